@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_EXT_BASE_EPOLL_TASK_RUNNER_H_
+#define INCLUDE_PERFETTO_EXT_BASE_EPOLL_TASK_RUNNER_H_
+
+#include "perfetto/base/build_config.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "perfetto/base/task_runner.h"
+#include "perfetto/base/thread_utils.h"
+#include "perfetto/ext/base/event_fd.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/thread_checker.h"
+#include "perfetto/ext/base/timing_wheel.h"
+
+namespace perfetto {
+namespace base {
+
+// A drop-in replacement of UnixTaskRunner for Linux and Android, meant for
+// task runners with many delayed tasks and file descriptor watches:
+// - Delayed tasks are kept in a TimingWheel rather than in a sorted map, so
+//   posting one and finding the next one to run are O(1).
+// - File descriptors are watched with epoll. Adding or removing a watch is a
+//   single epoll_ctl(), rather than a rebuild of the whole poll(2) set on the
+//   next iteration, and doesn't wake up the task runner.
+// - Posting a delayed task wakes up the task runner only if the task has to
+//   run before the time the task runner is going to wake up at.
+//
+// Tasks run in the same order as with UnixTaskRunner: immediate, delayed and
+// file descriptor watch tasks are interleaved, and delayed tasks with the same
+// deadline run in the order they were posted.
+class EpollTaskRunner : public TaskRunner {
+ public:
+  EpollTaskRunner();
+  ~EpollTaskRunner() override;
+
+  // Start executing tasks. Doesn't return until Quit() is called. Run() may be
+  // called multiple times on the same task runner.
+  void Run();
+  void Quit();
+
+  // Checks whether there are any pending immediate tasks to run. Note that
+  // delayed tasks don't count even if they are due to run.
+  bool IsIdleForTesting();
+
+  // TaskRunner implementation:
+  void PostTask(std::function<void()>) override;
+  void PostDelayedTask(std::function<void()>, uint32_t delay_ms) override;
+  void AddFileDescriptorWatch(PlatformHandle, std::function<void()>) override;
+  void RemoveFileDescriptorWatch(PlatformHandle) override;
+  bool RunsTasksOnCurrentThread() const override;
+
+  // Returns true if the task runner is quitting, or has quit and hasn't been
+  // restarted since.
+  bool QuitCalled();
+
+ private:
+  struct WatchTask {
+    std::function<void()> callback;
+    // Tells apart the watches of the same fd, so that the events and the
+    // tasks of a removed watch are ignored.
+    uint32_t generation;
+    // False for the fds that epoll doesn't support, e.g. regular files. Like
+    // with poll(2), they are always ready.
+    bool epoll_registered;
+  };
+
+  void WakeUp();
+  int GetDelayMsToNextTaskLocked();
+  void RunImmediateAndDelayedTask();
+  void PostFileDescriptorWatches(int num_events);
+  void RunFileDescriptorWatch(PlatformHandle, uint32_t generation);
+
+  // Makes epoll report the next event on the fd of |watch_task|, with
+  // |epoll_op| EPOLL_CTL_ADD or EPOLL_CTL_MOD.
+  void ArmWatchLocked(PlatformHandle, WatchTask* watch_task, int epoll_op);
+
+  ThreadChecker thread_checker_;
+  PlatformThreadId created_thread_id_ = GetThreadId();
+
+  ScopedFile epoll_fd_;
+  EventFd event_;
+  std::vector<struct epoll_event> events_;
+
+  // --- Begin lock-protected members ---
+
+  std::mutex lock_;
+
+  std::deque<std::function<void()>> immediate_tasks_;
+  TimingWheel delayed_tasks_;
+  bool quit_ = false;
+
+  // The time the task runner wakes up at, if nothing else happens, or
+  // TimingWheel::kNoExpiry.
+  uint64_t wake_up_time_ms_ = 0;
+
+  std::map<PlatformHandle, WatchTask> watch_tasks_;
+  uint32_t next_generation_ = 0;
+
+  // --- End lock-protected members ---
+};
+
+}  // namespace base
+}  // namespace perfetto
+
+#endif  // OS_LINUX || OS_ANDROID
+
+#endif  // INCLUDE_PERFETTO_EXT_BASE_EPOLL_TASK_RUNNER_H_
@@ -46,7 +46,7 @@ enum Tags : uint32_t {
   F(FTRACE_UNBLOCK_READERS), /*unused*/ \
   F(FTRACE_CPU_READ_NONBLOCK), /*unused*/ \
   F(FTRACE_CPU_READ_BLOCK), /*unused*/ \
-  F(FTRACE_CPU_SPLICE_NONBLOCK), /*unused*/ \
+  F(FTRACE_CPU_SPLICE_NONBLOCK), \
   F(FTRACE_CPU_SPLICE_BLOCK), /*unused*/ \
   F(FTRACE_CPU_WAIT_CMD), /*unused*/ \
   F(FTRACE_CPU_RUN_CYCLE), /*unused*/ \
@@ -70,7 +70,8 @@ enum Tags : uint32_t {
   F(PROFILER_UNWIND_ATTEMPT), \
   F(PROFILER_MAPS_PARSE), \
   F(PROFILER_MAPS_REPARSE), \
-  F(PROFILER_UNWIND_CACHE_CLEAR)
+  F(PROFILER_UNWIND_CACHE_CLEAR), \
+  F(FTRACE_WATERMARK_READ)
 
 // Append only, see above.
 //
@@ -85,7 +86,8 @@ enum Tags : uint32_t {
   F(PS_PIDS_SCANNED), \
   F(TRACE_SERVICE_COMMIT_DATA), \
   F(PROFILER_UNWIND_QUEUE_SZ), \
-  F(PROFILER_UNWIND_CURRENT_PID)
+  F(PROFILER_UNWIND_CURRENT_PID), \
+  F(FTRACE_READ_SYSCALLS)
 
 // clang-format on
 
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_EXT_BASE_TIMING_WHEEL_H_
+#define INCLUDE_PERFETTO_EXT_BASE_TIMING_WHEEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace perfetto {
+namespace base {
+
+// A hierarchical timing wheel of tasks, keyed by their expiry time in ms.
+// Not thread safe.
+//
+// There are 4 levels of 256 slots. Level L holds the tasks that expire in the
+// same 2^(8 * (L + 1)) ms block as now, but not in the same 2^(8 * L) ms one,
+// in the slot given by bits [8 * L, 8 * L + 8) of their expiry. When the
+// time reaches the start of a slot of level L > 0, the tasks in it are moved
+// to the lower levels. Tasks that expire more than 2^32 ms (~50 days) away
+// are kept in a map until they get within range.
+//
+// Inserting a task is O(1). Each task is moved at most once per level, and
+// finding the next occupied slot is a bitmap lookup, so Advance() is
+// amortized O(1) per task, however far the time jumps.
+//
+// Tasks that expire at the same time become ready in insertion order.
+class TimingWheel {
+ public:
+  using Task = std::function<void()>;
+
+  static constexpr uint64_t kNoExpiry = UINT64_MAX;
+
+  explicit TimingWheel(uint64_t now_ms);
+  ~TimingWheel();
+
+  TimingWheel(const TimingWheel&) = delete;
+  TimingWheel& operator=(const TimingWheel&) = delete;
+
+  // Adds a task that becomes ready once Advance() reaches |expiry_ms|. Tasks
+  // that expire before the current time are ready right away.
+  void Insert(uint64_t expiry_ms, Task task);
+
+  // Moves the current time forward to |now_ms|, making ready all the tasks
+  // that expire at or before it. Does nothing if |now_ms| is in the past.
+  void Advance(uint64_t now_ms);
+
+  bool HasReadyTask() const { return !ready_.empty(); }
+
+  // Returns the oldest ready task. There must be one.
+  Task PopReadyTask();
+
+  // Returns the earliest expiry of the tasks that aren't ready yet, or
+  // kNoExpiry if there are none.
+  uint64_t NextExpiry();
+
+  uint64_t now_ms() const { return now_ms_; }
+
+  // Number of tasks, ready or not.
+  size_t size() const { return size_; }
+
+ private:
+  static constexpr uint32_t kLevels = 4;
+  static constexpr uint32_t kSlotBits = 8;
+  static constexpr uint32_t kSlots = 1 << kSlotBits;
+  static constexpr uint32_t kBitmapWords = kSlots / 64;
+
+  struct Entry {
+    uint64_t expiry_ms;
+    uint64_t seq;  // Insertion order, to break ties.
+    Task task;
+  };
+
+  // Adds |entry| to the wheel, or to |due_| if it expires now.
+  void Place(Entry entry);
+
+  // Moves |due_| to |ready_| in insertion order.
+  void MoveDueToReady();
+
+  // Returns the first occupied slot of |level| after the current one, or
+  // kSlots if there is none.
+  uint32_t NextOccupiedSlot(uint32_t level) const;
+
+  // Returns the time at which the wheel next needs to do something: a level 0
+  // slot to expire, or a higher level slot or the overflow map to move down.
+  // kNoExpiry if the wheel is empty.
+  uint64_t NextEventTime() const;
+
+  // Handles the event at NextEventTime(), which must be |now_ms_|.
+  void RunEvent();
+
+  uint64_t now_ms_;
+  uint64_t next_seq_ = 0;
+  size_t size_ = 0;
+  uint64_t cached_next_expiry_ = kNoExpiry;
+  bool next_expiry_valid_ = true;
+
+  std::vector<Entry> slots_[kLevels][kSlots];
+  uint64_t occupied_[kLevels][kBitmapWords]{};
+  // Keyed by {expiry_ms, seq}.
+  std::map<std::pair<uint64_t, uint64_t>, Task> overflow_;
+  std::deque<Task> ready_;
+
+  // Reused across Advance() calls to avoid reallocations.
+  std::vector<Entry> due_;
+  std::vector<Entry> scratch_;
+};
+
+}  // namespace base
+}  // namespace perfetto
+
+#endif  // INCLUDE_PERFETTO_EXT_BASE_TIMING_WHEEL_H_
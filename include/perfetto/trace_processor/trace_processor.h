@@ -100,6 +100,16 @@ class PERFETTO_EXPORT_COMPONENT TraceProcessor : public TraceProcessorStorage {
   // by the ingestion process. Returns the number of table/views deleted.
   virtual size_t RestoreInitialTables() = 0;
 
+  // Writes a snapshot of all the tables built from the trace to |path|. The
+  // snapshot can be loaded back like any other trace file (e.g. with Parse()
+  // or trace_processor_shell) and skips all the parsing and sorting.
+  // Must be called after NotifyEndOfFile().
+  virtual base::Status SaveSnapshot(const std::string& path) = 0;
+
+  // Like SaveSnapshot() but writes the snapshot to |snapshot| instead of a
+  // file, e.g. to send it over RPC.
+  virtual base::Status SaveSnapshotToBuffer(std::vector<uint8_t>* snapshot) = 0;
+
   // Sets/returns the name of the currently loaded trace or an empty string if
   // no trace is fully loaded yet. This has no effect on the Trace Processor
   // functionality and is used for UI purposes only.
@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/base/build_config.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+
+#include "perfetto/ext/base/epoll_task_runner.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <sys/epoll.h>
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/time.h"
+#include "perfetto/ext/base/utils.h"
+#include "perfetto/ext/base/watchdog.h"
+
+namespace perfetto {
+namespace base {
+
+namespace {
+
+// Max number of events returned by one epoll_wait(). The others are returned
+// by the next calls.
+constexpr size_t kMaxEvents = 64;
+
+// The epoll data of |event_|. The data of the watched fds is made of the fd
+// and the generation of the watch, see EpollData().
+constexpr uint64_t kWakeUpEventData = UINT64_MAX;
+
+uint64_t EpollData(PlatformHandle fd, uint32_t generation) {
+  return (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
+}
+
+uint64_t NowMs() {
+  return static_cast<uint64_t>(GetWallTimeMs().count());
+}
+
+}  // namespace
+
+EpollTaskRunner::EpollTaskRunner()
+    : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+      events_(kMaxEvents),
+      delayed_tasks_(NowMs()) {
+  PERFETTO_CHECK(epoll_fd_);
+  struct epoll_event event {};
+  event.events = EPOLLIN;
+  event.data.u64 = kWakeUpEventData;
+  PERFETTO_CHECK(epoll_ctl(*epoll_fd_, EPOLL_CTL_ADD, event_.fd(), &event) ==
+                 0);
+}
+
+EpollTaskRunner::~EpollTaskRunner() = default;
+
+void EpollTaskRunner::WakeUp() {
+  event_.Notify();
+}
+
+void EpollTaskRunner::Run() {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  created_thread_id_ = GetThreadId();
+  quit_ = false;
+  for (;;) {
+    int timeout_ms;
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      if (quit_)
+        return;
+      timeout_ms = GetDelayMsToNextTaskLocked();
+    }
+
+    int ret = PERFETTO_EINTR(epoll_wait(*epoll_fd_, &events_[0],
+                                        static_cast<int>(events_.size()),
+                                        timeout_ms));
+    PERFETTO_CHECK(ret >= 0);
+    PostFileDescriptorWatches(ret);
+
+    // To avoid starvation we always interleave all types of tasks -- immediate,
+    // delayed and file descriptor watches.
+    RunImmediateAndDelayedTask();
+  }
+}
+
+void EpollTaskRunner::Quit() {
+  std::lock_guard<std::mutex> lock(lock_);
+  quit_ = true;
+  WakeUp();
+}
+
+bool EpollTaskRunner::QuitCalled() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return quit_;
+}
+
+bool EpollTaskRunner::IsIdleForTesting() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return immediate_tasks_.empty();
+}
+
+void EpollTaskRunner::RunImmediateAndDelayedTask() {
+  std::function<void()> immediate_task;
+  std::function<void()> delayed_task;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (!immediate_tasks_.empty()) {
+      immediate_task = std::move(immediate_tasks_.front());
+      immediate_tasks_.pop_front();
+    }
+    delayed_tasks_.Advance(NowMs());
+    if (delayed_tasks_.HasReadyTask())
+      delayed_task = delayed_tasks_.PopReadyTask();
+  }
+
+  errno = 0;
+  if (immediate_task)
+    RunTaskWithWatchdogGuard(immediate_task);
+  errno = 0;
+  if (delayed_task)
+    RunTaskWithWatchdogGuard(delayed_task);
+}
+
+void EpollTaskRunner::PostFileDescriptorWatches(int num_events) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  for (int i = 0; i < num_events; i++) {
+    uint64_t data = events_[static_cast<size_t>(i)].data.u64;
+
+    // The wake-up event is handled inline to avoid an infinite recursion of
+    // posted tasks.
+    if (data == kWakeUpEventData) {
+      event_.Clear();
+      continue;
+    }
+
+    // The fd is registered with EPOLLONESHOT, so epoll won't report it again
+    // until RunFileDescriptorWatch() re-arms it. Binding to |this| is safe
+    // since we are the only object executing the task.
+    PlatformHandle fd = static_cast<PlatformHandle>(data & UINT32_MAX);
+    uint32_t generation = static_cast<uint32_t>(data >> 32);
+    PostTask(std::bind(&EpollTaskRunner::RunFileDescriptorWatch, this, fd,
+                       generation));
+  }
+}
+
+void EpollTaskRunner::RunFileDescriptorWatch(PlatformHandle fd,
+                                             uint32_t generation) {
+  std::function<void()> task;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    auto it = watch_tasks_.find(fd);
+    // The watch may have been removed, or replaced, since the event.
+    if (it == watch_tasks_.end() || it->second.generation != generation)
+      return;
+    ArmWatchLocked(fd, &it->second, EPOLL_CTL_MOD);
+    task = it->second.callback;
+  }
+  errno = 0;
+  RunTaskWithWatchdogGuard(task);
+}
+
+void EpollTaskRunner::ArmWatchLocked(PlatformHandle fd,
+                                     WatchTask* watch_task,
+                                     int epoll_op) {
+  if (watch_task->epoll_registered) {
+    struct epoll_event event {};
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.u64 = EpollData(fd, watch_task->generation);
+    if (epoll_ctl(*epoll_fd_, epoll_op, fd, &event) == 0)
+      return;
+    // epoll doesn't support regular files and directories, which poll(2)
+    // always reports as readable. Do the same.
+    PERFETTO_CHECK(errno == EPERM && epoll_op == EPOLL_CTL_ADD);
+    watch_task->epoll_registered = false;
+  }
+  immediate_tasks_.push_back(std::bind(&EpollTaskRunner::RunFileDescriptorWatch,
+                                       this, fd, watch_task->generation));
+}
+
+int EpollTaskRunner::GetDelayMsToNextTaskLocked() {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  if (!immediate_tasks_.empty() || delayed_tasks_.HasReadyTask()) {
+    // Not going to sleep.
+    wake_up_time_ms_ = 0;
+    return 0;
+  }
+  wake_up_time_ms_ = delayed_tasks_.NextExpiry();
+  if (wake_up_time_ms_ == TimingWheel::kNoExpiry)
+    return -1;
+  uint64_t now_ms = NowMs();
+  if (wake_up_time_ms_ <= now_ms)
+    return 0;
+  return static_cast<int>(
+      std::min(wake_up_time_ms_ - now_ms, static_cast<uint64_t>(INT_MAX)));
+}
+
+void EpollTaskRunner::PostTask(std::function<void()> task) {
+  bool was_empty;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    was_empty = immediate_tasks_.empty();
+    immediate_tasks_.push_back(std::move(task));
+  }
+  if (was_empty)
+    WakeUp();
+}
+
+void EpollTaskRunner::PostDelayedTask(std::function<void()> task,
+                                      uint32_t delay_ms) {
+  bool wake_up = false;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    uint64_t expiry_ms = NowMs() + delay_ms;
+    delayed_tasks_.Insert(expiry_ms, std::move(task));
+    // Wake up only if the task runner is going to sleep past the task.
+    if (expiry_ms < wake_up_time_ms_) {
+      wake_up_time_ms_ = expiry_ms;
+      wake_up = true;
+    }
+  }
+  if (wake_up)
+    WakeUp();
+}
+
+void EpollTaskRunner::AddFileDescriptorWatch(PlatformHandle fd,
+                                             std::function<void()> task) {
+  PERFETTO_DCHECK(PlatformHandleChecker::IsValid(fd));
+  bool wake_up;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    PERFETTO_DCHECK(!watch_tasks_.count(fd));
+    WatchTask& watch_task = watch_tasks_[fd];
+    watch_task.callback = std::move(task);
+    watch_task.generation = next_generation_++;
+    watch_task.epoll_registered = true;
+    ArmWatchLocked(fd, &watch_task, EPOLL_CTL_ADD);
+    // epoll picks up the new fd by itself, but not the task posted for an fd
+    // that epoll doesn't support.
+    wake_up = !watch_task.epoll_registered;
+  }
+  if (wake_up)
+    WakeUp();
+}
+
+void EpollTaskRunner::RemoveFileDescriptorWatch(PlatformHandle fd) {
+  PERFETTO_DCHECK(PlatformHandleChecker::IsValid(fd));
+  std::lock_guard<std::mutex> lock(lock_);
+  auto it = watch_tasks_.find(fd);
+  PERFETTO_DCHECK(it != watch_tasks_.end());
+  if (it == watch_tasks_.end())
+    return;
+  // The fd may have been closed already. The events still pending for it are
+  // ignored in RunFileDescriptorWatch() as the watch is gone.
+  if (it->second.epoll_registered &&
+      epoll_ctl(*epoll_fd_, EPOLL_CTL_DEL, fd, nullptr) != 0) {
+    PERFETTO_DCHECK(errno == EBADF || errno == ENOENT);
+  }
+  watch_tasks_.erase(it);
+  // No need to schedule a wake-up for this.
+}
+
+bool EpollTaskRunner::RunsTasksOnCurrentThread() const {
+  return GetThreadId() == created_thread_id_;
+}
+
+}  // namespace base
+}  // namespace perfetto
+
+#endif  // OS_LINUX || OS_ANDROID
@@ -0,0 +1,139 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/ext/base/epoll_task_runner.h"
+#include "perfetto/ext/base/event_fd.h"
+#include "perfetto/ext/base/unix_task_runner.h"
+
+namespace {
+
+using perfetto::base::EventFd;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+// Arg 0: number of delayed tasks already pending, like the flush timeouts
+// and data source ticks of a busy traced.
+void DelayedTasksArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(64);
+  } else {
+    b->RangeMultiplier(16)->Range(16, 65536);
+  }
+}
+
+// Arg 0: number of idle file descriptors watched, like the producer sockets.
+void FdWatchesArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(16);
+  } else {
+    b->RangeMultiplier(4)->Range(4, 256);
+  }
+}
+
+// Posts tasks due in the next minute, which never run during the benchmark.
+template <typename TaskRunner>
+void PostPendingTasks(TaskRunner* task_runner,
+                      int num_tasks,
+                      std::minstd_rand0* rnd) {
+  for (int i = 0; i < num_tasks; i++)
+    task_runner->PostDelayedTask([] {}, 1000 + (*rnd)() % 60000);
+}
+
+// Measures the cost of PostDelayedTask() alone.
+template <typename TaskRunner>
+void BM_TaskRunnerPostDelayedTask(benchmark::State& state) {
+  // The posted tasks never run, so the task runner is recreated every
+  // |kPostsPerTaskRunner| iterations to keep the number of tasks in check.
+  static constexpr int kPostsPerTaskRunner = 1024;
+  const int num_pending_tasks = static_cast<int>(state.range(0));
+  std::minstd_rand0 rnd(0);
+  std::unique_ptr<TaskRunner> task_runner;
+  int posts = kPostsPerTaskRunner;
+  for (auto _ : state) {
+    if (posts++ == kPostsPerTaskRunner) {
+      state.PauseTiming();
+      task_runner.reset(new TaskRunner());
+      PostPendingTasks(task_runner.get(), num_pending_tasks, &rnd);
+      posts = 0;
+      state.ResumeTiming();
+    }
+    task_runner->PostDelayedTask([] {}, 1000 + rnd() % 60000);
+  }
+}
+
+// Measures the time from PostDelayedTask() to the task running, for a task
+// that is due right away.
+template <typename TaskRunner>
+void BM_TaskRunnerDispatchDelayedTask(benchmark::State& state) {
+  std::minstd_rand0 rnd(0);
+  TaskRunner task_runner;
+  PostPendingTasks(&task_runner, static_cast<int>(state.range(0)), &rnd);
+  for (auto _ : state) {
+    task_runner.PostDelayedTask([&task_runner] { task_runner.Quit(); }, 0);
+    task_runner.Run();
+  }
+}
+
+// Measures adding and removing a watch, and running a task, while other
+// file descriptors are watched.
+template <typename TaskRunner>
+void BM_TaskRunnerFdWatchChurn(benchmark::State& state) {
+  TaskRunner task_runner;
+  std::vector<EventFd> idle_fds(static_cast<size_t>(state.range(0)));
+  for (EventFd& evt : idle_fds)
+    task_runner.AddFileDescriptorWatch(evt.fd(), [] {});
+  EventFd evt;
+  for (auto _ : state) {
+    task_runner.AddFileDescriptorWatch(evt.fd(), [] {});
+    task_runner.RemoveFileDescriptorWatch(evt.fd());
+    task_runner.PostTask([&task_runner] { task_runner.Quit(); });
+    task_runner.Run();
+  }
+  for (EventFd& idle_evt : idle_fds)
+    task_runner.RemoveFileDescriptorWatch(idle_evt.fd());
+}
+
+}  // namespace
+
+using perfetto::base::UnixTaskRunner;
+
+BENCHMARK_TEMPLATE(BM_TaskRunnerPostDelayedTask, UnixTaskRunner)
+    ->Apply(DelayedTasksArgs);
+BENCHMARK_TEMPLATE(BM_TaskRunnerDispatchDelayedTask, UnixTaskRunner)
+    ->Apply(DelayedTasksArgs);
+BENCHMARK_TEMPLATE(BM_TaskRunnerFdWatchChurn, UnixTaskRunner)
+    ->Apply(FdWatchesArgs);
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+using perfetto::base::EpollTaskRunner;
+
+BENCHMARK_TEMPLATE(BM_TaskRunnerPostDelayedTask, EpollTaskRunner)
+    ->Apply(DelayedTasksArgs);
+BENCHMARK_TEMPLATE(BM_TaskRunnerDispatchDelayedTask, EpollTaskRunner)
+    ->Apply(DelayedTasksArgs);
+BENCHMARK_TEMPLATE(BM_TaskRunnerFdWatchChurn, EpollTaskRunner)
+    ->Apply(FdWatchesArgs);
+#endif
@@ -20,10 +20,12 @@
 
 #include <thread>
 
+#include "perfetto/ext/base/epoll_task_runner.h"
 #include "perfetto/ext/base/event_fd.h"
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/pipe.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/temp_file.h"
 #include "perfetto/ext/base/utils.h"
 #include "src/base/test/gtest_test_suite.h"
 #include "test/gtest_and_gmock.h"
@@ -32,12 +34,21 @@ namespace perfetto {
 namespace base {
 namespace {
 
+template <typename T>
 class TaskRunnerTest : public ::testing::Test {
  public:
-  UnixTaskRunner task_runner;
+  T task_runner;
 };
 
-TEST_F(TaskRunnerTest, PostImmediateTask) {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+using TaskRunnerTypes = ::testing::Types<UnixTaskRunner, EpollTaskRunner>;
+#else
+using TaskRunnerTypes = ::testing::Types<UnixTaskRunner>;
+#endif
+TYPED_TEST_SUITE(TaskRunnerTest, TaskRunnerTypes);
+
+TYPED_TEST(TaskRunnerTest, PostImmediateTask) {
   auto& task_runner = this->task_runner;
   int counter = 0;
   task_runner.PostTask([&counter] { counter = (counter << 4) | 1; });
@@ -49,7 +60,7 @@ TEST_F(TaskRunnerTest, PostImmediateTask) {
   EXPECT_EQ(0x1234, counter);
 }
 
-TEST_F(TaskRunnerTest, PostDelayedTask) {
+TYPED_TEST(TaskRunnerTest, PostDelayedTask) {
   auto& task_runner = this->task_runner;
   int counter = 0;
   task_runner.PostDelayedTask([&counter] { counter = (counter << 4) | 1; }, 5);
@@ -61,7 +72,7 @@ TEST_F(TaskRunnerTest, PostDelayedTask) {
   EXPECT_EQ(0x1234, counter);
 }
 
-TEST_F(TaskRunnerTest, PostImmediateTaskFromTask) {
+TYPED_TEST(TaskRunnerTest, PostImmediateTaskFromTask) {
   auto& task_runner = this->task_runner;
   task_runner.PostTask([&task_runner] {
     task_runner.PostTask([&task_runner] { task_runner.Quit(); });
@@ -69,7 +80,7 @@ TEST_F(TaskRunnerTest, PostImmediateTaskFromTask) {
   task_runner.Run();
 }
 
-TEST_F(TaskRunnerTest, PostDelayedTaskFromTask) {
+TYPED_TEST(TaskRunnerTest, PostDelayedTaskFromTask) {
   auto& task_runner = this->task_runner;
   task_runner.PostTask([&task_runner] {
     task_runner.PostDelayedTask([&task_runner] { task_runner.Quit(); }, 10);
@@ -77,7 +88,7 @@ TEST_F(TaskRunnerTest, PostDelayedTaskFromTask) {
   task_runner.Run();
 }
 
-TEST_F(TaskRunnerTest, PostImmediateTaskFromOtherThread) {
+TYPED_TEST(TaskRunnerTest, PostImmediateTaskFromOtherThread) {
   auto& task_runner = this->task_runner;
   ThreadChecker thread_checker;
   int counter = 0;
@@ -96,7 +107,7 @@ TEST_F(TaskRunnerTest, PostImmediateTaskFromOtherThread) {
   EXPECT_EQ(0x1234, counter);
 }
 
-TEST_F(TaskRunnerTest, PostDelayedTaskFromOtherThread) {
+TYPED_TEST(TaskRunnerTest, PostDelayedTaskFromOtherThread) {
   auto& task_runner = this->task_runner;
   std::thread thread([&task_runner] {
     task_runner.PostDelayedTask([&task_runner] { task_runner.Quit(); }, 10);
@@ -105,7 +116,7 @@ TEST_F(TaskRunnerTest, PostDelayedTaskFromOtherThread) {
   thread.join();
 }
 
-TEST_F(TaskRunnerTest, AddFileDescriptorWatch) {
+TYPED_TEST(TaskRunnerTest, AddFileDescriptorWatch) {
   auto& task_runner = this->task_runner;
   EventFd evt;
   task_runner.AddFileDescriptorWatch(evt.fd(),
@@ -114,7 +125,7 @@ TEST_F(TaskRunnerTest, AddFileDescriptorWatch) {
   task_runner.Run();
 }
 
-TEST_F(TaskRunnerTest, RemoveFileDescriptorWatch) {
+TYPED_TEST(TaskRunnerTest, RemoveFileDescriptorWatch) {
   auto& task_runner = this->task_runner;
   EventFd evt;
   evt.Notify();
@@ -129,7 +140,7 @@ TEST_F(TaskRunnerTest, RemoveFileDescriptorWatch) {
   EXPECT_FALSE(watch_ran);
 }
 
-TEST_F(TaskRunnerTest, RemoveFileDescriptorWatchFromTask) {
+TYPED_TEST(TaskRunnerTest, RemoveFileDescriptorWatchFromTask) {
   auto& task_runner = this->task_runner;
   EventFd evt;
   evt.Notify();
@@ -146,7 +157,7 @@ TEST_F(TaskRunnerTest, RemoveFileDescriptorWatchFromTask) {
   EXPECT_FALSE(watch_ran);
 }
 
-TEST_F(TaskRunnerTest, AddFileDescriptorWatchFromAnotherWatch) {
+TYPED_TEST(TaskRunnerTest, AddFileDescriptorWatchFromAnotherWatch) {
   auto& task_runner = this->task_runner;
   EventFd evt;
   EventFd evt2;
@@ -160,7 +171,7 @@ TEST_F(TaskRunnerTest, AddFileDescriptorWatchFromAnotherWatch) {
   task_runner.Run();
 }
 
-TEST_F(TaskRunnerTest, RemoveFileDescriptorWatchFromAnotherWatch) {
+TYPED_TEST(TaskRunnerTest, RemoveFileDescriptorWatchFromAnotherWatch) {
   auto& task_runner = this->task_runner;
   EventFd evt;
   EventFd evt2;
@@ -180,7 +191,7 @@ TEST_F(TaskRunnerTest, RemoveFileDescriptorWatchFromAnotherWatch) {
   EXPECT_FALSE(watch_ran);
 }
 
-TEST_F(TaskRunnerTest, ReplaceFileDescriptorWatchFromAnotherWatch) {
+TYPED_TEST(TaskRunnerTest, ReplaceFileDescriptorWatchFromAnotherWatch) {
   auto& task_runner = this->task_runner;
   EventFd evt;
   EventFd evt2;
@@ -201,7 +212,7 @@ TEST_F(TaskRunnerTest, ReplaceFileDescriptorWatchFromAnotherWatch) {
   EXPECT_FALSE(watch_ran);
 }
 
-TEST_F(TaskRunnerTest, AddFileDescriptorWatchFromAnotherThread) {
+TYPED_TEST(TaskRunnerTest, AddFileDescriptorWatchFromAnotherThread) {
   auto& task_runner = this->task_runner;
   EventFd evt;
   evt.Notify();
@@ -214,7 +225,7 @@ TEST_F(TaskRunnerTest, AddFileDescriptorWatchFromAnotherThread) {
   thread.join();
 }
 
-TEST_F(TaskRunnerTest, FileDescriptorWatchWithMultipleEvents) {
+TYPED_TEST(TaskRunnerTest, FileDescriptorWatchWithMultipleEvents) {
   auto& task_runner = this->task_runner;
   EventFd evt;
   evt.Notify();
@@ -233,7 +244,7 @@ TEST_F(TaskRunnerTest, FileDescriptorWatchWithMultipleEvents) {
   task_runner.Run();
 }
 
-TEST_F(TaskRunnerTest, PostManyDelayedTasks) {
+TYPED_TEST(TaskRunnerTest, PostManyDelayedTasks) {
   // Check that PostTask doesn't start failing if there are too many scheduled
   // wake-ups.
   auto& task_runner = this->task_runner;
@@ -243,7 +254,7 @@ TEST_F(TaskRunnerTest, PostManyDelayedTasks) {
   task_runner.Run();
 }
 
-TEST_F(TaskRunnerTest, RunAgain) {
+TYPED_TEST(TaskRunnerTest, RunAgain) {
   auto& task_runner = this->task_runner;
   int counter = 0;
   task_runner.PostTask([&task_runner, &counter] {
@@ -259,31 +270,33 @@ TEST_F(TaskRunnerTest, RunAgain) {
   EXPECT_EQ(2, counter);
 }
 
-void RepeatingTask(UnixTaskRunner* task_runner) {
-  task_runner->PostTask(std::bind(&RepeatingTask, task_runner));
+template <typename T>
+void RepeatingTask(T* task_runner) {
+  task_runner->PostTask(std::bind(&RepeatingTask<T>, task_runner));
 }
 
-TEST_F(TaskRunnerTest, FileDescriptorWatchesNotStarved) {
+TYPED_TEST(TaskRunnerTest, FileDescriptorWatchesNotStarved) {
   auto& task_runner = this->task_runner;
   EventFd evt;
   evt.Notify();
 
-  task_runner.PostTask(std::bind(&RepeatingTask, &task_runner));
+  task_runner.PostTask(std::bind(&RepeatingTask<TypeParam>, &task_runner));
   task_runner.AddFileDescriptorWatch(evt.fd(),
                                      [&task_runner] { task_runner.Quit(); });
   task_runner.Run();
 }
 
-void CountdownTask(UnixTaskRunner* task_runner, int* counter) {
+template <typename T>
+void CountdownTask(T* task_runner, int* counter) {
   if (!--(*counter)) {
     task_runner->Quit();
     return;
   }
-  task_runner->PostDelayedTask(std::bind(&CountdownTask, task_runner, counter),
-                               1);
+  task_runner->PostDelayedTask(
+      std::bind(&CountdownTask<T>, task_runner, counter), 1);
 }
 
-TEST_F(TaskRunnerTest, NoDuplicateFileDescriptorWatchCallbacks) {
+TYPED_TEST(TaskRunnerTest, NoDuplicateFileDescriptorWatchCallbacks) {
   auto& task_runner = this->task_runner;
   EventFd evt;
   evt.Notify();
@@ -295,11 +308,12 @@ TEST_F(TaskRunnerTest, NoDuplicateFileDescriptorWatchCallbacks) {
     evt.Clear();
     watch_called = true;
   });
-  task_runner.PostTask(std::bind(&CountdownTask, &task_runner, &counter));
+  task_runner.PostTask(
+      std::bind(&CountdownTask<TypeParam>, &task_runner, &counter));
   task_runner.Run();
 }
 
-TEST_F(TaskRunnerTest, ReplaceFileDescriptorWatchFromOtherThread) {
+TYPED_TEST(TaskRunnerTest, ReplaceFileDescriptorWatchFromOtherThread) {
   auto& task_runner = this->task_runner;
   EventFd evt;
   evt.Notify();
@@ -319,7 +333,7 @@ TEST_F(TaskRunnerTest, ReplaceFileDescriptorWatchFromOtherThread) {
   thread.join();
 }
 
-TEST_F(TaskRunnerTest, IsIdleForTesting) {
+TYPED_TEST(TaskRunnerTest, IsIdleForTesting) {
   auto& task_runner = this->task_runner;
   task_runner.PostTask(
       [&task_runner] { EXPECT_FALSE(task_runner.IsIdleForTesting()); });
@@ -330,7 +344,7 @@ TEST_F(TaskRunnerTest, IsIdleForTesting) {
   task_runner.Run();
 }
 
-TEST_F(TaskRunnerTest, RunsTasksOnCurrentThread) {
+TYPED_TEST(TaskRunnerTest, RunsTasksOnCurrentThread) {
   auto& main_tr = this->task_runner;
 
   EXPECT_TRUE(main_tr.RunsTasksOnCurrentThread());
@@ -346,7 +360,7 @@ TEST_F(TaskRunnerTest, RunsTasksOnCurrentThread) {
   thread.join();
 }
 
-TEST_F(TaskRunnerTest, FileDescriptorWatchFairness) {
+TYPED_TEST(TaskRunnerTest, FileDescriptorWatchFairness) {
   auto& task_runner = this->task_runner;
   EventFd evt[5];
   std::map<PlatformHandle, int /*num_tasks*/> num_tasks;
@@ -372,10 +386,48 @@ TEST_F(TaskRunnerTest, FileDescriptorWatchFairness) {
   }
 }
 
+TYPED_TEST(TaskRunnerTest, PostEarlierDelayedTaskFromOtherThread) {
+  auto& task_runner = this->task_runner;
+  // The task runner sleeps until this task is due...
+  task_runner.PostDelayedTask([] { ADD_FAILURE(); }, 3600 * 1000);
+  // ...and has to wake up for this one, which is due much earlier.
+  std::thread thread([&task_runner] {
+    task_runner.PostDelayedTask([&task_runner] { task_runner.Quit(); }, 10);
+  });
+  task_runner.Run();
+  thread.join();
+}
+
 #if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
 
+// poll(2) always reports regular files as readable, while epoll doesn't
+// support them at all.
+TYPED_TEST(TaskRunnerTest, FileDescriptorWatchOnRegularFile) {
+  auto& task_runner = this->task_runner;
+  TempFile file = TempFile::Create();
+  int event_count = 0;
+  task_runner.AddFileDescriptorWatch(file.fd(), [&task_runner, &event_count] {
+    if (++event_count == 3)
+      task_runner.Quit();
+  });
+  task_runner.Run();
+  task_runner.RemoveFileDescriptorWatch(file.fd());
+  EXPECT_EQ(event_count, 3);
+}
+
+TYPED_TEST(TaskRunnerTest, RemoveFileDescriptorWatchAfterClose) {
+  auto& task_runner = this->task_runner;
+  Pipe pipe = Pipe::Create();
+  PlatformHandle fd = pipe.rd.get();
+  task_runner.AddFileDescriptorWatch(fd, [] { ADD_FAILURE(); });
+  pipe.rd.reset();
+  task_runner.RemoveFileDescriptorWatch(fd);
+  task_runner.PostDelayedTask([&task_runner] { task_runner.Quit(); }, 10);
+  task_runner.Run();
+}
+
 // This tests UNIX-specific behavior on pipe closure.
-TEST_F(TaskRunnerTest, FileDescriptorClosedEvent) {
+TYPED_TEST(TaskRunnerTest, FileDescriptorClosedEvent) {
   auto& task_runner = this->task_runner;
   Pipe pipe = Pipe::Create();
   pipe.wr.reset();
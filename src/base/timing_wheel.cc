@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/ext/base/timing_wheel.h"
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+
+#if !defined(__GNUC__) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace perfetto {
+namespace base {
+
+namespace {
+
+// Returns the index of the lowest set bit of |word|. |word| must not be zero.
+inline uint32_t IndexOfLowestSetBit(uint64_t word) {
+  PERFETTO_DCHECK(word != 0);
+#if defined(__GNUC__) || defined(__clang__)
+  return static_cast<uint32_t>(__builtin_ctzll(word));
+#else
+  unsigned long idx;
+  _BitScanForward64(&idx, word);
+  return static_cast<uint32_t>(idx);
+#endif
+}
+
+}  // namespace
+
+// static
+constexpr uint64_t TimingWheel::kNoExpiry;
+
+TimingWheel::TimingWheel(uint64_t now_ms) : now_ms_(now_ms) {}
+
+TimingWheel::~TimingWheel() = default;
+
+void TimingWheel::Insert(uint64_t expiry_ms, Task task) {
+  size_++;
+  if (expiry_ms <= now_ms_) {
+    // Tasks are inserted in order, so there is no need to go through |due_|.
+    ready_.push_back(std::move(task));
+    return;
+  }
+  if (next_expiry_valid_)
+    cached_next_expiry_ = std::min(cached_next_expiry_, expiry_ms);
+  Place(Entry{expiry_ms, next_seq_++, std::move(task)});
+}
+
+void TimingWheel::Place(Entry entry) {
+  if (entry.expiry_ms <= now_ms_) {
+    due_.push_back(std::move(entry));
+    return;
+  }
+  for (uint32_t level = 0; level < kLevels; level++) {
+    uint32_t block_shift = kSlotBits * (level + 1);
+    if ((entry.expiry_ms >> block_shift) != (now_ms_ >> block_shift))
+      continue;
+    // As the expiry is after now and in the same block, the slot is always
+    // after the current one of the level.
+    uint32_t slot = (entry.expiry_ms >> (kSlotBits * level)) & (kSlots - 1);
+    occupied_[level][slot / 64] |= 1ull << (slot % 64);
+    slots_[level][slot].push_back(std::move(entry));
+    return;
+  }
+  uint64_t seq = entry.seq;
+  overflow_.emplace(std::make_pair(entry.expiry_ms, seq),
+                    std::move(entry.task));
+}
+
+uint32_t TimingWheel::NextOccupiedSlot(uint32_t level) const {
+  uint32_t start = ((now_ms_ >> (kSlotBits * level)) & (kSlots - 1)) + 1;
+  for (uint32_t word_idx = start / 64; word_idx < kBitmapWords; word_idx++) {
+    uint64_t word = occupied_[level][word_idx];
+    if (word_idx == start / 64)
+      word &= ~0ull << (start % 64);
+    if (word)
+      return word_idx * 64 + IndexOfLowestSetBit(word);
+  }
+  return kSlots;
+}
+
+uint64_t TimingWheel::NextEventTime() const {
+  // The events of a level all come before the ones of the higher levels.
+  for (uint32_t level = 0; level < kLevels; level++) {
+    uint32_t slot = NextOccupiedSlot(level);
+    if (slot == kSlots)
+      continue;
+    uint32_t block_shift = kSlotBits * (level + 1);
+    uint64_t block_start = (now_ms_ >> block_shift) << block_shift;
+    return block_start | (static_cast<uint64_t>(slot) << (kSlotBits * level));
+  }
+  if (!overflow_.empty()) {
+    uint32_t block_shift = kSlotBits * kLevels;
+    return (overflow_.begin()->first.first >> block_shift) << block_shift;
+  }
+  return kNoExpiry;
+}
+
+void TimingWheel::RunEvent() {
+  for (uint32_t level = 0; level < kLevels; level++) {
+    uint32_t slot = (now_ms_ >> (kSlotBits * level)) & (kSlots - 1);
+    uint64_t& word = occupied_[level][slot / 64];
+    uint64_t bit = 1ull << (slot % 64);
+    if (!(word & bit))
+      continue;
+    word &= ~bit;
+    // Swapping keeps the capacity of both vectors around.
+    PERFETTO_DCHECK(scratch_.empty());
+    scratch_.swap(slots_[level][slot]);
+    for (Entry& entry : scratch_)
+      Place(std::move(entry));
+    scratch_.clear();
+    return;
+  }
+
+  // All the levels are empty: move down the overflowed tasks that are now in
+  // range.
+  uint32_t block_shift = kSlotBits * kLevels;
+  while (!overflow_.empty()) {
+    auto it = overflow_.begin();
+    if ((it->first.first >> block_shift) != (now_ms_ >> block_shift))
+      break;
+    Place(Entry{it->first.first, it->first.second, std::move(it->second)});
+    overflow_.erase(it);
+  }
+}
+
+void TimingWheel::MoveDueToReady() {
+  std::sort(due_.begin(), due_.end(), [](const Entry& a, const Entry& b) {
+    return a.seq < b.seq;
+  });
+  for (Entry& entry : due_)
+    ready_.push_back(std::move(entry.task));
+  due_.clear();
+}
+
+void TimingWheel::Advance(uint64_t now_ms) {
+  if (now_ms <= now_ms_)
+    return;
+  // Jump from one event to the next rather than visiting every ms.
+  for (;;) {
+    uint64_t event_time = NextEventTime();
+    if (event_time > now_ms)
+      break;
+    now_ms_ = event_time;
+    RunEvent();
+    // All the tasks in |due_| expire at |now_ms_|, so the ones of later
+    // events come after them.
+    MoveDueToReady();
+    next_expiry_valid_ = false;
+  }
+  now_ms_ = now_ms;
+}
+
+TimingWheel::Task TimingWheel::PopReadyTask() {
+  PERFETTO_DCHECK(!ready_.empty());
+  Task task = std::move(ready_.front());
+  ready_.pop_front();
+  size_--;
+  return task;
+}
+
+uint64_t TimingWheel::NextExpiry() {
+  if (next_expiry_valid_)
+    return cached_next_expiry_;
+  uint64_t next_expiry = kNoExpiry;
+  // The tasks of the first occupied slot of the lowest non-empty level expire
+  // before all the other ones.
+  for (uint32_t level = 0; level < kLevels; level++) {
+    uint32_t slot = NextOccupiedSlot(level);
+    if (slot == kSlots)
+      continue;
+    for (const Entry& entry : slots_[level][slot])
+      next_expiry = std::min(next_expiry, entry.expiry_ms);
+    break;
+  }
+  if (next_expiry == kNoExpiry && !overflow_.empty())
+    next_expiry = overflow_.begin()->first.first;
+  cached_next_expiry_ = next_expiry;
+  next_expiry_valid_ = true;
+  return next_expiry;
+}
+
+}  // namespace base
+}  // namespace perfetto
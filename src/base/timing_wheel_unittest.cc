@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/ext/base/timing_wheel.h"
+
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace base {
+namespace {
+
+using ::testing::ElementsAre;
+
+// Runs the ready tasks and returns the ids they added to |ran|.
+std::vector<int> PopReadyTasks(TimingWheel* wheel, std::vector<int>* ran) {
+  ran->clear();
+  while (wheel->HasReadyTask())
+    wheel->PopReadyTask()();
+  return *ran;
+}
+
+TEST(TimingWheelTest, Empty) {
+  TimingWheel wheel(1000);
+  EXPECT_EQ(wheel.size(), 0u);
+  EXPECT_EQ(wheel.NextExpiry(), TimingWheel::kNoExpiry);
+  wheel.Advance(100000);
+  EXPECT_FALSE(wheel.HasReadyTask());
+  EXPECT_EQ(wheel.now_ms(), 100000u);
+}
+
+TEST(TimingWheelTest, ExpiresInOrder) {
+  TimingWheel wheel(1000);
+  std::vector<int> ran;
+  wheel.Insert(1010, [&ran] { ran.push_back(2); });
+  wheel.Insert(1005, [&ran] { ran.push_back(1); });
+  wheel.Insert(1015, [&ran] { ran.push_back(3); });
+  wheel.Insert(1015, [&ran] { ran.push_back(4); });
+  EXPECT_EQ(wheel.size(), 4u);
+  EXPECT_EQ(wheel.NextExpiry(), 1005u);
+
+  wheel.Advance(1004);
+  EXPECT_FALSE(wheel.HasReadyTask());
+  wheel.Advance(1005);
+  EXPECT_THAT(PopReadyTasks(&wheel, &ran), ElementsAre(1));
+  EXPECT_EQ(wheel.NextExpiry(), 1010u);
+
+  wheel.Advance(2000);
+  EXPECT_THAT(PopReadyTasks(&wheel, &ran), ElementsAre(2, 3, 4));
+  EXPECT_EQ(wheel.size(), 0u);
+  EXPECT_EQ(wheel.NextExpiry(), TimingWheel::kNoExpiry);
+}
+
+TEST(TimingWheelTest, PastExpiryIsReady) {
+  TimingWheel wheel(1000);
+  std::vector<int> ran;
+  wheel.Insert(1000, [&ran] { ran.push_back(1); });
+  wheel.Insert(10, [&ran] { ran.push_back(2); });
+  EXPECT_EQ(wheel.NextExpiry(), TimingWheel::kNoExpiry);
+  EXPECT_THAT(PopReadyTasks(&wheel, &ran), ElementsAre(1, 2));
+}
+
+TEST(TimingWheelTest, SameExpiryAcrossLevels) {
+  // The first task is inserted far away from its expiry, in a high level,
+  // the other two close to it. They must still run in insertion order.
+  TimingWheel wheel(0);
+  std::vector<int> ran;
+  const uint64_t kExpiry = 0x12345678;
+  wheel.Insert(kExpiry, [&ran] { ran.push_back(1); });
+  wheel.Advance(kExpiry - 0x10000);
+  wheel.Insert(kExpiry, [&ran] { ran.push_back(2); });
+  wheel.Advance(kExpiry - 3);
+  wheel.Insert(kExpiry, [&ran] { ran.push_back(3); });
+  EXPECT_FALSE(wheel.HasReadyTask());
+  EXPECT_EQ(wheel.NextExpiry(), kExpiry);
+  wheel.Advance(kExpiry);
+  EXPECT_THAT(PopReadyTasks(&wheel, &ran), ElementsAre(1, 2, 3));
+}
+
+TEST(TimingWheelTest, Overflow) {
+  TimingWheel wheel(0xffffff00);
+  std::vector<int> ran;
+  // Both in the next 2^32 ms block.
+  wheel.Insert(0x100000010, [&ran] { ran.push_back(2); });
+  wheel.Insert(0x200000000, [&ran] { ran.push_back(3); });
+  wheel.Insert(0xffffff10, [&ran] { ran.push_back(1); });
+  EXPECT_EQ(wheel.NextExpiry(), 0xffffff10u);
+
+  wheel.Advance(0x100000000);
+  EXPECT_THAT(PopReadyTasks(&wheel, &ran), ElementsAre(1));
+  EXPECT_EQ(wheel.NextExpiry(), 0x100000010u);
+  wheel.Advance(0x100000010);
+  EXPECT_THAT(PopReadyTasks(&wheel, &ran), ElementsAre(2));
+  EXPECT_EQ(wheel.NextExpiry(), 0x200000000u);
+  wheel.Advance(0x1ffffffff);
+  EXPECT_FALSE(wheel.HasReadyTask());
+  wheel.Advance(0x200000000);
+  EXPECT_THAT(PopReadyTasks(&wheel, &ran), ElementsAre(3));
+}
+
+TEST(TimingWheelTest, MatchesMultimap) {
+  // Inserts tasks with random delays while moving the time forward in random
+  // steps, and checks that they run in the same order as with a multimap.
+  std::minstd_rand0 rnd(0);
+  uint64_t now = 0xfff00000;
+  TimingWheel wheel(now);
+  std::multimap<uint64_t, int> expected_tasks;
+  std::vector<int> ran;
+  std::vector<int> expected;
+  int next_id = 0;
+  for (int i = 0; i < 5000; i++) {
+    for (int j = rnd() % 4; j > 0; j--) {
+      uint64_t delay;
+      switch (rnd() % 4) {
+        case 0:
+          delay = rnd() % 256;
+          break;
+        case 1:
+          delay = rnd() % 0x10000;
+          break;
+        case 2:
+          delay = rnd() % 0x1000000;
+          break;
+        default:
+          delay = rnd() % 16;
+          break;
+      }
+      int id = next_id++;
+      wheel.Insert(now + delay, [&ran, id] { ran.push_back(id); });
+      expected_tasks.emplace(now + delay, id);
+    }
+    // Tasks with a 0 delay are ready right away.
+    auto next_it = expected_tasks.upper_bound(now);
+    uint64_t expected_next = next_it == expected_tasks.end()
+                                 ? TimingWheel::kNoExpiry
+                                 : next_it->first;
+    ASSERT_EQ(wheel.NextExpiry(), expected_next);
+
+    now += rnd() % 2 ? rnd() % 64 : rnd() % 0x100000;
+    wheel.Advance(now);
+    while (!expected_tasks.empty() && expected_tasks.begin()->first <= now) {
+      expected.push_back(expected_tasks.begin()->second);
+      expected_tasks.erase(expected_tasks.begin());
+    }
+    while (wheel.HasReadyTask())
+      wheel.PopReadyTask()();
+    ASSERT_EQ(ran, expected);
+    ASSERT_EQ(wheel.size(), expected_tasks.size());
+  }
+}
+
+}  // namespace
+}  // namespace base
+}  // namespace perfetto
@@ -17,10 +17,15 @@
 #include "src/perfetto_cmd/packet_writer.h"
 
 #include <array>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 #include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 
 #include "perfetto/base/build_config.h"
@@ -79,6 +84,7 @@ class FilePacketWriter : public PacketWriter {
   FilePacketWriter(FILE* fd);
   ~FilePacketWriter() override;
   bool WritePacket(const TracePacket& packet) override;
+  bool Finish() override;
 
  private:
   FILE* fd_;
@@ -105,6 +111,10 @@ bool FilePacketWriter::WritePacket(const TracePacket& packet) {
   return true;
 }
 
+bool FilePacketWriter::Finish() {
+  return fflush(fd_) == 0;
+}
+
 #if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
 
 class ZipPacketWriter : public PacketWriter {
@@ -112,6 +122,7 @@ class ZipPacketWriter : public PacketWriter {
   ZipPacketWriter(std::unique_ptr<PacketWriter>);
   ~ZipPacketWriter() override;
   bool WritePacket(const TracePacket& packet) override;
+  bool Finish() override;
 
  private:
   void CheckEq(int actual_code, int expected_code);
@@ -209,6 +220,12 @@ bool ZipPacketWriter::WritePacket(const TracePacket& packet) {
   return true;
 }
 
+bool ZipPacketWriter::Finish() {
+  if (is_compressing_ && !FinalizeCompressedPacket())
+    return false;
+  return writer_->Finish();
+}
+
 bool ZipPacketWriter::FinalizeCompressedPacket() {
   PERFETTO_DCHECK(is_compressing_);
 
@@ -223,7 +240,7 @@ bool ZipPacketWriter::FinalizeCompressedPacket() {
   out_packet.AddSlice(preamble.data(), preamble_size);
   out_packet.AddSlice(start_, size);
 
-  if (!writer_->WritePackets(out_packets))
+  if (!writer_->WritePackets(std::move(out_packets)))
     return false;
 
   is_compressing_ = false;
@@ -250,6 +267,127 @@ void ZipPacketWriter::Deflate(const uint8_t* ptr, size_t size) {
 
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
 
+class ThreadedPacketWriter : public PacketWriter {
+ public:
+  ThreadedPacketWriter(std::unique_ptr<PacketWriter> writer,
+                       size_t max_pending_bytes);
+  ~ThreadedPacketWriter() override;
+  bool WritePackets(std::vector<TracePacket> packets) override;
+  bool WritePacket(const TracePacket& packet) override;
+  bool Finish() override;
+
+ private:
+  struct Batch {
+    std::vector<TracePacket> packets;
+    size_t size;
+  };
+
+  void WriterThreadMain();
+
+  std::unique_ptr<PacketWriter> writer_;  // Only used on |thread_|.
+  const size_t max_pending_bytes_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // The batches not written yet. |pending_bytes_| also counts the batch being
+  // written by |thread_|.
+  std::deque<Batch> queue_;   // Guarded by |mutex_|.
+  size_t pending_bytes_ = 0;  // Guarded by |mutex_|.
+  bool quit_ = false;         // Guarded by |mutex_|.
+  bool failed_ = false;       // Guarded by |mutex_|.
+  bool failure_returned_ = false;
+
+  std::thread thread_;  // Keep last, the thread starts in the constructor.
+};
+
+ThreadedPacketWriter::ThreadedPacketWriter(std::unique_ptr<PacketWriter> writer,
+                                           size_t max_pending_bytes)
+    : writer_(std::move(writer)),
+      max_pending_bytes_(max_pending_bytes),
+      thread_(&ThreadedPacketWriter::WriterThreadMain, this) {}
+
+ThreadedPacketWriter::~ThreadedPacketWriter() {
+  if (thread_.joinable() && !Finish() && !failure_returned_)
+    PERFETTO_ELOG("Failed to write packets");
+}
+
+bool ThreadedPacketWriter::Finish() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable())
+    thread_.join();
+  return !failed_;
+}
+
+bool ThreadedPacketWriter::WritePackets(std::vector<TracePacket> packets) {
+  size_t size = 0;
+  for (const TracePacket& packet : packets)
+    size += packet.size();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  // A batch larger than |max_pending_bytes_| is queued once the queue is
+  // empty.
+  cv_.wait(lock, [this, size] {
+    return failed_ || pending_bytes_ == 0 ||
+           pending_bytes_ + size <= max_pending_bytes_;
+  });
+  if (failed_) {
+    failure_returned_ = true;
+    return false;
+  }
+  pending_bytes_ += size;
+  queue_.push_back({std::move(packets), size});
+  lock.unlock();
+  cv_.notify_all();
+  return true;
+}
+
+bool ThreadedPacketWriter::WritePacket(const TracePacket& packet) {
+  // The caller keeps the ownership of |packet|, copy it.
+  Slice slice = Slice::Allocate(packet.size());
+  uint8_t* dst = slice.own_data();
+  for (const Slice& src : packet.slices()) {
+    memcpy(dst, src.start, src.size);
+    dst += src.size;
+  }
+  std::vector<TracePacket> packets(1);
+  packets[0].AddSlice(std::move(slice));
+  return WritePackets(std::move(packets));
+}
+
+void ThreadedPacketWriter::WriterThreadMain() {
+  for (;;) {
+    Batch batch;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return quit_ || !queue_.empty(); });
+      if (queue_.empty())
+        break;
+      batch = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    bool success = writer_->WritePackets(std::move(batch.packets));
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_bytes_ -= batch.size;
+      failed_ = !success;
+    }
+    cv_.notify_all();
+    if (!success)
+      break;
+  }
+  // Flushes the writer, e.g. the last compressed packet, on this thread too.
+  // |failed_| is only set by this thread so it can be read without the lock.
+  if (!failed_ && !writer_->Finish()) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    failed_ = true;
+  }
+  writer_.reset();
+}
+
 }  // namespace
 
 PacketWriter::PacketWriter() {}
@@ -267,4 +405,11 @@ std::unique_ptr<PacketWriter> CreateZipPacketWriter(
 }
 #endif
 
+std::unique_ptr<PacketWriter> CreateThreadedPacketWriter(
+    std::unique_ptr<PacketWriter> writer,
+    size_t max_pending_bytes) {
+  return std::unique_ptr<PacketWriter>(
+      new ThreadedPacketWriter(std::move(writer), max_pending_bytes));
+}
+
 }  // namespace perfetto
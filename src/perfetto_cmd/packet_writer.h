@@ -30,7 +30,7 @@ class PacketWriter {
  public:
   PacketWriter();
   virtual ~PacketWriter();
-  virtual bool WritePackets(const std::vector<TracePacket>& packets) {
+  virtual bool WritePackets(std::vector<TracePacket> packets) {
     for (const TracePacket& packet : packets) {
       if (!WritePacket(packet)) {
         return false;
@@ -39,12 +39,34 @@ class PacketWriter {
     return true;
   }
   virtual bool WritePacket(const TracePacket& packets) = 0;
+
+  // Writes out the data buffered by the writer, if any (e.g. the last
+  // compressed packet), and returns false if it or any previous packet
+  // couldn't be written. No packets can be written afterwards.
+  virtual bool Finish() { return true; }
 };
 
 std::unique_ptr<PacketWriter> CreateFilePacketWriter(FILE*);
 std::unique_ptr<PacketWriter> CreateZipPacketWriter(
     std::unique_ptr<PacketWriter>);
 
+// The |max_pending_bytes| of the threaded writer of perfetto_cmd: how many
+// bytes of trace data read from the service can be waiting to be compressed
+// and written to the output file before OnTraceData() blocks.
+constexpr size_t kMaxPendingWriteBytes = 32 * 1024 * 1024;
+
+// Returns a writer that hands the packets over to a background thread, which
+// passes them to |writer|. This moves the compression and the disk writes off
+// the calling thread. WritePackets() blocks while the packets queued for the
+// background thread exceed |max_pending_bytes|, to bound the memory usage when
+// |writer| can't keep up. A write error is returned by the next WritePackets()
+// call or by Finish(), which waits for all the queued packets to be written
+// and finishes |writer| on the background thread. The slices of the packets
+// passed to WritePackets() must own their memory.
+std::unique_ptr<PacketWriter> CreateThreadedPacketWriter(
+    std::unique_ptr<PacketWriter> writer,
+    size_t max_pending_bytes);
+
 }  // namespace perfetto
 
 #endif  // SRC_PERFETTO_CMD_PACKET_WRITER_H_
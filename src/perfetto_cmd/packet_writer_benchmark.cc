@@ -0,0 +1,100 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/tracing/core/trace_packet.h"
+#include "src/perfetto_cmd/packet_writer.h"
+
+namespace perfetto {
+namespace {
+
+constexpr size_t kPacketSize = 1024;
+constexpr size_t kPacketsPerBatch = 1024;
+// Small, so that the packets still queued when the timing stops are a small
+// fraction of the packets written.
+constexpr size_t kMaxPendingBytes = 4 * 1024 * 1024;
+
+// A batch of packets like the ones passed to PerfettoCmd::OnTraceData(). The
+// content is drawn from a small alphabet so that it compresses somewhat.
+std::vector<TracePacket> CreateBatch(std::minstd_rand0* rnd) {
+  std::vector<TracePacket> packets(kPacketsPerBatch);
+  for (TracePacket& packet : packets) {
+    Slice slice = Slice::Allocate(kPacketSize);
+    uint8_t* data = slice.own_data();
+    for (size_t i = 0; i < kPacketSize; i++)
+      data[i] = static_cast<uint8_t>('a' + (*rnd)() % 16);
+    packet.AddSlice(std::move(slice));
+  }
+  return packets;
+}
+
+// Arg 0: 1 to compress the packets.
+// Arg 1: 1 to write them on a background thread.
+// Measures how long WritePackets() blocks the caller, which is what delays
+// the reads from the service. The packets are written to /dev/null, so the
+// background thread is bound by the compression.
+void BM_PacketWriter(benchmark::State& state) {
+  bool compress = state.range(0) != 0;
+  bool threaded = state.range(1) != 0;
+#if !PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+  if (compress) {
+    state.SkipWithError("zlib not enabled in the build config");
+    return;
+  }
+#endif
+  base::ScopedFstream out(fopen("/dev/null", "wb"));
+  PERFETTO_CHECK(out);
+
+  std::unique_ptr<PacketWriter> writer = CreateFilePacketWriter(*out);
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+  if (compress)
+    writer = CreateZipPacketWriter(std::move(writer));
+#endif
+  if (threaded)
+    writer = CreateThreadedPacketWriter(std::move(writer), kMaxPendingBytes);
+
+  std::minstd_rand0 rnd(0);
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::vector<TracePacket> packets = CreateBatch(&rnd);
+    state.ResumeTiming();
+
+    PERFETTO_CHECK(writer->WritePackets(std::move(packets)));
+  }
+  // Waits for the background thread to write the queued packets.
+  writer.reset();
+
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() *
+                                               kPacketsPerBatch * kPacketSize));
+}
+BENCHMARK(BM_PacketWriter)
+    ->Args({0, 0})
+    ->Args({0, 1})
+    ->Args({1, 0})
+    ->Args({1, 1})
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace perfetto
@@ -18,7 +18,11 @@
 
 #include <string.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <random>
+#include <thread>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/file_utils.h"
@@ -53,6 +57,83 @@ TracePacket CreateTracePacket(F fill_function) {
   return packet;
 }
 
+std::vector<TracePacket> CreateSeqPackets(uint32_t first, uint32_t count) {
+  std::vector<TracePacket> packets;
+  for (uint32_t i = first; i < first + count; i++) {
+    packets.push_back(CreateTracePacket([i](TracePacketProto* msg) {
+      msg->mutable_for_testing()->set_seq_value(i);
+    }));
+  }
+  return packets;
+}
+
+// Blocks in WritePacket() until Unblock() is called, then returns
+// |return_value|.
+class BlockingPacketWriter : public PacketWriter {
+ public:
+  explicit BlockingPacketWriter(bool return_value)
+      : return_value_(return_value) {}
+
+  bool WritePacket(const TracePacket&) override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return unblocked_; });
+    return return_value_;
+  }
+
+  void Unblock() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      unblocked_ = true;
+    }
+    cv_.notify_all();
+  }
+
+ private:
+  const bool return_value_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool unblocked_ = false;
+};
+
+// Accepts all the packets and returns |finish_result| from Finish().
+class FinishingPacketWriter : public PacketWriter {
+ public:
+  explicit FinishingPacketWriter(bool finish_result)
+      : finish_result_(finish_result) {}
+
+  bool WritePacket(const TracePacket&) override { return true; }
+  bool Finish() override { return finish_result_; }
+
+ private:
+  const bool finish_result_;
+};
+
+// Like BlockingPacketWriter, but fails once |num_packets| packets have been
+// written.
+class FailingAfterPacketWriter : public BlockingPacketWriter {
+ public:
+  explicit FailingAfterPacketWriter(uint32_t num_packets)
+      : BlockingPacketWriter(true), num_packets_(num_packets) {}
+
+  bool WritePacket(const TracePacket& packet) override {
+    BlockingPacketWriter::WritePacket(packet);
+    if (written_ == num_packets_)
+      return false;
+    written_++;
+    return true;
+  }
+
+ private:
+  const uint32_t num_packets_;
+  uint32_t written_ = 0;
+};
+
+std::vector<TracePacket> CreateLargePackets(size_t size) {
+  std::vector<TracePacket> packets(1);
+  packets[0].AddSlice(Slice::Allocate(size));
+  return packets;
+}
+
 #if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
 std::string RandomString(size_t size) {
   std::minstd_rand0 rnd(0);
@@ -117,6 +198,126 @@ TEST(PacketWriterTest, FilePacketWriter) {
   EXPECT_EQ(trace.packet()[0].for_testing().str(), "abc");
 }
 
+TEST(PacketWriterTest, ThreadedPacketWriter) {
+  base::TempFile tmp = base::TempFile::CreateUnlinked();
+  base::ScopedResource<FILE*, fclose, nullptr> f(
+      fdopen(tmp.ReleaseFD().release(), "wb"));
+
+  {
+    std::unique_ptr<PacketWriter> writer =
+        CreateThreadedPacketWriter(CreateFilePacketWriter(*f), 1024);
+    for (uint32_t i = 0; i < 100; i++)
+      EXPECT_TRUE(writer->WritePackets(CreateSeqPackets(i * 10, 10)));
+    TracePacket packet = std::move(CreateSeqPackets(1000, 1)[0]);
+    EXPECT_TRUE(writer->WritePacket(packet));
+    EXPECT_TRUE(writer->Finish());
+  }
+
+  fseek(*f, 0, SEEK_SET);
+  std::string s;
+  EXPECT_TRUE(base::ReadFileStream(*f, &s));
+
+  protos::gen::Trace trace;
+  ASSERT_TRUE(trace.ParseFromString(s));
+  ASSERT_EQ(trace.packet().size(), 1001u);
+  for (uint32_t i = 0; i < 1001; i++)
+    EXPECT_EQ(trace.packet()[i].for_testing().seq_value(), i);
+}
+
+TEST(PacketWriterTest, ThreadedPacketWriter_BlocksWhenFull) {
+  auto* blocking_writer = new BlockingPacketWriter(true);
+  std::vector<TracePacket> first = CreateSeqPackets(0, 1);
+  size_t packet_size = first[0].size();
+  std::unique_ptr<PacketWriter> writer = CreateThreadedPacketWriter(
+      std::unique_ptr<PacketWriter>(blocking_writer), packet_size * 3 / 2);
+
+  // The first batch is handed over even if the writer thread is stuck on it.
+  EXPECT_TRUE(writer->WritePackets(std::move(first)));
+
+  std::atomic<bool> second_written{false};
+  std::thread thread([&writer, &second_written] {
+    EXPECT_TRUE(writer->WritePackets(CreateSeqPackets(1, 1)));
+    second_written = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(second_written);
+
+  blocking_writer->Unblock();
+  thread.join();
+  EXPECT_TRUE(second_written);
+}
+
+TEST(PacketWriterTest, ThreadedPacketWriter_WriteError) {
+  auto* failing_writer = new BlockingPacketWriter(false);
+  failing_writer->Unblock();
+  std::unique_ptr<PacketWriter> writer = CreateThreadedPacketWriter(
+      std::unique_ptr<PacketWriter>(failing_writer), 1);
+
+  // The failure is only known once the first batch has been written, which
+  // the second call waits for, as the queue is full.
+  EXPECT_TRUE(writer->WritePackets(CreateSeqPackets(0, 1)));
+  EXPECT_FALSE(writer->WritePackets(CreateSeqPackets(1, 1)));
+  EXPECT_FALSE(writer->WritePackets(CreateSeqPackets(2, 1)));
+  EXPECT_FALSE(writer->Finish());
+}
+
+TEST(PacketWriterTest, ThreadedPacketWriter_FinishReturnsWriteError) {
+  auto* failing_writer = new BlockingPacketWriter(false);
+  failing_writer->Unblock();
+  std::unique_ptr<PacketWriter> writer = CreateThreadedPacketWriter(
+      std::unique_ptr<PacketWriter>(failing_writer), 1024 * 1024);
+
+  // The packets are only queued: the error is only known by Finish().
+  EXPECT_TRUE(writer->WritePackets(CreateSeqPackets(0, 1)));
+  EXPECT_FALSE(writer->Finish());
+}
+
+TEST(PacketWriterTest, ThreadedPacketWriter_FinishReturnsLateWriteError) {
+  auto* failing_writer = new FailingAfterPacketWriter(15);
+  std::unique_ptr<PacketWriter> writer = CreateThreadedPacketWriter(
+      std::unique_ptr<PacketWriter>(failing_writer), kMaxPendingWriteBytes);
+
+  // All the batches are queued before the second one fails on the background
+  // thread, the error is only known by Finish().
+  for (uint32_t i = 0; i < 5; i++)
+    EXPECT_TRUE(writer->WritePackets(CreateSeqPackets(i * 10, 10)));
+  failing_writer->Unblock();
+  EXPECT_FALSE(writer->Finish());
+}
+
+TEST(PacketWriterTest, ThreadedPacketWriter_MaxPendingWriteBytes) {
+  auto* blocking_writer = new BlockingPacketWriter(true);
+  std::unique_ptr<PacketWriter> writer = CreateThreadedPacketWriter(
+      std::unique_ptr<PacketWriter>(blocking_writer), kMaxPendingWriteBytes);
+
+  // The writer thread is stuck on the first batch, which still counts towards
+  // the bound.
+  constexpr size_t kBatchSize = 1024 * 1024;
+  for (size_t i = 0; i < kMaxPendingWriteBytes / kBatchSize; i++)
+    EXPECT_TRUE(writer->WritePackets(CreateLargePackets(kBatchSize)));
+
+  std::atomic<bool> last_written{false};
+  std::thread thread([&writer, &last_written] {
+    EXPECT_TRUE(writer->WritePackets(CreateLargePackets(1)));
+    last_written = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(last_written);
+
+  blocking_writer->Unblock();
+  thread.join();
+  EXPECT_TRUE(last_written);
+  EXPECT_TRUE(writer->Finish());
+}
+
+TEST(PacketWriterTest, ThreadedPacketWriter_FinishReturnsFlushError) {
+  auto* finishing_writer = new FinishingPacketWriter(false);
+  std::unique_ptr<PacketWriter> writer = CreateThreadedPacketWriter(
+      std::unique_ptr<PacketWriter>(finishing_writer), 1024 * 1024);
+  EXPECT_TRUE(writer->WritePackets(CreateSeqPackets(0, 10)));
+  EXPECT_FALSE(writer->Finish());
+}
+
 #if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
 
 TEST(PacketWriterTest, ZipPacketWriter) {
@@ -152,6 +353,13 @@ TEST(PacketWriterTest, ZipPacketWriter) {
   EXPECT_EQ(subtrace.packet()[0].for_testing().str(), "abc");
 }
 
+TEST(PacketWriterTest, ZipPacketWriter_FinishReturnsFlushError) {
+  std::unique_ptr<PacketWriter> writer = CreateZipPacketWriter(
+      std::unique_ptr<PacketWriter>(new FinishingPacketWriter(false)));
+  EXPECT_TRUE(writer->WritePackets(CreateSeqPackets(0, 10)));
+  EXPECT_FALSE(writer->Finish());
+}
+
 TEST(PacketWriterTest, ZipPacketWriter_Empty) {
   base::TempFile tmp = base::TempFile::CreateUnlinked();
   base::ScopedResource<FILE*, fclose, nullptr> f(
@@ -315,6 +523,35 @@ TEST(PacketWriterTest, ZipPacketWriter_ShouldSplitPackets) {
   EXPECT_EQ(packet_count, 1000u);
 }
 
+TEST(PacketWriterTest, ThreadedZipPacketWriter) {
+  base::TempFile tmp = base::TempFile::CreateUnlinked();
+  base::ScopedResource<FILE*, fclose, nullptr> f(
+      fdopen(tmp.ReleaseFD().release(), "wb"));
+
+  {
+    std::unique_ptr<PacketWriter> writer = CreateThreadedPacketWriter(
+        CreateZipPacketWriter(CreateFilePacketWriter(*f)), 64 * 1024);
+    for (uint32_t i = 0; i < 100; i++)
+      EXPECT_TRUE(writer->WritePackets(CreateSeqPackets(i * 100, 100)));
+  }
+
+  std::string s;
+  fseek(*f, 0, SEEK_SET);
+  EXPECT_TRUE(base::ReadFileStream(*f, &s));
+
+  protos::gen::Trace trace;
+  ASSERT_TRUE(trace.ParseFromString(s));
+  uint32_t packet_count = 0;
+  for (const auto& packet : trace.packet()) {
+    protos::gen::Trace subtrace;
+    EXPECT_TRUE(
+        subtrace.ParseFromString(Decompress(packet.compressed_packets())));
+    for (const auto& subpacket : subtrace.packet())
+      EXPECT_EQ(subpacket.for_testing().seq_value(), packet_count++);
+  }
+  EXPECT_EQ(packet_count, 100 * 100u);
+}
+
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
 
 }  // namespace
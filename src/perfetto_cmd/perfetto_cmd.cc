@@ -30,6 +30,7 @@
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
 #include <io.h>
 #else
+#include <sys/resource.h>
 #include <unistd.h>
 #endif
 
@@ -79,6 +80,23 @@ perfetto::PerfettoCmd* g_perfetto_cmd;
 
 uint32_t kOnTraceDataTimeoutMs = 3000;
 
+// Returns the peak resident set size of this process in KB, or 0 if unknown.
+uint64_t GetPeakRssKb() {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_APPLE)
+  // In bytes rather than KB.
+  return static_cast<uint64_t>(usage.ru_maxrss) / 1024;
+#else
+  return static_cast<uint64_t>(usage.ru_maxrss);
+#endif
+#endif
+}
+
 class LoggingErrorReporter : public ErrorReporter {
  public:
   LoggingErrorReporter(std::string file_name, const char* config)
@@ -770,6 +788,13 @@ base::Optional<int> PerfettoCmd::ParseCmdlineAndMaybeDaemonize(int argc,
     }
   }
 
+  // Compress and write the trace on another thread, so that reading the
+  // buffers from the service is not stalled by the disk.
+  if (packet_writer_) {
+    packet_writer_ = CreateThreadedPacketWriter(std::move(packet_writer_),
+                                                kMaxPendingWriteBytes);
+  }
+
   bool will_trace_indefinitely =
       trace_config_->duration_ms() == 0 &&
       trace_config_->trigger_config().trigger_timeout_ms() == 0;
@@ -1070,10 +1095,10 @@ void PerfettoCmd::CheckTraceDataTimeout() {
 void PerfettoCmd::OnTraceData(std::vector<TracePacket> packets, bool has_more) {
   trace_data_timeout_armed_ = false;
 
-  if (!packet_writer_->WritePackets(packets)) {
-    PERFETTO_ELOG("Failed to write packets");
-    FinalizeTraceAndExit();
-  }
+  // The error is logged by FinalizeTraceAndExit(), as the writer's Finish()
+  // returns it as well.
+  if (!packet_writer_->WritePackets(std::move(packets)))
+    return FinalizeTraceAndExit();
 
   if (!has_more)
     FinalizeTraceAndExit();  // Reached end of trace.
@@ -1113,11 +1138,16 @@ void PerfettoCmd::OnTracingDisabled(const std::string& error) {
 
   // This will cause a bunch of OnTraceData callbacks. The last one will
   // save the file and exit.
+  read_buffers_start_ns_ = base::GetWallTimeNs().count();
   consumer_endpoint_->ReadBuffers();
 }
 
 void PerfettoCmd::FinalizeTraceAndExit() {
   LogUploadEvent(PerfettoStatsdAtom::kFinalizeTraceAndExit);
+  // Waits for the packets queued by the writer thread, if any.
+  bool write_failed = packet_writer_ && !packet_writer_->Finish();
+  if (write_failed)
+    PERFETTO_ELOG("Failed to write packets");
   packet_writer_.reset();
 
   if (trace_out_stream_) {
@@ -1140,9 +1170,25 @@ void PerfettoCmd::FinalizeTraceAndExit() {
     if (trace_config_->write_into_file()) {
       // trace_out_path_ might be empty in the case of --attach.
       PERFETTO_LOG("Trace written into the output file");
+    } else if (write_failed) {
+      PERFETTO_ELOG(
+          "The trace written into %s is incomplete",
+          trace_out_path_ == "-" ? "stdout" : trace_out_path_.c_str());
     } else {
       PERFETTO_LOG("Wrote %" PRIu64 " bytes into %s", bytes_written_,
                    trace_out_path_ == "-" ? "stdout" : trace_out_path_.c_str());
+      if (read_buffers_start_ns_ > 0) {
+        // Includes waiting for the packets queued by the writer thread.
+        double secs = static_cast<double>(base::GetWallTimeNs().count() -
+                                          read_buffers_start_ns_) /
+                      1e9;
+        PERFETTO_LOG("Read and wrote the trace in %.2f s (%.1f MB/s), peak "
+                     "RSS: %" PRIu64 " KB",
+                     secs,
+                     secs > 0 ? static_cast<double>(bytes_written_) / 1e6 / secs
+                              : 0,
+                     GetPeakRssKb());
+      }
     }
   }
 
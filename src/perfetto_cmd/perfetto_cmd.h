@@ -140,6 +140,8 @@ class PerfettoCmd : public Consumer {
   bool statsd_logging_ = false;
   bool update_guardrail_state_ = false;
   uint64_t bytes_written_ = 0;
+  // When ReadBuffers() was called, to report the write throughput.
+  int64_t read_buffers_start_ns_ = 0;
   std::string detach_key_;
   std::string attach_key_;
   bool stop_trace_once_attached_ = false;
@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/containers/bit_vector.h"
 
+#include <string.h>
+
 #include <limits>
 
 #include "src/trace_processor/containers/bit_vector_iterators.h"
@@ -79,6 +81,41 @@ BitVector::BitVector(uint32_t count, bool value) {
   Resize(count, value);
 }
 
+std::vector<uint64_t> BitVector::GetWords() const {
+  static_assert(sizeof(Block) == Block::kWords * sizeof(uint64_t),
+                "Blocks must be made of 64-bit words only");
+  std::vector<uint64_t> words(WordCeil(size()));
+  if (!words.empty())
+    memcpy(words.data(), blocks_.data(), words.size() * sizeof(uint64_t));
+  return words;
+}
+
+// static
+base::Optional<BitVector> BitVector::FromWords(const uint64_t* words,
+                                               size_t word_count,
+                                               uint32_t size) {
+  if (word_count != WordCeil(size))
+    return base::nullopt;
+
+  // All the methods rely on the bits past the size being zero.
+  uint32_t bits_in_last_word = size % BitWord::kBits;
+  if (bits_in_last_word != 0 && words[word_count - 1] >> bits_in_last_word)
+    return base::nullopt;
+
+  std::vector<Block> blocks(BlockCeil(size));
+  if (word_count > 0) {
+    memcpy(static_cast<void*>(blocks.data()), words,
+           word_count * sizeof(uint64_t));
+  }
+  std::vector<uint32_t> counts(blocks.size());
+  uint32_t count = 0;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    counts[i] = count;
+    count += blocks[i].CountSetBits();
+  }
+  return BitVector(std::move(blocks), std::move(counts), size);
+}
+
 BitVector::BitVector(std::vector<Block> blocks,
                      std::vector<uint32_t> counts,
                      uint32_t size)
@@ -25,7 +25,13 @@
 #include <array>
 #include <vector>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
+#include "perfetto/ext/base/optional.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+#include <immintrin.h>
+#endif
 
 namespace perfetto {
 namespace trace_processor {
@@ -309,6 +315,18 @@ class BitVector {
     counts_.shrink_to_fit();
   }
 
+  // Returns the bits packed in 64-bit words: bit |i| is bit |i % 64| of word
+  // |i / 64|. The bits of the last word past |size()| are zero. Together with
+  // FromWords(), this allows serializing a bitvector.
+  std::vector<uint64_t> GetWords() const;
+
+  // Creates a bitvector of |size| bits from |word_count| words in the format
+  // returned by GetWords(). Returns base::nullopt if |word_count| doesn't
+  // match |size| or if a bit past |size| is set.
+  static base::Optional<BitVector> FromWords(const uint64_t* words,
+                                             size_t word_count,
+                                             uint32_t size);
+
   // Updates the ith set bit of this bitvector with the value of
   // |other.IsSet(i)|.
   //
@@ -410,6 +428,12 @@ class BitVector {
     uint16_t IndexOfNthSet(uint32_t n) const {
       PERFETTO_DCHECK(n < kBits);
 
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+      // PDEP deposits the single bit of |1 << n| at the position of the nth
+      // set bit of the word: counting the trailing zeros of the result gives
+      // us its index.
+      return static_cast<uint16_t>(_tzcnt_u64(_pdep_u64(1ull << n, word_)));
+#else
       // The below code is very dense but essentially computes the nth set
       // bit inside |atom| in the "broadword" style of programming (sometimes
       // referred to as "SIMD within a register").
@@ -419,9 +443,9 @@ class BitVector {
       // allow branchless algorithms when considering bits of a uint64.
       //
       // In benchmarks, this algorithm has found to be the fastest, portable
-      // way of computing the nth set bit (if we were only targetting new
-      // versions of x64, we could also use pdep + ctz but unfortunately
-      // this would fail on WASM - this about 2.5-3x faster on x64).
+      // way of computing the nth set bit (on recent versions of x64, pdep +
+      // tzcnt above is about 2.5-3x faster but this is not available on
+      // other architectures or on WASM).
       //
       // The code below was taken from the paper
       // http://vigna.di.unimi.it/ftp/papers/Broadword.pdf
@@ -436,6 +460,7 @@ class BitVector {
       uint64_t ret = b + ((BwLessThan(s, l * L8) >> 7) * L8 >> 56);
 
       return static_cast<uint16_t>(ret);
+#endif
     }
 
     // Returns the number of set bits.
@@ -19,6 +19,21 @@
 namespace perfetto {
 namespace trace_processor {
 namespace internal {
+namespace {
+
+// Returns the index of the lowest set bit of |word|. |word| must not be zero.
+inline uint32_t IndexOfLowestSetBit(uint64_t word) {
+  PERFETTO_DCHECK(word != 0);
+#if defined(__GNUC__) || defined(__clang__)
+  return static_cast<uint32_t>(__builtin_ctzll(word));
+#else
+  unsigned long idx;
+  _BitScanForward64(&idx, word);
+  return static_cast<uint32_t>(idx);
+#endif
+}
+
+}  // namespace
 
 BaseIterator::BaseIterator(BitVector* bv) : bv_(bv) {
   size_ = bv->size();
@@ -84,49 +99,47 @@ SetBitsIterator::SetBitsIterator(const BitVector* bv)
 }
 
 void SetBitsIterator::ReadSetBitBatch(uint32_t start_idx) {
+  static_assert(sizeof(BitVector::Block) ==
+                    BitVector::Block::kWords * sizeof(uint64_t),
+                "Block must just consist of words.");
   PERFETTO_DCHECK(set_bit_index_ % kBatchSize == 0);
 
-  uint32_t set_bit_count_until_i = set_bit_index_;
-  for (uint32_t i = start_idx; i < size(); ++i) {
-    auto addr = BitVector::IndexToAddress(i);
-
-    // Compute the count to the end of the block noting that the last block
-    // needs to use |set_bit_count_| and not the next count in the vector
-    // because that is OOB.
-    uint32_t set_bits_to_end_of_block =
-        addr.block_idx == bv().counts_.size() - 1
-            ? set_bit_count_
-            : bv().counts_[addr.block_idx + 1];
-
-    // Optimization: If the count of set bits to the end of the block is the
-    // same as the count to the current index, we can just skip the whole
-    // block without iterating through the bits inside.
-    if (set_bits_to_end_of_block == set_bit_count_until_i) {
-      static constexpr BitVector::BlockOffset kLastBlockOffset = {
-          BitVector::Block::kWords - 1, BitVector::BitWord::kBits - 1};
-
-      i = BitVector::AddressToIndex({addr.block_idx, kLastBlockOffset});
-      continue;
+  // Instead of checking every bit, read the bitvector a word at a time and,
+  // for each word, pop the set bits from the bottom: this makes the cost
+  // proportional to the number of set bits (and words) rather than the number
+  // of bits. Safe because of the static_assert above.
+  const auto* words = reinterpret_cast<const uint64_t*>(bv().blocks_.data());
+  uint32_t word_count = BitVector::WordCeil(size());
+  uint32_t word_idx = start_idx / BitVector::BitWord::kBits;
+  if (word_idx >= word_count)
+    return;
+
+  // Ignore the bits before |start_idx| in the first word.
+  uint32_t start_bit = start_idx % BitVector::BitWord::kBits;
+  uint64_t word = words[word_idx] & (~0ull << start_bit);
+
+  uint32_t batch_idx = 0;
+  for (;;) {
+    while (word != 0) {
+      batch_[batch_idx++] =
+          word_idx * BitVector::BitWord::kBits + IndexOfLowestSetBit(word);
+
+      // Clear the lowest set bit.
+      word &= word - 1;
+
+      // If we've reached as many indicies as the batch can store, just
+      // return.
+      if (PERFETTO_UNLIKELY(batch_idx == kBatchSize))
+        return;
     }
-
-    // If the bit is not set, just bail out.
-    const auto& block = bv().blocks_[addr.block_idx];
-    if (!block.IsSet(addr.block_offset))
-      continue;
-
-    // Update |batch_| with the index of the current bit.
-    uint32_t batch_idx = set_bit_count_until_i++ % kBatchSize;
-    batch_[batch_idx] = i;
-
-    // If we've reached as many indicies as the batch can store, just
-    // return.
-    if (PERFETTO_UNLIKELY(batch_idx == kBatchSize - 1))
-      return;
+    if (++word_idx == word_count)
+      break;
+    word = words[word_idx];
   }
 
   // We should only get here when we've managed to read all the set bits.
   // End of batch should return from the body of the loop.
-  PERFETTO_DCHECK(set_bit_count_until_i == set_bit_count_);
+  PERFETTO_DCHECK(set_bit_index_ + batch_idx == set_bit_count_);
 }
 
 }  // namespace internal
@@ -450,6 +450,30 @@ TEST(BitVectorUnittest, IterateSetBitsStartsCorrectly) {
   ASSERT_FALSE(it);
 }
 
+TEST(BitVectorUnittest, IterateSetBitsSparseAndDense) {
+  // Empty blocks followed by full blocks spanning multiple batches of set
+  // bits and a few bits on word boundaries.
+  BitVector bv(5000, false);
+  bv.Resize(8000, true);
+  bv.Resize(20000, false);
+  for (uint32_t i : {63u, 64u, 4095u, 12345u, 19999u})
+    bv.Set(i);
+
+  std::vector<uint32_t> set_indices;
+  for (uint32_t i = 0; i < bv.size(); ++i) {
+    if (bv.IsSet(i))
+      set_indices.emplace_back(i);
+  }
+
+  uint32_t i = 0;
+  for (auto it = bv.IterateSetBits(); it; it.Next(), ++i) {
+    ASSERT_EQ(it.ordinal(), i);
+    ASSERT_EQ(it.index(), set_indices[i]);
+    ASSERT_EQ(bv.IndexOfNthSet(i), set_indices[i]);
+  }
+  ASSERT_EQ(i, set_indices.size());
+}
+
 TEST(BitVectorUnittest, Range) {
   BitVector bv =
       BitVector::Range(1, 1025, [](uint32_t t) { return t % 3 == 0; });
@@ -462,6 +486,34 @@ TEST(BitVectorUnittest, Range) {
   ASSERT_EQ(bv.CountSetBits(), 341u);
 }
 
+TEST(BitVectorUnittest, WordsRoundTrip) {
+  BitVector bv;
+  for (uint32_t i = 0; i < 1500; ++i)
+    bv.AppendTrue();
+  bv.Clear(3);
+  bv.Clear(1000);
+
+  std::vector<uint64_t> words = bv.GetWords();
+  ASSERT_EQ(words.size(), 24u);
+  ASSERT_EQ(words[0], ~uint64_t(8));
+  ASSERT_EQ(words.back(), (uint64_t(1) << (1500 % 64)) - 1);
+
+  base::Optional<BitVector> res =
+      BitVector::FromWords(words.data(), words.size(), bv.size());
+  ASSERT_TRUE(res);
+  ASSERT_EQ(res->size(), 1500u);
+  ASSERT_EQ(res->CountSetBits(), 1498u);
+  ASSERT_EQ(res->CountSetBits(1001), 999u);
+  ASSERT_EQ(res->IndexOfNthSet(1000), 1002u);
+  ASSERT_FALSE(res->IsSet(1000));
+
+  // A bit set past the size or a word count not matching the size is
+  // rejected.
+  ASSERT_FALSE(BitVector::FromWords(words.data(), words.size(), 1499));
+  ASSERT_FALSE(BitVector::FromWords(words.data(), words.size() - 1, 1500));
+  ASSERT_TRUE(BitVector::FromWords(nullptr, 0, 0));
+}
+
 TEST(BitVectorUnittest, QueryStressTest) {
   BitVector bv;
   std::vector<bool> bool_vec;
@@ -0,0 +1,414 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_CONTAINERS_PACKED_VECTOR_H_
+#define SRC_TRACE_PROCESSOR_CONTAINERS_PACKED_VECTOR_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/optional.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// An immutable, compressed copy of a std::vector<T> which still supports
+// O(1) random access to single elements without decompressing the rest of the
+// data.
+//
+// T must be a trivially copyable type of 4 or 8 bytes (e.g. integers, doubles,
+// StringPool::Id). Values are compressed as unsigned integers of the same
+// width; signed integers are first mapped so that their order is preserved
+// (e.g. -1 and 1 are close together).
+//
+// Three encodings are supported and the smallest one is picked by Pack():
+//  * kBitPacked: values are split into blocks of kBlockSize elements. Each
+//    block stores its minimum and the difference of every value from it,
+//    using only as many bits as the largest difference needs. This is a
+//    frame-of-reference encoding: it makes sorted timestamps cost only the
+//    bits of the deltas within a block and small-range integers (cpu, utid,
+//    depth...) only a few bits each.
+//  * kRunLength: consecutive equal values are stored once together with the
+//    index where the run starts. Good for columns like arg_set_id or
+//    columns which are almost constant. The run of the first element of every
+//    kBlockSize elements is also stored, so that looking up an element only
+//    has to search the runs within its block.
+//  * kDictionary: the distinct values are stored once in a sorted dictionary
+//    and each element only stores the index of its value in the dictionary,
+//    using as many bits as the size of the dictionary needs. Good for columns
+//    with few distinct but scattered values, like the keys of the args table
+//    or the names of slices.
+template <typename T>
+class PackedVector {
+ private:
+  using Word = typename std::conditional<sizeof(T) == sizeof(uint64_t),
+                                         uint64_t,
+                                         uint32_t>::type;
+
+ public:
+  static_assert(sizeof(T) == sizeof(uint32_t) || sizeof(T) == sizeof(uint64_t),
+                "PackedVector only supports 4 and 8 byte types");
+  static_assert(std::is_trivially_copyable<T>::value,
+                "PackedVector only supports trivially copyable types");
+
+  // Number of elements sharing the same frame of reference in kBitPacked and
+  // indexed together in kRunLength.
+  static constexpr uint32_t kBlockSize = 128;
+
+  enum class Encoding {
+    kBitPacked,
+    kRunLength,
+    kDictionary,
+  };
+
+  PackedVector(PackedVector&&) = default;
+  PackedVector& operator=(PackedVector&&) noexcept = default;
+
+  PackedVector(const PackedVector&) = delete;
+  PackedVector& operator=(const PackedVector&) = delete;
+
+  // Returns the compressed representation of |values| using the smallest
+  // encoding or base::nullopt if |values| is empty or no encoding saves at
+  // least a quarter of the memory used by |values|.
+  static base::Optional<PackedVector<T>> Pack(const std::vector<T>& values) {
+    if (values.empty())
+      return base::nullopt;
+    size_t raw_size = values.size() * sizeof(T);
+    size_t bit_packed_size = BitPackedSize(values);
+    size_t run_length_size = RunLengthSize(values);
+    // Decoding from the dictionary needs an extra lookup so it's only used
+    // if it also saves a quarter of the memory of the other encodings. This
+    // bounds the number of distinct values, which lets columns with many of
+    // them (e.g. timestamps) give up on the dictionary early.
+    size_t other_size = std::min(bit_packed_size, run_length_size);
+    base::Optional<std::vector<Word>> dictionary = CreateDictionary(
+        values, MaxDictionaryEntries(values.size(), other_size / 4 * 3));
+    size_t min_size =
+        dictionary ? DictionarySize(values.size(), dictionary->size())
+                   : other_size;
+    if (min_size > raw_size / 4 * 3)
+      return base::nullopt;
+
+    PackedVector<T> packed;
+    packed.size_ = static_cast<uint32_t>(values.size());
+    if (dictionary) {
+      packed.EncodeDictionary(values, std::move(*dictionary));
+    } else if (run_length_size < bit_packed_size) {
+      packed.EncodeRunLength(values);
+    } else {
+      packed.EncodeBitPacked(values);
+    }
+    return base::make_optional(std::move(packed));
+  }
+
+  // Returns the element at |idx|.
+  T Get(uint32_t idx) const {
+    PERFETTO_DCHECK(idx < size_);
+    if (encoding_ == Encoding::kRunLength) {
+      // The runs overlapping the block of |idx| are the ones from the run of
+      // its first element to the run of the first element of the next block.
+      uint32_t block = idx / kBlockSize;
+      auto first = run_starts_.begin() + block_runs_[block] + 1;
+      auto last = block + 1 < block_runs_.size()
+                      ? run_starts_.begin() + block_runs_[block + 1] + 1
+                      : run_starts_.end();
+      auto it = std::upper_bound(first, last, idx);
+      return FromWord(run_values_[static_cast<size_t>(
+          std::distance(run_starts_.begin(), it) - 1)]);
+    }
+    if (encoding_ == Encoding::kDictionary) {
+      uint64_t code = ReadBits(words_.data(), uint64_t(idx) * dictionary_width_,
+                               dictionary_width_);
+      return FromWord(dictionary_[static_cast<size_t>(code)]);
+    }
+    const Block& block = blocks_[idx / kBlockSize];
+    uint64_t delta = ReadBits(words_.data() + block.word_offset,
+                              uint64_t(idx % kBlockSize) * block.width,
+                              block.width);
+    return FromWord(static_cast<Word>(block.base + delta));
+  }
+
+  // Returns all the elements as a std::vector.
+  std::vector<T> Unpack() const {
+    std::vector<T> values(size_);
+    for (uint32_t i = 0; i < size_; ++i)
+      values[i] = Get(i);
+    return values;
+  }
+
+  // Returns the number of elements.
+  uint32_t size() const { return size_; }
+
+  // Returns the encoding picked by Pack().
+  Encoding encoding() const { return encoding_; }
+
+  // Returns the number of bytes used to store the elements.
+  size_t SizeInBytes() const {
+    return blocks_.size() * sizeof(Block) + words_.size() * sizeof(uint64_t) +
+           run_starts_.size() * sizeof(uint32_t) +
+           run_values_.size() * sizeof(Word) +
+           block_runs_.size() * sizeof(uint32_t) +
+           dictionary_.size() * sizeof(Word);
+  }
+
+ private:
+  struct Block {
+    // Minimum of the values in the block.
+    Word base;
+    // Index in |words_| of the first word of the block.
+    uint32_t word_offset;
+    // Number of bits used by each value in the block.
+    uint32_t width;
+  };
+
+  PackedVector() = default;
+
+  static Word ToWord(T value) {
+    Word word;
+    memcpy(&word, &value, sizeof(T));
+    // Flipping the sign bit maps signed integers onto unsigned ones
+    // preserving their order.
+    if (std::is_integral<T>::value && std::is_signed<T>::value)
+      word ^= Word(1) << (sizeof(Word) * 8 - 1);
+    return word;
+  }
+
+  static T FromWord(Word word) {
+    if (std::is_integral<T>::value && std::is_signed<T>::value)
+      word ^= Word(1) << (sizeof(Word) * 8 - 1);
+    T value;
+    memcpy(static_cast<void*>(&value), &word, sizeof(T));
+    return value;
+  }
+
+  // Returns the min of [begin, end) and the number of bits needed to store
+  // the difference between any element and the min.
+  static std::pair<Word, uint32_t> BlockFrame(const T* begin, const T* end) {
+    Word min = std::numeric_limits<Word>::max();
+    Word max = 0;
+    for (const T* it = begin; it != end; ++it) {
+      Word word = ToWord(*it);
+      min = std::min(min, word);
+      max = std::max(max, word);
+    }
+    return std::make_pair(min, BitWidth(uint64_t(max - min)));
+  }
+
+  static size_t WordsForBlock(size_t count, uint32_t width) {
+    return (count * width + 63) / 64;
+  }
+
+  // Returns the number of bits needed to store any value in [0, max].
+  static uint32_t BitWidth(uint64_t max) {
+    uint32_t width = 0;
+    for (; max; max >>= 1)
+      width++;
+    return width;
+  }
+
+  // Reads the |width| bit value starting at bit |bit| of |words|.
+  static uint64_t ReadBits(const uint64_t* words,
+                           uint64_t bit,
+                           uint32_t width) {
+    if (width == 0)
+      return 0;
+    const uint64_t* word = &words[bit / 64];
+    uint32_t shift = static_cast<uint32_t>(bit % 64);
+    uint64_t value = word[0] >> shift;
+    if (shift + width > 64)
+      value |= word[1] << (64 - shift);
+    if (width < 64)
+      value &= (uint64_t(1) << width) - 1;
+    return value;
+  }
+
+  // Writes the |width| bit |value| starting at bit |bit| of |words|, which
+  // must be zero.
+  static void WriteBits(uint64_t* words,
+                        uint64_t bit,
+                        uint32_t width,
+                        uint64_t value) {
+    if (width == 0)
+      return;
+    uint32_t shift = static_cast<uint32_t>(bit % 64);
+    words[bit / 64] |= value << shift;
+    if (shift + width > 64)
+      words[bit / 64 + 1] |= value >> (64 - shift);
+  }
+
+  static size_t BitPackedSize(const std::vector<T>& values) {
+    size_t size = 0;
+    for (size_t i = 0; i < values.size(); i += kBlockSize) {
+      size_t count = std::min<size_t>(kBlockSize, values.size() - i);
+      uint32_t width =
+          BlockFrame(values.data() + i, values.data() + i + count).second;
+      size += sizeof(Block) + WordsForBlock(count, width) * sizeof(uint64_t);
+    }
+    return size;
+  }
+
+  static size_t RunLengthSize(const std::vector<T>& values) {
+    size_t runs = 0;
+    for (size_t i = 0; i < values.size(); ++i) {
+      if (i == 0 || ToWord(values[i]) != ToWord(values[i - 1]))
+        runs++;
+    }
+    size_t blocks = (values.size() + kBlockSize - 1) / kBlockSize;
+    return runs * (sizeof(uint32_t) + sizeof(Word)) +
+           blocks * sizeof(uint32_t);
+  }
+
+  // Returns the sorted distinct values of |values| or base::nullopt if there
+  // are more than |max_entries| of them.
+  static base::Optional<std::vector<Word>> CreateDictionary(
+      const std::vector<T>& values,
+      size_t max_entries) {
+    if (max_entries == 0)
+      return base::nullopt;
+    // Only the distinct values are copied so that the columns with too many
+    // of them bail out without copying and sorting all the values.
+    base::FlatHashMap<Word, bool> seen;
+    std::vector<Word> dictionary;
+    for (const T& value : values) {
+      Word word = ToWord(value);
+      if (!seen.Insert(word, true).second)
+        continue;
+      if (dictionary.size() == max_entries)
+        return base::nullopt;
+      dictionary.emplace_back(word);
+    }
+    std::sort(dictionary.begin(), dictionary.end());
+    return base::make_optional(std::move(dictionary));
+  }
+
+  static size_t DictionarySize(size_t count, size_t entries) {
+    uint32_t width = BitWidth(entries - 1);
+    return entries * sizeof(Word) +
+           WordsForBlock(count, width) * sizeof(uint64_t);
+  }
+
+  // Returns the largest number of distinct values for which the dictionary
+  // encoding of |count| elements takes less than |max_size| bytes.
+  static size_t MaxDictionaryEntries(size_t count, size_t max_size) {
+    size_t max_entries = 0;
+    // Each element stores its dictionary index in |width| bits, which is
+    // enough for up to 2^width entries.
+    for (uint32_t width = 0; width <= 32; ++width) {
+      size_t words_size = WordsForBlock(count, width) * sizeof(uint64_t);
+      if (words_size >= max_size)
+        break;
+      uint64_t width_entries = uint64_t(1) << width;
+      uint64_t entries =
+          std::min<uint64_t>((max_size - words_size - 1) / sizeof(Word),
+                             width_entries);
+      max_entries = std::max(max_entries, static_cast<size_t>(entries));
+      if (entries < width_entries)
+        break;
+    }
+    return max_entries;
+  }
+
+  void EncodeBitPacked(const std::vector<T>& values) {
+    encoding_ = Encoding::kBitPacked;
+    for (size_t i = 0; i < values.size(); i += kBlockSize) {
+      size_t count = std::min<size_t>(kBlockSize, values.size() - i);
+      auto frame = BlockFrame(values.data() + i, values.data() + i + count);
+
+      Block block;
+      block.base = frame.first;
+      block.word_offset = static_cast<uint32_t>(words_.size());
+      block.width = frame.second;
+      blocks_.emplace_back(block);
+
+      words_.resize(words_.size() + WordsForBlock(count, block.width));
+      uint64_t* words = words_.data() + block.word_offset;
+      for (size_t j = 0; j < count && block.width > 0; ++j) {
+        uint64_t delta = uint64_t(ToWord(values[i + j]) - block.base);
+        WriteBits(words, j * block.width, block.width, delta);
+      }
+    }
+    PERFETTO_CHECK(words_.size() <= std::numeric_limits<uint32_t>::max());
+    blocks_.shrink_to_fit();
+  }
+
+  void EncodeRunLength(const std::vector<T>& values) {
+    encoding_ = Encoding::kRunLength;
+    for (size_t i = 0; i < values.size(); ++i) {
+      Word word = ToWord(values[i]);
+      if (i == 0 || word != run_values_.back()) {
+        run_starts_.emplace_back(static_cast<uint32_t>(i));
+        run_values_.emplace_back(word);
+      }
+      if (i % kBlockSize == 0)
+        block_runs_.emplace_back(static_cast<uint32_t>(run_starts_.size() - 1));
+    }
+    run_starts_.shrink_to_fit();
+    run_values_.shrink_to_fit();
+    block_runs_.shrink_to_fit();
+  }
+
+  void EncodeDictionary(const std::vector<T>& values,
+                        std::vector<Word> dictionary) {
+    encoding_ = Encoding::kDictionary;
+    dictionary_ = std::move(dictionary);
+    dictionary_.shrink_to_fit();
+    dictionary_width_ = BitWidth(dictionary_.size() - 1);
+    words_.resize(WordsForBlock(values.size(), dictionary_width_));
+    for (size_t i = 0; i < values.size(); ++i) {
+      auto it = std::lower_bound(dictionary_.begin(), dictionary_.end(),
+                                 ToWord(values[i]));
+      WriteBits(words_.data(), uint64_t(i) * dictionary_width_,
+                dictionary_width_,
+                static_cast<uint64_t>(std::distance(dictionary_.begin(), it)));
+    }
+  }
+
+  Encoding encoding_ = Encoding::kBitPacked;
+  uint32_t size_ = 0;
+
+  // Only used by kBitPacked.
+  std::vector<Block> blocks_;
+
+  // Used by kBitPacked and kDictionary.
+  std::vector<uint64_t> words_;
+
+  // Only used by kRunLength. |block_runs_| has the index in |run_starts_| of
+  // the run of the first element of each block.
+  std::vector<uint32_t> run_starts_;
+  std::vector<Word> run_values_;
+  std::vector<uint32_t> block_runs_;
+
+  // Only used by kDictionary.
+  std::vector<Word> dictionary_;
+  uint32_t dictionary_width_ = 0;
+};
+
+template <typename T>
+constexpr uint32_t PackedVector<T>::kBlockSize;
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_CONTAINERS_PACKED_VECTOR_H_
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/containers/packed_vector.h"
+
+#include <limits>
+#include <random>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+template <typename T>
+void ExpectSameValues(const PackedVector<T>& packed,
+                      const std::vector<T>& values) {
+  ASSERT_EQ(packed.size(), values.size());
+  for (uint32_t i = 0; i < values.size(); ++i)
+    ASSERT_EQ(packed.Get(i), values[i]) << "at index " << i;
+  ASSERT_EQ(packed.Unpack(), values);
+}
+
+TEST(PackedVector, SortedTimestamps) {
+  std::minstd_rand0 rnd(42);
+  std::vector<int64_t> ts;
+  int64_t cur = 1234567890123456;
+  for (uint32_t i = 0; i < 10000; ++i) {
+    cur += rnd() % 100000;
+    ts.push_back(cur);
+  }
+
+  auto packed = PackedVector<int64_t>::Pack(ts);
+  ASSERT_TRUE(packed);
+  ASSERT_EQ(packed->encoding(), PackedVector<int64_t>::Encoding::kBitPacked);
+  ExpectSameValues(*packed, ts);
+  ASSERT_LT(packed->SizeInBytes() * 2, ts.size() * sizeof(int64_t));
+}
+
+TEST(PackedVector, SmallRange) {
+  std::minstd_rand0 rnd(42);
+  std::vector<uint32_t> cpus;
+  for (uint32_t i = 0; i < 1000; ++i)
+    cpus.push_back(rnd() % 8);
+
+  auto packed = PackedVector<uint32_t>::Pack(cpus);
+  ASSERT_TRUE(packed);
+  ASSERT_EQ(packed->encoding(), PackedVector<uint32_t>::Encoding::kBitPacked);
+  ExpectSameValues(*packed, cpus);
+  ASSERT_LT(packed->SizeInBytes() * 5, cpus.size() * sizeof(uint32_t));
+}
+
+TEST(PackedVector, SignedValues) {
+  std::vector<int32_t> values;
+  for (int32_t i = -500; i < 500; ++i)
+    values.push_back(i % 3 == 0 ? -1 : i % 7);
+
+  auto packed = PackedVector<int32_t>::Pack(values);
+  ASSERT_TRUE(packed);
+  ExpectSameValues(*packed, values);
+}
+
+TEST(PackedVector, FullWidthValues) {
+  std::vector<int64_t> values(3000, 0);
+  values[10] = std::numeric_limits<int64_t>::min();
+  values[11] = std::numeric_limits<int64_t>::max();
+  values[2500] = -1;
+
+  auto packed = PackedVector<int64_t>::Pack(values);
+  ASSERT_TRUE(packed);
+  ExpectSameValues(*packed, values);
+}
+
+TEST(PackedVector, RunLength) {
+  std::vector<uint32_t> arg_set_ids;
+  for (uint32_t i = 0; i < 100; ++i) {
+    for (uint32_t j = 0; j < 1000; ++j)
+      arg_set_ids.push_back(i * 1000000);
+  }
+
+  auto packed = PackedVector<uint32_t>::Pack(arg_set_ids);
+  ASSERT_TRUE(packed);
+  ASSERT_EQ(packed->encoding(), PackedVector<uint32_t>::Encoding::kRunLength);
+  ExpectSameValues(*packed, arg_set_ids);
+}
+
+TEST(PackedVector, RunLengthRunsAcrossBlocks) {
+  // Runs of 1 to 300 elements, so that blocks contain several runs, a single
+  // one or are covered by a run starting in a previous block.
+  std::vector<uint32_t> values;
+  for (uint32_t i = 0; values.size() < 20000; ++i) {
+    uint32_t run_length = (i * 37) % 300 + 1;
+    for (uint32_t j = 0; j < run_length; ++j)
+      values.push_back(i * 1000003);
+  }
+
+  auto packed = PackedVector<uint32_t>::Pack(values);
+  ASSERT_TRUE(packed);
+  ASSERT_EQ(packed->encoding(), PackedVector<uint32_t>::Encoding::kRunLength);
+  ExpectSameValues(*packed, values);
+}
+
+TEST(PackedVector, Dictionary) {
+  // Few distinct values spread over a large range, like the string ids of
+  // the keys of the args table.
+  std::minstd_rand0 rnd(42);
+  std::vector<uint32_t> keys;
+  for (uint32_t i = 0; i < 10000; ++i)
+    keys.push_back((rnd() % 50) * 100003);
+
+  auto packed = PackedVector<uint32_t>::Pack(keys);
+  ASSERT_TRUE(packed);
+  ASSERT_EQ(packed->encoding(), PackedVector<uint32_t>::Encoding::kDictionary);
+  ExpectSameValues(*packed, keys);
+  ASSERT_LT(packed->SizeInBytes() * 5, keys.size() * sizeof(uint32_t));
+
+  std::vector<int64_t> single(1000, -42);
+  single[999] = 42;
+  auto packed_single = PackedVector<int64_t>::Pack(single);
+  ASSERT_TRUE(packed_single);
+  ExpectSameValues(*packed_single, single);
+}
+
+TEST(PackedVector, DictionaryTooManyValues) {
+  // The dictionary only pays off with up to ~3500 distinct values of the
+  // 10000 here: it is not even built with more of them.
+  std::minstd_rand0 rnd(42);
+  for (uint32_t distinct : {2000u, 8000u}) {
+    std::vector<uint32_t> keys;
+    for (uint32_t i = 0; i < 10000; ++i)
+      keys.push_back((rnd() % distinct) * 100003);
+
+    auto packed = PackedVector<uint32_t>::Pack(keys);
+    if (distinct == 2000) {
+      ASSERT_TRUE(packed);
+      ASSERT_EQ(packed->encoding(),
+                PackedVector<uint32_t>::Encoding::kDictionary);
+      ExpectSameValues(*packed, keys);
+    } else {
+      ASSERT_FALSE(packed);
+    }
+  }
+}
+
+TEST(PackedVector, Doubles) {
+  std::vector<double> values(1000, 1.5);
+  values[500] = -2.25;
+
+  auto packed = PackedVector<double>::Pack(values);
+  ASSERT_TRUE(packed);
+  ExpectSameValues(*packed, values);
+}
+
+TEST(PackedVector, IncompressibleData) {
+  std::mt19937_64 rnd(42);
+  std::vector<uint64_t> values;
+  for (uint32_t i = 0; i < 1000; ++i)
+    values.push_back(rnd());
+  ASSERT_FALSE(PackedVector<uint64_t>::Pack(values));
+  ASSERT_FALSE(PackedVector<uint64_t>::Pack({}));
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/containers/radix_sort.h"
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace radix_sort {
+
+namespace {
+
+// 11 bit digits keep the histogram of a pass (8KB) in L1 while needing only
+// 6 passes for 64 bit keys.
+constexpr uint32_t kDigitBits = 11;
+constexpr uint32_t kBuckets = 1u << kDigitBits;
+constexpr uint64_t kDigitMask = kBuckets - 1;
+
+// Below this size the setup cost of the passes is higher than the cost of a
+// comparison sort.
+constexpr size_t kMinRadixSortSize = 256;
+
+}  // namespace
+
+void SortIndices(const std::vector<uint64_t>& keys,
+                 uint32_t key_bits,
+                 std::vector<uint32_t>* idx) {
+  PERFETTO_DCHECK(key_bits <= 64);
+  const size_t n = idx->size();
+  if (n < 2 || key_bits == 0)
+    return;
+
+  if (n < kMinRadixSortSize) {
+    std::stable_sort(idx->begin(), idx->end(), [&keys](uint32_t a, uint32_t b) {
+      return keys[a] < keys[b];
+    });
+    return;
+  }
+
+  // Compute the histograms of all the passes while gathering the keys in the
+  // order of |idx| so that the passes read them sequentially.
+  const uint32_t passes = (key_bits + kDigitBits - 1) / kDigitBits;
+  std::vector<uint32_t> counts(passes * kBuckets);
+  std::vector<uint64_t> cur_keys(n);
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t key = keys[(*idx)[i]];
+    PERFETTO_DCHECK(key_bits == 64 || (key >> key_bits) == 0);
+    cur_keys[i] = key;
+    for (uint32_t p = 0; p < passes; ++p)
+      counts[p * kBuckets + ((key >> (p * kDigitBits)) & kDigitMask)]++;
+  }
+
+  std::vector<uint64_t> next_keys(n);
+  std::vector<uint32_t> next_idx(n);
+  for (uint32_t p = 0; p < passes; ++p) {
+    const uint32_t shift = p * kDigitBits;
+    uint32_t* count = &counts[p * kBuckets];
+    if (count[(cur_keys[0] >> shift) & kDigitMask] == n)
+      continue;
+
+    // Turn the histogram into the start offset of each bucket.
+    uint32_t offset = 0;
+    for (uint32_t b = 0; b < kBuckets; ++b) {
+      uint32_t bucket_count = count[b];
+      count[b] = offset;
+      offset += bucket_count;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+      uint32_t pos = count[(cur_keys[i] >> shift) & kDigitMask]++;
+      next_keys[pos] = cur_keys[i];
+      next_idx[pos] = (*idx)[i];
+    }
+    cur_keys.swap(next_keys);
+    idx->swap(next_idx);
+  }
+}
+
+}  // namespace radix_sort
+}  // namespace trace_processor
+}  // namespace perfetto
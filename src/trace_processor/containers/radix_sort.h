@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_CONTAINERS_RADIX_SORT_H_
+#define SRC_TRACE_PROCESSOR_CONTAINERS_RADIX_SORT_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+namespace perfetto {
+namespace trace_processor {
+namespace radix_sort {
+
+// Maps |value| to an unsigned integer such that the order of the integers
+// matches the order of the values (i.e. ToSortableKey(a) < ToSortableKey(b)
+// iff a < b).
+inline uint64_t ToSortableKey(uint32_t value) {
+  return value;
+}
+inline uint64_t ToSortableKey(uint64_t value) {
+  return value;
+}
+inline uint64_t ToSortableKey(int32_t value) {
+  return static_cast<uint64_t>(static_cast<int64_t>(value)) ^ (1ull << 63);
+}
+inline uint64_t ToSortableKey(int64_t value) {
+  return static_cast<uint64_t>(value) ^ (1ull << 63);
+}
+inline uint64_t ToSortableKey(double value) {
+  // -0.0 and 0.0 compare equal so make sure they get the same key.
+  if (value == 0)
+    value = 0;
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  // Negative numbers have all their bits flipped so that larger magnitudes
+  // sort first; positive numbers only need to sort after negative ones.
+  return (bits & (1ull << 63)) ? ~bits : bits | (1ull << 63);
+}
+
+// Returns the number of bits needed to represent |value|.
+inline uint32_t BitWidth(uint64_t value) {
+  uint32_t width = 0;
+  for (; value; value >>= 1)
+    width++;
+  return width;
+}
+
+// Stably sorts |idx| in increasing order of |keys[idx[i]]| using an LSD radix
+// sort over the lowest |key_bits| bits of the keys. Higher bits of the keys
+// must be zero.
+//
+// The cost is linear in the number of elements and in |key_bits| so callers
+// should make the keys as narrow as possible (e.g. by subtracting the
+// minimum). Passes in which all the keys have the same digit are skipped.
+void SortIndices(const std::vector<uint64_t>& keys,
+                 uint32_t key_bits,
+                 std::vector<uint32_t>* idx);
+
+}  // namespace radix_sort
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_CONTAINERS_RADIX_SORT_H_
@@ -0,0 +1,92 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+#include <benchmark/benchmark.h>
+
+#include "src/trace_processor/containers/radix_sort.h"
+
+namespace radix_sort = perfetto::trace_processor::radix_sort;
+
+namespace {
+
+static constexpr uint32_t kSize = 1000000;
+
+// Timestamp-like keys: a large base with random deltas, rebased on the
+// minimum as Column::SortKeys does.
+std::vector<uint64_t> CreateTimestampKeys() {
+  static constexpr uint32_t kRandomSeed = 42;
+  std::minstd_rand0 rnd_engine(kRandomSeed);
+  std::vector<uint64_t> keys(kSize);
+  for (uint64_t& key : keys)
+    key = (static_cast<uint64_t>(rnd_engine()) << 8) % (60ull * 1000000000);
+  return keys;
+}
+
+// Keys with few distinct values (e.g. cpus or string ranks).
+std::vector<uint64_t> CreateSmallRangeKeys() {
+  static constexpr uint32_t kRandomSeed = 32;
+  std::minstd_rand0 rnd_engine(kRandomSeed);
+  std::vector<uint64_t> keys(kSize);
+  for (uint64_t& key : keys)
+    key = rnd_engine() % 16;
+  return keys;
+}
+
+void BenchRadixSort(benchmark::State& state, std::vector<uint64_t> keys) {
+  uint32_t bits =
+      radix_sort::BitWidth(*std::max_element(keys.begin(), keys.end()));
+  std::vector<uint32_t> idx(keys.size());
+  for (auto _ : state) {
+    std::iota(idx.begin(), idx.end(), 0);
+    radix_sort::SortIndices(keys, bits, &idx);
+    benchmark::DoNotOptimize(idx.data());
+  }
+}
+
+void BenchStableSort(benchmark::State& state, std::vector<uint64_t> keys) {
+  std::vector<uint32_t> idx(keys.size());
+  for (auto _ : state) {
+    std::iota(idx.begin(), idx.end(), 0);
+    std::stable_sort(idx.begin(), idx.end(), [&keys](uint32_t a, uint32_t b) {
+      return keys[a] < keys[b];
+    });
+    benchmark::DoNotOptimize(idx.data());
+  }
+}
+
+}  // namespace
+
+static void BM_RadixSortTimestamps(benchmark::State& state) {
+  BenchRadixSort(state, CreateTimestampKeys());
+}
+BENCHMARK(BM_RadixSortTimestamps);
+
+static void BM_StableSortTimestamps(benchmark::State& state) {
+  BenchStableSort(state, CreateTimestampKeys());
+}
+BENCHMARK(BM_StableSortTimestamps);
+
+static void BM_RadixSortSmallRange(benchmark::State& state) {
+  BenchRadixSort(state, CreateSmallRangeKeys());
+}
+BENCHMARK(BM_RadixSortSmallRange);
+
+static void BM_StableSortSmallRange(benchmark::State& state) {
+  BenchStableSort(state, CreateSmallRangeKeys());
+}
+BENCHMARK(BM_StableSortSmallRange);
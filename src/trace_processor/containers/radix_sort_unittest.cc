@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/containers/radix_sort.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <random>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace radix_sort {
+namespace {
+
+std::vector<uint32_t> RadixSorted(const std::vector<uint64_t>& keys,
+                                  uint32_t key_bits) {
+  std::vector<uint32_t> idx(keys.size());
+  std::iota(idx.begin(), idx.end(), 0);
+  SortIndices(keys, key_bits, &idx);
+  return idx;
+}
+
+std::vector<uint32_t> StableSorted(const std::vector<uint64_t>& keys) {
+  std::vector<uint32_t> idx(keys.size());
+  std::iota(idx.begin(), idx.end(), 0);
+  std::stable_sort(idx.begin(), idx.end(), [&keys](uint32_t a, uint32_t b) {
+    return keys[a] < keys[b];
+  });
+  return idx;
+}
+
+TEST(RadixSortUnittest, ToSortableKeyPreservesOrder) {
+  std::vector<int64_t> longs = {std::numeric_limits<int64_t>::min(), -5, -1,
+                                0, 1, 7, std::numeric_limits<int64_t>::max()};
+  for (uint32_t i = 1; i < longs.size(); ++i)
+    ASSERT_LT(ToSortableKey(longs[i - 1]), ToSortableKey(longs[i]));
+
+  std::vector<int32_t> ints = {std::numeric_limits<int32_t>::min(), -1, 0, 3,
+                               std::numeric_limits<int32_t>::max()};
+  for (uint32_t i = 1; i < ints.size(); ++i)
+    ASSERT_LT(ToSortableKey(ints[i - 1]), ToSortableKey(ints[i]));
+
+  std::vector<double> doubles = {-std::numeric_limits<double>::infinity(),
+                                 -1e10,
+                                 -1.5,
+                                 -std::numeric_limits<double>::min(),
+                                 0.0,
+                                 std::numeric_limits<double>::min(),
+                                 0.25,
+                                 1e300,
+                                 std::numeric_limits<double>::infinity()};
+  for (uint32_t i = 1; i < doubles.size(); ++i)
+    ASSERT_LT(ToSortableKey(doubles[i - 1]), ToSortableKey(doubles[i]));
+  ASSERT_EQ(ToSortableKey(-0.0), ToSortableKey(0.0));
+}
+
+TEST(RadixSortUnittest, BitWidth) {
+  ASSERT_EQ(BitWidth(0), 0u);
+  ASSERT_EQ(BitWidth(1), 1u);
+  ASSERT_EQ(BitWidth(2047), 11u);
+  ASSERT_EQ(BitWidth(2048), 12u);
+  ASSERT_EQ(BitWidth(std::numeric_limits<uint64_t>::max()), 64u);
+}
+
+TEST(RadixSortUnittest, SmallInputs) {
+  ASSERT_EQ(RadixSorted({}, 3), std::vector<uint32_t>());
+  ASSERT_EQ(RadixSorted({5}, 3), std::vector<uint32_t>({0}));
+  ASSERT_EQ(RadixSorted({3, 1, 2, 1, 0}, 2),
+            std::vector<uint32_t>({4, 1, 3, 2, 0}));
+}
+
+TEST(RadixSortUnittest, MatchesStableSort) {
+  std::minstd_rand0 rnd(42);
+  for (uint32_t bits : {1u, 7u, 11u, 12u, 33u, 64u}) {
+    std::vector<uint64_t> keys(10000);
+    for (uint64_t& key : keys) {
+      key = (static_cast<uint64_t>(rnd()) << 32) ^ rnd();
+      if (bits < 64)
+        key &= (1ull << bits) - 1;
+    }
+    ASSERT_EQ(RadixSorted(keys, bits), StableSorted(keys)) << bits;
+  }
+}
+
+TEST(RadixSortUnittest, PartialIndexVector) {
+  // Only the rows in |idx| are sorted and |idx| can already be permuted.
+  std::minstd_rand0 rnd(7);
+  std::vector<uint64_t> keys(5000);
+  for (uint64_t& key : keys)
+    key = rnd() % 100;
+
+  std::vector<uint32_t> idx;
+  for (uint32_t i = static_cast<uint32_t>(keys.size()); i-- > 0;) {
+    if (i % 3 != 0)
+      idx.push_back(i);
+  }
+  std::vector<uint32_t> expected = idx;
+  std::stable_sort(
+      expected.begin(), expected.end(),
+      [&keys](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+
+  SortIndices(keys, BitWidth(99), &idx);
+  ASSERT_EQ(idx, expected);
+}
+
+}  // namespace
+}  // namespace radix_sort
+}  // namespace trace_processor
+}  // namespace perfetto
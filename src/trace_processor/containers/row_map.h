@@ -18,7 +18,9 @@
 #define SRC_TRACE_PROCESSOR_CONTAINERS_ROW_MAP_H_
 
 #include <stdint.h>
+#include <string.h>
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 
@@ -83,7 +85,8 @@ class RowMap {
   // BitVector::SetBitsIterator.
   class RangeIterator {
    public:
-    RangeIterator(const RowMap* rm) : rm_(rm), index_(rm->start_index_) {}
+    RangeIterator(const RowMap* rm) : RangeIterator(rm, rm->start_index_) {}
+    RangeIterator(const RowMap* rm, uint32_t index) : rm_(rm), index_(index) {}
 
     void Next() { ++index_; }
 
@@ -103,7 +106,8 @@ class RowMap {
   // BitVector::SetBitsIterator.
   class IndexVectorIterator {
    public:
-    IndexVectorIterator(const RowMap* rm) : rm_(rm) {}
+    IndexVectorIterator(const RowMap* rm, uint32_t ordinal = 0)
+        : rm_(rm), ordinal_(ordinal) {}
 
     void Next() { ++ordinal_; }
 
@@ -133,14 +137,14 @@ class RowMap {
     Iterator(const RowMap* rm) : rm_(rm) {
       switch (rm->mode_) {
         case Mode::kRange:
-          range_it_.reset(new RangeIterator(rm));
+          range_it_ = RangeIterator(rm);
           break;
         case Mode::kBitVector:
           set_bits_it_.reset(
               new BitVector::SetBitsIterator(rm->bit_vector_.IterateSetBits()));
           break;
         case Mode::kIndexVector:
-          iv_it_.reset(new IndexVectorIterator(rm));
+          iv_it_ = IndexVectorIterator(rm);
           break;
       }
     }
@@ -189,6 +193,38 @@ class RowMap {
       PERFETTO_FATAL("For GCC");
     }
 
+    // Writes the indices of the next (up to) |max| rows to |out|, forwarding
+    // the iterator past them, and returns the number of indices written.
+    //
+    // This is more efficient than calling index() and Next() for every row as
+    // the mode of the RowMap is only looked up once.
+    uint32_t NextBatch(uint32_t max, OutputIndex* out) {
+      uint32_t n = 0;
+      switch (rm_->mode_) {
+        case Mode::kRange: {
+          uint32_t start = range_it_->index();
+          n = std::min(max, rm_->end_index_ - start);
+          for (uint32_t i = 0; i < n; ++i)
+            out[i] = start + i;
+          *range_it_ = RangeIterator(rm_, start + n);
+          break;
+        }
+        case Mode::kBitVector:
+          for (; n < max && *set_bits_it_; ++n, set_bits_it_->Next())
+            out[n] = set_bits_it_->index();
+          break;
+        case Mode::kIndexVector: {
+          uint32_t start = iv_it_->ordinal();
+          uint32_t size = static_cast<uint32_t>(rm_->index_vector_.size());
+          n = std::min(max, size - start);
+          memcpy(out, rm_->index_vector_.data() + start, n * sizeof(uint32_t));
+          *iv_it_ = IndexVectorIterator(rm_, start + n);
+          break;
+        }
+      }
+      return n;
+    }
+
     // Returns the row of the index the iterator points to.
     InputRow row() const {
       switch (rm_->mode_) {
@@ -206,11 +242,12 @@ class RowMap {
     Iterator(const Iterator&) = delete;
     Iterator& operator=(const Iterator&) = delete;
 
-    // Only one of the below will be non-null depending on the mode of the
-    // RowMap.
-    std::unique_ptr<RangeIterator> range_it_;
+    // Only one of the below will be set depending on the mode of the RowMap.
+    // The set bits iterator is heap allocated as it contains a large buffer of
+    // indices which would make moving the iterator expensive.
+    base::Optional<RangeIterator> range_it_;
     std::unique_ptr<BitVector::SetBitsIterator> set_bits_it_;
-    std::unique_ptr<IndexVectorIterator> iv_it_;
+    base::Optional<IndexVectorIterator> iv_it_;
 
     const RowMap* rm_ = nullptr;
   };
@@ -496,6 +533,16 @@ class RowMap {
   // Returns if the RowMap is internally represented using a range.
   bool IsRange() const { return mode_ == Mode::kRange; }
 
+  // Returns the BitVector or the index vector backing the RowMap, or null if
+  // the RowMap is represented differently. Together with IsRange(), these
+  // allow serializing a RowMap.
+  const BitVector* GetIfBitVector() const {
+    return mode_ == Mode::kBitVector ? &bit_vector_ : nullptr;
+  }
+  const std::vector<OutputIndex>* GetIfIndexVector() const {
+    return mode_ == Mode::kIndexVector ? &index_vector_ : nullptr;
+  }
+
  private:
   enum class Mode {
     kRange,
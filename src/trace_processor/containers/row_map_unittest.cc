@@ -345,6 +345,41 @@ TEST(RowMapUnittest, IntersectManyIv) {
   ASSERT_EQ(rm.Get(2u), 3u);
 }
 
+// Reads all the indices of |rm| in batches of |batch_size|.
+std::vector<uint32_t> ReadInBatches(const RowMap& rm, uint32_t batch_size) {
+  std::vector<uint32_t> res;
+  std::vector<uint32_t> batch(batch_size);
+  auto it = rm.IterateRows();
+  for (uint32_t n = it.NextBatch(batch_size, batch.data()); n > 0;
+       n = it.NextBatch(batch_size, batch.data())) {
+    res.insert(res.end(), batch.begin(), batch.begin() + n);
+  }
+  EXPECT_FALSE(it);
+  return res;
+}
+
+TEST(RowMapUnittest, NextBatch) {
+  std::vector<uint32_t> iv = {3u, 2u, 0u, 1u, 1u, 3u, 7u};
+  BitVector bv{true, false, true, true, false, true, false, true};
+  for (uint32_t batch_size : {1u, 3u, 7u, 100u}) {
+    ASSERT_EQ(ReadInBatches(RowMap(3, 7), batch_size),
+              std::vector<uint32_t>({3u, 4u, 5u, 6u}));
+    ASSERT_EQ(ReadInBatches(RowMap(iv), batch_size), iv);
+    ASSERT_EQ(ReadInBatches(RowMap(bv.Copy()), batch_size),
+              std::vector<uint32_t>({0u, 2u, 3u, 5u, 7u}));
+  }
+
+  // Batches can be mixed with single row iteration.
+  RowMap rm(std::vector<uint32_t>{5u, 4u, 3u});
+  auto it = rm.IterateRows();
+  it.Next();
+  uint32_t batch[2];
+  ASSERT_EQ(it.NextBatch(2, batch), 2u);
+  ASSERT_EQ(batch[0], 4u);
+  ASSERT_EQ(batch[1], 3u);
+  ASSERT_FALSE(it);
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -39,14 +39,24 @@ constexpr size_t StringPool::kBlockIndexBitMask;
 constexpr size_t StringPool::kBlockSizeBytes;
 // static
 constexpr size_t StringPool::kMinLargeStringSizeBytes;
+// static
+constexpr size_t StringPool::kMaxBlocks;
+// static
+constexpr size_t StringPool::kNumLargeStringSegments;
+// static
+constexpr size_t StringPool::kNumShardBits;
+// static
+constexpr size_t StringPool::kNumShards;
 #endif
 
-StringPool::StringPool() {
+StringPool::StringPool()
+    : shards_(new Shard[kNumShards]), storage_mutex_(new std::mutex()) {
   static_assert(
       StringPool::kMinLargeStringSizeBytes <= StringPool::kBlockSizeBytes + 1,
       "minimum size of large strings must be small enough to support any "
       "string that doesn't fit in a Block.");
 
+  blocks_.reserve(kMaxBlocks);
   blocks_.emplace_back(kBlockSizeBytes);
 
   // Reserve a slot for the null string.
@@ -73,6 +83,7 @@ StringPool::Id StringPool::InsertString(base::StringView str, uint64_t hash) {
     if (str.size() + kMaxMetadataSize >= kMinLargeStringSizeBytes) {
       return InsertLargeString(str, hash);
     }
+    PERFETTO_CHECK(blocks_.size() < kMaxBlocks);
     blocks_.emplace_back(kBlockSizeBytes);
 
     // Try and reserve space again - this time we should definitely succeed.
@@ -84,22 +95,30 @@ StringPool::Id StringPool::InsertString(base::StringView str, uint64_t hash) {
   // hash to the id.
   Id string_id = Id::BlockString(blocks_.size() - 1, offset);
 
-  // Deliberately not adding |string_id| to |string_index_|. The caller
+  // Deliberately not adding |string_id| to the index. The caller
   // (InternString()) must take care of this.
-  PERFETTO_DCHECK(string_index_.Find(hash));
+  PERFETTO_DCHECK(ShardForHash(hash).index.Find(hash));
 
   return string_id;
 }
 
 StringPool::Id StringPool::InsertLargeString(base::StringView str,
                                              uint64_t hash) {
-  large_strings_.emplace_back(new std::string(str.begin(), str.size()));
+  size_t index = large_strings_count_;
+  auto segment_and_offset = LargeStringSegment(index);
+  PERFETTO_CHECK(segment_and_offset.first < kNumLargeStringSegments);
+  auto& segment = large_strings_[segment_and_offset.first];
+  if (!segment)
+    segment.reset(new std::string[1ull << segment_and_offset.first]);
+  segment[segment_and_offset.second].assign(str.begin(), str.size());
+  large_strings_count_++;
+
   // Compute id from the index and add a mapping from the hash to the id.
-  Id string_id = Id::LargeString(large_strings_.size() - 1);
+  Id string_id = Id::LargeString(index);
 
-  // Deliberately not adding |string_id| to |string_index_|. The caller
+  // Deliberately not adding |string_id| to the index. The caller
   // (InternString()) must take care of this.
-  PERFETTO_DCHECK(string_index_.Find(hash));
+  PERFETTO_DCHECK(ShardForHash(hash).index.Find(hash));
 
   return string_id;
 }
@@ -161,14 +180,14 @@ StringPool::Iterator& StringPool::Iterator::operator++() {
   }
 
   // Advance to the next string from |large_strings_|.
-  PERFETTO_DCHECK(large_strings_index_ < pool_->large_strings_.size());
+  PERFETTO_DCHECK(large_strings_index_ < pool_->large_strings_count_);
   large_strings_index_++;
   return *this;
 }
 
 StringPool::Iterator::operator bool() const {
   return block_index_ < pool_->blocks_.size() ||
-         large_strings_index_ < pool_->large_strings_.size();
+         large_strings_index_ < pool_->large_strings_count_;
 }
 
 NullTermStringView StringPool::Iterator::StringView() {
@@ -184,7 +203,7 @@ StringPool::Id StringPool::Iterator::StringId() {
       return Id::Null();
     return Id::BlockString(block_index_, block_offset_);
   }
-  PERFETTO_DCHECK(large_strings_index_ < pool_->large_strings_.size());
+  PERFETTO_DCHECK(large_strings_index_ < pool_->large_strings_count_);
   return Id::LargeString(large_strings_index_);
 }
 
@@ -20,7 +20,10 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <array>
 #include <limits>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include "perfetto/ext/base/flat_hash_map.h"
@@ -35,6 +38,11 @@ namespace trace_processor {
 
 // Interns strings in a string pool and hands out compact StringIds which can
 // be used to retrieve the string in O(1).
+//
+// The pool is not thread-safe with the exception of InternStringConcurrently()
+// which can be called from multiple threads at the same time, and Get() which
+// can be called at any time for Ids which have been handed out (i.e. reads
+// never block and never wait for writers).
 class StringPool {
  public:
   struct Id {
@@ -122,7 +130,7 @@ class StringPool {
 
     // Perform a hashtable insertion with a null ID just to check if the string
     // is already inserted. If it's not, overwrite 0 with the actual Id.
-    auto it_and_inserted = string_index_.Insert(hash, Id());
+    auto it_and_inserted = ShardForHash(hash).index.Insert(hash, Id());
     Id* id = it_and_inserted.first;
     if (!it_and_inserted.second) {
       PERFETTO_DCHECK(Get(*id) == str);
@@ -132,12 +140,38 @@ class StringPool {
     return *id;
   }
 
+  // Same as InternString() but can be called from multiple threads at the
+  // same time (e.g. by importers parsing different streams in parallel). Must
+  // not be called at the same time as any other non-const method.
+  //
+  // Lookups only lock the shard of the index the string hashes to so threads
+  // rarely contend on them; the storage is only locked to add new strings.
+  // Note that the Ids of new strings depend on the order in which threads
+  // intern them.
+  Id InternStringConcurrently(base::StringView str) {
+    if (str.data() == nullptr)
+      return Id::Null();
+
+    auto hash = str.Hash();
+    Shard& shard = ShardForHash(hash);
+    std::lock_guard<std::mutex> shard_lock(shard.mutex);
+    auto it_and_inserted = shard.index.Insert(hash, Id());
+    Id* id = it_and_inserted.first;
+    if (!it_and_inserted.second) {
+      PERFETTO_DCHECK(Get(*id) == str);
+      return *id;
+    }
+    std::lock_guard<std::mutex> storage_lock(*storage_mutex_);
+    *id = InsertString(str, hash);
+    return *id;
+  }
+
   base::Optional<Id> GetId(base::StringView str) const {
     if (str.data() == nullptr)
       return Id::Null();
 
     auto hash = str.Hash();
-    Id* id = string_index_.Find(hash);
+    Id* id = ShardForHash(hash).index.Find(hash);
     if (id) {
       PERFETTO_DCHECK(Get(*id) == str);
       return *id;
@@ -155,11 +189,30 @@ class StringPool {
 
   Iterator CreateIterator() const { return Iterator(this); }
 
-  size_t size() const { return string_index_.size(); }
+  size_t size() const {
+    size_t size = 0;
+    for (size_t i = 0; i < kNumShards; ++i)
+      size += shards_[i].index.size();
+    return size;
+  }
 
  private:
   using StringHash = uint64_t;
 
+  // The index from string hashes to Ids is split in shards, each with its own
+  // lock for InternStringConcurrently().
+  struct Shard {
+    std::mutex mutex;
+    base::FlatHashMap<StringHash,
+                      Id,
+                      base::AlreadyHashed<StringHash>,
+                      base::LinearProbe,
+                      /*AppendOnly=*/true>
+        index{/*initial_capacity=*/256u};
+  };
+  static constexpr size_t kNumShardBits = 4;
+  static constexpr size_t kNumShards = 1u << kNumShardBits;
+
   struct Block {
     explicit Block(size_t size)
         : mem_(base::PagedMemory::Allocate(size,
@@ -218,6 +271,11 @@ class StringPool {
       0xffffffff & ~kLargeStringFlagBitMask & ~kBlockOffsetBitMask;
 
   static constexpr size_t kBlockSizeBytes = kBlockOffsetBitMask + 1;  // 32 MB
+  static constexpr size_t kMaxBlocks = 1u << kNumBlockIndexBits;
+
+  // Large strings are stored in segments of doubling size (segment i has 2^i
+  // strings) so appending a large string never moves the existing ones.
+  static constexpr size_t kNumLargeStringSegments = 31;
 
   // If a string doesn't fit into the current block, we can either start a new
   // block or insert the string into the |large_strings_| vector. To maximize
@@ -236,6 +294,30 @@ class StringPool {
   // Insert a large string into the pool and return its Id.
   Id InsertLargeString(base::StringView, uint64_t hash);
 
+  // FlatHashMap uses the bottom bits of the hash for the bucket and the top
+  // ones for the tag so pick the shard from the middle ones.
+  Shard& ShardForHash(StringHash hash) const {
+    return shards_[(hash >> 32) & (kNumShards - 1)];
+  }
+
+  // Returns the segment and the index in the segment of the large string at
+  // |index|.
+  static std::pair<size_t, size_t> LargeStringSegment(size_t index) {
+    // Segment i starts at index 2^i - 1.
+    uint64_t pos = static_cast<uint64_t>(index) + 1;
+    size_t segment = 0;
+    while (pos >> (segment + 1))
+      segment++;
+    return std::make_pair(segment,
+                          static_cast<size_t>(pos - (1ull << segment)));
+  }
+
+  const std::string& LargeStringAt(size_t index) const {
+    auto segment_and_offset = LargeStringSegment(index);
+    return large_strings_[segment_and_offset.first]
+                         [segment_and_offset.second];
+  }
+
   // The returned pointer points to the start of the string metadata (i.e. the
   // first byte of the size).
   const uint8_t* IdToPtr(Id id) const {
@@ -278,26 +360,27 @@ class StringPool {
   NullTermStringView GetLargeString(Id id) const {
     PERFETTO_DCHECK(id.is_large_string());
     size_t index = id.large_string_index();
-    PERFETTO_DCHECK(index < large_strings_.size());
-    const std::string* str = large_strings_[index].get();
-    return NullTermStringView(str->c_str(), str->size());
+    PERFETTO_DCHECK(index < large_strings_count_);
+    const std::string& str = LargeStringAt(index);
+    return NullTermStringView(str.c_str(), str.size());
   }
 
-  // The actual memory storing the strings.
+  // The actual memory storing the strings. The capacity is reserved upfront
+  // for all the blocks an Id can address, so adding a block never moves the
+  // existing ones while other threads read them.
   std::vector<Block> blocks_;
 
-  // Any string that is too large to fit into a Block is stored separately
-  // (inside a unique_ptr to ensure any references to it remain valid even if
-  // |large_strings_| is resized).
-  std::vector<std::unique_ptr<std::string>> large_strings_;
+  // Any string that is too large to fit into a Block is stored separately, in
+  // the segments described above.
+  std::array<std::unique_ptr<std::string[]>, kNumLargeStringSegments>
+      large_strings_;
+  size_t large_strings_count_ = 0;
 
   // Maps hashes of strings to the Id in the string pool.
-  base::FlatHashMap<StringHash,
-                    Id,
-                    base::AlreadyHashed<StringHash>,
-                    base::LinearProbe,
-                    /*AppendOnly=*/true>
-      string_index_{/*initial_capacity=*/4096u};
+  std::unique_ptr<Shard[]> shards_;
+
+  // Serializes the insertion of new strings by InternStringConcurrently().
+  std::unique_ptr<std::mutex> storage_mutex_;
 };
 
 }  // namespace trace_processor
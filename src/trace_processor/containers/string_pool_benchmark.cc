@@ -0,0 +1,116 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "src/trace_processor/containers/string_pool.h"
+
+using perfetto::base::StringView;
+using perfetto::trace_processor::StringPool;
+
+namespace {
+
+// Roughly the shape of the strings interned while parsing a trace: each event
+// has a slice name (a few thousand distinct names, heavily skewed towards a
+// small number of hot ones) and a few arg keys (a few dozen distinct keys)
+// and, less often, a thread name (a few hundred distinct names).
+static constexpr uint32_t kEvents = 1024 * 256;
+static constexpr uint32_t kSliceNames = 5000;
+static constexpr uint32_t kArgKeys = 40;
+static constexpr uint32_t kThreadNames = 300;
+static constexpr uint32_t kArgsPerEvent = 3;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+std::vector<std::string> CreateStrings(uint32_t events, uint32_t seed) {
+  std::minstd_rand0 rnd_engine(seed);
+  std::vector<std::string> strings;
+  for (uint32_t i = 0; i < events; ++i) {
+    // Squaring a uniform number in [0, 1) makes the low indices much more
+    // likely than the high ones.
+    double r = static_cast<double>(rnd_engine()) / rnd_engine.max();
+    uint32_t slice = static_cast<uint32_t>(r * r * kSliceNames);
+    strings.push_back("Choreographer#doFrame " + std::to_string(slice));
+    for (uint32_t j = 0; j < kArgsPerEvent; ++j) {
+      uint32_t key = rnd_engine() % kArgKeys;
+      strings.push_back("args.debug.annotation_" + std::to_string(key));
+    }
+    if (rnd_engine() % 16 == 0) {
+      uint32_t thread = rnd_engine() % kThreadNames;
+      strings.push_back("RenderThread-" + std::to_string(thread));
+    }
+  }
+  return strings;
+}
+
+uint32_t EventCount() {
+  return IsBenchmarkFunctionalOnly() ? 1024 : kEvents;
+}
+
+}  // namespace
+
+static void BM_StringPoolIntern(benchmark::State& state) {
+  std::vector<std::string> strings = CreateStrings(EventCount(), 42);
+
+  for (auto _ : state) {
+    StringPool pool;
+    for (const std::string& str : strings)
+      benchmark::DoNotOptimize(pool.InternString(StringView(str)));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(strings.size()));
+}
+BENCHMARK(BM_StringPoolIntern);
+
+// Splits the same amount of work as BM_StringPoolIntern across
+// |state.range(0)| threads which intern in a shared pool.
+static void BM_StringPoolInternConcurrently(benchmark::State& state) {
+  uint32_t threads = static_cast<uint32_t>(state.range(0));
+  std::vector<std::vector<std::string>> strings;
+  size_t total = 0;
+  for (uint32_t i = 0; i < threads; ++i) {
+    strings.emplace_back(CreateStrings(EventCount() / threads, 42 + i));
+    total += strings.back().size();
+  }
+
+  for (auto _ : state) {
+    StringPool pool;
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < threads; ++i) {
+      workers.emplace_back([&pool, &strings, i] {
+        for (const std::string& str : strings[i]) {
+          benchmark::DoNotOptimize(
+              pool.InternStringConcurrently(StringView(str)));
+        }
+      });
+    }
+    for (std::thread& worker : workers)
+      worker.join();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(total));
+}
+BENCHMARK(BM_StringPoolInternConcurrently)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->Arg(8)
+    ->UseRealTime();
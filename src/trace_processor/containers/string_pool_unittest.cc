@@ -16,8 +16,11 @@
 
 #include "src/trace_processor/containers/string_pool.h"
 
+#include <algorithm>
 #include <array>
 #include <random>
+#include <string>
+#include <thread>
 
 #include "test/gtest_and_gmock.h"
 
@@ -128,6 +131,42 @@ TEST_F(StringPoolTest, StressTest) {
   ASSERT_EQ(string_map.size(), 0u);
 }
 
+TEST_F(StringPoolTest, InternConcurrently) {
+  static constexpr uint32_t kThreads = 4;
+  static constexpr uint32_t kStrings = 20000;
+
+  // Every thread interns the same strings in a different order and reads
+  // back the strings interned so far.
+  std::array<std::vector<StringPool::Id>, kThreads> ids;
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < kThreads; ++t) {
+    threads.emplace_back([this, t, &ids] {
+      std::minstd_rand0 rnd_engine(t);
+      std::vector<uint32_t> order(kStrings);
+      for (uint32_t i = 0; i < kStrings; ++i)
+        order[i] = i;
+      std::shuffle(order.begin(), order.end(), rnd_engine);
+
+      ids[t].resize(kStrings);
+      for (uint32_t i : order) {
+        std::string str = "str_" + std::to_string(i % (kStrings / 2)) + "_" +
+                          std::to_string(i);
+        ids[t][i] = pool_.InternStringConcurrently(base::StringView(str));
+        PERFETTO_CHECK(pool_.Get(ids[t][i]) == base::StringView(str));
+      }
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+
+  // Each string should have a single id, whichever thread interned it first.
+  for (uint32_t i = 0; i < kStrings; ++i) {
+    for (uint32_t t = 1; t < kThreads; ++t)
+      ASSERT_EQ(ids[t][i], ids[0][i]);
+  }
+  ASSERT_EQ(pool_.size(), kStrings);
+}
+
 TEST_F(StringPoolTest, BigString) {
   // Two of these should fit into one block, but the third one should go into
   // the |large_strings_| list.
@@ -16,6 +16,11 @@
 
 #include "src/trace_processor/db/column.h"
 
+#include <algorithm>
+#include <limits>
+
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "src/trace_processor/containers/radix_sort.h"
 #include "src/trace_processor/db/compare.h"
 #include "src/trace_processor/db/table.h"
 #include "src/trace_processor/util/glob.h"
@@ -51,7 +56,7 @@ Column::Column(const char* name,
       index_in_table_(index_in_table),
       overlay_index_(overlay_index),
       string_pool_(table->string_pool_) {
-  // Check that the dense-ness of the column and the nullable vector match.
+  // Check that the dense-ness of the column and the storage match.
   if (IsNullable() && !IsDummy()) {
     bool is_storage_dense;
     switch (type_) {
@@ -500,6 +505,176 @@ void Column::StableSortNumeric(std::vector<uint32_t>* out) const {
   });
 }
 
+void Column::GetAtIdxBatch(const uint32_t* idx,
+                           uint32_t n,
+                           SqlValue* out) const {
+  switch (type_) {
+    case ColumnType::kInt32:
+      GetAtIdxBatchTyped<int32_t>(idx, n, out);
+      return;
+    case ColumnType::kUint32:
+      GetAtIdxBatchTyped<uint32_t>(idx, n, out);
+      return;
+    case ColumnType::kInt64:
+      GetAtIdxBatchTyped<int64_t>(idx, n, out);
+      return;
+    case ColumnType::kDouble:
+      GetAtIdxBatchTyped<double>(idx, n, out);
+      return;
+    case ColumnType::kString: {
+      const auto& st = storage<StringPool::Id>();
+      for (uint32_t i = 0; i < n; ++i) {
+        const char* str = string_pool_->Get(st.Get(idx[i])).c_str();
+        out[i] = str == nullptr ? SqlValue() : SqlValue::String(str);
+      }
+      return;
+    }
+    case ColumnType::kId:
+      for (uint32_t i = 0; i < n; ++i)
+        out[i] = SqlValue::Long(idx[i]);
+      return;
+    case ColumnType::kDummy:
+      PERFETTO_FATAL("GetAtIdxBatch not allowed on dummy column");
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+template <typename T>
+void Column::GetAtIdxBatchTyped(const uint32_t* idx,
+                                uint32_t n,
+                                SqlValue* out) const {
+  if (IsNullable()) {
+    const auto& st = storage<base::Optional<T>>();
+    for (uint32_t i = 0; i < n; ++i) {
+      base::Optional<T> value = st.Get(idx[i]);
+      out[i] = value ? ToSqlValue(*value) : SqlValue();
+    }
+    return;
+  }
+  const auto& st = storage<T>();
+  for (uint32_t i = 0; i < n; ++i)
+    out[i] = ToSqlValue(st.Get(idx[i]));
+}
+
+base::Optional<Column::SortKeyInfo> Column::PrepareSortKeys(bool desc) const {
+  PERFETTO_CHECK(type_ != ColumnType::kDummy);
+
+  SortKeyInfo info;
+  info.desc = desc;
+  if (type_ == ColumnType::kString) {
+    // Rank the distinct strings of the column: as strings are interned, this
+    // requires comparing each distinct string only O(log(distinct)) times
+    // rather than comparing strings for every pair of rows being sorted.
+    const auto& st = storage<StringPool::Id>();
+    std::vector<StringPool::Id> ids;
+    for (auto it = overlay().IterateRows(); it; it.Next()) {
+      StringPool::Id id = st.Get(it.index());
+      if (!id.is_null() && info.string_ranks.Insert(id.raw_id(), 0).second)
+        ids.emplace_back(id);
+    }
+    std::sort(ids.begin(), ids.end(),
+              [this](StringPool::Id a, StringPool::Id b) {
+                return compare::String(string_pool_->Get(a),
+                                       string_pool_->Get(b)) < 0;
+              });
+    for (uint32_t i = 0; i < ids.size(); ++i)
+      *info.string_ranks.Find(ids[i].raw_id()) = i;
+  }
+
+  // Compute the range of the raw keys.
+  uint64_t min = std::numeric_limits<uint64_t>::max();
+  uint64_t max = 0;
+  bool has_nulls = false;
+  ForEachRawSortKey(info, [&](uint32_t, base::Optional<uint64_t> key) {
+    if (!key) {
+      has_nulls = true;
+      return;
+    }
+    min = std::min(min, *key);
+    max = std::max(max, *key);
+  });
+
+  bool has_values = min <= max;
+  info.null_offset = has_nulls ? 1 : 0;
+  if (has_values && has_nulls &&
+      max - min == std::numeric_limits<uint64_t>::max()) {
+    return base::nullopt;
+  }
+  info.min = has_values ? min : 0;
+  info.max_key = has_values ? max - min + info.null_offset : 0;
+  info.bits = radix_sort::BitWidth(info.max_key);
+  return base::make_optional(std::move(info));
+}
+
+void Column::SortKeys(const SortKeyInfo& info,
+                      std::vector<uint64_t>* keys) const {
+  keys->resize(overlay().size());
+  uint64_t* out = keys->data();
+  ForEachRawSortKey(info, [&info, out](uint32_t i,
+                                       base::Optional<uint64_t> raw_key) {
+    uint64_t key = raw_key ? *raw_key - info.min + info.null_offset : 0;
+    out[i] = info.desc ? info.max_key - key : key;
+  });
+}
+
+template <typename Fn>
+void Column::ForEachRawSortKey(const SortKeyInfo& info, Fn fn) const {
+  switch (type_) {
+    case ColumnType::kInt32:
+      return IsNullable() ? ForEachRawSortKeyNumeric<int32_t, true>(fn)
+                          : ForEachRawSortKeyNumeric<int32_t, false>(fn);
+    case ColumnType::kUint32:
+      return IsNullable() ? ForEachRawSortKeyNumeric<uint32_t, true>(fn)
+                          : ForEachRawSortKeyNumeric<uint32_t, false>(fn);
+    case ColumnType::kInt64:
+      return IsNullable() ? ForEachRawSortKeyNumeric<int64_t, true>(fn)
+                          : ForEachRawSortKeyNumeric<int64_t, false>(fn);
+    case ColumnType::kDouble:
+      return IsNullable() ? ForEachRawSortKeyNumeric<double, true>(fn)
+                          : ForEachRawSortKeyNumeric<double, false>(fn);
+    case ColumnType::kString: {
+      const auto& st = storage<StringPool::Id>();
+      uint32_t i = 0;
+      for (auto it = overlay().IterateRows(); it; it.Next(), ++i) {
+        StringPool::Id id = st.Get(it.index());
+        fn(i, id.is_null() ? base::nullopt
+                           : base::make_optional<uint64_t>(
+                                 *info.string_ranks.Find(id.raw_id())));
+      }
+      return;
+    }
+    case ColumnType::kId: {
+      uint32_t i = 0;
+      for (auto it = overlay().IterateRows(); it; it.Next(), ++i)
+        fn(i, base::make_optional<uint64_t>(it.index()));
+      return;
+    }
+    case ColumnType::kDummy:
+      PERFETTO_FATAL("SortKeys not allowed on dummy column");
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+template <typename T, bool is_nullable, typename Fn>
+void Column::ForEachRawSortKeyNumeric(Fn fn) const {
+  PERFETTO_DCHECK(IsNullable() == is_nullable);
+  PERFETTO_DCHECK(ColumnTypeHelper<T>::ToColumnType() == type_);
+
+  uint32_t i = 0;
+  if (is_nullable) {
+    const auto& st = storage<base::Optional<T>>();
+    for (auto it = overlay().IterateRows(); it; it.Next(), ++i) {
+      base::Optional<T> value = st.Get(it.index());
+      fn(i, value ? base::make_optional(radix_sort::ToSortableKey(*value))
+                  : base::nullopt);
+    }
+    return;
+  }
+  const auto& st = storage<T>();
+  for (auto it = overlay().IterateRows(); it; it.Next(), ++i)
+    fn(i, base::make_optional(radix_sort::ToSortableKey(st.Get(it.index()))));
+}
+
 const ColumnStorageOverlay& Column::overlay() const {
   PERFETTO_DCHECK(type_ != ColumnType::kDummy);
   return table_->overlays_[overlay_index()];
@@ -20,6 +20,7 @@
 #include <stdint.h>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "perfetto/ext/base/optional.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "src/trace_processor/containers/row_map.h"
@@ -117,12 +118,12 @@ class Column {
     // up filtering and skip sorting.
     kSorted = 1 << 0,
 
-    // Indicates the data in the column is non-null. That is, the NullableVector
+    // Indicates the data in the column is non-null. That is, the ColumnStorage
     // passed in will never have any null entries. This is only used for
     // numeric columns (string columns and id columns both have special
     // handling which ignores this flag).
     //
-    // This is used to speed up filters as we can safely index NullableVector
+    // This is used to speed up filters as we can safely index ColumnStorage
     // directly if this flag is set.
     kNonNull = 1 << 1,
 
@@ -293,6 +294,36 @@ class Column {
   // on the contents of this column.
   void StableSort(bool desc, std::vector<uint32_t>* idx) const;
 
+  // Maps the values of this column to integer keys such that sorting the rows
+  // by increasing key (e.g. with radix_sort::SortIndices) sorts them in
+  // ascending or descending order of the contents of this column. Computed by
+  // PrepareSortKeys() and used by SortKeys().
+  struct SortKeyInfo {
+    // Number of bits of the keys.
+    uint32_t bits = 0;
+    bool desc = false;
+
+    // Raw keys are rebased on |min|, leaving 0 for nulls if the column has any
+    // (|null_offset| is then 1).
+    uint64_t min = 0;
+    uint64_t null_offset = 0;
+    uint64_t max_key = 0;
+
+    // For string columns, the rank of each distinct string among the strings
+    // of the column.
+    base::FlatHashMap<uint32_t, uint32_t> string_ranks;
+  };
+
+  // Computes the range of the sort keys of this column in ascending or
+  // descending order (determined by |desc|), without materializing them. Keys
+  // use as few bits as possible; strings are keyed by their rank among the
+  // distinct strings of the column.
+  // Returns base::nullopt if the keys do not fit in 64 bits.
+  base::Optional<SortKeyInfo> PrepareSortKeys(bool desc) const;
+
+  // Computes the key of every row of this column, as described by |info|.
+  void SortKeys(const SortKeyInfo& info, std::vector<uint64_t>* keys) const;
+
   // Updates the given RowMap by only keeping rows where this column meets the
   // given filter constraint.
   void FilterInto(FilterOp op, SqlValue value, RowMap* rm) const {
@@ -367,6 +398,13 @@ class Column {
   // Returns the type of this Column in terms of SqlValue::Type.
   SqlValue::Type type() const { return ToSqlValueType(type_); }
 
+  // Returns the type of the data stored by this Column.
+  ColumnType column_type() const { return type_; }
+
+  // Returns the storage backing this Column, shared with the columns of the
+  // child tables. Null for id and dummy columns.
+  const ColumnStorageBase* storage_base() const { return storage_; }
+
   // Test the type of this Column.
   template <typename T>
   bool IsColumnType() const {
@@ -494,7 +532,7 @@ class Column {
          Table* table,
          uint32_t col_idx_in_table,
          uint32_t overlay_index,
-         ColumnStorageBase* nullable_vector);
+         ColumnStorageBase* storage);
 
   Column(const Column&) = delete;
   Column& operator=(const Column&) = delete;
@@ -531,6 +569,14 @@ class Column {
     return ToSqlValue(storage<T>().Get(idx));
   }
 
+  // Gets the values of the Column at the |n| indices in |idx|, storing them
+  // in |out|. Equivalent to calling GetAtIdx for every index but only
+  // dispatches on the type of the column once.
+  void GetAtIdxBatch(const uint32_t* idx, uint32_t n, SqlValue* out) const;
+
+  template <typename T>
+  void GetAtIdxBatchTyped(const uint32_t* idx, uint32_t n, SqlValue* out) const;
+
   // Optimized filter method for sorted columns.
   // Returns whether the constraint was handled by the method.
   bool FilterIntoSorted(FilterOp op, SqlValue value, RowMap* rm) const {
@@ -644,6 +690,17 @@ class Column {
   template <bool desc, typename T, bool is_nullable>
   void StableSortNumeric(std::vector<uint32_t>* out) const;
 
+  // Calls |fn| with the position and the order preserving raw key of every row
+  // of this column (base::nullopt for nulls). The raw keys of string columns
+  // are the ranks in |info.string_ranks|.
+  template <typename Fn>
+  void ForEachRawSortKey(const SortKeyInfo& info, Fn fn) const;
+
+  // Implementation of ForEachRawSortKey() for numeric columns.
+  // |T| and |is_nullable| should match the type and nullability of this column.
+  template <typename T, bool is_nullable, typename Fn>
+  void ForEachRawSortKeyNumeric(Fn fn) const;
+
   static constexpr bool IsDense(uint32_t flags) {
     return (flags & Flag::kDense) != 0;
   }
@@ -699,7 +756,7 @@ class Column {
     return string_pool_->Get(storage<StringPool::Id>().Get(idx));
   }
 
-  // type_ is used to cast nullable_vector_ to the correct type.
+  // type_ is used to cast storage_ to the correct type.
   ColumnType type_ = ColumnType::kInt64;
   ColumnStorageBase* storage_ = nullptr;
 
@@ -17,7 +17,14 @@
 #ifndef SRC_TRACE_PROCESSOR_DB_COLUMN_STORAGE_H_
 #define SRC_TRACE_PROCESSOR_DB_COLUMN_STORAGE_H_
 
-#include "src/trace_processor/containers/nullable_vector.h"
+#include <memory>
+#include <vector>
+
+#include "perfetto/base/compiler.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/optional.h"
+#include "src/trace_processor/containers/bit_vector.h"
+#include "src/trace_processor/containers/packed_vector.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -41,18 +48,84 @@ template <typename T>
 class ColumnStorage : public ColumnStorageBase {
  public:
   ColumnStorage() = default;
+  explicit ColumnStorage(std::vector<T> values)
+      : vector_(std::move(values)),
+        data_(vector_.data()),
+        size_(static_cast<uint32_t>(vector_.size())) {}
 
   explicit ColumnStorage(const ColumnStorage&) = delete;
   ColumnStorage& operator=(const ColumnStorage&) = delete;
 
+  // Moving a std::vector keeps its buffer so |data_| stays valid.
   ColumnStorage(ColumnStorage&&) = default;
   ColumnStorage& operator=(ColumnStorage&&) noexcept = default;
 
-  T Get(uint32_t idx) const { return vector_[idx]; }
-  void Append(T val) { vector_.emplace_back(val); }
-  void Set(uint32_t idx, T val) { vector_[idx] = val; }
-  uint32_t size() const { return static_cast<uint32_t>(vector_.size()); }
-  void ShrinkToFit() { vector_.shrink_to_fit(); }
+  // Creates a storage which reads the |size| values at |data| in place rather
+  // than copying them, e.g. from a mapped snapshot: |data| must outlive the
+  // storage. The values are copied by the first Append() or Set().
+  static ColumnStorage<T> External(const T* data, uint32_t size) {
+    ColumnStorage<T> storage;
+    storage.data_ = data;
+    storage.size_ = size;
+    storage.external_ = true;
+    return storage;
+  }
+
+  T Get(uint32_t idx) const {
+    return PERFETTO_LIKELY(!packed_) ? data_[idx] : packed_->Get(idx);
+  }
+
+  // Append() and Set() are O(1) except on compressed or external values (see
+  // ShrinkToFit() and External()): the first call then copies the whole
+  // column into a vector, which takes O(size()) time and memory.
+  void Append(T val) {
+    MakeMutable();
+    vector_.emplace_back(val);
+    data_ = vector_.data();
+    size_++;
+  }
+  void Set(uint32_t idx, T val) {
+    MakeMutable();
+    vector_[idx] = val;
+  }
+  uint32_t size() const { return size_; }
+
+  // Removes unused capacity and, if it saves enough memory, compresses the
+  // data using one of the encodings of PackedVector. Get() keeps working on
+  // the compressed data but the next Append() or Set() decompresses all of
+  // it, so this should only be called once the column won't change anymore.
+  // External values are left as they are.
+  void ShrinkToFit() {
+    if (packed_ || external_)
+      return;
+    base::Optional<PackedVector<T>> packed = PackedVector<T>::Pack(vector_);
+    if (packed) {
+      packed_.reset(new PackedVector<T>(std::move(*packed)));
+      vector_ = std::vector<T>();
+      data_ = nullptr;
+    } else {
+      vector_.shrink_to_fit();
+      data_ = vector_.data();
+    }
+  }
+
+  // Returns whether the data is stored compressed.
+  bool IsPacked() const { return !!packed_; }
+
+  // Returns whether the values are read in place from the data passed to
+  // External().
+  bool IsExternal() const { return external_; }
+
+  // Returns the values as a contiguous array, or null if the data is stored
+  // compressed: ToVector() has to be used instead in that case.
+  const T* data() const { return packed_ ? nullptr : data_; }
+
+  // Returns a copy of all the values.
+  std::vector<T> ToVector() const {
+    if (packed_)
+      return packed_->Unpack();
+    return std::vector<T>(data_, data_ + size_);
+  }
 
   template <bool IsDense>
   static ColumnStorage<T> Create() {
@@ -61,10 +134,48 @@ class ColumnStorage : public ColumnStorageBase {
   }
 
  private:
+  template <typename U>
+  friend class ColumnStorage;
+
+  // Inserts |val| before |idx|. Only used by the sparse nullable storage when
+  // a null row is set.
+  void Insert(uint32_t idx, T val) {
+    MakeMutable();
+    vector_.insert(vector_.begin() + static_cast<ptrdiff_t>(idx), val);
+    data_ = vector_.data();
+    size_++;
+  }
+
+  // Copies the compressed or external values into |vector_|.
+  void MakeMutable() {
+    if (PERFETTO_LIKELY(!packed_ && !external_))
+      return;
+    if (packed_)
+      PERFETTO_DLOG("Decompressing %u values to modify them", size_);
+    vector_ = ToVector();
+    data_ = vector_.data();
+    packed_.reset();
+    external_ = false;
+  }
+
   std::vector<T> vector_;
+  std::unique_ptr<PackedVector<T>> packed_;
+
+  // The values: |vector_.data()| or the data passed to External(). Unused
+  // when the values are compressed.
+  const T* data_ = nullptr;
+  uint32_t size_ = 0;
+  bool external_ = false;
 };
 
 // Class used for implementing storage for nullable columns.
+//
+// The values are stored in a ColumnStorage<T>, so they are compressed by
+// ShrinkToFit() or read in place like the ones of non-null columns, along with
+// a BitVector with a set bit for each non-null row. By default, only the
+// values of the non-null rows are stored, at the cost of counting the set bits
+// before a row to find its value. In dense mode, a (default) value is also
+// stored for each null row, which makes Set() O(1).
 template <typename T>
 class ColumnStorage<base::Optional<T>> : public ColumnStorageBase {
  public:
@@ -76,25 +187,84 @@ class ColumnStorage<base::Optional<T>> : public ColumnStorageBase {
   ColumnStorage(ColumnStorage&&) = default;
   ColumnStorage& operator=(ColumnStorage&&) noexcept = default;
 
-  base::Optional<T> Get(uint32_t idx) const { return nv_.Get(idx); }
-  void Append(T val) { nv_.Append(val); }
-  void Append(base::Optional<T> val) { nv_.Append(val); }
-  void Set(uint32_t idx, T val) { nv_.Set(idx, val); }
-  uint32_t size() const { return nv_.size(); }
-  bool IsDense() const { return nv_.IsDense(); }
-  void ShrinkToFit() { nv_.ShrinkToFit(); }
+  // Creates a storage from the values and the BitVector returned by
+  // non_null_values() and non_null_bit_vector(). Returns base::nullopt if
+  // the number of values doesn't match the BitVector.
+  static base::Optional<ColumnStorage<base::Optional<T>>>
+  FromValues(bool dense, ColumnStorage<T> values, BitVector valid) {
+    uint32_t expected_size = dense ? valid.size() : valid.CountSetBits();
+    if (values.size() != expected_size)
+      return base::nullopt;
+    ColumnStorage<base::Optional<T>> storage(dense);
+    storage.values_ = std::move(values);
+    storage.valid_ = std::move(valid);
+    return base::make_optional(std::move(storage));
+  }
+
+  base::Optional<T> Get(uint32_t idx) const {
+    if (!valid_.IsSet(idx))
+      return base::nullopt;
+    return values_.Get(dense_ ? idx : valid_.CountSetBits(idx));
+  }
+  void Append(T val) {
+    values_.Append(val);
+    valid_.AppendTrue();
+  }
+  void Append(base::Optional<T> val) {
+    if (val) {
+      Append(*val);
+      return;
+    }
+    if (dense_)
+      values_.Append(T());
+    valid_.AppendFalse();
+  }
+  void Set(uint32_t idx, T val) {
+    if (dense_) {
+      valid_.Set(idx);
+      values_.Set(idx, val);
+      return;
+    }
+    // Generally, we will be setting a null row to non-null so optimize for
+    // that path.
+    uint32_t row = valid_.CountSetBits(idx);
+    bool was_set = valid_.Set(idx);
+    if (PERFETTO_UNLIKELY(was_set)) {
+      values_.Set(row, val);
+    } else {
+      values_.Insert(row, val);
+    }
+  }
+  uint32_t size() const { return valid_.size(); }
+  bool IsDense() const { return dense_; }
+
+  // See ColumnStorage<T>::ShrinkToFit().
+  void ShrinkToFit() {
+    values_.ShrinkToFit();
+    valid_.ShrinkToFit();
+  }
+
+  // Returns whether the values are stored compressed.
+  bool IsPacked() const { return values_.IsPacked(); }
+
+  // Returns the values of the non-null rows or, in dense mode, the values of
+  // all the rows (with a default value for the null ones).
+  const ColumnStorage<T>& non_null_values() const { return values_; }
+
+  // Returns the BitVector with a set bit for each non-null row.
+  const BitVector& non_null_bit_vector() const { return valid_; }
 
   template <bool IsDense>
   static ColumnStorage<base::Optional<T>> Create() {
-    return IsDense
-               ? ColumnStorage<base::Optional<T>>(NullableVector<T>::Dense())
-               : ColumnStorage<base::Optional<T>>(NullableVector<T>::Sparse());
+    return ColumnStorage<base::Optional<T>>(IsDense);
   }
 
  private:
-  explicit ColumnStorage(NullableVector<T> nv) : nv_(std::move(nv)) {}
+  explicit ColumnStorage(bool dense) : dense_(dense) {}
 
-  NullableVector<T> nv_;
+  ColumnStorage<T> values_;
+  BitVector valid_;
+  bool dense_ = false;
 };
 
 }  // namespace trace_processor
@@ -0,0 +1,82 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <random>
+
+#include <benchmark/benchmark.h>
+
+#include "src/trace_processor/db/column_storage.h"
+
+using perfetto::trace_processor::ColumnStorage;
+
+namespace {
+
+// Sorted timestamps with up to 100us between them, like the ts column of
+// the sched or slice tables.
+std::vector<int64_t> CreateSortedTs(uint32_t size) {
+  static constexpr uint32_t kRandomSeed = 42;
+  std::minstd_rand0 rnd_engine(kRandomSeed);
+  std::vector<int64_t> ts(size);
+  int64_t cur = 1234567890123456;
+  for (uint32_t i = 0; i < size; ++i) {
+    cur += rnd_engine() % 100000;
+    ts[i] = cur;
+  }
+  return ts;
+}
+
+// Few distinct values spread over a large range, like the string ids of the
+// names of slices.
+std::vector<uint32_t> CreateFewDistinct(uint32_t size) {
+  static constexpr uint32_t kRandomSeed = 42;
+  std::minstd_rand0 rnd_engine(kRandomSeed);
+  std::vector<uint32_t> values(size);
+  for (uint32_t i = 0; i < size; ++i)
+    values[i] = (rnd_engine() % 1000) * 100003;
+  return values;
+}
+
+template <typename T>
+void BenchShrinkToFit(benchmark::State& state, const std::vector<T>& values) {
+  for (auto _ : state) {
+    state.PauseTiming();
+    ColumnStorage<T> storage(values);
+    state.ResumeTiming();
+
+    storage.ShrinkToFit();
+    benchmark::DoNotOptimize(storage.IsPacked());
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(values.size()));
+}
+
+}  // namespace
+
+static void BM_ColumnStorageShrinkToFitSortedTs(benchmark::State& state) {
+  BenchShrinkToFit(state,
+                   CreateSortedTs(static_cast<uint32_t>(state.range(0))));
+}
+BENCHMARK(BM_ColumnStorageShrinkToFitSortedTs)
+    ->RangeMultiplier(8)
+    ->Range(1 << 16, 1 << 24)
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_ColumnStorageShrinkToFitFewDistinct(benchmark::State& state) {
+  BenchShrinkToFit(state,
+                   CreateFewDistinct(static_cast<uint32_t>(state.range(0))));
+}
+BENCHMARK(BM_ColumnStorageShrinkToFitFewDistinct)
+    ->RangeMultiplier(8)
+    ->Range(1 << 16, 1 << 24)
+    ->Unit(benchmark::kMillisecond);
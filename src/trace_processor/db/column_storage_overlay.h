@@ -62,6 +62,12 @@ class ColumnStorageOverlay {
     // Returns the row of the index the iterator points to.
     InputRow row() const { return it_.row(); }
 
+    // Writes the indices of the next (up to) |max| rows to |out|; see
+    // RowMap::Iterator::NextBatch for details.
+    uint32_t NextBatch(uint32_t max, OutputIndex* out) {
+      return it_.NextBatch(max, out);
+    }
+
    private:
     RowMap::Iterator it_;
   };
@@ -211,6 +217,9 @@ class ColumnStorageOverlay {
   // Returns the iterator over the rows in this ColumnStorageOverlay.
   Iterator IterateRows() const { return Iterator(row_map_.IterateRows()); }
 
+  // Returns the RowMap which maps the rows to the indices in the storage.
+  const RowMap& row_map() const { return row_map_; }
+
  private:
   explicit ColumnStorageOverlay(RowMap rm) : row_map_(std::move(rm)) {}
 
@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/group_by_aggregator.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <array>
+#include <limits>
+
+#include "perfetto/ext/base/flat_hash_map.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+// Rows are processed in chunks of this size: the values of each column in the
+// chunk are read into a buffer in one go so that the type of the column is
+// only dispatched on once per chunk rather than once per cell.
+constexpr uint32_t kChunkSize = 1024;
+
+// Reads the values of a column at the storage indices |idx| into |out|,
+// setting |valid| to 0 for null values.
+template <typename V>
+using ChunkReader = void (*)(const Column&,
+                             const uint32_t* idx,
+                             uint32_t n,
+                             V* out,
+                             uint8_t* valid);
+
+inline bool ReadValue(int32_t value, int64_t* out) {
+  *out = value;
+  return true;
+}
+inline bool ReadValue(uint32_t value, int64_t* out) {
+  *out = value;
+  return true;
+}
+inline bool ReadValue(int64_t value, int64_t* out) {
+  *out = value;
+  return true;
+}
+inline bool ReadValue(double value, double* out) {
+  *out = value;
+  return true;
+}
+inline bool ReadValue(StringPool::Id value, int64_t* out) {
+  *out = value.raw_id();
+  return !value.is_null();
+}
+template <typename T, typename V>
+inline bool ReadValue(base::Optional<T> value, V* out) {
+  return value && ReadValue(*value, out);
+}
+
+template <typename T, typename V>
+void ReadTypedChunk(const Column& col,
+                    const uint32_t* idx,
+                    uint32_t n,
+                    V* out,
+                    uint8_t* valid) {
+  const TypedColumn<T>* typed = TypedColumn<T>::FromColumn(&col);
+  for (uint32_t i = 0; i < n; ++i) {
+    valid[i] = ReadValue(typed->GetAtIdx(idx[i]), &out[i]);
+  }
+}
+
+void ReadIdChunk(const Column&,
+                 const uint32_t* idx,
+                 uint32_t n,
+                 int64_t* out,
+                 uint8_t* valid) {
+  std::copy(idx, idx + n, out);
+  memset(valid, 1, n);
+}
+
+template <typename T, typename V>
+ChunkReader<V> ReaderFor(const Column& col) {
+  return col.IsNullable() ? &ReadTypedChunk<base::Optional<T>, V>
+                          : &ReadTypedChunk<T, V>;
+}
+
+// Returns the reader for integer-like columns or nullptr if the column has
+// a different type.
+ChunkReader<int64_t> LongReaderFor(const Column& col) {
+  if (col.IsId())
+    return &ReadIdChunk;
+  if (col.IsColumnType<int32_t>())
+    return ReaderFor<int32_t, int64_t>(col);
+  if (col.IsColumnType<uint32_t>())
+    return ReaderFor<uint32_t, int64_t>(col);
+  if (col.IsColumnType<int64_t>())
+    return ReaderFor<int64_t, int64_t>(col);
+  if (col.IsColumnType<StringPool::Id>())
+    return ReaderFor<StringPool::Id, int64_t>(col);
+  return nullptr;
+}
+
+struct GroupKey {
+  bool operator==(const GroupKey& other) const {
+    return values == other.values && null_mask == other.null_mask;
+  }
+
+  std::array<int64_t, GroupByAggregator::kMaxGroupByColumns> values{};
+  uint32_t null_mask = 0;
+};
+
+struct GroupKeyHasher {
+  size_t operator()(const GroupKey& key) const {
+    // A multiplicative mix is much cheaper than base::Hasher (which hashes one
+    // byte at a time) and good enough for ids and timestamps.
+    static constexpr uint64_t kMul = 0x9e3779b97f4a7c15ull;
+    uint64_t h = (static_cast<uint64_t>(key.values[0]) ^ key.null_mask) * kMul;
+    h = (h ^ (h >> 32) ^ static_cast<uint64_t>(key.values[1])) * kMul;
+    return static_cast<size_t>(h ^ (h >> 29));
+  }
+};
+
+template <typename V>
+struct Accumulator {
+  uint32_t first_row = 0;
+  int64_t count = 0;
+  int64_t value_count = 0;
+  V sum = 0;
+  V min = std::numeric_limits<V>::max();
+  V max = std::numeric_limits<V>::lowest();
+};
+
+// Returns false if the sum overflows: SQLite's SUM() then fails with
+// "integer overflow" rather than wrapping around.
+inline bool Add(int64_t a, int64_t b, int64_t* out) {
+#if defined(__GNUC__) || defined(__clang__)
+  return !__builtin_add_overflow(a, b, out);
+#else
+  if ((b > 0 && a > std::numeric_limits<int64_t>::max() - b) ||
+      (b < 0 && a < std::numeric_limits<int64_t>::min() - b)) {
+    return false;
+  }
+  *out = a + b;
+  return true;
+#endif
+}
+inline bool Add(double a, double b, double* out) {
+  *out = a + b;
+  return true;
+}
+
+inline SqlValue ToSqlValue(int64_t value) {
+  return SqlValue::Long(value);
+}
+inline SqlValue ToSqlValue(double value) {
+  return SqlValue::Double(value);
+}
+
+template <typename V>
+base::Status AggregateTyped(const Table& table,
+                    const std::vector<uint32_t>& group_by_cols,
+                    const std::vector<ChunkReader<int64_t>>& key_readers,
+                    const Column* value_col,
+                    ChunkReader<V> value_reader,
+                    std::vector<GroupByAggregator::Group>* groups) {
+  // Columns sharing an overlay also share the storage indices of each row so
+  // only iterate each overlay once.
+  std::vector<const Column*> cols;
+  for (uint32_t col_idx : group_by_cols)
+    cols.emplace_back(&table.GetColumn(col_idx));
+  if (value_col)
+    cols.emplace_back(value_col);
+
+  std::vector<uint32_t> overlays;
+  std::vector<uint32_t> overlay_for_col;
+  for (const Column* col : cols) {
+    auto it = std::find(overlays.begin(), overlays.end(), col->overlay_index());
+    overlay_for_col.emplace_back(
+        static_cast<uint32_t>(std::distance(overlays.begin(), it)));
+    if (it == overlays.end())
+      overlays.emplace_back(col->overlay_index());
+  }
+  std::vector<ColumnStorageOverlay::Iterator> its;
+  for (uint32_t overlay : overlays)
+    its.emplace_back(table.overlays()[overlay].IterateRows());
+
+  std::vector<std::vector<uint32_t>> storage_idx(
+      overlays.size(), std::vector<uint32_t>(kChunkSize));
+  std::vector<std::vector<int64_t>> keys(group_by_cols.size(),
+                                         std::vector<int64_t>(kChunkSize));
+  std::vector<std::vector<uint8_t>> key_valid(
+      group_by_cols.size(), std::vector<uint8_t>(kChunkSize));
+  std::vector<V> values(value_col ? kChunkSize : 0);
+  std::vector<uint8_t> value_valid(value_col ? kChunkSize : 0);
+
+  base::FlatHashMap<GroupKey, uint32_t, GroupKeyHasher> group_for_key;
+  std::vector<Accumulator<V>> accs;
+
+  // Rows are often clustered by the group by columns (e.g. slices on the same
+  // track) so remember the last group to skip most hash table lookups.
+  GroupKey last_key;
+  uint32_t last_group = std::numeric_limits<uint32_t>::max();
+
+  const uint32_t key_count = static_cast<uint32_t>(group_by_cols.size());
+  for (uint32_t start = 0; start < table.row_count(); start += kChunkSize) {
+    uint32_t n = std::min(kChunkSize, table.row_count() - start);
+    for (uint32_t i = 0; i < its.size(); ++i) {
+      for (uint32_t j = 0; j < n; ++j, its[i].Next())
+        storage_idx[i][j] = its[i].index();
+    }
+    for (uint32_t c = 0; c < key_count; ++c) {
+      key_readers[c](*cols[c], storage_idx[overlay_for_col[c]].data(), n,
+                     keys[c].data(), key_valid[c].data());
+    }
+    if (value_col) {
+      value_reader(*value_col, storage_idx[overlay_for_col[key_count]].data(),
+                   n, values.data(), value_valid.data());
+    }
+
+    for (uint32_t i = 0; i < n; ++i) {
+      GroupKey key;
+      for (uint32_t c = 0; c < key_count; ++c) {
+        if (key_valid[c][i]) {
+          key.values[c] = keys[c][i];
+        } else {
+          key.null_mask |= 1u << c;
+        }
+      }
+      if (last_group == std::numeric_limits<uint32_t>::max() ||
+          !(key == last_key)) {
+        auto it_and_inserted =
+            group_for_key.Insert(key, static_cast<uint32_t>(accs.size()));
+        if (it_and_inserted.second) {
+          accs.emplace_back();
+          accs.back().first_row = start + i;
+        }
+        last_key = key;
+        last_group = *it_and_inserted.first;
+      }
+
+      Accumulator<V>& acc = accs[last_group];
+      acc.count++;
+      if (value_col && value_valid[i]) {
+        V value = values[i];
+        acc.value_count++;
+        if (!Add(acc.sum, value, &acc.sum))
+          return base::ErrStatus("integer overflow");
+        acc.min = std::min(acc.min, value);
+        acc.max = std::max(acc.max, value);
+      }
+    }
+  }
+
+  groups->clear();
+  groups->reserve(accs.size());
+  for (const Accumulator<V>& acc : accs) {
+    GroupByAggregator::Group group;
+    for (uint32_t c = 0; c < key_count; ++c)
+      group.keys[c] = cols[c]->Get(acc.first_row);
+    group.count = acc.count;
+    if (acc.value_count > 0) {
+      group.sum = ToSqlValue(acc.sum);
+      group.min = ToSqlValue(acc.min);
+      group.max = ToSqlValue(acc.max);
+      group.avg = SqlValue::Double(static_cast<double>(acc.sum) /
+                                   static_cast<double>(acc.value_count));
+    }
+    groups->emplace_back(group);
+  }
+  return base::OkStatus();
+}
+
+}  // namespace
+
+constexpr uint32_t GroupByAggregator::kMaxGroupByColumns;
+
+// static
+base::Status GroupByAggregator::Aggregate(
+    const Table& table,
+    const std::vector<uint32_t>& group_by_cols,
+    base::Optional<uint32_t> value_col,
+    std::vector<Group>* groups) {
+  if (group_by_cols.empty() || group_by_cols.size() > kMaxGroupByColumns) {
+    return base::ErrStatus("GROUP BY: expected between 1 and %u columns",
+                           kMaxGroupByColumns);
+  }
+
+  std::vector<ChunkReader<int64_t>> key_readers;
+  for (uint32_t col_idx : group_by_cols) {
+    if (col_idx >= table.GetColumnCount())
+      return base::ErrStatus("GROUP BY: invalid column index %u", col_idx);
+    const Column& col = table.GetColumn(col_idx);
+    ChunkReader<int64_t> reader = LongReaderFor(col);
+    if (!reader) {
+      return base::ErrStatus(
+          "GROUP BY: column %s must be an integer or string column",
+          col.name());
+    }
+    key_readers.emplace_back(reader);
+  }
+
+  if (!value_col) {
+    return AggregateTyped<int64_t>(table, group_by_cols, key_readers, nullptr,
+                                   nullptr, groups);
+  }
+
+  if (*value_col >= table.GetColumnCount())
+    return base::ErrStatus("GROUP BY: invalid column index %u", *value_col);
+  const Column& col = table.GetColumn(*value_col);
+  if (col.IsColumnType<double>()) {
+    return AggregateTyped<double>(table, group_by_cols, key_readers, &col,
+                                  ReaderFor<double, double>(col), groups);
+  }
+  ChunkReader<int64_t> reader =
+      col.IsColumnType<StringPool::Id>() ? nullptr : LongReaderFor(col);
+  if (!reader) {
+    return base::ErrStatus(
+        "GROUP BY: aggregated column %s must be a numeric column", col.name());
+  }
+  return AggregateTyped<int64_t>(table, group_by_cols, key_readers, &col,
+                                 reader, groups);
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
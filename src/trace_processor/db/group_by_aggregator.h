@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_GROUP_BY_AGGREGATOR_H_
+#define SRC_TRACE_PROCESSOR_DB_GROUP_BY_AGGREGATOR_H_
+
+#include <stdint.h>
+
+#include <array>
+#include <vector>
+
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/optional.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/db/table.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Computes COUNT, SUM, MIN, MAX and AVG of a column of a Table for each
+// distinct combination of values of one or two other columns. This is the
+// equivalent of:
+//   SELECT g1, g2, COUNT(*), SUM(v), MIN(v), MAX(v), AVG(v)
+//   FROM table
+//   GROUP BY g1, g2
+// but works directly on the typed storage of the columns instead of pulling
+// every cell of the table through SQLite.
+//
+// Group by columns can be integer, id or string columns (strings are grouped
+// by their StringPool::Id). The aggregated column can be an integer, id or
+// double column.
+class GroupByAggregator {
+ public:
+  static constexpr uint32_t kMaxGroupByColumns = 2;
+
+  // The result of the aggregation for one group.
+  struct Group {
+    // The values of the group by columns; unused entries are null.
+    std::array<SqlValue, kMaxGroupByColumns> keys;
+
+    // Number of rows in the group.
+    int64_t count = 0;
+
+    // Aggregates of the non-null values of the aggregated column in the group.
+    // |sum|, |min| and |max| have the type of the aggregated column
+    // (i.e. long or double) and |avg| is always a double. All are null if
+    // there is no aggregated column or all its values are null.
+    SqlValue sum;
+    SqlValue min;
+    SqlValue max;
+    SqlValue avg;
+  };
+
+  // Computes the groups of |table| for the columns at indices
+  // |group_by_cols|, aggregating the values of the column at |value_col| if
+  // set. Groups are returned in the order in which they first appear in the
+  // table.
+  static base::Status Aggregate(const Table& table,
+                                const std::vector<uint32_t>& group_by_cols,
+                                base::Optional<uint32_t> value_col,
+                                std::vector<Group>* groups);
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DB_GROUP_BY_AGGREGATOR_H_
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/group_by_aggregator.h"
+
+#include <limits>
+#include <map>
+
+#include "src/trace_processor/tables/macros.h"
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+#define PERFETTO_TP_TEST_SCHED_TABLE_DEF(NAME, PARENT, C) \
+  NAME(TestSchedTable, "sched")                           \
+  PARENT(PERFETTO_TP_ROOT_TABLE_PARENT_DEF, C)            \
+  C(int64_t, ts, Column::Flag::kSorted)                   \
+  C(int64_t, dur)                                         \
+  C(uint32_t, cpu)                                        \
+  C(base::Optional<uint32_t>, utid)                       \
+  C(base::Optional<StringPool::Id>, end_state)            \
+  C(base::Optional<double>, load)
+PERFETTO_TP_TABLE(PERFETTO_TP_TEST_SCHED_TABLE_DEF);
+
+TestSchedTable::~TestSchedTable() = default;
+
+using CI = TestSchedTable::ColumnIndex;
+using Group = GroupByAggregator::Group;
+
+class GroupByAggregatorTest : public ::testing::Test {
+ protected:
+  void Insert(int64_t dur,
+              uint32_t cpu,
+              base::Optional<uint32_t> utid,
+              const char* end_state,
+              base::Optional<double> load) {
+    TestSchedTable::Row row;
+    row.ts = ts_++;
+    row.dur = dur;
+    row.cpu = cpu;
+    row.utid = utid;
+    row.end_state = end_state
+                        ? base::make_optional(pool_.InternString(end_state))
+                        : base::nullopt;
+    row.load = load;
+    table_.Insert(row);
+  }
+
+  StringPool pool_;
+  TestSchedTable table_{&pool_, nullptr};
+  int64_t ts_ = 0;
+};
+
+TEST_F(GroupByAggregatorTest, SingleIntColumn) {
+  Insert(10, 0, 1u, "R", 0.5);
+  Insert(20, 1, 2u, "S", 1.5);
+  Insert(30, 0, 1u, "S", base::nullopt);
+  Insert(40, 1, base::nullopt, nullptr, 2.0);
+  Insert(50, 1, 2u, "R", 3.0);
+
+  std::vector<Group> groups;
+  ASSERT_TRUE(GroupByAggregator::Aggregate(table_, {CI::utid},
+                                           CI::dur, &groups)
+                  .ok());
+  ASSERT_EQ(groups.size(), 3u);
+
+  ASSERT_EQ(groups[0].keys[0].AsLong(), 1);
+  ASSERT_TRUE(groups[0].keys[1].is_null());
+  ASSERT_EQ(groups[0].count, 2);
+  ASSERT_EQ(groups[0].sum.AsLong(), 40);
+  ASSERT_EQ(groups[0].min.AsLong(), 10);
+  ASSERT_EQ(groups[0].max.AsLong(), 30);
+  ASSERT_DOUBLE_EQ(groups[0].avg.AsDouble(), 20.0);
+
+  ASSERT_EQ(groups[1].keys[0].AsLong(), 2);
+  ASSERT_EQ(groups[1].count, 2);
+  ASSERT_EQ(groups[1].sum.AsLong(), 70);
+
+  // Null values form their own group.
+  ASSERT_TRUE(groups[2].keys[0].is_null());
+  ASSERT_EQ(groups[2].count, 1);
+  ASSERT_EQ(groups[2].sum.AsLong(), 40);
+}
+
+TEST_F(GroupByAggregatorTest, TwoColumnsWithStrings) {
+  Insert(10, 0, 1u, "R", 0.5);
+  Insert(20, 1, 2u, "S", 1.5);
+  Insert(30, 0, 1u, "S", base::nullopt);
+  Insert(40, 1, base::nullopt, nullptr, 2.0);
+  Insert(50, 0, 2u, "R", 3.0);
+
+  std::vector<Group> groups;
+  ASSERT_TRUE(GroupByAggregator::Aggregate(
+                  table_, {CI::cpu, CI::end_state}, CI::load,
+                  &groups)
+                  .ok());
+  ASSERT_EQ(groups.size(), 4u);
+
+  ASSERT_EQ(groups[0].keys[0].AsLong(), 0);
+  ASSERT_STREQ(groups[0].keys[1].AsString(), "R");
+  ASSERT_EQ(groups[0].count, 2);
+  ASSERT_DOUBLE_EQ(groups[0].sum.AsDouble(), 3.5);
+  ASSERT_DOUBLE_EQ(groups[0].min.AsDouble(), 0.5);
+  ASSERT_DOUBLE_EQ(groups[0].max.AsDouble(), 3.0);
+
+  ASSERT_EQ(groups[1].keys[0].AsLong(), 1);
+  ASSERT_STREQ(groups[1].keys[1].AsString(), "S");
+
+  // All the values of the aggregated column are null.
+  ASSERT_EQ(groups[2].keys[0].AsLong(), 0);
+  ASSERT_STREQ(groups[2].keys[1].AsString(), "S");
+  ASSERT_EQ(groups[2].count, 1);
+  ASSERT_TRUE(groups[2].sum.is_null());
+  ASSERT_TRUE(groups[2].avg.is_null());
+
+  ASSERT_EQ(groups[3].keys[0].AsLong(), 1);
+  ASSERT_TRUE(groups[3].keys[1].is_null());
+}
+
+TEST_F(GroupByAggregatorTest, CountOnlyOnFilteredTable) {
+  std::map<int64_t, int64_t> expected;
+  for (uint32_t i = 0; i < 10000; ++i) {
+    Insert(i, i % 7, i % 13, nullptr, base::nullopt);
+    if (i >= 5000 && i % 2 == 0)
+      expected[i % 13]++;
+  }
+
+  // Filtering makes the table go through a non-trivial overlay.
+  Table filtered = table_.Filter({table_.ts().ge(5000)}).Sort(
+      {table_.utid().descending()});
+  std::vector<uint32_t> even;
+  for (uint32_t i = 0; i < filtered.row_count(); ++i) {
+    if (filtered.GetColumn(CI::dur).Get(i).AsLong() % 2 == 0)
+      even.push_back(i);
+  }
+  filtered = filtered.Apply(RowMap(std::move(even)));
+
+  std::vector<Group> groups;
+  ASSERT_TRUE(GroupByAggregator::Aggregate(filtered, {CI::utid},
+                                           base::nullopt, &groups)
+                  .ok());
+  ASSERT_EQ(groups.size(), expected.size());
+  for (const Group& group : groups) {
+    ASSERT_EQ(group.count, expected[group.keys[0].AsLong()]);
+    ASSERT_TRUE(group.sum.is_null());
+  }
+}
+
+TEST_F(GroupByAggregatorTest, IntegerOverflow) {
+  // Like SQLite's SUM(), fail rather than wrap around.
+  Insert(std::numeric_limits<int64_t>::max(), 0, 1u, "R", 0.5);
+  Insert(1, 0, 1u, "R", 0.5);
+
+  std::vector<Group> groups;
+  base::Status status =
+      GroupByAggregator::Aggregate(table_, {CI::utid}, CI::dur, &groups);
+  ASSERT_FALSE(status.ok());
+  ASSERT_EQ(status.message(), "integer overflow");
+}
+
+TEST_F(GroupByAggregatorTest, InvalidColumns) {
+  Insert(10, 0, 1u, "R", 0.5);
+
+  std::vector<Group> groups;
+  ASSERT_FALSE(
+      GroupByAggregator::Aggregate(table_, {}, CI::dur, &groups).ok());
+  ASSERT_FALSE(GroupByAggregator::Aggregate(
+                   table_, {CI::cpu, CI::utid, CI::ts},
+                   CI::dur, &groups)
+                   .ok());
+  ASSERT_FALSE(GroupByAggregator::Aggregate(table_, {CI::load},
+                                            CI::dur, &groups)
+                   .ok());
+  ASSERT_FALSE(GroupByAggregator::Aggregate(table_, {CI::cpu},
+                                            CI::end_state, &groups)
+                   .ok());
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/interval_index.h"
+
+#include <algorithm>
+
+#include "src/trace_processor/containers/radix_sort.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+IntervalIndex::IntervalIndex() = default;
+IntervalIndex::~IntervalIndex() = default;
+
+IntervalIndex::IntervalIndex(IntervalIndex&&) noexcept = default;
+IntervalIndex& IntervalIndex::operator=(IntervalIndex&&) noexcept = default;
+
+base::Status IntervalIndex::Build(const Table& table,
+                                  uint32_t ts_col,
+                                  uint32_t dur_col,
+                                  base::Optional<uint32_t> partition_col,
+                                  IntervalIndex* out) {
+  std::vector<uint32_t> cols{ts_col, dur_col};
+  if (partition_col)
+    cols.push_back(*partition_col);
+  for (uint32_t col : cols) {
+    if (table.GetColumn(col).type() != SqlValue::Type::kLong) {
+      return base::ErrStatus("Column %s is not an integer column",
+                             table.GetColumn(col).name());
+    }
+  }
+
+  // Collect the indexed rows.
+  std::vector<uint32_t> rows;
+  std::vector<int64_t> starts;
+  std::vector<int64_t> durs;
+  std::vector<int64_t> partitions;
+  uint32_t row = 0;
+  for (auto it = table.IterateRows(); it; it.Next(), ++row) {
+    SqlValue ts = it.Get(ts_col);
+    SqlValue dur = it.Get(dur_col);
+    SqlValue partition = partition_col ? it.Get(*partition_col) : SqlValue();
+    if (ts.is_null() || dur.is_null() || (partition_col && partition.is_null()))
+      continue;
+    rows.push_back(row);
+    starts.push_back(ts.AsLong());
+    durs.push_back(dur.AsLong());
+    partitions.push_back(partition_col ? partition.AsLong() : 0);
+  }
+
+  // Sort by partition and then by ts. Both sorts are stable so rows with the
+  // same ts stay in table order.
+  std::vector<uint32_t> order(rows.size());
+  for (uint32_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  auto sort_by = [&order](const std::vector<int64_t>& values) {
+    if (values.empty())
+      return;
+    auto minmax = std::minmax_element(values.begin(), values.end());
+    uint64_t min = radix_sort::ToSortableKey(*minmax.first);
+    std::vector<uint64_t> keys(values.size());
+    for (uint32_t i = 0; i < values.size(); ++i)
+      keys[i] = radix_sort::ToSortableKey(values[i]) - min;
+    uint32_t bits = radix_sort::BitWidth(
+        radix_sort::ToSortableKey(*minmax.second) - min);
+    radix_sort::SortIndices(keys, bits, &order);
+  };
+  sort_by(starts);
+  if (partition_col)
+    sort_by(partitions);
+
+  IntervalIndex index;
+  index.rows_.resize(order.size());
+  index.starts_.resize(order.size());
+  index.ends_.resize(order.size());
+  index.max_ends_.resize(order.size());
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    uint32_t idx = order[i];
+    int64_t end = starts[idx] + durs[idx];
+    bool new_partition =
+        i == 0 || partitions[idx] != index.partitions_.back().value;
+    if (new_partition)
+      index.partitions_.push_back(Partition{partitions[idx], i, i});
+    index.partitions_.back().end = i + 1;
+
+    index.rows_[i] = rows[idx];
+    index.starts_[i] = starts[idx];
+    index.ends_[i] = end;
+    index.max_ends_[i] =
+        new_partition ? end : std::max(index.max_ends_[i - 1], end);
+    index.max_dur_ = std::max(index.max_dur_.value_or(durs[idx]), durs[idx]);
+  }
+  *out = std::move(index);
+  return base::OkStatus();
+}
+
+void IntervalIndex::FindOverlapping(int64_t t0,
+                                    int64_t t1,
+                                    base::Optional<int64_t> partition,
+                                    std::vector<uint32_t>* rows) const {
+  if (!partition) {
+    for (const Partition& p : partitions_)
+      FindOverlappingInPartition(p, t0, t1, rows);
+    return;
+  }
+  auto it = std::lower_bound(
+      partitions_.begin(), partitions_.end(), *partition,
+      [](const Partition& p, int64_t value) { return p.value < value; });
+  if (it != partitions_.end() && it->value == *partition)
+    FindOverlappingInPartition(*it, t0, t1, rows);
+}
+
+void IntervalIndex::FindOverlappingInPartition(
+    const Partition& partition,
+    int64_t t0,
+    int64_t t1,
+    std::vector<uint32_t>* rows) const {
+  // Rows at or after |hi| start at or after t1.
+  auto starts_begin = starts_.begin() + partition.begin;
+  auto starts_end = starts_.begin() + partition.end;
+  uint32_t hi = static_cast<uint32_t>(
+      std::lower_bound(starts_begin, starts_end, t1) - starts_.begin());
+
+  // Rows before |lo| all end at or before t0.
+  auto max_ends_begin = max_ends_.begin() + partition.begin;
+  auto max_ends_end = max_ends_.begin() + hi;
+  uint32_t lo = static_cast<uint32_t>(
+      std::upper_bound(max_ends_begin, max_ends_end, t0) - max_ends_.begin());
+
+  for (uint32_t i = lo; i < hi; ++i) {
+    if (ends_[i] > t0)
+      rows->push_back(rows_[i]);
+  }
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
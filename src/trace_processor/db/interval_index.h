@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_INTERVAL_INDEX_H_
+#define SRC_TRACE_PROCESSOR_DB_INTERVAL_INDEX_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/optional.h"
+#include "src/trace_processor/db/table.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Index answering "which rows of a table overlap the interval [t0, t1)"
+// queries, optionally restricted to the rows with a given value in a
+// partition column (e.g. track_id, cpu or utid).
+//
+// A row overlaps [t0, t1) if ts < t1 && ts + dur > t0; this is the same
+// condition as the one usually written in SQL so the results match. Rows with
+// a null ts, dur or partition are not indexed.
+//
+// The index is an augmented sorted array: the rows of each partition are
+// sorted by ts and, for each position, the maximum end (ts + dur) of all the
+// rows up to that position is stored. As the maximum end is nondecreasing,
+// both the rows starting after t1 and the prefix of rows which all end before
+// t0 can be skipped with a binary search; only the remaining rows need to be
+// checked individually. For partitions without nested intervals (e.g. sched
+// slices on a cpu) every remaining row overlaps.
+class IntervalIndex {
+ public:
+  IntervalIndex();
+  ~IntervalIndex();
+
+  IntervalIndex(IntervalIndex&&) noexcept;
+  IntervalIndex& operator=(IntervalIndex&&) noexcept;
+
+  // Builds the index for the rows of |table| using the values in the integer
+  // columns |ts_col|, |dur_col| and, if set, |partition_col|.
+  static base::Status Build(const Table& table,
+                            uint32_t ts_col,
+                            uint32_t dur_col,
+                            base::Optional<uint32_t> partition_col,
+                            IntervalIndex* out);
+
+  // Appends to |rows| the index of the rows overlapping [t0, t1) in
+  // |partition| or, if |partition| is not set, in any partition. Rows are
+  // appended sorted by partition and then by ts.
+  void FindOverlapping(int64_t t0,
+                       int64_t t1,
+                       base::Optional<int64_t> partition,
+                       std::vector<uint32_t>* rows) const;
+
+  // Returns the largest dur of any indexed row or base::nullopt if no row is
+  // indexed.
+  base::Optional<int64_t> max_dur() const { return max_dur_; }
+
+ private:
+  struct Partition {
+    int64_t value;
+    // Range of the partition in |rows_|, |starts_| and |max_ends_|.
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  void FindOverlappingInPartition(const Partition& partition,
+                                  int64_t t0,
+                                  int64_t t1,
+                                  std::vector<uint32_t>* rows) const;
+
+  // Sorted by value.
+  std::vector<Partition> partitions_;
+
+  // Table rows sorted by partition and ts.
+  std::vector<uint32_t> rows_;
+  std::vector<int64_t> starts_;
+  std::vector<int64_t> ends_;
+  // |max_ends_[i]| is the largest end of the rows of the partition up to i.
+  std::vector<int64_t> max_ends_;
+
+  base::Optional<int64_t> max_dur_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DB_INTERVAL_INDEX_H_
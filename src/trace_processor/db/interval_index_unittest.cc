@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/interval_index.h"
+
+#include <random>
+
+#include "src/trace_processor/db/runtime_table.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using testing::ElementsAre;
+using testing::IsEmpty;
+
+struct Interval {
+  int64_t ts;
+  int64_t dur;
+  int64_t track;
+};
+
+std::unique_ptr<RuntimeTable> CreateTable(StringPool* pool,
+                                          const std::vector<Interval>& rows) {
+  std::unique_ptr<RuntimeTable> table(
+      new RuntimeTable(pool, {"ts", "dur", "track"}));
+  for (const Interval& i : rows) {
+    PERFETTO_CHECK(table
+                       ->AddRow({SqlValue::Long(i.ts), SqlValue::Long(i.dur),
+                                 SqlValue::Long(i.track)})
+                       .ok());
+  }
+  PERFETTO_CHECK(table->Finalize().ok());
+  return table;
+}
+
+std::vector<uint32_t> Find(const IntervalIndex& index,
+                           int64_t t0,
+                           int64_t t1,
+                           base::Optional<int64_t> partition) {
+  std::vector<uint32_t> rows;
+  index.FindOverlapping(t0, t1, partition, &rows);
+  return rows;
+}
+
+TEST(IntervalIndexTest, NestedIntervals) {
+  StringPool pool;
+  // Row 0 contains rows 1 and 2; row 3 is on a different track.
+  auto table = CreateTable(
+      &pool, {{0, 100, 1}, {10, 10, 1}, {50, 10, 1}, {20, 10, 2}, {200, 5, 1}});
+  IntervalIndex index;
+  ASSERT_TRUE(IntervalIndex::Build(*table, 0, 1, 2u, &index).ok());
+
+  ASSERT_THAT(Find(index, 25, 55, 1), ElementsAre(0u, 2u));
+  ASSERT_THAT(Find(index, 25, 55, 2), ElementsAre(3u));
+  ASSERT_THAT(Find(index, 25, 55, base::nullopt), ElementsAre(0u, 2u, 3u));
+
+  // Intervals are half open.
+  ASSERT_THAT(Find(index, 100, 200, 1), IsEmpty());
+  ASSERT_THAT(Find(index, 100, 201, 1), ElementsAre(4u));
+  ASSERT_THAT(Find(index, 25, 55, 3), IsEmpty());
+
+  ASSERT_EQ(*index.max_dur(), 100);
+}
+
+TEST(IntervalIndexTest, MatchesLinearScan) {
+  StringPool pool;
+  std::minstd_rand0 rnd(42);
+  std::vector<Interval> intervals;
+  for (uint32_t i = 0; i < 1000; ++i) {
+    intervals.push_back(Interval{static_cast<int64_t>(rnd() % 10000),
+                                 static_cast<int64_t>(rnd() % 500),
+                                 static_cast<int64_t>(rnd() % 4)});
+  }
+  auto table = CreateTable(&pool, intervals);
+  IntervalIndex index;
+  ASSERT_TRUE(IntervalIndex::Build(*table, 0, 1, 2u, &index).ok());
+
+  for (uint32_t q = 0; q < 100; ++q) {
+    int64_t t0 = static_cast<int64_t>(rnd() % 10000);
+    int64_t t1 = t0 + static_cast<int64_t>(rnd() % 1000);
+    int64_t track = static_cast<int64_t>(rnd() % 4);
+
+    std::vector<uint32_t> expected;
+    for (uint32_t i = 0; i < intervals.size(); ++i) {
+      const Interval& in = intervals[i];
+      if (in.track == track && in.ts < t1 && in.ts + in.dur > t0)
+        expected.push_back(i);
+    }
+    std::vector<uint32_t> actual = Find(index, t0, t1, track);
+    std::sort(actual.begin(), actual.end());
+    ASSERT_EQ(actual, expected);
+  }
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/runtime_table.h"
+
+#include <algorithm>
+
+#include "src/trace_processor/util/status_macros.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+RuntimeTable::RuntimeTable(StringPool* pool, std::vector<std::string> col_names)
+    : Table(pool), col_names_(std::move(col_names)) {
+  builders_.resize(col_names_.size());
+}
+
+RuntimeTable::~RuntimeTable() = default;
+
+base::Status RuntimeTable::AddRow(const std::vector<SqlValue>& values) {
+  PERFETTO_CHECK(!finalized_);
+  PERFETTO_DCHECK(values.size() == builders_.size());
+  for (uint32_t i = 0; i < values.size(); ++i) {
+    RETURN_IF_ERROR(AddValue(i, values[i]));
+  }
+  row_count_++;
+  return base::OkStatus();
+}
+
+base::Status RuntimeTable::AddValue(uint32_t col_idx, const SqlValue& value) {
+  using Type = ColumnBuilder::Type;
+  ColumnBuilder& b = builders_[col_idx];
+  switch (value.type) {
+    case SqlValue::Type::kNull:
+      b.null_count++;
+      switch (b.type) {
+        case Type::kNull:
+          break;
+        case Type::kLong:
+          b.longs.emplace_back();
+          break;
+        case Type::kDouble:
+          b.doubles.emplace_back();
+          break;
+        case Type::kString:
+          b.strings.emplace_back(StringPool::Id::Null());
+          break;
+      }
+      return base::OkStatus();
+    case SqlValue::Type::kLong:
+      if (b.type == Type::kNull) {
+        b.type = Type::kLong;
+        b.longs.resize(row_count_);
+      }
+      if (b.type == Type::kLong) {
+        b.longs.emplace_back(value.long_value);
+        return base::OkStatus();
+      }
+      if (b.type == Type::kDouble) {
+        b.doubles.emplace_back(static_cast<double>(value.long_value));
+        return base::OkStatus();
+      }
+      break;
+    case SqlValue::Type::kDouble:
+      if (b.type == Type::kNull) {
+        b.type = Type::kDouble;
+        b.doubles.resize(row_count_);
+      } else if (b.type == Type::kLong) {
+        // Integers and doubles in the same column: store all of them as
+        // doubles (as SQLite would do when comparing them).
+        b.type = Type::kDouble;
+        b.doubles.reserve(b.longs.size() + 1);
+        for (const base::Optional<int64_t>& v : b.longs) {
+          b.doubles.emplace_back(
+              v ? base::make_optional(static_cast<double>(*v)) : base::nullopt);
+        }
+        b.longs = std::vector<base::Optional<int64_t>>();
+      }
+      if (b.type == Type::kDouble) {
+        b.doubles.emplace_back(value.double_value);
+        return base::OkStatus();
+      }
+      break;
+    case SqlValue::Type::kString:
+      if (b.type == Type::kNull) {
+        b.type = Type::kString;
+        b.strings.resize(row_count_, StringPool::Id::Null());
+      }
+      if (b.type == Type::kString) {
+        b.strings.emplace_back(string_pool_->InternString(value.AsString()));
+        return base::OkStatus();
+      }
+      break;
+    case SqlValue::Type::kBytes:
+      return base::ErrStatus("Column %s: bytes values are not supported",
+                             col_names_[col_idx].c_str());
+  }
+  return base::ErrStatus(
+      "Column %s: mixing string and numeric values is not supported",
+      col_names_[col_idx].c_str());
+}
+
+base::Status RuntimeTable::Finalize() {
+  PERFETTO_CHECK(!finalized_);
+  finalized_ = true;
+
+  using Type = ColumnBuilder::Type;
+  overlays_.emplace_back(row_count_);
+
+  bool has_id = false;
+  for (uint32_t i = 0; i < col_names_.size(); ++i) {
+    ColumnBuilder& b = builders_[i];
+    if (col_names_[i] == "id") {
+      if (b.type != Type::kLong || b.null_count > 0) {
+        return base::ErrStatus(
+            "The id column must only contain non-null integers");
+      }
+      std::vector<int64_t> ids(b.longs.size());
+      bool is_row_number = true;
+      for (uint32_t j = 0; j < ids.size(); ++j) {
+        ids[j] = *b.longs[j];
+        is_row_number = is_row_number && ids[j] == j;
+      }
+      std::sort(ids.begin(), ids.end());
+      if (std::adjacent_find(ids.begin(), ids.end()) != ids.end())
+        return base::ErrStatus("The id column must contain unique values");
+      has_id = true;
+
+      // Only ids equal to the row numbers, e.g. the id column of an
+      // unfiltered table, can be looked up in O(1) like the id columns of
+      // the other tables. Other ids are stored like any other column.
+      if (is_row_number) {
+        columns_.emplace_back(Column::IdColumn(this, i, 0));
+        schema_.columns.emplace_back(Table::Schema::Column{
+            "id", SqlValue::Type::kLong, true, true, false, false});
+        b = ColumnBuilder();
+        continue;
+      }
+    }
+
+    switch (b.type) {
+      case Type::kNull:
+        // Columns with only nulls are stored as (nullable) integer columns.
+        b.longs.resize(row_count_);
+        AddNumericColumn(i, b.longs, b.null_count);
+        break;
+      case Type::kLong:
+        AddNumericColumn(i, b.longs, b.null_count);
+        break;
+      case Type::kDouble:
+        AddNumericColumn(i, b.doubles, b.null_count);
+        break;
+      case Type::kString: {
+        std::unique_ptr<ColumnStorage<StringPool::Id>> storage(
+            new ColumnStorage<StringPool::Id>());
+        for (StringPool::Id id : b.strings)
+          storage->Append(id);
+        storage->ShrinkToFit();
+        // Nulls in string columns are represented by the null string id so
+        // the column itself is always non-null.
+        columns_.emplace_back(col_names_[i].c_str(), storage.get(),
+                              Column::Flag::kNonNull, this, i, 0);
+        storages_.emplace_back(std::move(storage));
+        schema_.columns.emplace_back(Table::Schema::Column{
+            col_names_[i], SqlValue::Type::kString, false, false, false,
+            false});
+        break;
+      }
+    }
+    b = ColumnBuilder();
+  }
+
+  if (!has_id) {
+    uint32_t col_idx = static_cast<uint32_t>(columns_.size());
+    columns_.emplace_back(Column::IdColumn(this, col_idx, 0));
+    schema_.columns.emplace_back(Table::Schema::Column{
+        "id", SqlValue::Type::kLong, true, true, true, false});
+  }
+  return base::OkStatus();
+}
+
+template <typename T>
+void RuntimeTable::AddNumericColumn(
+    uint32_t col_idx,
+    const std::vector<base::Optional<T>>& values,
+    uint32_t null_count) {
+  const char* name = col_names_[col_idx].c_str();
+  bool is_sorted = false;
+  if (null_count == 0) {
+    std::unique_ptr<ColumnStorage<T>> storage(new ColumnStorage<T>());
+    is_sorted = true;
+    for (uint32_t i = 0; i < values.size(); ++i) {
+      storage->Append(*values[i]);
+      is_sorted = is_sorted && (i == 0 || *values[i - 1] <= *values[i]);
+    }
+    storage->ShrinkToFit();
+    uint32_t flags = Column::Flag::kNonNull;
+    if (is_sorted)
+      flags |= Column::Flag::kSorted;
+    columns_.emplace_back(name, storage.get(), flags, this, col_idx, 0);
+    storages_.emplace_back(std::move(storage));
+  } else {
+    using Storage = ColumnStorage<base::Optional<T>>;
+    std::unique_ptr<Storage> storage(
+        new Storage(Storage::template Create<false>()));
+    for (const base::Optional<T>& value : values)
+      storage->Append(value);
+    storage->ShrinkToFit();
+    columns_.emplace_back(name, storage.get(), Column::Flag::kNoFlag, this,
+                          col_idx, 0);
+    storages_.emplace_back(std::move(storage));
+  }
+  schema_.columns.emplace_back(Table::Schema::Column{
+      col_names_[col_idx], columns_.back().type(), false, is_sorted, false,
+      false});
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
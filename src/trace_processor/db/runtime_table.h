@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_RUNTIME_TABLE_H_
+#define SRC_TRACE_PROCESSOR_DB_RUNTIME_TABLE_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/optional.h"
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/column_storage.h"
+#include "src/trace_processor/db/table.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Table whose columns are only known at runtime (e.g. the result of a SQL
+// query) rather than defined with the macros in tables/macros.h.
+//
+// Rows are added one at a time with AddRow() and the type of each column is
+// inferred from its values: integer columns containing a floating point
+// value become double columns while mixing strings and numbers in the same
+// column is an error. Once all the rows are added, Finalize() builds the
+// columns, marking them as sorted and non-null where possible so filters
+// can use the fast paths of Column.
+//
+// Like all the tables exposed to SQLite, runtime tables need an "id" column
+// with unique, non-null integer values: if no column has this name, a hidden
+// one containing the row number is added. An "id" column is only treated as
+// an id column (is_id in the schema) if its values are the row numbers.
+class RuntimeTable : public Table {
+ public:
+  RuntimeTable(StringPool* pool, std::vector<std::string> col_names);
+  ~RuntimeTable() override;
+
+  RuntimeTable(const RuntimeTable&) = delete;
+  RuntimeTable& operator=(const RuntimeTable&) = delete;
+
+  // Adds a row containing |values|, one for each column.
+  base::Status AddRow(const std::vector<SqlValue>& values);
+
+  // Builds the columns of the table from the rows added so far. No more rows
+  // can be added after this is called.
+  base::Status Finalize();
+
+  // Returns the schema of the table. Only valid after Finalize().
+  const Table::Schema& schema() const { return schema_; }
+
+ private:
+  // Values of a column while rows are being added.
+  struct ColumnBuilder {
+    enum class Type {
+      kNull,
+      kLong,
+      kDouble,
+      kString,
+    };
+
+    Type type = Type::kNull;
+    uint32_t null_count = 0;
+    std::vector<base::Optional<int64_t>> longs;
+    std::vector<base::Optional<double>> doubles;
+    std::vector<StringPool::Id> strings;
+  };
+
+  base::Status AddValue(uint32_t col_idx, const SqlValue& value);
+
+  template <typename T>
+  void AddNumericColumn(uint32_t col_idx,
+                        const std::vector<base::Optional<T>>& values,
+                        uint32_t null_count);
+
+  // Names of the columns. Never resized after construction as columns point
+  // to these strings.
+  const std::vector<std::string> col_names_;
+  std::vector<ColumnBuilder> builders_;
+  std::vector<std::unique_ptr<ColumnStorageBase>> storages_;
+  Table::Schema schema_;
+  bool finalized_ = false;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DB_RUNTIME_TABLE_H_
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/runtime_table.h"
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+TEST(RuntimeTableTest, InfersColumnTypes) {
+  StringPool pool;
+  RuntimeTable table(&pool, {"ts", "value", "name", "empty"});
+  ASSERT_TRUE(table
+                  .AddRow({SqlValue::Long(10), SqlValue(),
+                           SqlValue::String("a"), SqlValue()})
+                  .ok());
+  ASSERT_TRUE(table
+                  .AddRow({SqlValue::Long(20), SqlValue::Long(3), SqlValue(),
+                           SqlValue()})
+                  .ok());
+  ASSERT_TRUE(table
+                  .AddRow({SqlValue::Long(20), SqlValue::Double(1.5),
+                           SqlValue::String("b"), SqlValue()})
+                  .ok());
+  ASSERT_TRUE(table.Finalize().ok());
+
+  ASSERT_EQ(table.row_count(), 3u);
+  const Table::Schema& schema = table.schema();
+  ASSERT_EQ(schema.columns.size(), 5u);
+
+  // Sorted, non-null integers.
+  ASSERT_EQ(schema.columns[0].type, SqlValue::Type::kLong);
+  ASSERT_TRUE(schema.columns[0].is_sorted);
+  ASSERT_TRUE(table.GetColumn(0).IsSorted());
+  ASSERT_FALSE(table.GetColumn(0).IsNullable());
+
+  // Integers mixed with doubles are stored as doubles.
+  ASSERT_EQ(schema.columns[1].type, SqlValue::Type::kDouble);
+  ASSERT_TRUE(table.GetColumn(1).Get(0).is_null());
+  ASSERT_DOUBLE_EQ(table.GetColumn(1).Get(1).AsDouble(), 3.0);
+  ASSERT_DOUBLE_EQ(table.GetColumn(1).Get(2).AsDouble(), 1.5);
+
+  ASSERT_EQ(schema.columns[2].type, SqlValue::Type::kString);
+  ASSERT_STREQ(table.GetColumn(2).Get(0).AsString(), "a");
+  ASSERT_TRUE(table.GetColumn(2).Get(1).is_null());
+
+  ASSERT_TRUE(table.GetColumn(3).Get(2).is_null());
+
+  // A hidden id column is added.
+  ASSERT_EQ(schema.columns[4].name, "id");
+  ASSERT_TRUE(schema.columns[4].is_id);
+  ASSERT_TRUE(schema.columns[4].is_hidden);
+  ASSERT_EQ(table.GetColumn(4).Get(2).AsLong(), 2);
+
+  // Filters work on the inferred columns.
+  Table filtered =
+      table.Filter({table.GetColumn(0).eq_value(SqlValue::Long(20)),
+                    table.GetColumn(2).is_not_null()});
+  ASSERT_EQ(filtered.row_count(), 1u);
+  ASSERT_EQ(filtered.GetColumn(4).Get(0).AsLong(), 2);
+}
+
+TEST(RuntimeTableTest, IdColumn) {
+  StringPool pool;
+  {
+    RuntimeTable table(&pool, {"id", "value"});
+    ASSERT_TRUE(table.AddRow({SqlValue::Long(5), SqlValue::Long(1)}).ok());
+    ASSERT_TRUE(table.AddRow({SqlValue::Long(2), SqlValue::Long(1)}).ok());
+    ASSERT_TRUE(table.Finalize().ok());
+    ASSERT_EQ(table.schema().columns.size(), 2u);
+    // Not the row numbers so this is a regular column.
+    ASSERT_FALSE(table.schema().columns[0].is_id);
+    ASSERT_FALSE(table.schema().columns[0].is_hidden);
+    ASSERT_EQ(table.GetColumn(0).Get(0).AsLong(), 5);
+
+    Table filtered =
+        table.Filter({table.GetColumn(0).eq_value(SqlValue::Long(2))});
+    ASSERT_EQ(filtered.row_count(), 1u);
+    ASSERT_EQ(filtered.GetColumn(0).Get(0).AsLong(), 2);
+  }
+  {
+    RuntimeTable table(&pool, {"value", "id"});
+    ASSERT_TRUE(table.AddRow({SqlValue::Long(7), SqlValue::Long(0)}).ok());
+    ASSERT_TRUE(table.AddRow({SqlValue::Long(8), SqlValue::Long(1)}).ok());
+    ASSERT_TRUE(table.Finalize().ok());
+    ASSERT_EQ(table.schema().columns.size(), 2u);
+    ASSERT_TRUE(table.schema().columns[1].is_id);
+    ASSERT_FALSE(table.schema().columns[1].is_hidden);
+    ASSERT_TRUE(table.GetColumn(1).IsId());
+
+    Table filtered =
+        table.Filter({table.GetColumn(1).eq_value(SqlValue::Long(1))});
+    ASSERT_EQ(filtered.row_count(), 1u);
+    ASSERT_EQ(filtered.GetColumn(0).Get(0).AsLong(), 8);
+  }
+  {
+    RuntimeTable table(&pool, {"id"});
+    ASSERT_TRUE(table.AddRow({SqlValue::Long(5)}).ok());
+    ASSERT_TRUE(table.AddRow({SqlValue::Long(5)}).ok());
+    ASSERT_FALSE(table.Finalize().ok());
+  }
+  {
+    RuntimeTable table(&pool, {"id"});
+    ASSERT_TRUE(table.AddRow({SqlValue::String("foo")}).ok());
+    ASSERT_FALSE(table.Finalize().ok());
+  }
+}
+
+TEST(RuntimeTableTest, MixedStringsAndNumbers) {
+  StringPool pool;
+  RuntimeTable table(&pool, {"value"});
+  ASSERT_TRUE(table.AddRow({SqlValue::Long(1)}).ok());
+  ASSERT_FALSE(table.AddRow({SqlValue::String("foo")}).ok());
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
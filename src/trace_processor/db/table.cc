@@ -16,6 +16,10 @@
 
 #include "src/trace_processor/db/table.h"
 
+#include <algorithm>
+
+#include "src/trace_processor/containers/radix_sort.h"
+
 namespace perfetto {
 namespace trace_processor {
 
@@ -54,6 +58,40 @@ Table Table::CopyExceptRowMaps() const {
   return table;
 }
 
+constexpr uint32_t Table::Iterator::kBatchSize;
+constexpr uint32_t Table::Iterator::kNoBatch;
+
+Table::Iterator::Iterator(const Table* table) : table_(table) {
+  uint32_t max_batch_size = std::min(kBatchSize, table->row_count());
+  its_.reserve(table->overlays().size());
+  indices_.reserve(table->overlays().size());
+  for (const auto& rm : table->overlays()) {
+    its_.emplace_back(rm.IterateRows());
+    indices_.emplace_back(max_batch_size);
+  }
+  column_batches_.resize(table->columns_.size());
+  batch_size_ = max_batch_size;
+  for (uint32_t i = 0; i < its_.size(); ++i)
+    its_[i].NextBatch(batch_size_, indices_[i].data());
+}
+
+void Table::Iterator::NextBatch() {
+  batch_start_ += batch_size_;
+  batch_size_ = std::min(kBatchSize, table_->row_count() - batch_start_);
+  pos_ = 0;
+  for (uint32_t i = 0; i < its_.size(); ++i)
+    its_[i].NextBatch(batch_size_, indices_[i].data());
+}
+
+void Table::Iterator::ReadColumnBatch(uint32_t col_idx) const {
+  const Column& col = table_->columns_[col_idx];
+  ColumnBatch& batch = column_batches_[col_idx];
+  batch.start = batch_start_;
+  batch.values.resize(indices_[0].size());
+  col.GetAtIdxBatch(indices_[col.overlay_index()].data(), batch_size_,
+                    batch.values.data());
+}
+
 Table Table::Sort(const std::vector<Order>& od) const {
   if (od.empty())
     return Copy();
@@ -97,6 +135,13 @@ Table Table::Sort(const std::vector<Order>& od) const {
     //     y asc, we will have the correct order of x where y is the same (since
     //     the sort is stable).
     //
+    // Each column is sorted with a radix sort on integer keys computed by
+    // Column::SortKeys when possible: this is linear in the number of rows
+    // and avoids dispatching on the type of the column for every comparison.
+    // Moreover, when the keys of all the columns fit in 64 bits together, they
+    // are packed in a single key (with the first order by in the most
+    // significant bits) and the index vector is sorted only once.
+    //
     // TODO(lalitm): it is possible that we could sort the last constraint (i.e.
     // the first constraint in the below loop) in a non-stable way. However,
     // this is more subtle than it appears as we would then need special
@@ -106,8 +151,44 @@ Table Table::Sort(const std::vector<Order>& od) const {
     // in DbSqliteTable which currently eliminates constraints on sorted
     // columns.
     std::iota(idx.begin(), idx.end(), 0);
-    for (auto it = od.rbegin(); it != od.rend(); ++it) {
-      columns_[it->col_idx].StableSort(it->desc, &idx);
+
+    // Only the ranges of the keys are computed upfront: the keys themselves
+    // are materialized once it's known that they will be radix sorted, and
+    // one column at a time when they can't be fused.
+    std::vector<base::Optional<Column::SortKeyInfo>> key_infos;
+    key_infos.reserve(od.size());
+    uint32_t total_bits = 0;
+    bool all_keyed = true;
+    for (uint32_t i = 0; i < od.size(); ++i) {
+      key_infos.emplace_back(
+          columns_[od[i].col_idx].PrepareSortKeys(od[i].desc));
+      all_keyed &= key_infos[i].has_value();
+      total_bits += key_infos[i] ? key_infos[i]->bits : 64;
+    }
+
+    std::vector<uint64_t> keys;
+    if (all_keyed && total_bits <= 64) {
+      std::vector<uint64_t> fused;
+      columns_[od[0].col_idx].SortKeys(*key_infos[0], &fused);
+      for (uint32_t i = 1; i < od.size(); ++i) {
+        uint32_t bits = key_infos[i]->bits;
+        columns_[od[i].col_idx].SortKeys(*key_infos[i], &keys);
+        // |bits| can only be 64 if all the other columns have a single value
+        // (i.e. zero bits), in which case |fused| is all zeros.
+        for (uint32_t r = 0; r < row_count_; ++r)
+          fused[r] = bits == 64 ? keys[r] : (fused[r] << bits) | keys[r];
+      }
+      radix_sort::SortIndices(fused, total_bits, &idx);
+    } else {
+      for (uint32_t i = static_cast<uint32_t>(od.size()); i-- > 0;) {
+        const Column& col = columns_[od[i].col_idx];
+        if (key_infos[i]) {
+          col.SortKeys(*key_infos[i], &keys);
+          radix_sort::SortIndices(keys, key_infos[i]->bits, &idx);
+        } else {
+          col.StableSort(od[i].desc, &idx);
+        }
+      }
     }
   }
 
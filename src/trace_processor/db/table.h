@@ -37,14 +37,15 @@ namespace trace_processor {
 class Table {
  public:
   // Iterator over the rows of the table.
+  //
+  // Rows are processed in batches: the storage indices of all the rows in a
+  // batch are computed in one go for every overlay and the values of a column
+  // are read for the whole batch the first time the column is accessed in the
+  // batch. This avoids dispatching on the mode of the RowMaps and the type of
+  // the column for every cell.
   class Iterator {
    public:
-    explicit Iterator(const Table* table) : table_(table) {
-      its_.reserve(table->overlays().size());
-      for (const auto& rm : table->overlays()) {
-        its_.emplace_back(rm.IterateRows());
-      }
-    }
+    explicit Iterator(const Table* table);
 
     Iterator(Iterator&&) noexcept = default;
     Iterator& operator=(Iterator&&) = default;
@@ -54,23 +55,48 @@ class Table {
 
     // Advances the iterator to the next row of the table.
     void Next() {
-      for (auto& it : its_) {
-        it.Next();
-      }
+      if (PERFETTO_UNLIKELY(++pos_ == batch_size_))
+        NextBatch();
     }
 
     // Returns whether the row the iterator is pointing at is valid.
-    explicit operator bool() const { return its_[0]; }
+    explicit operator bool() const { return pos_ < batch_size_; }
 
     // Returns the value at the current row for column |col_idx|.
     SqlValue Get(uint32_t col_idx) const {
-      const auto& col = table_->columns_[col_idx];
-      return col.GetAtIdx(its_[col.overlay_index()].index());
+      const ColumnBatch& batch = column_batches_[col_idx];
+      if (PERFETTO_UNLIKELY(batch.start != batch_start_))
+        ReadColumnBatch(col_idx);
+      return batch.values[pos_];
     }
 
    private:
+    static constexpr uint32_t kBatchSize = 1024;
+    static constexpr uint32_t kNoBatch = std::numeric_limits<uint32_t>::max();
+
+    // The values of a column for the rows of the current batch.
+    struct ColumnBatch {
+      // The first row of the batch the values were read for.
+      uint32_t start = kNoBatch;
+      std::vector<SqlValue> values;
+    };
+
+    // Computes the storage indices of the next batch of rows.
+    void NextBatch();
+
+    // Reads the values of the column |col_idx| for the current batch.
+    void ReadColumnBatch(uint32_t col_idx) const;
+
     const Table* table_ = nullptr;
     std::vector<ColumnStorageOverlay::Iterator> its_;
+
+    // For each overlay, the storage indices of the rows in the current batch.
+    std::vector<std::vector<uint32_t>> indices_;
+    mutable std::vector<ColumnBatch> column_batches_;
+
+    uint32_t batch_start_ = 0;
+    uint32_t batch_size_ = 0;
+    uint32_t pos_ = 0;
   };
 
   // Helper class storing the schema of the table. This allows decisions to be
@@ -206,6 +232,22 @@ class Table {
   }
   const std::vector<Column>& columns() const { return columns_; }
 
+  // Returns the storage backing the column at |idx|. Together with
+  // ReplaceRows(), this allows replacing the contents of the table as a
+  // whole, e.g. when restoring it from a snapshot.
+  ColumnStorageBase* GetMutableColumnStorage(uint32_t idx) {
+    return columns_[idx].storage_;
+  }
+
+  // Replaces the rows of the table with the |row_count| rows selected from
+  // the column storages by |overlays|.
+  void ReplaceRows(uint32_t row_count,
+                   std::vector<ColumnStorageOverlay> overlays) {
+    PERFETTO_DCHECK(overlays.size() == overlays_.size());
+    row_count_ = row_count;
+    overlays_ = std::move(overlays);
+  }
+
  protected:
   explicit Table(StringPool* pool);
 
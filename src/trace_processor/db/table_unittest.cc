@@ -15,6 +15,14 @@
  */
 
 #include "src/trace_processor/db/table.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <random>
+
 #include "perfetto/ext/base/optional.h"
 #include "src/trace_processor/db/typed_column.h"
 #include "src/trace_processor/tables/macros.h"
@@ -35,6 +43,100 @@ PERFETTO_TP_TABLE(PERFETTO_TP_TEST_EVENT_TABLE_DEF);
 
 TestEventTable::~TestEventTable() = default;
 
+#define PERFETTO_TP_TEST_SORT_TABLE_DEF(NAME, PARENT, C) \
+  NAME(TestSortTable, "sort")                            \
+  PARENT(PERFETTO_TP_ROOT_TABLE_PARENT_DEF, C)           \
+  C(int64_t, big)                                        \
+  C(base::Optional<int32_t>, small)                      \
+  C(base::Optional<double>, real)                        \
+  C(base::Optional<StringPool::Id>, name)
+PERFETTO_TP_TABLE(PERFETTO_TP_TEST_SORT_TABLE_DEF);
+
+TestSortTable::~TestSortTable() = default;
+
+// Compares two values of the same column with nulls first.
+int CompareValues(const SqlValue& a, const SqlValue& b) {
+  if (a.is_null() || b.is_null())
+    return static_cast<int>(!a.is_null()) - static_cast<int>(!b.is_null());
+  switch (a.type) {
+    case SqlValue::Type::kLong:
+      return (a.AsLong() > b.AsLong()) - (a.AsLong() < b.AsLong());
+    case SqlValue::Type::kDouble:
+      return (a.AsDouble() > b.AsDouble()) - (a.AsDouble() < b.AsDouble());
+    case SqlValue::Type::kString:
+      return strcmp(a.AsString(), b.AsString());
+    case SqlValue::Type::kNull:
+    case SqlValue::Type::kBytes:
+      break;
+  }
+  PERFETTO_FATAL("Unexpected type");
+}
+
+// Checks that |table| sorted by |od| matches sorting the rows with a
+// comparison sort on their values.
+void CheckSort(const Table& table, const std::vector<Order>& od) {
+  std::vector<uint32_t> expected(table.row_count());
+  std::iota(expected.begin(), expected.end(), 0);
+  std::stable_sort(
+      expected.begin(), expected.end(), [&](uint32_t a, uint32_t b) {
+        for (const Order& o : od) {
+          const Column& col = table.GetColumn(o.col_idx);
+          SqlValue a_val = col.Get(a);
+          SqlValue b_val = col.Get(b);
+          int cmp = CompareValues(a_val, b_val);
+          if (cmp != 0)
+            return o.desc ? cmp > 0 : cmp < 0;
+        }
+        return false;
+      });
+
+  Table sorted = table.Sort(od);
+  ASSERT_EQ(sorted.row_count(), table.row_count());
+  for (uint32_t i = 0; i < sorted.row_count(); ++i) {
+    // Rows are identified by the id column.
+    ASSERT_EQ(sorted.GetColumn(0).Get(i).AsLong(),
+              table.GetColumn(0).Get(expected[i]).AsLong());
+  }
+}
+
+TEST(TableTest, SortMatchesComparisonSort) {
+  StringPool pool;
+  TestSortTable table{&pool, nullptr};
+  using CI = TestSortTable::ColumnIndex;
+
+  static const char* const kNames[] = {"b", "a", "ab", "", "c", "ba"};
+  std::minstd_rand0 rnd(42);
+  for (uint32_t i = 0; i < 1000; ++i) {
+    TestSortTable::Row row;
+    // Extreme values check that the keys of a column can use all 64 bits.
+    row.big = i % 97 == 0 ? std::numeric_limits<int64_t>::min()
+                          : i % 89 == 0 ? std::numeric_limits<int64_t>::max()
+                                        : static_cast<int64_t>(rnd()) - 1000;
+    if (rnd() % 5)
+      row.small = static_cast<int32_t>(rnd() % 7) - 3;
+    if (rnd() % 5)
+      row.real = (static_cast<double>(rnd() % 11) - 5) / 4;
+    if (rnd() % 5)
+      row.name = pool.InternString(kNames[rnd() % 6]);
+    table.Insert(row);
+  }
+
+  CheckSort(table, {table.big().ascending()});
+  CheckSort(table, {table.small().descending()});
+  CheckSort(table, {table.real().ascending()});
+  CheckSort(table, {table.name().descending()});
+  CheckSort(table, {table.small().ascending(), table.name().ascending(),
+                    table.real().descending()});
+  CheckSort(table, {table.name().ascending(), table.big().descending()});
+  CheckSort(table, {table.small().descending(), table.big().ascending(),
+                    table.real().ascending()});
+
+  // Sorting an already sorted table with a non-trivial overlay.
+  Table sorted = table.Filter({table.small().ge(0)})
+                     .Sort({table.real().descending()});
+  CheckSort(sorted, {Order{CI::name, false}, Order{CI::small, true}});
+}
+
 TEST(TableTest, SetIdColumns) {
   StringPool pool;
   TestEventTable table{&pool, nullptr};
@@ -126,6 +228,126 @@ TEST(TableTest, SetIdColumns) {
   }
 }
 
+TEST(TableTest, IteratorCrossesBatches) {
+  StringPool pool;
+  TestSortTable table{&pool, nullptr};
+  for (uint32_t i = 0; i < 5000; ++i) {
+    TestSortTable::Row row;
+    row.big = i;
+    if (i % 3)
+      row.small = static_cast<int32_t>(i % 100);
+    row.name = pool.InternString(base::StringView(std::to_string(i % 10)));
+    table.Insert(row);
+  }
+  using CI = TestSortTable::ColumnIndex;
+
+  // Covers a range overlay, an index vector overlay (after sorting) and a bit
+  // vector overlay (after filtering).
+  std::vector<Table> tables;
+  tables.emplace_back(table.Copy());
+  tables.emplace_back(table.Sort({table.big().descending()}));
+  tables.emplace_back(table.Filter({table.small().gt(50)}));
+  for (const Table& t : tables) {
+    uint32_t row = 0;
+    for (auto it = t.IterateRows(); it; it.Next(), ++row) {
+      // Only read some columns for some rows to check values are read
+      // correctly when columns are accessed partway through a batch.
+      if (row % 7 == 0) {
+        SqlValue small = t.GetColumn(CI::small).Get(row);
+        ASSERT_EQ(it.Get(CI::small).is_null(), small.is_null());
+        if (!small.is_null()) {
+          ASSERT_EQ(it.Get(CI::small).AsLong(), small.AsLong());
+        }
+      }
+      ASSERT_EQ(it.Get(CI::big).AsLong(),
+                t.GetColumn(CI::big).Get(row).AsLong());
+      if (row % 3 == 0) {
+        ASSERT_STREQ(it.Get(CI::name).AsString(),
+                     t.GetColumn(CI::name).Get(row).AsString());
+      }
+    }
+    ASSERT_EQ(row, t.row_count());
+  }
+}
+
+TEST(TableTest, ShrinkToFitPacksColumns) {
+  StringPool pool;
+  TestEventTable table{&pool, nullptr};
+  for (uint32_t i = 0; i < 1000; ++i)
+    table.Insert(TestEventTable::Row(1000000 + i * 10, i % 5, i / 100 * 100));
+  table.ShrinkToFit();
+
+  // Filtering and reading work on the packed columns.
+  auto res = table.Filter({table.ts().ge(1000000 + 5000), table.dur().eq(3),
+                           table.arg_set_id().eq(700)});
+  ASSERT_EQ(res.row_count(), 20u);
+  for (auto it = res.IterateRows(); it; it.Next()) {
+    ASSERT_EQ(it.Get(static_cast<uint32_t>(TestEventTable::ColumnIndex::dur))
+                  .AsLong(),
+              3);
+  }
+  ASSERT_EQ(table.ts()[999], 1000000 + 9990);
+
+  // Mutations unpack the columns first.
+  table.mutable_dur()->Set(999, 42);
+  table.Insert(TestEventTable::Row(2000000, 1, 1000));
+  ASSERT_EQ(table.row_count(), 1001u);
+  ASSERT_EQ(table.dur()[999], 42);
+  ASSERT_EQ(table.dur()[998], 3);
+  ASSERT_EQ(table.ts()[1000], 2000000);
+  ASSERT_EQ(table.arg_set_id()[1000], 1000u);
+}
+
+TEST(TableTest, ShrinkToFitPacksNullableColumns) {
+  StringPool pool;
+  TestSortTable table{&pool, nullptr};
+  std::vector<base::Optional<int32_t>> small;
+  for (uint32_t i = 0; i < 1000; ++i) {
+    TestSortTable::Row row;
+    row.big = i;
+    if (i % 3 != 0)
+      row.small = static_cast<int32_t>(i % 10);
+    small.push_back(row.small);
+    table.Insert(row);
+  }
+  table.ShrinkToFit();
+  using CI = TestSortTable::ColumnIndex;
+  const auto& storage = *static_cast<const ColumnStorage<base::Optional<int32_t>>*>(
+      table.GetColumn(CI::small).storage_base());
+  ASSERT_TRUE(storage.IsPacked());
+  for (uint32_t i = 0; i < small.size(); ++i)
+    ASSERT_EQ(table.small()[i], small[i]);
+
+  auto res = table.Filter({table.small().eq(4)});
+  ASSERT_EQ(res.row_count(), 67u);
+
+  // Setting a null row inserts into the packed values.
+  table.mutable_small()->Set(0, 42);
+  small[0] = 42;
+  ASSERT_FALSE(storage.IsPacked());
+  for (uint32_t i = 0; i < small.size(); ++i)
+    ASSERT_EQ(table.small()[i], small[i]);
+}
+
+TEST(ColumnStorageTest, DenseNullablePacked) {
+  auto storage = ColumnStorage<base::Optional<int64_t>>::Create<true>();
+  for (int64_t i = 0; i < 1000; ++i) {
+    storage.Append(i % 4 == 0 ? base::nullopt
+                              : base::make_optional(1000000 + i / 100));
+  }
+  storage.ShrinkToFit();
+  ASSERT_TRUE(storage.IsPacked());
+  ASSERT_EQ(storage.non_null_values().size(), 1000u);
+  for (uint32_t i = 0; i < 1000; ++i) {
+    ASSERT_EQ(storage.Get(i), i % 4 == 0 ? base::nullopt
+                                         : base::make_optional<int64_t>(
+                                               1000000 + i / 100));
+  }
+  storage.Set(0, 7);
+  ASSERT_EQ(storage.Get(0), base::make_optional<int64_t>(7));
+  ASSERT_EQ(storage.Get(1), base::make_optional<int64_t>(1000000));
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_group_by_generator.h"
+
+#include <algorithm>
+
+#include "perfetto/ext/base/string_utils.h"
+#include "src/trace_processor/db/group_by_aggregator.h"
+#include "src/trace_processor/sqlite/sqlite_utils.h"
+#include "src/trace_processor/tables/macros.h"
+#include "src/trace_processor/util/status_macros.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace tables {
+
+#define PERFETTO_TP_EXPERIMENTAL_GROUP_BY_TABLE_DEF(NAME, PARENT, C) \
+  NAME(ExperimentalGroupByTable, "experimental_group_by")            \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                                  \
+  C(base::Optional<int64_t>, int_key)                                \
+  C(base::Optional<StringPool::Id>, string_key)                      \
+  C(base::Optional<int64_t>, int_key_2)                              \
+  C(base::Optional<StringPool::Id>, string_key_2)                    \
+  C(int64_t, count)                                                  \
+  C(base::Optional<int64_t>, int_sum)                                \
+  C(base::Optional<int64_t>, int_min)                                \
+  C(base::Optional<int64_t>, int_max)                                \
+  C(base::Optional<double>, real_sum)                                \
+  C(base::Optional<double>, real_min)                                \
+  C(base::Optional<double>, real_max)                                \
+  C(base::Optional<double>, avg)                                     \
+  C(StringPool::Id, source_table, Column::Flag::kHidden)             \
+  C(StringPool::Id, group_by, Column::Flag::kHidden)                 \
+  C(base::Optional<StringPool::Id>, value_column, Column::Flag::kHidden)
+
+PERFETTO_TP_TABLE(PERFETTO_TP_EXPERIMENTAL_GROUP_BY_TABLE_DEF);
+
+ExperimentalGroupByTable::~ExperimentalGroupByTable() = default;
+
+}  // namespace tables
+
+namespace {
+
+using CI = tables::ExperimentalGroupByTable::ColumnIndex;
+
+base::Optional<std::string> GetStringArg(const std::vector<Constraint>& cs,
+                                         uint32_t col) {
+  auto it = std::find_if(cs.begin(), cs.end(), [col](const Constraint& c) {
+    return c.col_idx == col && c.op == FilterOp::kEq;
+  });
+  if (it == cs.end() || it->value.type != SqlValue::Type::kString)
+    return base::nullopt;
+  return std::string(it->value.AsString());
+}
+
+}  // namespace
+
+ExperimentalGroupByGenerator::ExperimentalGroupByGenerator(StringPool* pool)
+    : pool_(pool) {}
+
+ExperimentalGroupByGenerator::~ExperimentalGroupByGenerator() = default;
+
+void ExperimentalGroupByGenerator::AddTable(const std::string& name,
+                                            const Table* table) {
+  tables_[name] = table;
+}
+
+Table::Schema ExperimentalGroupByGenerator::CreateSchema() {
+  return tables::ExperimentalGroupByTable::Schema();
+}
+
+std::string ExperimentalGroupByGenerator::TableName() {
+  return tables::ExperimentalGroupByTable::Name();
+}
+
+uint32_t ExperimentalGroupByGenerator::EstimateRowCount() {
+  // The number of groups is usually small compared to the source table.
+  return 1024;
+}
+
+base::Status ExperimentalGroupByGenerator::ValidateConstraints(
+    const QueryConstraints& qc) {
+  bool has_source_table = false;
+  bool has_group_by = false;
+  for (const auto& c : qc.constraints()) {
+    has_source_table |= c.column == static_cast<int>(CI::source_table) &&
+                        sqlite_utils::IsOpEq(c.op);
+    has_group_by |= c.column == static_cast<int>(CI::group_by) &&
+                    sqlite_utils::IsOpEq(c.op);
+  }
+  return has_source_table && has_group_by
+             ? base::OkStatus()
+             : base::ErrStatus("Failed to find required constraints");
+}
+
+base::Status ExperimentalGroupByGenerator::ComputeTable(
+    const std::vector<Constraint>& cs,
+    const std::vector<Order>&,
+    const BitVector&,
+    std::unique_ptr<Table>& table_return) {
+  base::Optional<std::string> source_table = GetStringArg(cs, CI::source_table);
+  base::Optional<std::string> group_by = GetStringArg(cs, CI::group_by);
+  base::Optional<std::string> value_column = GetStringArg(cs, CI::value_column);
+  if (!source_table || !group_by) {
+    return base::ErrStatus(
+        "experimental_group_by: table and group by columns must be strings");
+  }
+
+  // Allow the names of the views which only rename a table (e.g. "slice" for
+  // "internal_slice") to be used as well.
+  auto table_it = tables_.find(*source_table);
+  if (table_it == tables_.end())
+    table_it = tables_.find("internal_" + *source_table);
+  if (table_it == tables_.end()) {
+    return base::ErrStatus("experimental_group_by: unknown table %s",
+                           source_table->c_str());
+  }
+  const Table& table = *table_it->second;
+
+  auto col_index = [&table](const std::string& name) {
+    return table.GetColumnIndexByName(name.c_str());
+  };
+  std::vector<uint32_t> group_by_cols;
+  for (const std::string& name :
+       base::SplitString(base::ReplaceAll(*group_by, " ", ""), ",")) {
+    base::Optional<uint32_t> idx = col_index(name);
+    if (!idx) {
+      return base::ErrStatus("experimental_group_by: unknown column %s",
+                             name.c_str());
+    }
+    group_by_cols.emplace_back(*idx);
+  }
+  base::Optional<uint32_t> value_col;
+  if (value_column) {
+    value_col = col_index(*value_column);
+    if (!value_col) {
+      return base::ErrStatus("experimental_group_by: unknown column %s",
+                             value_column->c_str());
+    }
+  }
+
+  std::vector<GroupByAggregator::Group> groups;
+  RETURN_IF_ERROR(
+      GroupByAggregator::Aggregate(table, group_by_cols, value_col, &groups));
+
+  std::unique_ptr<tables::ExperimentalGroupByTable> out(
+      new tables::ExperimentalGroupByTable(pool_, nullptr));
+  StringPool::Id source_table_id =
+      pool_->InternString(base::StringView(*source_table));
+  StringPool::Id group_by_id = pool_->InternString(base::StringView(*group_by));
+  base::Optional<StringPool::Id> value_column_id;
+  if (value_column)
+    value_column_id = pool_->InternString(base::StringView(*value_column));
+
+  auto set_key = [this](const SqlValue& key, base::Optional<int64_t>* int_key,
+                        base::Optional<StringPool::Id>* string_key) {
+    if (key.type == SqlValue::Type::kLong) {
+      *int_key = key.AsLong();
+    } else if (key.type == SqlValue::Type::kString) {
+      *string_key = pool_->InternString(key.AsString());
+    }
+  };
+  for (const GroupByAggregator::Group& group : groups) {
+    tables::ExperimentalGroupByTable::Row row;
+    set_key(group.keys[0], &row.int_key, &row.string_key);
+    set_key(group.keys[1], &row.int_key_2, &row.string_key_2);
+    row.count = group.count;
+    if (group.sum.type == SqlValue::Type::kLong) {
+      row.int_sum = group.sum.AsLong();
+      row.int_min = group.min.AsLong();
+      row.int_max = group.max.AsLong();
+    } else if (group.sum.type == SqlValue::Type::kDouble) {
+      row.real_sum = group.sum.AsDouble();
+      row.real_min = group.min.AsDouble();
+      row.real_max = group.max.AsDouble();
+    }
+    if (!group.avg.is_null())
+      row.avg = group.avg.AsDouble();
+    row.source_table = source_table_id;
+    row.group_by = group_by_id;
+    row.value_column = value_column_id;
+    out->Insert(row);
+  }
+  table_return = std::move(out);
+  return base::OkStatus();
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_GROUP_BY_GENERATOR_H_
+#define SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_GROUP_BY_GENERATOR_H_
+
+#include <map>
+#include <string>
+
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/dynamic/dynamic_table_generator.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Dynamic table generator for the "experimental_group_by" table function.
+//
+// Computes COUNT, SUM, MIN, MAX and AVG of a column of a db table grouped by
+// one or two of its integer or string columns using GroupByAggregator; i.e.
+//   SELECT int_key AS utid, int_sum AS total_dur
+//   FROM experimental_group_by('sched_slice', 'utid', 'dur')
+// is equivalent to
+//   SELECT utid, SUM(dur) AS total_dur FROM sched_slice GROUP BY utid
+// but does not require SQLite to step through every row of the table.
+//
+// The arguments are the name of the table, a comma separated list of the
+// columns to group by and, optionally, the column to aggregate. Any constraint
+// on the source table has to be applied by the caller (e.g. by filtering the
+// output).
+//
+// Following the args table, integer and string keys and aggregates are
+// returned in separate columns (e.g. |int_key| and |string_key|).
+class ExperimentalGroupByGenerator : public DynamicTableGenerator {
+ public:
+  explicit ExperimentalGroupByGenerator(StringPool* pool);
+  ~ExperimentalGroupByGenerator() override;
+
+  // Makes |table| available to the table function under |name|.
+  void AddTable(const std::string& name, const Table* table);
+
+  Table::Schema CreateSchema() override;
+  std::string TableName() override;
+  uint32_t EstimateRowCount() override;
+  base::Status ValidateConstraints(const QueryConstraints&) override;
+  base::Status ComputeTable(const std::vector<Constraint>& cs,
+                            const std::vector<Order>& ob,
+                            const BitVector& cols_used,
+                            std::unique_ptr<Table>& table_return) override;
+
+ private:
+  StringPool* pool_ = nullptr;
+  std::map<std::string, const Table*> tables_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_GROUP_BY_GENERATOR_H_
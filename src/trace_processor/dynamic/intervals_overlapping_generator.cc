@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/intervals_overlapping_generator.h"
+
+#include <algorithm>
+
+#include "src/trace_processor/sqlite/sqlite_utils.h"
+#include "src/trace_processor/tables/macros.h"
+#include "src/trace_processor/util/status_macros.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace tables {
+
+#define PERFETTO_TP_INTERVALS_OVERLAPPING_TABLE_DEF(NAME, PARENT, C) \
+  NAME(IntervalsOverlappingTable, "intervals_overlapping")            \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                                   \
+  C(int64_t, interval_id)                                             \
+  C(int64_t, ts)                                                      \
+  C(int64_t, dur)                                                     \
+  C(base::Optional<int64_t>, partition_value)                         \
+  C(StringPool::Id, source_table, Column::Flag::kHidden)              \
+  C(int64_t, start_ts, Column::Flag::kHidden)                         \
+  C(int64_t, end_ts, Column::Flag::kHidden)                           \
+  C(base::Optional<StringPool::Id>, partition_column, Column::Flag::kHidden)
+
+PERFETTO_TP_TABLE(PERFETTO_TP_INTERVALS_OVERLAPPING_TABLE_DEF);
+
+IntervalsOverlappingTable::~IntervalsOverlappingTable() = default;
+
+}  // namespace tables
+
+namespace {
+
+using CI = tables::IntervalsOverlappingTable::ColumnIndex;
+
+base::Optional<SqlValue> GetEqArg(const std::vector<Constraint>& cs,
+                                  uint32_t col,
+                                  SqlValue::Type type) {
+  auto it = std::find_if(cs.begin(), cs.end(), [col](const Constraint& c) {
+    return c.col_idx == col && c.op == FilterOp::kEq;
+  });
+  if (it == cs.end() || it->value.type != type)
+    return base::nullopt;
+  return it->value;
+}
+
+}  // namespace
+
+IntervalsOverlappingGenerator::IntervalsOverlappingGenerator(StringPool* pool)
+    : pool_(pool) {}
+
+IntervalsOverlappingGenerator::~IntervalsOverlappingGenerator() = default;
+
+void IntervalsOverlappingGenerator::AddTable(const std::string& name,
+                                             const Table* table) {
+  tables_[name] = Source{table, {}, {}};
+}
+
+void IntervalsOverlappingGenerator::AddView(
+    const std::string& name,
+    const Table* table,
+    std::map<std::string, std::string> aliases,
+    std::set<std::string> end_cols) {
+  tables_[name] = Source{table, std::move(aliases), std::move(end_cols)};
+}
+
+const Table* IntervalsOverlappingGenerator::FindTable(
+    const std::string& name) const {
+  auto it = tables_.find(name);
+  return it == tables_.end() ? nullptr : it->second.table;
+}
+
+base::Optional<uint32_t> IntervalsOverlappingGenerator::FindColumn(
+    const std::string& name,
+    const std::string& col) const {
+  auto it = tables_.find(name);
+  if (it == tables_.end())
+    return base::nullopt;
+  auto alias = it->second.aliases.find(col);
+  const std::string& table_col =
+      alias == it->second.aliases.end() ? col : alias->second;
+  return it->second.table->GetColumnIndexByName(table_col.c_str());
+}
+
+bool IntervalsOverlappingGenerator::IsEndColumn(const std::string& name,
+                                                const std::string& col) const {
+  auto it = tables_.find(name);
+  return it != tables_.end() && it->second.end_cols.count(col) > 0;
+}
+
+base::Status IntervalsOverlappingGenerator::GetIndex(
+    const std::string& name,
+    const base::Optional<std::string>& partition_col,
+    const IntervalIndex** index) {
+  const Table* table = FindTable(name);
+  if (!table)
+    return base::ErrStatus("Unknown table %s", name.c_str());
+
+  auto key = std::make_pair(table, partition_col.value_or(""));
+  auto it = indices_.find(key);
+  if (tables_finalized_ && it != indices_.end()) {
+    *index = &it->second;
+    return base::OkStatus();
+  }
+
+  base::Optional<uint32_t> ts_col = FindColumn(name, "ts");
+  base::Optional<uint32_t> dur_col = FindColumn(name, "dur");
+  if (!ts_col || !dur_col) {
+    return base::ErrStatus("Table %s does not have ts and dur columns",
+                           name.c_str());
+  }
+  base::Optional<uint32_t> part_col;
+  if (partition_col) {
+    part_col = FindColumn(name, *partition_col);
+    if (!part_col) {
+      return base::ErrStatus("Unknown column %s in table %s",
+                             partition_col->c_str(), name.c_str());
+    }
+  }
+
+  IntervalIndex built;
+  RETURN_IF_ERROR(
+      IntervalIndex::Build(*table, *ts_col, *dur_col, part_col, &built));
+  IntervalIndex& slot = indices_[key];
+  slot = std::move(built);
+  *index = &slot;
+  return base::OkStatus();
+}
+
+base::Status IntervalsOverlappingGenerator::GetMaxDur(
+    const std::string& name,
+    base::Optional<int64_t>* max_dur) {
+  const Table* table = FindTable(name);
+  if (!table)
+    return base::ErrStatus("Unknown table %s", name.c_str());
+
+  auto it = max_durs_.find(table);
+  if (tables_finalized_ && it != max_durs_.end()) {
+    *max_dur = it->second;
+    return base::OkStatus();
+  }
+
+  base::Optional<uint32_t> dur_col = FindColumn(name, "dur");
+  if (!dur_col || table->GetColumn(*dur_col).type() != SqlValue::Type::kLong)
+    return base::ErrStatus("Table %s has no integer dur column", name.c_str());
+
+  // Nulls compare lower than any integer so the max is only null if all the
+  // durs are.
+  base::Optional<SqlValue> max = table->GetColumn(*dur_col).Max();
+  *max_dur = max && max->type == SqlValue::Type::kLong
+                 ? base::make_optional(max->AsLong())
+                 : base::nullopt;
+  if (tables_finalized_)
+    max_durs_[table] = *max_dur;
+  return base::OkStatus();
+}
+
+Table::Schema IntervalsOverlappingGenerator::CreateSchema() {
+  return tables::IntervalsOverlappingTable::Schema();
+}
+
+std::string IntervalsOverlappingGenerator::TableName() {
+  return tables::IntervalsOverlappingTable::Name();
+}
+
+uint32_t IntervalsOverlappingGenerator::EstimateRowCount() {
+  // Overlap queries are usually for a small window of the trace.
+  return 1024;
+}
+
+base::Status IntervalsOverlappingGenerator::ValidateConstraints(
+    const QueryConstraints& qc) {
+  bool has_source_table = false;
+  bool has_start_ts = false;
+  bool has_end_ts = false;
+  for (const auto& c : qc.constraints()) {
+    if (!sqlite_utils::IsOpEq(c.op))
+      continue;
+    has_source_table |= c.column == static_cast<int>(CI::source_table);
+    has_start_ts |= c.column == static_cast<int>(CI::start_ts);
+    has_end_ts |= c.column == static_cast<int>(CI::end_ts);
+  }
+  return has_source_table && has_start_ts && has_end_ts
+             ? base::OkStatus()
+             : base::ErrStatus("Failed to find required constraints");
+}
+
+base::Status IntervalsOverlappingGenerator::ComputeTable(
+    const std::vector<Constraint>& cs,
+    const std::vector<Order>&,
+    const BitVector&,
+    std::unique_ptr<Table>& table_return) {
+  base::Optional<SqlValue> source_table =
+      GetEqArg(cs, CI::source_table, SqlValue::Type::kString);
+  base::Optional<SqlValue> start_ts =
+      GetEqArg(cs, CI::start_ts, SqlValue::Type::kLong);
+  base::Optional<SqlValue> end_ts =
+      GetEqArg(cs, CI::end_ts, SqlValue::Type::kLong);
+  base::Optional<SqlValue> partition_column =
+      GetEqArg(cs, CI::partition_column, SqlValue::Type::kString);
+  if (!source_table || !start_ts || !end_ts) {
+    return base::ErrStatus(
+        "intervals_overlapping: expected a table name and two timestamps");
+  }
+
+  std::string name = source_table->AsString();
+  base::Optional<std::string> partition_col;
+  if (partition_column)
+    partition_col = partition_column->AsString();
+
+  const IntervalIndex* index = nullptr;
+  base::Status status = GetIndex(name, partition_col, &index);
+  if (!status.ok()) {
+    return base::ErrStatus("intervals_overlapping: %s", status.c_message());
+  }
+
+  // Only look at one partition if the output is filtered on it.
+  base::Optional<int64_t> partition;
+  if (partition_col) {
+    base::Optional<SqlValue> value =
+        GetEqArg(cs, CI::partition_value, SqlValue::Type::kLong);
+    if (value)
+      partition = value->AsLong();
+  }
+
+  std::vector<uint32_t> rows;
+  index->FindOverlapping(start_ts->AsLong(), end_ts->AsLong(), partition,
+                         &rows);
+
+  const Table& table = *FindTable(name);
+  const Column& id = table.GetColumn(*FindColumn(name, "id"));
+  const Column& ts = table.GetColumn(*FindColumn(name, "ts"));
+  const Column& dur = table.GetColumn(*FindColumn(name, "dur"));
+  const Column* part = partition_col
+                           ? &table.GetColumn(*FindColumn(name, *partition_col))
+                           : nullptr;
+
+  std::unique_ptr<tables::IntervalsOverlappingTable> out(
+      new tables::IntervalsOverlappingTable(pool_, nullptr));
+  StringPool::Id source_table_id = pool_->InternString(base::StringView(name));
+  base::Optional<StringPool::Id> partition_column_id;
+  if (partition_col) {
+    partition_column_id =
+        pool_->InternString(base::StringView(*partition_col));
+  }
+  for (uint32_t row : rows) {
+    tables::IntervalsOverlappingTable::Row r;
+    r.interval_id = id.Get(row).AsLong();
+    r.ts = ts.Get(row).AsLong();
+    r.dur = dur.Get(row).AsLong();
+    if (part)
+      r.partition_value = part->Get(row).AsLong();
+    r.source_table = source_table_id;
+    r.start_ts = start_ts->AsLong();
+    r.end_ts = end_ts->AsLong();
+    r.partition_column = partition_column_id;
+    out->Insert(r);
+  }
+  table_return = std::move(out);
+  return base::OkStatus();
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DYNAMIC_INTERVALS_OVERLAPPING_GENERATOR_H_
+#define SRC_TRACE_PROCESSOR_DYNAMIC_INTERVALS_OVERLAPPING_GENERATOR_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/interval_index.h"
+#include "src/trace_processor/dynamic/dynamic_table_generator.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Dynamic table generator for the "intervals_overlapping" table function.
+//
+// Returns the rows of a db table overlapping [start_ts, end_ts), optionally
+// partitioned by an integer column; i.e.
+//   SELECT interval_id FROM intervals_overlapping('slice', 100, 200,
+//                                                 'track_id')
+//   WHERE partition_value = 5
+// is equivalent to
+//   SELECT id FROM slice
+//   WHERE track_id = 5 AND ts < 200 AND ts + dur > 100
+// but, instead of scanning all the rows of the track, uses an IntervalIndex
+// of the table and partition column. Once the tables are finalized, the index
+// is built the first time it is queried and then reused.
+//
+// Rows are returned sorted by partition and then by ts.
+class IntervalsOverlappingGenerator : public DynamicTableGenerator {
+ public:
+  explicit IntervalsOverlappingGenerator(StringPool* pool);
+  ~IntervalsOverlappingGenerator() override;
+
+  // Makes |table| available to the table function under |name|.
+  void AddTable(const std::string& name, const Table* table);
+
+  // Makes |table| available under |name| as well, for a view which returns
+  // all the rows and columns of |table| plus columns which are copies of
+  // other columns (e.g. "slice", which adds "slice_id" to "internal_slice").
+  // |aliases| maps the name of each added column to the column it copies.
+  // |end_cols| are the names of the added columns computed as ts + dur (e.g.
+  // "ts_end" for "sched"). Views which filter rows or compute other columns
+  // must not be added: the span join reads the rows of |table| in their place.
+  void AddView(const std::string& name,
+               const Table* table,
+               std::map<std::string, std::string> aliases,
+               std::set<std::string> end_cols = {});
+
+  // Indicates that the rows of the tables won't change anymore, i.e. the
+  // trace has been fully parsed. Until then, rows can be added and updated
+  // (e.g. the dur of a slice is set when it ends) so indices are rebuilt on
+  // every query; afterwards they are only built once.
+  void OnTablesFinalized() { tables_finalized_ = true; }
+
+  // Sets |index| to the index of the ts and dur columns of the table called
+  // |name|, partitioned by |partition_col| if set, building it if necessary.
+  // |index| is valid until the next call for the same table and partition
+  // column.
+  base::Status GetIndex(const std::string& name,
+                        const base::Optional<std::string>& partition_col,
+                        const IntervalIndex** index);
+
+  // Sets |max_dur| to the largest dur of the table called |name| or to
+  // base::nullopt if the table has no row with a dur.
+  base::Status GetMaxDur(const std::string& name,
+                         base::Optional<int64_t>* max_dur);
+
+  Table::Schema CreateSchema() override;
+  std::string TableName() override;
+  uint32_t EstimateRowCount() override;
+  base::Status ValidateConstraints(const QueryConstraints&) override;
+  base::Status ComputeTable(const std::vector<Constraint>& cs,
+                            const std::vector<Order>& ob,
+                            const BitVector& cols_used,
+                            std::unique_ptr<Table>& table_return) override;
+
+  // Returns the table, or the table of the view, called |name|. Returns
+  // nullptr if there is no such table.
+  const Table* FindTable(const std::string& name) const;
+
+  // Returns the index in FindTable(|name|) of the column |col| of the table
+  // or view called |name|, if any.
+  base::Optional<uint32_t> FindColumn(const std::string& name,
+                                      const std::string& col) const;
+
+  // Returns whether |col| is a column computed as ts + dur by the view called
+  // |name| (see AddView()).
+  bool IsEndColumn(const std::string& name, const std::string& col) const;
+
+ private:
+  struct Source {
+    const Table* table;
+    // Columns added by a view, see AddView().
+    std::map<std::string, std::string> aliases;
+    std::set<std::string> end_cols;
+  };
+
+  StringPool* pool_ = nullptr;
+  std::map<std::string, Source> tables_;
+  bool tables_finalized_ = false;
+
+  // Indices built so far, keyed by table and partition column (empty if not
+  // partitioned).
+  std::map<std::pair<const Table*, std::string>, IntervalIndex> indices_;
+
+  // Largest dur of each table, only cached once the tables are finalized.
+  std::map<const Table*, base::Optional<int64_t>> max_durs_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DYNAMIC_INTERVALS_OVERLAPPING_GENERATOR_H_
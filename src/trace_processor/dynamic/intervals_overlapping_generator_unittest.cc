@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/intervals_overlapping_generator.h"
+
+#include "src/trace_processor/tables/macros.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using testing::ElementsAre;
+using testing::IsEmpty;
+
+#define PERFETTO_TP_TEST_INTERVAL_TABLE_DEF(NAME, PARENT, C) \
+  NAME(TestIntervalTable, "interval")                        \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                          \
+  C(int64_t, ts)                                             \
+  C(int64_t, dur)                                            \
+  C(int64_t, track)
+PERFETTO_TP_TABLE(PERFETTO_TP_TEST_INTERVAL_TABLE_DEF);
+
+TestIntervalTable::~TestIntervalTable() = default;
+
+class IntervalsOverlappingGeneratorTest : public ::testing::Test {
+ protected:
+  IntervalsOverlappingGeneratorTest()
+      : table_(&pool_, nullptr), generator_(&pool_) {
+    // Row 0 contains rows 1 and 2; row 3 is on a different track.
+    table_.Insert(TestIntervalTable::Row(0, 100, 1));
+    table_.Insert(TestIntervalTable::Row(10, 10, 1));
+    table_.Insert(TestIntervalTable::Row(50, 10, 1));
+    table_.Insert(TestIntervalTable::Row(20, 10, 2));
+    table_.Insert(TestIntervalTable::Row(200, 5, 1));
+    generator_.AddTable("interval", &table_);
+  }
+
+  // Returns the index of the column called |name| in the output table.
+  uint32_t ColumnIndex(const char* name) {
+    Table::Schema schema = generator_.CreateSchema();
+    for (uint32_t i = 0; i < schema.columns.size(); ++i) {
+      if (schema.columns[i].name == name)
+        return i;
+    }
+    PERFETTO_FATAL("Unknown column %s", name);
+  }
+
+  // Returns the ids of the rows of |table_name| overlapping [start, end),
+  // only in |partition| of |partition_col| if set.
+  std::vector<int64_t> Overlapping(const char* table_name,
+                                   int64_t start,
+                                   int64_t end,
+                                   const char* partition_col = nullptr,
+                                   base::Optional<int64_t> partition = {}) {
+    std::vector<Constraint> cs{
+        {ColumnIndex("source_table"), FilterOp::kEq,
+         SqlValue::String(table_name)},
+        {ColumnIndex("start_ts"), FilterOp::kEq, SqlValue::Long(start)},
+        {ColumnIndex("end_ts"), FilterOp::kEq, SqlValue::Long(end)},
+    };
+    if (partition_col) {
+      cs.push_back({ColumnIndex("partition_column"), FilterOp::kEq,
+                    SqlValue::String(partition_col)});
+    }
+    if (partition) {
+      cs.push_back({ColumnIndex("partition_value"), FilterOp::kEq,
+                    SqlValue::Long(*partition)});
+    }
+    std::unique_ptr<Table> out;
+    base::Status status = generator_.ComputeTable(cs, {}, BitVector(), out);
+    EXPECT_TRUE(status.ok()) << status.message();
+    std::vector<int64_t> ids;
+    if (!out)
+      return ids;
+    const Column& id = *out->GetColumnByName("interval_id");
+    for (uint32_t i = 0; i < out->row_count(); ++i)
+      ids.push_back(id.Get(i).AsLong());
+    return ids;
+  }
+
+  base::Optional<int64_t> MaxDur() {
+    base::Optional<int64_t> max_dur;
+    EXPECT_TRUE(generator_.GetMaxDur("interval", &max_dur).ok());
+    return max_dur;
+  }
+
+  StringPool pool_;
+  TestIntervalTable table_;
+  IntervalsOverlappingGenerator generator_;
+};
+
+TEST_F(IntervalsOverlappingGeneratorTest, Overlapping) {
+  // Sorted by ts.
+  ASSERT_THAT(Overlapping("interval", 25, 55), ElementsAre(0, 3, 2));
+  ASSERT_THAT(Overlapping("interval", 100, 200), IsEmpty());
+  ASSERT_THAT(Overlapping("interval", 100, 201), ElementsAre(4));
+}
+
+TEST_F(IntervalsOverlappingGeneratorTest, Partitioned) {
+  // Sorted by partition and then by ts.
+  ASSERT_THAT(Overlapping("interval", 0, 300, "track"),
+              ElementsAre(0, 1, 2, 4, 3));
+  ASSERT_THAT(Overlapping("interval", 25, 55, "track", 1), ElementsAre(0, 2));
+  ASSERT_THAT(Overlapping("interval", 25, 55, "track", 2), ElementsAre(3));
+  ASSERT_THAT(Overlapping("interval", 25, 55, "track", 3), IsEmpty());
+}
+
+TEST_F(IntervalsOverlappingGeneratorTest, View) {
+  generator_.AddView("interval_view", &table_, {{"interval_track", "track"}});
+  ASSERT_EQ(generator_.FindTable("interval_view"), &table_);
+  ASSERT_EQ(generator_.FindColumn("interval_view", "interval_track"),
+            generator_.FindColumn("interval", "track"));
+  ASSERT_EQ(generator_.FindColumn("interval_view", "ts"),
+            generator_.FindColumn("interval", "ts"));
+  ASSERT_EQ(generator_.FindColumn("interval_view", "foo"), base::nullopt);
+  ASSERT_EQ(generator_.FindColumn("interval", "interval_track"),
+            base::nullopt);
+
+  ASSERT_THAT(Overlapping("interval_view", 25, 55, "interval_track", 1),
+              ElementsAre(0, 2));
+  ASSERT_THAT(Overlapping("interval_view", 25, 55, "track", 2),
+              ElementsAre(3));
+}
+
+TEST_F(IntervalsOverlappingGeneratorTest, Errors) {
+  std::vector<Constraint> cs{
+      {ColumnIndex("source_table"), FilterOp::kEq, SqlValue::String("foo")},
+      {ColumnIndex("start_ts"), FilterOp::kEq, SqlValue::Long(0)},
+      {ColumnIndex("end_ts"), FilterOp::kEq, SqlValue::Long(10)},
+  };
+  std::unique_ptr<Table> out;
+  ASSERT_FALSE(generator_.ComputeTable(cs, {}, BitVector(), out).ok());
+  ASSERT_EQ(generator_.FindTable("internal_interval"), nullptr);
+
+  const IntervalIndex* index = nullptr;
+  ASSERT_FALSE(
+      generator_.GetIndex("interval", std::string("foo"), &index).ok());
+  base::Optional<int64_t> max_dur;
+  ASSERT_FALSE(generator_.GetMaxDur("foo", &max_dur).ok());
+}
+
+TEST_F(IntervalsOverlappingGeneratorTest, MaxDur) {
+  ASSERT_EQ(MaxDur(), 100);
+
+  StringPool pool;
+  TestIntervalTable empty(&pool, nullptr);
+  generator_.AddTable("empty", &empty);
+  base::Optional<int64_t> max_dur = 0;
+  ASSERT_TRUE(generator_.GetMaxDur("empty", &max_dur).ok());
+  ASSERT_EQ(max_dur, base::nullopt);
+}
+
+TEST_F(IntervalsOverlappingGeneratorTest, SeesUpdatesUntilFinalized) {
+  ASSERT_THAT(Overlapping("interval", 150, 160), IsEmpty());
+  ASSERT_EQ(MaxDur(), 100);
+
+  // Rows are updated in place while the trace is parsed, e.g. when a slice
+  // ends, without changing the row count.
+  table_.mutable_dur()->Set(0, 1000);
+  ASSERT_THAT(Overlapping("interval", 150, 160), ElementsAre(0));
+  ASSERT_EQ(MaxDur(), 1000);
+
+  table_.Insert(TestIntervalTable::Row(150, 2000, 2));
+  ASSERT_THAT(Overlapping("interval", 150, 160), ElementsAre(0, 5));
+  ASSERT_EQ(MaxDur(), 2000);
+}
+
+TEST_F(IntervalsOverlappingGeneratorTest, CachesOnceFinalized) {
+  generator_.OnTablesFinalized();
+  ASSERT_THAT(Overlapping("interval", 150, 160), IsEmpty());
+  ASSERT_EQ(MaxDur(), 100);
+
+  const IntervalIndex* index = nullptr;
+  ASSERT_TRUE(generator_.GetIndex("interval", base::nullopt, &index).ok());
+
+  // The tables are not expected to change anymore: the cached index and
+  // max dur are used.
+  table_.mutable_dur()->Set(0, 1000);
+  const IntervalIndex* cached = nullptr;
+  ASSERT_TRUE(generator_.GetIndex("interval", base::nullopt, &cached).ok());
+  ASSERT_EQ(cached, index);
+  ASSERT_THAT(Overlapping("interval", 150, 160), IsEmpty());
+  ASSERT_EQ(MaxDur(), 100);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -22,6 +22,8 @@
 #include "src/trace_processor/importers/ninja/ninja_log_parser.h"
 #include "src/trace_processor/importers/proto/proto_trace_parser.h"
 #include "src/trace_processor/importers/proto/proto_trace_reader.h"
+#include "src/trace_processor/importers/snapshot/snapshot_trace_reader.h"
+#include "src/trace_processor/storage/trace_storage_snapshot.h"
 #include "src/trace_processor/trace_sorter.h"
 
 namespace perfetto {
@@ -148,6 +150,10 @@ util::Status ForwardingTraceParser::Parse(TraceBlobView blob) {
         }
         return util::ErrStatus("Android Bugreport support is disabled. %s",
                                kNoZlibErr);
+      case kSnapshotTraceType:
+        PERFETTO_DLOG("Trace processor snapshot detected");
+        reader_.reset(new SnapshotTraceReader(context_));
+        break;
       case kUnknownTraceType:
         // If renaming this error message don't remove the "(ERR:fmt)" part.
         // The UI's error_dialog.ts uses it to make the dialog more graceful.
@@ -165,6 +171,8 @@ void ForwardingTraceParser::NotifyEndOfFile() {
 TraceType GuessTraceType(const uint8_t* data, size_t size) {
   if (size == 0)
     return kUnknownTraceType;
+  if (TraceStorageSnapshot::IsSnapshot(data, size))
+    return kSnapshotTraceType;
   std::string start(reinterpret_cast<const char*>(data),
                     std::min<size_t>(size, kGuessTraceMaxLookahead));
   if (size >= 8) {
@@ -30,13 +30,14 @@ struct SystraceLine;
 struct InlineSchedWaking;
 struct TracePacketData;
 struct TrackEventData;
+class TraceBlobView;
 
 class TraceParser {
  public:
   virtual ~TraceParser();
 
   virtual void ParseTracePacket(int64_t, TracePacketData);
-  virtual void ParseJsonPacket(int64_t, std::string);
+  virtual void ParseJsonPacket(int64_t, TraceBlobView);
   virtual void ParseFuchsiaRecord(int64_t, FuchsiaRecord);
   virtual void ParseTrackEvent(int64_t, TrackEventData);
   virtual void ParseSystraceLine(int64_t, SystraceLine);
@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/importers/ftrace/ftrace_tokenizer.h"
 
+#include <algorithm>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/protozero/proto_decoder.h"
 #include "perfetto/protozero/proto_utils.h"
@@ -31,11 +33,13 @@ namespace perfetto {
 namespace trace_processor {
 
 using protozero::ProtoDecoder;
+using protozero::proto_utils::MakeTagLengthDelimited;
 using protozero::proto_utils::MakeTagVarInt;
 using protozero::proto_utils::ParseVarInt;
 
 using protos::pbzero::BuiltinClock;
 using protos::pbzero::FtraceClock;
+using protos::pbzero::FtraceEvent;
 using protos::pbzero::FtraceEventBundle;
 
 namespace {
@@ -52,6 +56,98 @@ PERFETTO_ALWAYS_INLINE base::Optional<int64_t> ResolveTraceTime(
   return context->clock_tracker->ToTraceTime(clock_id, ts);
 }
 
+void AppendVarInt(uint64_t value, std::vector<uint8_t>* out) {
+  uint8_t buf[protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+  uint8_t* end = protozero::proto_utils::WriteVarInt(value, buf);
+  out->insert(out->end(), buf, end);
+}
+
+void AppendBytesField(uint32_t field_id,
+                      const uint8_t* data,
+                      size_t size,
+                      std::vector<uint8_t>* out) {
+  AppendVarInt(MakeTagLengthDelimited(field_id), out);
+  AppendVarInt(size, out);
+  out->insert(out->end(), data, data + size);
+}
+
+// A column of a FtraceEventBundle.CompactEvents batch.
+struct CompactEventsColumn {
+  using ValuesIterator = protozero::PackedRepeatedFieldIterator<
+      protozero::proto_utils::ProtoWireType::kVarInt,
+      uint64_t>;
+  using Column = FtraceEventBundle::CompactEvents::Column;
+  using ColumnDecoder = Column::Decoder;
+
+  enum class Type { kUint, kInt, kString };
+
+  CompactEventsColumn(const ColumnDecoder& column,
+                      Type _type,
+                      protozero::ConstBytes values,
+                      bool* parse_error)
+      : field_id(column.field_id()),
+        type(_type),
+        it(values.data, values.size, parse_error) {}
+
+  static CompactEventsColumn Create(protozero::ConstBytes bytes,
+                                    bool* parse_error) {
+    ColumnDecoder column(bytes);
+    if (column.has_int_values()) {
+      return CompactEventsColumn(
+          column, Type::kInt,
+          column.at<Column::kIntValuesFieldNumber>().as_bytes(), parse_error);
+    }
+    if (column.has_string_indexes()) {
+      return CompactEventsColumn(
+          column, Type::kString,
+          column.at<Column::kStringIndexesFieldNumber>().as_bytes(),
+          parse_error);
+    }
+    return CompactEventsColumn(
+        column, Type::kUint,
+        column.at<Column::kUintValuesFieldNumber>().as_bytes(), parse_error);
+  }
+
+  // Appends the value of the current event to |out| as it's encoded in the
+  // FtraceEvent proto and moves to the next event.
+  bool AppendField(const std::vector<protozero::ConstChars>& string_table,
+                   std::vector<uint8_t>* out) {
+    if (!it || field_id == 0)
+      return false;
+    uint64_t value = *it;
+    ++it;
+    switch (type) {
+      case Type::kUint:
+        AppendVarInt(MakeTagVarInt(field_id), out);
+        AppendVarInt(value, out);
+        return true;
+      case Type::kInt:
+        // Negative values are sign extended, as protozero::Message does.
+        AppendVarInt(MakeTagVarInt(field_id), out);
+        AppendVarInt(static_cast<uint64_t>(
+                         protozero::proto_utils::ZigZagDecode(value)),
+                     out);
+        return true;
+      case Type::kString: {
+        // Index 0 means that the field isn't set.
+        if (value == 0)
+          return true;
+        if (value > string_table.size())
+          return false;
+        const protozero::ConstChars& str = string_table[value - 1];
+        AppendBytesField(field_id, reinterpret_cast<const uint8_t*>(str.data),
+                         str.size, out);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  uint32_t field_id;
+  Type type;
+  ValuesIterator it;
+};
+
 }  // namespace
 
 PERFETTO_ALWAYS_INLINE
@@ -103,6 +199,11 @@ base::Status FtraceTokenizer::TokenizeFtraceBundle(
     TokenizeFtraceCompactSched(cpu, clock_id, decoder.compact_sched());
   }
 
+  if (decoder.has_compact_events()) {
+    TokenizeFtraceCompactEvents(cpu, clock_id, decoder.compact_events(),
+                                state);
+  }
+
   for (auto it = decoder.event(); it; ++it) {
     TokenizeFtraceEvent(cpu, clock_id, bundle.slice(it->data(), it->size()),
                         state);
@@ -269,6 +370,106 @@ void FtraceTokenizer::TokenizeFtraceCompactSchedWaking(
     context_->storage->IncrementStats(stats::compact_sched_has_parse_errors);
 }
 
+void FtraceTokenizer::TokenizeFtraceCompactEvents(
+    uint32_t cpu,
+    ClockTracker::ClockId clock_id,
+    protozero::ConstBytes packet,
+    PacketSequenceState* state) {
+  FtraceEventBundle::CompactEvents::Decoder compact_events(packet);
+
+  std::vector<protozero::ConstChars> string_table;
+  for (auto it = compact_events.intern_table(); it; ++it)
+    string_table.push_back(*it);
+
+  for (auto it = compact_events.batch(); it; ++it) {
+    if (!TokenizeFtraceCompactEventsBatch(cpu, clock_id, *it, string_table,
+                                          state)) {
+      context_->storage->IncrementStats(stats::compact_events_has_parse_errors);
+    }
+  }
+}
+
+// Re-encodes the events of the batch as FtraceEvent protos, so that they go
+// through the sorter and FtraceParser exactly as the non-compact events.
+// All the events share a single TraceBlob.
+bool FtraceTokenizer::TokenizeFtraceCompactEventsBatch(
+    uint32_t cpu,
+    ClockTracker::ClockId clock_id,
+    protozero::ConstBytes batch_bytes,
+    const std::vector<protozero::ConstChars>& string_table,
+    PacketSequenceState* state) {
+  FtraceEventBundle::CompactEvents::Batch::Decoder batch(batch_bytes);
+  if (!batch.has_event_id())
+    return false;
+
+  bool parse_error = false;
+  std::vector<CompactEventsColumn> common_columns;
+  for (auto it = batch.common_field(); it; ++it)
+    common_columns.push_back(CompactEventsColumn::Create(*it, &parse_error));
+  std::vector<CompactEventsColumn> columns;
+  for (auto it = batch.field(); it; ++it)
+    columns.push_back(CompactEventsColumn::Create(*it, &parse_error));
+
+  struct EncodedEvent {
+    int64_t timestamp;
+    size_t offset;
+    size_t size;
+  };
+  std::vector<EncodedEvent> events;
+  std::vector<uint8_t>& buf = compact_events_buf_;
+  std::vector<uint8_t>& nested = compact_events_nested_buf_;
+  buf.clear();
+
+  // Accumulator for timestamp deltas.
+  int64_t timestamp_acc = 0;
+  bool fields_valid = true;
+  for (auto ts_it = batch.timestamp(&parse_error); ts_it; ++ts_it) {
+    timestamp_acc += static_cast<int64_t>(*ts_it);
+
+    size_t offset = buf.size();
+    AppendVarInt(MakeTagVarInt(FtraceEvent::kTimestampFieldNumber), &buf);
+    AppendVarInt(static_cast<uint64_t>(timestamp_acc), &buf);
+    for (CompactEventsColumn& column : common_columns)
+      fields_valid &= column.AppendField(string_table, &buf);
+
+    nested.clear();
+    for (CompactEventsColumn& column : columns)
+      fields_valid &= column.AppendField(string_table, &nested);
+    AppendBytesField(batch.event_id(), nested.data(), nested.size(), &buf);
+
+    if (!fields_valid)
+      break;
+    events.push_back(EncodedEvent{timestamp_acc, offset, buf.size() - offset});
+  }
+
+  // Push the events which were decoded correctly, even if the rest of the
+  // batch is malformed. Events whose timestamp can't be converted to the
+  // trace clock are dropped and the batch is reported as having errors.
+  bool timestamps_valid = true;
+  if (!events.empty()) {
+    TraceBlobView blob(TraceBlob::CopyFrom(buf.data(), buf.size()));
+    for (const EncodedEvent& event : events) {
+      base::Optional<int64_t> timestamp =
+          ResolveTraceTime(context_, clock_id, event.timestamp);
+      if (!timestamp) {
+        timestamps_valid = false;
+        continue;
+      }
+      context_->sorter->PushFtraceEvent(
+          cpu, *timestamp, blob.slice_off(event.offset, event.size), state);
+    }
+  }
+
+  // Check that all packed buffers were decoded correctly, and fully.
+  auto exhausted = [](const CompactEventsColumn& column) {
+    return !column.it;
+  };
+  bool sizes_match =
+      std::all_of(common_columns.begin(), common_columns.end(), exhausted) &&
+      std::all_of(columns.begin(), columns.end(), exhausted);
+  return fields_valid && timestamps_valid && !parse_error && sizes_match;
+}
+
 void FtraceTokenizer::HandleFtraceClockSnapshot(int64_t ftrace_ts,
                                                 int64_t boot_ts,
                                                 uint32_t packet_sequence_id) {
@@ -17,6 +17,8 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_TOKENIZER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_TOKENIZER_H_
 
+#include <vector>
+
 #include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/importers/common/clock_tracker.h"
 #include "src/trace_processor/storage/trace_storage.h"
@@ -56,12 +58,27 @@ class FtraceTokenizer {
       ClockTracker::ClockId,
       const protos::pbzero::FtraceEventBundle::CompactSched::Decoder& compact,
       const std::vector<StringId>& string_table);
+  void TokenizeFtraceCompactEvents(uint32_t cpu,
+                                   ClockTracker::ClockId,
+                                   protozero::ConstBytes,
+                                   PacketSequenceState* state);
+  bool TokenizeFtraceCompactEventsBatch(
+      uint32_t cpu,
+      ClockTracker::ClockId,
+      protozero::ConstBytes batch,
+      const std::vector<protozero::ConstChars>& string_table,
+      PacketSequenceState* state);
 
   void HandleFtraceClockSnapshot(int64_t ftrace_ts,
                                  int64_t boot_ts,
                                  uint32_t packet_sequence_id);
 
   int64_t latest_ftrace_clock_snapshot_ts_ = 0;
+
+  // Scratch buffers used to re-encode the events of a compact_events batch as
+  // FtraceEvent protos.
+  std::vector<uint8_t> compact_events_buf_;
+  std::vector<uint8_t> compact_events_nested_buf_;
   TraceProcessorContext* context_;
 };
 
@@ -17,15 +17,25 @@
 #include "src/trace_processor/importers/gzip/gzip_trace_parser.h"
 
 #include <string>
+#include <utility>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/string_view.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/forwarding_trace_parser.h"
+#include "src/trace_processor/storage/stats.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/trace_processor_context.h"
 #include "src/trace_processor/util/gzip_utils.h"
 #include "src/trace_processor/util/status_macros.h"
 
+#if GZIP_TRACE_PARSER_HAS_THREADS()
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
 namespace perfetto {
 namespace trace_processor {
 
@@ -33,20 +43,260 @@ namespace {
 
 using ResultCode = util::GzipDecompressor::ResultCode;
 
+#if GZIP_TRACE_PARSER_HAS_THREADS()
+// Size of the blobs produced by the decompression thread. This is smaller than
+// the buffer used by the synchronous path so that the first decompressed bytes
+// reach the tokenizer early and stay warm in cache.
+constexpr size_t kWorkerOutputChunkSize = 4 * 1024 * 1024;
+
+// Max number of decompressed chunks the worker can get ahead of the parser.
+constexpr size_t kMaxPendingOutputs = 8;
+
+// Max number of compressed chunks Parse() queues before waiting for the
+// worker to catch up.
+constexpr size_t kMaxInflightInputs = 4;
+#endif
+
 }  // namespace
 
+#if GZIP_TRACE_PARSER_HAS_THREADS()
+// Decompresses the input passed by GzipTraceParser on a dedicated thread.
+// Only raw pointers cross the thread boundary: input chunks are owned by the
+// parser until the worker reports them as consumed, and output buffers are
+// turned into TraceBlob(s) on the parser thread.
+class GzipTraceParser::DecompressionWorker {
+ public:
+  struct Output {
+    std::unique_ptr<uint8_t[]> data;
+    size_t size;
+  };
+
+  struct TakeResult {
+    std::deque<Output> outputs;
+    // Total number of input chunks fully consumed since the beginning.
+    size_t inputs_consumed = 0;
+    util::Status status;
+  };
+
+  DecompressionWorker() : thread_(&DecompressionWorker::Run, this) {}
+
+  ~DecompressionWorker() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  void PushInput(const uint8_t* data, size_t size) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      inputs_.emplace_back(data, size);
+    }
+    cv_.notify_all();
+  }
+
+  // Returns the output decompressed so far. If |wait| is true, first waits
+  // until either some output is available, an input chunk has been consumed
+  // or an error occurred.
+  TakeResult Take(bool wait) {
+    TakeResult res;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (wait) {
+        cv_.wait(lock, [this] {
+          return !outputs_.empty() || inputs_consumed_ != inputs_taken_ ||
+                 !status_.ok();
+        });
+      }
+      res.outputs = std::move(outputs_);
+      outputs_.clear();
+      res.inputs_consumed = inputs_taken_ = inputs_consumed_;
+      res.status = status_;
+    }
+    // Unblock the worker if it was waiting for |outputs_| to drain.
+    cv_.notify_all();
+    return res;
+  }
+
+  // Returns true if the input consumed so far ends in the middle of a gzip
+  // member, i.e. the trace is truncated if no more input follows.
+  bool needs_more_input() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return needs_more_input_;
+  }
+
+ private:
+  void Run() {
+    for (;;) {
+      std::pair<const uint8_t*, size_t> input;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return quit_ || !inputs_.empty(); });
+        if (quit_)
+          return;
+        input = inputs_.front();
+      }
+      bool ok = Decompress(input.first, input.second);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        inputs_.pop_front();
+        inputs_consumed_++;
+        if (!ok && status_.ok())
+          status_ = util::ErrStatus("Failed to decompress trace chunk");
+      }
+      cv_.notify_all();
+    }
+  }
+
+  // Returns false on decompression errors.
+  bool Decompress(const uint8_t* data, size_t size) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      // Once an error has occurred, drain the remaining input without
+      // touching it.
+      if (!status_.ok())
+        return true;
+    }
+    if (size == 0)
+      return true;
+    decompressor_.Feed(data, size);
+    for (;;) {
+      if (!buffer_) {
+        buffer_.reset(new uint8_t[kWorkerOutputChunkSize]);
+        bytes_written_ = 0;
+      }
+      auto result =
+          decompressor_.ExtractOutput(buffer_.get() + bytes_written_,
+                                      kWorkerOutputChunkSize - bytes_written_);
+      if (result.ret == ResultCode::kError)
+        return false;
+      bytes_written_ += result.bytes_written;
+
+      // Flush the output at the end of each input chunk rather than waiting
+      // for the buffer to fill up, to keep the parser busy.
+      bool end_of_input = result.ret == ResultCode::kNeedsMoreInput ||
+                          result.ret == ResultCode::kEof;
+      if (bytes_written_ == kWorkerOutputChunkSize ||
+          (end_of_input && bytes_written_ > 0)) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] {
+          return quit_ || outputs_.size() < kMaxPendingOutputs;
+        });
+        if (quit_)
+          return true;
+        outputs_.push_back(Output{std::move(buffer_), bytes_written_});
+        lock.unlock();
+        cv_.notify_all();
+      }
+      if (end_of_input) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        needs_more_input_ = result.ret == ResultCode::kNeedsMoreInput;
+        return true;
+      }
+    }
+  }
+
+  // Only accessed by the worker thread.
+  util::GzipDecompressor decompressor_;
+  std::unique_ptr<uint8_t[]> buffer_;
+  size_t bytes_written_ = 0;
+
+  // Guarded by |mutex_|.
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::pair<const uint8_t*, size_t>> inputs_;
+  std::deque<Output> outputs_;
+  size_t inputs_consumed_ = 0;
+  size_t inputs_taken_ = 0;
+  util::Status status_;
+  bool needs_more_input_ = false;
+  bool quit_ = false;
+
+  // Must be last: the thread starts running in the constructor.
+  std::thread thread_;
+};
+#endif  // GZIP_TRACE_PARSER_HAS_THREADS()
+
 GzipTraceParser::GzipTraceParser(TraceProcessorContext* context)
     : context_(context) {}
 
 GzipTraceParser::GzipTraceParser(std::unique_ptr<ChunkedTraceReader> reader)
     : context_(nullptr), inner_(std::move(reader)) {}
 
-GzipTraceParser::~GzipTraceParser() = default;
+GzipTraceParser::~GzipTraceParser() {
+#if GZIP_TRACE_PARSER_HAS_THREADS()
+  // Stop the worker before releasing the input it might still be reading.
+  worker_.reset();
+#endif
+}
+
+void GzipTraceParser::MaybeSkipHeader(const uint8_t** start, size_t* len) {
+  if (first_chunk_parsed_)
+    return;
+  first_chunk_parsed_ = true;
+
+  // .ctrace files begin with: "TRACE:\n" or "done. TRACE:\n" strip this if
+  // present.
+  base::StringView beginning(reinterpret_cast<const char*>(*start), *len);
+
+  static const char* kSystraceFileHeader = "TRACE:\n";
+  size_t offset = Find(kSystraceFileHeader, beginning);
+  if (offset != std::string::npos) {
+    *start += strlen(kSystraceFileHeader) + offset;
+    *len -= strlen(kSystraceFileHeader) + offset;
+  }
+}
 
 util::Status GzipTraceParser::Parse(TraceBlobView blob) {
+#if GZIP_TRACE_PARSER_HAS_THREADS()
+  // Once the decompression failed, the rest of the input can't be used.
+  RETURN_IF_ERROR(worker_status_);
+  if (!worker_) {
+    PERFETTO_DCHECK(!first_chunk_parsed_);
+    worker_.reset(new DecompressionWorker());
+  }
+
+  const uint8_t* start = blob.data();
+  size_t len = blob.size();
+  MaybeSkipHeader(&start, &len);
+
+  inflight_inputs_.emplace_back(std::move(blob));
+  worker_->PushInput(start, len);
+  return ForwardDecompressedOutput(kMaxInflightInputs);
+#else
   return ParseUnowned(blob.data(), blob.size());
+#endif
 }
 
+#if GZIP_TRACE_PARSER_HAS_THREADS()
+util::Status GzipTraceParser::ForwardDecompressedOutput(
+    size_t max_inflight_inputs) {
+  for (;;) {
+    bool wait = inflight_inputs_.size() > max_inflight_inputs;
+    DecompressionWorker::TakeResult res = worker_->Take(wait);
+    for (; inputs_released_ < res.inputs_consumed; inputs_released_++)
+      inflight_inputs_.pop_front();
+    for (auto& output : res.outputs) {
+      if (!inner_) {
+        PERFETTO_CHECK(context_);
+        inner_.reset(new ForwardingTraceParser(context_));
+      }
+      TraceBlob out_blob =
+          TraceBlob::TakeOwnership(std::move(output.data), output.size);
+      RETURN_IF_ERROR(inner_->Parse(TraceBlobView(std::move(out_blob))));
+    }
+    if (!res.status.ok()) {
+      worker_status_ = res.status;
+      return worker_status_;
+    }
+    if (inflight_inputs_.size() <= max_inflight_inputs)
+      return util::OkStatus();
+  }
+}
+#endif  // GZIP_TRACE_PARSER_HAS_THREADS()
+
 util::Status GzipTraceParser::ParseUnowned(const uint8_t* data, size_t size) {
   const uint8_t* start = data;
   size_t len = size;
@@ -56,19 +306,7 @@ util::Status GzipTraceParser::ParseUnowned(const uint8_t* data, size_t size) {
     inner_.reset(new ForwardingTraceParser(context_));
   }
 
-  if (!first_chunk_parsed_) {
-    // .ctrace files begin with: "TRACE:\n" or "done. TRACE:\n" strip this if
-    // present.
-    base::StringView beginning(reinterpret_cast<const char*>(start), size);
-
-    static const char* kSystraceFileHeader = "TRACE:\n";
-    size_t offset = Find(kSystraceFileHeader, beginning);
-    if (offset != std::string::npos) {
-      start += strlen(kSystraceFileHeader) + offset;
-      len -= strlen(kSystraceFileHeader) + offset;
-    }
-    first_chunk_parsed_ = true;
-  }
+  MaybeSkipHeader(&start, &len);
 
   // Our default uncompressed buffer size is 32MB as it allows for good
   // throughput.
@@ -107,6 +345,28 @@ util::Status GzipTraceParser::ParseUnowned(const uint8_t* data, size_t size) {
 }
 
 void GzipTraceParser::NotifyEndOfFile() {
+#if GZIP_TRACE_PARSER_HAS_THREADS()
+  if (worker_) {
+    // Wait for the worker to decompress all the input and forward it. The
+    // errors in the last chunks show up only here, when Parse() has already
+    // returned for all the input.
+    util::Status status = ForwardDecompressedOutput(0);
+    // Like ParseUnowned(), a trace which ends in the middle of a gzip member
+    // is an error. The output decompressed so far is kept.
+    if (status.ok() && worker_->needs_more_input()) {
+      worker_status_ = util::ErrStatus("Truncated gzip trace");
+      status = worker_status_;
+    }
+    worker_.reset();
+    inflight_inputs_.clear();
+    if (!status.ok()) {
+      PERFETTO_ELOG("Gzip trace decompression: %s", status.c_message());
+      if (!worker_status_.ok() && context_)
+        context_->storage->IncrementStats(stats::gzip_decompression_errors);
+    }
+  }
+#endif
+
   // TODO(lalitm): this should really be an error returned to the caller but
   // due to historical implementation, NotifyEndOfFile does not return a
   // util::Status.
@@ -17,9 +17,21 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_GZIP_GZIP_TRACE_PARSER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_GZIP_GZIP_TRACE_PARSER_H_
 
+#include <deque>
+#include <memory>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/importers/common/chunked_trace_reader.h"
 #include "src/trace_processor/util/gzip_utils.h"
 
+// WASM (and NaCl) builds of the trace processor are single-threaded.
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WASM) || PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+#define GZIP_TRACE_PARSER_HAS_THREADS() 0
+#else
+#define GZIP_TRACE_PARSER_HAS_THREADS() 1
+#endif
+
 namespace perfetto {
 namespace trace_processor {
 
@@ -32,14 +44,36 @@ class GzipTraceParser : public ChunkedTraceReader {
   ~GzipTraceParser() override;
 
   // ChunkedTraceReader implementation
+  // Where threads are available, Parse() hands the compressed data over to a
+  // background thread and forwards the decompressed output to the inner
+  // reader as it becomes available. Decompression of the next chunk is then
+  // pipelined with the tokenization and parsing of the previous one.
+  // Decompression errors are returned by the first Parse() call after the
+  // worker hit them. The ones found while draining the last chunks in
+  // NotifyEndOfFile(), as well as a trace ending in the middle of a gzip
+  // member, are recorded in the gzip_decompression_errors stat.
   util::Status Parse(TraceBlobView) override;
   void NotifyEndOfFile() override;
 
+  // Decompresses synchronously on the calling thread. The data is not
+  // retained after this call returns. Must not be mixed with Parse().
   util::Status ParseUnowned(const uint8_t*, size_t);
 
   bool needs_more_input() const { return needs_more_input_; }
 
  private:
+  class DecompressionWorker;
+
+  // Strips the systrace "TRACE:" header, if present, from the first chunk.
+  void MaybeSkipHeader(const uint8_t** start, size_t* len);
+
+#if GZIP_TRACE_PARSER_HAS_THREADS()
+  // Passes any output decompressed so far by |worker_| to |inner_| and
+  // releases the input chunks the worker is done with. Blocks until no more
+  // than |max_inflight_inputs| input chunks are pending in the worker.
+  util::Status ForwardDecompressedOutput(size_t max_inflight_inputs);
+#endif
+
   TraceProcessorContext* const context_;
   util::GzipDecompressor decompressor_;
   std::unique_ptr<ChunkedTraceReader> inner_;
@@ -49,6 +83,20 @@ class GzipTraceParser : public ChunkedTraceReader {
 
   bool first_chunk_parsed_ = false;
   bool needs_more_input_ = false;
+
+#if GZIP_TRACE_PARSER_HAS_THREADS()
+  std::unique_ptr<DecompressionWorker> worker_;
+
+  // Compressed chunks handed over to |worker_| and not yet fully consumed by
+  // it. They are kept alive here because the refcounting of TraceBlob is not
+  // thread-safe, so only raw pointers are passed to the worker.
+  std::deque<TraceBlobView> inflight_inputs_;
+  size_t inputs_released_ = 0;
+
+  // Set once the worker failed to decompress the input. Parse() keeps
+  // returning it from then on.
+  util::Status worker_status_;
+#endif
 };
 
 }  // namespace trace_processor
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/gzip/gzip_trace_parser.h"
+
+#include <zlib.h>
+
+#include <string>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/trace_processor/trace_blob.h"
+#include "perfetto/trace_processor/trace_blob_view.h"
+#include "src/trace_processor/storage/stats.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+class CollectingReader : public ChunkedTraceReader {
+ public:
+  explicit CollectingReader(std::string* out) : out_(out) {}
+
+  util::Status Parse(TraceBlobView blob) override {
+    out_->append(reinterpret_cast<const char*>(blob.data()), blob.size());
+    return util::OkStatus();
+  }
+  void NotifyEndOfFile() override { eof_ = true; }
+
+  bool eof() const { return eof_; }
+
+ private:
+  std::string* out_;
+  bool eof_ = false;
+};
+
+std::string GzipCompress(const std::string& input) {
+  z_stream stream{};
+  deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8,
+               Z_DEFAULT_STRATEGY);
+  std::string output(deflateBound(&stream, uLong(input.size())), '\0');
+  stream.next_in =
+      const_cast<Bytef*>(reinterpret_cast<const Bytef*>(input.data()));
+  stream.avail_in = uInt(input.size());
+  stream.next_out = reinterpret_cast<Bytef*>(&output[0]);
+  stream.avail_out = uInt(output.size());
+  PERFETTO_CHECK(deflate(&stream, Z_FINISH) == Z_STREAM_END);
+  output.resize(output.size() - stream.avail_out);
+  deflateEnd(&stream);
+  return output;
+}
+
+std::string MakePayload(size_t size) {
+  std::string payload;
+  for (uint32_t i = 0; payload.size() < size; i++)
+    payload += std::to_string(i * 2654435761u) + ",";
+  payload.resize(size);
+  return payload;
+}
+
+// Feeds |compressed| to a GzipTraceParser in chunks of |chunk_size| bytes and
+// returns the decompressed output seen by the inner reader.
+std::string ParseInChunks(const std::string& compressed, size_t chunk_size) {
+  std::string out;
+  auto* reader = new CollectingReader(&out);
+  GzipTraceParser parser((std::unique_ptr<ChunkedTraceReader>(reader)));
+  for (size_t off = 0; off < compressed.size(); off += chunk_size) {
+    size_t size = std::min(chunk_size, compressed.size() - off);
+    TraceBlob blob = TraceBlob::CopyFrom(compressed.data() + off, size);
+    EXPECT_TRUE(parser.Parse(TraceBlobView(std::move(blob))).ok());
+  }
+  parser.NotifyEndOfFile();
+  EXPECT_TRUE(reader->eof());
+  return out;
+}
+
+TEST(GzipTraceParserTest, SingleChunk) {
+  std::string payload = MakePayload(64 * 1024);
+  EXPECT_EQ(ParseInChunks(GzipCompress(payload), 1024 * 1024), payload);
+}
+
+TEST(GzipTraceParserTest, ManySmallChunks) {
+  // Larger than the decompression buffers, so that the output is split too.
+  std::string payload = MakePayload(10 * 1024 * 1024);
+  EXPECT_EQ(ParseInChunks(GzipCompress(payload), 4096), payload);
+}
+
+TEST(GzipTraceParserTest, MultiMember) {
+  std::string first = MakePayload(100 * 1024);
+  std::string second = MakePayload(3000);
+  std::string compressed = GzipCompress(first) + GzipCompress(second);
+  EXPECT_EQ(ParseInChunks(compressed, 1000), first + second);
+  EXPECT_EQ(ParseInChunks(compressed, compressed.size()), first + second);
+}
+
+TEST(GzipTraceParserTest, SystraceHeaderIsSkipped) {
+  std::string payload = MakePayload(1000);
+  std::string compressed = "TRACE:\n" + GzipCompress(payload);
+  EXPECT_EQ(ParseInChunks(compressed, 100), payload);
+}
+
+TEST(GzipTraceParserTest, CorruptedInput) {
+  std::string compressed = GzipCompress(MakePayload(256 * 1024));
+  for (size_t i = 64; i < compressed.size(); i += 7)
+    compressed[i] = static_cast<char>(compressed[i] ^ 0x5a);
+
+  std::string out;
+  GzipTraceParser parser(
+      std::unique_ptr<ChunkedTraceReader>(new CollectingReader(&out)));
+  size_t num_chunks = 0;
+  size_t first_failed_chunk = 0;
+  for (size_t off = 0; off < compressed.size(); off += 1024) {
+    size_t size = std::min<size_t>(1024, compressed.size() - off);
+    TraceBlob blob = TraceBlob::CopyFrom(compressed.data() + off, size);
+    util::Status status = parser.Parse(TraceBlobView(std::move(blob)));
+    num_chunks++;
+    if (!status.ok() && first_failed_chunk == 0)
+      first_failed_chunk = num_chunks;
+    // Once an error is returned, all the next calls fail too.
+    EXPECT_TRUE(first_failed_chunk == 0 || !status.ok());
+  }
+  // The input is much longer than what Parse() queues up before waiting for
+  // the decompression, so the error must be returned by Parse().
+  ASSERT_GT(num_chunks, 10u);
+  EXPECT_NE(first_failed_chunk, 0u);
+  EXPECT_LT(out.size(), 256u * 1024);
+}
+
+TEST(GzipTraceParserTest, CorruptedLastChunkIsRecordedInStats) {
+  std::string compressed = GzipCompress(MakePayload(1000));
+  compressed[0] = 'x';
+
+  TraceProcessorContext context;
+  context.storage.reset(new TraceStorage());
+  GzipTraceParser parser(&context);
+  TraceBlob blob = TraceBlob::CopyFrom(compressed.data(), compressed.size());
+  // Depending on whether the worker got to the input already, the error is
+  // returned here or found when draining the input at the end of file. Like
+  // TraceProcessorStorageImpl, don't notify the end of file after an error.
+  if (!parser.Parse(TraceBlobView(std::move(blob))).ok())
+    return;
+  parser.NotifyEndOfFile();
+  EXPECT_EQ(
+      context.storage->stats()[stats::gzip_decompression_errors].value, 1);
+}
+
+TEST(GzipTraceParserTest, TruncatedInputIsRecordedInStats) {
+  // Cut within the gzip header, so that no output reaches the inner reader.
+  std::string compressed = GzipCompress(MakePayload(1000)).substr(0, 8);
+
+  TraceProcessorContext context;
+  context.storage.reset(new TraceStorage());
+  GzipTraceParser parser(&context);
+  TraceBlob blob = TraceBlob::CopyFrom(compressed.data(), compressed.size());
+  ASSERT_TRUE(parser.Parse(TraceBlobView(std::move(blob))).ok());
+  parser.NotifyEndOfFile();
+  EXPECT_EQ(
+      context.storage->stats()[stats::gzip_decompression_errors].value, 1);
+}
+
+TEST(GzipTraceParserTest, TruncatedInputKeepsDecompressedOutput) {
+  std::string payload = MakePayload(100 * 1024);
+  std::string compressed = GzipCompress(payload);
+  compressed.resize(compressed.size() / 2);
+
+  std::string out = ParseInChunks(compressed, 1024);
+  EXPECT_GT(out.size(), 0u);
+  EXPECT_LT(out.size(), payload.size());
+  EXPECT_EQ(out, payload.substr(0, out.size()));
+}
+
+TEST(GzipTraceParserTest, ParseUnowned) {
+  std::string payload = MakePayload(100 * 1024);
+  std::string compressed = GzipCompress(payload);
+  std::string out;
+  GzipTraceParser parser(
+      std::unique_ptr<ChunkedTraceReader>(new CollectingReader(&out)));
+  ASSERT_TRUE(parser
+                  .ParseUnowned(
+                      reinterpret_cast<const uint8_t*>(compressed.data()),
+                      compressed.size())
+                  .ok());
+  EXPECT_FALSE(parser.needs_more_input());
+  parser.NotifyEndOfFile();
+  EXPECT_EQ(out, payload);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -40,25 +40,62 @@ namespace trace_processor {
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
 namespace {
 
-base::Optional<uint64_t> MaybeExtractFlowIdentifier(const Json::Value& value,
-                                                    bool version2) {
-  std::string id_key = (version2 ? "bind_id" : "id");
-  if (!value.isMember(id_key))
+base::StringView GetRawValue(const JsonEventValues& values, JsonEventKey key) {
+  return values[static_cast<size_t>(key)];
+}
+
+// Like Json::Value::asBool().
+bool CoerceRawValueToBool(base::StringView raw_value) {
+  if (raw_value == "true")
+    return true;
+  if (raw_value.empty() || raw_value == "false" || raw_value == "null")
+    return false;
+  base::Optional<double> number = base::StringToDouble(raw_value.ToStdString());
+  return number && *number != 0;
+}
+
+// Like Json::Value::asString(): absent values are empty and numbers are
+// converted to strings.
+std::string CoerceRawValueToString(base::StringView raw_value) {
+  if (raw_value.empty())
+    return std::string();
+  std::string storage;
+  base::Optional<base::StringView> str =
+      json::DecodeRawString(raw_value, &storage);
+  if (str)
+    return str->ToStdString();
+  base::Optional<Json::Value> value = json::ParseJsonString(raw_value);
+  if (!value || value->isObject() || value->isArray())
+    return std::string();
+  return value->asString();
+}
+
+base::Optional<uint64_t> MaybeExtractFlowIdentifier(
+    const JsonEventValues& values,
+    bool version2) {
+  base::StringView raw_id = GetRawValue(
+      values, version2 ? JsonEventKey::kBindId : JsonEventKey::kId);
+  if (raw_id.empty())
     return base::nullopt;
-  auto id = value[id_key];
-  if (id.isNumeric())
-    return id.asUInt64();
-  if (!id.isString())
+  std::string storage;
+  base::Optional<base::StringView> str =
+      json::DecodeRawString(raw_id, &storage);
+  if (str)
+    return base::StringToUInt64(str->ToStdString(), 16);
+  base::Optional<Json::Value> id = json::ParseJsonString(raw_id);
+  if (!id || !id->isNumeric())
     return base::nullopt;
-  const char* c_string = id.asCString();
-  return base::CStringToUInt64(c_string, 16);
+  return id->asUInt64();
 }
 
 }  // namespace
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
 
 JsonTraceParser::JsonTraceParser(TraceProcessorContext* context)
-    : context_(context), systrace_line_parser_(context) {}
+    : context_(context),
+      systrace_line_parser_(context),
+      json_reader_(json::IsJsonSupported() ? json::CreateJsonReader()
+                                           : nullptr) {}
 
 JsonTraceParser::~JsonTraceParser() = default;
 
@@ -67,57 +104,73 @@ void JsonTraceParser::ParseSystraceLine(int64_t, SystraceLine line) {
 }
 
 void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
-                                      std::string string_value) {
+                                      TraceBlobView json_value) {
   PERFETTO_DCHECK(json::IsJsonSupported());
 
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
-  auto opt_value = json::ParseJsonString(base::StringView(string_value));
-  if (!opt_value) {
+  // Only the top level of the event is scanned, in place. The values are then
+  // decoded on demand: jsoncpp is only used for "args" and for the rare
+  // values which need it, e.g. strings with escape sequences.
+  JsonEventValues values;
+  base::Status status = ReadJsonEventValues(
+      base::StringView(reinterpret_cast<const char*>(json_value.data()),
+                       json_value.size()),
+      &values);
+  if (!status.ok()) {
     context_->storage->IncrementStats(stats::json_parser_failure);
     return;
   }
+  auto raw_value = [&values](JsonEventKey key) {
+    return GetRawValue(values, key);
+  };
 
   ProcessTracker* procs = context_->process_tracker.get();
   TraceStorage* storage = context_->storage.get();
   SliceTracker* slice_tracker = context_->slice_tracker.get();
   FlowTracker* flow_tracker = context_->flow_tracker.get();
 
-  const Json::Value& value = *opt_value;
-  auto& ph = value["ph"];
-  if (!ph.isString())
+  std::string ph_storage;
+  base::Optional<base::StringView> ph =
+      json::DecodeRawString(raw_value(JsonEventKey::kPh), &ph_storage);
+  if (!ph)
     return;
-  char phase = *ph.asCString();
+  char phase = ph->empty() ? '\0' : ph->at(0);
 
-  base::Optional<uint32_t> opt_pid;
-  base::Optional<uint32_t> opt_tid;
-
-  if (value.isMember("pid"))
-    opt_pid = json::CoerceToUint32(value["pid"]);
-  if (value.isMember("tid"))
-    opt_tid = json::CoerceToUint32(value["tid"]);
+  base::Optional<uint32_t> opt_pid =
+      json::CoerceRawValueToUint32(raw_value(JsonEventKey::kPid));
+  base::Optional<uint32_t> opt_tid =
+      json::CoerceRawValueToUint32(raw_value(JsonEventKey::kTid));
 
   uint32_t pid = opt_pid.value_or(0);
   uint32_t tid = opt_tid.value_or(pid);
   UniqueTid utid = procs->UpdateThread(tid, pid);
 
-  std::string id = value.isMember("id") ? value["id"].asString() : "";
+  std::string id = CoerceRawValueToString(raw_value(JsonEventKey::kId));
 
-  base::StringView cat = value.isMember("cat")
-                             ? base::StringView(value["cat"].asCString())
-                             : base::StringView();
+  std::string cat_storage;
+  base::StringView cat =
+      json::DecodeRawString(raw_value(JsonEventKey::kCat), &cat_storage)
+          .value_or(base::StringView());
   StringId cat_id = storage->InternString(cat);
 
-  base::StringView name = value.isMember("name")
-                              ? base::StringView(value["name"].asCString())
-                              : base::StringView();
+  std::string name_storage;
+  base::StringView name =
+      json::DecodeRawString(raw_value(JsonEventKey::kName), &name_storage)
+          .value_or(base::StringView());
   StringId name_id = name.empty() ? kNullStringId : storage->InternString(name);
 
-  auto args_inserter = [this, &value](ArgsTracker::BoundInserter* inserter) {
-    if (value.isMember("args")) {
-      json::AddJsonValueToArgs(value["args"], /* flat_key = */ "args",
-                               /* key = */ "args", context_->storage.get(),
-                               inserter);
+  base::StringView raw_args = raw_value(JsonEventKey::kArgs);
+  auto args_inserter = [this, raw_args](ArgsTracker::BoundInserter* inserter) {
+    if (raw_args.empty())
+      return;
+    base::Optional<Json::Value> args = ParseArgs(raw_args);
+    if (!args) {
+      context_->storage->IncrementStats(stats::json_parser_failure);
+      return;
     }
+    json::AddJsonValueToArgs(*args, /* flat_key = */ "args",
+                             /* key = */ "args", context_->storage.get(),
+                             inserter);
   };
 
   // Only used for 'B', 'E', and 'X' events so wrap in lambda so it gets
@@ -129,9 +182,9 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
     row.track_id = track_id;
     row.category = cat_id;
     row.name = name_id;
-    row.thread_ts = json::CoerceToTs(value["tts"]);
+    row.thread_ts = json::CoerceRawValueToTs(raw_value(JsonEventKey::kTts));
     // tdur will only exist on 'X' events.
-    row.thread_dur = json::CoerceToTs(value["tdur"]);
+    row.thread_dur = json::CoerceRawValueToTs(raw_value(JsonEventKey::kTdur));
     // JSON traces don't report these counters as part of slices.
     row.thread_instruction_count = base::nullopt;
     row.thread_instruction_delta = base::nullopt;
@@ -143,7 +196,7 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
       TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
       slice_tracker->BeginTyped(storage->mutable_slice_table(),
                                 make_slice_row(track_id), args_inserter);
-      MaybeAddFlow(track_id, value);
+      MaybeAddFlow(track_id, values);
       break;
     }
     case 'E': {  // TRACE_EVENT_END.
@@ -151,7 +204,7 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
       auto opt_slice_id = slice_tracker->End(timestamp, track_id, cat_id,
                                              name_id, args_inserter);
       // Now try to update thread_dur if we have a tts field.
-      auto opt_tts = json::CoerceToTs(value["tts"]);
+      auto opt_tts = json::CoerceRawValueToTs(raw_value(JsonEventKey::kTts));
       if (opt_slice_id.has_value() && opt_tts) {
         auto* slice = storage->mutable_slice_table();
         auto maybe_row = slice->id().IndexOf(*opt_slice_id);
@@ -179,7 +232,7 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
       if (phase == 'b') {
         slice_tracker->BeginTyped(storage->mutable_slice_table(),
                                   make_slice_row(track_id), args_inserter);
-        MaybeAddFlow(track_id, value);
+        MaybeAddFlow(track_id, values);
       } else if (phase == 'e') {
         slice_tracker->End(timestamp, track_id, cat_id, name_id, args_inserter);
         // We don't handle tts here as we do in the 'E'
@@ -187,12 +240,13 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
       } else {
         context_->slice_tracker->Scoped(timestamp, track_id, cat_id, name_id,
                                         0);
-        MaybeAddFlow(track_id, value);
+        MaybeAddFlow(track_id, values);
       }
       break;
     }
     case 'X': {  // TRACE_EVENT (scoped event).
-      base::Optional<int64_t> opt_dur = json::CoerceToTs(value["dur"]);
+      base::Optional<int64_t> opt_dur =
+          json::CoerceRawValueToTs(raw_value(JsonEventKey::kDur));
       if (!opt_dur.has_value())
         return;
       TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
@@ -200,12 +254,12 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
       row.dur = opt_dur.value();
       slice_tracker->ScopedTyped(storage->mutable_slice_table(), std::move(row),
                                  args_inserter);
-      MaybeAddFlow(track_id, value);
+      MaybeAddFlow(track_id, values);
       break;
     }
     case 'C': {  // TRACE_EVENT_COUNTER
-      auto args = value["args"];
-      if (!args.isObject()) {
+      base::Optional<Json::Value> args = ParseArgs(raw_args);
+      if (!args || !args->isObject()) {
         context_->storage->IncrementStats(stats::json_parser_failure);
         break;
       }
@@ -215,7 +269,7 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
         counter_name_prefix += " id: " + id;
       }
 
-      for (auto it = args.begin(); it != args.end(); ++it) {
+      for (auto it = args->begin(); it != args->end(); ++it) {
         double counter;
         if (it->isString()) {
           auto opt = base::CStringToDouble(it->asCString());
@@ -241,10 +295,10 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
     case 'R':
     case 'I':
     case 'i': {  // TRACE_EVENT_INSTANT
-      base::StringView scope;
-      if (value.isMember("s")) {
-        scope = value["s"].asCString();
-      }
+      std::string scope_storage;
+      base::StringView scope =
+          json::DecodeRawString(raw_value(JsonEventKey::kScope), &scope_storage)
+              .value_or(base::StringView());
 
       TrackId track_id;
       if (scope == "g") {
@@ -284,7 +338,7 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
     case 's': {  // TRACE_EVENT_FLOW_START
       TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
       auto opt_source_id =
-          MaybeExtractFlowIdentifier(value, /* version2 = */ false);
+          MaybeExtractFlowIdentifier(values, /* version2 = */ false);
       if (opt_source_id) {
         FlowId flow_id = flow_tracker->GetFlowIdForV1Event(
             opt_source_id.value(), cat_id, name_id);
@@ -297,7 +351,7 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
     case 't': {  // TRACE_EVENT_FLOW_STEP
       TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
       auto opt_source_id =
-          MaybeExtractFlowIdentifier(value, /* version2 = */ false);
+          MaybeExtractFlowIdentifier(values, /* version2 = */ false);
       if (opt_source_id) {
         FlowId flow_id = flow_tracker->GetFlowIdForV1Event(
             opt_source_id.value(), cat_id, name_id);
@@ -310,12 +364,14 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
     case 'f': {  // TRACE_EVENT_FLOW_END
       TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
       auto opt_source_id =
-          MaybeExtractFlowIdentifier(value, /* version2 = */ false);
+          MaybeExtractFlowIdentifier(values, /* version2 = */ false);
       if (opt_source_id) {
         FlowId flow_id = flow_tracker->GetFlowIdForV1Event(
             opt_source_id.value(), cat_id, name_id);
+        std::string bp_storage;
         bool bind_enclosing_slice =
-            value.isMember("bp") && strcmp(value["bp"].asCString(), "e") == 0;
+            json::DecodeRawString(raw_value(JsonEventKey::kBindPoint),
+                                  &bp_storage) == base::StringView("e");
         flow_tracker->End(track_id, flow_id, bind_enclosing_slice,
                           /* close_flow = */ false);
       } else {
@@ -324,15 +380,21 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
       break;
     }
     case 'M': {  // Metadata events (process and thread names).
-      if (name == "thread_name" && !value["args"]["name"].empty()) {
-        const char* thread_name = value["args"]["name"].asCString();
+      if (name != "thread_name" && name != "process_name")
+        break;
+      base::Optional<Json::Value> args = ParseArgs(raw_args);
+      if (!args)
+        break;
+      const Json::Value& args_name = (*args)["name"];
+      if (name == "thread_name" && !args_name.empty()) {
+        const char* thread_name = args_name.asCString();
         auto thread_name_id = context_->storage->InternString(thread_name);
         procs->UpdateThreadName(tid, thread_name_id,
                                 ThreadNamePriority::kOther);
         break;
       }
-      if (name == "process_name" && !value["args"]["name"].empty()) {
-        const char* proc_name = value["args"]["name"].asCString();
+      if (name == "process_name" && !args_name.empty()) {
+        const char* proc_name = args_name.asCString();
         procs->SetProcessMetadata(pid, base::nullopt, proc_name,
                                   base::StringView());
         break;
@@ -342,19 +404,29 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
 #else
   perfetto::base::ignore_result(timestamp);
   perfetto::base::ignore_result(context_);
-  perfetto::base::ignore_result(string_value);
+  perfetto::base::ignore_result(json_value);
   PERFETTO_ELOG("Cannot parse JSON trace due to missing JSON support");
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
 }
 
-void JsonTraceParser::MaybeAddFlow(TrackId track_id, const Json::Value& event) {
+base::Optional<Json::Value> JsonTraceParser::ParseArgs(
+    base::StringView raw_args) {
+  if (raw_args.empty())
+    return base::nullopt;
+  return json::ParseJsonString(raw_args, json_reader_.get());
+}
+
+void JsonTraceParser::MaybeAddFlow(TrackId track_id,
+                                   const JsonEventValues& event) {
   PERFETTO_DCHECK(json::IsJsonSupported());
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
   auto opt_bind_id = MaybeExtractFlowIdentifier(event, /* version2 = */ true);
   if (opt_bind_id) {
     FlowTracker* flow_tracker = context_->flow_tracker.get();
-    bool flow_out = event.isMember("flow_out") && event["flow_out"].asBool();
-    bool flow_in = event.isMember("flow_in") && event["flow_in"].asBool();
+    bool flow_out =
+        CoerceRawValueToBool(GetRawValue(event, JsonEventKey::kFlowOut));
+    bool flow_in =
+        CoerceRawValueToBool(GetRawValue(event, JsonEventKey::kFlowIn));
     if (flow_in && flow_out) {
       flow_tracker->Step(track_id, opt_bind_id.value());
     } else if (flow_out) {
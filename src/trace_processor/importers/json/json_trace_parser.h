@@ -22,14 +22,13 @@
 #include <memory>
 #include <tuple>
 
+#include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/importers/common/trace_parser.h"
+#include "src/trace_processor/importers/json/json_trace_tokenizer.h"
+#include "src/trace_processor/importers/json/json_utils.h"
 #include "src/trace_processor/importers/systrace/systrace_line.h"
 #include "src/trace_processor/importers/systrace/systrace_line_parser.h"
 
-namespace Json {
-class Value;
-}
-
 namespace perfetto {
 namespace trace_processor {
 
@@ -43,14 +42,18 @@ class JsonTraceParser : public TraceParser {
   ~JsonTraceParser() override;
 
   // TraceParser implementation.
-  void ParseJsonPacket(int64_t timestamp, std::string string_value) override;
+  void ParseJsonPacket(int64_t timestamp, TraceBlobView json_value) override;
   void ParseSystraceLine(int64_t timestamp, SystraceLine line) override;
 
  private:
+  // Parses "args", the only part of the events which is parsed with jsoncpp.
+  base::Optional<Json::Value> ParseArgs(base::StringView raw_args);
+
+  void MaybeAddFlow(TrackId track_id, const JsonEventValues& event);
+
   TraceProcessorContext* const context_;
   SystraceLineParser systrace_line_parser_;
-
-  void MaybeAddFlow(TrackId track_id, const Json::Value& event);
+  std::unique_ptr<Json::CharReader> json_reader_;
 };
 
 }  // namespace trace_processor
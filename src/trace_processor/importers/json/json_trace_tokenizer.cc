@@ -16,11 +16,17 @@
 
 #include "src/trace_processor/importers/json/json_trace_tokenizer.h"
 
+#include <string.h>
+
+#include <algorithm>
 #include <memory>
+#include <tuple>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/utils.h"
 
+#include "perfetto/trace_processor/trace_blob.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/importers/json/json_utils.h"
 #include "src/trace_processor/storage/stats.h"
@@ -32,40 +38,79 @@ namespace trace_processor {
 
 namespace {
 
+constexpr uint64_t kOnes = 0x0101010101010101ULL;
+constexpr uint64_t kHighBits = 0x8080808080808080ULL;
+
+// Returns whether any byte of |word| is less than |n|, which must be <= 128.
+inline bool HasByteLessThan(uint64_t word, uint8_t n) {
+  return ((word - kOnes * n) & ~word & kHighBits) != 0;
+}
+
+// Returns whether any byte of |word| is equal to |c|.
+inline bool HasByte(uint64_t word, uint8_t c) {
+  return HasByteLessThan(word ^ (kOnes * c), 1);
+}
+
+// Returns a pointer to the first 8 byte word, starting at |s|, which may
+// contain a quote or a backslash, or a control character if |stop_at_cntrl|.
+// The bytes skipped over are known to be plain string characters, so they can
+// be scanned a word at a time rather than one by one.
+const char* SkipPlainStringWords(const char* s,
+                                 const char* end,
+                                 bool stop_at_cntrl) {
+  while (end - s >= 8) {
+    uint64_t word;
+    memcpy(&word, s, sizeof(word));
+    if (HasByte(word, '"') || HasByte(word, '\\'))
+      break;
+    if (stop_at_cntrl && (HasByteLessThan(word, 0x20) || HasByte(word, 0x7f)))
+      break;
+    s += 8;
+  }
+  return s;
+}
+
+// Appends the (unescaped) character |c| to |key|. |key| can be null, in which
+// case the character is only validated. This is used to skip over strings
+// which are not interesting without allocating memory for them.
 base::Status AppendUnescapedCharacter(char c,
                                       bool is_escaping,
                                       std::string* key) {
   if (is_escaping) {
+    char unescaped;
     switch (c) {
       case '"':
       case '\\':
       case '/':
-        key->push_back(c);
+        unescaped = c;
         break;
       case 'b':
-        key->push_back('\b');
+        unescaped = '\b';
         break;
       case 'f':
-        key->push_back('\f');
+        unescaped = '\f';
         break;
       case 'n':
-        key->push_back('\n');
+        unescaped = '\n';
         break;
       case 'r':
-        key->push_back('\r');
+        unescaped = '\r';
         break;
       case 't':
-        key->push_back('\t');
+        unescaped = '\t';
         break;
       case 'u':
         // Just pass through \uxxxx escape sequences which JSON supports but is
         // not worth the effort to parse as we never use them here.
-        key->append("\\u");
-        break;
+        if (key)
+          key->append("\\u");
+        return base::OkStatus();
       default:
         return base::ErrStatus("Illegal character in JSON");
     }
-  } else if (c != '\\') {
+    if (key)
+      key->push_back(unescaped);
+  } else if (c != '\\' && key) {
     key->push_back(c);
   }
   return base::OkStatus();
@@ -76,6 +121,8 @@ enum class ReadStringRes {
   kNeedsMoreData,
   kFatalError,
 };
+// Reads one JSON string starting at |start|, unescaping it into |key|. If
+// |key| is null the string is validated and skipped over.
 ReadStringRes ReadOneJsonString(const char* start,
                                 const char* end,
                                 std::string* key,
@@ -89,6 +136,15 @@ ReadStringRes ReadOneJsonString(const char* start,
 
   bool is_escaping = false;
   for (const char* s = start + 1; s < end; s++) {
+    if (!is_escaping) {
+      const char* plain_end = SkipPlainStringWords(s, end, true);
+      if (key)
+        key->append(s, plain_end);
+      s = plain_end;
+      if (s == end)
+        break;
+    }
+
     // Control characters are not allowed in JSON strings.
     if (iscntrl(*s))
       return ReadStringRes::kFatalError;
@@ -124,9 +180,8 @@ SkipValueRes SkipOneJsonValue(const char* start,
     if (*s == '"') {
       // Because strings can contain {}[] characters, handle them separately
       // before anything else.
-      std::string ignored;
       const char* str_next = nullptr;
-      switch (ReadOneJsonString(s, end, &ignored, &str_next)) {
+      switch (ReadOneJsonString(s, end, nullptr, &str_next)) {
         case ReadStringRes::kFatalError:
           return SkipValueRes::kFatalError;
         case ReadStringRes::kNeedsMoreData:
@@ -170,27 +225,113 @@ SkipValueRes SkipOneJsonValue(const char* start,
   return SkipValueRes::kNeedsMoreData;
 }
 
+// Converts the raw "ts" of an event like json::CoerceToTs() does with the
+// value returned by ExtractValueForJsonKey(). Unlike CoerceRawValueToTs(),
+// real numbers are converted from their text rather than from a double, so
+// their decimals are exact.
+base::Optional<int64_t> CoerceRawTs(base::StringView raw_ts) {
+  if (raw_ts.empty())
+    return base::nullopt;
+  if (raw_ts.at(0) != '"')
+    return json::CoerceToTs(raw_ts.ToStdString());
+  std::string storage;
+  base::Optional<base::StringView> ts = json::DecodeRawString(raw_ts, &storage);
+  return ts ? json::CoerceToTs(ts->ToStdString()) : base::nullopt;
+}
+
 base::Status SetOutAndReturn(const char* ptr, const char** out) {
   *out = ptr;
   return base::OkStatus();
 }
 
+// Indexed by JsonEventKey.
+constexpr const char* kJsonEventKeyNames[] = {
+    "ph", "pid", "tid", "id", "bind_id", "cat", "name", "tts",
+    "dur", "tdur", "s", "bp", "flow_in", "flow_out", "args"};
+static_assert(base::ArraySize(kJsonEventKeyNames) ==
+                  std::tuple_size<JsonEventValues>::value,
+              "kJsonEventKeyNames doesn't match JsonEventKey");
+
+base::Optional<JsonEventKey> FindJsonEventKey(const std::string& key) {
+  for (size_t i = 0; i < base::ArraySize(kJsonEventKeyNames); ++i) {
+    if (key == kJsonEventKeyNames[i])
+      return static_cast<JsonEventKey>(i);
+  }
+  return base::nullopt;
+}
+
 }  // namespace
 
 ReadDictRes ReadOneJsonDict(const char* start,
                             const char* end,
                             base::StringView* value,
                             const char** next) {
+  return ReadOneJsonDict(start, end, value, next, nullptr);
+}
+
+ReadDictRes ReadOneJsonDict(const char* start,
+                            const char* end,
+                            base::StringView* value,
+                            const char** next,
+                            JsonTsAndPh* ts_and_ph) {
   int braces = 0;
   int square_brackets = 0;
   const char* dict_begin = nullptr;
   bool in_string = false;
   bool is_escaping = false;
+
+  // State of the keys and values of the dictionary itself, when looking for
+  // |ts_and_ph|: they are the ones seen at |braces| == 1, outside of arrays.
+  int dict_square_brackets = 0;
+  bool expecting_key = false;
+  const char* key_begin = nullptr;
+  base::StringView key;
+  const char* value_begin = nullptr;
+  if (ts_and_ph)
+    *ts_and_ph = JsonTsAndPh();
+  auto is_dict_level = [&] {
+    return ts_and_ph && braces == 1 && square_brackets == dict_square_brackets;
+  };
+  auto end_dict_value = [&](const char* value_end) {
+    if (value_begin) {
+      while (value_begin < value_end && isspace(*value_begin))
+        value_begin++;
+      while (value_end > value_begin && isspace(value_end[-1]))
+        value_end--;
+      base::StringView raw(value_begin,
+                           static_cast<size_t>(value_end - value_begin));
+      if (key == "ts" && !ts_and_ph->ts.data())
+        ts_and_ph->ts = raw;
+      else if (key == "ph" && !ts_and_ph->ph.data())
+        ts_and_ph->ph = raw;
+    }
+    value_begin = nullptr;
+    expecting_key = true;
+  };
+
   for (const char* s = start; s < end; s++) {
-    if (isspace(*s) || *s == ',')
+    if (in_string && !is_escaping) {
+      s = SkipPlainStringWords(s, end, false);
+      if (s == end)
+        break;
+    }
+    if (isspace(*s))
+      continue;
+    if (*s == ',') {
+      if (!in_string && is_dict_level())
+        end_dict_value(s);
       continue;
+    }
     if (*s == '"' && !is_escaping) {
       in_string = !in_string;
+      if (is_dict_level() && expecting_key) {
+        if (in_string) {
+          key_begin = s + 1;
+        } else {
+          key = base::StringView(key_begin, static_cast<size_t>(s - key_begin));
+          expecting_key = false;
+        }
+      }
       continue;
     }
     if (in_string) {
@@ -201,15 +342,25 @@ ReadDictRes ReadOneJsonDict(const char* start,
       // characters:
       continue;
     }
+    if (*s == ':') {
+      if (is_dict_level())
+        value_begin = s + 1;
+      continue;
+    }
     if (*s == '{') {
-      if (braces == 0)
+      if (braces == 0) {
         dict_begin = s;
+        dict_square_brackets = square_brackets;
+        expecting_key = true;
+      }
       braces++;
       continue;
     }
     if (*s == '}') {
       if (braces <= 0)
         return ReadDictRes::kEndOfTrace;
+      if (is_dict_level())
+        end_dict_value(s);
       if (--braces > 0)
         continue;
       size_t len = static_cast<size_t>((s + 1) - dict_begin);
@@ -310,6 +461,10 @@ base::Status ExtractValueForJsonKey(base::StringView dict,
     kAfterDict,
   };
 
+  // Only the value of |key| is materialized. The values of all the other keys
+  // (notably "args", which is often large) are skipped over without copying.
+  std::string current_key;
+  std::string value_str;
   ExtractValueState state = kBeforeDict;
   for (const char* s = start; s < end;) {
     if (isspace(*s)) {
@@ -338,7 +493,7 @@ base::Status ExtractValueForJsonKey(base::StringView dict,
       continue;
     }
 
-    std::string current_key;
+    current_key.clear();
     auto res = ReadOneJsonKey(s, end, &current_key, &s);
     if (res == ReadKeyRes::kEndOfDictionary)
       break;
@@ -360,7 +515,7 @@ base::Status ExtractValueForJsonKey(base::StringView dict,
           "Failure parsing JSON: unsupported JSON dictionary with array");
     }
 
-    std::string value_str;
+    const bool is_requested_key = key == current_key;
     if (*s == '{') {
       base::StringView dict_str;
       ReadDictRes dict_res = ReadOneJsonDict(s, end, &dict_str, &s);
@@ -370,9 +525,11 @@ base::Status ExtractValueForJsonKey(base::StringView dict,
         return base::ErrStatus(
             "Failure parsing JSON: unable to parse dictionary");
       }
-      value_str = dict_str.ToStdString();
+      if (is_requested_key)
+        value_str = dict_str.ToStdString();
     } else if (*s == '"') {
-      auto str_res = ReadOneJsonString(s, end, &value_str, &s);
+      auto str_res = ReadOneJsonString(
+          s, end, is_requested_key ? &value_str : nullptr, &s);
       if (str_res == ReadStringRes::kNeedsMoreData ||
           str_res == ReadStringRes::kFatalError) {
         return base::ErrStatus("Failure parsing JSON: unable to parse string");
@@ -386,11 +543,12 @@ base::Status ExtractValueForJsonKey(base::StringView dict,
           break;
         }
       }
-      value_str = std::string(value_start, value_end);
+      if (is_requested_key)
+        value_str.assign(value_start, value_end);
     }
 
-    if (key == current_key) {
-      *value = value_str;
+    if (is_requested_key) {
+      *value = std::move(value_str);
       return base::OkStatus();
     }
   }
@@ -402,6 +560,63 @@ base::Status ExtractValueForJsonKey(base::StringView dict,
   return base::OkStatus();
 }
 
+base::Status ReadJsonEventValues(base::StringView dict,
+                                 JsonEventValues* values) {
+  values->fill(base::StringView());
+
+  const char* s = dict.data();
+  const char* end = dict.data() + dict.size();
+  while (s < end && isspace(*s))
+    ++s;
+  if (s == end || *s != '{')
+    return base::ErrStatus("Failure parsing JSON: event is not a dictionary");
+  ++s;
+
+  std::string key;
+  for (;;) {
+    key.clear();
+    switch (ReadOneJsonKey(s, end, &key, &s)) {
+      case ReadKeyRes::kFoundKey:
+        break;
+      case ReadKeyRes::kEndOfDictionary:
+        for (; s < end; ++s) {
+          if (!isspace(*s)) {
+            return base::ErrStatus(
+                "Failure parsing JSON: unexpected character after event");
+          }
+        }
+        return base::OkStatus();
+      case ReadKeyRes::kNeedsMoreData:
+        return base::ErrStatus("Failure parsing JSON: partial event");
+      case ReadKeyRes::kFatalError:
+        return base::ErrStatus(
+            "Failure parsing JSON: encountered fatal error while parsing key "
+            "of event");
+    }
+
+    // Strings are read separately, as SkipOneJsonValue() doesn't stop at
+    // their closing quote.
+    const char* value_start = s;
+    if (*s == '"') {
+      if (ReadOneJsonString(s, end, nullptr, &s) !=
+          ReadStringRes::kEndOfString) {
+        return base::ErrStatus("Failure parsing JSON: unable to parse string");
+      }
+    } else if (SkipOneJsonValue(s, end, &s) != SkipValueRes::kEndOfValue) {
+      return base::ErrStatus("Failure parsing JSON: unable to parse value");
+    }
+    const char* value_end = s;
+    while (value_end > value_start && isspace(value_end[-1]))
+      --value_end;
+
+    base::Optional<JsonEventKey> opt_key = FindJsonEventKey(key);
+    if (opt_key) {
+      (*values)[static_cast<size_t>(*opt_key)] = base::StringView(
+          value_start, static_cast<size_t>(value_end - value_start));
+    }
+  }
+}
+
 ReadSystemLineRes ReadOneSystemTraceLine(const char* start,
                                          const char* end,
                                          std::string* line,
@@ -440,10 +655,54 @@ JsonTraceTokenizer::~JsonTraceTokenizer() = default;
 base::Status JsonTraceTokenizer::Parse(TraceBlobView blob) {
   PERFETTO_DCHECK(json::IsJsonSupported());
 
-  buffer_.insert(buffer_.end(), blob.data(), blob.data() + blob.size());
-  const char* buf = buffer_.data();
+  // Trace events are pushed to the sorter as slices of the blob they were read
+  // from, rather than as copies. The only data that needs copying is the tail
+  // of the previous chunk which could not be parsed because it was split
+  // across the chunk boundary. Glue that to a prefix of |blob|, growing the
+  // prefix until the split object has been consumed, and then continue
+  // parsing |blob| in place.
+  size_t blob_offset = 0;
+  if (!buffer_.empty()) {
+    size_t prefix_size = std::min(blob.size(), kMinGlueSize);
+    for (;;) {
+      size_t glued_size = buffer_.size() + prefix_size;
+      TraceBlob glued = TraceBlob::Allocate(glued_size);
+      memcpy(glued.data(), buffer_.data(), buffer_.size());
+      memcpy(glued.data() + buffer_.size(), blob.data(), prefix_size);
+
+      size_t consumed = 0;
+      RETURN_IF_ERROR(ParseBlob(TraceBlobView(std::move(glued)), &consumed));
+      if (consumed >= buffer_.size()) {
+        blob_offset = consumed - buffer_.size();
+        buffer_.clear();
+        break;
+      }
+      buffer_.erase(buffer_.begin(),
+                    buffer_.begin() + static_cast<ptrdiff_t>(consumed));
+      if (prefix_size == blob.size()) {
+        // Even the whole chunk was not enough, keep it all for next time.
+        buffer_.insert(buffer_.end(), blob.data(), blob.data() + blob.size());
+        return base::OkStatus();
+      }
+      prefix_size = std::min(blob.size(), prefix_size * 2);
+    }
+  }
+
+  TraceBlobView remaining =
+      blob.slice_off(blob_offset, blob.size() - blob_offset);
+  size_t consumed = 0;
+  RETURN_IF_ERROR(ParseBlob(remaining.copy(), &consumed));
+  buffer_.assign(remaining.data() + consumed,
+                 remaining.data() + remaining.size());
+  return base::OkStatus();
+}
+
+base::Status JsonTraceTokenizer::ParseBlob(TraceBlobView blob,
+                                           size_t* consumed) {
+  const char* buf = reinterpret_cast<const char*>(blob.data());
   const char* next = buf;
-  const char* end = buf + buffer_.size();
+  const char* end = buf + blob.size();
+  *consumed = 0;
 
   if (offset_ == 0) {
     // Strip leading whitespace.
@@ -477,10 +736,14 @@ base::Status JsonTraceTokenizer::Parse(TraceBlobView blob) {
                     ? TracePosition::kDictionaryKey
                     : TracePosition::kInsideTraceEventsArray;
   }
-  RETURN_IF_ERROR(ParseInternal(next, end, &next));
 
-  offset_ += static_cast<uint64_t>(next - buf);
-  buffer_.erase(buffer_.begin(), buffer_.begin() + (next - buf));
+  current_blob_ = std::move(blob);
+  base::Status status = ParseInternal(next, end, &next);
+  current_blob_ = TraceBlobView();
+  RETURN_IF_ERROR(status);
+
+  *consumed = static_cast<size_t>(next - buf);
+  offset_ += *consumed;
   return base::OkStatus();
 }
 
@@ -511,7 +774,8 @@ base::Status JsonTraceTokenizer::HandleTraceEvent(const char* start,
                                                   const char** out) {
   for (const char* next = start; next < end;) {
     base::StringView unparsed;
-    switch (ReadOneJsonDict(next, end, &unparsed, &next)) {
+    JsonTsAndPh ts_and_ph;
+    switch (ReadOneJsonDict(next, end, &unparsed, &next, &ts_and_ph)) {
       case ReadDictRes::kEndOfArray: {
         if (format_ == TraceFormat::kOnlyTraceEvents) {
           position_ = TracePosition::kEof;
@@ -530,25 +794,26 @@ base::Status JsonTraceTokenizer::HandleTraceEvent(const char* start,
         break;
     }
 
-    base::Optional<std::string> opt_raw_ts;
-    RETURN_IF_ERROR(ExtractValueForJsonKey(unparsed, "ts", &opt_raw_ts));
-    base::Optional<int64_t> opt_ts =
-        opt_raw_ts ? json::CoerceToTs(*opt_raw_ts) : base::nullopt;
+    base::Optional<int64_t> opt_ts = CoerceRawTs(ts_and_ph.ts);
     int64_t ts = 0;
     if (opt_ts.has_value()) {
       ts = opt_ts.value();
     } else {
       // Metadata events may omit ts. In all other cases error:
-      base::Optional<std::string> opt_raw_ph;
-      RETURN_IF_ERROR(ExtractValueForJsonKey(unparsed, "ph", &opt_raw_ph));
-      if (!opt_raw_ph || *opt_raw_ph != "M") {
+      std::string ph_storage;
+      base::Optional<base::StringView> opt_ph =
+          json::DecodeRawString(ts_and_ph.ph, &ph_storage);
+      if (!opt_ph || *opt_ph != "M") {
         context_->storage->IncrementStats(stats::json_tokenizer_failure);
         continue;
       }
     }
-    context_->sorter->PushJsonValue(ts, unparsed.ToStdString());
+    context_->sorter->PushJsonValue(
+        ts, current_blob_.slice(
+                reinterpret_cast<const uint8_t*>(unparsed.data()),
+                unparsed.size()));
   }
-  return base::OkStatus();
+  return SetOutAndReturn(end, out);
 }
 
 base::Status JsonTraceTokenizer::HandleDictionaryKey(const char* start,
@@ -607,6 +872,9 @@ base::Status JsonTraceTokenizer::HandleDictionaryKey(const char* start,
     auto result = ReadOneJsonString(next, end, &time_unit, &next);
     if (result == ReadStringRes::kFatalError)
       return base::ErrStatus("Could not parse displayTimeUnit");
+    // Read the key again once the rest of the value is available.
+    if (result == ReadStringRes::kNeedsMoreData)
+      return SetOutAndReturn(start, out);
     context_->storage->IncrementStats(stats::json_display_time_unit);
     return ParseInternal(next, end, out);
   }
@@ -618,7 +886,7 @@ base::Status JsonTraceTokenizer::HandleDictionaryKey(const char* start,
           "Failure parsing JSON: error while parsing value for key %s",
           key.c_str());
     case SkipValueRes::kNeedsMoreData:
-      return SetOutAndReturn(next, out);
+      return SetOutAndReturn(start, out);
     case SkipValueRes::kEndOfValue:
       return ParseInternal(next, end, out);
   }
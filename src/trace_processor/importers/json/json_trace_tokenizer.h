@@ -19,6 +19,10 @@
 
 #include <stdint.h>
 
+#include <array>
+#include <vector>
+
+#include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/importers/common/chunked_trace_reader.h"
 #include "src/trace_processor/importers/json/json_utils.h"
 #include "src/trace_processor/importers/systrace/systrace_line_tokenizer.h"
@@ -52,6 +56,23 @@ ReadDictRes ReadOneJsonDict(const char* start,
                             base::StringView* value,
                             const char** next);
 
+// The raw JSON text (see JsonEventValues) of the values of the "ts" and "ph"
+// keys of a dictionary. Missing keys have a null data().
+struct JsonTsAndPh {
+  base::StringView ts;
+  base::StringView ph;
+};
+
+// Same as above, but also sets |ts_and_ph| from the keys of the dictionary
+// (not of the ones nested in it) in the same pass. As with
+// ExtractValueForJsonKey(), the first value wins for duplicated keys.
+// Visible for testing.
+ReadDictRes ReadOneJsonDict(const char* start,
+                            const char* end,
+                            base::StringView* value,
+                            const char** next,
+                            JsonTsAndPh* ts_and_ph);
+
 enum class ReadKeyRes {
   kFoundKey,
   kNeedsMoreData,
@@ -82,6 +103,41 @@ base::Status ExtractValueForJsonKey(base::StringView dict,
                                     const std::string& key,
                                     base::Optional<std::string>* value);
 
+// The keys of a trace event which are read by JsonTraceParser.
+enum class JsonEventKey : uint8_t {
+  kPh = 0,
+  kPid,
+  kTid,
+  kId,
+  kBindId,
+  kCat,
+  kName,
+  kTts,
+  kDur,
+  kTdur,
+  kScope,
+  kBindPoint,
+  kFlowIn,
+  kFlowOut,
+  kArgs,
+
+  kMax = kArgs,
+};
+
+// The raw JSON text of the values of the JsonEventKey keys of a trace event,
+// indexed by key: e.g. "B" (quotes included), 1234 or {"a": 1}. The values of
+// the keys missing from the event have a null data().
+using JsonEventValues =
+    std::array<base::StringView, static_cast<size_t>(JsonEventKey::kMax) + 1>;
+
+// Takes as input a JSON trace event dictionary and stores into |values| the
+// raw values of the keys it contains, without decoding or copying them. This
+// lets JsonTraceParser decode only the values it needs, in place. Like with
+// JSON parsers, the last value wins for duplicated keys.
+// Visible for testing.
+base::Status ReadJsonEventValues(base::StringView dict,
+                                 JsonEventValues* values);
+
 enum class ReadSystemLineRes {
   kFoundLine,
   kNeedsMoreData,
@@ -134,6 +190,14 @@ class JsonTraceTokenizer : public ChunkedTraceReader {
     kEof,
   };
 
+  // Minimum number of bytes of a new chunk which are glued to the unparsed
+  // tail of the previous one. See Parse().
+  static constexpr size_t kMinGlueSize = 64 * 1024;
+
+  // Parses as much as possible of |blob|, setting |consumed| to the number of
+  // bytes which don't need to be seen again.
+  base::Status ParseBlob(TraceBlobView blob, size_t* consumed);
+
   base::Status ParseInternal(const char* start,
                              const char* end,
                              const char** out);
@@ -161,6 +225,9 @@ class JsonTraceTokenizer : public ChunkedTraceReader {
   // Used to glue together JSON objects that span across two (or more)
   // Parse boundaries.
   std::vector<char> buffer_;
+  // The blob currently being parsed by ParseBlob(). Trace events are pushed
+  // to the sorter as slices of it.
+  TraceBlobView current_blob_;
 };
 
 }  // namespace trace_processor
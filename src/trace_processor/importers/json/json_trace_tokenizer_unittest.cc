@@ -18,7 +18,13 @@
 
 #include <json/value.h>
 
+#include "perfetto/trace_processor/trace_blob.h"
+#include "perfetto/trace_processor/trace_blob_view.h"
+#include "src/trace_processor/importers/common/trace_parser.h"
 #include "src/trace_processor/importers/json/json_utils.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/trace_sorter.h"
+#include "src/trace_processor/types/trace_processor_context.h"
 #include "test/gtest_and_gmock.h"
 
 namespace perfetto {
@@ -74,6 +80,24 @@ TEST(JsonTraceTokenizerTest, ReadDictTwoDicts) {
   ASSERT_EQ(parsed["bar"].asInt(), 2);
 }
 
+TEST(JsonTraceTokenizerTest, ReadDictLongStrings) {
+  // Strings are scanned a word at a time: put the quotes, escapes and braces
+  // at every offset within a word.
+  for (size_t pad = 0; pad < 16; pad++) {
+    std::string padding(pad, 'x');
+    std::string dict = R"({ "k": ")" + padding + R"(\"}{\\", "l": ")" +
+                       padding + R"(" } , { "m": 1 })";
+    const char* start = dict.data();
+    const char* end = start + dict.size();
+    const char* next = nullptr;
+    base::StringView value;
+    ReadDictRes result = ReadOneJsonDict(start, end, &value, &next);
+
+    ASSERT_EQ(result, ReadDictRes::kFoundDict) << pad;
+    ASSERT_EQ(value.ToStdString(), dict.substr(0, dict.find(" , ")));
+  }
+}
+
 TEST(JsonTraceTokenizerTest, ReadDictNeedMoreData) {
   const char* start = R"({"foo": 1)";
   const char* end = start + strlen(start);
@@ -85,6 +109,27 @@ TEST(JsonTraceTokenizerTest, ReadDictNeedMoreData) {
   ASSERT_EQ(next, nullptr);
 }
 
+TEST(JsonTraceTokenizerTest, ReadDictTsAndPh) {
+  const char* start =
+      R"({"args": {"ts": 1, "ph": "X"}, "arr": [{"ts": 2}, 3], )"
+      R"("ts" : 1234.5 , "ph":"B", "ts": 6}, {"ph": "M"})";
+  const char* end = start + strlen(start);
+  const char* next = nullptr;
+  base::StringView value;
+  JsonTsAndPh ts_and_ph;
+
+  ASSERT_EQ(ReadOneJsonDict(start, end, &value, &next, &ts_and_ph),
+            ReadDictRes::kFoundDict);
+  ASSERT_EQ(ts_and_ph.ts.ToStdString(), "1234.5");
+  ASSERT_EQ(ts_and_ph.ph.ToStdString(), R"("B")");
+
+  ASSERT_EQ(ReadOneJsonDict(next, end, &value, &next, &ts_and_ph),
+            ReadDictRes::kFoundDict);
+  ASSERT_EQ(ts_and_ph.ts.data(), nullptr);
+  ASSERT_EQ(ts_and_ph.ph.ToStdString(), R"("M")");
+  ASSERT_EQ(next, end);
+}
+
 TEST(JsonTraceTokenizerTest, ReadKeyIntValue) {
   const char* start = R"("Test": 01234, )";
   const char* middle = start + strlen(R"("Test": )");
@@ -272,6 +317,142 @@ TEST(JsonTraceTokenizerTest, ExtractValueForJsonKey) {
   ASSERT_EQ(*line, R"({"ts": 149029, "foo": "bar"})");
 }
 
+TEST(JsonTraceTokenizerTest, ReadJsonEventValues) {
+  JsonEventValues values;
+  ASSERT_TRUE(ReadJsonEventValues(R"( {
+    "name": "slice \"1\"", "ph" : "X", "ts": 10.5, "dur": 2,
+    "pid": 1, "tid": "2", "unknown": [1, {"a": "}"}],
+    "args": {"a": [1, 2], "b": {"c": "d"}}, "cat": ""
+  } )",
+                                  &values)
+                  .ok());
+  auto value = [&values](JsonEventKey key) {
+    return values[static_cast<size_t>(key)];
+  };
+  ASSERT_EQ(value(JsonEventKey::kName), R"("slice \"1\"")");
+  ASSERT_EQ(value(JsonEventKey::kPh), R"("X")");
+  ASSERT_EQ(value(JsonEventKey::kDur), "2");
+  ASSERT_EQ(value(JsonEventKey::kPid), "1");
+  ASSERT_EQ(value(JsonEventKey::kTid), R"("2")");
+  ASSERT_EQ(value(JsonEventKey::kArgs),
+            R"({"a": [1, 2], "b": {"c": "d"}})");
+  ASSERT_EQ(value(JsonEventKey::kCat), R"("")");
+  ASSERT_EQ(value(JsonEventKey::kId).data(), nullptr);
+  ASSERT_EQ(value(JsonEventKey::kFlowIn).data(), nullptr);
+
+  // The last value of duplicated keys wins.
+  ASSERT_TRUE(ReadJsonEventValues(R"({"ph": "B", "ph": "E"})", &values).ok());
+  ASSERT_EQ(value(JsonEventKey::kPh), R"("E")");
+  ASSERT_EQ(value(JsonEventKey::kName).data(), nullptr);
+
+  ASSERT_TRUE(ReadJsonEventValues("{}", &values).ok());
+  ASSERT_FALSE(ReadJsonEventValues(R"({"ph": "B")", &values).ok());
+  ASSERT_FALSE(ReadJsonEventValues(R"({"ph": "B"} x)", &values).ok());
+  ASSERT_FALSE(ReadJsonEventValues(R"({"ph": })", &values).ok());
+  ASSERT_FALSE(ReadJsonEventValues(R"(["ph"])", &values).ok());
+}
+
+class CollectingJsonParser : public TraceParser {
+ public:
+  void ParseJsonPacket(int64_t ts, TraceBlobView value) override {
+    events.emplace_back(
+        ts, std::string(reinterpret_cast<const char*>(value.data()),
+                        value.size()));
+  }
+
+  std::vector<std::pair<int64_t, std::string>> events;
+};
+
+TEST(JsonTraceTokenizerTest, EventsSplitAcrossChunks) {
+  const std::string kEvent1 = R"({"ph":"B","ts":1,"pid":1,"tid":2,"name":"a"})";
+  const std::string kEvent2 =
+      R"({"args":{"x":"}{"},"ph":"E","ts":2,"pid":1,"tid":2})";
+  const std::string trace = R"({"traceEvents":[)" + kEvent1 + "," + kEvent2 +
+                            R"(],"metadata":{"a":[1,2]},)"
+                            R"("displayTimeUnit":"ns"})";
+
+  // Split the trace at every possible position, to check that events which
+  // straddle a chunk boundary are glued back together correctly.
+  for (size_t split = 1; split < trace.size(); split++) {
+    TraceProcessorContext context;
+    context.storage.reset(new TraceStorage());
+    std::unique_ptr<CollectingJsonParser> parser(new CollectingJsonParser());
+    CollectingJsonParser* parser_ptr = parser.get();
+    context.sorter.reset(new TraceSorter(&context, std::move(parser),
+                                         TraceSorter::SortingMode::kFullSort));
+
+    JsonTraceTokenizer tokenizer(&context);
+    ASSERT_TRUE(
+        tokenizer.Parse(TraceBlobView(TraceBlob::CopyFrom(trace.data(), split)))
+            .ok());
+    ASSERT_TRUE(tokenizer
+                    .Parse(TraceBlobView(TraceBlob::CopyFrom(
+                        trace.data() + split, trace.size() - split)))
+                    .ok());
+    tokenizer.NotifyEndOfFile();
+    context.sorter->ExtractEventsForced();
+
+    ASSERT_EQ(parser_ptr->events.size(), 2u) << "split at " << split;
+    EXPECT_EQ(parser_ptr->events[0].first, 1000);
+    EXPECT_EQ(parser_ptr->events[0].second, kEvent1);
+    EXPECT_EQ(parser_ptr->events[1].first, 2000);
+    EXPECT_EQ(parser_ptr->events[1].second, kEvent2);
+  }
+}
+
+TEST(JsonTraceTokenizerTest, GlueEndsAfterEvent) {
+  // The first chunk ends in the middle of the first event, so the start of
+  // the second chunk is glued to it. The glued prefix of the second chunk
+  // (64KB, see JsonTraceTokenizer::kMinGlueSize) ends right after an event.
+  static constexpr size_t kGlueSize = 64 * 1024;
+  auto event = [](size_t ts, size_t name_size) {
+    return R"({"ph":"i","ts":)" + std::to_string(ts) +
+           R"(,"pid":1,"tid":2,"name":")" + std::string(name_size, 'x') +
+           R"("})";
+  };
+  const std::string kFirst = event(0, 10);
+  std::string first_chunk = R"({"traceEvents":[)" + kFirst.substr(0, 20);
+  std::string second_chunk = kFirst.substr(20);
+  std::vector<std::string> events{kFirst};
+  while (second_chunk.size() + event(events.size(), 1000).size() + 1 <
+         kGlueSize) {
+    events.push_back(event(events.size(), 1000));
+    second_chunk += "," + events.back();
+  }
+  size_t name_size = kGlueSize - second_chunk.size() - 1 -
+                     event(events.size(), 0).size();
+  events.push_back(event(events.size(), name_size));
+  second_chunk += "," + events.back();
+  ASSERT_EQ(second_chunk.size(), kGlueSize);
+  events.push_back(event(events.size(), 10));
+  second_chunk += "," + events.back() + "]}";
+
+  TraceProcessorContext context;
+  context.storage.reset(new TraceStorage());
+  std::unique_ptr<CollectingJsonParser> parser(new CollectingJsonParser());
+  CollectingJsonParser* parser_ptr = parser.get();
+  context.sorter.reset(new TraceSorter(&context, std::move(parser),
+                                       TraceSorter::SortingMode::kFullSort));
+
+  JsonTraceTokenizer tokenizer(&context);
+  ASSERT_TRUE(tokenizer
+                  .Parse(TraceBlobView(TraceBlob::CopyFrom(
+                      first_chunk.data(), first_chunk.size())))
+                  .ok());
+  ASSERT_TRUE(tokenizer
+                  .Parse(TraceBlobView(TraceBlob::CopyFrom(
+                      second_chunk.data(), second_chunk.size())))
+                  .ok());
+  tokenizer.NotifyEndOfFile();
+  context.sorter->ExtractEventsForced();
+
+  ASSERT_EQ(parser_ptr->events.size(), events.size());
+  for (size_t i = 0; i < events.size(); i++) {
+    EXPECT_EQ(parser_ptr->events[i].first, static_cast<int64_t>(i) * 1000);
+    EXPECT_EQ(parser_ptr->events[i].second, events[i]);
+  }
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
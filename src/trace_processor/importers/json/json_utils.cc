@@ -18,10 +18,11 @@
 
 #include "perfetto/base/build_config.h"
 
+#include <ctype.h>
+
 #include <limits>
 
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
-#include <json/reader.h>
 #include "perfetto/ext/base/string_utils.h"
 #endif
 
@@ -123,13 +124,162 @@ base::Optional<uint32_t> CoerceToUint32(const Json::Value& value) {
 #endif
 }
 
+#if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
+namespace {
+
+// The type jsoncpp would give to a raw JSON value.
+enum class RawValueType {
+  kString,
+  kInt,
+  kReal,
+  kOther,
+};
+
+RawValueType GetRawValueType(base::StringView raw_value) {
+  if (raw_value.empty())
+    return RawValueType::kOther;
+  char first = raw_value.at(0);
+  if (first == '"') {
+    return raw_value.size() >= 2 && raw_value.at(raw_value.size() - 1) == '"'
+               ? RawValueType::kString
+               : RawValueType::kOther;
+  }
+  if (first != '-' && !isdigit(first))
+    return RawValueType::kOther;
+  for (char c : raw_value) {
+    if (c == '.' || c == 'e' || c == 'E')
+      return RawValueType::kReal;
+  }
+  return RawValueType::kInt;
+}
+
+// Returns the decoded contents of the raw JSON string |raw_value|, i.e. the
+// string jsoncpp's Value::asString() would return.
+base::Optional<std::string> GetStringContents(base::StringView raw_value) {
+  std::string storage;
+  base::Optional<base::StringView> contents =
+      DecodeRawString(raw_value, &storage);
+  return contents ? base::make_optional(contents->ToStdString())
+                  : base::nullopt;
+}
+
+}  // namespace
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
+
+base::Optional<int64_t> CoerceRawValueToTs(base::StringView raw_value) {
+  PERFETTO_DCHECK(IsJsonSupported());
+
+#if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
+  switch (GetRawValueType(raw_value)) {
+    case RawValueType::kReal: {
+      base::Optional<double> d = base::StringToDouble(raw_value.ToStdString());
+      if (!d)
+        return base::nullopt;
+      return static_cast<int64_t>(*d * 1000.0);
+    }
+    case RawValueType::kInt: {
+      base::Optional<int64_t> n = base::StringToInt64(raw_value.ToStdString());
+      if (!n)
+        return base::nullopt;
+      return *n * 1000;
+    }
+    case RawValueType::kString: {
+      base::Optional<std::string> s = GetStringContents(raw_value);
+      return s ? CoerceToTs(*s) : base::nullopt;
+    }
+    case RawValueType::kOther:
+      return base::nullopt;
+  }
+  PERFETTO_FATAL("For GCC");
+#else
+  perfetto::base::ignore_result(raw_value);
+  return base::nullopt;
+#endif
+}
+
+base::Optional<uint32_t> CoerceRawValueToUint32(base::StringView raw_value) {
+  PERFETTO_DCHECK(IsJsonSupported());
+
+#if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
+  base::Optional<int64_t> n;
+  switch (GetRawValueType(raw_value)) {
+    case RawValueType::kReal: {
+      // Like Json::Value::asUInt64(), which truncates reals.
+      base::Optional<double> d = base::StringToDouble(raw_value.ToStdString());
+      if (!d || *d < 0 || *d >= 4294967296.0)
+        return base::nullopt;
+      return static_cast<uint32_t>(*d);
+    }
+    case RawValueType::kInt:
+      n = base::StringToInt64(raw_value.ToStdString());
+      break;
+    case RawValueType::kString: {
+      // Like CoerceToInt64(), which takes anything strtoll() fully consumes:
+      // notably, the empty string is 0.
+      base::Optional<std::string> s = GetStringContents(raw_value);
+      if (!s)
+        break;
+      char* str_end;
+      int64_t value = strtoll(s->c_str(), &str_end, 10);
+      if (str_end == s->data() + s->size())
+        n = value;
+      break;
+    }
+    case RawValueType::kOther:
+      break;
+  }
+  if (!n || *n < 0 || *n > std::numeric_limits<uint32_t>::max())
+    return base::nullopt;
+  return static_cast<uint32_t>(*n);
+#else
+  perfetto::base::ignore_result(raw_value);
+  return base::nullopt;
+#endif
+}
+
+base::Optional<base::StringView> DecodeRawString(base::StringView raw_value,
+                                                 std::string* storage) {
+  PERFETTO_DCHECK(IsJsonSupported());
+
+#if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
+  if (GetRawValueType(raw_value) != RawValueType::kString)
+    return base::nullopt;
+  base::StringView contents = raw_value.substr(1, raw_value.size() - 2);
+  if (contents.find('\\') == base::StringView::npos)
+    return contents;
+
+  // Escape sequences are rare enough to leave them to jsoncpp.
+  base::Optional<Json::Value> value = ParseJsonString(raw_value);
+  if (!value || !value->isString())
+    return base::nullopt;
+  *storage = value->asString();
+  return base::StringView(*storage);
+#else
+  perfetto::base::ignore_result(raw_value);
+  perfetto::base::ignore_result(storage);
+  return base::nullopt;
+#endif
+}
+
 base::Optional<Json::Value> ParseJsonString(base::StringView raw_string) {
   PERFETTO_DCHECK(IsJsonSupported());
+  return ParseJsonString(raw_string, CreateJsonReader().get());
+}
 
+std::unique_ptr<Json::CharReader> CreateJsonReader() {
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
   Json::CharReaderBuilder b;
-  auto reader = std::unique_ptr<Json::CharReader>(b.newCharReader());
+  return std::unique_ptr<Json::CharReader>(b.newCharReader());
+#else
+  return nullptr;
+#endif
+}
 
+base::Optional<Json::Value> ParseJsonString(base::StringView raw_string,
+                                            Json::CharReader* reader) {
+  PERFETTO_DCHECK(IsJsonSupported());
+
+#if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
   Json::Value value;
   const char* begin = raw_string.data();
   return reader->parse(begin, begin + raw_string.size(), &value, nullptr)
@@ -137,6 +287,7 @@ base::Optional<Json::Value> ParseJsonString(base::StringView raw_string) {
              : base::nullopt;
 #else
   perfetto::base::ignore_result(raw_string);
+  perfetto::base::ignore_result(reader);
   return base::nullopt;
 #endif
 }
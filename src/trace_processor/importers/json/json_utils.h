@@ -19,15 +19,20 @@
 
 #include <stdint.h>
 
+#include <memory>
+#include <string>
+
 #include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/string_view.h"
 
 #include "src/trace_processor/importers/common/args_tracker.h"
 
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
+#include <json/reader.h>
 #include <json/value.h>
 #else
 namespace Json {
+class CharReader {};
 class Value {};
 }  // namespace Json
 #endif
@@ -45,10 +50,31 @@ base::Optional<int64_t> CoerceToTs(const std::string& value);
 base::Optional<int64_t> CoerceToInt64(const Json::Value& value);
 base::Optional<uint32_t> CoerceToUint32(const Json::Value& value);
 
+// Same as above, but for the raw JSON text of a value, as found in the trace:
+// e.g. 42, 42.1 or "42" (quotes included). This allows to read the values of
+// a trace event in place, without parsing the whole event.
+base::Optional<int64_t> CoerceRawValueToTs(base::StringView raw_value);
+base::Optional<uint32_t> CoerceRawValueToUint32(base::StringView raw_value);
+
+// Decodes the raw JSON string |raw_value| (quotes included). The result points
+// into |raw_value| if the string has no escape sequences, and into |storage|,
+// which receives the unescaped string, otherwise. Returns nullopt if
+// |raw_value| is not a JSON string.
+// This function should only be called if |IsJsonSupported()| returns true.
+base::Optional<base::StringView> DecodeRawString(base::StringView raw_value,
+                                                 std::string* storage);
+
 // Parses the given JSON string into a JSON::Value object.
 // This function should only be called if |IsJsonSupported()| returns true.
 base::Optional<Json::Value> ParseJsonString(base::StringView raw_string);
 
+// Same as above, but with a reader returned by CreateJsonReader(). Creating
+// the reader costs several times more than parsing a short string like the
+// args of a trace event, so callers parsing many strings should reuse one.
+std::unique_ptr<Json::CharReader> CreateJsonReader();
+base::Optional<Json::Value> ParseJsonString(base::StringView raw_string,
+                                            Json::CharReader* reader);
+
 // Flattens the given Json::Value and adds each leaf node to the bound args
 // inserter. Note:
 //  * |flat_key| and |key| should be non-empty and will be used to prefix the
@@ -56,6 +56,60 @@ TEST(JsonTraceUtilsTest, CoerceToTs) {
   ASSERT_FALSE(CoerceToTs(Json::Value("1234!")).has_value());
 }
 
+TEST(JsonTraceUtilsTest, CoerceRawValueToUint32) {
+  ASSERT_EQ(CoerceRawValueToUint32("42").value_or(0), 42u);
+  ASSERT_EQ(CoerceRawValueToUint32(R"("42")").value_or(0), 42u);
+  ASSERT_EQ(CoerceRawValueToUint32("42.1").value_or(0), 42u);
+  ASSERT_EQ(CoerceRawValueToUint32("4.2e1").value_or(0), 42u);
+  ASSERT_FALSE(CoerceRawValueToUint32("-1").has_value());
+  ASSERT_FALSE(CoerceRawValueToUint32("4294967296").has_value());
+  ASSERT_FALSE(CoerceRawValueToUint32(R"("foo")").has_value());
+  ASSERT_FALSE(CoerceRawValueToUint32("true").has_value());
+  ASSERT_FALSE(CoerceRawValueToUint32("").has_value());
+}
+
+TEST(JsonTraceUtilsTest, CoerceRawValueToUint32MatchesJsonValue) {
+  // Strings are coerced like CoerceToUint32() does for the string values
+  // jsoncpp returns: an empty string is 0 and escape sequences are decoded.
+  ASSERT_EQ(CoerceToUint32(Json::Value("")).value_or(1), 0u);
+  ASSERT_EQ(CoerceRawValueToUint32(R"("")").value_or(1), 0u);
+  ASSERT_EQ(CoerceRawValueToUint32(R"("\u0034\u0032")").value_or(0), 42u);
+  ASSERT_EQ(CoerceRawValueToUint32(R"(" 42")").value_or(0), 42u);
+  ASSERT_EQ(CoerceToUint32(Json::Value(" 42")).value_or(0), 42u);
+  ASSERT_FALSE(CoerceRawValueToUint32(R"("42 ")").has_value());
+  ASSERT_FALSE(CoerceToUint32(Json::Value("42 ")).has_value());
+}
+
+TEST(JsonTraceUtilsTest, CoerceRawValueToTs) {
+  ASSERT_EQ(CoerceRawValueToTs("42").value_or(-1), 42000);
+  ASSERT_EQ(CoerceRawValueToTs("-42").value_or(-1), -42000);
+  ASSERT_EQ(CoerceRawValueToTs(R"("42")").value_or(-1), 42000);
+  ASSERT_EQ(CoerceRawValueToTs("42.1").value_or(-1), 42100);
+  ASSERT_EQ(CoerceRawValueToTs(R"("42.1")").value_or(-1), 42100);
+  ASSERT_EQ(CoerceRawValueToTs("4.21e1").value_or(-1), 42100);
+  ASSERT_FALSE(CoerceRawValueToTs(R"("1234!")").has_value());
+  ASSERT_FALSE(CoerceRawValueToTs("null").has_value());
+  ASSERT_FALSE(CoerceRawValueToTs("").has_value());
+  ASSERT_EQ(CoerceRawValueToTs(R"("")").value_or(-1), 0);
+  ASSERT_EQ(CoerceRawValueToTs(R"("\u0034\u0032")").value_or(-1), 42000);
+}
+
+TEST(JsonTraceUtilsTest, DecodeRawString) {
+  std::string storage;
+  base::StringView raw = R"("plain")";
+  base::Optional<base::StringView> str = DecodeRawString(raw, &storage);
+  ASSERT_EQ(str, base::StringView("plain"));
+  // Strings without escape sequences point into the raw value.
+  ASSERT_EQ(str->data(), raw.data() + 1);
+
+  ASSERT_EQ(DecodeRawString(R"("a\"b\u0041")", &storage),
+            base::StringView("a\"bA"));
+  ASSERT_EQ(DecodeRawString(R"("")", &storage), base::StringView());
+  ASSERT_FALSE(DecodeRawString("42", &storage).has_value());
+  ASSERT_FALSE(DecodeRawString(R"(")", &storage).has_value());
+  ASSERT_FALSE(DecodeRawString("", &storage).has_value());
+}
+
 }  // namespace
 }  // namespace json
 }  // namespace trace_processor
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/snapshot/snapshot_trace_reader.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+#include "perfetto/base/logging.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/storage/stats.h"
+#include "src/trace_processor/storage/trace_storage_snapshot.h"
+#include "src/trace_processor/types/destructible.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+#include "src/trace_processor/util/status_macros.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+// Keeps the snapshot alive for the columns which read it in place.
+struct SnapshotData : public Destructible {
+  ~SnapshotData() override;
+
+  // The chunks of the snapshot when they are contiguous in memory, e.g. when
+  // the file is mmapped.
+  std::vector<TraceBlobView> chunks;
+
+  // Otherwise, the chunks copied into one buffer.
+  std::vector<uint8_t> concatenated;
+};
+
+SnapshotData::~SnapshotData() = default;
+
+}  // namespace
+
+SnapshotTraceReader::SnapshotTraceReader(TraceProcessorContext* context)
+    : context_(context) {}
+
+SnapshotTraceReader::~SnapshotTraceReader() = default;
+
+util::Status SnapshotTraceReader::Parse(TraceBlobView blob) {
+  if (restored_)
+    return util::ErrStatus("Unexpected data after the end of the snapshot");
+  if (blob.size() == 0)
+    return util::OkStatus();
+
+  if (!chunks_.empty()) {
+    const TraceBlobView& last = chunks_.back();
+    contiguous_ &= last.data() + last.size() == blob.data();
+  }
+  received_size_ += blob.size();
+  chunks_.emplace_back(std::move(blob));
+
+  if (snapshot_size_ == 0) {
+    if (received_size_ < TraceStorageSnapshot::kHeaderSize)
+      return util::OkStatus();
+    uint8_t header[TraceStorageSnapshot::kHeaderSize];
+    CopyPrefix(header, sizeof(header));
+    RETURN_IF_ERROR(TraceStorageSnapshot::ReadHeader(header, sizeof(header),
+                                                     &snapshot_size_));
+  }
+  if (received_size_ > snapshot_size_) {
+    return util::ErrStatus("Snapshot is %zu bytes, expected %" PRIu64,
+                           received_size_, snapshot_size_);
+  }
+  if (received_size_ < snapshot_size_)
+    return util::OkStatus();
+  return Restore();
+}
+
+void SnapshotTraceReader::NotifyEndOfFile() {
+  if (restored_ || chunks_.empty())
+    return;
+  PERFETTO_ELOG("Snapshot truncated: %zu bytes received, expected %" PRIu64,
+                received_size_, snapshot_size_);
+  context_->storage->IncrementStats(stats::snapshot_truncated);
+  chunks_.clear();
+}
+
+void SnapshotTraceReader::CopyPrefix(uint8_t* dst, size_t size) const {
+  for (const TraceBlobView& chunk : chunks_) {
+    size_t chunk_size = std::min(size, chunk.size());
+    memcpy(dst, chunk.data(), chunk_size);
+    dst += chunk_size;
+    size -= chunk_size;
+    if (size == 0)
+      break;
+  }
+}
+
+util::Status SnapshotTraceReader::Restore() {
+  restored_ = true;
+  std::unique_ptr<SnapshotData> snapshot(new SnapshotData());
+  const uint8_t* data = chunks_.front().data();
+  if (contiguous_) {
+    snapshot->chunks = std::move(chunks_);
+  } else {
+    snapshot->concatenated.resize(received_size_);
+    CopyPrefix(snapshot->concatenated.data(), received_size_);
+    data = snapshot->concatenated.data();
+  }
+  chunks_.clear();
+  util::Status status = TraceStorageSnapshot::Restore(
+      data, received_size_, std::move(snapshot), context_->storage.get());
+  if (!status.ok())
+    return util::ErrStatus("Failed to load snapshot: %s", status.c_message());
+  return util::OkStatus();
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_IMPORTERS_SNAPSHOT_SNAPSHOT_TRACE_READER_H_
+#define SRC_TRACE_PROCESSOR_IMPORTERS_SNAPSHOT_SNAPSHOT_TRACE_READER_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "perfetto/trace_processor/trace_blob_view.h"
+#include "src/trace_processor/importers/common/chunked_trace_reader.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+class TraceProcessorContext;
+
+// Loads a snapshot written by TraceStorageSnapshot::Write() (e.g. with
+// trace_processor_shell --save-snapshot) into the storage of |context|.
+// The snapshot is restored in one go by the Parse() call which receives its
+// last byte (the size of the snapshot is in its header), so that a corrupted
+// snapshot fails the load like any other malformed trace. When the chunks
+// passed to Parse() are contiguous slices of the same buffer (as is the case
+// when the file is mmapped) the restore reads directly from it, otherwise the
+// chunks are first concatenated. Either way, the restored storage keeps the
+// snapshot alive and reads the numeric columns in place from it.
+class SnapshotTraceReader : public ChunkedTraceReader {
+ public:
+  explicit SnapshotTraceReader(TraceProcessorContext*);
+  ~SnapshotTraceReader() override;
+  SnapshotTraceReader(const SnapshotTraceReader&) = delete;
+  SnapshotTraceReader& operator=(const SnapshotTraceReader&) = delete;
+
+  // ChunkedTraceReader implementation
+  util::Status Parse(TraceBlobView) override;
+  void NotifyEndOfFile() override;
+
+ private:
+  // Copies the first |size| bytes received into |dst|.
+  void CopyPrefix(uint8_t* dst, size_t size) const;
+
+  util::Status Restore();
+
+  TraceProcessorContext* const context_;
+  std::vector<TraceBlobView> chunks_;
+  bool contiguous_ = true;
+  size_t received_size_ = 0;
+
+  // Set once the header is received.
+  uint64_t snapshot_size_ = 0;
+  bool restored_ = false;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_IMPORTERS_SNAPSHOT_SNAPSHOT_TRACE_READER_H_
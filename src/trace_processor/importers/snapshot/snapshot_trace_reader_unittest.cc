@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/snapshot/snapshot_trace_reader.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "perfetto/trace_processor/trace_blob.h"
+#include "perfetto/trace_processor/trace_blob_view.h"
+#include "src/trace_processor/storage/stats.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/storage/trace_storage_snapshot.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+// Returns the storage of |column|, whose values are of type T.
+template <typename T>
+const ColumnStorage<T>& GetStorage(const Column& column) {
+  return *static_cast<const ColumnStorage<T>*>(column.storage_base());
+}
+
+class SnapshotTraceReaderTest : public ::testing::Test {
+ protected:
+  SnapshotTraceReaderTest() {
+    TraceStorage storage;
+    storage.mutable_thread_table()->Insert(tables::ThreadTable::Row(1234));
+    base::TempFile file = base::TempFile::Create();
+    EXPECT_TRUE(TraceStorageSnapshot::Write(storage, file.fd()).ok());
+    EXPECT_TRUE(base::ReadFile(file.path(), &snapshot_));
+
+    context_.storage.reset(new TraceStorage());
+    reader_.reset(new SnapshotTraceReader(&context_));
+  }
+
+  // Passes [offset, offset + size) of |data| to the reader as a separate
+  // (non contiguous) chunk.
+  util::Status Parse(const std::string& data, size_t offset, size_t size) {
+    return reader_->Parse(
+        TraceBlobView(TraceBlob::CopyFrom(data.data() + offset, size)));
+  }
+
+  // Passes |data| to the reader in chunks of |chunk_size| bytes and returns
+  // the first error.
+  util::Status ParseInChunks(const std::string& data, size_t chunk_size) {
+    for (size_t offset = 0; offset < data.size(); offset += chunk_size) {
+      util::Status status =
+          Parse(data, offset, std::min(chunk_size, data.size() - offset));
+      if (!status.ok())
+        return status;
+    }
+    return util::OkStatus();
+  }
+
+  std::string snapshot_;
+  TraceProcessorContext context_;
+  std::unique_ptr<SnapshotTraceReader> reader_;
+};
+
+TEST_F(SnapshotTraceReaderTest, RestoresInChunks) {
+  // Smaller than the header, which is then split across chunks.
+  ASSERT_TRUE(ParseInChunks(snapshot_, 7).ok());
+  reader_->NotifyEndOfFile();
+
+  const auto& threads = context_.storage->thread_table();
+  ASSERT_EQ(threads.row_count(), 1u);
+  EXPECT_EQ(threads.tid()[0], 1234u);
+  EXPECT_EQ(context_.storage->stats()[stats::snapshot_truncated].value, 0);
+}
+
+TEST_F(SnapshotTraceReaderTest, RestoresContiguousChunksInPlace) {
+  TraceBlobView whole(TraceBlob::CopyFrom(snapshot_.data(), snapshot_.size()));
+  for (size_t offset = 0; offset < whole.size(); offset += 100) {
+    size_t size = std::min<size_t>(100, whole.size() - offset);
+    ASSERT_TRUE(reader_->Parse(whole.slice_off(offset, size)).ok());
+  }
+  reader_->NotifyEndOfFile();
+
+  const auto& threads = context_.storage->thread_table();
+  ASSERT_EQ(threads.row_count(), 1u);
+  EXPECT_TRUE(GetStorage<uint32_t>(threads.tid()).IsExternal());
+  EXPECT_EQ(threads.tid()[0], 1234u);
+}
+
+TEST_F(SnapshotTraceReaderTest, CorruptedSnapshotFailsParse) {
+  // Claim more strings than there are in the snapshot.
+  uint32_t string_count = 0xffffffff;
+  memcpy(&snapshot_[TraceStorageSnapshot::kHeaderSize], &string_count,
+         sizeof(string_count));
+  ASSERT_TRUE(Parse(snapshot_, 0, snapshot_.size() - 1).ok());
+  ASSERT_FALSE(Parse(snapshot_, snapshot_.size() - 1, 1).ok());
+  EXPECT_EQ(context_.storage->thread_table().row_count(), 0u);
+}
+
+TEST_F(SnapshotTraceReaderTest, DataAfterTheSnapshotFailsParse) {
+  ASSERT_FALSE(ParseInChunks(snapshot_ + "extra", 1024).ok());
+}
+
+TEST_F(SnapshotTraceReaderTest, TruncatedSnapshotIsRecordedInStats) {
+  ASSERT_TRUE(Parse(snapshot_, 0, snapshot_.size() - 1).ok());
+  reader_->NotifyEndOfFile();
+  EXPECT_EQ(context_.storage->thread_table().row_count(), 0u);
+  EXPECT_EQ(context_.storage->stats()[stats::snapshot_truncated].value, 1);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
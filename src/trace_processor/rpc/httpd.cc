@@ -243,6 +243,11 @@ void Httpd::OnHttpRequest(const base::HttpRequest& req) {
     return conn.SendResponse("200 OK", headers, Vec2Sv(res));
   }
 
+  if (req.uri == "/save_snapshot") {
+    std::vector<uint8_t> res = trace_processor_rpc_.SaveSnapshot();
+    return conn.SendResponse("200 OK", headers, Vec2Sv(res));
+  }
+
   return conn.SendResponseAndClose("404 Not Found", headers);
 }
 
@@ -262,6 +262,12 @@ void Rpc::ParseRpcRequest(const uint8_t* data, size_t len) {
       resp.Send(rpc_response_fn_);
       break;
     }
+    case RpcProto::TPM_SAVE_SNAPSHOT: {
+      Response resp(tx_seq_id_++, req_type);
+      SaveSnapshotInternal(resp->set_save_snapshot_result());
+      resp.Send(rpc_response_fn_);
+      break;
+    }
     default: {
       // This can legitimately happen if the client is newer. We reply with a
       // generic "unkown request" response, so the client can do feature
@@ -433,6 +439,22 @@ void Rpc::DisableAndReadMetatraceInternal(
   }
 }
 
+std::vector<uint8_t> Rpc::SaveSnapshot() {
+  protozero::HeapBuffered<protos::pbzero::SaveSnapshotResult> result;
+  SaveSnapshotInternal(result.get());
+  return result.SerializeAsArray();
+}
+
+void Rpc::SaveSnapshotInternal(protos::pbzero::SaveSnapshotResult* result) {
+  std::vector<uint8_t> snapshot;
+  util::Status status = trace_processor_->SaveSnapshotToBuffer(&snapshot);
+  if (status.ok()) {
+    result->set_snapshot(snapshot.data(), snapshot.size());
+  } else {
+    result->set_error(status.message());
+  }
+}
+
 std::vector<uint8_t> Rpc::GetStatus() {
   protozero::HeapBuffered<protos::pbzero::StatusResult> status;
   status->set_loaded_trace_name(trace_processor_->GetCurrentTraceName());
@@ -33,6 +33,7 @@ namespace protos {
 namespace pbzero {
 class ComputeMetricResult;
 class DisableAndReadMetatraceResult;
+class SaveSnapshotResult;
 }  // namespace pbzero
 }  // namespace protos
 
@@ -106,6 +107,7 @@ class Rpc {
   void EnableMetatrace(const uint8_t* data, size_t len);  // EnableMetatraceArgs
   std::vector<uint8_t> DisableAndReadMetatrace();
   std::vector<uint8_t> GetStatus();
+  std::vector<uint8_t> SaveSnapshot();  // SaveSnapshotResult
 
   // Creates a new RPC session by deleting all tables and views that have been
   // created (by the UI or user) after the trace was loaded; built-in
@@ -139,6 +141,7 @@ class Rpc {
                              protos::pbzero::ComputeMetricResult*);
   void DisableAndReadMetatraceInternal(
       protos::pbzero::DisableAndReadMetatraceResult*);
+  void SaveSnapshotInternal(protos::pbzero::SaveSnapshotResult*);
 
   std::unique_ptr<TraceProcessor> trace_processor_;
   RpcResponseFunction rpc_response_fn_;
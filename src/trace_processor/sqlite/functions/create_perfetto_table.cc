@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sqlite/functions/create_perfetto_table.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#include <set>
+
+#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/string_view.h"
+#include "src/trace_processor/sqlite/db_sqlite_table.h"
+#include "src/trace_processor/sqlite/functions/create_function_internal.h"
+#include "src/trace_processor/sqlite/scoped_db.h"
+#include "src/trace_processor/sqlite/sqlite_utils.h"
+#include "src/trace_processor/tp_metatrace.h"
+#include "src/trace_processor/util/status_macros.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+bool IsIdentifierChar(char c) {
+  return isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// Returns a pointer to the first character of |p| which is not whitespace
+// or part of a comment.
+const char* SkipWhitespaceAndComments(const char* p) {
+  for (;;) {
+    while (isspace(static_cast<unsigned char>(*p)))
+      ++p;
+    if (p[0] == '-' && p[1] == '-') {
+      p += strcspn(p, "\n");
+    } else if (p[0] == '/' && p[1] == '*') {
+      const char* end = strstr(p + 2, "*/");
+      p = end ? end + 2 : p + strlen(p);
+    } else {
+      return p;
+    }
+  }
+}
+
+// If |*p| starts with the keyword |keyword| (case insensitive), moves |*p|
+// to the next token and returns true.
+bool ConsumeKeyword(const char** p, const char* keyword) {
+  // Only looks at as many characters of |*p| as there are in |keyword|: this
+  // runs on every statement, which may be long.
+  size_t len = 0;
+  for (; keyword[len]; ++len) {
+    if (base::Lowercase((*p)[len]) != base::Lowercase(keyword[len]))
+      return false;
+  }
+  if (IsIdentifierChar((*p)[len]))
+    return false;
+  *p = SkipWhitespaceAndComments(*p + len);
+  return true;
+}
+
+base::Status IsNameAvailable(sqlite3* db, const std::string& name) {
+  // Db tables are registered as eponymous virtual tables which do not show up
+  // in sqlite_master but are all listed in perfetto_tables.
+  ScopedSqliteString query(sqlite3_mprintf(
+      "SELECT name FROM sqlite_master WHERE name = %Q "
+      "UNION ALL SELECT name FROM perfetto_tables WHERE name = %Q",
+      name.c_str(), name.c_str()));
+  ScopedStmt stmt;
+  const char* tail = nullptr;
+  RETURN_IF_ERROR(sqlite_utils::PrepareStmt(db, query.get(), &stmt, &tail));
+  int ret = sqlite3_step(*stmt);
+  if (ret == SQLITE_ROW) {
+    return base::ErrStatus("CREATE_PERFETTO_TABLE: a table named %s exists",
+                           name.c_str());
+  }
+  if (ret != SQLITE_DONE) {
+    return base::ErrStatus("CREATE_PERFETTO_TABLE: %s", sqlite3_errmsg(db));
+  }
+  return base::OkStatus();
+}
+
+}  // namespace
+
+base::Status CreatePerfettoTable::Run(Context* ctx,
+                                      size_t argc,
+                                      sqlite3_value** argv,
+                                      SqlValue&,
+                                      Destructors&) {
+  if (argc != 2) {
+    return base::ErrStatus(
+        "CREATE_PERFETTO_TABLE: invalid number of args; expected %u, received "
+        "%zu",
+        2u, argc);
+  }
+  for (size_t i = 0; i < argc; ++i) {
+    base::Status status = TypeCheckSqliteValue(argv[i], SqlValue::kString);
+    if (!status.ok()) {
+      return base::ErrStatus("CREATE_PERFETTO_TABLE: argument %zu %s", i,
+                             status.c_message());
+    }
+  }
+  std::string name(reinterpret_cast<const char*>(sqlite3_value_text(argv[0])));
+  const char* sql = reinterpret_cast<const char*>(sqlite3_value_text(argv[1]));
+
+  PERFETTO_TP_TRACE(metatrace::Category::QUERY, "CREATE_PERFETTO_TABLE",
+                    [&name](metatrace::Record* r) {
+                      r->AddArg("Table", base::StringView(name));
+                    });
+
+  if (ctx->tables->count(name)) {
+    return base::ErrStatus("CREATE_PERFETTO_TABLE: table %s already exists",
+                           name.c_str());
+  }
+  RETURN_IF_ERROR(IsNameAvailable(ctx->db, name));
+
+  ScopedStmt stmt;
+  const char* tail = nullptr;
+  RETURN_IF_ERROR(sqlite_utils::PrepareStmt(ctx->db, sql, &stmt, &tail));
+  if (!stmt) {
+    return base::ErrStatus("CREATE_PERFETTO_TABLE(%s): empty SQL statement",
+                           name.c_str());
+  }
+
+  uint32_t col_count = static_cast<uint32_t>(sqlite3_column_count(*stmt));
+  std::vector<std::string> col_names;
+  std::set<std::string> seen_names;
+  for (uint32_t i = 0; i < col_count; ++i) {
+    std::string col_name = sqlite3_column_name(*stmt, static_cast<int>(i));
+    if (!seen_names.insert(col_name).second) {
+      return base::ErrStatus(
+          "CREATE_PERFETTO_TABLE(%s): column %s appears more than once",
+          name.c_str(), col_name.c_str());
+    }
+    col_names.emplace_back(std::move(col_name));
+  }
+
+  std::unique_ptr<RuntimeTable> table(
+      new RuntimeTable(ctx->pool, std::move(col_names)));
+  std::vector<SqlValue> row(col_count);
+  int ret = sqlite3_step(*stmt);
+  for (; ret == SQLITE_ROW; ret = sqlite3_step(*stmt)) {
+    for (uint32_t i = 0; i < col_count; ++i) {
+      row[i] = sqlite_utils::SqliteValueToSqlValue(
+          sqlite3_column_value(*stmt, static_cast<int>(i)));
+    }
+    base::Status status = table->AddRow(row);
+    if (!status.ok()) {
+      return base::ErrStatus("CREATE_PERFETTO_TABLE(%s): %s", name.c_str(),
+                             status.c_message());
+    }
+  }
+  if (ret != SQLITE_DONE) {
+    return base::ErrStatus("CREATE_PERFETTO_TABLE(%s): %s", name.c_str(),
+                           sqlite3_errmsg(ctx->db));
+  }
+
+  base::Status status = table->Finalize();
+  if (!status.ok()) {
+    return base::ErrStatus("CREATE_PERFETTO_TABLE(%s): %s", name.c_str(),
+                           status.c_message());
+  }
+  DbSqliteTable::RegisterTable(ctx->db, ctx->cache, table->schema(),
+                               table.get(), name);
+  (*ctx->tables)[name] = std::move(table);
+
+  // CREATE_PERFETTO_TABLE doesn't have a return value so just don't sent
+  // |out|.
+  return base::OkStatus();
+}
+
+base::Status CreatePerfettoTable::RewriteStatement(sqlite3* db,
+                                                   const char* sql,
+                                                   std::string* rewritten_sql,
+                                                   const char** tail) {
+  rewritten_sql->clear();
+
+  const char* p = SkipWhitespaceAndComments(sql);
+  if (!ConsumeKeyword(&p, "CREATE") || !ConsumeKeyword(&p, "PERFETTO"))
+    return base::OkStatus();
+  if (!ConsumeKeyword(&p, "TABLE"))
+    return base::ErrStatus("CREATE PERFETTO: expected TABLE");
+
+  const char* name_start = p;
+  while (IsIdentifierChar(*p))
+    ++p;
+  if (p == name_start)
+    return base::ErrStatus("CREATE PERFETTO TABLE: expected table name");
+  std::string name(name_start, p);
+  p = SkipWhitespaceAndComments(p);
+  if (!ConsumeKeyword(&p, "AS")) {
+    return base::ErrStatus("CREATE PERFETTO TABLE %s: expected AS",
+                           name.c_str());
+  }
+
+  // Let SQLite find the end of the SELECT statement. This also checks that
+  // the statement is valid before it gets quoted in the rewritten SQL.
+  ScopedStmt stmt;
+  const char* select_tail = nullptr;
+  RETURN_IF_ERROR(sqlite_utils::PrepareStmt(db, p, &stmt, &select_tail));
+  if (!stmt) {
+    return base::ErrStatus("CREATE PERFETTO TABLE %s: expected SELECT",
+                           name.c_str());
+  }
+  std::string select(p, select_tail);
+  while (!select.empty() &&
+         (select.back() == ';' ||
+          isspace(static_cast<unsigned char>(select.back())))) {
+    select.pop_back();
+  }
+
+  ScopedSqliteString rewritten(
+      sqlite3_mprintf("SELECT CREATE_PERFETTO_TABLE(%Q, %Q)", name.c_str(),
+                      select.c_str()));
+  *rewritten_sql = rewritten.get();
+  *tail = select_tail;
+  return base::OkStatus();
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
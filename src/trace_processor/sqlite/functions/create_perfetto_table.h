@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_SQLITE_FUNCTIONS_CREATE_PERFETTO_TABLE_H_
+#define SRC_TRACE_PROCESSOR_SQLITE_FUNCTIONS_CREATE_PERFETTO_TABLE_H_
+
+#include <sqlite3.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/runtime_table.h"
+#include "src/trace_processor/sqlite/functions/register_function.h"
+#include "src/trace_processor/sqlite/query_cache.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Implementation of the CREATE_PERFETTO_TABLE SQL function and of the
+// CREATE PERFETTO TABLE statement:
+//   CREATE PERFETTO TABLE foo AS SELECT ...
+// which is rewritten to a call to the function before being executed (see
+// RewriteStatement()).
+//
+// The SELECT statement is run once and its result stored in a RuntimeTable,
+// which is then queried like any other db table: unlike a SQLite table
+// created with CREATE TABLE ... AS SELECT, the data is stored in columns with
+// inferred types and sortedness and constraints are pushed down to the db
+// layer by DbSqliteTable.
+struct CreatePerfettoTable : public SqlFunction {
+  using Tables =
+      std::unordered_map<std::string, std::unique_ptr<RuntimeTable>>;
+
+  struct Context {
+    sqlite3* db;
+    QueryCache* cache;
+    StringPool* pool;
+    // Owns the tables created by the function.
+    Tables* tables;
+  };
+
+  static constexpr bool kVoidReturn = true;
+
+  static base::Status Run(Context* ctx,
+                          size_t argc,
+                          sqlite3_value** argv,
+                          SqlValue& out,
+                          Destructors&);
+
+  // If the first statement in |sql| is a CREATE PERFETTO TABLE statement,
+  // sets |rewritten_sql| to the equivalent call to CREATE_PERFETTO_TABLE and
+  // |tail| to the end of the statement in |sql|. Otherwise, clears
+  // |rewritten_sql|.
+  static base::Status RewriteStatement(sqlite3* db,
+                                       const char* sql,
+                                       std::string* rewritten_sql,
+                                       const char** tail);
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_SQLITE_FUNCTIONS_CREATE_PERFETTO_TABLE_H_
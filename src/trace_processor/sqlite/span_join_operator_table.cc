@@ -23,10 +23,12 @@
 #include <set>
 #include <utility>
 
+#include "perfetto/base/compiler.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/string_view.h"
+#include "src/trace_processor/dynamic/intervals_overlapping_generator.h"
 #include "src/trace_processor/sqlite/sqlite_utils.h"
 #include "src/trace_processor/tp_metatrace.h"
 #include "src/trace_processor/util/status_macros.h"
@@ -73,52 +75,84 @@ std::string OpToString(int op) {
     case SQLITE_INDEX_CONSTRAINT_GLOB:
       return " glob ";
     case SQLITE_INDEX_CONSTRAINT_ISNULL:
-      // The "null" will be added below in EscapedSqliteValueAsString.
+      // The "null" will be added below in EscapedSqlValueAsString.
       return " is ";
     case SQLITE_INDEX_CONSTRAINT_ISNOTNULL:
-      // The "null" will be added below in EscapedSqliteValueAsString.
+      // The "null" will be added below in EscapedSqlValueAsString.
       return " is not ";
     default:
       PERFETTO_FATAL("Operator to string conversion not impemented for %d", op);
   }
 }
 
-std::string EscapedSqliteValueAsString(sqlite3_value* value) {
-  switch (sqlite3_value_type(value)) {
-    case SQLITE_INTEGER:
-      return std::to_string(sqlite3_value_int64(value));
-    case SQLITE_FLOAT:
-      return std::to_string(sqlite3_value_double(value));
-    case SQLITE_TEXT: {
+std::string EscapedSqlValueAsString(const SqlValue& value) {
+  switch (value.type) {
+    case SqlValue::Type::kLong:
+      return std::to_string(value.AsLong());
+    case SqlValue::Type::kDouble:
+      return std::to_string(value.AsDouble());
+    case SqlValue::Type::kString:
       // If str itself contains a single quote, we need to escape it with
       // another single quote.
-      const char* str =
-          reinterpret_cast<const char*>(sqlite3_value_text(value));
-      return "'" + base::ReplaceAll(str, "'", "''") + "'";
-    }
-    case SQLITE_NULL:
+      return "'" + base::ReplaceAll(value.AsString(), "'", "''") + "'";
+    case SqlValue::Type::kNull:
       return " null";
+    case SqlValue::Type::kBytes:
+      PERFETTO_FATAL("Unknown value type %d", static_cast<int>(value.type));
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+base::Optional<FilterOp> SqliteOpToFilterOp(int op) {
+  switch (op) {
+    case SQLITE_INDEX_CONSTRAINT_EQ:
+      return FilterOp::kEq;
+    case SQLITE_INDEX_CONSTRAINT_NE:
+      return FilterOp::kNe;
+    case SQLITE_INDEX_CONSTRAINT_GE:
+      return FilterOp::kGe;
+    case SQLITE_INDEX_CONSTRAINT_GT:
+      return FilterOp::kGt;
+    case SQLITE_INDEX_CONSTRAINT_LE:
+      return FilterOp::kLe;
+    case SQLITE_INDEX_CONSTRAINT_LT:
+      return FilterOp::kLt;
+    case SQLITE_INDEX_CONSTRAINT_GLOB:
+      return FilterOp::kGlob;
+    case SQLITE_INDEX_CONSTRAINT_ISNULL:
+      return FilterOp::kIsNull;
+    case SQLITE_INDEX_CONSTRAINT_ISNOTNULL:
+      return FilterOp::kIsNotNull;
     default:
-      PERFETTO_FATAL("Unknown value type %d", sqlite3_value_type(value));
+      return base::nullopt;
   }
 }
 
 }  // namespace
 
-SpanJoinOperatorTable::SpanJoinOperatorTable(sqlite3* db, const TraceStorage*)
-    : db_(db) {}
+#if !PERFETTO_IS_AT_LEAST_CPP17()
+// static
+constexpr uint32_t SpanJoinOperatorTable::kNativeEndColumn;
+#endif
+
+SpanJoinOperatorTable::SpanJoinOperatorTable(
+    sqlite3* db,
+    IntervalsOverlappingGenerator* intervals)
+    : db_(db), intervals_(intervals) {}
 
-void SpanJoinOperatorTable::RegisterTable(sqlite3* db,
-                                          const TraceStorage* storage) {
-  SqliteTable::Register<SpanJoinOperatorTable>(db, storage, "span_join",
+void SpanJoinOperatorTable::RegisterTable(
+    sqlite3* db,
+    IntervalsOverlappingGenerator* intervals) {
+  SqliteTable::Register<SpanJoinOperatorTable>(db, intervals, "span_join",
                                                /* read_write */ false,
                                                /* requires_args */ true);
 
-  SqliteTable::Register<SpanJoinOperatorTable>(db, storage, "span_left_join",
+  SqliteTable::Register<SpanJoinOperatorTable>(db, intervals, "span_left_join",
                                                /* read_write */ false,
                                                /* requires_args */ true);
 
-  SqliteTable::Register<SpanJoinOperatorTable>(db, storage, "span_outer_join",
+  SqliteTable::Register<SpanJoinOperatorTable>(db, intervals,
+                                               "span_outer_join",
                                                /* read_write */ false,
                                                /* requires_args */ true);
 }
@@ -175,6 +209,7 @@ util::Status SpanJoinOperatorTable::Init(int argc,
   status = CreateTableDefinition(t1_desc, t1_shadow_type, &t1_defn_);
   if (!status.ok())
     return status;
+  MaybeSetNativeTable(&t1_defn_);
 
   EmitShadowType t2_shadow_type;
   if (IsOuterJoin() || IsLeftJoin()) {
@@ -189,6 +224,7 @@ util::Status SpanJoinOperatorTable::Init(int argc,
   status = CreateTableDefinition(t2_desc, t2_shadow_type, &t2_defn_);
   if (!status.ok())
     return status;
+  MaybeSetNativeTable(&t2_defn_);
 
   std::vector<SqliteTable::Column> cols;
   // Ensure the shared columns are consistently ordered and are not
@@ -290,12 +326,12 @@ int SpanJoinOperatorTable::FindFunction(const char* name,
   return 0;
 }
 
-std::vector<std::string>
-SpanJoinOperatorTable::ComputeSqlConstraintsForDefinition(
+std::vector<SpanJoinOperatorTable::ChildConstraint>
+SpanJoinOperatorTable::ComputeConstraintsForDefinition(
     const TableDefinition& defn,
     const QueryConstraints& qc,
     sqlite3_value** argv) {
-  std::vector<std::string> constraints;
+  std::vector<ChildConstraint> constraints;
   for (size_t i = 0; i < qc.constraints().size(); i++) {
     const auto& cs = qc.constraints()[i];
     auto col_name = GetNameForGlobalColumnIndex(defn, cs.column);
@@ -307,8 +343,23 @@ SpanJoinOperatorTable::ComputeSqlConstraintsForDefinition(
     // explicitly request that they are passed as geq constraints to the source
     // tables.
     if (col_name == kTsColumnName && !sqlite_utils::IsOpLe(cs.op) &&
-        cs.op != kSourceGeqOpCode)
+        cs.op != kSourceGeqOpCode) {
+      // Ge and Gt constraints cannot be passed as is because spans starting
+      // before the bound can still overlap it. However, spans ending before
+      // the bound cannot be part of the output so, if we know how long the
+      // spans of the child table can be, we can skip most of them.
+      bool is_lower_bound =
+          sqlite_utils::IsOpGe(cs.op) || sqlite_utils::IsOpGt(cs.op);
+      if (is_lower_bound && !defn.ShouldEmitPresentPartitionShadow()) {
+        base::Optional<int64_t> bound =
+            ComputeTsLowerBoundForDefinition(defn, argv[i]);
+        if (bound) {
+          constraints.emplace_back(ChildConstraint{
+              col_name, SQLITE_INDEX_CONSTRAINT_GE, SqlValue::Long(*bound)});
+        }
+      }
       continue;
+    }
 
     // Allow SQLite handle any constraints on duration apart from source_geq
     // constraints.
@@ -320,15 +371,69 @@ SpanJoinOperatorTable::ComputeSqlConstraintsForDefinition(
     if (defn.ShouldEmitPresentPartitionShadow())
       continue;
 
-    auto op = OpToString(cs.op == kSourceGeqOpCode ? SQLITE_INDEX_CONSTRAINT_GE
-                                                   : cs.op);
-    auto value = EscapedSqliteValueAsString(argv[i]);
-
-    constraints.emplace_back("`" + col_name + "`" + op + value);
+    int op = cs.op == kSourceGeqOpCode ? SQLITE_INDEX_CONSTRAINT_GE : cs.op;
+    constraints.emplace_back(ChildConstraint{
+        col_name, op, sqlite_utils::SqliteValueToSqlValue(argv[i])});
   }
   return constraints;
 }
 
+base::Optional<int64_t>
+SpanJoinOperatorTable::ComputeTsLowerBoundForDefinition(
+    const TableDefinition& defn,
+    sqlite3_value* ts) {
+  if (!intervals_ || sqlite3_value_type(ts) != SQLITE_INTEGER)
+    return base::nullopt;
+
+  base::Optional<int64_t> max_dur;
+  if (!intervals_->GetMaxDur(defn.name(), &max_dur).ok() || !max_dur)
+    return base::nullopt;
+
+  // A span ends at or after |ts| only if it starts at or after
+  // |ts| - |max_dur|.
+  int64_t value = sqlite3_value_int64(ts);
+  if (*max_dur > 0 && value < std::numeric_limits<int64_t>::min() + *max_dur)
+    return base::nullopt;
+  if (*max_dur < 0 && value > std::numeric_limits<int64_t>::max() + *max_dur)
+    return base::nullopt;
+  return value - *max_dur;
+}
+
+void SpanJoinOperatorTable::MaybeSetNativeTable(TableDefinition* defn) {
+  if (!intervals_)
+    return;
+  const Table* table = intervals_->FindTable(defn->name());
+  if (!table)
+    return;
+
+  // |defn| can also be a view added with AddView() (e.g. "slice" for
+  // "internal_slice"), which returns the same rows as the table. Only read
+  // the table directly if all the columns of |defn| map to its columns or
+  // are computed from its ts and dur (e.g. "ts_end" for "sched").
+  std::vector<uint32_t> cols;
+  for (const SqliteTable::Column& col : defn->columns()) {
+    base::Optional<uint32_t> idx =
+        intervals_->FindColumn(defn->name(), col.name());
+    if (idx) {
+      cols.push_back(*idx);
+    } else if (intervals_->IsEndColumn(defn->name(), col.name())) {
+      cols.push_back(kNativeEndColumn);
+    } else {
+      return;
+    }
+  }
+  std::vector<uint32_t> int_cols{defn->ts_idx(), defn->dur_idx()};
+  if (defn->IsPartitioned())
+    int_cols.push_back(defn->partition_idx());
+  for (uint32_t col : int_cols) {
+    if (cols[col] == kNativeEndColumn ||
+        table->GetColumn(cols[col]).type() != SqlValue::Type::kLong) {
+      return;
+    }
+  }
+  defn->SetNativeTable(table, std::move(cols));
+}
+
 util::Status SpanJoinOperatorTable::CreateTableDefinition(
     const TableDescriptor& desc,
     EmitShadowType emit_shadow_type,
@@ -616,8 +721,10 @@ util::Status SpanJoinOperatorTable::Query::Initialize(
     sqlite3_value** argv,
     InitialEofBehavior eof_behavior) {
   *this = Query(table_, definition(), db_);
-  sql_query_ = CreateSqlQuery(
-      table_->ComputeSqlConstraintsForDefinition(*defn_, qc, argv));
+  std::vector<ChildConstraint> cs =
+      table_->ComputeConstraintsForDefinition(*defn_, qc, argv);
+  if (!defn_->native_table() || !CreateNativeRows(cs))
+    sql_query_ = CreateSqlQuery(cs);
   util::Status status = Rewind();
   if (!status.ok())
     return status;
@@ -740,6 +847,12 @@ util::Status SpanJoinOperatorTable::Query::NextSliceState() {
 }
 
 util::Status SpanJoinOperatorTable::Query::Rewind() {
+  if (native_rows_) {
+    native_it_ = native_rows_->IterateRows();
+    cursor_eof_ = !*native_it_;
+    return StartFromCursor();
+  }
+
   sqlite3_stmt* stmt = nullptr;
   int res =
       sqlite3_prepare_v2(db_, sql_query_.c_str(),
@@ -754,7 +867,10 @@ util::Status SpanJoinOperatorTable::Query::Rewind() {
                   .c_message());
 
   RETURN_IF_ERROR(CursorNext());
+  return StartFromCursor();
+}
 
+util::Status SpanJoinOperatorTable::Query::StartFromCursor() {
   // Setup the first slice as a missing partition shadow from the lowest
   // partition until the first slice partition. We will handle finding the real
   // slice in |FindNextValidSlice()|.
@@ -776,6 +892,13 @@ util::Status SpanJoinOperatorTable::Query::Rewind() {
 }
 
 util::Status SpanJoinOperatorTable::Query::CursorNext() {
+  if (native_it_) {
+    // Rows with null partitions were already filtered out.
+    native_it_->Next();
+    cursor_eof_ = !*native_it_;
+    return util::OkStatus();
+  }
+
   auto* stmt = stmt_.get();
   int res;
   if (defn_->IsPartitioned()) {
@@ -800,16 +923,22 @@ util::Status SpanJoinOperatorTable::Query::CursorNext() {
 }
 
 std::string SpanJoinOperatorTable::Query::CreateSqlQuery(
-    const std::vector<std::string>& cs) const {
+    const std::vector<ChildConstraint>& cs) const {
   std::vector<std::string> col_names;
   for (const SqliteTable::Column& c : defn_->columns()) {
     col_names.push_back("`" + c.name() + "`");
   }
 
+  std::vector<std::string> constraints;
+  for (const ChildConstraint& c : cs) {
+    constraints.push_back("`" + c.col_name + "`" + OpToString(c.op) +
+                          EscapedSqlValueAsString(c.value));
+  }
+
   std::string sql = "SELECT " + base::Join(col_names, ", ");
   sql += " FROM " + defn_->name();
-  if (!cs.empty()) {
-    sql += " WHERE " + base::Join(cs, " AND ");
+  if (!constraints.empty()) {
+    sql += " WHERE " + base::Join(constraints, " AND ");
   }
   sql += " ORDER BY ";
   sql += defn_->IsPartitioned()
@@ -820,6 +949,44 @@ std::string SpanJoinOperatorTable::Query::CreateSqlQuery(
   return sql;
 }
 
+bool SpanJoinOperatorTable::Query::CreateNativeRows(
+    const std::vector<ChildConstraint>& cs) {
+  const Table& table = *defn_->native_table();
+  std::vector<Constraint> constraints;
+  const std::vector<SqliteTable::Column>& cols = defn_->columns();
+  for (const ChildConstraint& c : cs) {
+    auto col = std::find_if(cols.begin(), cols.end(),
+                            [&c](const SqliteTable::Column& column) {
+                              return column.name() == c.col_name;
+                            });
+    base::Optional<FilterOp> op = SqliteOpToFilterOp(c.op);
+    if (col == cols.end() || !op)
+      return false;
+    size_t i = static_cast<size_t>(col - cols.begin());
+    if (defn_->native_cols()[i] == kNativeEndColumn)
+      return false;
+    constraints.push_back(Constraint{defn_->native_cols()[i], *op, c.value});
+  }
+
+  // Same as the ORDER BY of the SQL query; rows with null partitions are
+  // skipped by CursorNext() so filter them out upfront.
+  std::vector<Order> orders;
+  if (defn_->IsPartitioned()) {
+    uint32_t partition = defn_->native_cols()[defn_->partition_idx()];
+    constraints.push_back(
+        Constraint{partition, FilterOp::kIsNotNull, SqlValue()});
+    orders.push_back(Order{partition, false});
+  }
+  orders.push_back(Order{defn_->native_cols()[defn_->ts_idx()], false});
+
+  PERFETTO_TP_TRACE(metatrace::Category::QUERY, "SPAN_JOIN_NATIVE_ROWS",
+                    [this](metatrace::Record* r) {
+                      r->AddArg("Table", defn_->name());
+                    });
+  native_rows_.reset(new Table(table.Filter(constraints).Sort(orders)));
+  return true;
+}
+
 void SpanJoinOperatorTable::Query::ReportSqliteResult(sqlite3_context* context,
                                                       size_t index) {
   if (state_ != State::kReal) {
@@ -827,6 +994,14 @@ void SpanJoinOperatorTable::Query::ReportSqliteResult(sqlite3_context* context,
     return;
   }
 
+  if (native_it_) {
+    // Strings are owned by the string pool so don't need to be copied.
+    sqlite_utils::ReportSqlValue(context, NativeCursorValue(
+                                              static_cast<uint32_t>(index)),
+                                 sqlite_utils::kSqliteStatic);
+    return;
+  }
+
   sqlite3_stmt* stmt = stmt_.get();
   int idx = static_cast<int>(index);
   switch (sqlite3_column_type(stmt, idx)) {
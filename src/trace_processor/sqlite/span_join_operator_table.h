@@ -30,12 +30,15 @@
 #include "perfetto/ext/base/flat_hash_map.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/status.h"
+#include "src/trace_processor/db/table.h"
 #include "src/trace_processor/sqlite/scoped_db.h"
 #include "src/trace_processor/sqlite/sqlite_table.h"
 
 namespace perfetto {
 namespace trace_processor {
 
+class IntervalsOverlappingGenerator;
+
 // Implements the SPAN JOIN operation between two tables on a particular column.
 //
 // Span:
@@ -120,6 +123,19 @@ class SpanJoinOperatorTable : public SqliteTable {
     uint32_t dur_idx() const { return dur_idx_; }
     uint32_t partition_idx() const { return partition_idx_; }
 
+    // Returns the db table with the rows of this table if they can be read
+    // directly rather than by querying SQLite or nullptr otherwise.
+    const Table* native_table() const { return native_table_; }
+
+    // Returns the index in |native_table()| of each column in |columns()|,
+    // or kNativeEndColumn for the columns computed as ts + dur.
+    const std::vector<uint32_t>& native_cols() const { return native_cols_; }
+
+    void SetNativeTable(const Table* table, std::vector<uint32_t> cols) {
+      native_table_ = table;
+      native_cols_ = std::move(cols);
+    }
+
    private:
     EmitShadowType emit_shadow_type_ = EmitShadowType::kNone;
 
@@ -130,6 +146,24 @@ class SpanJoinOperatorTable : public SqliteTable {
     uint32_t ts_idx_ = std::numeric_limits<uint32_t>::max();
     uint32_t dur_idx_ = std::numeric_limits<uint32_t>::max();
     uint32_t partition_idx_ = std::numeric_limits<uint32_t>::max();
+
+    const Table* native_table_ = nullptr;
+    std::vector<uint32_t> native_cols_;
+  };
+
+  // Value of TableDefinition::native_cols() for the columns of a native table
+  // which are computed as ts + dur (e.g. "ts_end" of "sched").
+  static constexpr uint32_t kNativeEndColumn =
+      std::numeric_limits<uint32_t>::max();
+
+  // A constraint on the span join which can be passed to a child table.
+  struct ChildConstraint {
+    std::string col_name;
+    // The SQLite constraint operator (SQLITE_INDEX_CONSTRAINT_*).
+    int op;
+    // Strings point to the arguments of xFilter so this is only valid while
+    // the cursor is being filtered.
+    SqlValue value;
   };
 
   // Stores information about a single subquery into one of the two child
@@ -250,8 +284,39 @@ class SpanJoinOperatorTable : public SqliteTable {
     // Forwards the cursor to point to the next real slice.
     util::Status CursorNext();
 
-    // Creates an SQL query from the given set of constraint strings.
-    std::string CreateSqlQuery(const std::vector<std::string>& cs) const;
+    // Sets up the state machine after the cursor was moved to the first row.
+    util::Status StartFromCursor();
+
+    // Creates an SQL query from the given set of constraints.
+    std::string CreateSqlQuery(const std::vector<ChildConstraint>& cs) const;
+
+    // Filters and sorts the rows of the native table of the definition
+    // using the given set of constraints. Returns false if the constraints
+    // cannot be applied to the native table (in which case the SQL query
+    // should be used instead).
+    bool CreateNativeRows(const std::vector<ChildConstraint>& cs);
+
+    // Returns the value of the column |idx| of the definition at the current
+    // row of |native_it_|.
+    SqlValue NativeCursorValue(uint32_t idx) const {
+      uint32_t col = defn_->native_cols()[idx];
+      if (col != kNativeEndColumn)
+        return native_it_->Get(col);
+      // Like ts + dur in SQLite, null if either of them is.
+      SqlValue ts = native_it_->Get(defn_->native_cols()[defn_->ts_idx()]);
+      SqlValue dur = native_it_->Get(defn_->native_cols()[defn_->dur_idx()]);
+      if (ts.is_null() || dur.is_null())
+        return SqlValue();
+      return SqlValue::Long(ts.AsLong() + dur.AsLong());
+    }
+
+    // Returns the value of the integer column |idx| of the definition at the
+    // current row of |native_it_| where null is returned as zero like
+    // sqlite3_column_int64 does.
+    int64_t NativeCursorLong(uint32_t idx) const {
+      SqlValue value = NativeCursorValue(idx);
+      return value.is_null() ? 0 : value.AsLong();
+    }
 
     // Returns whether the current slice pointed to is a present partition
     // shadow.
@@ -275,12 +340,16 @@ class SpanJoinOperatorTable : public SqliteTable {
 
     int64_t CursorTs() const {
       PERFETTO_DCHECK(!cursor_eof_);
+      if (native_it_)
+        return NativeCursorLong(defn_->ts_idx());
       auto ts_idx = static_cast<int>(defn_->ts_idx());
       return sqlite3_column_int64(stmt_.get(), ts_idx);
     }
 
     int64_t CursorDur() const {
       PERFETTO_DCHECK(!cursor_eof_);
+      if (native_it_)
+        return NativeCursorLong(defn_->dur_idx());
       auto dur_idx = static_cast<int>(defn_->dur_idx());
       return sqlite3_column_int64(stmt_.get(), dur_idx);
     }
@@ -288,6 +357,8 @@ class SpanJoinOperatorTable : public SqliteTable {
     int64_t CursorPartition() const {
       PERFETTO_DCHECK(!cursor_eof_);
       PERFETTO_DCHECK(defn_->IsPartitioned());
+      if (native_it_)
+        return NativeCursorLong(defn_->partition_idx());
       auto partition_idx = static_cast<int>(defn_->partition_idx());
       return sqlite3_column_int64(stmt_.get(), partition_idx);
     }
@@ -309,6 +380,12 @@ class SpanJoinOperatorTable : public SqliteTable {
     std::string sql_query_;
     ScopedStmt stmt_;
 
+    // Only set if the rows are read from the native table of the definition
+    // instead of |stmt_|. |native_rows_| is heap allocated so its address
+    // doesn't change when the query is moved, as |native_it_| points to it.
+    std::unique_ptr<Table> native_rows_;
+    base::Optional<Table::Iterator> native_it_;
+
     const TableDefinition* defn_ = nullptr;
     sqlite3* db_ = nullptr;
     SpanJoinOperatorTable* table_ = nullptr;
@@ -368,9 +445,12 @@ class SpanJoinOperatorTable : public SqliteTable {
     SpanJoinOperatorTable* table_;
   };
 
-  SpanJoinOperatorTable(sqlite3*, const TraceStorage*);
+  SpanJoinOperatorTable(sqlite3*, IntervalsOverlappingGenerator*);
 
-  static void RegisterTable(sqlite3* db, const TraceStorage* storage);
+  // |intervals| is used to push down lower bounds on ts to the child tables
+  // which are db tables; it can be null.
+  static void RegisterTable(sqlite3* db,
+                            IntervalsOverlappingGenerator* intervals);
 
   // Table implementation.
   util::Status Init(int, const char* const*, SqliteTable::Schema*) override;
@@ -429,11 +509,21 @@ class SpanJoinOperatorTable : public SqliteTable {
       EmitShadowType emit_shadow_type,
       SpanJoinOperatorTable::TableDefinition* defn);
 
-  std::vector<std::string> ComputeSqlConstraintsForDefinition(
+  std::vector<ChildConstraint> ComputeConstraintsForDefinition(
       const TableDefinition& defn,
       const QueryConstraints& qc,
       sqlite3_value** argv);
 
+  // Returns a lower bound on the ts of the spans of |defn| which end at or
+  // after |ts|, if one can be computed.
+  base::Optional<int64_t> ComputeTsLowerBoundForDefinition(
+      const TableDefinition& defn,
+      sqlite3_value* ts);
+
+  // Sets the native table of |defn| if its rows can be read directly from a
+  // db table.
+  void MaybeSetNativeTable(TableDefinition* defn);
+
   std::string GetNameForGlobalColumnIndex(const TableDefinition& defn,
                                           int global_column);
 
@@ -446,6 +536,7 @@ class SpanJoinOperatorTable : public SqliteTable {
   base::FlatHashMap<size_t, ColumnLocator> global_index_to_column_locator_;
 
   sqlite3* const db_;
+  IntervalsOverlappingGenerator* const intervals_;
 };
 
 }  // namespace trace_processor
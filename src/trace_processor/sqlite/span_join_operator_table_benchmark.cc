@@ -0,0 +1,161 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark for SPAN_JOIN between a synthetic sched table and a synthetic
+// counter table (e.g. cpu frequency) both partitioned by cpu. The same join is
+// run both on the db tables directly and on views of them, which forces the
+// span join to read its children through SQLite.
+
+#include <random>
+
+#include <benchmark/benchmark.h>
+#include <sqlite3.h>
+
+#include "src/trace_processor/db/runtime_table.h"
+#include "src/trace_processor/dynamic/intervals_overlapping_generator.h"
+#include "src/trace_processor/sqlite/db_sqlite_table.h"
+#include "src/trace_processor/sqlite/query_cache.h"
+#include "src/trace_processor/sqlite/scoped_db.h"
+#include "src/trace_processor/sqlite/span_join_operator_table.h"
+
+namespace {
+
+using benchmark::Counter;
+using perfetto::trace_processor::DbSqliteTable;
+using perfetto::trace_processor::DynamicTableGenerator;
+using perfetto::trace_processor::IntervalsOverlappingGenerator;
+using perfetto::trace_processor::QueryCache;
+using perfetto::trace_processor::RuntimeTable;
+using perfetto::trace_processor::ScopedDb;
+using perfetto::trace_processor::ScopedStmt;
+using perfetto::trace_processor::SpanJoinOperatorTable;
+using perfetto::trace_processor::SqlValue;
+using perfetto::trace_processor::StringPool;
+
+static constexpr uint32_t kCpus = 8;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+void SpanJoinBenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Ranges({{1024, 1024}});
+  } else {
+    b->RangeMultiplier(4)->Ranges({{1024, 1024 * 256}});
+  }
+}
+
+// Creates a table with |size| back-to-back intervals split between |kCpus|
+// cpus with durations up to |max_dur| and a random |value_col| column.
+std::unique_ptr<RuntimeTable> CreateIntervalTable(StringPool* pool,
+                                                  const char* value_col,
+                                                  uint32_t size,
+                                                  uint32_t max_dur,
+                                                  uint32_t seed) {
+  std::minstd_rand0 rnd_engine(seed);
+  std::unique_ptr<RuntimeTable> table(
+      new RuntimeTable(pool, {"ts", "dur", "cpu", value_col}));
+  int64_t ts[kCpus] = {};
+  for (uint32_t i = 0; i < size; ++i) {
+    uint32_t cpu = rnd_engine() % kCpus;
+    int64_t dur = 1 + static_cast<int64_t>(rnd_engine() % max_dur);
+    PERFETTO_CHECK(table
+                       ->AddRow({SqlValue::Long(ts[cpu]), SqlValue::Long(dur),
+                                 SqlValue::Long(cpu),
+                                 SqlValue::Long(rnd_engine() % 1000)})
+                       .ok());
+    ts[cpu] += dur;
+  }
+  PERFETTO_CHECK(table->Finalize().ok());
+  return table;
+}
+
+void BenchmarkSpanJoin(benchmark::State& state, bool native) {
+  uint32_t size = static_cast<uint32_t>(state.range(0));
+
+  // The tables and the cache need to outlive the ScopedDb.
+  StringPool pool;
+  std::unique_ptr<RuntimeTable> sched =
+      CreateIntervalTable(&pool, "utid", size, 10000, 476);
+  std::unique_ptr<RuntimeTable> counter =
+      CreateIntervalTable(&pool, "value", size / 4, 40000, 477);
+  QueryCache cache;
+
+  sqlite3_initialize();
+  ScopedDb db;
+  sqlite3* raw_db = nullptr;
+  PERFETTO_CHECK(sqlite3_open(":memory:", &raw_db) == SQLITE_OK);
+  db.reset(raw_db);
+  sqlite3_exec(*db, "CREATE TABLE perfetto_tables(name STRING)", nullptr,
+               nullptr, nullptr);
+
+  auto* intervals = new IntervalsOverlappingGenerator(&pool);
+  intervals->AddTable("sched", sched.get());
+  intervals->AddTable("counter", counter.get());
+  DbSqliteTable::RegisterTable(*db, &cache, sched->schema(), sched.get(),
+                               "sched");
+  DbSqliteTable::RegisterTable(*db, &cache, counter->schema(), counter.get(),
+                               "counter");
+  DbSqliteTable::RegisterTable(
+      *db, &cache, std::unique_ptr<DynamicTableGenerator>(intervals));
+  SpanJoinOperatorTable::RegisterTable(*db, intervals);
+
+  std::string sql =
+      native ? "CREATE VIRTUAL TABLE sp USING "
+               "SPAN_JOIN(sched PARTITIONED cpu, counter PARTITIONED cpu);"
+             : "CREATE VIEW sched_view AS SELECT * FROM sched;"
+               "CREATE VIEW counter_view AS SELECT * FROM counter;"
+               "CREATE VIRTUAL TABLE sp USING SPAN_JOIN("
+               "sched_view PARTITIONED cpu, counter_view PARTITIONED cpu);";
+  PERFETTO_CHECK(sqlite3_exec(*db, sql.c_str(), nullptr, nullptr, nullptr) ==
+                 SQLITE_OK);
+
+  ScopedStmt stmt;
+  sqlite3_stmt* raw_stmt;
+  std::string query = "SELECT ts, dur, cpu FROM sp";
+  int err = sqlite3_prepare_v2(*db, query.c_str(),
+                               static_cast<int>(query.size()), &raw_stmt,
+                               nullptr);
+  PERFETTO_CHECK(err == SQLITE_OK);
+  stmt.reset(raw_stmt);
+
+  for (auto _ : state) {
+    sqlite3_reset(raw_stmt);
+    while (sqlite3_step(*stmt) == SQLITE_ROW) {
+      for (int i = 0; i < 3; ++i)
+        benchmark::DoNotOptimize(sqlite3_column_int64(*stmt, i));
+    }
+  }
+
+  state.counters["s/row"] =
+      Counter(static_cast<double>(size),
+              Counter::kIsIterationInvariantRate | Counter::kInvert);
+}
+
+// Span join which reads both children directly from the db tables.
+static void BM_SpanJoinNative(benchmark::State& state) {
+  BenchmarkSpanJoin(state, true);
+}
+
+BENCHMARK(BM_SpanJoinNative)->Apply(SpanJoinBenchmarkArgs);
+
+// Span join which reads both children by running a query on SQLite.
+static void BM_SpanJoinSql(benchmark::State& state) {
+  BenchmarkSpanJoin(state, false);
+}
+
+BENCHMARK(BM_SpanJoinSql)->Apply(SpanJoinBenchmarkArgs);
+
+}  // namespace
@@ -16,12 +16,20 @@
 
 #include "src/trace_processor/sqlite/span_join_operator_table.h"
 
+#include <random>
+
+#include "src/trace_processor/db/runtime_table.h"
+#include "src/trace_processor/dynamic/intervals_overlapping_generator.h"
+#include "src/trace_processor/sqlite/db_sqlite_table.h"
+#include "src/trace_processor/sqlite/query_cache.h"
 #include "test/gtest_and_gmock.h"
 
 namespace perfetto {
 namespace trace_processor {
 namespace {
 
+using testing::ElementsAre;
+
 class SpanJoinOperatorTableTest : public ::testing::Test {
  public:
   SpanJoinOperatorTableTest() {
@@ -340,6 +348,237 @@ TEST_F(SpanJoinOperatorTableTest, LeftJoinTwoSpanTables_EmptyRight) {
   ASSERT_EQ(sqlite3_step(stmt_.get()), SQLITE_DONE);
 }
 
+struct Span {
+  int64_t ts;
+  int64_t dur;
+  int64_t part;
+  int64_t value;
+};
+
+// Span joins db tables, which are read directly by the operator, or views of
+// them, which are read through SQLite.
+class SpanJoinOperatorTableNativeTest : public ::testing::Test {
+ public:
+  SpanJoinOperatorTableNativeTest() : intervals_(&pool_) {
+    sqlite3* db = nullptr;
+    PERFETTO_CHECK(sqlite3_initialize() == SQLITE_OK);
+    PERFETTO_CHECK(sqlite3_open(":memory:", &db) == SQLITE_OK);
+    db_.reset(db);
+    RunStatement("CREATE TABLE perfetto_tables(name STRING)");
+
+    SpanJoinOperatorTable::RegisterTable(db_.get(), &intervals_);
+  }
+
+  // Creates the db table |name|, with the columns ts, dur, |part_col| and
+  // |value_col|, and the view "|name|_view" of it.
+  void CreateTable(const std::string& name,
+                   const std::string& part_col,
+                   const std::string& value_col,
+                   const std::vector<Span>& spans) {
+    std::unique_ptr<RuntimeTable> table(
+        new RuntimeTable(&pool_, {"ts", "dur", part_col, value_col}));
+    for (const Span& span : spans) {
+      ASSERT_TRUE(table
+                      ->AddRow({SqlValue::Long(span.ts),
+                                SqlValue::Long(span.dur),
+                                SqlValue::Long(span.part),
+                                SqlValue::Long(span.value)})
+                      .ok());
+    }
+    ASSERT_TRUE(table->Finalize().ok());
+    DbSqliteTable::RegisterTable(*db_, &cache_, table->schema(), table.get(),
+                                 name);
+    intervals_.AddTable(name, table.get());
+    tables_.push_back(std::move(table));
+    RunStatement("CREATE VIEW " + name + "_view AS SELECT * FROM " + name);
+  }
+
+  void RunStatement(const std::string& sql) {
+    int ret = sqlite3_exec(*db_, sql.c_str(), nullptr, nullptr, nullptr);
+    ASSERT_EQ(ret, SQLITE_OK) << sql << ": " << sqlite3_errmsg(*db_);
+  }
+
+  // Returns the rows returned by |sql|, with the columns separated by spaces.
+  std::vector<std::string> Query(const std::string& sql) {
+    std::vector<std::string> rows;
+    sqlite3_stmt* raw_stmt = nullptr;
+    int ret = sqlite3_prepare_v2(*db_, sql.c_str(),
+                                 static_cast<int>(sql.size()), &raw_stmt,
+                                 nullptr);
+    EXPECT_EQ(ret, SQLITE_OK) << sql << ": " << sqlite3_errmsg(*db_);
+    ScopedStmt stmt(raw_stmt);
+    while ((ret = sqlite3_step(*stmt)) == SQLITE_ROW) {
+      std::string row;
+      for (int i = 0; i < sqlite3_column_count(*stmt); ++i) {
+        const unsigned char* text = sqlite3_column_text(*stmt, i);
+        row += i == 0 ? "" : " ";
+        row += text ? reinterpret_cast<const char*>(text) : "NULL";
+      }
+      rows.push_back(row);
+    }
+    EXPECT_EQ(ret, SQLITE_DONE) << sql << ": " << sqlite3_errmsg(*db_);
+    return rows;
+  }
+
+  // Checks that the span join of type |join| (e.g. "SPAN_OUTER_JOIN") of
+  // |t1| and |t2| (e.g. "f PARTITIONED part") returns the same rows when
+  // reading the db tables directly as when reading their views.
+  void ExpectNativeMatchesSql(const std::string& join,
+                              const std::string& t1,
+                              const std::string& t2) {
+    auto view = [](const std::string& t) {
+      size_t end = t.find(' ');
+      return end == std::string::npos ? t + "_view"
+                                      : t.substr(0, end) + "_view" +
+                                            t.substr(end);
+    };
+    std::string native = "sp" + std::to_string(span_joins_++);
+    std::string sql = "sp" + std::to_string(span_joins_++);
+    RunStatement("CREATE VIRTUAL TABLE " + native + " USING " + join + "(" +
+                 t1 + ", " + t2 + ")");
+    RunStatement("CREATE VIRTUAL TABLE " + sql + " USING " + join + "(" +
+                 view(t1) + ", " + view(t2) + ")");
+
+    for (const char* where :
+         {"", " WHERE ts >= 1000", " WHERE ts >= 1000 AND ts < 3000",
+          " WHERE dur > 20"}) {
+      std::vector<std::string> rows = Query("SELECT * FROM " + native + where);
+      EXPECT_FALSE(rows.empty()) << join << where;
+      EXPECT_EQ(rows, Query("SELECT * FROM " + sql + where)) << join << where;
+    }
+  }
+
+  // Returns |count| spans which don't overlap, even across partitions, with
+  // partitions in [first_part, first_part + parts).
+  static std::vector<Span> RandomSpans(uint32_t count,
+                                       int64_t first_part,
+                                       uint32_t parts,
+                                       uint32_t seed) {
+    std::minstd_rand0 rnd_engine(seed);
+    auto rnd = [&rnd_engine](uint32_t max) {
+      return static_cast<int64_t>(rnd_engine() % max);
+    };
+    std::vector<Span> spans;
+    int64_t ts = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+      // Leave gaps between some of the spans.
+      ts += rnd(2) ? 0 : rnd(50);
+      int64_t dur = 1 + rnd(100);
+      spans.push_back(Span{ts, dur, first_part + rnd(parts), rnd(1000)});
+      ts += dur;
+    }
+    return spans;
+  }
+
+ protected:
+  // The tables need to outlive |db_|.
+  StringPool pool_;
+  QueryCache cache_;
+  std::vector<std::unique_ptr<RuntimeTable>> tables_;
+  IntervalsOverlappingGenerator intervals_;
+  ScopedDb db_;
+  uint32_t span_joins_ = 0;
+};
+
+TEST_F(SpanJoinOperatorTableNativeTest, TsLowerBound) {
+  // The first span of f is longer than the others and starts well before the
+  // spans of s it overlaps.
+  CreateTable("f", "part", "f_value",
+              {{0, 1000, 1, 1}, {100, 10, 1, 2}, {500, 10, 2, 3},
+               {900, 50, 2, 4}});
+  CreateTable("s", "part", "s_value",
+              {{700, 100, 1, 5}, {950, 10, 1, 6}, {400, 600, 2, 7}});
+  RunStatement(
+      "CREATE VIRTUAL TABLE sp USING SPAN_JOIN(f PARTITIONED part, "
+      "s PARTITIONED part);"
+      "CREATE VIRTUAL TABLE sp_view USING SPAN_JOIN(f_view PARTITIONED part, "
+      "s_view PARTITIONED part);");
+
+  for (int64_t ts : {0, 600, 700, 701, 905, 2000}) {
+    std::string where = " WHERE ts >= " + std::to_string(ts);
+    std::vector<std::string> rows = Query("SELECT * FROM sp" + where);
+    ASSERT_EQ(rows, Query("SELECT * FROM sp_view" + where)) << where;
+    if (ts == 600) {
+      ASSERT_THAT(rows,
+                  ElementsAre("700 100 1 1 5", "950 10 1 1 6", "900 50 2 4 7"));
+    }
+  }
+}
+
+TEST_F(SpanJoinOperatorTableNativeTest, MatchesSql) {
+  // f and s share partitions 1 to 3, which only appear in one of them
+  // otherwise, so outer joins emit shadow slices of missing partitions as well
+  // as of the gaps between spans. g has the spans of s but a differently
+  // named partition column to be joined with f without partitioning.
+  CreateTable("f", "part", "f_value", RandomSpans(300, 0, 4, 1));
+  CreateTable("s", "part", "s_value", RandomSpans(200, 1, 5, 2));
+  CreateTable("g", "g_part", "g_value", RandomSpans(200, 1, 5, 2));
+
+  for (const char* join : {"SPAN_JOIN", "SPAN_LEFT_JOIN", "SPAN_OUTER_JOIN"}) {
+    ExpectNativeMatchesSql(join, "f PARTITIONED part", "s PARTITIONED part");
+    ExpectNativeMatchesSql(join, "f", "g");
+    ExpectNativeMatchesSql(join, "f PARTITIONED part", "g");
+    ExpectNativeMatchesSql(join, "g", "f PARTITIONED part");
+  }
+}
+
+TEST_F(SpanJoinOperatorTableNativeTest, ViewWithAliases) {
+  CreateTable("f", "part", "f_value", RandomSpans(300, 0, 4, 1));
+  CreateTable("g", "g_part", "g_value", RandomSpans(200, 1, 5, 2));
+
+  // Like the builtin "slice" and "thread" views, which are read from their
+  // table directly once registered with AddView().
+  RunStatement(
+      "CREATE VIEW f_alias AS SELECT *, f_value AS f_copy, part AS cpu FROM f;"
+      "CREATE VIEW f_alias_view AS SELECT * FROM f_alias;");
+  intervals_.AddView("f_alias", tables_[0].get(),
+                     {{"f_copy", "f_value"}, {"cpu", "part"}});
+
+  for (const char* join : {"SPAN_JOIN", "SPAN_LEFT_JOIN", "SPAN_OUTER_JOIN"}) {
+    ExpectNativeMatchesSql(join, "f_alias PARTITIONED cpu", "g");
+    ExpectNativeMatchesSql(join, "f_alias", "g PARTITIONED g_part");
+  }
+}
+
+TEST_F(SpanJoinOperatorTableNativeTest, ViewWithEndColumn) {
+  // f_end is registered with the table h rather than f, which has the spans
+  // of f with other values: the span join of f_end must return the rows of
+  // h_end, which is read through SQLite, to show that it reads the table
+  // directly despite the computed ts_end (like the builtin "sched" view).
+  std::vector<Span> spans = RandomSpans(300, 0, 4, 1);
+  CreateTable("f", "part", "f_value", spans);
+  for (Span& span : spans)
+    span.value += 1000;
+  CreateTable("h", "part", "f_value", spans);
+  CreateTable("g", "g_part", "g_value", RandomSpans(200, 1, 5, 2));
+  RunStatement(
+      "CREATE VIEW f_end AS SELECT *, ts + dur AS ts_end FROM f;"
+      "CREATE VIEW h_end AS SELECT *, ts + dur AS ts_end FROM h;");
+  intervals_.AddView("f_end", tables_[1].get(), {}, {"ts_end"});
+
+  for (const char* join : {"SPAN_JOIN", "SPAN_LEFT_JOIN", "SPAN_OUTER_JOIN"}) {
+    for (const char* tables :
+         {"f_end PARTITIONED part, g", "f_end, g PARTITIONED g_part"}) {
+      std::string native = "sp" + std::to_string(span_joins_++);
+      std::string sql = "sp" + std::to_string(span_joins_++);
+      std::string h_tables = tables;
+      h_tables[0] = 'h';
+      RunStatement("CREATE VIRTUAL TABLE " + native + " USING " + join + "(" +
+                   tables + ")");
+      RunStatement("CREATE VIRTUAL TABLE " + sql + " USING " + join + "(" +
+                   h_tables + ")");
+
+      for (const char* where : {"", " WHERE ts >= 1000"}) {
+        std::vector<std::string> rows =
+            Query("SELECT * FROM " + native + where);
+        EXPECT_FALSE(rows.empty()) << join << where;
+        EXPECT_EQ(rows, Query("SELECT * FROM " + sql + where))
+            << join << where;
+      }
+    }
+  }
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
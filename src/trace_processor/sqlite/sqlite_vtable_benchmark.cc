@@ -26,13 +26,39 @@
 #include <sqlite3.h>
 
 #include "perfetto/base/compiler.h"
+#include "src/trace_processor/db/group_by_aggregator.h"
+#include "src/trace_processor/sqlite/db_sqlite_table.h"
+#include "src/trace_processor/sqlite/query_cache.h"
 #include "src/trace_processor/sqlite/scoped_db.h"
+#include "src/trace_processor/tables/macros.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+#define PERFETTO_TP_BENCHMARK_SCHED_TABLE_DEF(NAME, PARENT, C) \
+  NAME(BenchmarkSchedTable, "benchmark_sched")                 \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                            \
+  C(int64_t, dur)                                              \
+  C(uint32_t, utid)
+PERFETTO_TP_TABLE(PERFETTO_TP_BENCHMARK_SCHED_TABLE_DEF);
+
+BenchmarkSchedTable::~BenchmarkSchedTable() = default;
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
 
 namespace {
 
 using benchmark::Counter;
+using perfetto::trace_processor::BenchmarkSchedTable;
+using perfetto::trace_processor::DbSqliteTable;
+using perfetto::trace_processor::GroupByAggregator;
+using perfetto::trace_processor::QueryCache;
 using perfetto::trace_processor::ScopedDb;
 using perfetto::trace_processor::ScopedStmt;
+using perfetto::trace_processor::StringPool;
 
 bool IsBenchmarkFunctionalOnly() {
   return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
@@ -267,4 +293,106 @@ static void BM_SqliteCountOne(benchmark::State& state) {
 
 BENCHMARK(BM_SqliteCountOne)->Apply(SizeBenchmarkArgs);
 
+void FillSchedTable(BenchmarkSchedTable* table, uint32_t size) {
+  static constexpr uint32_t kRandomSeed = 476;
+  std::minstd_rand0 rnd_engine(kRandomSeed);
+  for (uint32_t i = 0; i < size; ++i) {
+    BenchmarkSchedTable::Row row;
+    row.dur = static_cast<int64_t>(rnd_engine() % 1000000);
+    row.utid = static_cast<uint32_t>(rnd_engine() % 256);
+    table->Insert(row);
+  }
+}
+
+// Runs |sql| on a benchmark_sched table with |state.range(0)| rows going
+// through SQLite and DbSqliteTable, reading all the columns of the result.
+void BenchmarkDbSqliteTableQuery(benchmark::State& state,
+                                 const std::string& sql) {
+  uint32_t size = static_cast<uint32_t>(state.range(0));
+
+  // The table and the cache need to outlive the ScopedDb.
+  StringPool pool;
+  BenchmarkSchedTable table(&pool, nullptr);
+  FillSchedTable(&table, size);
+  QueryCache cache;
+
+  sqlite3_initialize();
+  ScopedDb db;
+  sqlite3* raw_db = nullptr;
+  PERFETTO_CHECK(sqlite3_open(":memory:", &raw_db) == SQLITE_OK);
+  db.reset(raw_db);
+  DbSqliteTable::RegisterTable(*db, &cache, BenchmarkSchedTable::Schema(),
+                               &table, BenchmarkSchedTable::Name());
+
+  ScopedStmt stmt;
+  sqlite3_stmt* raw_stmt;
+  int err = sqlite3_prepare_v2(*db, sql.c_str(), static_cast<int>(sql.size()),
+                               &raw_stmt, nullptr);
+  PERFETTO_CHECK(err == SQLITE_OK);
+  stmt.reset(raw_stmt);
+
+  int col_count = sqlite3_column_count(raw_stmt);
+  for (auto _ : state) {
+    sqlite3_reset(raw_stmt);
+    while (sqlite3_step(*stmt) == SQLITE_ROW) {
+      for (int i = 0; i < col_count; ++i)
+        benchmark::DoNotOptimize(sqlite3_column_int64(*stmt, i));
+    }
+  }
+
+  state.counters["s/row"] =
+      Counter(static_cast<double>(size),
+              Counter::kIsIterationInvariantRate | Counter::kInvert);
+}
+
+// Scans all the rows and columns of a db table.
+static void BM_SqliteFullScan(benchmark::State& state) {
+  BenchmarkDbSqliteTableQuery(state,
+                              "SELECT id, dur, utid FROM benchmark_sched");
+}
+
+BENCHMARK(BM_SqliteFullScan)->Apply(SizeBenchmarkArgs);
+
+// Scans half of the rows of a db table selected by a filter (i.e. the rows are
+// not a range of the table).
+static void BM_SqliteFilteredScan(benchmark::State& state) {
+  BenchmarkDbSqliteTableQuery(
+      state, "SELECT id, dur, utid FROM benchmark_sched WHERE utid < 128");
+}
+
+BENCHMARK(BM_SqliteFilteredScan)->Apply(SizeBenchmarkArgs);
+
+// Computes "SELECT utid, SUM(dur) ... GROUP BY utid" on a db table going
+// through SQLite and DbSqliteTable.
+static void BM_SqliteGroupBySum(benchmark::State& state) {
+  BenchmarkDbSqliteTableQuery(
+      state, "SELECT utid, SUM(dur) FROM benchmark_sched GROUP BY utid");
+}
+
+BENCHMARK(BM_SqliteGroupBySum)->Apply(SizeBenchmarkArgs);
+
+// Computes the same aggregation as BM_SqliteGroupBySum directly on the
+// storage of the table (i.e. what experimental_group_by does).
+static void BM_DbGroupBySum(benchmark::State& state) {
+  uint32_t size = static_cast<uint32_t>(state.range(0));
+
+  StringPool pool;
+  BenchmarkSchedTable table(&pool, nullptr);
+  FillSchedTable(&table, size);
+
+  using CI = BenchmarkSchedTable::ColumnIndex;
+  std::vector<GroupByAggregator::Group> groups;
+  for (auto _ : state) {
+    PERFETTO_CHECK(
+        GroupByAggregator::Aggregate(table, {CI::utid}, CI::dur, &groups).ok());
+    benchmark::DoNotOptimize(groups.data());
+  }
+
+  state.counters["s/row"] =
+      Counter(static_cast<double>(size),
+              Counter::kIsIterationInvariantRate | Counter::kInvert);
+}
+
+BENCHMARK(BM_DbGroupBySum)->Apply(SizeBenchmarkArgs);
+
 }  // namespace
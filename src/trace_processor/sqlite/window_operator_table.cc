@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/sqlite/window_operator_table.h"
 
+#include <algorithm>
+
 #include "src/trace_processor/sqlite/sqlite_utils.h"
 
 namespace perfetto {
@@ -120,8 +122,47 @@ int WindowOperatorTable::Cursor::Filter(const QueryConstraints& qc,
                       sqlite3_value_int(argv[0]) == 0;
   if (return_first) {
     filter_type_ = FilterType::kReturnFirst;
-  } else {
-    filter_type_ = FilterType::kReturnAll;
+    return SQLITE_OK;
+  }
+  filter_type_ = FilterType::kReturnAll;
+
+  // Only generate the windows which can satisfy the constraints on ts (e.g.
+  // the ones passed down by span join): SQLite would discard the others
+  // anyway.
+  int64_t min_ts = window_start_;
+  for (size_t i = 0; i < qc.constraints().size(); ++i) {
+    const auto& cs = qc.constraints()[i];
+    if (cs.column != Column::kTs ||
+        sqlite3_value_type(argv[i]) != SQLITE_INTEGER) {
+      continue;
+    }
+    int64_t value = sqlite3_value_int64(argv[i]);
+    if (IsOpEq(cs.op) || IsOpGe(cs.op)) {
+      min_ts = std::max(min_ts, value);
+    } else if (IsOpGt(cs.op) && value < std::numeric_limits<int64_t>::max()) {
+      min_ts = std::max(min_ts, value + 1);
+    }
+    if (IsOpEq(cs.op) || IsOpLe(cs.op)) {
+      if (value < std::numeric_limits<int64_t>::max())
+        window_end_ = std::min(window_end_, value + 1);
+    } else if (IsOpLt(cs.op)) {
+      window_end_ = std::min(window_end_, value);
+    }
+  }
+
+  // Skip to the first window starting at or after |min_ts|.
+  if (min_ts >= window_end_) {
+    current_ts_ = window_end_;
+  } else if (min_ts > window_start_ && step_size_ > 0) {
+    int64_t offset = min_ts - window_start_;
+    int64_t skipped = offset / step_size_ + (offset % step_size_ != 0);
+    if (skipped > (window_end_ - 1 - window_start_) / step_size_) {
+      current_ts_ = window_end_;
+    } else {
+      current_ts_ = window_start_ + skipped * step_size_;
+      quantum_ts_ = skipped;
+      row_id_ = skipped;
+    }
   }
   return SQLITE_OK;
 }
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sqlite/window_operator_table.h"
+
+#include "src/trace_processor/sqlite/scoped_db.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using testing::ElementsAre;
+using testing::IsEmpty;
+
+class WindowOperatorTableTest : public ::testing::Test {
+ public:
+  WindowOperatorTableTest() {
+    sqlite3* db = nullptr;
+    PERFETTO_CHECK(sqlite3_initialize() == SQLITE_OK);
+    PERFETTO_CHECK(sqlite3_open(":memory:", &db) == SQLITE_OK);
+    db_.reset(db);
+
+    WindowOperatorTable::RegisterTable(db_.get(), nullptr);
+  }
+
+  void SetWindow(int64_t start, int64_t dur, int64_t quantum) {
+    std::string sql = "UPDATE window SET window_start = " +
+                      std::to_string(start) +
+                      ", window_dur = " + std::to_string(dur) +
+                      ", quantum = " + std::to_string(quantum) +
+                      " WHERE rowid = 0";
+    ASSERT_EQ(sqlite3_exec(*db_, sql.c_str(), nullptr, nullptr, nullptr),
+              SQLITE_OK);
+  }
+
+  // Returns the ts and quantum_ts of the windows matching |where|.
+  std::vector<std::pair<int64_t, int64_t>> Windows(const std::string& where) {
+    std::string sql = "SELECT ts, quantum_ts FROM window " + where;
+    sqlite3_stmt* raw_stmt = nullptr;
+    EXPECT_EQ(sqlite3_prepare_v2(*db_, sql.c_str(),
+                                 static_cast<int>(sql.size()), &raw_stmt,
+                                 nullptr),
+              SQLITE_OK);
+    ScopedStmt stmt(raw_stmt);
+    std::vector<std::pair<int64_t, int64_t>> windows;
+    while (sqlite3_step(*stmt) == SQLITE_ROW) {
+      windows.emplace_back(sqlite3_column_int64(*stmt, 0),
+                           sqlite3_column_int64(*stmt, 1));
+    }
+    return windows;
+  }
+
+ protected:
+  ScopedDb db_;
+};
+
+TEST_F(WindowOperatorTableTest, AllWindows) {
+  SetWindow(100, 350, 100);
+  ASSERT_THAT(Windows(""),
+              ElementsAre(std::make_pair(100, 0), std::make_pair(200, 1),
+                          std::make_pair(300, 2), std::make_pair(400, 3)));
+
+  SetWindow(100, 350, 0);
+  ASSERT_THAT(Windows(""), ElementsAre(std::make_pair(100, 0)));
+}
+
+TEST_F(WindowOperatorTableTest, TsLowerBound) {
+  SetWindow(100, 1000, 100);
+  ASSERT_THAT(Windows("WHERE ts >= 300 AND ts < 600"),
+              ElementsAre(std::make_pair(300, 2), std::make_pair(400, 3),
+                          std::make_pair(500, 4)));
+  ASSERT_THAT(Windows("WHERE ts >= 250 AND ts <= 500"),
+              ElementsAre(std::make_pair(300, 2), std::make_pair(400, 3),
+                          std::make_pair(500, 4)));
+  ASSERT_THAT(Windows("WHERE ts > 300 AND ts < 500"),
+              ElementsAre(std::make_pair(400, 3)));
+  ASSERT_THAT(Windows("WHERE ts = 1000"),
+              ElementsAre(std::make_pair(1000, 9)));
+  ASSERT_THAT(Windows("WHERE ts >= 0 AND ts < 150"),
+              ElementsAre(std::make_pair(100, 0)));
+}
+
+TEST_F(WindowOperatorTableTest, TsOutOfWindow) {
+  SetWindow(100, 1000, 100);
+  ASSERT_THAT(Windows("WHERE ts >= 1100"), IsEmpty());
+  ASSERT_THAT(Windows("WHERE ts = 150"), IsEmpty());
+  ASSERT_THAT(Windows("WHERE ts < 100"), IsEmpty());
+  ASSERT_THAT(Windows("WHERE ts >= 500 AND ts < 400"), IsEmpty());
+  ASSERT_THAT(Windows("WHERE ts > 9223372036854775807"), IsEmpty());
+}
+
+TEST_F(WindowOperatorTableTest, RowIdLookup) {
+  SetWindow(100, 1000, 100);
+  ASSERT_THAT(Windows("WHERE rowid = 0"), ElementsAre(std::make_pair(100, 0)));
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
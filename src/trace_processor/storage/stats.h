@@ -73,6 +73,9 @@ namespace stats {
   F(gpu_render_stage_parser_errors,     kSingle,  kError,    kAnalysis, ""),   \
   F(graphics_frame_event_parser_errors, kSingle,  kInfo,     kAnalysis, ""),   \
   F(guess_trace_type_duration_ns,       kSingle,  kInfo,     kAnalysis, ""),   \
+  F(gzip_decompression_errors,          kSingle,  kError,    kTrace,           \
+      "The trace is corrupted or truncated and could not be fully "            \
+      "decompressed. The data after the corrupted part is missing."),          \
   F(interned_data_tokenizer_errors,     kSingle,  kInfo,     kAnalysis, ""),   \
   F(invalid_clock_snapshots,            kSingle,  kError,    kAnalysis, ""),   \
   F(invalid_cpu_times,                  kSingle,  kError,    kAnalysis, ""),   \
@@ -87,6 +90,8 @@ namespace stats {
   F(rss_stat_unknown_thread_for_mm_id,  kSingle,  kInfo,     kAnalysis, ""),   \
   F(sched_switch_out_of_order,          kSingle,  kError,    kAnalysis, ""),   \
   F(slice_out_of_order,                 kSingle,  kError,    kAnalysis, ""),   \
+  F(snapshot_truncated,                 kSingle,  kError,    kTrace,           \
+      "The snapshot ended before its expected size and was not loaded."),     \
   F(flow_duplicate_id,                  kSingle,  kError,    kTrace,    ""),   \
   F(flow_no_enclosing_slice,            kSingle,  kError,    kTrace,    ""),   \
   F(flow_step_without_start,            kSingle,  kInfo,     kTrace,    ""),   \
@@ -204,6 +209,7 @@ namespace stats {
        "The file to be parsed can't be opened. This can happend when "         \
        "the file name is not found or no permission to access the file"),      \
   F(compact_sched_has_parse_errors,     kSingle,  kError,    kTrace,    ""),   \
+  F(compact_events_has_parse_errors,    kSingle,  kError,    kTrace,    ""),   \
   F(misplaced_end_event,                kSingle,  kDataLoss, kAnalysis, ""),   \
   F(truncated_sys_write_duration,       kSingle,  kDataLoss,  kAnalysis,       \
       "Count of sys_write slices that have a truncated duration to resolve "   \
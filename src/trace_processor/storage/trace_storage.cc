@@ -115,6 +115,51 @@ void TraceStorage::SqlStats::RecordQueryEnd(uint32_t row, int64_t time_ended) {
   times_ended_[queue_row] = time_ended;
 }
 
+util::Status TraceStorage::ExtractArg(uint32_t arg_set_id,
+                                      const char* key,
+                                      base::Optional<Variadic>* result) {
+  *result = base::nullopt;
+
+  // Keys which were never interned can't be in any arg set: this avoids
+  // interning the keys of failed lookups.
+  base::Optional<StringId> key_id = string_pool_.GetId(key);
+  if (!key_id)
+    return util::OkStatus();
+
+  std::pair<uint32_t, uint32_t> rows = GetArgSetRows(arg_set_id);
+  const auto& keys = arg_table_.key();
+  for (uint32_t row = rows.first; row < rows.second; ++row) {
+    if (keys[row] != *key_id)
+      continue;
+    if (result->has_value()) {
+      return util::ErrStatus(
+          "EXTRACT_ARG: received multiple args matching arg set id and key");
+    }
+    *result = GetArgValue(row);
+  }
+  return util::OkStatus();
+}
+
+std::pair<uint32_t, uint32_t> TraceStorage::GetArgSetRows(
+    uint32_t arg_set_id) {
+  const auto& arg_set_ids = arg_table_.arg_set_id();
+  uint32_t row_count = arg_table_.row_count();
+  for (uint32_t row = arg_set_indexed_rows_; row < row_count; ++row) {
+    // Arg sets without args start where the next one does.
+    uint32_t id = arg_set_ids[row];
+    while (arg_set_start_rows_.size() <= id)
+      arg_set_start_rows_.push_back(row);
+  }
+  arg_set_indexed_rows_ = row_count;
+
+  if (arg_set_id >= arg_set_start_rows_.size())
+    return std::make_pair(row_count, row_count);
+  uint32_t end = arg_set_id + 1 < arg_set_start_rows_.size()
+                     ? arg_set_start_rows_[arg_set_id + 1]
+                     : row_count;
+  return std::make_pair(arg_set_start_rows_[arg_set_id], end);
+}
+
 std::pair<int64_t, int64_t> TraceStorage::GetTraceTimestampBoundsNs() const {
   int64_t start_ns = std::numeric_limits<int64_t>::max();
   int64_t end_ns = std::numeric_limits<int64_t>::min();
@@ -20,6 +20,7 @@
 #include <array>
 #include <deque>
 #include <map>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -45,6 +46,7 @@
 #include "src/trace_processor/tables/slice_tables.h"
 #include "src/trace_processor/tables/trace_proto_tables.h"
 #include "src/trace_processor/tables/track_tables.h"
+#include "src/trace_processor/types/destructible.h"
 #include "src/trace_processor/types/variadic.h"
 #include "src/trace_processor/views/slice_views.h"
 
@@ -307,7 +309,10 @@ class TraceStorage {
   }
 
   // Requests the removal of unused capacity.
-  // Matches the semantics of std::vector::shrink_to_fit.
+  // Matches the semantics of std::vector::shrink_to_fit. Non-null columns are
+  // also compressed when possible (see ColumnStorage::ShrinkToFit()), which
+  // makes the next insertion or update of a column decompress it: only call
+  // this once the trace has been fully parsed.
   void ShrinkToFitTables() {
     // At the moment, we only bother calling ShrinkToFit on a set group
     // of tables. If we wanted to extend this to every table, we'd need to deal
@@ -488,6 +493,16 @@ class TraceStorage {
 
   const StatsMap& stats() const { return stats_; }
 
+  // Replaces all the stats, e.g. when restoring a snapshot of the storage.
+  void ReplaceStats(StatsMap stats) { stats_ = std::move(stats); }
+
+  // Takes ownership of the data which the columns restored from a snapshot
+  // read in place (see ColumnStorage::External()), releasing the data of the
+  // previous snapshot.
+  void ReplaceSnapshotData(std::unique_ptr<Destructible> data) {
+    snapshot_data_ = std::move(data);
+  }
+
   const tables::MetadataTable& metadata_table() const {
     return metadata_table_;
   }
@@ -717,24 +732,15 @@ class TraceStorage {
   // Returns (0, 0) if the trace is empty.
   std::pair<int64_t, int64_t> GetTraceTimestampBoundsNs() const;
 
+  // Sets |result| to the value of the arg with |key| in the arg set
+  // |arg_set_id| or to base::nullopt if there is no such arg.
   util::Status ExtractArg(uint32_t arg_set_id,
                           const char* key,
-                          base::Optional<Variadic>* result) {
-    const auto& args = arg_table();
-    RowMap filtered = args.FilterToRowMap(
-        {args.arg_set_id().eq(arg_set_id), args.key().eq(key)});
-    if (filtered.empty()) {
-      *result = base::nullopt;
-      return util::OkStatus();
-    }
-    if (filtered.size() > 1) {
-      return util::ErrStatus(
-          "EXTRACT_ARG: received multiple args matching arg set id and key");
-    }
-    uint32_t idx = filtered.Get(0);
-    *result = GetArgValue(idx);
-    return util::OkStatus();
-  }
+                          base::Optional<Variadic>* result);
+
+  // Returns the rows [first, second) of the args table which contain the args
+  // of |arg_set_id|.
+  std::pair<uint32_t, uint32_t> GetArgSetRows(uint32_t arg_set_id);
 
   Variadic GetArgValue(uint32_t row) const {
     Variadic v;
@@ -804,6 +810,13 @@ class TraceStorage {
   // Stats about parsing the trace.
   StatsMap stats_{};
 
+  // The snapshot the tables were restored from, if any. Declared before the
+  // tables so that it is destroyed after them.
+  std::unique_ptr<Destructible> snapshot_data_;
+
+  // Note: all the tables below must also be listed in
+  // GetTables() in trace_storage_snapshot.cc.
+
   // Extra data extracted from the trace. Includes:
   // * metadata from chrome and benchmarking infrastructure
   // * descriptions of android packages
@@ -846,6 +859,13 @@ class TraceStorage {
   // Args for all other tables.
   tables::ArgTable arg_table_{&string_pool_, nullptr};
 
+  // Row of |arg_table_| where the args of each arg set id start, covering the
+  // first |arg_set_indexed_rows_| rows of the table. Arg sets are only ever
+  // appended to the table with increasing ids so this is extended lazily by
+  // GetArgSetRows().
+  std::vector<uint32_t> arg_set_start_rows_;
+  uint32_t arg_set_indexed_rows_ = 0;
+
   // Information about all the threads and processes in the trace.
   tables::ThreadTable thread_table_{&string_pool_, nullptr};
   tables::ProcessTable process_table_{&string_pool_, nullptr};
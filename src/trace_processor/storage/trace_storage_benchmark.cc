@@ -0,0 +1,102 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <random>
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+#include "src/trace_processor/storage/trace_storage.h"
+
+using perfetto::base::Optional;
+using perfetto::trace_processor::StringId;
+using perfetto::trace_processor::TraceStorage;
+using perfetto::trace_processor::Variadic;
+namespace tables = perfetto::trace_processor::tables;
+
+namespace {
+
+static constexpr uint32_t kArgKeys = 60;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+void ArgSetBenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(1024);
+  } else {
+    b->RangeMultiplier(8)->Range(1024, 1024 * 512);
+  }
+}
+
+std::string KeyName(uint32_t key) {
+  return "debug.annotation_" + std::to_string(key);
+}
+
+// Fills the args table with |arg_sets| arg sets of 1 to 8 args each, similar
+// to the debug annotations of track events: keys come from a small set and
+// values are a mix of ints and strings.
+void PopulateArgs(TraceStorage* storage, uint32_t arg_sets) {
+  std::minstd_rand0 rnd_engine(42);
+  StringId int_type = storage->GetIdForVariadicType(Variadic::Type::kInt);
+  StringId string_type = storage->GetIdForVariadicType(Variadic::Type::kString);
+  auto* args = storage->mutable_arg_table();
+  for (uint32_t id = 1; id <= arg_sets; ++id) {
+    uint32_t count = 1 + rnd_engine() % 8;
+    uint32_t first_key = rnd_engine() % (kArgKeys - count);
+    for (uint32_t i = 0; i < count; ++i) {
+      tables::ArgTable::Row row;
+      row.arg_set_id = id;
+      row.flat_key = storage->InternString(
+          perfetto::base::StringView(KeyName(first_key + i)));
+      row.key = row.flat_key;
+      if (rnd_engine() % 2) {
+        row.int_value = static_cast<int64_t>(rnd_engine() % 10000);
+        row.value_type = int_type;
+      } else {
+        row.string_value = storage->InternString(perfetto::base::StringView(
+            "value_" + std::to_string(rnd_engine() % 1000)));
+        row.value_type = string_type;
+      }
+      args->Insert(row);
+    }
+  }
+  storage->ShrinkToFitTables();
+}
+
+}  // namespace
+
+static void BM_TraceStorageExtractArg(benchmark::State& state) {
+  uint32_t arg_sets = static_cast<uint32_t>(state.range(0));
+  TraceStorage storage;
+  PopulateArgs(&storage, arg_sets);
+
+  std::minstd_rand0 rnd_engine(476);
+  std::vector<std::pair<uint32_t, std::string>> lookups;
+  for (uint32_t i = 0; i < 1024; ++i) {
+    lookups.emplace_back(1 + rnd_engine() % arg_sets,
+                         KeyName(rnd_engine() % kArgKeys));
+  }
+
+  uint32_t i = 0;
+  for (auto _ : state) {
+    const auto& lookup = lookups[i++ % lookups.size()];
+    Optional<Variadic> value;
+    PERFETTO_CHECK(
+        storage.ExtractArg(lookup.first, lookup.second.c_str(), &value).ok());
+    benchmark::DoNotOptimize(value);
+  }
+}
+BENCHMARK(BM_TraceStorageExtractArg)->Apply(ArgSetBenchmarkArgs);
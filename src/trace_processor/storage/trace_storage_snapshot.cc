@@ -0,0 +1,1064 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/storage/trace_storage_snapshot.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "perfetto/base/build_config.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/string_view.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/destructible.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+#if !PERFETTO_IS_AT_LEAST_CPP17()
+// static
+constexpr char TraceStorageSnapshot::kMagic[];
+// static
+constexpr size_t TraceStorageSnapshot::kMagicSize;
+// static
+constexpr uint32_t TraceStorageSnapshot::kVersion;
+// static
+constexpr size_t TraceStorageSnapshot::kHeaderSize;
+#endif
+
+namespace {
+
+// Column data is aligned to this boundary inside the snapshot so that it can
+// be accessed in place when the snapshot is mapped in memory.
+constexpr size_t kDataAlignment = 8;
+
+// Size of the buffer used to batch the writes to the output file.
+constexpr size_t kWriteBufferSize = 1024 * 1024;
+
+// Offset of the size of the whole snapshot in the header.
+constexpr size_t kSnapshotSizeOffset =
+    TraceStorageSnapshot::kMagicSize + sizeof(uint32_t);
+
+// Tags of the representations of an overlay in the snapshot.
+enum class OverlayTag : uint8_t {
+  kRange = 0,
+  kBitVector = 1,
+  kIndexVector = 2,
+};
+
+// Buffers the writes to the snapshot file, or appends them to a buffer, and
+// keeps track of the offset to align column data.
+class Writer {
+ public:
+  explicit Writer(int fd) : fd_(fd) { buffer_.reserve(kWriteBufferSize); }
+  explicit Writer(std::vector<uint8_t>* out) : fd_(-1), out_(out) {}
+
+  void Write(const void* data, size_t size) {
+    offset_ += size;
+    if (out_) {
+      const uint8_t* ptr = static_cast<const uint8_t*>(data);
+      out_->insert(out_->end(), ptr, ptr + size);
+      return;
+    }
+    if (buffer_.size() + size > kWriteBufferSize)
+      Flush();
+    if (size >= kWriteBufferSize) {
+      WriteToFd(data, size);
+      return;
+    }
+    const uint8_t* ptr = static_cast<const uint8_t*>(data);
+    buffer_.insert(buffer_.end(), ptr, ptr + size);
+  }
+
+  template <typename T>
+  void WritePod(T value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Only trivially copyable types can be written");
+    Write(&value, sizeof(value));
+  }
+
+  void WriteVarInt(uint64_t value) {
+    uint8_t buf[protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+    uint8_t* end = protozero::proto_utils::WriteVarInt(value, buf);
+    Write(buf, static_cast<size_t>(end - buf));
+  }
+
+  void WriteString(base::StringView str) {
+    WriteVarInt(str.size());
+    Write(str.data(), str.size());
+  }
+
+  // Writes the element count of an array followed by padding up to the
+  // alignment of column data. The caller is expected to write the elements
+  // immediately after.
+  void WriteArrayHeader(uint64_t count) {
+    WritePod(count);
+    static const uint8_t kZeros[kDataAlignment] = {};
+    Write(kZeros, (kDataAlignment - offset_ % kDataAlignment) % kDataAlignment);
+  }
+
+  template <typename T>
+  void WriteArray(const std::vector<T>& vec) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Only trivially copyable types can be written");
+    WriteArrayHeader(vec.size());
+    Write(vec.data(), vec.size() * sizeof(T));
+  }
+
+  // Flushes the writes and fills in the size of the snapshot in the header.
+  base::Status Finish() {
+    uint64_t size = offset_;
+    if (out_) {
+      memcpy(out_->data() + kSnapshotSizeOffset, &size, sizeof(size));
+      return base::OkStatus();
+    }
+    Flush();
+    if (ok_ && lseek(fd_, static_cast<off_t>(kSnapshotSizeOffset), SEEK_SET) <
+                   0) {
+      ok_ = false;
+      errno_ = errno;
+    }
+    WriteToFd(&size, sizeof(size));
+    if (!ok_)
+      return base::ErrStatus("Failed to write snapshot (errno: %d, %s)",
+                             errno_, strerror(errno_));
+    return base::OkStatus();
+  }
+
+ private:
+  void Flush() {
+    WriteToFd(buffer_.data(), buffer_.size());
+    buffer_.clear();
+  }
+
+  void WriteToFd(const void* data, size_t size) {
+    if (!ok_ || size == 0)
+      return;
+    if (base::WriteAll(fd_, data, size) != static_cast<ssize_t>(size)) {
+      ok_ = false;
+      errno_ = errno;
+    }
+  }
+
+  const int fd_;
+  std::vector<uint8_t>* const out_ = nullptr;
+  std::vector<uint8_t> buffer_;
+  uint64_t offset_ = 0;
+  bool ok_ = true;
+  int errno_ = 0;
+};
+
+// Bounds-checked cursor over the snapshot. All the Read* methods return false
+// (and leave the reader in a failed state) if the snapshot is truncated.
+class Reader {
+ public:
+  Reader(const uint8_t* data, size_t size)
+      : begin_(data), cur_(data), end_(data + size) {}
+
+  bool Read(void* dst, size_t size) {
+    if (!ok_ || size > static_cast<size_t>(end_ - cur_))
+      return Fail();
+    if (size > 0)
+      memcpy(dst, cur_, size);
+    cur_ += size;
+    return true;
+  }
+
+  template <typename T>
+  bool ReadPod(T* value) {
+    return Read(value, sizeof(T));
+  }
+
+  bool ReadString(base::StringView* str) {
+    uint64_t size = 0;
+    const uint8_t* next =
+        protozero::proto_utils::ParseVarInt(cur_, end_, &size);
+    if (!ok_ || next == cur_)
+      return Fail();
+    cur_ = next;
+    if (size > static_cast<uint64_t>(end_ - cur_))
+      return Fail();
+    *str = base::StringView(reinterpret_cast<const char*>(cur_),
+                            static_cast<size_t>(size));
+    cur_ += size;
+    return true;
+  }
+
+  // Reads an array header written by Writer::WriteArrayHeader() and returns a
+  // pointer to the (aligned) elements in the snapshot, or nullptr on failure.
+  const uint8_t* ReadArrayHeader(size_t element_size, uint64_t* count) {
+    if (!ReadPod(count))
+      return nullptr;
+    size_t offset = static_cast<size_t>(cur_ - begin_);
+    size_t padding =
+        (kDataAlignment - offset % kDataAlignment) % kDataAlignment;
+    if (padding > static_cast<size_t>(end_ - cur_)) {
+      Fail();
+      return nullptr;
+    }
+    cur_ += padding;
+    if (*count > static_cast<uint64_t>(end_ - cur_) / element_size ||
+        *count > std::numeric_limits<uint32_t>::max()) {
+      Fail();
+      return nullptr;
+    }
+    const uint8_t* data = cur_;
+    cur_ += static_cast<size_t>(*count) * element_size;
+    return data;
+  }
+
+  template <typename T>
+  bool ReadArray(std::vector<T>* vec) {
+    uint64_t count = 0;
+    const uint8_t* data = ReadArrayHeader(sizeof(T), &count);
+    if (!data)
+      return false;
+    vec->resize(static_cast<size_t>(count));
+    if (count > 0)
+      memcpy(vec->data(), data, static_cast<size_t>(count) * sizeof(T));
+    return true;
+  }
+
+  bool ok() const { return ok_; }
+  bool at_end() const { return cur_ == end_; }
+  size_t remaining() const { return static_cast<size_t>(end_ - cur_); }
+
+ private:
+  bool Fail() {
+    ok_ = false;
+    return false;
+  }
+
+  const uint8_t* const begin_;
+  const uint8_t* cur_;
+  const uint8_t* const end_;
+  bool ok_ = true;
+};
+
+// A column read from the snapshot and not yet committed to its table.
+struct StagedColumn {
+  // The storage of the column. Only set for the string columns once the
+  // whole snapshot is validated and its strings are interned, so that a
+  // corrupted snapshot doesn't pollute the StringPool.
+  std::unique_ptr<ColumnStorageBase> storage;
+
+  // The StringIds of the string columns, as they were in the pool of the
+  // storage the snapshot was written from.
+  const uint8_t* string_ids = nullptr;
+
+  uint32_t size = 0;
+  bool present = false;
+};
+
+struct StagedTable {
+  uint32_t row_count = 0;
+  std::vector<ColumnStorageOverlay> overlays;
+
+  // For each overlay, the minimum size of the storage of the columns it
+  // applies to: the end of the range or of the bitvector, or the largest
+  // index plus one.
+  std::vector<uint32_t> min_storage_sizes;
+
+  // Indexed by the index of the column in the table; not present for the
+  // columns not owned by the table.
+  std::vector<StagedColumn> columns;
+};
+
+void WriteBitVector(Writer* writer, const BitVector& bv) {
+  writer->WritePod(bv.size());
+  writer->WriteArray(bv.GetWords());
+}
+
+bool ReadBitVector(Reader* reader, BitVector* bv) {
+  uint32_t size = 0;
+  std::vector<uint64_t> words;
+  if (!reader->ReadPod(&size) || !reader->ReadArray(&words))
+    return false;
+  base::Optional<BitVector> res =
+      BitVector::FromWords(words.data(), words.size(), size);
+  if (!res)
+    return false;
+  *bv = std::move(*res);
+  return true;
+}
+
+void WriteOverlay(Writer* writer, const ColumnStorageOverlay& overlay) {
+  const RowMap& rm = overlay.row_map();
+  if (rm.IsRange()) {
+    uint32_t start = rm.size() == 0 ? 0 : rm.Get(0);
+    writer->WritePod(OverlayTag::kRange);
+    writer->WritePod(start);
+    writer->WritePod(start + rm.size());
+  } else if (const BitVector* bv = rm.GetIfBitVector()) {
+    writer->WritePod(OverlayTag::kBitVector);
+    WriteBitVector(writer, *bv);
+  } else {
+    writer->WritePod(OverlayTag::kIndexVector);
+    writer->WriteArray(*rm.GetIfIndexVector());
+  }
+}
+
+// Reads an overlay and sets |min_storage_size| to the minimum size of the
+// storage it can be applied to.
+bool ReadOverlay(Reader* reader,
+                 ColumnStorageOverlay* overlay,
+                 uint32_t* min_storage_size) {
+  OverlayTag tag;
+  if (!reader->ReadPod(&tag))
+    return false;
+  switch (tag) {
+    case OverlayTag::kRange: {
+      uint32_t start = 0;
+      uint32_t end = 0;
+      if (!reader->ReadPod(&start) || !reader->ReadPod(&end) || start > end)
+        return false;
+      *overlay = ColumnStorageOverlay(start, end);
+      *min_storage_size = end;
+      return true;
+    }
+    case OverlayTag::kBitVector: {
+      BitVector bv;
+      if (!ReadBitVector(reader, &bv))
+        return false;
+      *min_storage_size = bv.size();
+      *overlay = ColumnStorageOverlay(std::move(bv));
+      return true;
+    }
+    case OverlayTag::kIndexVector: {
+      std::vector<uint32_t> rows;
+      if (!reader->ReadArray(&rows))
+        return false;
+      uint64_t min_size = 0;
+      for (uint32_t row : rows)
+        min_size = std::max(min_size, uint64_t(row) + 1);
+      if (min_size > std::numeric_limits<uint32_t>::max())
+        return false;
+      *min_storage_size = static_cast<uint32_t>(min_size);
+      *overlay = ColumnStorageOverlay(std::move(rows));
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename T>
+void WriteValues(Writer* writer, const ColumnStorage<T>& values) {
+  if (const T* data = values.data()) {
+    writer->WriteArrayHeader(values.size());
+    writer->Write(data, values.size() * sizeof(T));
+  } else {
+    writer->WriteArray(values.ToVector());
+  }
+}
+
+template <typename T>
+void WriteStorage(Writer* writer,
+                  const ColumnStorageBase& storage,
+                  bool nullable) {
+  if (nullable) {
+    const auto& typed =
+        static_cast<const ColumnStorage<base::Optional<T>>&>(storage);
+    writer->WritePod(static_cast<uint8_t>(typed.IsDense()));
+    WriteBitVector(writer, typed.non_null_bit_vector());
+    WriteValues(writer, typed.non_null_values());
+    return;
+  }
+  WriteValues(writer, static_cast<const ColumnStorage<T>&>(storage));
+}
+
+// Returns a storage for the |size| values at |data|. If |in_place|, they are
+// used in place from the snapshot rather than copied.
+template <typename T>
+ColumnStorage<T> ValuesFromSnapshot(const uint8_t* data,
+                                    uint32_t size,
+                                    bool in_place) {
+  // The values are aligned relative to the start of the snapshot, so this
+  // only fails if the snapshot itself is misaligned in memory.
+  if (in_place && reinterpret_cast<uintptr_t>(data) % alignof(T) == 0)
+    return ColumnStorage<T>::External(reinterpret_cast<const T*>(data), size);
+  std::vector<T> values(size);
+  if (size > 0)
+    memcpy(static_cast<void*>(values.data()), data, size * sizeof(T));
+  return ColumnStorage<T>(std::move(values));
+}
+
+// Reads the values of a column written by WriteValues().
+template <typename T>
+bool ReadValues(Reader* reader, bool in_place, ColumnStorage<T>* values) {
+  uint64_t count = 0;
+  const uint8_t* data = reader->ReadArrayHeader(sizeof(T), &count);
+  if (!data)
+    return false;
+  *values = ValuesFromSnapshot<T>(data, static_cast<uint32_t>(count), in_place);
+  return true;
+}
+
+// Reads the storage of a column into |staged|. If |in_place|, the values are
+// read in place from the snapshot rather than copied.
+template <typename T>
+bool ReadStorage(Reader* reader,
+                 bool nullable,
+                 bool in_place,
+                 StagedColumn* staged) {
+  ColumnStorage<T> values;
+  if (!nullable) {
+    if (!ReadValues(reader, in_place, &values))
+      return false;
+    staged->size = values.size();
+    staged->storage.reset(new ColumnStorage<T>(std::move(values)));
+    return true;
+  }
+
+  uint8_t dense = 0;
+  BitVector valid;
+  if (!reader->ReadPod(&dense) || !ReadBitVector(reader, &valid) ||
+      !ReadValues(reader, in_place, &values)) {
+    return false;
+  }
+  // Checks the invariant between the validity bits and the data: getting
+  // this wrong would cause out of bounds accesses when querying the column.
+  using Storage = ColumnStorage<base::Optional<T>>;
+  base::Optional<Storage> storage =
+      Storage::FromValues(dense, std::move(values), std::move(valid));
+  if (!storage)
+    return false;
+  staged->size = storage->size();
+  staged->storage.reset(new Storage(std::move(*storage)));
+  return true;
+}
+
+template <typename T>
+void CommitStorage(ColumnStorageBase* dst,
+                   ColumnStorageBase* src,
+                   bool nullable) {
+  if (nullable) {
+    using Storage = ColumnStorage<base::Optional<T>>;
+    *static_cast<Storage*>(dst) = std::move(*static_cast<Storage*>(src));
+  } else {
+    using Storage = ColumnStorage<T>;
+    *static_cast<Storage*>(dst) = std::move(*static_cast<Storage*>(src));
+  }
+}
+
+void WriteColumn(Writer* writer, const Column& col) {
+  writer->WriteString(col.name());
+  writer->WritePod(static_cast<uint8_t>(col.column_type()));
+  writer->WritePod(static_cast<uint8_t>(col.IsNullable()));
+
+  const ColumnStorageBase& storage = *col.storage_base();
+  switch (col.column_type()) {
+    case ColumnType::kInt32:
+      WriteStorage<int32_t>(writer, storage, col.IsNullable());
+      break;
+    case ColumnType::kUint32:
+      WriteStorage<uint32_t>(writer, storage, col.IsNullable());
+      break;
+    case ColumnType::kInt64:
+      WriteStorage<int64_t>(writer, storage, col.IsNullable());
+      break;
+    case ColumnType::kDouble:
+      WriteStorage<double>(writer, storage, col.IsNullable());
+      break;
+    case ColumnType::kString: {
+      // String columns are never stored as optionals: null strings are
+      // represented by StringPool::Id::Null().
+      WriteValues(writer,
+                  static_cast<const ColumnStorage<StringPool::Id>&>(storage));
+      break;
+    }
+    case ColumnType::kId:
+    case ColumnType::kDummy:
+      PERFETTO_FATAL("Columns without storage cannot be written");
+  }
+}
+
+// Reads a column into |staged|. The StringIds of string columns are only
+// checked, and converted to the ones of the pool of the storage, once the
+// strings are interned.
+bool ReadColumn(Reader* reader,
+                const Column& col,
+                bool in_place,
+                StagedColumn* staged) {
+  base::StringView name;
+  uint8_t type = 0;
+  uint8_t nullable = 0;
+  if (!reader->ReadString(&name) || !reader->ReadPod(&type) ||
+      !reader->ReadPod(&nullable)) {
+    return false;
+  }
+  if (name != base::StringView(col.name()) ||
+      type != static_cast<uint8_t>(col.column_type()) ||
+      static_cast<bool>(nullable) != col.IsNullable()) {
+    return false;
+  }
+
+  staged->present = true;
+  switch (col.column_type()) {
+    case ColumnType::kInt32:
+      return ReadStorage<int32_t>(reader, col.IsNullable(), in_place, staged);
+    case ColumnType::kUint32:
+      return ReadStorage<uint32_t>(reader, col.IsNullable(), in_place, staged);
+    case ColumnType::kInt64:
+      return ReadStorage<int64_t>(reader, col.IsNullable(), in_place, staged);
+    case ColumnType::kDouble:
+      return ReadStorage<double>(reader, col.IsNullable(), in_place, staged);
+    case ColumnType::kString: {
+      uint64_t count = 0;
+      staged->string_ids = reader->ReadArrayHeader(sizeof(uint32_t), &count);
+      staged->size = static_cast<uint32_t>(count);
+      return staged->string_ids != nullptr;
+    }
+    case ColumnType::kId:
+    case ColumnType::kDummy:
+      break;
+  }
+  return false;
+}
+
+// Creates the storage of the string columns of |staged| once the strings of
+// the snapshot are interned. |ids| maps the StringIds of the snapshot to the
+// ones of the pool; if |same_ids|, they are all equal and the column is used
+// as it is. Returns false if the column refers to a string not in the
+// snapshot.
+bool StageStringColumn(const base::FlatHashMap<uint32_t, StringPool::Id>& ids,
+                       bool same_ids,
+                       bool in_place,
+                       StagedColumn* staged) {
+  std::vector<StringPool::Id> remapped(same_ids ? 0 : staged->size);
+  for (uint32_t i = 0; i < staged->size; ++i) {
+    uint32_t raw_id;
+    memcpy(&raw_id, staged->string_ids + i * sizeof(raw_id), sizeof(raw_id));
+    if (raw_id == StringPool::Id::Null().raw_id())
+      continue;
+    const StringPool::Id* id = ids.Find(raw_id);
+    if (!id)
+      return false;
+    if (!same_ids)
+      remapped[i] = *id;
+  }
+  if (same_ids) {
+    staged->storage.reset(
+        new ColumnStorage<StringPool::Id>(ValuesFromSnapshot<StringPool::Id>(
+            staged->string_ids, staged->size, in_place)));
+  } else {
+    staged->storage.reset(
+        new ColumnStorage<StringPool::Id>(std::move(remapped)));
+  }
+  return true;
+}
+
+void CommitColumn(ColumnType type,
+                  bool nullable,
+                  ColumnStorageBase* dst,
+                  StagedColumn* staged) {
+  ColumnStorageBase* src = staged->storage.get();
+  switch (type) {
+    case ColumnType::kInt32:
+      CommitStorage<int32_t>(dst, src, nullable);
+      break;
+    case ColumnType::kUint32:
+      CommitStorage<uint32_t>(dst, src, nullable);
+      break;
+    case ColumnType::kInt64:
+      CommitStorage<int64_t>(dst, src, nullable);
+      break;
+    case ColumnType::kDouble:
+      CommitStorage<double>(dst, src, nullable);
+      break;
+    case ColumnType::kString:
+      CommitStorage<StringPool::Id>(dst, src, false);
+      break;
+    case ColumnType::kId:
+    case ColumnType::kDummy:
+      PERFETTO_FATAL("Columns without storage cannot be restored");
+  }
+}
+
+// Returns whether |col| is owned by |table|, rather than inherited from the
+// parent table, and has its own storage.
+bool IsOwnColumnWithStorage(const Table& table, const Column& col) {
+  uint32_t own_overlay = static_cast<uint32_t>(table.overlays().size() - 1);
+  return col.overlay_index() == own_overlay && !col.IsId() && !col.IsDummy();
+}
+
+void WriteTable(Writer* writer, const char* name, const Table& table) {
+  writer->WriteString(name);
+  writer->WritePod(table.row_count());
+  writer->WritePod(static_cast<uint32_t>(table.overlays().size()));
+  for (const ColumnStorageOverlay& overlay : table.overlays())
+    WriteOverlay(writer, overlay);
+
+  // Only the columns owned by this table are written: the columns inherited
+  // from the parent table share their storage with it and are written as
+  // part of the parent.
+  std::vector<const Column*> own_columns;
+  for (const Column& col : table.columns()) {
+    if (IsOwnColumnWithStorage(table, col))
+      own_columns.push_back(&col);
+  }
+  writer->WritePod(static_cast<uint32_t>(own_columns.size()));
+  for (const Column* col : own_columns)
+    WriteColumn(writer, *col);
+}
+
+base::Status ReadTable(Reader* reader,
+                       const char* name,
+                       const Table& table,
+                       bool in_place,
+                       StagedTable* staged) {
+  base::StringView snapshot_name;
+  if (!reader->ReadString(&snapshot_name))
+    return base::ErrStatus("Snapshot truncated");
+  if (snapshot_name != base::StringView(name)) {
+    return base::ErrStatus("Snapshot table mismatch: expected %s, found %s",
+                           name, snapshot_name.ToStdString().c_str());
+  }
+
+  uint32_t overlay_count = 0;
+  if (!reader->ReadPod(&staged->row_count) || !reader->ReadPod(&overlay_count))
+    return base::ErrStatus("Snapshot truncated (table %s)", name);
+  if (overlay_count != table.overlays().size())
+    return base::ErrStatus("Snapshot schema mismatch (table %s)", name);
+
+  staged->overlays.resize(overlay_count);
+  staged->min_storage_sizes.resize(overlay_count);
+  for (uint32_t i = 0; i < overlay_count; ++i) {
+    ColumnStorageOverlay& overlay = staged->overlays[i];
+    if (!ReadOverlay(reader, &overlay, &staged->min_storage_sizes[i]) ||
+        overlay.size() != staged->row_count) {
+      return base::ErrStatus("Snapshot corrupted (table %s)", name);
+    }
+  }
+
+  uint32_t column_count = 0;
+  if (!reader->ReadPod(&column_count))
+    return base::ErrStatus("Snapshot truncated (table %s)", name);
+
+  uint32_t columns_read = 0;
+  const std::vector<Column>& columns = table.columns();
+  staged->columns.resize(columns.size());
+  for (uint32_t i = 0; i < columns.size(); ++i) {
+    const Column& col = columns[i];
+    if (!IsOwnColumnWithStorage(table, col))
+      continue;
+    if (columns_read++ >= column_count)
+      return base::ErrStatus("Snapshot schema mismatch (table %s)", name);
+
+    if (!ReadColumn(reader, col, in_place, &staged->columns[i])) {
+      return base::ErrStatus(
+          "Snapshot corrupted or schema mismatch (table %s, column %s)", name,
+          col.name());
+    }
+    // The tables in TraceStorage are only ever appended to, so the storage
+    // owned by a table always has one entry per row.
+    if (staged->columns[i].size != staged->row_count) {
+      return base::ErrStatus("Snapshot corrupted (table %s, column %s)", name,
+                             col.name());
+    }
+  }
+  if (columns_read != column_count)
+    return base::ErrStatus("Snapshot schema mismatch (table %s)", name);
+  return base::OkStatus();
+}
+
+// Checks that the overlays of every table, including the ones over the
+// columns inherited from the parent tables, stay within the bounds of the
+// restored storage.
+base::Status ValidateOverlays(
+    const std::vector<std::pair<const char*, Table*>>& tables,
+    const std::vector<StagedTable>& staged) {
+  std::map<const ColumnStorageBase*, uint32_t> storage_sizes;
+  for (size_t i = 0; i < tables.size(); ++i) {
+    const std::vector<Column>& columns = tables[i].second->columns();
+    for (uint32_t j = 0; j < columns.size(); ++j) {
+      if (staged[i].columns[j].present)
+        storage_sizes[columns[j].storage_base()] = staged[i].columns[j].size;
+    }
+  }
+  for (size_t i = 0; i < tables.size(); ++i) {
+    const std::vector<Column>& columns = tables[i].second->columns();
+    for (const Column& col : columns) {
+      if (col.IsId() || col.IsDummy())
+        continue;
+      auto it = storage_sizes.find(col.storage_base());
+      if (it == storage_sizes.end()) {
+        return base::ErrStatus(
+            "Snapshot schema mismatch (table %s, column %s): storage missing",
+            tables[i].first, col.name());
+      }
+      if (it->second < staged[i].min_storage_sizes[col.overlay_index()]) {
+        return base::ErrStatus("Snapshot corrupted (table %s, column %s)",
+                               tables[i].first, col.name());
+      }
+    }
+  }
+  return base::OkStatus();
+}
+
+void CommitTable(Table* table, StagedTable* staged) {
+  for (uint32_t i = 0; i < staged->columns.size(); ++i) {
+    if (!staged->columns[i].present)
+      continue;
+    const Column& col = table->columns()[i];
+    CommitColumn(col.column_type(), col.IsNullable(),
+                 table->GetMutableColumnStorage(i), &staged->columns[i]);
+  }
+  table->ReplaceRows(staged->row_count, std::move(staged->overlays));
+}
+
+// Returns all the tables in |storage| together with their name. The order
+// of this list defines the order of the tables in the snapshot.
+std::vector<std::pair<const char*, Table*>> GetTables(TraceStorage* storage) {
+#define PERFETTO_TP_SNAPSHOT_TABLE(name)                                    \
+  {                                                                         \
+    std::remove_pointer<decltype(storage->mutable_##name())>::type::Name(), \
+        storage->mutable_##name()                                           \
+  }
+
+  // When adding a table to TraceStorage, it also needs to be added here (and
+  // kVersion bumped) for it to be preserved in snapshots.
+  return {
+      PERFETTO_TP_SNAPSHOT_TABLE(metadata_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(clock_snapshot_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(track_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(thread_state_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(gpu_track_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(process_track_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(thread_track_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(counter_track_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(thread_counter_track_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(process_counter_track_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(cpu_counter_track_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(irq_counter_track_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(softirq_counter_track_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(gpu_counter_track_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(energy_counter_track_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(uid_counter_track_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(energy_per_uid_counter_track_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(gpu_counter_group_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(perf_counter_track_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(arg_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(thread_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(process_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(slice_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(flow_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(sched_slice_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(gpu_slice_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(counter_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(raw_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(cpu_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(cpu_freq_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(android_log_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(android_dumpstate_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(stack_profile_mapping_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(stack_profile_frame_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(stack_profile_callsite_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(stack_sample_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(heap_profile_allocation_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(cpu_profile_stack_sample_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(perf_sample_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(package_list_table),
+      {tables::AndroidGameInterventionListTable::Name(),
+       storage->mutable_android_game_intervenion_list_table()},
+      PERFETTO_TP_SNAPSHOT_TABLE(profiler_smaps_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(symbol_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(heap_graph_object_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(heap_graph_class_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(heap_graph_reference_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(vulkan_memory_allocations_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(graphics_frame_slice_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(memory_snapshot_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(process_memory_snapshot_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(memory_snapshot_node_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(memory_snapshot_edge_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(expected_frame_timeline_slice_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(actual_frame_timeline_slice_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(experimental_proto_content_table),
+      PERFETTO_TP_SNAPSHOT_TABLE(experimental_missing_chrome_processes_table),
+  };
+
+#undef PERFETTO_TP_SNAPSHOT_TABLE
+}
+
+}  // namespace
+
+// static
+bool TraceStorageSnapshot::IsSnapshot(const uint8_t* data, size_t size) {
+  return size >= kMagicSize && memcmp(data, kMagic, kMagicSize) == 0;
+}
+
+// static
+base::Status TraceStorageSnapshot::ReadHeader(const uint8_t* data,
+                                              size_t size,
+                                              uint64_t* snapshot_size) {
+  if (!IsSnapshot(data, size))
+    return base::ErrStatus("Not a trace processor snapshot");
+
+  Reader reader(data, size);
+  char magic[kMagicSize];
+  uint32_t version = 0;
+  if (!reader.Read(magic, kMagicSize) || !reader.ReadPod(&version))
+    return base::ErrStatus("Snapshot truncated");
+  if (version != kVersion) {
+    return base::ErrStatus(
+        "Snapshot version %u is not supported (expected %u): re-create the "
+        "snapshot with this version of trace processor",
+        version, kVersion);
+  }
+  if (!reader.ReadPod(snapshot_size))
+    return base::ErrStatus("Snapshot truncated");
+  if (*snapshot_size < kHeaderSize)
+    return base::ErrStatus("Snapshot corrupted");
+  return base::OkStatus();
+}
+
+namespace {
+
+base::Status WriteSnapshot(const TraceStorage& storage, Writer* writer) {
+  writer->Write(TraceStorageSnapshot::kMagic, TraceStorageSnapshot::kMagicSize);
+  writer->WritePod(TraceStorageSnapshot::kVersion);
+  // The size of the snapshot, filled in by Writer::Finish().
+  writer->WritePod(uint64_t(0));
+
+  // Strings, in the order of the pool, each with its StringId. The null
+  // string is not written.
+  const StringPool& pool = storage.string_pool();
+  writer->WritePod(static_cast<uint32_t>(pool.size()));
+  for (auto it = pool.CreateIterator(); it; ++it) {
+    StringPool::Id id = it.StringId();
+    if (id.is_null())
+      continue;
+    writer->WritePod(id.raw_id());
+    writer->WriteString(it.StringView());
+  }
+
+  // Stats are written by name so that they survive the addition of new keys.
+  writer->WritePod(static_cast<uint32_t>(stats::kNumKeys));
+  for (size_t i = 0; i < stats::kNumKeys; ++i) {
+    const TraceStorage::Stats& stat = storage.stats()[i];
+    writer->WriteString(stats::kNames[i]);
+    writer->WritePod(stat.value);
+    writer->WritePod(static_cast<uint32_t>(stat.indexed_values.size()));
+    for (const auto& index_and_value : stat.indexed_values) {
+      writer->WritePod(static_cast<int32_t>(index_and_value.first));
+      writer->WritePod(index_and_value.second);
+    }
+  }
+
+  // The tables are only read, GetTables() just doesn't have a const variant.
+  auto tables = GetTables(const_cast<TraceStorage*>(&storage));
+  writer->WritePod(static_cast<uint32_t>(tables.size()));
+  for (const auto& name_and_table : tables) {
+    WriteTable(writer, name_and_table.first, *name_and_table.second);
+  }
+
+  const TraceStorage::VirtualTrackSlices& slices =
+      storage.virtual_track_slices();
+  writer->WriteArrayHeader(slices.slice_count());
+  for (uint32_t i = 0; i < slices.slice_count(); ++i) {
+    writer->WritePod(slices.slice_ids()[i].value);
+    writer->WritePod(slices.thread_timestamp_ns()[i]);
+    writer->WritePod(slices.thread_duration_ns()[i]);
+    writer->WritePod(slices.thread_instruction_counts()[i]);
+    writer->WritePod(slices.thread_instruction_deltas()[i]);
+  }
+  return writer->Finish();
+}
+
+}  // namespace
+
+// static
+base::Status TraceStorageSnapshot::Write(const TraceStorage& storage, int fd) {
+  Writer writer(fd);
+  return WriteSnapshot(storage, &writer);
+}
+
+// static
+base::Status TraceStorageSnapshot::Write(const TraceStorage& storage,
+                                         std::vector<uint8_t>* snapshot) {
+  snapshot->clear();
+  Writer writer(snapshot);
+  return WriteSnapshot(storage, &writer);
+}
+
+// static
+base::Status TraceStorageSnapshot::Restore(const uint8_t* data,
+                                           size_t size,
+                                           std::unique_ptr<Destructible> owner,
+                                           TraceStorage* storage) {
+  uint64_t snapshot_size = 0;
+  base::Status status = ReadHeader(data, size, &snapshot_size);
+  if (!status.ok())
+    return status;
+  if (snapshot_size != size) {
+    return base::ErrStatus("Snapshot size mismatch: expected %" PRIu64
+                           " bytes, got %zu",
+                           snapshot_size, size);
+  }
+
+  // Offsets are relative to the start of the snapshot (including the magic)
+  // to match the alignment of the writer.
+  Reader reader(data, size);
+  uint8_t header[kHeaderSize];
+  if (!reader.Read(header, kHeaderSize))
+    return base::ErrStatus("Snapshot truncated");
+
+  // The strings with their StringId in the storage the snapshot was written
+  // from. The null string is not written.
+  uint32_t string_count = 0;
+  if (!reader.ReadPod(&string_count))
+    return base::ErrStatus("Snapshot truncated");
+  std::vector<std::pair<uint32_t, base::StringView>> strings;
+  // Each string takes at least its id and a one byte size: don't trust
+  // |string_count| beyond that, it could be corrupted.
+  strings.reserve(std::min<size_t>(
+      string_count, reader.remaining() / (sizeof(uint32_t) + 1)));
+  for (uint32_t i = 0; i < string_count; ++i) {
+    uint32_t raw_id = 0;
+    base::StringView str;
+    if (!reader.ReadPod(&raw_id) || !reader.ReadString(&str))
+      return base::ErrStatus("Snapshot truncated (strings)");
+    strings.emplace_back(raw_id, str);
+  }
+
+  TraceStorage::StatsMap stats{};
+  uint32_t stats_count = 0;
+  if (!reader.ReadPod(&stats_count))
+    return base::ErrStatus("Snapshot truncated (stats)");
+  for (uint32_t i = 0; i < stats_count; ++i) {
+    base::StringView name;
+    int64_t value = 0;
+    uint32_t indexed_count = 0;
+    if (!reader.ReadString(&name) || !reader.ReadPod(&value) ||
+        !reader.ReadPod(&indexed_count)) {
+      return base::ErrStatus("Snapshot truncated (stats)");
+    }
+    // Stats unknown to this version of trace processor are dropped.
+    TraceStorage::Stats* stat = nullptr;
+    for (size_t key = 0; key < stats::kNumKeys; ++key) {
+      if (name == base::StringView(stats::kNames[key])) {
+        stat = &stats[key];
+        break;
+      }
+    }
+    if (stat)
+      stat->value = value;
+    for (uint32_t j = 0; j < indexed_count; ++j) {
+      int32_t index = 0;
+      int64_t indexed_value = 0;
+      if (!reader.ReadPod(&index) || !reader.ReadPod(&indexed_value))
+        return base::ErrStatus("Snapshot truncated (stats)");
+      if (stat)
+        stat->indexed_values[index] = indexed_value;
+    }
+  }
+
+  // All the tables are first read into staging storage so that a corrupted
+  // or incompatible snapshot leaves |storage| untouched.
+  auto tables = GetTables(storage);
+  uint32_t table_count = 0;
+  if (!reader.ReadPod(&table_count))
+    return base::ErrStatus("Snapshot truncated (tables)");
+  if (table_count != tables.size()) {
+    return base::ErrStatus("Snapshot has %u tables, expected %zu", table_count,
+                           tables.size());
+  }
+  std::vector<StagedTable> staged(tables.size());
+  for (size_t i = 0; i < tables.size(); ++i) {
+    status = ReadTable(&reader, tables[i].first, *tables[i].second, !!owner,
+                       &staged[i]);
+    if (!status.ok())
+      return status;
+  }
+  status = ValidateOverlays(tables, staged);
+  if (!status.ok())
+    return status;
+
+  TraceStorage::VirtualTrackSlices slices;
+  uint64_t slice_count = 0;
+  const size_t kSliceSize = sizeof(uint32_t) + 4 * sizeof(int64_t);
+  const uint8_t* slice_data = reader.ReadArrayHeader(kSliceSize, &slice_count);
+  if (!slice_data)
+    return base::ErrStatus("Snapshot truncated (virtual track slices)");
+  for (uint64_t i = 0; i < slice_count; ++i, slice_data += kSliceSize) {
+    uint32_t slice_id;
+    int64_t values[4];
+    memcpy(&slice_id, slice_data, sizeof(slice_id));
+    memcpy(values, slice_data + sizeof(slice_id), sizeof(values));
+    slices.AddVirtualTrackSlice(SliceId(slice_id), values[0], values[1],
+                                values[2], values[3]);
+  }
+
+  if (!reader.ok() || !reader.at_end())
+    return base::ErrStatus("Snapshot corrupted");
+
+  // Strings are interned into the existing pool rather than replacing it:
+  // parts of trace processor hold onto StringIds interned at construction.
+  // As a new storage interns the same strings at construction as the one the
+  // snapshot was written from, interning the rest in the same order usually
+  // gives them the same StringIds and the string columns can be used as they
+  // are. Otherwise they are converted. Either way, every StringId of the
+  // columns is checked against the strings of the snapshot: a corrupted one
+  // fails the load, leaving the strings interned but the tables untouched.
+  base::FlatHashMap<uint32_t, StringPool::Id> string_ids;
+  bool same_string_ids = true;
+  for (const auto& str : strings) {
+    StringPool::Id id = storage->InternString(str.second);
+    same_string_ids &= id.raw_id() == str.first;
+    string_ids.Insert(str.first, id);
+  }
+  for (size_t i = 0; i < tables.size(); ++i) {
+    const std::vector<Column>& columns = tables[i].second->columns();
+    for (uint32_t j = 0; j < columns.size(); ++j) {
+      StagedColumn& col = staged[i].columns[j];
+      if (!col.present || columns[j].column_type() != ColumnType::kString)
+        continue;
+      if (!StageStringColumn(string_ids, same_string_ids, !!owner, &col)) {
+        return base::ErrStatus("Snapshot corrupted (table %s, column %s)",
+                               tables[i].first, columns[j].name());
+      }
+    }
+  }
+
+  for (size_t i = 0; i < tables.size(); ++i)
+    CommitTable(tables[i].second, &staged[i]);
+  storage->ReplaceStats(std::move(stats));
+  *storage->mutable_virtual_track_slices() = std::move(slices);
+  // Only released now that the tables don't use the previous snapshot.
+  storage->ReplaceSnapshotData(std::move(owner));
+  return base::OkStatus();
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
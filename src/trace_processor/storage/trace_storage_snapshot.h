@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_STORAGE_TRACE_STORAGE_SNAPSHOT_H_
+#define SRC_TRACE_PROCESSOR_STORAGE_TRACE_STORAGE_SNAPSHOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "perfetto/base/status.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+class Destructible;
+class TraceStorage;
+
+// Serializes the contents of a fully loaded TraceStorage (all the tables,
+// the strings they reference and the import stats) into a flat, columnar
+// snapshot file and restores it later without going through the importers.
+//
+// Layout of a snapshot (all integers are in native byte order):
+// [magic] [version] [size of the whole snapshot]
+// [strings]: count, then the StringId and varint-size prefixed string of each
+//            string, in StringPool order.
+// [stats]: count, then (name, value, indexed values) for each key.
+// [tables]: count, then for each table its name, row count, overlays and the
+//           columns owned by the table. Column data is 8-byte aligned and
+//           stored exactly as in memory, so it can be copied in bulk or
+//           read in place.
+// [virtual track slices]
+//
+// Snapshots are only guaranteed to be readable by the same version of trace
+// processor which wrote them: a mismatch in version, tables or columns causes
+// Restore() to fail without modifying the storage. The same goes for a
+// corrupted snapshot, but only its structure is checked before anything is
+// committed (the sizes of all the sections, the overlays against the sizes of
+// the columns and the validity bits of nullable columns against their
+// values): the values of the columns are not read, so that the pages of a
+// mapped snapshot are only touched by the queries which need them.
+class TraceStorageSnapshot {
+ public:
+  // Magic at the start of every snapshot; used by GuessTraceType().
+  static constexpr char kMagic[] = "PERFETTO-TP-SNAPSHOT";
+  static constexpr size_t kMagicSize = sizeof(kMagic) - 1;
+
+  // Bump whenever the format or the set of tables/columns changes.
+  static constexpr uint32_t kVersion = 3;
+
+  // Size of the header, which contains the magic, the version and the size
+  // of the whole snapshot.
+  static constexpr size_t kHeaderSize =
+      kMagicSize + sizeof(uint32_t) + sizeof(uint64_t);
+
+  // Returns whether |data| starts with a snapshot header.
+  static bool IsSnapshot(const uint8_t* data, size_t size);
+
+  // Parses the header in [data, data + kHeaderSize) and sets |snapshot_size|
+  // to the size of the whole snapshot. Fails if the version is not supported.
+  static base::Status ReadHeader(const uint8_t* data,
+                                 size_t size,
+                                 uint64_t* snapshot_size);
+
+  // Writes a snapshot of |storage| to |fd|, which must be seekable as the
+  // size in the header is filled in at the end.
+  static base::Status Write(const TraceStorage& storage, int fd);
+
+  // Writes a snapshot of |storage| to |snapshot|, replacing its contents.
+  static base::Status Write(const TraceStorage& storage,
+                            std::vector<uint8_t>* snapshot);
+
+  // Replaces the contents of the tables in |storage| with the snapshot in
+  // [data, data + size). Strings are interned into the existing StringPool of
+  // |storage| so that any StringId already handed out stays valid.
+  // If |owner| is not null, it must keep [data, data + size) alive: it is
+  // handed over to |storage| and the columns read their values in place from
+  // the snapshot (e.g. from the mapped file) instead of copying them; only
+  // the validity bits of nullable columns and the overlays are copied, as
+  // well as the string columns if the StringPool of |storage| doesn't assign
+  // the same StringIds as the one the snapshot was written from. Otherwise,
+  // all the data is copied.
+  static base::Status Restore(const uint8_t* data,
+                              size_t size,
+                              std::unique_ptr<Destructible> owner,
+                              TraceStorage* storage);
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_STORAGE_TRACE_STORAGE_SNAPSHOT_H_
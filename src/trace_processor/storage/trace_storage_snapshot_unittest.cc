@@ -0,0 +1,324 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/storage/trace_storage_snapshot.h"
+
+#include <string.h>
+
+#include <string>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/destructible.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+std::string WriteSnapshot(const TraceStorage& storage) {
+  base::TempFile file = base::TempFile::Create();
+  EXPECT_TRUE(TraceStorageSnapshot::Write(storage, file.fd()).ok());
+  std::string snapshot;
+  EXPECT_TRUE(base::ReadFile(file.path(), &snapshot));
+  return snapshot;
+}
+
+// Returns the offset of the table |name| with |row_count| rows and
+// |overlay_count| overlays in |snapshot|, just after its header.
+size_t FindTable(const std::string& snapshot,
+                 const std::string& name,
+                 uint32_t row_count,
+                 uint32_t overlay_count) {
+  std::string header(1, static_cast<char>(name.size()));
+  header += name;
+  header.append(reinterpret_cast<const char*>(&row_count), sizeof(row_count));
+  header.append(reinterpret_cast<const char*>(&overlay_count),
+                sizeof(overlay_count));
+  size_t pos = snapshot.find(header);
+  EXPECT_NE(pos, std::string::npos);
+  EXPECT_EQ(snapshot.find(header, pos + 1), std::string::npos);
+  return pos + header.size();
+}
+
+template <typename T>
+void Overwrite(std::string* snapshot, size_t offset, T value) {
+  ASSERT_LE(offset + sizeof(T), snapshot->size());
+  memcpy(&(*snapshot)[offset], &value, sizeof(T));
+}
+
+base::Status Restore(const std::string& snapshot, TraceStorage* storage) {
+  return TraceStorageSnapshot::Restore(
+      reinterpret_cast<const uint8_t*>(snapshot.data()), snapshot.size(),
+      nullptr, storage);
+}
+
+// Returns the storage of |column|, whose values are of type T.
+template <typename T>
+const ColumnStorage<T>& GetStorage(const Column& column) {
+  return *static_cast<const ColumnStorage<T>*>(column.storage_base());
+}
+
+struct SnapshotBuffer : public Destructible {
+  ~SnapshotBuffer() override;
+  std::vector<uint8_t> data;
+};
+
+SnapshotBuffer::~SnapshotBuffer() = default;
+
+class TraceStorageSnapshotTest : public ::testing::Test {
+ protected:
+  void PopulateStorage() {
+    tables::ThreadTable::Row thread(1234);
+    thread.name = storage_.InternString("thread_name");
+    thread.upid = 1u;
+    storage_.mutable_thread_table()->Insert(thread);
+    storage_.mutable_thread_table()->Insert(tables::ThreadTable::Row(5678));
+
+    TrackId track = storage_.mutable_track_table()->Insert({}).id;
+    for (uint32_t i = 0; i < 100; ++i) {
+      tables::SliceTable::Row slice;
+      slice.ts = 1000 + i;
+      slice.dur = 10;
+      slice.track_id = track;
+      slice.name = storage_.InternString(
+          base::StringView("slice_" + std::to_string(i % 7)));
+      if (i % 3 == 0)
+        slice.thread_ts = i * 2;
+      storage_.mutable_slice_table()->Insert(slice);
+    }
+
+    // Rows in a child table are also inserted in the parent.
+    tables::GpuSliceTable::Row gpu_slice;
+    gpu_slice.ts = 5000;
+    gpu_slice.track_id = track;
+    gpu_slice.render_target_name = storage_.InternString("target");
+    storage_.mutable_gpu_slice_table()->Insert(gpu_slice);
+
+    tables::ArgTable::Row arg;
+    arg.arg_set_id = 1;
+    arg.flat_key = arg.key = storage_.InternString("key");
+    arg.real_value = 1.5;
+    storage_.mutable_arg_table()->Insert(arg);
+
+    storage_.SetStats(stats::android_log_num_failed, 42);
+    storage_.IncrementIndexedStats(stats::ftrace_cpu_overrun_end, 3, 7);
+    storage_.mutable_virtual_track_slices()->AddVirtualTrackSlice(
+        SliceId(4), 1, 2, 3, 4);
+  }
+
+  TraceStorage storage_;
+};
+
+TEST_F(TraceStorageSnapshotTest, RoundTrip) {
+  PopulateStorage();
+  std::string snapshot = WriteSnapshot(storage_);
+  ASSERT_TRUE(TraceStorageSnapshot::IsSnapshot(
+      reinterpret_cast<const uint8_t*>(snapshot.data()), snapshot.size()));
+
+  // Intern some strings first so that ids differ between the two pools.
+  TraceStorage restored;
+  restored.InternString("unrelated");
+  restored.InternString("slice_3");
+  restored.mutable_thread_table()->Insert(tables::ThreadTable::Row(1));
+  ASSERT_TRUE(Restore(snapshot, &restored).ok());
+
+  const auto& threads = restored.thread_table();
+  ASSERT_EQ(threads.row_count(), 2u);
+  EXPECT_EQ(threads.tid()[0], 1234u);
+  EXPECT_EQ(restored.GetString(*threads.name()[0]).ToStdString(),
+            "thread_name");
+  EXPECT_EQ(threads.upid()[0], 1u);
+  EXPECT_EQ(threads.tid()[1], 5678u);
+  EXPECT_FALSE(threads.name()[1].has_value());
+  EXPECT_FALSE(threads.upid()[1].has_value());
+
+  const auto& slices = restored.slice_table();
+  ASSERT_EQ(slices.row_count(), 101u);
+  for (uint32_t i = 0; i < 100; ++i) {
+    EXPECT_EQ(slices.ts()[i], 1000 + i);
+    EXPECT_EQ(restored.GetString(*slices.name()[i]).ToStdString(),
+              "slice_" + std::to_string(i % 7));
+    EXPECT_EQ(slices.thread_ts()[i],
+              i % 3 == 0 ? base::make_optional<int64_t>(i * 2)
+                         : base::nullopt);
+  }
+  EXPECT_EQ(restored.GetString(slices.type()[100]).ToStdString(),
+            "gpu_slice");
+
+  const auto& gpu_slices = restored.gpu_slice_table();
+  ASSERT_EQ(gpu_slices.row_count(), 1u);
+  EXPECT_EQ(gpu_slices.ts()[0], 5000);
+  EXPECT_EQ(gpu_slices.id()[0].value, 100u);
+  EXPECT_EQ(
+      restored.GetString(gpu_slices.render_target_name()[0]).ToStdString(),
+      "target");
+
+  // Interned strings must be looked up by content after the restore.
+  auto filtered = slices.Filter({slices.name().eq("slice_3")},
+                               RowMap::OptimizeFor::kMemory);
+  EXPECT_EQ(filtered.row_count(), 14u);
+
+  const auto& args = restored.arg_table();
+  ASSERT_EQ(args.row_count(), 1u);
+  EXPECT_EQ(args.real_value()[0], 1.5);
+  EXPECT_FALSE(args.int_value()[0].has_value());
+
+  EXPECT_EQ(restored.stats()[stats::android_log_num_failed].value, 42);
+  EXPECT_EQ(*restored.GetIndexedStats(stats::ftrace_cpu_overrun_end, 3), 7);
+  ASSERT_EQ(restored.virtual_track_slices().slice_count(), 1u);
+  EXPECT_EQ(restored.virtual_track_slices().thread_duration_ns()[0], 2);
+}
+
+TEST_F(TraceStorageSnapshotTest, SnapshotOfRestoredStorageIsIdentical) {
+  PopulateStorage();
+  std::string snapshot = WriteSnapshot(storage_);
+
+  TraceStorage restored;
+  ASSERT_TRUE(Restore(snapshot, &restored).ok());
+  EXPECT_EQ(WriteSnapshot(restored), snapshot);
+}
+
+TEST_F(TraceStorageSnapshotTest, RestoreInPlace) {
+  PopulateStorage();
+  std::unique_ptr<SnapshotBuffer> buffer(new SnapshotBuffer());
+  ASSERT_TRUE(TraceStorageSnapshot::Write(storage_, &buffer->data).ok());
+  ASSERT_EQ(std::string(buffer->data.begin(), buffer->data.end()),
+            WriteSnapshot(storage_));
+
+  TraceStorage restored;
+  const uint8_t* data = buffer->data.data();
+  size_t size = buffer->data.size();
+  ASSERT_TRUE(
+      TraceStorageSnapshot::Restore(data, size, std::move(buffer), &restored)
+          .ok());
+
+  // The values of all the columns are read from the snapshot.
+  auto* slices = restored.mutable_slice_table();
+  const auto& ts = GetStorage<int64_t>(slices->ts());
+  EXPECT_TRUE(ts.IsExternal());
+  EXPECT_GE(reinterpret_cast<const uint8_t*>(ts.data()), data);
+  EXPECT_LT(reinterpret_cast<const uint8_t*>(ts.data()), data + size);
+  EXPECT_EQ(slices->ts()[42], 1042);
+
+  // A new storage assigns the same StringIds, so string columns are used as
+  // they are.
+  EXPECT_TRUE(GetStorage<StringPool::Id>(slices->name()).IsExternal());
+  EXPECT_EQ(restored.GetString(*slices->name()[5]).ToStdString(), "slice_5");
+
+  const auto& thread_ts = GetStorage<base::Optional<int64_t>>(
+      slices->thread_ts());
+  EXPECT_TRUE(thread_ts.non_null_values().IsExternal());
+  EXPECT_EQ(slices->thread_ts()[3], 6);
+  EXPECT_FALSE(slices->thread_ts()[4].has_value());
+
+  // Mutations copy the values first.
+  slices->mutable_ts()->Set(42, 7);
+  slices->Insert(tables::SliceTable::Row(3000));
+  EXPECT_FALSE(ts.IsExternal());
+  EXPECT_EQ(slices->ts()[41], 1041);
+  EXPECT_EQ(slices->ts()[42], 7);
+  EXPECT_EQ(slices->ts()[101], 3000);
+  EXPECT_EQ(slices->row_count(), 102u);
+}
+
+TEST_F(TraceStorageSnapshotTest, TruncatedSnapshotLeavesStorageUntouched) {
+  PopulateStorage();
+  std::string snapshot = WriteSnapshot(storage_);
+
+  for (size_t size : {size_t(4), snapshot.size() / 2, snapshot.size() - 1}) {
+    TraceStorage restored;
+    restored.mutable_thread_table()->Insert(tables::ThreadTable::Row(1));
+    EXPECT_FALSE(Restore(snapshot.substr(0, size), &restored).ok());
+    ASSERT_EQ(restored.thread_table().row_count(), 1u);
+    EXPECT_EQ(restored.thread_table().tid()[0], 1u);
+    EXPECT_EQ(restored.slice_table().row_count(), 0u);
+  }
+}
+
+TEST_F(TraceStorageSnapshotTest, OverlayOutOfBoundsOfParentStorage) {
+  PopulateStorage();
+  std::string snapshot = WriteSnapshot(storage_);
+
+  // The overlay of the gpu_slice table over the columns of the slice table is
+  // a bitvector of 101 bits with only bit 100 set. Move the bit past the 101
+  // rows of the slice table, keeping the same number of words.
+  size_t overlay = FindTable(snapshot, "gpu_slice", 1, 2);
+  ASSERT_EQ(snapshot[overlay], 1);  // BitVector.
+  Overwrite<uint32_t>(&snapshot, overlay + 1, 128);
+  size_t words = (overlay + 5 + sizeof(uint64_t) + 7) / 8 * 8;
+  Overwrite<uint64_t>(&snapshot, words + sizeof(uint64_t), uint64_t(1) << 63);
+
+  TraceStorage restored;
+  size_t string_count = restored.string_pool().size();
+  EXPECT_FALSE(Restore(snapshot, &restored).ok());
+  EXPECT_EQ(restored.slice_table().row_count(), 0u);
+  EXPECT_EQ(restored.gpu_slice_table().row_count(), 0u);
+  EXPECT_EQ(restored.string_pool().size(), string_count);
+}
+
+TEST_F(TraceStorageSnapshotTest, StringIdNotInSnapshot) {
+  PopulateStorage();
+  std::string snapshot = WriteSnapshot(storage_);
+
+  // Columns of the thread table: tid, then name.
+  size_t table = FindTable(snapshot, "internal_thread", 2, 1);
+  size_t column = snapshot.find("\x04name", table);
+  ASSERT_NE(column, std::string::npos);
+  size_t count = column + 5 + 2 * sizeof(uint8_t);
+  size_t data = (count + sizeof(uint64_t) + 7) / 8 * 8;
+  Overwrite<uint32_t>(&snapshot, data, 1000000);
+
+  // Both when the pool assigns the same StringIds as the storage the snapshot
+  // was written from and when they need to be converted.
+  TraceStorage same_ids;
+  EXPECT_FALSE(Restore(snapshot, &same_ids).ok());
+  EXPECT_EQ(same_ids.thread_table().row_count(), 0u);
+  EXPECT_EQ(same_ids.slice_table().row_count(), 0u);
+
+  TraceStorage other_ids;
+  other_ids.InternString("unrelated");
+  EXPECT_FALSE(Restore(snapshot, &other_ids).ok());
+  EXPECT_EQ(other_ids.thread_table().row_count(), 0u);
+  EXPECT_EQ(other_ids.slice_table().row_count(), 0u);
+}
+
+TEST_F(TraceStorageSnapshotTest, ColumnSizeMismatch) {
+  PopulateStorage();
+  std::string snapshot = WriteSnapshot(storage_);
+
+  // Pretend that the thread table has one row only: its columns still have
+  // two.
+  size_t table = FindTable(snapshot, "internal_thread", 2, 1);
+  Overwrite<uint32_t>(&snapshot, table - 8, 1);
+  Overwrite<uint32_t>(&snapshot, table + 5, 1);
+
+  TraceStorage restored;
+  EXPECT_FALSE(Restore(snapshot, &restored).ok());
+  EXPECT_EQ(restored.thread_table().row_count(), 0u);
+}
+
+TEST_F(TraceStorageSnapshotTest, VersionMismatch) {
+  std::string snapshot = WriteSnapshot(storage_);
+  snapshot[TraceStorageSnapshot::kMagicSize] ^= 0x7f;
+  TraceStorage restored;
+  EXPECT_FALSE(Restore(snapshot, &restored).ok());
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/storage/trace_storage.h"
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+class TraceStorageTest : public ::testing::Test {
+ protected:
+  void AddIntArg(uint32_t arg_set_id, const char* key, int64_t value) {
+    tables::ArgTable::Row row;
+    row.arg_set_id = arg_set_id;
+    row.flat_key = storage_.InternString(key);
+    row.key = row.flat_key;
+    row.int_value = value;
+    row.value_type = storage_.GetIdForVariadicType(Variadic::Type::kInt);
+    storage_.mutable_arg_table()->Insert(row);
+  }
+
+  base::Optional<int64_t> Extract(uint32_t arg_set_id, const char* key) {
+    base::Optional<Variadic> value;
+    EXPECT_TRUE(storage_.ExtractArg(arg_set_id, key, &value).ok());
+    if (!value)
+      return base::nullopt;
+    EXPECT_EQ(value->type, Variadic::Type::kInt);
+    return value->int_value;
+  }
+
+  TraceStorage storage_;
+};
+
+TEST_F(TraceStorageTest, ExtractArg) {
+  AddIntArg(1, "a", 10);
+  AddIntArg(1, "b", 11);
+  // Arg set 2 has no args.
+  AddIntArg(3, "a", 30);
+
+  ASSERT_EQ(Extract(1, "a"), 10);
+  ASSERT_EQ(Extract(1, "b"), 11);
+  ASSERT_EQ(Extract(2, "a"), base::nullopt);
+  ASSERT_EQ(Extract(3, "a"), 30);
+  ASSERT_EQ(Extract(3, "b"), base::nullopt);
+  ASSERT_EQ(Extract(1, "unknown_key"), base::nullopt);
+  ASSERT_EQ(Extract(4, "a"), base::nullopt);
+  ASSERT_EQ(storage_.GetArgSetRows(2), std::make_pair(2u, 2u));
+
+  // Arg sets added after the first lookup are found as well.
+  AddIntArg(5, "b", 50);
+  ASSERT_EQ(Extract(3, "a"), 30);
+  ASSERT_EQ(Extract(4, "b"), base::nullopt);
+  ASSERT_EQ(Extract(5, "b"), 50);
+
+  // Lookups keep working once the table is compressed.
+  storage_.ShrinkToFitTables();
+  ASSERT_EQ(Extract(1, "b"), 11);
+  ASSERT_EQ(Extract(5, "b"), 50);
+}
+
+TEST_F(TraceStorageTest, ExtractArgMultipleMatches) {
+  AddIntArg(1, "a", 10);
+  AddIntArg(1, "a", 11);
+
+  base::Optional<Variadic> value;
+  ASSERT_FALSE(storage_.ExtractArg(1, "a", &value).ok());
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -935,7 +935,7 @@ class AbstractConstRowReference {
                                                                               \
     /*                                                                        \
      * Expands to                                                             \
-     * NullableVector<col1_type> col1_;                                       \
+     * ColumnStorage<col1_type> col1_;                                        \
      * ...                                                                    \
      */                                                                       \
     PERFETTO_TP_TABLE_COLUMNS(DEF, PERFETTO_TP_TABLE_MEMBER)                  \
@@ -414,7 +414,20 @@ TEST_F(TraceProcessorIntegrationTest, RestoreInitialTables) {
     it.Next();
     ASSERT_TRUE(it.Status().ok());
 
-    ASSERT_EQ(RestoreInitialTables(), 3u);
+    // Created again with the same name on every iteration.
+    it = Query("CREATE PERFETTO TABLE user4 AS SELECT name FROM stats;");
+    it.Next();
+    ASSERT_TRUE(it.Status().ok());
+
+    it = Query("CREATE VIEW user5 AS SELECT * FROM user4;");
+    it.Next();
+    ASSERT_TRUE(it.Status().ok());
+
+    ASSERT_EQ(RestoreInitialTables(), 5u);
+
+    it = Query("SELECT * FROM user4;");
+    it.Next();
+    ASSERT_FALSE(it.Status().ok());
   }
 }
 
@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/trace_processor_impl.h"
 
+#include <fcntl.h>
+
 #include <algorithm>
 #include <cstdint>
 #include <memory>
@@ -24,6 +26,7 @@
 #include "perfetto/base/logging.h"
 #include "perfetto/base/status.h"
 #include "perfetto/base/time.h"
+#include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
@@ -35,8 +38,10 @@
 #include "src/trace_processor/dynamic/experimental_counter_dur_generator.h"
 #include "src/trace_processor/dynamic/experimental_flamegraph_generator.h"
 #include "src/trace_processor/dynamic/experimental_flat_slice_generator.h"
+#include "src/trace_processor/dynamic/experimental_group_by_generator.h"
 #include "src/trace_processor/dynamic/experimental_sched_upid_generator.h"
 #include "src/trace_processor/dynamic/experimental_slice_layout_generator.h"
+#include "src/trace_processor/dynamic/intervals_overlapping_generator.h"
 #include "src/trace_processor/dynamic/view_generator.h"
 #include "src/trace_processor/importers/additional_modules.h"
 #include "src/trace_processor/importers/android_bugreport/android_bugreport_parser.h"
@@ -51,6 +56,7 @@
 #include "src/trace_processor/importers/systrace/systrace_trace_parser.h"
 #include "src/trace_processor/iterator_impl.h"
 #include "src/trace_processor/sqlite/functions/create_function.h"
+#include "src/trace_processor/sqlite/functions/create_perfetto_table.h"
 #include "src/trace_processor/sqlite/functions/create_view_function.h"
 #include "src/trace_processor/sqlite/functions/import.h"
 #include "src/trace_processor/sqlite/functions/pprof_functions.h"
@@ -67,6 +73,7 @@
 #include "src/trace_processor/sqlite/stats_table.h"
 #include "src/trace_processor/sqlite/window_operator_table.h"
 #include "src/trace_processor/stdlib/utils.h"
+#include "src/trace_processor/storage/trace_storage_snapshot.h"
 #include "src/trace_processor/tp_metatrace.h"
 #include "src/trace_processor/types/variadic.h"
 #include "src/trace_processor/util/protozero_to_text.h"
@@ -237,6 +244,9 @@ void CreateBuiltinViews(sqlite3* db) {
                nullptr, nullptr, &error);
   MaybeRegisterError(error);
 
+  // The views which only add copies of columns to a table (slice, slices,
+  // thread and process) are also registered with the intervals_overlapping
+  // generator in the TraceProcessorImpl constructor: keep them in sync.
   sqlite3_exec(db,
                "CREATE VIEW slice AS "
                "SELECT "
@@ -555,7 +565,19 @@ base::Status PrepareAndStepUntilLastValidStmt(
     {
       PERFETTO_TP_TRACE(metatrace::Category::QUERY, "QUERY_PREPARE");
       const char* tail = nullptr;
-      RETURN_IF_ERROR(sqlite_utils::PrepareStmt(db, rem_sql, &cur_stmt, &tail));
+      // CREATE PERFETTO TABLE is not understood by SQLite: it is rewritten
+      // into a call to the CREATE_PERFETTO_TABLE function.
+      std::string rewritten_sql;
+      RETURN_IF_ERROR(CreatePerfettoTable::RewriteStatement(
+          db, rem_sql, &rewritten_sql, &tail));
+      if (rewritten_sql.empty()) {
+        RETURN_IF_ERROR(
+            sqlite_utils::PrepareStmt(db, rem_sql, &cur_stmt, &tail));
+      } else {
+        const char* rewritten_tail = nullptr;
+        RETURN_IF_ERROR(sqlite_utils::PrepareStmt(db, rewritten_sql.c_str(),
+                                                  &cur_stmt, &rewritten_tail));
+      }
       rem_sql = tail;
     }
 
@@ -638,6 +660,8 @@ const char* TraceTypeToString(TraceType trace_type) {
       return "ninja_log";
     case kAndroidBugreportTraceType:
       return "android_bugreport";
+    case kSnapshotTraceType:
+      return "snapshot";
   }
   PERFETTO_FATAL("For GCC");
 }
@@ -683,6 +707,9 @@ TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
   CreateBuiltinViews(db);
   db_.reset(std::move(db));
 
+  // Setup the query cache.
+  query_cache_.reset(new QueryCache());
+
   // New style function registration.
   if (cfg.enable_dev_features) {
     RegisterDevFunctions(db);
@@ -707,6 +734,12 @@ TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
       db, "CREATE_VIEW_FUNCTION", 3,
       std::unique_ptr<CreateViewFunction::Context>(
           new CreateViewFunction::Context{db_.get()}));
+  RegisterFunction<CreatePerfettoTable>(
+      db, "CREATE_PERFETTO_TABLE", 2,
+      std::unique_ptr<CreatePerfettoTable::Context>(
+          new CreatePerfettoTable::Context{
+              db_.get(), query_cache_.get(),
+              context_.storage->mutable_string_pool(), &runtime_tables_}));
   RegisterFunction<Import>(db, "IMPORT", 1,
                            std::unique_ptr<Import::Context>(new Import::Context{
                                db_.get(), this, stdlib::SetupStdLib()}));
@@ -725,16 +758,21 @@ TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
 
   SetupMetrics(this, *db_, &sql_metrics_, cfg.skip_builtin_metric_paths);
 
-  // Setup the query cache.
-  query_cache_.reset(new QueryCache());
-
   const TraceStorage* storage = context_.storage.get();
 
   SqlStatsTable::RegisterTable(*db_, storage);
   StatsTable::RegisterTable(*db_, storage);
 
+  // The intervals_overlapping table is also used by span join to skip the
+  // spans of db tables which cannot be part of the output.
+  std::unique_ptr<IntervalsOverlappingGenerator> intervals_generator(
+      new IntervalsOverlappingGenerator(
+          context_.storage.get()->mutable_string_pool()));
+  intervals_generator_ = intervals_generator.get();
+  RegisterDynamicTable(std::move(intervals_generator));
+
   // Operator tables.
-  SpanJoinOperatorTable::RegisterTable(*db_, storage);
+  SpanJoinOperatorTable::RegisterTable(*db_, intervals_generator_);
   WindowOperatorTable::RegisterTable(*db_, storage);
   CreateViewFunction::RegisterTable(*db_);
 
@@ -780,6 +818,11 @@ TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
       new ExperimentalAnnotatedStackGenerator(&context_)));
   RegisterDynamicTable(std::unique_ptr<ExperimentalFlatSliceGenerator>(
       new ExperimentalFlatSliceGenerator(&context_)));
+  std::unique_ptr<ExperimentalGroupByGenerator> group_by_generator(
+      new ExperimentalGroupByGenerator(
+          context_.storage.get()->mutable_string_pool()));
+  group_by_generator_ = group_by_generator.get();
+  RegisterDynamicTable(std::move(group_by_generator));
 
   // Views.
   RegisterView(storage->thread_slice_view());
@@ -857,6 +900,20 @@ TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
   RegisterDbTable(storage->experimental_proto_content_table());
 
   RegisterDbTable(storage->experimental_missing_chrome_processes_table());
+
+  // Views created by CreateBuiltinViews() which only add copies of columns,
+  // or ts + dur, to a table: the span join can read their rows from the table
+  // directly.
+  intervals_generator_->AddView("slice", &storage->slice_table(),
+                                {{"cat", "category"}, {"slice_id", "id"}});
+  intervals_generator_->AddView("slices", &storage->slice_table(),
+                                {{"cat", "category"}, {"slice_id", "id"}});
+  intervals_generator_->AddView("thread", &storage->thread_table(),
+                                {{"utid", "id"}});
+  intervals_generator_->AddView("process", &storage->process_table(),
+                                {{"upid", "id"}});
+  intervals_generator_->AddView("sched", &storage->sched_slice_table(), {},
+                                {"ts_end"});
 }
 
 TraceProcessorImpl::~TraceProcessorImpl() = default;
@@ -920,6 +977,9 @@ void TraceProcessorImpl::NotifyEndOfFile() {
 
   context_.storage->ShrinkToFitTables();
 
+  // The tables are complete: the interval indices can now be cached.
+  intervals_generator_->OnTablesFinalized();
+
   // Rebuild the bounds table once everything has been completed: we do this
   // so that if any data was added to tables in
   // TraceProcessorStorageImpl::NotifyEndOfFile, this will be counted in
@@ -943,6 +1003,11 @@ size_t TraceProcessorImpl::RestoreInitialTables() {
       deletion_list.push_back(std::make_pair(type, name));
     }
   }
+  // The tables created with CREATE PERFETTO TABLE are virtual table modules
+  // rather than entries of sqlite_master: they can only have been created
+  // after loading the trace.
+  for (const auto& table : runtime_tables_)
+    msg += " " + table.first;
 
   PERFETTO_LOG("%s", msg.c_str());
 
@@ -959,7 +1024,43 @@ size_t TraceProcessorImpl::RestoreInitialTables() {
     if (!it.Status().ok() && tn.first != "index")
       PERFETTO_FATAL("%s -> %s", query.c_str(), it.Status().c_message());
   }
-  return deletion_list.size();
+
+  // Step 3: delete the CREATE PERFETTO TABLE tables, after the views which
+  // may use them. Unregistering the module destroys its DbSqliteTable, which
+  // points to the table, so this has to happen before the table is deleted.
+  size_t runtime_table_count = runtime_tables_.size();
+  for (const auto& table : runtime_tables_) {
+    const std::string& name = table.first;
+    int ret = sqlite3_create_module_v2(db_.get(), name.c_str(), nullptr,
+                                       nullptr, nullptr);
+    if (ret != SQLITE_OK)
+      PERFETTO_FATAL("Unregistering %s failed: %d", name.c_str(), ret);
+    ScopedSqliteString query(sqlite3_mprintf(
+        "DELETE FROM perfetto_tables WHERE name = %Q", name.c_str()));
+    auto it = ExecuteQuery(query.get());
+    while (it.Next()) {
+    }
+    if (!it.Status().ok())
+      PERFETTO_FATAL("%s -> %s", query.get(), it.Status().c_message());
+  }
+  runtime_tables_.clear();
+  return deletion_list.size() + runtime_table_count;
+}
+
+base::Status TraceProcessorImpl::SaveSnapshot(const std::string& path) {
+  if (!notify_eof_called_)
+    return base::ErrStatus("The trace must be fully loaded to save a snapshot");
+  base::ScopedFile fd(base::OpenFile(path, O_CREAT | O_RDWR | O_TRUNC, 0600));
+  if (!fd)
+    return base::ErrStatus("Unable to open snapshot file %s", path.c_str());
+  return TraceStorageSnapshot::Write(*context_.storage, *fd);
+}
+
+base::Status TraceProcessorImpl::SaveSnapshotToBuffer(
+    std::vector<uint8_t>* snapshot) {
+  if (!notify_eof_called_)
+    return base::ErrStatus("The trace must be fully loaded to save a snapshot");
+  return TraceStorageSnapshot::Write(*context_.storage, snapshot);
 }
 
 Iterator TraceProcessorImpl::ExecuteQuery(const std::string& sql) {
@@ -29,8 +29,11 @@
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/status.h"
 #include "perfetto/trace_processor/trace_processor.h"
+#include "src/trace_processor/dynamic/experimental_group_by_generator.h"
+#include "src/trace_processor/dynamic/intervals_overlapping_generator.h"
 #include "src/trace_processor/sqlite/db_sqlite_table.h"
 #include "src/trace_processor/sqlite/functions/create_function.h"
+#include "src/trace_processor/sqlite/functions/create_perfetto_table.h"
 #include "src/trace_processor/sqlite/functions/create_view_function.h"
 #include "src/trace_processor/sqlite/functions/import.h"
 #include "src/trace_processor/sqlite/query_cache.h"
@@ -89,6 +92,9 @@ class TraceProcessorImpl : public TraceProcessor,
 
   size_t RestoreInitialTables() override;
 
+  base::Status SaveSnapshot(const std::string& path) override;
+  base::Status SaveSnapshotToBuffer(std::vector<uint8_t>* snapshot) override;
+
   std::string GetCurrentTraceName() override;
   void SetCurrentTraceName(const std::string&) override;
 
@@ -105,6 +111,8 @@ class TraceProcessorImpl : public TraceProcessor,
   void RegisterDbTable(const Table& table) {
     DbSqliteTable::RegisterTable(*db_, query_cache_.get(), Table::Schema(),
                                  &table, Table::Name());
+    group_by_generator_->AddTable(Table::Name(), &table);
+    intervals_generator_->AddTable(Table::Name(), &table);
   }
 
   void RegisterDynamicTable(std::unique_ptr<DynamicTableGenerator> generator) {
@@ -127,6 +135,17 @@ class TraceProcessorImpl : public TraceProcessor,
 
   std::unique_ptr<QueryCache> query_cache_;
 
+  // Tables created by CREATE PERFETTO TABLE statements.
+  CreatePerfettoTable::Tables runtime_tables_;
+
+  // Owned by the experimental_group_by table registered in the constructor;
+  // every db table is made available to it by RegisterDbTable().
+  ExperimentalGroupByGenerator* group_by_generator_ = nullptr;
+
+  // Owned by the intervals_overlapping table registered in the constructor;
+  // every db table is made available to it by RegisterDbTable().
+  IntervalsOverlappingGenerator* intervals_generator_ = nullptr;
+
   DescriptorPool pool_;
   std::vector<metrics::SqlMetricFile> sql_metrics_;
   std::unordered_map<std::string, std::string> proto_field_to_sql_metric_path_;
@@ -685,6 +685,7 @@ struct CommandLineOptions {
   std::string metric_names;
   std::string metric_output;
   std::string trace_file_path;
+  std::string snapshot_path;
   std::string port_number;
   std::vector<std::string> raw_metric_extensions;
   bool launch_shell = false;
@@ -745,6 +746,10 @@ Options:
                                       last N events.
  --metatrace-categories CATEGORIES    A comma-separated list of metatrace
                                       categories to enable.
+ --save-snapshot FILE                 Writes a snapshot of all the tables built
+                                      from the trace into FILE. Later runs can
+                                      load FILE instead of the trace to skip
+                                      parsing it again.
  --full-sort                          Forces the trace processor into performing
                                       a full sort ignoring any windowing
                                       logic.
@@ -779,6 +784,7 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
     OPT_NO_FTRACE_RAW,
     OPT_METATRACE_BUFFER_CAPACITY,
     OPT_METATRACE_CATEGORIES,
+    OPT_SAVE_SNAPSHOT,
   };
 
   static const option long_options[] = {
@@ -804,6 +810,7 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       {"metric-extension", required_argument, nullptr, OPT_METRIC_EXTENSION},
       {"dev", no_argument, nullptr, OPT_DEV},
       {"no-ftrace-raw", no_argument, nullptr, OPT_NO_FTRACE_RAW},
+      {"save-snapshot", required_argument, nullptr, OPT_SAVE_SNAPSHOT},
       {nullptr, 0, nullptr, 0}};
 
   bool explicit_interactive = false;
@@ -917,6 +924,11 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       continue;
     }
 
+    if (option == OPT_SAVE_SNAPSHOT) {
+      command_line_options.snapshot_path = optarg;
+      continue;
+    }
+
     PrintUsage(argv);
     exit(option == 'h' ? 0 : 1);
   }
@@ -925,7 +937,8 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       explicit_interactive || (command_line_options.pre_metrics_path.empty() &&
                                command_line_options.metric_names.empty() &&
                                command_line_options.query_file_path.empty() &&
-                               command_line_options.sqlite_file_path.empty());
+                               command_line_options.sqlite_file_path.empty() &&
+                               command_line_options.snapshot_path.empty());
 
   // Only allow non-interactive queries to emit perf data.
   if (!command_line_options.perf_file_path.empty() &&
@@ -1414,6 +1427,11 @@ base::Status TraceProcessorMain(int argc, char** argv) {
                   t_load_s, size_mb / t_load_s);
 
     RETURN_IF_ERROR(PrintStats());
+
+    if (!options.snapshot_path.empty()) {
+      RETURN_IF_ERROR(g_tp->SaveSnapshot(options.snapshot_path));
+      PERFETTO_ILOG("Snapshot written to %s", options.snapshot_path.c_str());
+    }
   }
 
 #if PERFETTO_HAS_SIGNAL_H()
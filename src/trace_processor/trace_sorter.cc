@@ -205,7 +205,7 @@ void TraceSorter::EvictVariadic(const TimestampedDescriptor& ts_desc) {
       EvictTypedVariadic<FuchsiaRecord>(ts_desc);
       return;
     case EventType::kJsonValue:
-      EvictTypedVariadic<std::string>(ts_desc);
+      EvictTypedVariadic<TraceBlobView>(ts_desc);
       return;
     case EventType::kSystraceLine:
       EvictTypedVariadic<SystraceLine>(ts_desc);
@@ -241,7 +241,7 @@ void TraceSorter::ParseTracePacket(const TimestampedDescriptor& ts_desc) {
       return;
     case EventType::kJsonValue:
       parser_->ParseJsonPacket(ts_desc.ts,
-                               EvictTypedVariadic<std::string>(ts_desc));
+                               EvictTypedVariadic<TraceBlobView>(ts_desc));
       return;
     case EventType::kSystraceLine:
       parser_->ParseSystraceLine(ts_desc.ts,
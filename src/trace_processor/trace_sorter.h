@@ -125,7 +125,7 @@ class TraceSorter {
     AppendNonFtraceEvent(timestamp, offset, EventType::kTracePacket);
   }
 
-  inline void PushJsonValue(int64_t timestamp, std::string json_value) {
+  inline void PushJsonValue(int64_t timestamp, TraceBlobView json_value) {
     uint32_t offset = variadic_queue_.Append(std::move(json_value));
     AppendNonFtraceEvent(timestamp, offset, EventType::kJsonValue);
   }
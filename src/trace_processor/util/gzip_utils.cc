@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/util/gzip_utils.h"
 
+#include <algorithm>
+
 // For bazel build.
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/compiler.h"
@@ -30,6 +32,22 @@ namespace perfetto {
 namespace trace_processor {
 namespace util {
 
+namespace {
+
+// Size of the gzip trailer: CRC32 + ISIZE (uncompressed size mod 2^32).
+constexpr size_t kGzipTrailerSize = 8;
+
+// Deflate can't achieve a compression ratio better than ~1032:1. Used to
+// sanity check the ISIZE hint before trusting it for an allocation.
+constexpr uint64_t kMaxDeflateRatio = 1032;
+
+// Upper bound for pre-sizing the output from the ISIZE hint. The trailer is
+// attacker controlled, so larger outputs are grown as they are inflated
+// rather than allocated (and zero-filled) upfront.
+constexpr size_t kMaxPresize = 4 * 1024 * 1024;
+
+}  // namespace
+
 bool IsGzipSupported() {
 #if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
   return true;
@@ -40,7 +58,16 @@ bool IsGzipSupported() {
 
 #if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)  // Real Implementation
 
-GzipDecompressor::GzipDecompressor(InputMode mode) : z_stream_(new z_stream()) {
+namespace {
+
+// The first two bytes of every gzip member (RFC 1952).
+constexpr uint8_t kGzipMagic0 = 0x1f;
+constexpr uint8_t kGzipMagic1 = 0x8b;
+
+}  // namespace
+
+GzipDecompressor::GzipDecompressor(InputMode mode)
+    : z_stream_(new z_stream()), mode_(mode) {
   z_stream_->zalloc = nullptr;
   z_stream_->zfree = nullptr;
   z_stream_->opaque = nullptr;
@@ -56,9 +83,15 @@ GzipDecompressor::~GzipDecompressor() {
 
 void GzipDecompressor::Reset() {
   inflateReset(z_stream_.get());
+  member_ended_ = false;
 }
 
 void GzipDecompressor::Feed(const uint8_t* data, size_t size) {
+  // A new gzip member starting at a Feed() boundary.
+  if (member_ended_ && mode_ == InputMode::kGzip && size > 0 &&
+      data[0] == kGzipMagic0) {
+    Reset();
+  }
   // This const_cast is not harmfull as zlib will not modify the data in this
   // pointer. This is only necessary because of the build flags we use to be
   // compatible with other embedders.
@@ -82,8 +115,21 @@ GzipDecompressor::Result GzipDecompressor::ExtractOutput(uint8_t* out,
       // Ignore inflateEnd error as we will error out anyway.
       inflateEnd(z_stream_.get());
       return Result{ResultCode::kError, 0};
-    case Z_STREAM_END:
-      return Result{ResultCode::kEof, out_size - z_stream_->avail_out};
+    case Z_STREAM_END: {
+      size_t bytes_written = out_size - z_stream_->avail_out;
+      member_ended_ = true;
+      // If what follows is another gzip member, keep going with it. Anything
+      // else (e.g. zero padding) is trailing garbage and is ignored, as
+      // gzip(1) does.
+      const uint8_t* next = z_stream_->next_in;
+      uInt avail = z_stream_->avail_in;
+      if (mode_ == InputMode::kGzip && avail > 0 && next[0] == kGzipMagic0 &&
+          (avail == 1 || next[1] == kGzipMagic1)) {
+        Reset();
+        return Result{ResultCode::kOk, bytes_written};
+      }
+      return Result{ResultCode::kEof, bytes_written};
+    }
     case Z_BUF_ERROR:
       return Result{ResultCode::kNeedsMoreInput, 0};
     default:
@@ -93,7 +139,9 @@ GzipDecompressor::Result GzipDecompressor::ExtractOutput(uint8_t* out,
 
 #else  // Dummy Implementation
 
-GzipDecompressor::GzipDecompressor(InputMode) {}
+GzipDecompressor::GzipDecompressor(InputMode mode) : mode_(mode) {
+  base::ignore_result(mode_, member_ended_);
+}
 GzipDecompressor::~GzipDecompressor() = default;
 void GzipDecompressor::Reset() {}
 void GzipDecompressor::Feed(const uint8_t*, size_t) {}
@@ -108,10 +156,38 @@ std::vector<uint8_t> GzipDecompressor::DecompressFully(const uint8_t* data,
                                                        size_t len) {
   std::vector<uint8_t> whole_data;
   GzipDecompressor decompressor;
-  auto decom_output_consumer = [&](const uint8_t* buf, size_t buf_len) {
-    whole_data.insert(whole_data.end(), buf, buf + buf_len);
-  };
-  decompressor.FeedAndExtract(data, len, decom_output_consumer);
+  decompressor.Feed(data, len);
+
+  // ISIZE is only a hint: it is truncated to 32 bits and, for multi-member
+  // inputs, only covers the last member. The loop below grows the buffer if
+  // the hint turns out to be too small.
+  size_t size_hint = 0;
+  if (len >= kGzipTrailerSize) {
+    const uint8_t* isize = data + len - 4;
+    uint32_t hint = static_cast<uint32_t>(isize[0]) |
+                    static_cast<uint32_t>(isize[1]) << 8 |
+                    static_cast<uint32_t>(isize[2]) << 16 |
+                    static_cast<uint32_t>(isize[3]) << 24;
+    if (hint <= static_cast<uint64_t>(len) * kMaxDeflateRatio)
+      size_hint = std::min<size_t>(hint, kMaxPresize);
+  }
+  // The +1 lets inflate() consume the trailer and report the end of stream
+  // in the same pass, rather than stopping as soon as the buffer is full.
+  whole_data.resize(std::max<size_t>(size_hint + 1, 4096));
+
+  size_t bytes_written = 0;
+  for (;;) {
+    if (bytes_written == whole_data.size())
+      whole_data.resize(whole_data.size() * 2);
+    Result result = decompressor.ExtractOutput(
+        whole_data.data() + bytes_written, whole_data.size() - bytes_written);
+    if (result.ret == ResultCode::kError)
+      break;
+    bytes_written += result.bytes_written;
+    if (result.ret != ResultCode::kOk)
+      break;
+  }
+  whole_data.resize(bytes_written);
   return whole_data;
 }
 
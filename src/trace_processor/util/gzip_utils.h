@@ -83,6 +83,12 @@ class GzipDecompressor {
   GzipDecompressor& operator=(const GzipDecompressor&) = delete;
 
   // Feed the next mem-block.
+  // In kGzip mode, if the previous gzip member has been fully decompressed
+  // (i.e. ExtractOutput returned kEof) and |data| begins with a new gzip
+  // header, the decompressor is transparently reset to start decoding the new
+  // member. This allows multi-member gzip files (e.g. the output of
+  // `cat a.gz b.gz` or of parallel compressors like pigz) to be decoded as a
+  // single stream.
   void Feed(const uint8_t* data, size_t size);
 
   // Feed the next mem-block and extract output in the callback consumer.
@@ -107,6 +113,9 @@ class GzipDecompressor {
   // Extract the newly available partial output. On each 'Feed', this method
   // should be called repeatedly until there is no more data to output
   // i.e. (either 'kEof' or 'kNeedsMoreInput').
+  // When a gzip member ends and the remaining input begins with another gzip
+  // member, 'kOk' is returned instead of 'kEof' and decompression carries on
+  // with the next member on the following call.
   Result ExtractOutput(uint8_t* out, size_t out_capacity);
 
   // Sets the state of the decompressor to reuse with other gzip streams.
@@ -117,10 +126,17 @@ class GzipDecompressor {
   // Decompress the entire mem-block and return decompressed mem-block.
   // This is used for decompressing small strings or small files
   // which doesn't require streaming decompression.
+  // The output is pre-sized using the ISIZE field in the gzip trailer, so that
+  // the common case of a single-member input is decompressed straight into
+  // the returned vector with a single inflate pass.
   static std::vector<uint8_t> DecompressFully(const uint8_t* data, size_t len);
 
  private:
   std::unique_ptr<z_stream_s> z_stream_;
+  InputMode mode_;
+
+  // Set when the current gzip member has been fully decompressed.
+  bool member_ended_ = false;
 };
 
 }  // namespace util
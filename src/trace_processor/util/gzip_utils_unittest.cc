@@ -49,6 +49,24 @@ static std::string TrivialGzipCompress(const std::string& input) {
   return std::string(output, buffer_len - defstream.avail_out);
 }
 
+// Compresses |input| as a single gzip member (i.e. with a gzip header and
+// trailer, rather than the zlib ones emitted by TrivialGzipCompress).
+static std::string GzipMemberCompress(const std::string& input) {
+  z_stream defstream{};
+  deflateInit2(&defstream, Z_BEST_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8,
+               Z_DEFAULT_STRATEGY);
+  std::string output(deflateBound(&defstream, uLong(input.size())), '\0');
+  defstream.avail_in = uint32_t(input.size());
+  defstream.next_in =
+      const_cast<Bytef*>(reinterpret_cast<const Bytef*>(input.data()));
+  defstream.avail_out = uint32_t(output.size());
+  defstream.next_out = reinterpret_cast<Bytef*>(&output[0]);
+  PERFETTO_CHECK(deflate(&defstream, Z_FINISH) == Z_STREAM_END);
+  output.resize(output.size() - defstream.avail_out);
+  deflateEnd(&defstream);
+  return output;
+}
+
 // Trivially decompress using ZlibOnlineDecompress.
 // It's called 'trivial' because we are feeding the entire input in one shot.
 static std::string TrivialDecompress(const std::string& input) {
@@ -109,6 +127,65 @@ TEST(GzipDecompressor, Streaming) {
   EXPECT_EQ(input, decompressed);
 }
 
+TEST(GzipDecompressor, MultiMember) {
+  string compressed = GzipMemberCompress("Abc..") + GzipMemberCompress("Def..");
+  EXPECT_EQ("Abc..Def..", TrivialDecompress(compressed));
+}
+
+TEST(GzipDecompressor, MultiMemberSplitAtMemberBoundary) {
+  string first = GzipMemberCompress("Abc..");
+  string second = GzipMemberCompress("Def..");
+  string decompressed;
+  auto consumer = [&](const uint8_t* data, size_t len) {
+    decompressed.append(reinterpret_cast<const char*>(data), len);
+  };
+  GzipDecompressor decompressor;
+  EXPECT_EQ(decompressor.FeedAndExtract(
+                reinterpret_cast<const uint8_t*>(first.data()), first.size(),
+                consumer),
+            GzipDecompressor::ResultCode::kEof);
+  EXPECT_EQ(decompressor.FeedAndExtract(
+                reinterpret_cast<const uint8_t*>(second.data()),
+                second.size(), consumer),
+            GzipDecompressor::ResultCode::kEof);
+  EXPECT_EQ("Abc..Def..", decompressed);
+}
+
+TEST(GzipDecompressor, TrailingGarbageIgnored) {
+  string compressed = GzipMemberCompress("Abc..Def..Ghi");
+  compressed.append(64, '\0');
+  EXPECT_EQ("Abc..Def..Ghi", TrivialDecompress(compressed));
+}
+
+TEST(GzipDecompressor, DecompressFully) {
+  string input;
+  for (int i = 0; i < 10000; i++)
+    input += "Abc..Def..Ghi." + std::to_string(i);
+  string compressed = GzipMemberCompress(input);
+  std::vector<uint8_t> out = GzipDecompressor::DecompressFully(
+      reinterpret_cast<const uint8_t*>(compressed.data()), compressed.size());
+  EXPECT_EQ(input, string(out.begin(), out.end()));
+
+  // The ISIZE hint only covers the last member, so the output buffer needs to
+  // grow here.
+  string multi = compressed + GzipMemberCompress("Jkl");
+  out = GzipDecompressor::DecompressFully(
+      reinterpret_cast<const uint8_t*>(multi.data()), multi.size());
+  EXPECT_EQ(input + "Jkl", string(out.begin(), out.end()));
+}
+
+TEST(GzipDecompressor, DecompressFullyBogusSizeHint) {
+  // The last four bytes claim a ~4GB output. They are within the deflate
+  // ratio of the input size but must not be trusted for the allocation.
+  string compressed = GzipMemberCompress("Abc..Def..Ghi");
+  compressed.append(4 * 1024 * 1024, '\0');
+  compressed.append(4, '\xff');
+  std::vector<uint8_t> out = GzipDecompressor::DecompressFully(
+      reinterpret_cast<const uint8_t*>(compressed.data()), compressed.size());
+  EXPECT_EQ("Abc..Def..Ghi", string(out.begin(), out.end()));
+  EXPECT_LE(out.capacity(), 8u * 1024 * 1024);
+}
+
 static std::string ReadFile(const std::string& file_name) {
   std::ifstream fd(file_name, std::ios::binary);
   std::stringstream buffer;
@@ -0,0 +1,139 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sys/stat.h>
+
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/time.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/base/test/tmp_dir_tree.h"
+#include "src/traced/probes/filesystem/file_scanner.h"
+#include "src/traced/probes/filesystem/parallel_file_scanner.h"
+
+namespace perfetto {
+namespace {
+
+constexpr int kNumDirs = 64;
+constexpr int kFilesPerDir = 64;
+// One file out of |kWantedEvery| is looked for.
+constexpr int kWantedEvery = 97;
+
+std::string FilePath(int dir, int file) {
+  return base::StackString<32>("d%02d/f%02d", dir, file).ToStdString();
+}
+
+// Creates |kNumDirs| directories of |kFilesPerDir| files and returns the
+// inodes of some of the files.
+ParallelFileScanner::WantedInodes CreateTree(base::TmpDirTree* tree) {
+  ParallelFileScanner::WantedInodes wanted;
+  for (int dir = 0; dir < kNumDirs; dir++) {
+    tree->AddDir(base::StackString<8>("d%02d", dir).ToStdString());
+    for (int file = 0; file < kFilesPerDir; file++) {
+      std::string path = FilePath(dir, file);
+      tree->AddFile(path, "");
+      if ((dir * kFilesPerDir + file) % kWantedEvery != 0)
+        continue;
+      struct stat buf;
+      PERFETTO_CHECK(lstat(tree->AbsolutePath(path).c_str(), &buf) == 0);
+      wanted[buf.st_dev].insert(buf.st_ino);
+    }
+  }
+  return wanted;
+}
+
+// Stops the scan once all the wanted inodes have been found, like
+// InodeFileDataSource does.
+class WantedInodesDelegate : public FileScanner::Delegate {
+ public:
+  WantedInodesDelegate(const ParallelFileScanner::WantedInodes& wanted,
+                       std::function<void()> done_callback)
+      : wanted_(wanted), done_callback_(std::move(done_callback)) {}
+
+  bool OnInodeFound(BlockDeviceID block_device_id,
+                    Inode inode,
+                    const std::string&,
+                    InodeFileMap_Entry_Type) override {
+    auto it = wanted_.find(block_device_id);
+    if (it == wanted_.end() || it->second.erase(inode) == 0)
+      return true;
+    if (first_found_ns_ == 0)
+      first_found_ns_ = base::GetBootTimeNs().count();
+    if (it->second.empty())
+      wanted_.erase(it);
+    return !wanted_.empty();
+  }
+
+  void OnInodeScanDone() override { done_callback_(); }
+
+  int64_t first_found_ns() const { return first_found_ns_; }
+
+ private:
+  ParallelFileScanner::WantedInodes wanted_;
+  std::function<void()> done_callback_;
+  int64_t first_found_ns_ = 0;
+};
+
+// Arg 0: 0 to scan with FileScanner, otherwise the number of threads of the
+// ParallelFileScanner. The files are in the page cache, so this measures the
+// CPU cost of the scan rather than the I/O.
+void BM_FileScannerFindInodes(benchmark::State& state) {
+  base::TmpDirTree tree;
+  ParallelFileScanner::WantedInodes wanted = CreateTree(&tree);
+  uint32_t num_threads = static_cast<uint32_t>(state.range(0));
+
+  double first_found_ms = 0;
+  double cpu_ms = 0;
+  for (auto _ : state) {
+    int64_t start_ns = base::GetBootTimeNs().count();
+    if (num_threads == 0) {
+      int64_t cpu_start_ns = base::GetThreadCPUTimeNs().count();
+      WantedInodesDelegate delegate(wanted, [] {});
+      FileScanner scanner({tree.path()}, &delegate);
+      scanner.Scan();
+      cpu_ms += static_cast<double>(base::GetThreadCPUTimeNs().count() -
+                                    cpu_start_ns) /
+                1e6;
+      first_found_ms +=
+          static_cast<double>(delegate.first_found_ns() - start_ns) / 1e6;
+    } else {
+      base::TestTaskRunner task_runner;
+      WantedInodesDelegate delegate(wanted,
+                                    task_runner.CreateCheckpoint("done"));
+      ParallelFileScanner scanner({tree.path()}, wanted, &delegate,
+                                  num_threads);
+      scanner.Scan(&task_runner);
+      task_runner.RunUntilCheckpoint("done");
+      cpu_ms += static_cast<double>(scanner.stats().cpu_time_ns) / 1e6;
+      first_found_ms +=
+          static_cast<double>(delegate.first_found_ns() - start_ns) / 1e6;
+    }
+  }
+
+  state.counters["first_found_ms"] =
+      benchmark::Counter(first_found_ms, benchmark::Counter::kAvgIterations);
+  state.counters["scan_cpu_ms"] =
+      benchmark::Counter(cpu_ms, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_FileScannerFindInodes)->Arg(0)->Arg(1)->Arg(4)->UseRealTime();
+
+}  // namespace
+}  // namespace perfetto
@@ -55,6 +55,27 @@ std::string DbgFmt(const std::vector<std::string>& values) {
   return result;
 }
 
+// Drops the paths of a cached inode that have been deleted or now point to
+// another inode, possibly with the same number on another block device.
+void ValidateCacheEntry(BlockDeviceID block_device_id,
+                        Inode inode_number,
+                        InodeMapValue* value) {
+  std::set<std::string> paths;
+  for (const std::string& path : value->paths()) {
+    struct stat buf;
+    if (lstat(path.c_str(), &buf) == 0 && buf.st_ino == inode_number &&
+        buf.st_dev == block_device_id) {
+      paths.insert(path);
+    }
+  }
+  if (paths.size() != value->paths().size()) {
+    PERFETTO_DLOG("Dropped %zu stale paths of cached inode %" PRIu64,
+                  value->paths().size() - paths.size(),
+                  static_cast<uint64_t>(inode_number));
+    value->SetPaths(std::move(paths));
+  }
+}
+
 class StaticMapDelegate : public FileScanner::Delegate {
  public:
   StaticMapDelegate(
@@ -136,6 +157,7 @@ InodeFileDataSource::InodeFileDataSource(
   scan_delay_ms_ = OrDefault(cfg.scan_delay_ms(), kScanDelayMs);
   scan_batch_size_ = OrDefault(cfg.scan_batch_size(), kScanBatchSize);
   do_not_scan_ = cfg.do_not_scan();
+  scan_threads_ = cfg.scan_threads();
 }
 
 InodeFileDataSource::~InodeFileDataSource() = default;
@@ -177,11 +199,19 @@ void InodeFileDataSource::AddInodesFromLRUCache(
   uint64_t cache_found_count = 0;
   for (auto it = inode_numbers->begin(); it != inode_numbers->end();) {
     Inode inode_number = *it;
-    auto value = cache_->Get(std::make_pair(block_device_id, inode_number));
+    LRUInodeCache::InodeKey key(block_device_id, inode_number);
+    auto value = cache_->Get(key);
     if (value == nullptr) {
       ++it;
       continue;
     }
+    if (validated_cache_entries_.count(key) == 0) {
+      // Added by OnCacheEntriesValidated() once its paths have been checked.
+      if (validating_cache_entries_.insert(key).second)
+        cache_entries_to_validate_.push_back({key, *value});
+      it = inode_numbers->erase(it);
+      continue;
+    }
     cache_found_count++;
     it = inode_numbers->erase(it);
     FillInodeEntry(AddToCurrentTracePacket(block_device_id), inode_number,
@@ -223,47 +253,93 @@ void InodeFileDataSource::OnInodes(
     AddInodesFromStaticMap(block_device_id, &inode_numbers);
     AddInodesFromLRUCache(block_device_id, &inode_numbers);
 
-    if (do_not_scan_)
-      inode_numbers.clear();
-
-    // If we defined mount points we want to scan in the config,
-    // skip inodes on other mount points.
-    if (!scan_mount_points_.empty()) {
-      bool process = true;
-      auto range = mount_points_.equal_range(block_device_id);
-      for (auto it = range.first; it != range.second; ++it) {
-        if (scan_mount_points_.count(it->second) == 0) {
-          process = false;
-          break;
-        }
-      }
-      if (!process)
-        continue;
+    AddMissingInodes(block_device_id, inode_numbers);
+  }
+
+  if (!cache_entries_to_validate_.empty())
+    ValidateCacheEntries();
+}
+
+void InodeFileDataSource::AddMissingInodes(
+    BlockDeviceID block_device_id,
+    const std::set<Inode>& inode_numbers) {
+  if (do_not_scan_ || inode_numbers.empty())
+    return;
+
+  // If we defined mount points we want to scan in the config,
+  // skip inodes on other mount points.
+  if (!scan_mount_points_.empty()) {
+    auto range = mount_points_.equal_range(block_device_id);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (scan_mount_points_.count(it->second) == 0)
+        return;
     }
+  }
 
-    if (!inode_numbers.empty()) {
-      // Try to piggy back the current scan.
-      auto it = missing_inodes_.find(block_device_id);
-      if (it != missing_inodes_.end()) {
-        it->second.insert(inode_numbers.cbegin(), inode_numbers.cend());
-      }
-      next_missing_inodes_[block_device_id].insert(inode_numbers.cbegin(),
-                                                   inode_numbers.cend());
-      if (!scan_running_) {
-        scan_running_ = true;
-        auto weak_this = GetWeakPtr();
-        task_runner_->PostDelayedTask(
-            [weak_this] {
-              if (!weak_this) {
-                PERFETTO_DLOG("Giving up filesystem scan.");
-                return;
-              }
-              weak_this->FindMissingInodes();
-            },
-            scan_delay_ms_);
-      }
+  // Try to piggy back the current scan.
+  auto it = missing_inodes_.find(block_device_id);
+  if (it != missing_inodes_.end())
+    it->second.insert(inode_numbers.cbegin(), inode_numbers.cend());
+  next_missing_inodes_[block_device_id].insert(inode_numbers.cbegin(),
+                                               inode_numbers.cend());
+  if (scan_running_)
+    return;
+  scan_running_ = true;
+  auto weak_this = GetWeakPtr();
+  task_runner_->PostDelayedTask(
+      [weak_this] {
+        if (!weak_this) {
+          PERFETTO_DLOG("Giving up filesystem scan.");
+          return;
+        }
+        weak_this->FindMissingInodes();
+      },
+      scan_delay_ms_);
+}
+
+void InodeFileDataSource::ValidateCacheEntries() {
+  // The paths are lstat()-ed on a thread of their own rather than on the
+  // task runner, which is shared with the ftrace readers.
+  if (!validation_thread_) {
+    validation_thread_.reset(new base::ThreadTaskRunner(
+        base::ThreadTaskRunner::CreateAndStart("inode_validate")));
+  }
+  std::vector<CacheEntry> entries = std::move(cache_entries_to_validate_);
+  cache_entries_to_validate_.clear();
+  base::TaskRunner* task_runner = task_runner_;
+  auto weak_this = GetWeakPtr();
+  validation_thread_->PostTask([entries, task_runner, weak_this]() mutable {
+    for (CacheEntry& entry : entries)
+      ValidateCacheEntry(entry.key.first, entry.key.second, &entry.value);
+    task_runner->PostTask([entries, weak_this]() mutable {
+      if (weak_this)
+        weak_this->OnCacheEntriesValidated(std::move(entries));
+    });
+  });
+}
+
+void InodeFileDataSource::OnCacheEntriesValidated(
+    std::vector<CacheEntry> entries) {
+  std::map<BlockDeviceID, std::set<Inode>> missing_inodes;
+  for (CacheEntry& entry : entries) {
+    validating_cache_entries_.erase(entry.key);
+    // Found by a scan in the meantime.
+    if (validated_cache_entries_.count(entry.key))
+      continue;
+    BlockDeviceID block_device_id = entry.key.first;
+    Inode inode_number = entry.key.second;
+    if (entry.value.paths().empty()) {
+      cache_->Remove(entry.key);
+      missing_inodes[block_device_id].insert(inode_number);
+      continue;
     }
+    validated_cache_entries_.insert(entry.key);
+    FillInodeEntry(AddToCurrentTracePacket(block_device_id), inode_number,
+                   entry.value);
+    cache_->Insert(entry.key, std::move(entry.value));
   }
+  for (const auto& p : missing_inodes)
+    AddMissingInodes(p.first, p.second);
 }
 
 InodeFileMap* InodeFileDataSource::AddToCurrentTracePacket(
@@ -316,6 +392,7 @@ bool InodeFileDataSource::OnInodeFound(BlockDeviceID block_device_id,
   RemoveFromNextMissingInodes(block_device_id, inode_number);
 
   std::pair<BlockDeviceID, Inode> key{block_device_id, inode_number};
+  validated_cache_entries_.insert(key);
   auto cur_val = cache_->Get(key);
   if (cur_val) {
     cur_val->AddPath(path);
@@ -343,6 +420,17 @@ void InodeFileDataSource::OnInodeScanDone() {
   // Finalize the accumulated trace packets.
   ResetTracePacket();
   file_scanner_.reset();
+  if (parallel_file_scanner_) {
+    const ParallelFileScanner::Stats& stats = parallel_file_scanner_->stats();
+    PERFETTO_DLOG("Scanned %" PRIu64 " directories (%" PRIu64
+                  " entries) in %" PRIu64 " ms, %" PRIu64
+                  " ms CPU. Found %" PRIu64 " inodes, the first after %" PRIu64
+                  " ms.",
+                  stats.dirs_scanned, stats.entries_scanned,
+                  stats.wall_time_ns / 1000000, stats.cpu_time_ns / 1000000,
+                  stats.inodes_found, stats.first_inode_found_ns / 1000000);
+    parallel_file_scanner_.reset();
+  }
   if (!missing_inodes_.empty()) {
     // At least write mount point mapping for inodes that are not found.
     for (const auto& p : missing_inodes_) {
@@ -393,8 +481,17 @@ void InodeFileDataSource::FindMissingInodes() {
     AddRootsForBlockDevice(p.first, &roots);
 
   PERFETTO_DCHECK(file_scanner_.get() == nullptr);
+  PERFETTO_DCHECK(parallel_file_scanner_.get() == nullptr);
   auto weak_this = GetWeakPtr();
   PERFETTO_DLOG("Starting scan of %s", DbgFmt(roots).c_str());
+  if (scan_threads_ > 0) {
+    // The scanning threads work on a copy of |missing_inodes_|: the inodes
+    // piggy backed on this scan are only looked for by the next one.
+    parallel_file_scanner_.reset(new ParallelFileScanner(
+        std::move(roots), missing_inodes_, this, scan_threads_));
+    parallel_file_scanner_->Scan(task_runner_);
+    return;
+  }
   file_scanner_ = std::unique_ptr<FileScanner>(new FileScanner(
       std::move(roots), this, scan_interval_ms_, scan_batch_size_));
 
@@ -24,9 +24,11 @@
 #include <set>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "perfetto/base/flat_set.h"
 #include "perfetto/base/task_runner.h"
+#include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/base/weak_ptr.h"
 #include "perfetto/ext/traced/data_source_types.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
@@ -35,6 +37,7 @@
 #include "src/traced/probes/filesystem/file_scanner.h"
 #include "src/traced/probes/filesystem/fs_mount.h"
 #include "src/traced/probes/filesystem/lru_inode_cache.h"
+#include "src/traced/probes/filesystem/parallel_file_scanner.h"
 #include "src/traced/probes/probes_data_source.h"
 
 #include "protos/perfetto/trace/filesystem/inode_file_map.pbzero.h"
@@ -75,7 +78,11 @@ class InodeFileDataSource : public ProbesDataSource,
   void AddInodesFromStaticMap(BlockDeviceID block_device_id,
                               std::set<Inode>* inode_numbers);
 
-  // Search in LRUInodeCache and add inodes to InodeFileMap if found
+  // Search in LRUInodeCache and add inodes to InodeFileMap if found. As the
+  // cache outlives tracing sessions, the paths of each entry are checked to
+  // still point to the inode the first time it is used in a session. These
+  // checks are done on a background thread: the entries are only added once
+  // they complete, and scanned for if none of their paths are left.
   void AddInodesFromLRUCache(BlockDeviceID block_device_id,
                              std::set<Inode>* inode_numbers);
 
@@ -94,6 +101,15 @@ class InodeFileDataSource : public ProbesDataSource,
   InodeFileMap* AddToCurrentTracePacket(BlockDeviceID block_device_id);
   void ResetTracePacket();
   void FindMissingInodes();
+  void AddMissingInodes(BlockDeviceID block_device_id,
+                        const std::set<Inode>& inode_numbers);
+
+  struct CacheEntry {
+    LRUInodeCache::InodeKey key;
+    InodeMapValue value;
+  };
+  void ValidateCacheEntries();
+  void OnCacheEntriesValidated(std::vector<CacheEntry> entries);
 
   // Callbacks for dynamic filesystem scan.
   bool OnInodeFound(BlockDeviceID block_device_id,
@@ -118,6 +134,9 @@ class InodeFileDataSource : public ProbesDataSource,
   std::map<BlockDeviceID, std::set<Inode>> missing_inodes_;
   std::map<BlockDeviceID, std::set<Inode>> next_missing_inodes_;
   std::set<BlockDeviceID> seen_block_devices_;
+  std::set<LRUInodeCache::InodeKey> validated_cache_entries_;
+  std::set<LRUInodeCache::InodeKey> validating_cache_entries_;
+  std::vector<CacheEntry> cache_entries_to_validate_;
   BlockDeviceID current_block_device_id_;
   TraceWriter::TracePacketHandle current_trace_packet_;
   InodeFileMap* current_file_map_;
@@ -127,7 +146,10 @@ class InodeFileDataSource : public ProbesDataSource,
   uint32_t scan_interval_ms_ = 0;
   uint32_t scan_delay_ms_ = 0;
   uint32_t scan_batch_size_ = 0;
+  uint32_t scan_threads_ = 0;
   std::unique_ptr<FileScanner> file_scanner_;
+  std::unique_ptr<ParallelFileScanner> parallel_file_scanner_;
+  std::unique_ptr<base::ThreadTaskRunner> validation_thread_;
   base::WeakPtrFactory<InodeFileDataSource> weak_factory_;  // Keep last.
 };
 
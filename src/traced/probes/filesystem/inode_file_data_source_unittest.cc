@@ -34,6 +34,7 @@ using ::testing::_;
 using ::testing::Eq;
 using ::testing::InvokeWithoutArgs;
 using ::testing::IsNull;
+using ::testing::NotNull;
 using ::testing::Pointee;
 
 class TestInodeFileDataSource : public InodeFileDataSource {
@@ -114,6 +115,34 @@ TEST_F(InodeFileDataSourceTest, TestFileSystemScan) {
               Pointee(Eq(value)));
 }
 
+TEST_F(InodeFileDataSourceTest, TestParallelFileSystemScan) {
+  DataSourceConfig ds_config;
+  protozero::HeapBuffered<protos::pbzero::InodeFileConfig> inode_cfg;
+  inode_cfg->set_scan_delay_ms(1);
+  inode_cfg->set_scan_threads(2);
+  ds_config.set_inode_file_config_raw(inode_cfg.SerializeAsString());
+  auto data_source = GetInodeFileDataSource(ds_config);
+
+  struct stat buf;
+  PERFETTO_CHECK(
+      lstat(base::GetTestDataPath("src/traced/probes/filesystem/testdata/file2")
+                .c_str(),
+            &buf) != -1);
+
+  auto done = task_runner_.CreateCheckpoint("done");
+  InodeMapValue value(
+      protos::pbzero::InodeFileMap::Entry::Type::FILE,
+      {base::GetTestDataPath("src/traced/probes/filesystem/testdata/file2")});
+  EXPECT_CALL(*data_source, FillInodeEntry(_, buf.st_ino, Eq(value)))
+      .WillOnce(InvokeWithoutArgs(done));
+
+  data_source->OnInodes({{buf.st_ino, buf.st_dev}});
+  task_runner_.RunUntilCheckpoint("done");
+
+  EXPECT_THAT(cache_.Get(std::make_pair(buf.st_dev, buf.st_ino)),
+              Pointee(Eq(value)));
+}
+
 TEST_F(InodeFileDataSourceTest, TestStaticMap) {
   DataSourceConfig config;
   auto data_source = GetInodeFileDataSource(config);
@@ -160,5 +189,119 @@ TEST_F(InodeFileDataSourceTest, TestCache) {
   data_source->OnInodes({{buf.st_ino, buf.st_dev}});
 }
 
+TEST_F(InodeFileDataSourceTest, TestStaleCacheEntries) {
+  DataSourceConfig ds_config;
+  protozero::HeapBuffered<protos::pbzero::InodeFileConfig> inode_cfg;
+  inode_cfg->set_do_not_scan(true);
+  ds_config.set_inode_file_config_raw(inode_cfg.SerializeAsString());
+  auto data_source = GetInodeFileDataSource(ds_config);
+
+  const std::string file1 =
+      base::GetTestDataPath("src/traced/probes/filesystem/testdata/dir1/file1");
+  const std::string file2 =
+      base::GetTestDataPath("src/traced/probes/filesystem/testdata/file2");
+  const std::string deleted =
+      base::GetTestDataPath("src/traced/probes/filesystem/testdata/deleted");
+  struct stat buf1;
+  PERFETTO_CHECK(lstat(file1.c_str(), &buf1) != -1);
+  struct stat buf2;
+  PERFETTO_CHECK(lstat(file2.c_str(), &buf2) != -1);
+  auto key1 = std::make_pair(buf1.st_dev, buf1.st_ino);
+  auto key2 = std::make_pair(buf2.st_dev, buf2.st_ino);
+
+  // Left by a previous session: file2 is also cached under a path that was
+  // deleted since, and the only path cached for file1 now points to file2.
+  cache_.Insert(key1, InodeMapValue(
+                          protos::pbzero::InodeFileMap::Entry::Type::FILE,
+                          {file2}));
+  cache_.Insert(key2, InodeMapValue(
+                          protos::pbzero::InodeFileMap::Entry::Type::FILE,
+                          {file2, deleted}));
+
+  auto done = task_runner_.CreateCheckpoint("done");
+  InodeMapValue value2(protos::pbzero::InodeFileMap::Entry::Type::FILE,
+                       {file2});
+  EXPECT_CALL(*data_source, FillInodeEntry(_, buf2.st_ino, Eq(value2)))
+      .WillOnce(InvokeWithoutArgs(done));
+  EXPECT_CALL(*data_source, FillInodeEntry(_, buf1.st_ino, _)).Times(0);
+
+  data_source->OnInodes(
+      {{buf1.st_ino, buf1.st_dev}, {buf2.st_ino, buf2.st_dev}});
+  // The paths are checked off the task runner.
+  EXPECT_THAT(cache_.Get(key1), NotNull());
+  task_runner_.RunUntilCheckpoint("done");
+
+  EXPECT_THAT(cache_.Get(key1), IsNull());
+  EXPECT_THAT(cache_.Get(key2), Pointee(Eq(value2)));
+}
+
+TEST_F(InodeFileDataSourceTest, TestCacheEntryOfOtherBlockDevice) {
+  DataSourceConfig ds_config;
+  protozero::HeapBuffered<protos::pbzero::InodeFileConfig> inode_cfg;
+  inode_cfg->set_do_not_scan(true);
+  ds_config.set_inode_file_config_raw(inode_cfg.SerializeAsString());
+  auto data_source = GetInodeFileDataSource(ds_config);
+
+  const std::string file2 =
+      base::GetTestDataPath("src/traced/probes/filesystem/testdata/file2");
+  struct stat buf;
+  PERFETTO_CHECK(lstat(file2.c_str(), &buf) != -1);
+
+  // Left by a previous session for the same inode number on another block
+  // device, e.g. one that was unmounted since: the path now points to an
+  // unrelated file.
+  BlockDeviceID other_block_device_id = buf.st_dev + 1;
+  auto key = std::make_pair(other_block_device_id, buf.st_ino);
+  InodeMapValue value(protos::pbzero::InodeFileMap::Entry::Type::FILE,
+                      {file2});
+  cache_.Insert(key, value);
+  cache_.Insert(std::make_pair(buf.st_dev, buf.st_ino), value);
+
+  // The entries are validated in a single batch, the one of the right block
+  // device signals when it is done.
+  auto done = task_runner_.CreateCheckpoint("done");
+  EXPECT_CALL(*data_source, FillInodeEntry(_, buf.st_ino, Eq(value)))
+      .WillOnce(InvokeWithoutArgs(done));
+
+  data_source->OnInodes(
+      {{buf.st_ino, other_block_device_id}, {buf.st_ino, buf.st_dev}});
+  task_runner_.RunUntilCheckpoint("done");
+
+  EXPECT_THAT(cache_.Get(key), IsNull());
+}
+
+TEST_F(InodeFileDataSourceTest, TestStaleCacheEntryIsScanned) {
+  DataSourceConfig ds_config;
+  protozero::HeapBuffered<protos::pbzero::InodeFileConfig> inode_cfg;
+  inode_cfg->set_scan_interval_ms(1);
+  inode_cfg->set_scan_delay_ms(1);
+  ds_config.set_inode_file_config_raw(inode_cfg.SerializeAsString());
+  auto data_source = GetInodeFileDataSource(ds_config);
+
+  const std::string file2 =
+      base::GetTestDataPath("src/traced/probes/filesystem/testdata/file2");
+  const std::string deleted =
+      base::GetTestDataPath("src/traced/probes/filesystem/testdata/deleted");
+  struct stat buf;
+  PERFETTO_CHECK(lstat(file2.c_str(), &buf) != -1);
+  auto key = std::make_pair(buf.st_dev, buf.st_ino);
+  cache_.Insert(key, InodeMapValue(
+                         protos::pbzero::InodeFileMap::Entry::Type::FILE,
+                         {deleted}));
+
+  // None of the cached paths are left, so the inode is looked for by the
+  // filesystem scan.
+  auto done = task_runner_.CreateCheckpoint("done");
+  InodeMapValue value(protos::pbzero::InodeFileMap::Entry::Type::FILE,
+                      {file2});
+  EXPECT_CALL(*data_source, FillInodeEntry(_, buf.st_ino, Eq(value)))
+      .WillOnce(InvokeWithoutArgs(done));
+
+  data_source->OnInodes({{buf.st_ino, buf.st_dev}});
+  task_runner_.RunUntilCheckpoint("done");
+
+  EXPECT_THAT(cache_.Get(key), Pointee(Eq(value)));
+}
+
 }  // namespace
 }  // namespace perfetto
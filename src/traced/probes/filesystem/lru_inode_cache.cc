@@ -36,6 +36,14 @@ void LRUInodeCache::Insert(InodeKey k, InodeMapValue v) {
   return Insert(it, std::move(k), std::move(v));
 }
 
+void LRUInodeCache::Remove(const InodeKey& k) {
+  auto map_it = map_.find(k);
+  if (map_it == map_.end())
+    return;
+  list_.erase(map_it->second);
+  map_.erase(map_it);
+}
+
 void LRUInodeCache::Insert(typename MapType::iterator map_it,
                            InodeKey k,
                            InodeMapValue v) {
@@ -37,6 +37,7 @@ class LRUInodeCache {
 
   InodeMapValue* Get(const InodeKey& k);
   void Insert(InodeKey k, InodeMapValue v);
+  void Remove(const InodeKey& k);
 
  private:
   using ItemType = std::pair<const InodeKey, InodeMapValue>;
@@ -73,5 +73,19 @@ TEST(LRUInodeCacheTest, Overflow) {
   EXPECT_THAT(cache.Get(key3), Pointee(Eq(val3())));
 }
 
+TEST(LRUInodeCacheTest, Remove) {
+  LRUInodeCache cache(2);
+  cache.Insert(key1, val1());
+  cache.Insert(key2, val2());
+  cache.Remove(key1);
+  cache.Remove(key3);
+  EXPECT_THAT(cache.Get(key1), IsNull());
+  EXPECT_THAT(cache.Get(key2), Pointee(Eq(val2())));
+  // The removed entry does not count towards the capacity.
+  cache.Insert(key3, val3());
+  EXPECT_THAT(cache.Get(key2), Pointee(Eq(val2())));
+  EXPECT_THAT(cache.Get(key3), Pointee(Eq(val3())));
+}
+
 }  // namespace
 }  // namespace perfetto
@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/filesystem/parallel_file_scanner.h"
+
+#include <dirent.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <utility>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/time.h"
+#include "perfetto/ext/base/scoped_file.h"
+
+#include "protos/perfetto/trace/filesystem/inode_file_map.pbzero.h"
+
+namespace perfetto {
+namespace {
+
+std::string JoinPaths(const std::string& one, const std::string& other) {
+  std::string result;
+  result.reserve(one.size() + other.size() + 1);
+  result += one;
+  if (!result.empty() && result.back() != '/')
+    result += '/';
+  result += other;
+  return result;
+}
+
+// Returns how far |inode| is from the closest inode in |wanted|. Directories
+// with a lower value are scanned first.
+uint64_t DistanceToWanted(const std::set<Inode>* wanted, Inode inode) {
+  uint64_t distance = std::numeric_limits<uint64_t>::max();
+  if (!wanted)
+    return distance;
+  auto it = wanted->lower_bound(inode);
+  if (it != wanted->end())
+    distance = static_cast<uint64_t>(*it - inode);
+  if (it != wanted->begin()) {
+    distance =
+        std::min(distance, static_cast<uint64_t>(inode - *std::prev(it)));
+  }
+  return distance;
+}
+
+}  // namespace
+
+// The state shared between the main thread and the scanning threads.
+struct ParallelFileScanner::SharedState {
+  struct Directory {
+    uint64_t distance;
+    std::string path;
+
+    // The heap keeps the directory with the lowest distance at the front.
+    bool operator<(const Directory& other) const {
+      return distance > other.distance;
+    }
+  };
+
+  // Not modified after construction, can be read without the lock.
+  WantedInodes wanted_inodes;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<Directory> queue;  // A heap. Guarded by |mutex|.
+  uint32_t busy_threads = 0;     // Guarded by |mutex|.
+  std::atomic<bool> stop{false};
+
+  std::atomic<uint64_t> dirs_scanned{0};
+  std::atomic<uint64_t> entries_scanned{0};
+};
+
+ParallelFileScanner::ParallelFileScanner(
+    std::vector<std::string> root_directories,
+    WantedInodes wanted_inodes,
+    FileScanner::Delegate* delegate,
+    uint32_t num_threads)
+    : delegate_(delegate),
+      num_threads_(std::max(num_threads, 1u)),
+      state_(new SharedState()),
+      weak_factory_(this) {
+  state_->wanted_inodes = std::move(wanted_inodes);
+  for (std::string& root : root_directories)
+    state_->queue.push_back({0, std::move(root)});
+}
+
+ParallelFileScanner::~ParallelFileScanner() {
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->stop = true;
+  }
+  state_->cv.notify_all();
+  // Joins the scanning threads.
+  threads_.clear();
+}
+
+void ParallelFileScanner::Scan(base::TaskRunner* task_runner) {
+  PERFETTO_DCHECK(threads_.empty());
+  scan_start_ns_ = static_cast<uint64_t>(base::GetBootTimeNs().count());
+  threads_.reserve(num_threads_);
+  threads_running_ = num_threads_;
+  for (uint32_t i = 0; i < num_threads_; i++) {
+    threads_.emplace_back(base::ThreadTaskRunner::CreateAndStart("fs_scan"));
+    std::shared_ptr<SharedState> state = state_;
+    auto weak_this = weak_factory_.GetWeakPtr();
+    threads_.back().PostTask([state, task_runner, weak_this] {
+      ScanDirectories(state, task_runner, weak_this);
+    });
+  }
+}
+
+// static
+void ParallelFileScanner::ScanDirectories(
+    std::shared_ptr<SharedState> state,
+    base::TaskRunner* task_runner,
+    base::WeakPtr<ParallelFileScanner> weak_this) {
+  uint64_t cpu_start_ns =
+      static_cast<uint64_t>(base::GetThreadCPUTimeNs().count());
+  std::vector<SharedState::Directory> subdirs;
+  for (;;) {
+    std::string path;
+    {
+      std::unique_lock<std::mutex> lock(state->mutex);
+      // Other threads can still add directories until they are all idle.
+      state->cv.wait(lock, [&state] {
+        return state->stop || !state->queue.empty() ||
+               state->busy_threads == 0;
+      });
+      if (state->stop || state->queue.empty())
+        break;
+      std::pop_heap(state->queue.begin(), state->queue.end());
+      path = std::move(state->queue.back().path);
+      state->queue.pop_back();
+      state->busy_threads++;
+    }
+
+    // Shared with the task that passes them to the delegate.
+    std::shared_ptr<std::vector<FoundInode>> found_inodes(
+        new std::vector<FoundInode>());
+    base::ScopedDir dir(opendir(path.c_str()));
+    struct stat buf;
+    if (!dir) {
+      PERFETTO_DPLOG("opendir %s", path.c_str());
+    } else if (fstat(dirfd(dir.get()), &buf) != 0) {
+      PERFETTO_DPLOG("fstat %s", path.c_str());
+    } else {
+      BlockDeviceID block_device_id = buf.st_dev;
+      auto wanted_it = state->wanted_inodes.find(block_device_id);
+      const std::set<Inode>* wanted = wanted_it == state->wanted_inodes.end()
+                                          ? nullptr
+                                          : &wanted_it->second;
+      uint64_t entries = 0;
+      while (struct dirent* entry = readdir(dir.get())) {
+        if (state->stop)
+          break;
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+          continue;
+        entries++;
+        protos::pbzero::InodeFileMap_Entry_Type type =
+            protos::pbzero::InodeFileMap::Entry::Type::UNKNOWN;
+        if (entry->d_type == DT_DIR) {
+          subdirs.push_back({DistanceToWanted(wanted, entry->d_ino),
+                             JoinPaths(path, entry->d_name)});
+          type = protos::pbzero::InodeFileMap::Entry::Type::DIRECTORY;
+        } else if (entry->d_type == DT_REG) {
+          type = protos::pbzero::InodeFileMap::Entry::Type::FILE;
+        }
+        if (wanted && wanted->count(entry->d_ino)) {
+          found_inodes->push_back({block_device_id, entry->d_ino,
+                                   JoinPaths(path, entry->d_name), type});
+        }
+      }
+      state->dirs_scanned++;
+      state->entries_scanned += entries;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      for (SharedState::Directory& subdir : subdirs) {
+        state->queue.push_back(std::move(subdir));
+        std::push_heap(state->queue.begin(), state->queue.end());
+      }
+      state->busy_threads--;
+    }
+    subdirs.clear();
+    state->cv.notify_all();
+
+    if (!found_inodes->empty()) {
+      task_runner->PostTask([weak_this, found_inodes] {
+        if (weak_this)
+          weak_this->OnInodesFound(*found_inodes);
+      });
+    }
+  }
+
+  uint64_t cpu_time_ns =
+      static_cast<uint64_t>(base::GetThreadCPUTimeNs().count()) - cpu_start_ns;
+  task_runner->PostTask([weak_this, cpu_time_ns] {
+    if (weak_this)
+      weak_this->OnThreadDone(cpu_time_ns);
+  });
+}
+
+void ParallelFileScanner::OnInodesFound(
+    const std::vector<FoundInode>& inodes) {
+  if (stopped_)
+    return;
+  if (stats_.inodes_found == 0) {
+    stats_.first_inode_found_ns =
+        static_cast<uint64_t>(base::GetBootTimeNs().count()) - scan_start_ns_;
+  }
+  for (const FoundInode& found : inodes) {
+    stats_.inodes_found++;
+    if (!delegate_->OnInodeFound(found.block_device_id, found.inode,
+                                 found.path, found.type)) {
+      stopped_ = true;
+      {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->stop = true;
+      }
+      state_->cv.notify_all();
+      return;
+    }
+  }
+}
+
+void ParallelFileScanner::OnThreadDone(uint64_t cpu_time_ns) {
+  stats_.cpu_time_ns += cpu_time_ns;
+  PERFETTO_DCHECK(threads_running_ > 0);
+  if (--threads_running_ > 0)
+    return;
+  stats_.dirs_scanned = state_->dirs_scanned;
+  stats_.entries_scanned = state_->entries_scanned;
+  stats_.wall_time_ns =
+      static_cast<uint64_t>(base::GetBootTimeNs().count()) - scan_start_ns_;
+  // The delegate can destroy this object.
+  delegate_->OnInodeScanDone();
+}
+
+}  // namespace perfetto
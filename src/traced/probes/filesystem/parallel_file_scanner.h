@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FILESYSTEM_PARALLEL_FILE_SCANNER_H_
+#define SRC_TRACED_PROBES_FILESYSTEM_PARALLEL_FILE_SCANNER_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/task_runner.h"
+#include "perfetto/ext/base/thread_task_runner.h"
+#include "perfetto/ext/base/weak_ptr.h"
+#include "perfetto/ext/traced/data_source_types.h"
+#include "src/traced/probes/filesystem/file_scanner.h"
+
+namespace perfetto {
+
+// Looks for a set of inodes by walking the directory trees under
+// |root_directories| on background threads. Unlike FileScanner, which passes
+// every inode to the delegate, only the wanted inodes are passed to the
+// delegate, in batches, on the task runner passed to Scan().
+//
+// Directories are scanned in order of how close their inode number is to the
+// closest wanted inode: filesystems like ext4 and f2fs allocate the inodes of
+// new files close to the one of their directory, so most of the wanted
+// inodes are found well before the end of the walk.
+//
+// The scan stops once the delegate's OnInodeFound() returns false or all the
+// directories have been scanned, after which OnInodeScanDone() is called.
+class ParallelFileScanner {
+ public:
+  using WantedInodes = std::map<BlockDeviceID, std::set<Inode>>;
+
+  struct Stats {
+    uint64_t dirs_scanned = 0;
+    uint64_t entries_scanned = 0;
+    uint64_t inodes_found = 0;
+    // Sum of the CPU time of the scanning threads.
+    uint64_t cpu_time_ns = 0;
+    // Wall time from Scan() to the first found inode and to the end of the
+    // scan. 0 if no inode was found or if the scan is not done yet.
+    uint64_t first_inode_found_ns = 0;
+    uint64_t wall_time_ns = 0;
+  };
+
+  ParallelFileScanner(std::vector<std::string> root_directories,
+                      WantedInodes wanted_inodes,
+                      FileScanner::Delegate* delegate,
+                      uint32_t num_threads);
+  ~ParallelFileScanner();
+
+  ParallelFileScanner(const ParallelFileScanner&) = delete;
+  ParallelFileScanner& operator=(const ParallelFileScanner&) = delete;
+
+  void Scan(base::TaskRunner* task_runner);
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  struct SharedState;
+
+  struct FoundInode {
+    BlockDeviceID block_device_id;
+    Inode inode;
+    std::string path;
+    InodeFileMap_Entry_Type type;
+  };
+
+  static void ScanDirectories(std::shared_ptr<SharedState> state,
+                              base::TaskRunner* task_runner,
+                              base::WeakPtr<ParallelFileScanner> weak_this);
+  void OnInodesFound(const std::vector<FoundInode>& inodes);
+  void OnThreadDone(uint64_t cpu_time_ns);
+
+  FileScanner::Delegate* const delegate_;
+  const uint32_t num_threads_;
+  std::shared_ptr<SharedState> state_;
+  std::vector<base::ThreadTaskRunner> threads_;
+  uint32_t threads_running_ = 0;
+  uint64_t scan_start_ns_ = 0;
+  bool stopped_ = false;
+  Stats stats_;
+  base::WeakPtrFactory<ParallelFileScanner> weak_factory_;  // Keep last.
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FILESYSTEM_PARALLEL_FILE_SCANNER_H_
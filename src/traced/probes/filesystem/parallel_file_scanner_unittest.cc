@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/filesystem/parallel_file_scanner.h"
+
+#include <sys/stat.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "protos/perfetto/trace/filesystem/inode_file_map.pbzero.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/base/test/utils.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+using ::testing::UnorderedElementsAre;
+
+using FoundEntry = std::tuple<BlockDeviceID, Inode, std::string>;
+
+class TestDelegate : public FileScanner::Delegate {
+ public:
+  TestDelegate(std::function<bool(const FoundEntry&)> callback,
+               std::function<void()> done_callback)
+      : callback_(std::move(callback)),
+        done_callback_(std::move(done_callback)) {}
+
+  bool OnInodeFound(BlockDeviceID block_device_id,
+                    Inode inode,
+                    const std::string& path,
+                    InodeFileMap_Entry_Type type) override {
+    EXPECT_EQ(type, protos::pbzero::InodeFileMap::Entry::Type::FILE);
+    return callback_(FoundEntry(block_device_id, inode, path));
+  }
+
+  void OnInodeScanDone() override { done_callback_(); }
+
+ private:
+  std::function<bool(const FoundEntry&)> callback_;
+  std::function<void()> done_callback_;
+};
+
+std::string TestDataPath(const std::string& path) {
+  return base::GetTestDataPath("src/traced/probes/filesystem/testdata" + path);
+}
+
+FoundEntry StatEntry(const std::string& path) {
+  struct stat buf;
+  PERFETTO_CHECK(lstat(path.c_str(), &buf) != -1);
+  return FoundEntry(buf.st_dev, buf.st_ino, path);
+}
+
+ParallelFileScanner::WantedInodes WantedTestFiles() {
+  ParallelFileScanner::WantedInodes wanted;
+  for (const char* file : {"/dir1/file1", "/file2"}) {
+    FoundEntry entry = StatEntry(TestDataPath(file));
+    wanted[std::get<0>(entry)].insert(std::get<1>(entry));
+  }
+  return wanted;
+}
+
+TEST(ParallelFileScannerTest, FindsWantedInodes) {
+  base::TestTaskRunner task_runner;
+  std::vector<FoundEntry> found;
+  TestDelegate delegate(
+      [&found](const FoundEntry& entry) {
+        found.push_back(entry);
+        return true;
+      },
+      task_runner.CreateCheckpoint("done"));
+
+  ParallelFileScanner scanner({TestDataPath("")}, WantedTestFiles(), &delegate,
+                              2);
+  scanner.Scan(&task_runner);
+  task_runner.RunUntilCheckpoint("done");
+
+  EXPECT_THAT(found,
+              UnorderedElementsAre(StatEntry(TestDataPath("/dir1/file1")),
+                                   StatEntry(TestDataPath("/file2"))));
+  EXPECT_EQ(scanner.stats().inodes_found, 2u);
+  EXPECT_EQ(scanner.stats().dirs_scanned, 2u);
+  EXPECT_GT(scanner.stats().first_inode_found_ns, 0u);
+  EXPECT_GE(scanner.stats().wall_time_ns, scanner.stats().first_inode_found_ns);
+}
+
+TEST(ParallelFileScannerTest, StopsWhenDelegateReturnsFalse) {
+  base::TestTaskRunner task_runner;
+  uint64_t seen = 0;
+  TestDelegate delegate(
+      [&seen](const FoundEntry&) {
+        ++seen;
+        return false;
+      },
+      task_runner.CreateCheckpoint("done"));
+
+  ParallelFileScanner scanner({TestDataPath("")}, WantedTestFiles(), &delegate,
+                              4);
+  scanner.Scan(&task_runner);
+  task_runner.RunUntilCheckpoint("done");
+
+  EXPECT_EQ(seen, 1u);
+}
+
+TEST(ParallelFileScannerTest, NoWantedInodesOnDevice) {
+  base::TestTaskRunner task_runner;
+  uint64_t seen = 0;
+  TestDelegate delegate(
+      [&seen](const FoundEntry&) {
+        ++seen;
+        return true;
+      },
+      task_runner.CreateCheckpoint("done"));
+
+  // Same inodes, but on another block device.
+  ParallelFileScanner::WantedInodes wanted;
+  for (const auto& dev_and_inodes : WantedTestFiles())
+    wanted[dev_and_inodes.first + 1] = dev_and_inodes.second;
+  ParallelFileScanner scanner({TestDataPath("")}, std::move(wanted), &delegate,
+                              2);
+  scanner.Scan(&task_runner);
+  task_runner.RunUntilCheckpoint("done");
+
+  EXPECT_EQ(seen, 0u);
+  EXPECT_EQ(scanner.stats().dirs_scanned, 2u);
+  EXPECT_EQ(scanner.stats().first_inode_found_ns, 0u);
+}
+
+TEST(ParallelFileScannerTest, DestroyWhileScanning) {
+  base::TestTaskRunner task_runner;
+  TestDelegate delegate(
+      [](const FoundEntry&) {
+        ADD_FAILURE();
+        return true;
+      },
+      [] { ADD_FAILURE(); });
+
+  std::unique_ptr<ParallelFileScanner> scanner(new ParallelFileScanner(
+      {TestDataPath("")}, WantedTestFiles(), &delegate, 2));
+  scanner->Scan(&task_runner);
+  scanner.reset();
+  // Any task posted by the scanning threads is a no-op.
+  task_runner.RunUntilIdle();
+}
+
+}  // namespace
+}  // namespace perfetto
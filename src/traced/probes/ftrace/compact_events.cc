@@ -0,0 +1,391 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ftrace/compact_events.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "src/traced/probes/ftrace/cpu_reader.h"
+
+namespace perfetto {
+
+namespace {
+
+using protos::pbzero::FtraceEventBundle;
+using protozero::proto_utils::ZigZagEncode;
+
+template <typename T>
+T ReadValue(const uint8_t* ptr) {
+  T t;
+  memcpy(&t, reinterpret_cast<const void*>(ptr), sizeof(T));
+  return t;
+}
+
+void AppendVarInt(uint64_t value, std::vector<uint8_t>* out) {
+  uint8_t buf[protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+  uint8_t* end = protozero::proto_utils::WriteVarInt(value, buf);
+  out->insert(out->end(), buf, end);
+}
+
+void AppendSigned(int64_t value, std::vector<uint8_t>* out) {
+  AppendVarInt(ZigZagEncode(value), out);
+}
+
+bool IsEligibleField(const Field& field) {
+  switch (field.strategy) {
+    case kUint8ToUint32:
+    case kUint8ToUint64:
+    case kUint16ToUint32:
+    case kUint16ToUint64:
+    case kUint32ToUint32:
+    case kUint32ToUint64:
+    case kUint64ToUint64:
+    case kInt8ToInt32:
+    case kInt8ToInt64:
+    case kInt16ToInt32:
+    case kInt16ToInt64:
+    case kInt32ToInt32:
+    case kInt32ToInt64:
+    case kInt64ToInt64:
+    case kFixedCStringToString:
+    case kBoolToUint32:
+    case kBoolToUint64:
+    case kInode32ToUint64:
+    case kInode64ToUint64:
+    case kPid32ToInt32:
+    case kPid32ToInt64:
+    case kCommonPid32ToInt32:
+    case kCommonPid32ToInt64:
+    case kDevId32ToUint64:
+    case kDevId64ToUint64:
+    case kDataLocToString:
+      return true;
+    case kCStringToString:
+    case kStringPtrToString:
+    case kFtraceSymAddr64ToUint64:
+    case kInvalidTranslationStrategy:
+      return false;
+  }
+  return false;
+}
+
+// Returns the location of the string of a __data_loc field, or false if it
+// points outside of the record. |len| is 0 if the string is empty.
+bool ReadDataLoc(const uint8_t* start,
+                 const uint8_t* end,
+                 const Field& field,
+                 const uint8_t** string_start,
+                 uint16_t* len) {
+  PERFETTO_DCHECK(field.ftrace_size == 4);
+  uint32_t data = ReadValue<uint32_t>(start + field.ftrace_offset);
+  const uint16_t offset = data & 0xffff;
+  *len = (data >> 16) & 0xffff;
+  *string_start = start + offset;
+  return *len == 0 || *string_start + *len <= end;
+}
+
+}  // namespace
+
+bool IsCompactEventsEligible(const Event& event,
+                             const std::vector<Field>& common_fields) {
+  if (event.proto_field_id ==
+      protos::pbzero::FtraceEvent::kGenericFieldNumber) {
+    return false;
+  }
+  return std::all_of(common_fields.begin(), common_fields.end(),
+                     IsEligibleField) &&
+         std::all_of(event.fields.begin(), event.fields.end(), IsEligibleField);
+}
+
+CompactEventsBuffer::CompactEventsBuffer() = default;
+CompactEventsBuffer::~CompactEventsBuffer() = default;
+
+bool CompactEventsBuffer::AppendEvent(const Event& event,
+                                      const std::vector<Field>& common_fields,
+                                      uint64_t timestamp,
+                                      const uint8_t* start,
+                                      const uint8_t* end) {
+  PERFETTO_DCHECK(IsCompactEventsEligible(event, common_fields));
+  if (static_cast<size_t>(end - start) < event.size)
+    return false;
+
+  // Check the strings first, so that the columns of a batch never end up with
+  // different lengths.
+  auto valid_data_loc = [start, end](const Field& field) {
+    const uint8_t* string_start;
+    uint16_t len;
+    return field.strategy != kDataLocToString ||
+           ReadDataLoc(start, end, field, &string_start, &len);
+  };
+  if (!std::all_of(common_fields.begin(), common_fields.end(),
+                   valid_data_loc) ||
+      !std::all_of(event.fields.begin(), event.fields.end(), valid_data_loc)) {
+    PERFETTO_DFATAL("__data_loc points at invalid location");
+    return false;
+  }
+
+  Batch* batch = GetOrCreateBatch(event, common_fields);
+  if (batch->size == 0)
+    active_batches_.push_back(batch);
+  batch->size++;
+  size_++;
+
+  AppendVarInt(timestamp - batch->last_timestamp, &batch->timestamps);
+  batch->last_timestamp = timestamp;
+
+  AppendFields(common_fields, start, end, &batch->common_columns);
+  AppendFields(event.fields, start, end, &batch->columns);
+  return true;
+}
+
+CompactEventsBuffer::Batch* CompactEventsBuffer::GetOrCreateBatch(
+    const Event& event,
+    const std::vector<Field>& common_fields) {
+  if (event.ftrace_event_id >= batches_by_ftrace_id_.size())
+    batches_by_ftrace_id_.resize(event.ftrace_event_id + 1);
+  std::unique_ptr<Batch>& batch = batches_by_ftrace_id_[event.ftrace_event_id];
+  if (batch)
+    return batch.get();
+
+  auto to_column = [](const Field& field) {
+    Column column;
+    column.field_id = field.proto_field_id;
+    switch (field.strategy) {
+      case kInt8ToInt32:
+      case kInt8ToInt64:
+      case kInt16ToInt32:
+      case kInt16ToInt64:
+      case kInt32ToInt32:
+      case kInt32ToInt64:
+      case kInt64ToInt64:
+      case kPid32ToInt32:
+      case kPid32ToInt64:
+      case kCommonPid32ToInt32:
+      case kCommonPid32ToInt64:
+        column.type = ColumnType::kInt;
+        break;
+      case kFixedCStringToString:
+      case kDataLocToString:
+        column.type = ColumnType::kString;
+        break;
+      case kUint8ToUint32:
+      case kUint8ToUint64:
+      case kUint16ToUint32:
+      case kUint16ToUint64:
+      case kUint32ToUint32:
+      case kUint32ToUint64:
+      case kUint64ToUint64:
+      case kBoolToUint32:
+      case kBoolToUint64:
+      case kInode32ToUint64:
+      case kInode64ToUint64:
+      case kDevId32ToUint64:
+      case kDevId64ToUint64:
+      case kCStringToString:
+      case kStringPtrToString:
+      case kFtraceSymAddr64ToUint64:
+      case kInvalidTranslationStrategy:
+        column.type = ColumnType::kUint;
+        break;
+    }
+    return column;
+  };
+
+  batch.reset(new Batch());
+  batch->event_id = event.proto_field_id;
+  for (const Field& field : common_fields)
+    batch->common_columns.push_back(to_column(field));
+  for (const Field& field : event.fields)
+    batch->columns.push_back(to_column(field));
+  return batch.get();
+}
+
+// Appends the same values CpuReader::ParseField() writes for each field.
+void CompactEventsBuffer::AppendFields(const std::vector<Field>& fields,
+                                       const uint8_t* start,
+                                       const uint8_t* end,
+                                       std::vector<Column>* columns) {
+  PERFETTO_DCHECK(fields.size() == columns->size());
+  for (size_t i = 0; i < fields.size(); i++) {
+    const Field& field = fields[i];
+    std::vector<uint8_t>* out = &(*columns)[i].packed;
+    const uint8_t* field_start = start + field.ftrace_offset;
+    switch (field.strategy) {
+      case kUint8ToUint32:
+      case kUint8ToUint64:
+      case kBoolToUint32:
+      case kBoolToUint64:
+        AppendVarInt(ReadValue<uint8_t>(field_start), out);
+        break;
+      case kUint16ToUint32:
+      case kUint16ToUint64:
+        AppendVarInt(ReadValue<uint16_t>(field_start), out);
+        break;
+      case kUint32ToUint32:
+      case kUint32ToUint64:
+      case kInode32ToUint64:
+        AppendVarInt(ReadValue<uint32_t>(field_start), out);
+        break;
+      case kUint64ToUint64:
+      case kInode64ToUint64:
+        AppendVarInt(ReadValue<uint64_t>(field_start), out);
+        break;
+      case kInt8ToInt32:
+      case kInt8ToInt64:
+        AppendSigned(ReadValue<int8_t>(field_start), out);
+        break;
+      case kInt16ToInt32:
+      case kInt16ToInt64:
+        AppendSigned(ReadValue<int16_t>(field_start), out);
+        break;
+      case kInt32ToInt32:
+      case kInt32ToInt64:
+      case kPid32ToInt32:
+      case kPid32ToInt64:
+      case kCommonPid32ToInt32:
+      case kCommonPid32ToInt64:
+        AppendSigned(ReadValue<int32_t>(field_start), out);
+        break;
+      case kInt64ToInt64:
+        AppendSigned(ReadValue<int64_t>(field_start), out);
+        break;
+      case kDevId32ToUint64:
+        AppendVarInt(CpuReader::TranslateBlockDeviceIDToUserspace(
+                         ReadValue<uint32_t>(field_start)),
+                     out);
+        break;
+      case kDevId64ToUint64:
+        AppendVarInt(CpuReader::TranslateBlockDeviceIDToUserspace(
+                         ReadValue<uint64_t>(field_start)),
+                     out);
+        break;
+      case kFixedCStringToString: {
+        const char* str = reinterpret_cast<const char*>(field_start);
+        AppendVarInt(InternString(str, strnlen(str, field.ftrace_size)) + 1,
+                     out);
+        break;
+      }
+      case kDataLocToString: {
+        const uint8_t* string_start;
+        uint16_t len;
+        // Already validated by AppendEvent().
+        ReadDataLoc(start, end, field, &string_start, &len);
+        if (len == 0) {
+          AppendVarInt(0, out);
+          break;
+        }
+        const char* str = reinterpret_cast<const char*>(string_start);
+        AppendVarInt(InternString(str, strnlen(str, len)) + 1, out);
+        break;
+      }
+      case kCStringToString:
+      case kStringPtrToString:
+      case kFtraceSymAddr64ToUint64:
+      case kInvalidTranslationStrategy:
+        PERFETTO_FATAL("Unexpected translation strategy");
+    }
+  }
+}
+
+uint32_t CompactEventsBuffer::InternString(const char* data, size_t size) {
+  base::Hasher hasher;
+  hasher.Update(data, size);
+  uint64_t hash = hasher.digest();
+
+  uint32_t* index = interned_.Find(hash);
+  if (index) {
+    const auto& offset = intern_offsets_[*index];
+    if (offset.second == size &&
+        memcmp(&intern_buf_[offset.first], data, size) == 0) {
+      return *index;
+    }
+  }
+
+  // Unique string (or, very unlikely, a hash collision: the string is then
+  // interned twice, which is still correct).
+  auto new_index = static_cast<uint32_t>(intern_offsets_.size());
+  intern_offsets_.emplace_back(static_cast<uint32_t>(intern_buf_.size()),
+                               static_cast<uint32_t>(size));
+  intern_buf_.append(data, size);
+  if (!index)
+    interned_.Insert(hash, new_index);
+  return new_index;
+}
+
+void CompactEventsBuffer::WriteAndReset(FtraceEventBundle* bundle) {
+  if (size_ > 0) {
+    using CompactEvents = FtraceEventBundle::CompactEvents;
+    auto* compact_out = bundle->set_compact_events();
+    for (const auto& offset : intern_offsets_)
+      compact_out->add_intern_table(&intern_buf_[offset.first], offset.second);
+
+    auto write_column = [](const Column& column,
+                           CompactEvents::Column* column_out) {
+      column_out->set_field_id(column.field_id);
+      uint32_t field_id = 0;
+      switch (column.type) {
+        case ColumnType::kUint:
+          field_id = CompactEvents::Column::kUintValuesFieldNumber;
+          break;
+        case ColumnType::kInt:
+          field_id = CompactEvents::Column::kIntValuesFieldNumber;
+          break;
+        case ColumnType::kString:
+          field_id = CompactEvents::Column::kStringIndexesFieldNumber;
+          break;
+      }
+      column_out->AppendBytes(field_id, column.packed.data(),
+                              column.packed.size());
+    };
+
+    for (Batch* batch : active_batches_) {
+      auto* batch_out = compact_out->add_batch();
+      batch_out->set_event_id(batch->event_id);
+      batch_out->AppendBytes(CompactEvents::Batch::kTimestampFieldNumber,
+                             batch->timestamps.data(),
+                             batch->timestamps.size());
+      for (const Column& column : batch->common_columns)
+        write_column(column, batch_out->add_common_field());
+      for (const Column& column : batch->columns)
+        write_column(column, batch_out->add_field());
+    }
+  }
+
+  // Keep the batches (and the capacity of their columns) for the next bundle.
+  for (Batch* batch : active_batches_) {
+    batch->size = 0;
+    batch->last_timestamp = 0;
+    batch->timestamps.clear();
+    for (Column& column : batch->common_columns)
+      column.packed.clear();
+    for (Column& column : batch->columns)
+      column.packed.clear();
+  }
+  active_batches_.clear();
+  size_ = 0;
+
+  intern_buf_.clear();
+  intern_offsets_.clear();
+  interned_.Clear();
+}
+
+}  // namespace perfetto
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FTRACE_COMPACT_EVENTS_H_
+#define SRC_TRACED_PROBES_FTRACE_COMPACT_EVENTS_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/hash.h"
+#include "src/traced/probes/ftrace/event_info_constants.h"
+
+namespace perfetto {
+
+namespace protos {
+namespace pbzero {
+class FtraceEventBundle;
+}  // namespace pbzero
+}  // namespace protos
+
+// Returns true if |event| can be written in the generic compact format of
+// FtraceEventBundle.CompactEvents, i.e. if all its fields (and the
+// |common_fields|) are integers or strings stored within the event record.
+// Generic events, events with kernel symbol addresses (encoded as an index
+// into the FtraceMetadata of each data source), printk format strings and
+// unbounded C strings (e.g. ftrace/print) are always written as FtraceEvent.
+bool IsCompactEventsEligible(const Event& event,
+                             const std::vector<Field>& common_fields);
+
+// Mutable state for buffering events in a columnar form, one batch per event
+// type, that can later be written out as FtraceEventBundle.CompactEvents with
+// |WriteAndReset|. Used by the ftrace reader.
+class CompactEventsBuffer {
+ public:
+  CompactEventsBuffer();
+  ~CompactEventsBuffer();
+
+  // Buffers the fields of |event|, which must be eligible for the compact
+  // format. |start| points to the beginning of the event and |end| to the end
+  // of the record. Returns false if the event is malformed (e.g. a __data_loc
+  // field points outside of the record), in which case nothing is buffered.
+  bool AppendEvent(const Event& event,
+                   const std::vector<Field>& common_fields,
+                   uint64_t timestamp,
+                   const uint8_t* start,
+                   const uint8_t* end);
+
+  // Number of events buffered since the last |WriteAndReset|.
+  size_t size() const { return size_; }
+
+  // Writes out the currently buffered events, and starts the next batch
+  // internally.
+  void WriteAndReset(protos::pbzero::FtraceEventBundle* bundle);
+
+ private:
+  enum class ColumnType { kUint, kInt, kString };
+
+  struct Column {
+    uint32_t field_id = 0;
+    ColumnType type = ColumnType::kUint;
+    // Packed varints, one per event of the batch.
+    std::vector<uint8_t> packed;
+  };
+
+  // The buffered events of one event type.
+  struct Batch {
+    uint32_t event_id = 0;
+    size_t size = 0;
+    // The first timestamp of a batch is absolute, the rest are relative to
+    // the preceding event of the same batch.
+    uint64_t last_timestamp = 0;
+    std::vector<uint8_t> timestamps;
+    std::vector<Column> common_columns;
+    std::vector<Column> columns;
+  };
+
+  Batch* GetOrCreateBatch(const Event& event,
+                          const std::vector<Field>& common_fields);
+  void AppendFields(const std::vector<Field>& fields,
+                    const uint8_t* start,
+                    const uint8_t* end,
+                    std::vector<Column>* columns);
+  uint32_t InternString(const char* data, size_t size);
+
+  // Indexed by ftrace event id. Batches are kept across |WriteAndReset| to
+  // reuse their allocations.
+  std::vector<std::unique_ptr<Batch>> batches_by_ftrace_id_;
+  // The batches with at least one event, in the order they were started.
+  std::vector<Batch*> active_batches_;
+  size_t size_ = 0;
+
+  // Interned strings, stored back to back in |intern_buf_|. |interned_| maps
+  // the hash of a string to its index in |intern_offsets_|.
+  std::string intern_buf_;
+  std::vector<std::pair<uint32_t, uint32_t>> intern_offsets_;
+  base::FlatHashMap<uint64_t, uint32_t, base::AlreadyHashed<uint64_t>>
+      interned_;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FTRACE_COMPACT_EVENTS_H_
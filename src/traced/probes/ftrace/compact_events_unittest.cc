@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ftrace/compact_events.h"
+
+#include <string.h>
+
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "perfetto/protozero/proto_decoder.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "src/traced/probes/ftrace/cpu_reader.h"
+#include "src/traced/probes/ftrace/ftrace_metadata.h"
+#include "src/traced/probes/ftrace/proto_translation_table.h"
+#include "src/traced/probes/ftrace/test/cpu_reader_support.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.gen.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+
+namespace perfetto {
+namespace {
+
+using CompactEvents = protos::gen::FtraceEventBundle::CompactEvents;
+
+// A field of a proto message: its id and either its varint value or its
+// string value.
+using DecodedField = std::pair<uint32_t, std::string>;
+
+std::vector<DecodedField> DecodeFields(const uint8_t* data, size_t size) {
+  std::vector<DecodedField> fields;
+  protozero::ProtoDecoder decoder(data, size);
+  for (auto field = decoder.ReadField(); field; field = decoder.ReadField()) {
+    if (field.type() == protozero::proto_utils::ProtoWireType::kVarInt) {
+      fields.emplace_back(field.id(), std::to_string(field.as_uint64()));
+    } else {
+      fields.emplace_back(field.id(), field.as_std_string());
+    }
+  }
+  return fields;
+}
+
+// Returns the fields of the |index|-th event of |columns|, as they would be
+// encoded in the FtraceEvent proto.
+std::vector<DecodedField> EventFields(
+    const std::vector<CompactEvents::Column>& columns,
+    const std::vector<std::string>& intern_table,
+    size_t index) {
+  std::vector<DecodedField> fields;
+  for (const CompactEvents::Column& column : columns) {
+    if (!column.uint_values().empty()) {
+      fields.emplace_back(column.field_id(),
+                          std::to_string(column.uint_values()[index]));
+    } else if (!column.int_values().empty()) {
+      // Negative values are sign extended in the FtraceEvent proto.
+      fields.emplace_back(
+          column.field_id(),
+          std::to_string(static_cast<uint64_t>(
+              protozero::proto_utils::ZigZagDecode(column.int_values()[index]))));
+    } else {
+      uint32_t string_index = column.string_indexes()[index];
+      if (string_index == 0)
+        continue;
+      fields.emplace_back(column.field_id(), intern_table[string_index - 1]);
+    }
+  }
+  return fields;
+}
+
+TEST(CompactEventsTest, Eligibility) {
+  const ProtoTranslationTable* table =
+      GetTable("android_raven_AOSP.MASTER_5.10.43");
+  auto eligible = [table](const char* name) {
+    return table->IsCompactEventsEligibleById(
+        table->GetEventByName(name)->ftrace_event_id);
+  };
+  EXPECT_TRUE(eligible("sched_switch"));
+  EXPECT_TRUE(eligible("sched_wakeup"));
+  EXPECT_TRUE(eligible("cpu_frequency"));
+  EXPECT_TRUE(eligible("block_rq_issue"));
+  // C string until the end of the record.
+  EXPECT_FALSE(eligible("print"));
+  // Kernel symbols.
+  EXPECT_FALSE(eligible("workqueue_execute_start"));
+}
+
+class CompactEventsParsingTest : public ::testing::TestWithParam<const char*> {
+};
+
+// Fills all the eligible events with random data and checks that the compact
+// batches hold the same fields as the FtraceEvent protos CpuReader::ParseEvent
+// writes.
+TEST_P(CompactEventsParsingTest, SameAsParseEvent) {
+  ProtoTranslationTable* table = GetTable(GetParam());
+  std::minstd_rand0 rnd_engine(42);
+  for (size_t id = 0; id <= table->largest_id(); id++) {
+    const Event* event = table->GetEventById(id);
+    if (!event || !table->IsCompactEventsEligibleById(id))
+      continue;
+
+    CompactEventsBuffer buffer;
+    std::vector<std::vector<DecodedField>> expected_events;
+    std::vector<uint64_t> expected_timestamps;
+    uint64_t timestamp = 1000;
+    for (int i = 0; i < 10; i++) {
+      // Strings (__data_loc) are appended after the fixed part of the event.
+      std::vector<uint8_t> data(event->size + 64u);
+      for (uint8_t& byte : data)
+        byte = rnd_engine() % 4 == 0 ? 0 : static_cast<uint8_t>(rnd_engine());
+      // task_rename expects a valid common pid.
+      for (const Field& field : table->common_fields())
+        data[field.ftrace_offset] |= 1;
+      uint32_t data_end = event->size;
+      for (const Field& field : event->fields) {
+        if (field.strategy != kDataLocToString)
+          continue;
+        uint32_t len = rnd_engine() % 16;
+        uint32_t data_loc = (len << 16) | data_end;
+        memcpy(&data[field.ftrace_offset], &data_loc, sizeof(data_loc));
+        data_end += len;
+      }
+      const uint8_t* start = data.data();
+      const uint8_t* end = start + data_end;
+      timestamp += rnd_engine() % 100000;
+
+      ASSERT_TRUE(buffer.AppendEvent(*event, table->common_fields(), timestamp,
+                                     start, end));
+
+      protozero::HeapBuffered<protos::pbzero::FtraceEvent> proto;
+      proto->set_timestamp(timestamp);
+      FtraceMetadata metadata;
+      // Some events (e.g. android_fs_dataread_start) have an inode field but
+      // no device field, which FtraceMetadata DCHECKs on.
+      metadata.AddDevice(0);
+      ASSERT_TRUE(CpuReader::ParseEvent(static_cast<uint16_t>(id), start, end,
+                                        table, proto.get(), &metadata));
+      std::vector<uint8_t> serialized = proto.SerializeAsArray();
+      expected_events.push_back(
+          DecodeFields(serialized.data(), serialized.size()));
+      expected_timestamps.push_back(timestamp);
+    }
+    EXPECT_EQ(10u, buffer.size());
+
+    protozero::HeapBuffered<protos::pbzero::FtraceEventBundle> bundle;
+    buffer.WriteAndReset(bundle.get());
+    EXPECT_EQ(0u, buffer.size());
+    protos::gen::FtraceEventBundle parsed;
+    ASSERT_TRUE(parsed.ParseFromString(bundle.SerializeAsString()));
+
+    ASSERT_EQ(1u, parsed.compact_events().batch().size()) << event->name;
+    const CompactEvents::Batch& batch = parsed.compact_events().batch()[0];
+    EXPECT_EQ(event->proto_field_id, batch.event_id());
+    ASSERT_EQ(10u, batch.timestamp().size());
+    const auto& intern_table = parsed.compact_events().intern_table();
+
+    uint64_t ts = 0;
+    for (size_t i = 0; i < 10; i++) {
+      ts += batch.timestamp()[i];
+      EXPECT_EQ(expected_timestamps[i], ts);
+
+      // The FtraceEvent proto: timestamp, common fields and the event.
+      std::vector<DecodedField> fields;
+      fields.emplace_back(protos::pbzero::FtraceEvent::kTimestampFieldNumber,
+                          std::to_string(ts));
+      for (DecodedField& field :
+           EventFields(batch.common_field(), intern_table, i)) {
+        fields.push_back(std::move(field));
+      }
+      const DecodedField& expected_nested = expected_events[i].back();
+      ASSERT_EQ(event->proto_field_id, expected_nested.first);
+      fields.push_back(expected_nested);
+      EXPECT_EQ(expected_events[i], fields) << event->name;
+
+      const std::string& nested = expected_nested.second;
+      EXPECT_EQ(DecodeFields(reinterpret_cast<const uint8_t*>(nested.data()),
+                             nested.size()),
+                EventFields(batch.field(), intern_table, i))
+          << event->name;
+    }
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    ByDevice,
+    CompactEventsParsingTest,
+    ::testing::Values("android_seed_N2F62_3.10.49",
+                      "android_hammerhead_MRA59G_3.4.0",
+                      "android_flounder_lte_LRX16F_3.10.40",
+                      "android_walleye_OPM5.171019.017.A1_4.4.88",
+                      "android_raven_AOSP.MASTER_5.10.43",
+                      "synthetic"));
+
+TEST(CompactEventsTest, InternsStrings) {
+  const ProtoTranslationTable* table =
+      GetTable("android_raven_AOSP.MASTER_5.10.43");
+  const Event* sched_switch = table->GetEventByName("sched_switch");
+  const Event* sched_wakeup = table->GetEventByName("sched_wakeup");
+
+  // All the comm fields of both events are set to the same value.
+  auto make_event = [](const Event* event) {
+    std::vector<uint8_t> data(event->size);
+    for (const Field& field : event->fields) {
+      if (field.strategy == kFixedCStringToString)
+        strcpy(reinterpret_cast<char*>(&data[field.ftrace_offset]), "comm");
+    }
+    return data;
+  };
+  std::vector<uint8_t> data = make_event(sched_switch);
+  std::vector<uint8_t> wakeup_data = make_event(sched_wakeup);
+
+  CompactEventsBuffer buffer;
+  for (uint64_t ts : {10, 20, 30}) {
+    ASSERT_TRUE(buffer.AppendEvent(*sched_switch, table->common_fields(), ts,
+                                   data.data(), data.data() + data.size()));
+  }
+  ASSERT_TRUE(buffer.AppendEvent(*sched_wakeup, table->common_fields(), 25,
+                                 wakeup_data.data(),
+                                 wakeup_data.data() + wakeup_data.size()));
+
+  protozero::HeapBuffered<protos::pbzero::FtraceEventBundle> bundle;
+  buffer.WriteAndReset(bundle.get());
+  protos::gen::FtraceEventBundle parsed;
+  ASSERT_TRUE(parsed.ParseFromString(bundle.SerializeAsString()));
+
+  const auto& compact_events = parsed.compact_events();
+  EXPECT_THAT(compact_events.intern_table(), testing::ElementsAre("comm"));
+  ASSERT_EQ(2u, compact_events.batch().size());
+  EXPECT_THAT(compact_events.batch()[0].timestamp(),
+              testing::ElementsAre(10, 10, 10));
+  EXPECT_THAT(compact_events.batch()[1].timestamp(), testing::ElementsAre(25));
+
+  // The next bundle starts from scratch.
+  ASSERT_TRUE(buffer.AppendEvent(*sched_switch, table->common_fields(), 40,
+                                 data.data(), data.data() + data.size()));
+  protozero::HeapBuffered<protos::pbzero::FtraceEventBundle> next_bundle;
+  buffer.WriteAndReset(next_bundle.get());
+  ASSERT_TRUE(parsed.ParseFromString(next_bundle.SerializeAsString()));
+  EXPECT_THAT(parsed.compact_events().intern_table(),
+              testing::ElementsAre("comm"));
+  ASSERT_EQ(1u, parsed.compact_events().batch().size());
+  EXPECT_THAT(parsed.compact_events().batch()[0].timestamp(),
+              testing::ElementsAre(40));
+}
+
+}  // namespace
+}  // namespace perfetto
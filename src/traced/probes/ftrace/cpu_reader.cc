@@ -146,6 +146,76 @@ bool ZeroPaddedPageTail(const uint8_t* start, const uint8_t* end) {
   return true;
 }
 
+// Events with kernel symbol addresses can't share their encoding between data
+// sources, as addresses are encoded as an index into the FtraceMetadata of
+// each data source.
+bool IsEncodingShareable(const Event& info,
+                         const ProtoTranslationTable* table) {
+  auto is_sym_addr = [](const Field& field) {
+    return field.strategy == kFtraceSymAddr64ToUint64;
+  };
+  return std::none_of(table->common_fields().begin(),
+                      table->common_fields().end(), is_sym_addr) &&
+         std::none_of(info.fields.begin(), info.fields.end(), is_sym_addr);
+}
+
+// Applies to |metadata| the changes that CpuReader::ParseField() does.
+void ParseFieldMetadata(const Field& field,
+                        const uint8_t* start,
+                        FtraceMetadata* metadata) {
+  const uint8_t* field_start = start + field.ftrace_offset;
+  switch (field.strategy) {
+    case kInode32ToUint64:
+      metadata->AddInode(static_cast<Inode>(ReadValue<uint32_t>(field_start)));
+      return;
+    case kInode64ToUint64:
+      metadata->AddInode(static_cast<Inode>(ReadValue<uint64_t>(field_start)));
+      return;
+    case kPid32ToInt32:
+    case kPid32ToInt64:
+      metadata->AddPid(ReadValue<int32_t>(field_start));
+      return;
+    case kCommonPid32ToInt32:
+    case kCommonPid32ToInt64:
+      metadata->AddCommonPid(ReadValue<int32_t>(field_start));
+      return;
+    case kDevId32ToUint64:
+      metadata->AddDevice(CpuReader::TranslateBlockDeviceIDToUserspace(
+          ReadValue<uint32_t>(field_start)));
+      return;
+    case kDevId64ToUint64:
+      metadata->AddDevice(CpuReader::TranslateBlockDeviceIDToUserspace(
+          ReadValue<uint64_t>(field_start)));
+      return;
+    case kFtraceSymAddr64ToUint64:
+      // Never shared, see IsEncodingShareable().
+      PERFETTO_DFATAL("Unexpected symbol address");
+      return;
+    case kUint8ToUint32:
+    case kUint8ToUint64:
+    case kUint16ToUint32:
+    case kUint16ToUint64:
+    case kUint32ToUint32:
+    case kUint32ToUint64:
+    case kUint64ToUint64:
+    case kInt8ToInt32:
+    case kInt8ToInt64:
+    case kInt16ToInt32:
+    case kInt16ToInt64:
+    case kInt32ToInt32:
+    case kInt32ToInt64:
+    case kInt64ToInt64:
+    case kFixedCStringToString:
+    case kCStringToString:
+    case kStringPtrToString:
+    case kDataLocToString:
+    case kBoolToUint32:
+    case kBoolToUint64:
+    case kInvalidTranslationStrategy:
+      return;
+  }
+}
+
 void LogInvalidPage(const void* start, size_t size) {
   PERFETTO_ELOG("Invalid ftrace page");
   std::string hexdump = base::HexDump(start, size);
@@ -176,6 +246,72 @@ CpuReader::CpuReader(size_t cpu,
 
 CpuReader::~CpuReader() = default;
 
+CpuReader::EventEncodingCache::EventEncodingCache()
+    : scratch_(new protozero::HeapBuffered<protos::pbzero::FtraceEvent>()) {}
+
+CpuReader::EventEncodingCache::~EventEncodingCache() = default;
+
+void CpuReader::EventEncodingCache::Reset() {
+  next_event_ = 0;
+  entries_.clear();
+  encoded_events_.clear();
+}
+
+bool CpuReader::EventEncodingCache::WriteEvent(
+    uint32_t index,
+    uint16_t ftrace_event_id,
+    uint64_t timestamp,
+    const uint8_t* start,
+    const uint8_t* end,
+    const ProtoTranslationTable* table,
+    FtraceEventBundle* bundle,
+    FtraceMetadata* metadata) {
+  if (index >= entries_.size())
+    entries_.resize(index + 1);
+  Entry& entry = entries_[index];
+  if (PERFETTO_UNLIKELY(entry.state != State::kNotEncoded &&
+                        entry.start != start)) {
+    entry.state = State::kNotShareable;
+  }
+
+  switch (entry.state) {
+    case State::kEncoded:
+      bundle->AppendBytes(FtraceEventBundle::kEventFieldNumber,
+                          encoded_events_.data() + entry.offset, entry.size);
+      ParseEventMetadata(ftrace_event_id, start, table, metadata);
+      return true;
+    case State::kNotShareable: {
+      protos::pbzero::FtraceEvent* event = bundle->add_event();
+      event->set_timestamp(timestamp);
+      return ParseEvent(ftrace_event_id, start, end, table, event, metadata);
+    }
+    case State::kNotEncoded:
+      break;
+  }
+
+  scratch_->Reset();
+  (*scratch_)->set_timestamp(timestamp);
+  if (!ParseEvent(ftrace_event_id, start, end, table, scratch_->get(),
+                  metadata)) {
+    return false;
+  }
+  entry.start = start;
+  entry.offset = static_cast<uint32_t>(encoded_events_.size());
+  for (const auto& slice : scratch_->GetSlices()) {
+    protozero::ContiguousMemoryRange range = slice.GetUsedRange();
+    encoded_events_.insert(encoded_events_.end(), range.begin, range.end);
+  }
+  entry.size = static_cast<uint32_t>(encoded_events_.size()) - entry.offset;
+  entry.state =
+      IsEncodingShareable(*table->GetEventById(ftrace_event_id), table)
+          ? State::kEncoded
+          : State::kNotShareable;
+
+  bundle->AppendBytes(FtraceEventBundle::kEventFieldNumber,
+                      encoded_events_.data() + entry.offset, entry.size);
+  return true;
+}
+
 size_t CpuReader::ReadCycle(
     uint8_t* parsing_buf,
     size_t parsing_buf_size_pages,
@@ -185,6 +321,8 @@ size_t CpuReader::ReadCycle(
   metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
                              metatrace::FTRACE_CPU_READ_CYCLE);
 
+  read_syscalls_ = 0;
+
   // Work in batches to keep cache locality, and limit memory usage.
   size_t batch_pages = std::min(parsing_buf_size_pages, max_pages);
   size_t total_pages_read = 0;
@@ -205,6 +343,7 @@ size_t CpuReader::ReadCycle(
   }
   PERFETTO_METATRACE_COUNTER(TAG_FTRACE, FTRACE_PAGES_DRAINED,
                              total_pages_read);
+  PERFETTO_METATRACE_COUNTER(TAG_FTRACE, FTRACE_READ_SYSCALLS, read_syscalls_);
   return total_pages_read;
 }
 
@@ -221,8 +360,24 @@ size_t CpuReader::ReadAndProcessBatch(
   {
     metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
                                metatrace::FTRACE_CPU_READ_BATCH);
+    bool try_splice = use_splice_;
     for (; pages_read < max_pages;) {
       uint8_t* curr_page = parsing_buf + (pages_read * base::kPageSize);
+
+      // Move all the pages that the kernel has finished writing in one go.
+      // The page that the kernel is still writing into (if any) can only be
+      // read(), which is done below with the usual caught-up heuristic.
+      if (try_splice) {
+        size_t pages_wanted = max_pages - pages_read;
+        size_t pages_spliced = 0;
+        bool spliced = SplicePages(curr_page, pages_wanted, &pages_spliced);
+        pages_read += pages_spliced;
+        // On errors too, the remaining pages are read().
+        try_splice = spliced && pages_spliced == pages_wanted;
+        continue;
+      }
+
+      read_syscalls_++;
       ssize_t res =
           PERFETTO_EINTR(read(*trace_fd_, curr_page, base::kPageSize));
       if (res < 0) {
@@ -289,11 +444,21 @@ size_t CpuReader::ReadAndProcessBatch(
   if (pages_read == 0)
     return pages_read;
 
+  // With more than one data source, each event is decoded and encoded only
+  // once and then copied into the bundles of the other data sources.
+  EventEncodingCache* event_cache = nullptr;
+  if (started_data_sources.size() > 1) {
+    if (!event_cache_)
+      event_cache_.reset(new EventEncodingCache());
+    event_cache_->Reset();
+    event_cache = event_cache_.get();
+  }
+
   for (FtraceDataSource* data_source : started_data_sources) {
     size_t pages_parsed_ok = ProcessPagesForDataSource(
         data_source->trace_writer(), data_source->mutable_metadata(), cpu_,
         data_source->parsing_config(), parsing_buf, pages_read, table_,
-        symbolizer_, ftrace_clock_snapshot_, ftrace_clock_);
+        symbolizer_, ftrace_clock_snapshot_, ftrace_clock_, event_cache);
     // If this happens, it means that we did not know how to parse the kernel
     // binary format. This is a bug in either perfetto or the kernel, and must
     // be investigated. Hence we abort instead of recording a bit in the ftrace
@@ -310,6 +475,87 @@ size_t CpuReader::ReadAndProcessBatch(
   return pages_read;
 }
 
+bool CpuReader::SplicePages(uint8_t* dst,
+                            size_t max_pages,
+                            size_t* pages_spliced) {
+  *pages_spliced = 0;
+  if (!use_splice_)
+    return false;
+  if (!splice_pipe_.rd) {
+    splice_pipe_ = base::Pipe::Create(base::Pipe::kBothNonBlock);
+    // Pipes hold 16 pages by default, try to make room for a whole batch. If
+    // this fails (e.g. if above /proc/sys/fs/pipe-max-size) it just takes a few
+    // more splice() calls.
+    fcntl(*splice_pipe_.wr, F_SETPIPE_SZ,
+          static_cast<int>(max_pages * base::kPageSize));
+    int pipe_size = fcntl(*splice_pipe_.wr, F_GETPIPE_SZ);
+    splice_pipe_pages_ =
+        std::max(static_cast<size_t>(std::max(pipe_size, 0)) / base::kPageSize,
+                 static_cast<size_t>(1));
+  }
+
+  while (*pages_spliced < max_pages) {
+    size_t pages = std::min(max_pages - *pages_spliced, splice_pipe_pages_);
+    ssize_t res;
+    {
+      metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
+                                 metatrace::FTRACE_CPU_SPLICE_NONBLOCK);
+      read_syscalls_++;
+      res = PERFETTO_EINTR(splice(*trace_fd_, nullptr, *splice_pipe_.wr,
+                                  nullptr, pages * base::kPageSize,
+                                  SPLICE_F_NONBLOCK));
+    }
+    if (res < 0) {
+      // Expected errors:
+      // EAGAIN, EBUSY: no page that the kernel has finished writing.
+      // ENOMEM, ENODEV: as for read(), see ReadAndProcessBatch().
+      // Anything else means that splice() doesn't work on this file.
+      if (errno == EAGAIN || errno == EBUSY || errno == ENOMEM ||
+          errno == ENODEV) {
+        break;
+      }
+      PERFETTO_DPLOG("[cpu%zu]: splice() failed, using read() instead", cpu_);
+      DisableSplice();
+      return false;
+    }
+    if (res == 0)
+      break;
+
+    const size_t bytes = static_cast<size_t>(res);
+    uint8_t* pos = dst + (*pages_spliced * base::kPageSize);
+    for (size_t bytes_read = 0; bytes_read < bytes;) {
+      read_syscalls_++;
+      ssize_t rd = PERFETTO_EINTR(
+          read(*splice_pipe_.rd, pos + bytes_read, bytes - bytes_read));
+      if (rd <= 0) {
+        // Not expected as the data is in the pipe. What is left in it is lost.
+        PERFETTO_PLOG("[cpu%zu]: read() from the splice pipe failed", cpu_);
+        *pages_spliced += bytes_read / base::kPageSize;
+        DisableSplice();
+        return false;
+      }
+      bytes_read += static_cast<size_t>(rd);
+    }
+    *pages_spliced += bytes / base::kPageSize;
+
+    // The kernel only splices whole pages from trace_pipe_raw.
+    if (bytes % base::kPageSize != 0) {
+      PERFETTO_ELOG("[cpu%zu]: splice() moved a partial page, using read()",
+                    cpu_);
+      DisableSplice();
+      return false;
+    }
+    if (bytes < pages * base::kPageSize)
+      break;
+  }
+  return true;
+}
+
+void CpuReader::DisableSplice() {
+  use_splice_ = false;
+  splice_pipe_ = base::Pipe();
+}
+
 // static
 size_t CpuReader::ProcessPagesForDataSource(
     TraceWriter* trace_writer,
@@ -321,12 +567,19 @@ size_t CpuReader::ProcessPagesForDataSource(
     const ProtoTranslationTable* table,
     LazyKernelSymbolizer* symbolizer,
     const FtraceClockSnapshot* ftrace_clock_snapshot,
-    protos::pbzero::FtraceClock ftrace_clock) {
+    protos::pbzero::FtraceClock ftrace_clock,
+    EventEncodingCache* event_cache) {
+  if (event_cache)
+    event_cache->Rewind();
+
   // Allocate the buffer for compact scheduler events (which will be unused if
   // the compact option isn't enabled).
   CompactSchedBuffer compact_sched;
   bool compact_sched_enabled = ds_config->compact_sched.enabled;
 
+  // Same for the generic compact encoding of all other events.
+  CompactEventsBuffer compact_events;
+
   TraceWriter::TracePacketHandle packet;
   protos::pbzero::FtraceEventBundle* bundle = nullptr;
 
@@ -335,6 +588,8 @@ size_t CpuReader::ProcessPagesForDataSource(
     PERFETTO_DCHECK(packet);
     if (compact_sched_enabled)
       compact_sched.WriteAndReset(bundle);
+    if (ds_config->compact_events)
+      compact_events.WriteAndReset(bundle);
 
     bundle->Finalize();
     bundle = nullptr;
@@ -451,7 +706,8 @@ size_t CpuReader::ProcessPagesForDataSource(
 
     size_t evt_size =
         ParsePagePayload(parse_pos, &page_header.value(), table, ds_config,
-                         &compact_sched, bundle, metadata);
+                         &compact_sched, &compact_events, bundle, metadata,
+                         event_cache);
 
     if (evt_size != page_header->size) {
       break;
@@ -524,10 +780,13 @@ size_t CpuReader::ParsePagePayload(const uint8_t* start_of_payload,
                                    const ProtoTranslationTable* table,
                                    const FtraceDataSourceConfig* ds_config,
                                    CompactSchedBuffer* compact_sched_buffer,
+                                   CompactEventsBuffer* compact_events_buffer,
                                    FtraceEventBundle* bundle,
-                                   FtraceMetadata* metadata) {
+                                   FtraceMetadata* metadata,
+                                   EventEncodingCache* event_cache) {
   const uint8_t* ptr = start_of_payload;
   const uint8_t* const end = ptr + page_header->size;
+  PERFETTO_DCHECK(!ds_config->compact_events || compact_events_buffer);
 
   uint64_t timestamp = page_header->timestamp;
 
@@ -614,6 +873,21 @@ size_t CpuReader::ParsePagePayload(const uint8_t* start_of_payload,
         if (!ReadAndAdvance<uint16_t>(&ptr, end, &ftrace_event_id))
           return 0;
 
+        // Every event takes a position in the batch, whether or not this data
+        // source has it enabled, so that it's the same for all data sources.
+        uint32_t event_index = event_cache ? event_cache->NextEvent() : 0;
+        auto write_event = [&] {
+          if (event_cache) {
+            return event_cache->WriteEvent(event_index, ftrace_event_id,
+                                           timestamp, start, next, table,
+                                           bundle, metadata);
+          }
+          protos::pbzero::FtraceEvent* event = bundle->add_event();
+          event->set_timestamp(timestamp);
+          return ParseEvent(ftrace_event_id, start, next, table, event,
+                            metadata);
+        };
+
         if (ds_config->event_filter.IsEventEnabled(ftrace_event_id)) {
           // Special-cased handling of some scheduler events when compact format
           // is enabled.
@@ -647,18 +921,21 @@ size_t CpuReader::ParsePagePayload(const uint8_t* start_of_payload,
           } else if (ftrace_print_filter_enabled &&
                      ftrace_event_id == ds_config->print_filter->event_id()) {
             if (ds_config->print_filter->IsEventInteresting(start, next)) {
-              protos::pbzero::FtraceEvent* event = bundle->add_event();
-              event->set_timestamp(timestamp);
-              if (!ParseEvent(ftrace_event_id, start, next, table, event,
-                              metadata))
+              if (!write_event())
                 return 0;
             }
+          } else if (ds_config->compact_events &&
+                     table->IsCompactEventsEligibleById(ftrace_event_id)) {
+            // Generic compact encoding of events with a fixed layout.
+            if (!compact_events_buffer->AppendEvent(
+                    *table->GetEventById(ftrace_event_id),
+                    table->common_fields(), timestamp, start, next)) {
+              return 0;
+            }
+            ParseEventMetadata(ftrace_event_id, start, table, metadata);
           } else {
             // Common case: parse all other types of enabled events.
-            protos::pbzero::FtraceEvent* event = bundle->add_event();
-            event->set_timestamp(timestamp);
-            if (!ParseEvent(ftrace_event_id, start, next, table, event,
-                            metadata))
+            if (!write_event())
               return 0;
           }
         }
@@ -710,6 +987,10 @@ bool CpuReader::ParseEvent(uint16_t ftrace_event_id,
                                   field.ftrace_name);
       success &= ParseField(field, start, end, table, generic_field, metadata);
     }
+  } else if (EventDecoder decoder =
+                 table->GetEventDecoderById(ftrace_event_id)) {
+    // Hot events with a layout known at compile time.
+    success &= decoder(start, end, nested, metadata);
   } else {  // Parse all other events.
     for (const Field& field : info.fields) {
       success &= ParseField(field, start, end, table, nested, metadata);
@@ -731,6 +1012,26 @@ bool CpuReader::ParseEvent(uint16_t ftrace_event_id,
   return success;
 }
 
+// static
+void CpuReader::ParseEventMetadata(uint16_t ftrace_event_id,
+                                   const uint8_t* start,
+                                   const ProtoTranslationTable* table,
+                                   FtraceMetadata* metadata) {
+  const Event& info = *table->GetEventById(ftrace_event_id);
+  for (const Field& field : table->common_fields())
+    ParseFieldMetadata(field, start, metadata);
+  for (const Field& field : info.fields)
+    ParseFieldMetadata(field, start, metadata);
+
+  // See ParseEvent().
+  if (PERFETTO_UNLIKELY(info.proto_field_id ==
+                        protos::pbzero::FtraceEvent::kTaskRenameFieldNumber)) {
+    PERFETTO_DCHECK(metadata->last_seen_common_pid);
+    metadata->AddRenamePid(metadata->last_seen_common_pid);
+  }
+  metadata->FinishEvent();
+}
+
 // Caller must guarantee that the field fits in the range,
 // explicitly: start + field.ftrace_offset + field.ftrace_size <= end
 // The only exception is fields with strategy = kCStringToString
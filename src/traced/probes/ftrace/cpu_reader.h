@@ -25,6 +25,7 @@
 #include <memory>
 #include <set>
 #include <thread>
+#include <vector>
 
 #include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/paged_memory.h"
@@ -35,6 +36,8 @@
 #include "perfetto/ext/tracing/core/trace_writer.h"
 #include "perfetto/protozero/message.h"
 #include "perfetto/protozero/message_handle.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "src/traced/probes/ftrace/compact_events.h"
 #include "src/traced/probes/ftrace/compact_sched.h"
 #include "src/traced/probes/ftrace/ftrace_metadata.h"
 #include "src/traced/probes/ftrace/proto_translation_table.h"
@@ -49,6 +52,7 @@ struct FtraceDataSourceConfig;
 
 namespace protos {
 namespace pbzero {
+class FtraceEvent;
 class FtraceEventBundle;
 enum FtraceClock : int32_t;
 }  // namespace pbzero
@@ -66,6 +70,71 @@ class CpuReader {
     bool lost_events;
   };
 
+  // Shares the work of parsing a batch of pages between all the data sources
+  // reading it: each event is decoded and encoded as a FtraceEvent proto only
+  // the first time a data source needs it. The other data sources copy the
+  // encoded event into their bundle and only apply the effects of the event
+  // on their FtraceMetadata (see ParseEventMetadata()).
+  //
+  // Events are identified by their position in the batch, which is the same
+  // for all the data sources as each of them walks all the events of the
+  // pages, including the ones it doesn't have enabled.
+  class EventEncodingCache {
+   public:
+    EventEncodingCache();
+    ~EventEncodingCache();
+
+    // Forgets the events of the previous batch of pages.
+    void Reset();
+
+    // Must be called before a data source starts walking the batch.
+    void Rewind() { next_event_ = 0; }
+
+    // Returns the position in the batch of the next event walked.
+    uint32_t NextEvent() { return next_event_++; }
+
+    // Adds the event at position |index| in the batch to |bundle|, encoding
+    // it if no other data source has done it yet. Returns false if the event
+    // can't be parsed. Positions can differ between data sources if one of
+    // them gives up on a page early: |start| is checked to catch that.
+    bool WriteEvent(uint32_t index,
+                    uint16_t ftrace_event_id,
+                    uint64_t timestamp,
+                    const uint8_t* start,
+                    const uint8_t* end,
+                    const ProtoTranslationTable* table,
+                    FtraceEventBundle* bundle,
+                    FtraceMetadata* metadata);
+
+   private:
+    enum class State : uint8_t {
+      kNotEncoded,
+      kEncoded,
+      // The encoding depends on the FtraceMetadata of the data source (i.e.
+      // it contains kernel symbol indexes) so it can't be copied.
+      kNotShareable,
+    };
+    struct Entry {
+      const uint8_t* start = nullptr;
+      State state = State::kNotEncoded;
+      uint32_t offset = 0;
+      uint32_t size = 0;
+    };
+
+    EventEncodingCache(const EventEncodingCache&) = delete;
+    EventEncodingCache& operator=(const EventEncodingCache&) = delete;
+
+    uint32_t next_event_ = 0;
+    std::vector<Entry> entries_;
+
+    // The encoded events, back to back. |entries_| point into this.
+    std::vector<uint8_t> encoded_events_;
+
+    // Used to encode one event at a time.
+    std::unique_ptr<protozero::HeapBuffered<protos::pbzero::FtraceEvent>>
+        scratch_;
+  };
+
   CpuReader(size_t cpu,
             const ProtoTranslationTable* table,
             LazyKernelSymbolizer* symbolizer,
@@ -80,6 +149,9 @@ class CpuReader {
                    size_t max_pages,
                    const std::set<FtraceDataSource*>& started_data_sources);
 
+  // The trace_pipe_raw file of the cpu.
+  int trace_fd() const { return *trace_fd_; }
+
   template <typename T>
   static bool ReadAndAdvance(const uint8_t** ptr, const uint8_t* end, T* out) {
     if (*ptr > end - sizeof(T))
@@ -179,20 +251,36 @@ class CpuReader {
       uint16_t page_header_size_len);
 
   // Parse the payload of a raw ftrace page, and write the events as protos
-  // into the provided bundle (and/or compact buffer).
+  // into the provided bundle (and/or compact buffers).
   // |table| contains the mix of compile time (e.g. proto field ids) and
   // run time (e.g. field offset and size) information necessary to do this.
   // The table is initialized once at start time by the ftrace controller
   // which passes it to the CpuReader which passes it here.
   // The caller is responsible for validating that the page_header->size stays
   // within the current page.
+  // If |event_cache| is not null, the events are written through it.
   static size_t ParsePagePayload(const uint8_t* start_of_payload,
                                  const PageHeader* page_header,
                                  const ProtoTranslationTable* table,
                                  const FtraceDataSourceConfig* ds_config,
                                  CompactSchedBuffer* compact_sched_buffer,
+                                 CompactEventsBuffer* compact_events_buffer,
                                  FtraceEventBundle* bundle,
-                                 FtraceMetadata* metadata);
+                                 FtraceMetadata* metadata,
+                                 EventEncodingCache* event_cache);
+
+  static size_t ParsePagePayload(const uint8_t* start_of_payload,
+                                 const PageHeader* page_header,
+                                 const ProtoTranslationTable* table,
+                                 const FtraceDataSourceConfig* ds_config,
+                                 CompactSchedBuffer* compact_sched_buffer,
+                                 FtraceEventBundle* bundle,
+                                 FtraceMetadata* metadata) {
+    return ParsePagePayload(start_of_payload, page_header, table, ds_config,
+                            compact_sched_buffer,
+                            /*compact_events_buffer=*/nullptr, bundle, metadata,
+                            /*event_cache=*/nullptr);
+  }
 
   // Parse a single raw ftrace event beginning at |start| and ending at |end|
   // and write it into the provided bundle as a proto.
@@ -208,6 +296,14 @@ class CpuReader {
                          protozero::Message* message,
                          FtraceMetadata* metadata);
 
+  // Applies to |metadata| the same changes as ParseEvent() without encoding
+  // the event. Used for events which have already been encoded for another
+  // data source.
+  static void ParseEventMetadata(uint16_t ftrace_event_id,
+                                 const uint8_t* start,
+                                 const ProtoTranslationTable* table,
+                                 FtraceMetadata* metadata);
+
   static bool ParseField(const Field& field,
                          const uint8_t* start,
                          const uint8_t* end,
@@ -232,7 +328,9 @@ class CpuReader {
                                       FtraceMetadata* metadata);
 
   // Parses & encodes the given range of contiguous tracing pages. Called by
-  // |ReadAndProcessBatch| for each active data source.
+  // |ReadAndProcessBatch| for each active data source. If |event_cache| is not
+  // null, the encoding of the events is shared with the other data sources
+  // processing the same pages.
   //
   // Returns the number of correctly processed pages. If the return value is
   // equal to |pages_read|, there was no error. Otherwise, the return value
@@ -249,12 +347,28 @@ class CpuReader {
       const ProtoTranslationTable* table,
       LazyKernelSymbolizer* symbolizer,
       const FtraceClockSnapshot*,
-      protos::pbzero::FtraceClock);
+      protos::pbzero::FtraceClock,
+      EventEncodingCache* event_cache);
 
   void set_ftrace_clock(protos::pbzero::FtraceClock clock) {
     ftrace_clock_ = clock;
   }
 
+  // Moves up to |max_pages| pages of ftrace data into |dst| with splice(),
+  // which (unlike read()) moves many pages per syscall, and sets
+  // |*pages_spliced| to the number of pages moved. Only the pages the kernel
+  // has finished writing are spliced: moving fewer than |max_pages| pages
+  // means that we got to the page the kernel is writing into, which needs to
+  // be read().
+  //
+  // Returns false if splice() doesn't work on the file or moved something
+  // other than whole pages. The pages moved until then are still returned,
+  // a partial page is dropped, and splice() is not used anymore: all the
+  // reads fall back to read().
+  //
+  // public for testing
+  bool SplicePages(uint8_t* dst, size_t max_pages, size_t* pages_spliced);
+
  private:
   CpuReader(const CpuReader&) = delete;
   CpuReader& operator=(const CpuReader&) = delete;
@@ -269,12 +383,27 @@ class CpuReader {
       bool first_batch_in_cycle,
       const std::set<FtraceDataSource*>& started_data_sources);
 
+  // Stops using splice() for the next reads, see SplicePages().
+  void DisableSplice();
+
   const size_t cpu_;
   const ProtoTranslationTable* const table_;
   LazyKernelSymbolizer* const symbolizer_;
   const FtraceClockSnapshot* const ftrace_clock_snapshot_;
   base::ScopedFile trace_fd_;
   protos::pbzero::FtraceClock ftrace_clock_{};
+
+  // Pipe through which the pages are spliced, created on the first read.
+  // splice() is not used anymore if it fails on |trace_fd_|.
+  base::Pipe splice_pipe_;
+  size_t splice_pipe_pages_ = 0;
+  bool use_splice_ = true;
+
+  // Number of syscalls made to read the data in the current ReadCycle().
+  uint32_t read_syscalls_ = 0;
+
+  // Only used when more than one data source is started.
+  std::unique_ptr<EventEncodingCache> event_cache_;
 };
 
 }  // namespace perfetto
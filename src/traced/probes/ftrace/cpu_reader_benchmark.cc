@@ -12,6 +12,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <string.h>
+
+#include <vector>
+
 #include <benchmark/benchmark.h>
 
 #include "perfetto/ext/base/utils.h"
@@ -19,6 +23,7 @@
 #include "perfetto/protozero/scattered_stream_null_delegate.h"
 #include "perfetto/protozero/scattered_stream_writer.h"
 #include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "src/traced/probes/ftrace/compact_events.h"
 #include "src/traced/probes/ftrace/cpu_reader.h"
 #include "src/traced/probes/ftrace/ftrace_config_muxer.h"
 #include "src/traced/probes/ftrace/ftrace_print_filter.h"
@@ -572,6 +577,7 @@ void DoParse(const ExamplePage& test_case,
   FtraceDataSourceConfig ds_config{EventFilter{},
                                    EventFilter{},
                                    DisabledCompactSchedConfigForTesting(),
+                                   false /*compact_events*/,
                                    base::nullopt,
                                    {},
                                    {},
@@ -632,5 +638,184 @@ void BM_ParsePageFullOfPrintWithFilterRules(benchmark::State& state) {
 }
 BENCHMARK(BM_ParsePageFullOfPrintWithFilterRules)->DenseRange(0, 16, 1);
 
+// Parses a page full of sched_switch events, with compact_sched disabled, as
+// FtraceEvent protos (arg 0) or with the generic compact encoding (arg 1).
+// Also reports the size of the bundle written for the page: the smaller it
+// is, the more time a trace buffer in ring buffer mode retains.
+void BM_ParsePageFullOfSchedSwitchCompactEvents(benchmark::State& state) {
+  ScatteredStreamWriterNullDelegate delegate(base::kPageSize);
+  ScatteredStreamWriter stream(&delegate);
+  protozero::RootMessage<FtraceEventBundle> writer;
+
+  ProtoTranslationTable* table = GetTable(g_full_page_sched_switch.name);
+  auto page = PageFromXxd(g_full_page_sched_switch.data);
+
+  const bool compact_events = state.range(0) != 0;
+  FtraceDataSourceConfig ds_config{EventFilter{},
+                                   EventFilter{},
+                                   DisabledCompactSchedConfigForTesting(),
+                                   compact_events,
+                                   base::nullopt,
+                                   {},
+                                   {},
+                                   false /*symbolize_ksyms*/,
+                                   false /*preserve_ftrace_buffer*/};
+  ds_config.event_filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+
+  FtraceMetadata metadata{};
+  uint64_t bundle_bytes = 0;
+  while (state.KeepRunning()) {
+    writer.Reset(&stream);
+
+    std::unique_ptr<CompactSchedBuffer> compact_sched_buffer(
+        new CompactSchedBuffer());
+    std::unique_ptr<CompactEventsBuffer> compact_events_buffer(
+        new CompactEventsBuffer());
+    const uint8_t* parse_pos = page.get();
+    base::Optional<CpuReader::PageHeader> page_header =
+        CpuReader::ParsePageHeader(&parse_pos, table->page_header_size_len());
+
+    if (!page_header.has_value())
+      return;
+
+    CpuReader::ParsePagePayload(parse_pos, &page_header.value(), table,
+                                &ds_config, compact_sched_buffer.get(),
+                                compact_events_buffer.get(), &writer,
+                                &metadata, /*event_cache=*/nullptr);
+    if (compact_events)
+      compact_events_buffer->WriteAndReset(&writer);
+    bundle_bytes += writer.Finalize();
+
+    metadata.Clear();
+  }
+  state.counters["bundle_bytes"] = benchmark::Counter(
+      static_cast<double>(bundle_bytes), benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_ParsePageFullOfSchedSwitchCompactEvents)->Arg(0)->Arg(1);
+
+// Parses a page full of sched_switch events for |state.range(0)| concurrent
+// data sources, as CpuReader::ReadAndProcessBatch() does.
+void DoParseForDataSources(benchmark::State& state, bool use_event_cache) {
+  ScatteredStreamWriterNullDelegate delegate(base::kPageSize);
+  ScatteredStreamWriter stream(&delegate);
+  protozero::RootMessage<FtraceEventBundle> writer;
+
+  ProtoTranslationTable* table = GetTable(g_full_page_sched_switch.name);
+  auto page = PageFromXxd(g_full_page_sched_switch.data);
+
+  FtraceDataSourceConfig ds_config{EventFilter{},
+                                   EventFilter{},
+                                   DisabledCompactSchedConfigForTesting(),
+                                   false /*compact_events*/,
+                                   base::nullopt,
+                                   {},
+                                   {},
+                                   false /*symbolize_ksyms*/,
+                                   false /*preserve_ftrace_buffer*/};
+  ds_config.event_filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+
+  const size_t data_sources = static_cast<size_t>(state.range(0));
+  std::vector<FtraceMetadata> metadata(data_sources);
+  CpuReader::EventEncodingCache event_cache;
+  while (state.KeepRunning()) {
+    event_cache.Reset();
+    for (FtraceMetadata& ds_metadata : metadata) {
+      event_cache.Rewind();
+      writer.Reset(&stream);
+
+      std::unique_ptr<CompactSchedBuffer> compact_buffer(
+          new CompactSchedBuffer());
+      const uint8_t* parse_pos = page.get();
+      base::Optional<CpuReader::PageHeader> page_header =
+          CpuReader::ParsePageHeader(&parse_pos,
+                                     table->page_header_size_len());
+
+      if (!page_header.has_value())
+        return;
+
+      CpuReader::ParsePagePayload(
+          parse_pos, &page_header.value(), table, &ds_config,
+          compact_buffer.get(), /*compact_events_buffer=*/nullptr, &writer,
+          &ds_metadata, use_event_cache ? &event_cache : nullptr);
+
+      ds_metadata.Clear();
+    }
+  }
+  // Each page of the kernel buffer is parsed once per data source.
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(base::kPageSize));
+}
+
+void BM_ParsePageForDataSources(benchmark::State& state) {
+  DoParseForDataSources(state, /*use_event_cache=*/false);
+}
+BENCHMARK(BM_ParsePageForDataSources)->Arg(1)->Arg(2)->Arg(4);
+
+void BM_ParsePageForDataSourcesWithEventCache(benchmark::State& state) {
+  DoParseForDataSources(state, /*use_event_cache=*/true);
+}
+BENCHMARK(BM_ParsePageForDataSourcesWithEventCache)->Arg(1)->Arg(2)->Arg(4);
+
+// Events which have a decoder specialized for their layout on the kernel of
+// the table used below, see FindEventDecoder().
+const char* const kHotEvents[] = {
+    "sched_switch",  "sched_waking",  "irq_handler_entry",
+    "softirq_raise", "cpu_frequency", "workqueue_execute_start",
+    "block_rq_issue",
+};
+
+// Parses a single event, whose name is given by |state.range(0)|, either with
+// its specialized decoder or field by field, as done for all other events.
+void DoParseEvent(benchmark::State& state, bool use_decoder) {
+  ScatteredStreamWriterNullDelegate delegate(base::kPageSize);
+  ScatteredStreamWriter stream(&delegate);
+  protozero::RootMessage<FtraceEventBundle> writer;
+
+  const char* name = kHotEvents[state.range(0)];
+  ProtoTranslationTable* table = GetTable("android_raven_AOSP.MASTER_5.10.43");
+  const Event* event = table->GetEventByName(name);
+  EventDecoder decoder = table->GetEventDecoderById(event->ftrace_event_id);
+  PERFETTO_CHECK(decoder);
+  state.SetLabel(name);
+
+  // Fixed size strings are not null terminated and __data_loc ones are empty.
+  std::vector<uint8_t> data(event->size, 0x61);
+  for (const Field& field : event->fields) {
+    if (field.strategy == kDataLocToString)
+      memset(&data[field.ftrace_offset], 0, field.ftrace_size);
+  }
+  const uint8_t* start = data.data();
+  const uint8_t* end = start + data.size();
+
+  FtraceMetadata metadata{};
+  while (state.KeepRunning()) {
+    writer.Reset(&stream);
+    auto* nested =
+        writer.BeginNestedMessage<protozero::Message>(event->proto_field_id);
+    if (use_decoder) {
+      decoder(start, end, nested, &metadata);
+    } else {
+      for (const Field& field : event->fields)
+        CpuReader::ParseField(field, start, end, table, nested, &metadata);
+    }
+    writer.Finalize();
+    metadata.FinishEvent();
+  }
+}
+
+void BM_ParseEventGeneric(benchmark::State& state) {
+  DoParseEvent(state, /*use_decoder=*/false);
+}
+BENCHMARK(BM_ParseEventGeneric)
+    ->DenseRange(0, static_cast<int>(base::ArraySize(kHotEvents)) - 1, 1);
+
+void BM_ParseEventWithDecoder(benchmark::State& state) {
+  DoParseEvent(state, /*use_decoder=*/true);
+}
+BENCHMARK(BM_ParseEventWithDecoder)
+    ->DenseRange(0, static_cast<int>(base::ArraySize(kHotEvents)) - 1, 1);
+
 }  // namespace
 }  // namespace perfetto
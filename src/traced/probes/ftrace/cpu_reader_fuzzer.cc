@@ -57,6 +57,7 @@ void FuzzCpuReaderProcessPagesForDataSource(const uint8_t* data, size_t size) {
   FtraceDataSourceConfig ds_config{EventFilter{},
                                    EventFilter{},
                                    DisabledCompactSchedConfigForTesting(),
+                                   /*compact_events=*/false,
                                    base::nullopt,
                                    {},
                                    {},
@@ -71,7 +72,7 @@ void FuzzCpuReaderProcessPagesForDataSource(const uint8_t* data, size_t size) {
   CpuReader::ProcessPagesForDataSource(
       &null_writer, &metadata, /*cpu=*/0, &ds_config, g_page, /*pages_read=*/1,
       table, /*symbolizer*/ nullptr, /*ftrace_clock_snapshot=*/nullptr,
-      protos::pbzero::FTRACE_CLOCK_UNSPECIFIED);
+      protos::pbzero::FTRACE_CLOCK_UNSPECIFIED, /*event_cache=*/nullptr);
 }
 
 }  // namespace perfetto
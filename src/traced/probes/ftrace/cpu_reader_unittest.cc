@@ -16,10 +16,14 @@
 
 #include "src/traced/probes/ftrace/cpu_reader.h"
 
+#include <fcntl.h>
 #include <string.h>
 #include <sys/stat.h>
 
 #include "perfetto/base/build_config.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/pipe.h"
+#include "perfetto/ext/base/temp_file.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
@@ -66,6 +70,7 @@ FtraceDataSourceConfig EmptyConfig() {
   return FtraceDataSourceConfig{EventFilter{},
                                 EventFilter{},
                                 DisabledCompactSchedConfigForTesting(),
+                                false /*compact_events*/,
                                 base::nullopt,
                                 {},
                                 {},
@@ -945,6 +950,7 @@ TEST(CpuReaderTest, ParseSixSchedSwitchCompactFormat) {
   FtraceDataSourceConfig ds_config{EventFilter{},
                                    EventFilter{},
                                    EnabledCompactSchedConfigForTesting(),
+                                   false /*compact_events*/,
                                    base::nullopt,
                                    {},
                                    {},
@@ -1008,6 +1014,152 @@ TEST(CpuReaderTest, ParseSixSchedSwitchCompactFormat) {
   EXPECT_EQ("sleep", next_comm);
 }
 
+TEST(CpuReaderTest, ParseSixSchedSwitchCompactEvents) {
+  const ExamplePage* test_case = &g_six_sched_switch;
+
+  BundleProvider bundle_provider(base::kPageSize);
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+
+  FtraceDataSourceConfig ds_config{EventFilter{},
+                                   EventFilter{},
+                                   DisabledCompactSchedConfigForTesting(),
+                                   true /*compact_events*/,
+                                   base::nullopt,
+                                   {},
+                                   {},
+                                   false /* symbolize_ksyms*/,
+                                   false /*preserve_ftrace_buffer*/};
+  ds_config.event_filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+
+  FtraceMetadata metadata{};
+  CompactSchedBuffer compact_sched_buffer;
+  CompactEventsBuffer compact_events_buffer;
+  const uint8_t* parse_pos = page.get();
+  base::Optional<CpuReader::PageHeader> page_header =
+      CpuReader::ParsePageHeader(&parse_pos, table->page_header_size_len());
+  ASSERT_TRUE(page_header.has_value());
+
+  size_t evt_bytes = CpuReader::ParsePagePayload(
+      parse_pos, &page_header.value(), table, &ds_config,
+      &compact_sched_buffer, &compact_events_buffer, bundle_provider.writer(),
+      &metadata, /*event_cache=*/nullptr);
+  EXPECT_LT(0u, evt_bytes);
+
+  // The events were buffered rather than written, but the metadata is the
+  // same as usual.
+  EXPECT_EQ(6u, compact_events_buffer.size());
+  EXPECT_THAT(metadata.pids, Contains(3733));
+  EXPECT_THAT(metadata.pids, Contains(10));
+
+  compact_events_buffer.WriteAndReset(bundle_provider.writer());
+  bundle_provider.writer()->Finalize();
+  auto bundle = bundle_provider.ParseProto();
+  ASSERT_TRUE(bundle);
+  EXPECT_EQ(0u, bundle->event().size());
+  EXPECT_FALSE(bundle->has_compact_sched());
+
+  const auto& compact_events = bundle->compact_events();
+  ASSERT_EQ(1u, compact_events.batch().size());
+  const auto& batch = compact_events.batch()[0];
+  EXPECT_EQ(static_cast<uint32_t>(
+                protos::gen::FtraceEvent::kSchedSwitchFieldNumber),
+            batch.event_id());
+  ASSERT_EQ(6u, batch.timestamp().size());
+  EXPECT_TRUE(WithinOneMicrosecond(batch.timestamp()[0], 1045157, 722134));
+
+  ASSERT_EQ(1u, batch.common_field().size());
+  EXPECT_EQ(static_cast<uint32_t>(protos::gen::FtraceEvent::kPidFieldNumber),
+            batch.common_field()[0].field_id());
+  EXPECT_EQ(6u, batch.common_field()[0].int_values().size());
+
+  auto column = [&batch](uint32_t field_id) {
+    for (const auto& c : batch.field()) {
+      if (c.field_id() == field_id)
+        return c;
+    }
+    return protos::gen::FtraceEventBundle::CompactEvents::Column();
+  };
+  using Switch = protos::gen::SchedSwitchFtraceEvent;
+  auto next_pid = column(Switch::kNextPidFieldNumber);
+  ASSERT_EQ(6u, next_pid.int_values().size());
+  EXPECT_EQ(3733,
+            protozero::proto_utils::ZigZagDecode(next_pid.int_values()[0]));
+
+  // String indexes are offset by one, 0 means that the field isn't set.
+  auto next_comm = column(Switch::kNextCommFieldNumber);
+  ASSERT_EQ(6u, next_comm.string_indexes().size());
+  uint32_t comm_index = next_comm.string_indexes()[0];
+  ASSERT_LT(0u, comm_index);
+  EXPECT_EQ("sleep", compact_events.intern_table()[comm_index - 1]);
+
+  auto prev_state = column(Switch::kPrevStateFieldNumber);
+  ASSERT_EQ(6u, prev_state.int_values().size());
+  EXPECT_EQ(1,
+            protozero::proto_utils::ZigZagDecode(prev_state.int_values()[0]));
+}
+
+// Parses the same page for several data sources sharing an EventEncodingCache
+// and checks that they get exactly what they would get without it.
+TEST(CpuReaderTest, ParseSixSchedSwitchWithEventCache) {
+  const ExamplePage* test_case = &g_six_sched_switch;
+
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+  const uint32_t sched_switch_id =
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch"));
+
+  // The compact data source doesn't use the cache, but still needs to go
+  // through all the events.
+  std::vector<FtraceDataSourceConfig> ds_configs;
+  ds_configs.push_back(FtraceDataSourceConfig{
+      EventFilter{}, EventFilter{}, EnabledCompactSchedConfigForTesting(),
+      false /*compact_events*/, base::nullopt, {}, {},
+      false /* symbolize_ksyms*/,
+      false /*preserve_ftrace_buffer*/});
+  ds_configs.push_back(EmptyConfig());
+  ds_configs.push_back(EmptyConfig());
+  for (FtraceDataSourceConfig& ds_config : ds_configs)
+    ds_config.event_filter.AddEnabledEvent(sched_switch_id);
+
+  auto parse = [&](const FtraceDataSourceConfig& ds_config,
+                   CpuReader::EventEncodingCache* event_cache,
+                   FtraceMetadata* metadata) {
+    BundleProvider bundle_provider(base::kPageSize);
+    std::unique_ptr<CompactSchedBuffer> compact_buffer(
+        new CompactSchedBuffer());
+    const uint8_t* parse_pos = page.get();
+    base::Optional<CpuReader::PageHeader> page_header =
+        CpuReader::ParsePageHeader(&parse_pos, table->page_header_size_len());
+    EXPECT_TRUE(page_header.has_value());
+    EXPECT_LT(0u, CpuReader::ParsePagePayload(
+                      parse_pos, &page_header.value(), table, &ds_config,
+                      compact_buffer.get(), /*compact_events_buffer=*/nullptr,
+                      bundle_provider.writer(), metadata, event_cache));
+    compact_buffer->WriteAndReset(bundle_provider.writer());
+    return bundle_provider.ParseProto();
+  };
+
+  CpuReader::EventEncodingCache event_cache;
+  event_cache.Reset();
+  for (const FtraceDataSourceConfig& ds_config : ds_configs) {
+    event_cache.Rewind();
+    FtraceMetadata metadata{};
+    auto bundle = parse(ds_config, &event_cache, &metadata);
+    ASSERT_TRUE(bundle);
+
+    FtraceMetadata expected_metadata{};
+    auto expected_bundle = parse(ds_config, nullptr, &expected_metadata);
+    ASSERT_TRUE(expected_bundle);
+
+    EXPECT_EQ(*bundle, *expected_bundle);
+    EXPECT_EQ(bundle->event().size(),
+              ds_config.compact_sched.enabled ? 0u : 6u);
+    EXPECT_THAT(metadata.pids, ElementsAreArray(expected_metadata.pids));
+  }
+}
+
 TEST_F(CpuReaderTableTest, ParseAllFields) {
   using FakeEventProvider =
       ProtoProvider<pbzero::FakeFtraceEvent, gen::FakeFtraceEvent>;
@@ -1234,6 +1386,14 @@ TEST_F(CpuReaderTableTest, ParseAllFields) {
               Contains(Pair(98u, kUserspaceBlockDeviceId)));
   EXPECT_THAT(metadata.inode_and_device,
               Contains(Pair(99u, k64BitUserspaceBlockDeviceId)));
+
+  // ParseEventMetadata() must have the same effect on the metadata.
+  FtraceMetadata metadata_only{};
+  CpuReader::ParseEventMetadata(ftrace_event_id, input.get(), &table,
+                                &metadata_only);
+  EXPECT_THAT(metadata_only.pids, ElementsAreArray(metadata.pids));
+  EXPECT_THAT(metadata_only.inode_and_device,
+              ElementsAreArray(metadata.inode_and_device));
 }
 
 TEST(CpuReaderTest, TaskRenameEvent) {
@@ -1360,7 +1520,7 @@ TEST(CpuReaderTest, NewPacketOnLostEvents) {
   size_t processed_pages = CpuReader::ProcessPagesForDataSource(
       &trace_writer, &metadata, /*cpu=*/1, &ds_config, buf.get(), kTestPages,
       table, /*symbolizer=*/nullptr, /*ftrace_clock_snapshot=*/nullptr,
-      protos::pbzero::FTRACE_CLOCK_UNSPECIFIED);
+      protos::pbzero::FTRACE_CLOCK_UNSPECIFIED, /*event_cache=*/nullptr);
 
   ASSERT_EQ(processed_pages, kTestPages);
 
@@ -1409,7 +1569,7 @@ TEST(CpuReaderTest, ProcessPagesForDataSourceError) {
   size_t processed_pages = CpuReader::ProcessPagesForDataSource(
       &trace_writer, &metadata, /*cpu=*/1, &ds_config, buf.get(), kTestPages,
       table, /*symbolizer=*/nullptr, /*ftrace_clock_snapshot=*/nullptr,
-      protos::pbzero::FTRACE_CLOCK_UNSPECIFIED);
+      protos::pbzero::FTRACE_CLOCK_UNSPECIFIED, /*event_cache=*/nullptr);
 
   EXPECT_EQ(processed_pages, 3u);
 }
@@ -3064,5 +3224,143 @@ TEST(CpuReaderTest, ZeroPaddedPageWorkaround) {
   ASSERT_TRUE(bundle);
 }
 
+// Returns |size| bytes of data which differ between pages.
+std::vector<uint8_t> MakePages(size_t size) {
+  std::vector<uint8_t> data(size);
+  for (size_t i = 0; i < size; i++)
+    data[i] = static_cast<uint8_t>(i / base::kPageSize + i);
+  return data;
+}
+
+// Returns a CpuReader reading |path|, which stands for trace_pipe_raw.
+std::unique_ptr<CpuReader> CreateCpuReaderForFile(const std::string& path) {
+  base::ScopedFile fd = base::OpenFile(path, O_RDONLY);
+  PERFETTO_CHECK(fd);
+  return std::unique_ptr<CpuReader>(
+      new CpuReader(0, nullptr, nullptr, nullptr, std::move(fd)));
+}
+
+TEST(CpuReaderTest, SplicePagesWholePages) {
+  base::TempFile file = base::TempFile::Create();
+  std::vector<uint8_t> data = MakePages(2 * base::kPageSize);
+  ASSERT_EQ(base::WriteAll(file.fd(), data.data(), data.size()),
+            static_cast<ssize_t>(data.size()));
+  std::unique_ptr<CpuReader> reader = CreateCpuReaderForFile(file.path());
+
+  std::vector<uint8_t> buf(4 * base::kPageSize);
+  size_t pages = 0;
+  ASSERT_TRUE(reader->SplicePages(buf.data(), 4, &pages));
+  ASSERT_EQ(pages, 2u);
+  EXPECT_EQ(memcmp(buf.data(), data.data(), data.size()), 0);
+
+  // Nothing left.
+  ASSERT_TRUE(reader->SplicePages(buf.data(), 4, &pages));
+  EXPECT_EQ(pages, 0u);
+}
+
+TEST(CpuReaderTest, SplicePagesPartialPage) {
+  base::TempFile file = base::TempFile::Create();
+  std::vector<uint8_t> data = MakePages(2 * base::kPageSize + 100);
+  ASSERT_EQ(base::WriteAll(file.fd(), data.data(), data.size()),
+            static_cast<ssize_t>(data.size()));
+  std::unique_ptr<CpuReader> reader = CreateCpuReaderForFile(file.path());
+
+  // The whole pages are returned and the partial one is dropped.
+  std::vector<uint8_t> buf(4 * base::kPageSize);
+  size_t pages = 0;
+  ASSERT_FALSE(reader->SplicePages(buf.data(), 4, &pages));
+  ASSERT_EQ(pages, 2u);
+  EXPECT_EQ(memcmp(buf.data(), data.data(), 2 * base::kPageSize), 0);
+
+  // splice() isn't used anymore.
+  ASSERT_FALSE(reader->SplicePages(buf.data(), 4, &pages));
+  EXPECT_EQ(pages, 0u);
+}
+
+TEST(CpuReaderTest, SplicePagesNoData) {
+  // A non-blocking pipe stands for a trace_pipe_raw without any full page.
+  base::Pipe pipe = base::Pipe::Create(base::Pipe::kBothNonBlock);
+  std::unique_ptr<CpuReader> reader(
+      new CpuReader(0, nullptr, nullptr, nullptr, std::move(pipe.rd)));
+
+  // EAGAIN is not an error.
+  std::vector<uint8_t> buf(4 * base::kPageSize);
+  size_t pages = 0;
+  ASSERT_TRUE(reader->SplicePages(buf.data(), 4, &pages));
+  EXPECT_EQ(pages, 0u);
+
+  std::vector<uint8_t> data = MakePages(base::kPageSize);
+  ASSERT_EQ(base::WriteAll(*pipe.wr, data.data(), data.size()),
+            static_cast<ssize_t>(data.size()));
+  ASSERT_TRUE(reader->SplicePages(buf.data(), 4, &pages));
+  ASSERT_EQ(pages, 1u);
+  EXPECT_EQ(memcmp(buf.data(), data.data(), data.size()), 0);
+}
+
+// Returns |pages| pages of data whose header says that they are full, as the
+// pages the kernel has finished writing.
+std::vector<uint8_t> MakeFullPages(size_t pages,
+                                   const ProtoTranslationTable* table) {
+  std::vector<uint8_t> data = MakePages(pages * base::kPageSize);
+  const uint16_t size_len = table->page_header_size_len();
+  const uint64_t commit = base::kPageSize - 8 - size_len;
+  for (size_t i = 0; i < pages; i++)
+    memcpy(&data[i * base::kPageSize + 8], &commit, size_len);
+  return data;
+}
+
+TEST(CpuReaderTest, ReadCycleSplicesUntilEagain) {
+  ProtoTranslationTable* table = GetTable("android_raven_AOSP.MASTER_5.10.43");
+  base::Pipe pipe = base::Pipe::Create(base::Pipe::kBothNonBlock);
+  CpuReader reader(0, table, nullptr, nullptr, std::move(pipe.rd));
+
+  // splice() moves the 3 pages, then both splice() and read() get EAGAIN.
+  std::vector<uint8_t> data = MakeFullPages(3, table);
+  ASSERT_EQ(base::WriteAll(*pipe.wr, data.data(), data.size()),
+            static_cast<ssize_t>(data.size()));
+  std::vector<uint8_t> buf(8 * base::kPageSize);
+  ASSERT_EQ(reader.ReadCycle(buf.data(), 8, 8, {}), 3u);
+  EXPECT_EQ(memcmp(buf.data(), data.data(), data.size()), 0);
+
+  // splice() is still used.
+  data = MakeFullPages(1, table);
+  ASSERT_EQ(base::WriteAll(*pipe.wr, data.data(), data.size()),
+            static_cast<ssize_t>(data.size()));
+  size_t pages = 0;
+  ASSERT_TRUE(reader.SplicePages(buf.data(), 8, &pages));
+  ASSERT_EQ(pages, 1u);
+  EXPECT_EQ(memcmp(buf.data(), data.data(), data.size()), 0);
+}
+
+TEST(CpuReaderTest, ReadCycleFallsBackToReadAfterPartialSplice) {
+  ProtoTranslationTable* table = GetTable("android_raven_AOSP.MASTER_5.10.43");
+  base::Pipe pipe = base::Pipe::Create(base::Pipe::kBothNonBlock);
+  CpuReader reader(0, table, nullptr, nullptr, std::move(pipe.rd));
+
+  // splice() moves the 2 pages and a partial one, which is dropped. The
+  // following read() gets EAGAIN.
+  std::vector<uint8_t> data = MakeFullPages(2, table);
+  ASSERT_EQ(base::WriteAll(*pipe.wr, data.data(), data.size()),
+            static_cast<ssize_t>(data.size()));
+  std::vector<uint8_t> partial(100, 0x42);
+  ASSERT_EQ(base::WriteAll(*pipe.wr, partial.data(), partial.size()),
+            static_cast<ssize_t>(partial.size()));
+  std::vector<uint8_t> buf(8 * base::kPageSize);
+  ASSERT_EQ(reader.ReadCycle(buf.data(), 8, 8, {}), 2u);
+  EXPECT_EQ(memcmp(buf.data(), data.data(), data.size()), 0);
+
+  // The next pages are read() one at a time.
+  data = MakeFullPages(3, table);
+  ASSERT_EQ(base::WriteAll(*pipe.wr, data.data(), data.size()),
+            static_cast<ssize_t>(data.size()));
+  memset(buf.data(), 0, buf.size());
+  ASSERT_EQ(reader.ReadCycle(buf.data(), 8, 8, {}), 3u);
+  EXPECT_EQ(memcmp(buf.data(), data.data(), data.size()), 0);
+
+  size_t pages = 0;
+  ASSERT_FALSE(reader.SplicePages(buf.data(), 8, &pages));
+  EXPECT_EQ(pages, 0u);
+}
+
 }  // namespace
 }  // namespace perfetto
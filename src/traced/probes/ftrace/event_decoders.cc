@@ -0,0 +1,524 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ftrace/event_decoders.h"
+
+#include <string.h>
+
+#include <vector>
+
+#include "perfetto/base/compiler.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/protozero/message.h"
+#include "protos/perfetto/trace/ftrace/block.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/irq.pbzero.h"
+#include "protos/perfetto/trace/ftrace/power.pbzero.h"
+#include "protos/perfetto/trace/ftrace/sched.pbzero.h"
+#include "protos/perfetto/trace/ftrace/workqueue.pbzero.h"
+#include "src/traced/probes/ftrace/cpu_reader.h"
+#include "src/traced/probes/ftrace/ftrace_metadata.h"
+
+namespace perfetto {
+
+namespace {
+
+using protos::pbzero::BlockRqCompleteFtraceEvent;
+using protos::pbzero::BlockRqIssueFtraceEvent;
+using protos::pbzero::CpuFrequencyFtraceEvent;
+using protos::pbzero::FtraceEvent;
+using protos::pbzero::IrqHandlerEntryFtraceEvent;
+using protos::pbzero::IrqHandlerExitFtraceEvent;
+using protos::pbzero::SchedSwitchFtraceEvent;
+using protos::pbzero::SchedWakingFtraceEvent;
+using protos::pbzero::SoftirqEntryFtraceEvent;
+using protos::pbzero::WorkqueueExecuteStartFtraceEvent;
+
+// Translates a single field, see the matching cases in CpuReader::ParseField.
+// Only the strategies used by the layouts below are specialized, using a
+// layout with any other strategy fails to compile.
+template <TranslationStrategy kStrategy>
+struct FieldDecoder;
+
+template <typename T>
+struct VarIntFieldDecoder {
+  static bool Decode(const uint8_t*,
+                     const uint8_t* field_start,
+                     const uint8_t*,
+                     uint16_t,
+                     uint32_t field_id,
+                     protozero::Message* message,
+                     FtraceMetadata*) {
+    CpuReader::ReadIntoVarInt<T>(field_start, field_id, message);
+    return true;
+  }
+};
+
+template <>
+struct FieldDecoder<kUint32ToUint32> : VarIntFieldDecoder<uint32_t> {};
+template <>
+struct FieldDecoder<kUint32ToUint64> : VarIntFieldDecoder<uint32_t> {};
+template <>
+struct FieldDecoder<kUint64ToUint64> : VarIntFieldDecoder<uint64_t> {};
+template <>
+struct FieldDecoder<kInt32ToInt32> : VarIntFieldDecoder<int32_t> {};
+template <>
+struct FieldDecoder<kInt32ToInt64> : VarIntFieldDecoder<int32_t> {};
+template <>
+struct FieldDecoder<kInt64ToInt64> : VarIntFieldDecoder<int64_t> {};
+
+template <>
+struct FieldDecoder<kPid32ToInt32> {
+  static bool Decode(const uint8_t*,
+                     const uint8_t* field_start,
+                     const uint8_t*,
+                     uint16_t,
+                     uint32_t field_id,
+                     protozero::Message* message,
+                     FtraceMetadata* metadata) {
+    CpuReader::ReadPid(field_start, field_id, message, metadata);
+    return true;
+  }
+};
+
+template <>
+struct FieldDecoder<kDevId32ToUint64> {
+  static bool Decode(const uint8_t*,
+                     const uint8_t* field_start,
+                     const uint8_t*,
+                     uint16_t,
+                     uint32_t field_id,
+                     protozero::Message* message,
+                     FtraceMetadata* metadata) {
+    CpuReader::ReadDevId<uint32_t>(field_start, field_id, message, metadata);
+    return true;
+  }
+};
+
+template <>
+struct FieldDecoder<kFtraceSymAddr64ToUint64> {
+  static bool Decode(const uint8_t*,
+                     const uint8_t* field_start,
+                     const uint8_t*,
+                     uint16_t,
+                     uint32_t field_id,
+                     protozero::Message* message,
+                     FtraceMetadata* metadata) {
+    CpuReader::ReadSymbolAddr<uint64_t>(field_start, field_id, message,
+                                        metadata);
+    return true;
+  }
+};
+
+template <>
+struct FieldDecoder<kFixedCStringToString> {
+  static bool Decode(const uint8_t*,
+                     const uint8_t* field_start,
+                     const uint8_t*,
+                     uint16_t size,
+                     uint32_t field_id,
+                     protozero::Message* message,
+                     FtraceMetadata*) {
+    const char* str = reinterpret_cast<const char*>(field_start);
+    message->AppendBytes(field_id, str, strnlen(str, size));
+    return true;
+  }
+};
+
+template <>
+struct FieldDecoder<kDataLocToString> {
+  static bool Decode(const uint8_t* start,
+                     const uint8_t* field_start,
+                     const uint8_t* end,
+                     uint16_t,
+                     uint32_t field_id,
+                     protozero::Message* message,
+                     FtraceMetadata*) {
+    // See kernel header include/trace/trace_events.h
+    uint32_t data;
+    memcpy(&data, field_start, sizeof(data));
+    const uint16_t offset = data & 0xffff;
+    const uint16_t len = (data >> 16) & 0xffff;
+    const uint8_t* const string_start = start + offset;
+
+    if (PERFETTO_UNLIKELY(len == 0))
+      return true;
+    if (PERFETTO_UNLIKELY(string_start + len > end)) {
+      PERFETTO_DFATAL("__data_loc points at invalid location");
+      return false;
+    }
+    const char* str = reinterpret_cast<const char*>(string_start);
+    message->AppendBytes(field_id, str, strnlen(str, len));
+    return true;
+  }
+};
+
+// A field at a fixed position in the raw event.
+template <uint16_t kOffset,
+          uint16_t kSize,
+          TranslationStrategy kStrategy,
+          uint32_t kProtoFieldId>
+struct FieldLayout {
+  static bool Matches(const Field& field) {
+    return field.ftrace_offset == kOffset && field.ftrace_size == kSize &&
+           field.strategy == kStrategy && field.proto_field_id == kProtoFieldId;
+  }
+
+  PERFETTO_ALWAYS_INLINE static bool Decode(const uint8_t* start,
+                                            const uint8_t* end,
+                                            protozero::Message* message,
+                                            FtraceMetadata* metadata) {
+    PERFETTO_DCHECK(start + kOffset + kSize <= end);
+    return FieldDecoder<kStrategy>::Decode(start, start + kOffset, end, kSize,
+                                           kProtoFieldId, message, metadata);
+  }
+};
+
+// The layout of a whole event: its fields, in the same order as in the
+// |fields| of the Event the layout is checked against. Fields are written to
+// the proto in that order, so the output is the same as the generic path.
+template <typename... Fields>
+struct EventLayout;
+
+template <>
+struct EventLayout<> {
+  static bool MatchesFrom(const std::vector<Field>& fields, size_t i) {
+    return i == fields.size();
+  }
+
+  PERFETTO_ALWAYS_INLINE static bool DecodeFields(const uint8_t*,
+                                                  const uint8_t*,
+                                                  protozero::Message*,
+                                                  FtraceMetadata*) {
+    return true;
+  }
+};
+
+template <typename First, typename... Rest>
+struct EventLayout<First, Rest...> {
+  static bool Matches(const Event& event) {
+    return MatchesFrom(event.fields, 0);
+  }
+
+  static bool MatchesFrom(const std::vector<Field>& fields, size_t i) {
+    return i < fields.size() && First::Matches(fields[i]) &&
+           EventLayout<Rest...>::MatchesFrom(fields, i + 1);
+  }
+
+  static bool Decode(const uint8_t* start,
+                     const uint8_t* end,
+                     protozero::Message* message,
+                     FtraceMetadata* metadata) {
+    return DecodeFields(start, end, message, metadata);
+  }
+
+  PERFETTO_ALWAYS_INLINE static bool DecodeFields(const uint8_t* start,
+                                                  const uint8_t* end,
+                                                  protozero::Message* message,
+                                                  FtraceMetadata* metadata) {
+    bool success = First::Decode(start, end, message, metadata);
+    success &=
+        EventLayout<Rest...>::DecodeFields(start, end, message, metadata);
+    return success;
+  }
+};
+
+// The layouts below are the ones found in the format files of the kernels
+// under test/data. Unless stated otherwise they are shared by 3.10+ kernels,
+// both 32 and 64 bit.
+
+// 64-bit kernels, where prev_state is a long.
+using SchedSwitchLayout = EventLayout<
+    FieldLayout<8,
+                16,
+                kFixedCStringToString,
+                SchedSwitchFtraceEvent::kPrevCommFieldNumber>,
+    FieldLayout<24,
+                4,
+                kPid32ToInt32,
+                SchedSwitchFtraceEvent::kPrevPidFieldNumber>,
+    FieldLayout<28,
+                4,
+                kInt32ToInt32,
+                SchedSwitchFtraceEvent::kPrevPrioFieldNumber>,
+    FieldLayout<32,
+                8,
+                kInt64ToInt64,
+                SchedSwitchFtraceEvent::kPrevStateFieldNumber>,
+    FieldLayout<40,
+                16,
+                kFixedCStringToString,
+                SchedSwitchFtraceEvent::kNextCommFieldNumber>,
+    FieldLayout<56,
+                4,
+                kPid32ToInt32,
+                SchedSwitchFtraceEvent::kNextPidFieldNumber>,
+    FieldLayout<60,
+                4,
+                kInt32ToInt32,
+                SchedSwitchFtraceEvent::kNextPrioFieldNumber>>;
+
+// 32-bit kernels.
+using SchedSwitchLayout32 = EventLayout<
+    FieldLayout<8,
+                16,
+                kFixedCStringToString,
+                SchedSwitchFtraceEvent::kPrevCommFieldNumber>,
+    FieldLayout<24,
+                4,
+                kPid32ToInt32,
+                SchedSwitchFtraceEvent::kPrevPidFieldNumber>,
+    FieldLayout<28,
+                4,
+                kInt32ToInt32,
+                SchedSwitchFtraceEvent::kPrevPrioFieldNumber>,
+    FieldLayout<32,
+                4,
+                kInt32ToInt64,
+                SchedSwitchFtraceEvent::kPrevStateFieldNumber>,
+    FieldLayout<36,
+                16,
+                kFixedCStringToString,
+                SchedSwitchFtraceEvent::kNextCommFieldNumber>,
+    FieldLayout<52,
+                4,
+                kPid32ToInt32,
+                SchedSwitchFtraceEvent::kNextPidFieldNumber>,
+    FieldLayout<56,
+                4,
+                kInt32ToInt32,
+                SchedSwitchFtraceEvent::kNextPrioFieldNumber>>;
+
+// sched_waking and sched_wakeup.
+using SchedWakeupLayout = EventLayout<
+    FieldLayout<8,
+                16,
+                kFixedCStringToString,
+                SchedWakingFtraceEvent::kCommFieldNumber>,
+    FieldLayout<24, 4, kPid32ToInt32, SchedWakingFtraceEvent::kPidFieldNumber>,
+    FieldLayout<28, 4, kInt32ToInt32, SchedWakingFtraceEvent::kPrioFieldNumber>,
+    FieldLayout<32,
+                4,
+                kInt32ToInt32,
+                SchedWakingFtraceEvent::kSuccessFieldNumber>,
+    FieldLayout<36,
+                4,
+                kInt32ToInt32,
+                SchedWakingFtraceEvent::kTargetCpuFieldNumber>>;
+
+using IrqHandlerEntryLayout = EventLayout<
+    FieldLayout<8,
+                4,
+                kInt32ToInt32,
+                IrqHandlerEntryFtraceEvent::kIrqFieldNumber>,
+    FieldLayout<12,
+                4,
+                kDataLocToString,
+                IrqHandlerEntryFtraceEvent::kNameFieldNumber>>;
+
+// Older kernels which also have the address of the handler.
+using IrqHandlerEntryWithHandlerLayout = EventLayout<
+    FieldLayout<8,
+                4,
+                kInt32ToInt32,
+                IrqHandlerEntryFtraceEvent::kIrqFieldNumber>,
+    FieldLayout<12,
+                4,
+                kDataLocToString,
+                IrqHandlerEntryFtraceEvent::kNameFieldNumber>,
+    FieldLayout<16,
+                4,
+                kUint32ToUint32,
+                IrqHandlerEntryFtraceEvent::kHandlerFieldNumber>>;
+
+using IrqHandlerExitLayout = EventLayout<
+    FieldLayout<8,
+                4,
+                kInt32ToInt32,
+                IrqHandlerExitFtraceEvent::kIrqFieldNumber>,
+    FieldLayout<12,
+                4,
+                kInt32ToInt32,
+                IrqHandlerExitFtraceEvent::kRetFieldNumber>>;
+
+// softirq_entry, softirq_exit and softirq_raise.
+using SoftirqLayout = EventLayout<
+    FieldLayout<8,
+                4,
+                kUint32ToUint32,
+                SoftirqEntryFtraceEvent::kVecFieldNumber>>;
+
+// cpu_frequency and cpu_idle.
+using CpuStateLayout = EventLayout<
+    FieldLayout<8,
+                4,
+                kUint32ToUint32,
+                CpuFrequencyFtraceEvent::kStateFieldNumber>,
+    FieldLayout<12,
+                4,
+                kUint32ToUint32,
+                CpuFrequencyFtraceEvent::kCpuIdFieldNumber>>;
+
+// workqueue_execute_start and, on 5.x kernels, workqueue_execute_end. Only
+// 64-bit kernels have kernel addresses that get symbolized.
+using WorkqueueExecuteLayout = EventLayout<
+    FieldLayout<8,
+                8,
+                kFtraceSymAddr64ToUint64,
+                WorkqueueExecuteStartFtraceEvent::kWorkFieldNumber>,
+    FieldLayout<16,
+                8,
+                kFtraceSymAddr64ToUint64,
+                WorkqueueExecuteStartFtraceEvent::kFunctionFieldNumber>>;
+
+// workqueue_execute_end before 5.x.
+using WorkqueueExecuteEndLayout = EventLayout<
+    FieldLayout<8,
+                8,
+                kFtraceSymAddr64ToUint64,
+                WorkqueueExecuteStartFtraceEvent::kWorkFieldNumber>>;
+
+using BlockRqIssueLayout = EventLayout<
+    FieldLayout<8,
+                4,
+                kDevId32ToUint64,
+                BlockRqIssueFtraceEvent::kDevFieldNumber>,
+    FieldLayout<16,
+                8,
+                kUint64ToUint64,
+                BlockRqIssueFtraceEvent::kSectorFieldNumber>,
+    FieldLayout<24,
+                4,
+                kUint32ToUint32,
+                BlockRqIssueFtraceEvent::kNrSectorFieldNumber>,
+    FieldLayout<28,
+                4,
+                kUint32ToUint32,
+                BlockRqIssueFtraceEvent::kBytesFieldNumber>,
+    FieldLayout<32,
+                8,
+                kFixedCStringToString,
+                BlockRqIssueFtraceEvent::kRwbsFieldNumber>,
+    FieldLayout<40,
+                16,
+                kFixedCStringToString,
+                BlockRqIssueFtraceEvent::kCommFieldNumber>,
+    FieldLayout<56,
+                4,
+                kDataLocToString,
+                BlockRqIssueFtraceEvent::kCmdFieldNumber>>;
+
+// Before 5.x, where |errors| was renamed to |error|.
+using BlockRqCompleteLayout = EventLayout<
+    FieldLayout<8,
+                4,
+                kDevId32ToUint64,
+                BlockRqCompleteFtraceEvent::kDevFieldNumber>,
+    FieldLayout<16,
+                8,
+                kUint64ToUint64,
+                BlockRqCompleteFtraceEvent::kSectorFieldNumber>,
+    FieldLayout<24,
+                4,
+                kUint32ToUint32,
+                BlockRqCompleteFtraceEvent::kNrSectorFieldNumber>,
+    FieldLayout<28,
+                4,
+                kInt32ToInt32,
+                BlockRqCompleteFtraceEvent::kErrorsFieldNumber>,
+    FieldLayout<32,
+                8,
+                kFixedCStringToString,
+                BlockRqCompleteFtraceEvent::kRwbsFieldNumber>,
+    FieldLayout<40,
+                4,
+                kDataLocToString,
+                BlockRqCompleteFtraceEvent::kCmdFieldNumber>>;
+
+using BlockRqCompleteLayout5 = EventLayout<
+    FieldLayout<8,
+                4,
+                kDevId32ToUint64,
+                BlockRqCompleteFtraceEvent::kDevFieldNumber>,
+    FieldLayout<16,
+                8,
+                kUint64ToUint64,
+                BlockRqCompleteFtraceEvent::kSectorFieldNumber>,
+    FieldLayout<24,
+                4,
+                kUint32ToUint32,
+                BlockRqCompleteFtraceEvent::kNrSectorFieldNumber>,
+    FieldLayout<32,
+                8,
+                kFixedCStringToString,
+                BlockRqCompleteFtraceEvent::kRwbsFieldNumber>,
+    FieldLayout<40,
+                4,
+                kDataLocToString,
+                BlockRqCompleteFtraceEvent::kCmdFieldNumber>,
+    FieldLayout<28,
+                4,
+                kInt32ToInt32,
+                BlockRqCompleteFtraceEvent::kErrorFieldNumber>>;
+
+struct KnownLayout {
+  // Field id of the event in FtraceEvent.
+  uint32_t proto_field_id;
+  bool (*matches)(const Event&);
+  EventDecoder decoder;
+};
+
+#define PERFETTO_KNOWN_LAYOUT(event, layout) \
+  { FtraceEvent::event, &layout::Matches, &layout::Decode }
+
+const KnownLayout kKnownLayouts[] = {
+    PERFETTO_KNOWN_LAYOUT(kSchedSwitchFieldNumber, SchedSwitchLayout),
+    PERFETTO_KNOWN_LAYOUT(kSchedSwitchFieldNumber, SchedSwitchLayout32),
+    PERFETTO_KNOWN_LAYOUT(kSchedWakingFieldNumber, SchedWakeupLayout),
+    PERFETTO_KNOWN_LAYOUT(kSchedWakeupFieldNumber, SchedWakeupLayout),
+    PERFETTO_KNOWN_LAYOUT(kIrqHandlerEntryFieldNumber, IrqHandlerEntryLayout),
+    PERFETTO_KNOWN_LAYOUT(kIrqHandlerEntryFieldNumber,
+                          IrqHandlerEntryWithHandlerLayout),
+    PERFETTO_KNOWN_LAYOUT(kIrqHandlerExitFieldNumber, IrqHandlerExitLayout),
+    PERFETTO_KNOWN_LAYOUT(kSoftirqEntryFieldNumber, SoftirqLayout),
+    PERFETTO_KNOWN_LAYOUT(kSoftirqExitFieldNumber, SoftirqLayout),
+    PERFETTO_KNOWN_LAYOUT(kSoftirqRaiseFieldNumber, SoftirqLayout),
+    PERFETTO_KNOWN_LAYOUT(kCpuFrequencyFieldNumber, CpuStateLayout),
+    PERFETTO_KNOWN_LAYOUT(kCpuIdleFieldNumber, CpuStateLayout),
+    PERFETTO_KNOWN_LAYOUT(kWorkqueueExecuteStartFieldNumber,
+                          WorkqueueExecuteLayout),
+    PERFETTO_KNOWN_LAYOUT(kWorkqueueExecuteEndFieldNumber,
+                          WorkqueueExecuteLayout),
+    PERFETTO_KNOWN_LAYOUT(kWorkqueueExecuteEndFieldNumber,
+                          WorkqueueExecuteEndLayout),
+    PERFETTO_KNOWN_LAYOUT(kBlockRqIssueFieldNumber, BlockRqIssueLayout),
+    PERFETTO_KNOWN_LAYOUT(kBlockRqCompleteFieldNumber, BlockRqCompleteLayout),
+    PERFETTO_KNOWN_LAYOUT(kBlockRqCompleteFieldNumber, BlockRqCompleteLayout5),
+};
+
+#undef PERFETTO_KNOWN_LAYOUT
+
+}  // namespace
+
+EventDecoder FindEventDecoder(const Event& event) {
+  for (const KnownLayout& layout : kKnownLayouts) {
+    if (layout.proto_field_id == event.proto_field_id && layout.matches(event))
+      return layout.decoder;
+  }
+  return nullptr;
+}
+
+}  // namespace perfetto
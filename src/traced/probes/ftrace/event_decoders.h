@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FTRACE_EVENT_DECODERS_H_
+#define SRC_TRACED_PROBES_FTRACE_EVENT_DECODERS_H_
+
+#include <stdint.h>
+
+#include "src/traced/probes/ftrace/event_info_constants.h"
+
+namespace protozero {
+class Message;
+}  // namespace protozero
+
+namespace perfetto {
+
+struct FtraceMetadata;
+
+// Decodes the fields of a raw ftrace event (all but the common fields) into
+// |message|, the nested proto of the event (e.g. SchedSwitchFtraceEvent).
+// |start| points to the beginning of the event and |end| to the end of the
+// record. Returns false if any of the fields could not be read.
+using EventDecoder = bool (*)(const uint8_t* start,
+                              const uint8_t* end,
+                              protozero::Message* message,
+                              FtraceMetadata* metadata);
+
+// The hottest events (scheduling, irqs, cpu frequency/idle, workqueues and
+// block requests) have a handful of well known layouts across kernels. For
+// each of them we have a decoder instantiated at compile time, where the
+// offset, size, translation strategy and proto field id of every field are
+// constants, which avoids the per-field dispatch of CpuReader::ParseField.
+//
+// Returns the decoder for the layout |event| has on this kernel, which must
+// match the runtime format field by field, or nullptr if there is none. In
+// the latter case the event has to be parsed generically.
+EventDecoder FindEventDecoder(const Event& event);
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FTRACE_EVENT_DECODERS_H_
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ftrace/event_decoders.h"
+
+#include <string.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "src/traced/probes/ftrace/cpu_reader.h"
+#include "src/traced/probes/ftrace/ftrace_metadata.h"
+#include "src/traced/probes/ftrace/proto_translation_table.h"
+#include "src/traced/probes/ftrace/test/cpu_reader_support.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+const char* const kHotEvents[] = {
+    "sched_switch",
+    "sched_waking",
+    "sched_wakeup",
+    "irq_handler_entry",
+    "irq_handler_exit",
+    "softirq_entry",
+    "softirq_exit",
+    "softirq_raise",
+    "cpu_frequency",
+    "cpu_idle",
+    "workqueue_execute_start",
+    "workqueue_execute_end",
+    "block_rq_issue",
+    "block_rq_complete",
+};
+
+EventDecoder GetDecoder(const ProtoTranslationTable* table, const char* name) {
+  const Event* event = table->GetEventByName(name);
+  if (!event)
+    return nullptr;
+  return table->GetEventDecoderById(event->ftrace_event_id);
+}
+
+std::vector<int32_t> Pids(const FtraceMetadata& metadata) {
+  return std::vector<int32_t>(metadata.pids.begin(), metadata.pids.end());
+}
+
+TEST(EventDecodersTest, HotEventsHaveDecoders) {
+  // The events of the other test kernels have layouts which are only partly
+  // covered (e.g. 3.4 has a larger common header).
+  for (const char* device : {"android_flounder_lte_LRX16F_3.10.40",
+                             "android_walleye_OPM5.171019.017.A1_4.4.88",
+                             "android_raven_AOSP.MASTER_5.10.43"}) {
+    const ProtoTranslationTable* table = GetTable(device);
+    for (const char* name : kHotEvents) {
+      if (!table->GetEventByName(name))
+        continue;
+      EXPECT_NE(GetDecoder(table, name), nullptr) << device << " " << name;
+    }
+  }
+}
+
+const char* const kDevices[] = {
+    "android_seed_N2F62_3.10.49",
+    "android_hammerhead_MRA59G_3.4.0",
+    "android_flounder_lte_LRX16F_3.10.40",
+    "android_walleye_OPM5.171019.017.A1_4.4.88",
+    "android_raven_AOSP.MASTER_5.10.43",
+    "synthetic",
+};
+
+// Parameterized by the name of the event.
+class EventDecodersParsingTest : public ::testing::TestWithParam<const char*> {
+};
+
+// Fills the event with random data and checks that CpuReader::ParseEvent,
+// which uses the specialized decoder, produces exactly the same proto and
+// metadata as parsing each field with CpuReader::ParseField.
+TEST_P(EventDecodersParsingTest, SameAsGenericParsing) {
+  const char* name = GetParam();
+  std::minstd_rand0 rnd_engine(42);
+  size_t devices_decoded = 0;
+  for (const char* device : kDevices) {
+    const ProtoTranslationTable* table = GetTable(device);
+    const Event* event = table->GetEventByName(name);
+    EventDecoder decoder = GetDecoder(table, name);
+    if (!decoder)
+      continue;
+    devices_decoded++;
+
+    for (int i = 0; i < 100; i++) {
+      // Strings (__data_loc) are appended after the fixed part of the event.
+      std::vector<uint8_t> data(event->size + 64u);
+      for (uint8_t& byte : data)
+        byte = rnd_engine() % 4 == 0 ? 0 : static_cast<uint8_t>(rnd_engine());
+      uint32_t data_end = event->size;
+      for (const Field& field : event->fields) {
+        if (field.strategy != kDataLocToString)
+          continue;
+        uint32_t len = rnd_engine() % 16;
+        uint32_t data_loc = (len << 16) | data_end;
+        memcpy(&data[field.ftrace_offset], &data_loc, sizeof(data_loc));
+        data_end += len;
+      }
+      const uint8_t* start = data.data();
+      const uint8_t* end = start + data_end;
+
+      protozero::HeapBuffered<protozero::Message> specialized;
+      FtraceMetadata specialized_metadata;
+      ASSERT_TRUE(CpuReader::ParseEvent(event->ftrace_event_id, start, end,
+                                        table, specialized.get(),
+                                        &specialized_metadata));
+
+      protozero::HeapBuffered<protozero::Message> generic;
+      FtraceMetadata generic_metadata;
+      for (const Field& field : table->common_fields()) {
+        ASSERT_TRUE(CpuReader::ParseField(field, start, end, table,
+                                          generic.get(), &generic_metadata));
+      }
+      protozero::Message* nested =
+          generic->BeginNestedMessage<protozero::Message>(
+              event->proto_field_id);
+      for (const Field& field : event->fields) {
+        ASSERT_TRUE(CpuReader::ParseField(field, start, end, table, nested,
+                                          &generic_metadata));
+      }
+
+      // The device is forgotten at the end of the event by ParseEvent, so it
+      // is checked on the decoder alone.
+      protozero::HeapBuffered<protozero::Message> decoded;
+      FtraceMetadata decoded_metadata;
+      ASSERT_TRUE(decoder(start, end, decoded.get(), &decoded_metadata));
+      EXPECT_EQ(decoded_metadata.last_seen_device_id,
+                generic_metadata.last_seen_device_id)
+          << device;
+      generic_metadata.FinishEvent();
+
+      EXPECT_EQ(specialized.SerializeAsArray(), generic.SerializeAsArray())
+          << device;
+      EXPECT_EQ(Pids(specialized_metadata), Pids(generic_metadata)) << device;
+      EXPECT_EQ(specialized_metadata.kernel_addrs.size(),
+                generic_metadata.kernel_addrs.size())
+          << device;
+    }
+  }
+  // Every event with a decoder must be checked on at least one kernel.
+  EXPECT_GT(devices_decoded, 0u);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    ByEvent,
+    EventDecodersParsingTest,
+    ::testing::ValuesIn(kHotEvents),
+    [](const ::testing::TestParamInfo<const char*>& info) {
+      return std::string(info.param);
+    });
+
+TEST(EventDecodersTest, FallBackOnUnknownLayout) {
+  const ProtoTranslationTable* table =
+      GetTable("android_raven_AOSP.MASTER_5.10.43");
+  Event sched_switch = *table->GetEventByName("sched_switch");
+  ASSERT_NE(FindEventDecoder(sched_switch), nullptr);
+
+  Event moved_field = sched_switch;
+  moved_field.fields[1].ftrace_offset = 20;
+  EXPECT_EQ(FindEventDecoder(moved_field), nullptr);
+
+  Event missing_field = sched_switch;
+  missing_field.fields.pop_back();
+  EXPECT_EQ(FindEventDecoder(missing_field), nullptr);
+
+  Event other_strategy = sched_switch;
+  other_strategy.fields[3].strategy = kInt32ToInt64;
+  EXPECT_EQ(FindEventDecoder(other_strategy), nullptr);
+
+  // 32-bit kernels can't symbolize kernel addresses, these are parsed
+  // generically.
+  const ProtoTranslationTable* seed_table =
+      GetTable("android_seed_N2F62_3.10.49");
+  EXPECT_EQ(GetDecoder(seed_table, "workqueue_execute_start"), nullptr);
+}
+
+}  // namespace
+}  // namespace perfetto
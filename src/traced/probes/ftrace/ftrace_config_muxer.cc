@@ -709,7 +709,8 @@ FtraceConfigId FtraceConfigMuxer::SetupConfig(const FtraceConfig& request,
   ds_configs_.emplace(
       std::piecewise_construct, std::forward_as_tuple(id),
       std::forward_as_tuple(std::move(filter), std::move(syscall_filter),
-                            compact_sched, std::move(ftrace_print_filter),
+                            compact_sched, request.compact_events().enabled(),
+                            std::move(ftrace_print_filter),
                             std::move(apps), std::move(categories),
                             request.symbolize_ksyms(),
                             request.preserve_ftrace_buffer()));
@@ -44,6 +44,7 @@ struct FtraceDataSourceConfig {
   FtraceDataSourceConfig(EventFilter _event_filter,
                          EventFilter _syscall_filter,
                          CompactSchedConfig _compact_sched,
+                         bool _compact_events,
                          base::Optional<FtracePrintFilterConfig> _print_filter,
                          std::vector<std::string> _atrace_apps,
                          std::vector<std::string> _atrace_categories,
@@ -52,6 +53,7 @@ struct FtraceDataSourceConfig {
       : event_filter(std::move(_event_filter)),
         syscall_filter(std::move(_syscall_filter)),
         compact_sched(_compact_sched),
+        compact_events(_compact_events),
         print_filter(std::move(_print_filter)),
         atrace_apps(std::move(_atrace_apps)),
         atrace_categories(std::move(_atrace_categories)),
@@ -69,6 +71,10 @@ struct FtraceDataSourceConfig {
   // Configuration of the optional compact encoding of scheduling events.
   const CompactSchedConfig compact_sched;
 
+  // If true, the events which have a fixed layout are written in the generic
+  // compact format (FtraceEventBundle.CompactEvents).
+  const bool compact_events;
+
   // Optional configuration that's used to filter "ftrace/print" events based on
   // the content of their "buf" field.
   base::Optional<FtracePrintFilterConfig> print_filter;
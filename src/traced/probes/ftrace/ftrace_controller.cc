@@ -18,12 +18,15 @@
 
 #include <fcntl.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/utsname.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
 #include <string>
 #include <utility>
@@ -206,6 +209,19 @@ uint64_t FtraceController::NowMs() const {
   return static_cast<uint64_t>(base::GetWallTimeMs().count());
 }
 
+bool FtraceController::SupportsBufferWatermarkPoll() const {
+  // poll() of trace_pipe_raw waits for the buffer to be "buffer_percent" full
+  // since Linux 6.1. Before that, it returns as soon as there's any data.
+  struct utsname uname_info;
+  if (uname(&uname_info) != 0)
+    return false;
+  int major = 0;
+  int minor = 0;
+  if (sscanf(uname_info.release, "%d.%d", &major, &minor) != 2)
+    return false;
+  return major > 6 || (major == 6 && minor >= 1);
+}
+
 void FtraceController::StartIfNeeded() {
   using FtraceClock = protos::pbzero::FtraceClock;
   if (started_data_sources_.size() > 1)
@@ -247,6 +263,28 @@ void FtraceController::StartIfNeeded() {
           weak_this->ReadTick(generation);
       },
       drain_period_ms - (NowMs() % drain_period_ms));
+
+  start_ms_ = NowMs();
+  drain_wakeups_ = 0;
+
+  // On top of the periodic reads, read each cpu as soon as its buffer is past
+  // the watermark, if requested and supported. "buffer_percent" exists since
+  // Linux 5.1 but poll() only honors it since 6.1: as the watch is
+  // level-triggered, it would otherwise fire as soon as there's any data.
+  // The current value is restored when stopping, so it is only changed if it
+  // can be read.
+  drain_buffer_percent_ = 0;
+  uint32_t buffer_percent = GetDrainBufferPercent();
+  base::Optional<uint32_t> original_buffer_percent;
+  if (buffer_percent && SupportsBufferWatermarkPoll())
+    original_buffer_percent = ftrace_procfs_->GetBufferPercent();
+  if (original_buffer_percent &&
+      ftrace_procfs_->SetBufferPercent(buffer_percent)) {
+    drain_buffer_percent_ = buffer_percent;
+    original_buffer_percent_ = *original_buffer_percent;
+    for (size_t cpu = 0; cpu < per_cpu_.size(); cpu++)
+      UpdateBufferWatermarkWatch(cpu, true);
+  }
 }
 
 // We handle the ftrace buffers in a repeating task (ReadTick). On a given tick,
@@ -272,12 +310,18 @@ void FtraceController::StartIfNeeded() {
 // drain period. Therefore we introduce |per_cpu_.period_page_quota|. If the
 // consumer wants to handle a high bandwidth of ftrace events, they should set
 // the config values appropriately.
+//
+// With FtraceConfig.drain_buffer_percent, each cpu is also read as soon as its
+// buffer is past the watermark (see OnBufferPastWatermark), so that the cpus
+// are read as often as their event rate requires, and ReadTick is only a
+// fallback. The same per-period quota applies to these reads.
 void FtraceController::ReadTick(int generation) {
   metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
                              metatrace::FTRACE_READ_TICK);
   if (started_data_sources_.empty() || generation != generation_) {
     return;
   }
+  drain_wakeups_++;
 
 #if PERFETTO_DCHECK_IS_ON()
   // The OnFtraceDataWrittenIntoDataSourceBuffers() below is supposed to clear
@@ -331,8 +375,10 @@ void FtraceController::ReadTick(int generation) {
   } else {
     // Done until next drain period.
     size_t period_page_quota = ftrace_config_muxer_->GetPerCpuBufferSizePages();
-    for (auto& per_cpu : per_cpu_)
-      per_cpu.period_page_quota = period_page_quota;
+    for (size_t i = 0; i < per_cpu_.size(); i++) {
+      per_cpu_[i].period_page_quota = period_page_quota;
+      UpdateBufferWatermarkWatch(i, true);
+    }
 
     // Snapshot the clock so the data in the next period will be clock synced as
     // well.
@@ -348,6 +394,69 @@ void FtraceController::ReadTick(int generation) {
   }
 }
 
+void FtraceController::OnBufferPastWatermark(int generation, size_t cpu) {
+  metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
+                             metatrace::FTRACE_WATERMARK_READ);
+  if (started_data_sources_.empty() || generation != generation_)
+    return;
+  PerCpuState& per_cpu = per_cpu_[cpu];
+  if (per_cpu.period_page_quota > 0) {
+    drain_wakeups_++;
+
+    // The watch is level-triggered: if the buffer is still past the watermark
+    // after this, we're called again once the other pending tasks have run.
+    size_t max_pages =
+        std::min(per_cpu.period_page_quota, kMaxPagesPerCpuPerReadTick);
+    uint8_t* parsing_buf = reinterpret_cast<uint8_t*>(parsing_mem_.Get());
+    per_cpu.reader->set_ftrace_clock(ftrace_config_muxer_->ftrace_clock());
+    size_t pages_read = per_cpu.reader->ReadCycle(
+        parsing_buf, kParsingBufferSizePages, max_pages, started_data_sources_);
+    per_cpu.period_page_quota -=
+        std::min(pages_read, per_cpu.period_page_quota);
+    observer_->OnFtraceDataWrittenIntoDataSourceBuffers();
+  }
+
+  // Out of quota: stop watching until ReadTick refills it at the end of the
+  // drain period, rather than chasing a cpu that writes faster than we read.
+  if (per_cpu.period_page_quota == 0)
+    UpdateBufferWatermarkWatch(cpu, false);
+}
+
+void FtraceController::UpdateBufferWatermarkWatch(size_t cpu, bool enable) {
+  PerCpuState& per_cpu = per_cpu_[cpu];
+  int fd = per_cpu.reader->trace_fd();
+  if (!drain_buffer_percent_ || fd < 0 || per_cpu.watermark_watch == enable)
+    return;
+  per_cpu.watermark_watch = enable;
+  if (!enable) {
+    task_runner_->RemoveFileDescriptorWatch(fd);
+    return;
+  }
+  auto weak_this = weak_factory_.GetWeakPtr();
+  int generation = generation_;
+  task_runner_->AddFileDescriptorWatch(fd, [weak_this, generation, cpu] {
+    if (weak_this)
+      weak_this->OnBufferPastWatermark(generation, cpu);
+  });
+}
+
+uint32_t FtraceController::GetDrainBufferPercent() {
+  uint32_t min_buffer_percent = 0;
+  for (const FtraceDataSource* data_source : data_sources_) {
+    uint32_t buffer_percent = data_source->config().drain_buffer_percent();
+    if (buffer_percent > 100) {
+      PERFETTO_LOG("drain_buffer_percent was %u should be at most 100",
+                   buffer_percent);
+      continue;
+    }
+    if (buffer_percent &&
+        (!min_buffer_percent || buffer_percent < min_buffer_percent)) {
+      min_buffer_percent = buffer_percent;
+    }
+  }
+  return min_buffer_percent;
+}
+
 uint32_t FtraceController::GetDrainPeriodMs() {
   if (data_sources_.empty())
     return kDefaultDrainPeriodMs;
@@ -392,6 +501,13 @@ void FtraceController::StopIfNeeded() {
   if (!started_data_sources_.empty())
     return;
 
+  for (size_t cpu = 0; cpu < per_cpu_.size(); cpu++)
+    UpdateBufferWatermarkWatch(cpu, false);
+  if (drain_buffer_percent_) {
+    ftrace_procfs_->SetBufferPercent(original_buffer_percent_);
+    drain_buffer_percent_ = 0;
+  }
+
   // We are not implicitly flushing on Stop. The tracing service is supposed to
   // ask for an explicit flush before stopping, unless it needs to perform a
   // non-graceful stop.
@@ -472,6 +588,18 @@ void FtraceController::RemoveDataSource(FtraceDataSource* data_source) {
 
 void FtraceController::DumpFtraceStats(FtraceStats* stats) {
   DumpAllCpuStats(ftrace_procfs_.get(), stats);
+  stats->drain_buffer_percent = drain_buffer_percent_;
+  stats->drain_wakeups = drain_wakeups_;
+  uint64_t now_ms = NowMs();
+  if (!per_cpu_.empty() && now_ms > start_ms_) {
+    double elapsed_s = static_cast<double>(now_ms - start_ms_) / 1000;
+    uint64_t overruns = 0;
+    for (const FtraceCpuStats& cpu_stats : stats->cpu_stats)
+      overruns += cpu_stats.overrun;
+    stats->drain_wakeups_per_second =
+        static_cast<double>(drain_wakeups_) / elapsed_s;
+    stats->overruns_per_second = static_cast<double>(overruns) / elapsed_s;
+  }
   if (symbolizer_ && symbolizer_->is_valid()) {
     auto* symbol_map = symbolizer_->GetOrCreateKernelSymbolMap();
     stats->kernel_symbols_parsed =
@@ -105,6 +105,7 @@ class FtraceController {
 
   // Protected and virtual for testing.
   virtual uint64_t NowMs() const;
+  virtual bool SupportsBufferWatermarkPoll() const;
 
  private:
   friend class TestFtraceController;
@@ -114,6 +115,8 @@ class FtraceController {
         : reader(std::move(_reader)), period_page_quota(_period_page_quota) {}
     std::unique_ptr<CpuReader> reader;
     size_t period_page_quota = 0;
+    // Whether the trace_pipe_raw fd is being watched for the buffer watermark.
+    bool watermark_watch = false;
   };
 
   FtraceController(const FtraceController&) = delete;
@@ -122,7 +125,13 @@ class FtraceController {
   // Periodic task that reads all per-cpu ftrace buffers.
   void ReadTick(int generation);
 
+  // Reads the buffer of |cpu| when it's past the watermark (see
+  // FtraceConfig.drain_buffer_percent).
+  void OnBufferPastWatermark(int generation, size_t cpu);
+  void UpdateBufferWatermarkWatch(size_t cpu, bool enable);
+
   uint32_t GetDrainPeriodMs();
+  uint32_t GetDrainBufferPercent();
 
   void StartIfNeeded();
   void StopIfNeeded();
@@ -139,6 +148,10 @@ class FtraceController {
   std::unique_ptr<FtraceConfigMuxer> ftrace_config_muxer_;
   std::unique_ptr<FtraceClockSnapshot> ftrace_clock_snapshot_;
   int generation_ = 0;
+  uint32_t drain_buffer_percent_ = 0;  // 0 if not draining on the watermark.
+  uint32_t original_buffer_percent_ = 0;  // Restored when stopping.
+  uint64_t drain_wakeups_ = 0;
+  uint64_t start_ms_ = 0;
   bool atrace_running_ = false;
   bool retain_ksyms_on_stop_ = false;
   bool preserve_ftrace_buffer_ = false;
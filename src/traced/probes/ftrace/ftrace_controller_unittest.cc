@@ -183,6 +183,9 @@ class TestFtraceController : public FtraceController,
   MockTaskRunner* runner() { return runner_.get(); }
   MockFtraceProcfs* procfs() { return procfs_; }
   uint64_t NowMs() const override { return now_ms; }
+  bool SupportsBufferWatermarkPoll() const override {
+    return supports_buffer_watermark_poll;
+  }
   uint32_t drain_period_ms() { return GetDrainPeriodMs(); }
 
   std::unique_ptr<FtraceDataSource> AddFakeDataSource(const FtraceConfig& cfg) {
@@ -196,6 +199,7 @@ class TestFtraceController : public FtraceController,
   void OnFtraceDataWrittenIntoDataSourceBuffers() override {}
 
   uint64_t now_ms = 0;
+  bool supports_buffer_watermark_poll = true;
 
  private:
   TestFtraceController(const TestFtraceController&) = delete;
@@ -473,6 +477,129 @@ TEST(FtraceControllerTest, PeriodicDrainConfig) {
   }
 }
 
+TEST(FtraceControllerTest, BufferWatermarkDrain) {
+  auto controller = CreateTestController(true /* nice procfs */, 2 /* cpus */);
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_drain_buffer_percent(30);
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(data_source);
+
+  // Starting saves and sets the watermark and watches the buffers of all the
+  // cpus.
+  std::vector<std::function<void()>> watches;
+  EXPECT_CALL(*controller->procfs(), WriteToFile(_, _)).Times(AnyNumber());
+  EXPECT_CALL(*controller->procfs(), ReadFileIntoString("/root/buffer_percent"))
+      .WillOnce(Return("25\n"));
+  EXPECT_CALL(*controller->procfs(), WriteToFile("/root/buffer_percent", "30"))
+      .WillOnce(Return(true));
+  EXPECT_CALL(*controller->runner(), AddFileDescriptorWatch(_, _))
+      .Times(2)
+      .WillRepeatedly(Invoke([&watches](int, std::function<void()> watch) {
+        watches.push_back(std::move(watch));
+      }));
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+  Mock::VerifyAndClearExpectations(controller->procfs());
+  Mock::VerifyAndClearExpectations(controller->runner());
+  ASSERT_EQ(watches.size(), 2u);
+
+  // Each watermark wakeup reads the cpu and is accounted in the stats.
+  watches[1]();
+  controller->now_ms = 2000;
+  FtraceStats stats{};
+  controller->DumpFtraceStats(&stats);
+  EXPECT_EQ(stats.drain_buffer_percent, 30u);
+  EXPECT_EQ(stats.drain_wakeups, 1u);
+  EXPECT_DOUBLE_EQ(stats.drain_wakeups_per_second, 0.5);
+
+  // Stopping removes the watches and restores the original watermark.
+  EXPECT_CALL(*controller->runner(), RemoveFileDescriptorWatch(_)).Times(2);
+  EXPECT_CALL(*controller->procfs(), WriteToFile(_, _)).Times(AnyNumber());
+  EXPECT_CALL(*controller->procfs(), WriteToFile("/root/buffer_percent", "25"))
+      .WillOnce(Return(true));
+  data_source.reset();
+}
+
+TEST(FtraceControllerTest, BufferWatermarkDrainUnreadable) {
+  auto controller = CreateTestController(true /* nice procfs */);
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_drain_buffer_percent(30);
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(data_source);
+
+  // The watermark isn't changed if it can't be restored afterwards.
+  EXPECT_CALL(*controller->procfs(), WriteToFile(_, _)).Times(AnyNumber());
+  EXPECT_CALL(*controller->procfs(), ReadFileIntoString("/root/buffer_percent"))
+      .WillOnce(Return(""));
+  EXPECT_CALL(*controller->procfs(), WriteToFile("/root/buffer_percent", _))
+      .Times(0);
+  EXPECT_CALL(*controller->runner(), AddFileDescriptorWatch(_, _)).Times(0);
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+
+  FtraceStats stats{};
+  controller->DumpFtraceStats(&stats);
+  EXPECT_EQ(stats.drain_buffer_percent, 0u);
+  data_source.reset();
+}
+
+TEST(FtraceControllerTest, BufferWatermarkDrainUnsupported) {
+  auto controller = CreateTestController(true /* nice procfs */);
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_drain_buffer_percent(30);
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(data_source);
+
+  // Kernels that can't set the watermark only use the periodic reads.
+  EXPECT_CALL(*controller->procfs(), WriteToFile(_, _)).Times(AnyNumber());
+  EXPECT_CALL(*controller->procfs(), ReadFileIntoString("/root/buffer_percent"))
+      .WillOnce(Return("0\n"));
+  EXPECT_CALL(*controller->procfs(), WriteToFile("/root/buffer_percent", "30"))
+      .WillOnce(Return(false));
+  EXPECT_CALL(*controller->runner(), AddFileDescriptorWatch(_, _)).Times(0);
+  EXPECT_CALL(*controller->runner(), PostDelayedTask(_, _)).Times(1);
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+  Mock::VerifyAndClearExpectations(controller->procfs());
+
+  FtraceStats stats{};
+  controller->DumpFtraceStats(&stats);
+  EXPECT_EQ(stats.drain_buffer_percent, 0u);
+
+  // Nothing is restored when stopping.
+  EXPECT_CALL(*controller->procfs(), WriteToFile(_, _)).Times(AnyNumber());
+  EXPECT_CALL(*controller->procfs(), WriteToFile("/root/buffer_percent", _))
+      .Times(0);
+  EXPECT_CALL(*controller->runner(), RemoveFileDescriptorWatch(_)).Times(0);
+  data_source.reset();
+}
+
+TEST(FtraceControllerTest, BufferWatermarkDrainOldKernel) {
+  auto controller = CreateTestController(true /* nice procfs */);
+  controller->supports_buffer_watermark_poll = false;
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_drain_buffer_percent(30);
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(data_source);
+
+  // Kernels whose poll() ignores the watermark only use the periodic reads,
+  // even if they have "buffer_percent".
+  EXPECT_CALL(*controller->procfs(), WriteToFile(_, _)).Times(AnyNumber());
+  EXPECT_CALL(*controller->procfs(), ReadFileIntoString("/root/buffer_percent"))
+      .Times(0);
+  EXPECT_CALL(*controller->procfs(), WriteToFile("/root/buffer_percent", _))
+      .Times(0);
+  EXPECT_CALL(*controller->runner(), AddFileDescriptorWatch(_, _)).Times(0);
+  EXPECT_CALL(*controller->runner(), PostDelayedTask(_, _)).Times(1);
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+
+  FtraceStats stats{};
+  controller->DumpFtraceStats(&stats);
+  EXPECT_EQ(stats.drain_buffer_percent, 0u);
+  data_source.reset();
+}
+
 TEST(FtraceMetadataTest, Clear) {
   FtraceMetadata metadata;
   metadata.inode_and_device.insert(std::make_pair(1, 1));
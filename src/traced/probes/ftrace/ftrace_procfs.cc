@@ -400,6 +400,19 @@ bool FtraceProcfs::SetCpuBufferSizeInPages(size_t pages) {
   return WriteNumberToFile(path, pages * (base::kPageSize / 1024ul));
 }
 
+bool FtraceProcfs::SetBufferPercent(uint32_t percent) {
+  std::string path = root_ + "buffer_percent";
+  return WriteNumberToFile(path, percent);
+}
+
+base::Optional<uint32_t> FtraceProcfs::GetBufferPercent() const {
+  std::string path = root_ + "buffer_percent";
+  std::string str = ReadFileIntoString(path);
+  if (str.size() && str[str.size() - 1] == '\n')
+    str.resize(str.size() - 1);
+  return base::StringToUInt32(str);
+}
+
 bool FtraceProcfs::EnableTracing() {
   KernelLogWrite("perfetto: enabled ftrace\n");
   PERFETTO_LOG("enabled ftrace in %s", root_.c_str());
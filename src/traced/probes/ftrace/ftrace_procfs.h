@@ -22,6 +22,7 @@
 #include <string>
 #include <vector>
 
+#include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/scoped_file.h"
 
 namespace perfetto {
@@ -117,6 +118,14 @@ class FtraceProcfs {
   // by the number of CPUs.
   bool SetCpuBufferSizeInPages(size_t pages);
 
+  // Sets how full (in percent) a per-cpu buffer has to be for poll() on its
+  // trace_pipe_raw to report it as readable.
+  bool SetBufferPercent(uint32_t percent);
+
+  // Returns the current "buffer_percent", or nullopt if it can't be read (e.g.
+  // on kernels before 5.1 which don't have it).
+  base::Optional<uint32_t> GetBufferPercent() const;
+
   // Returns the number of CPUs.
   // This will match the number of tracing/per_cpu/cpuXX directories.
   size_t virtual NumberOfCpus() const;
@@ -26,6 +26,11 @@ void FtraceStats::Write(protos::pbzero::FtraceStats* writer) const {
   }
   writer->set_kernel_symbols_parsed(kernel_symbols_parsed);
   writer->set_kernel_symbols_mem_kb(kernel_symbols_mem_kb);
+  if (drain_buffer_percent)
+    writer->set_drain_buffer_percent(drain_buffer_percent);
+  writer->set_drain_wakeups(drain_wakeups);
+  writer->set_drain_wakeups_per_second(drain_wakeups_per_second);
+  writer->set_overruns_per_second(overruns_per_second);
   if (!setup_errors.atrace_errors.empty())
     writer->set_atrace_errors(setup_errors.atrace_errors);
   for (const std::string& err : setup_errors.unknown_ftrace_events)
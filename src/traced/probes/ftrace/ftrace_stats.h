@@ -55,6 +55,10 @@ struct FtraceStats {
   FtraceSetupErrors setup_errors;
   uint32_t kernel_symbols_parsed = 0;
   uint32_t kernel_symbols_mem_kb = 0;
+  uint32_t drain_buffer_percent = 0;
+  uint64_t drain_wakeups = 0;
+  double drain_wakeups_per_second = 0;
+  double overruns_per_second = 0;
 
   void Write(protos::pbzero::FtraceStats*) const;
 };
@@ -23,6 +23,7 @@
 
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/protozero/proto_utils.h"
+#include "src/traced/probes/ftrace/compact_events.h"
 #include "src/traced/probes/ftrace/event_info.h"
 #include "src/traced/probes/ftrace/ftrace_procfs.h"
 
@@ -503,12 +504,17 @@ ProtoTranslationTable::ProtoTranslationTable(
     PrintkMap printk_formats)
     : ftrace_procfs_(ftrace_procfs),
       events_(BuildEventsDeque(events)),
+      event_decoders_(events_.size()),
+      compact_events_eligible_(events_.size()),
       largest_id_(events_.size() - 1),
       common_fields_(std::move(common_fields)),
       ftrace_page_header_spec_(ftrace_page_header_spec),
       compact_sched_format_(compact_sched_format),
       printk_formats_(printk_formats) {
   for (const Event& event : events) {
+    event_decoders_[event.ftrace_event_id] = FindEventDecoder(event);
+    compact_events_eligible_[event.ftrace_event_id] =
+        IsCompactEventsEligible(event, common_fields_);
     group_and_name_to_event_[GroupAndName(event.group, event.name)] =
         &events_.at(event.ftrace_event_id);
     name_to_events_[event.name].push_back(&events_.at(event.ftrace_event_id));
@@ -29,6 +29,7 @@
 
 #include "perfetto/ext/base/scoped_file.h"
 #include "src/traced/probes/ftrace/compact_sched.h"
+#include "src/traced/probes/ftrace/event_decoders.h"
 #include "src/traced/probes/ftrace/event_info.h"
 #include "src/traced/probes/ftrace/format_parser/format_parser.h"
 #include "src/traced/probes/ftrace/printk_formats_parser.h"
@@ -130,6 +131,19 @@ class ProtoTranslationTable {
     return evt;
   }
 
+  // Returns the decoder specialized for the layout of the event with the given
+  // id on this kernel (see FindEventDecoder()), or nullptr if the event has to
+  // be parsed field by field.
+  EventDecoder GetEventDecoderById(size_t id) const {
+    return id < event_decoders_.size() ? event_decoders_[id] : nullptr;
+  }
+
+  // Returns true if the event with the given id can be written in the generic
+  // compact format (see IsCompactEventsEligible()).
+  bool IsCompactEventsEligibleById(size_t id) const {
+    return id < compact_events_eligible_.size() && compact_events_eligible_[id];
+  }
+
   size_t EventToFtraceId(const GroupAndName& group_and_name) const {
     if (!group_and_name_to_event_.count(group_and_name))
       return 0;
@@ -182,6 +196,8 @@ class ProtoTranslationTable {
 
   const FtraceProcfs* ftrace_procfs_;
   std::deque<Event> events_;
+  std::vector<EventDecoder> event_decoders_;
+  std::vector<bool> compact_events_eligible_;
   size_t largest_id_;
   std::map<GroupAndName, const Event*> group_and_name_to_event_;
   std::map<std::string, std::vector<const Event*>> name_to_events_;
@@ -16,7 +16,10 @@
 
 #include "src/traced/probes/ps/process_stats_data_source.h"
 
+#include <fcntl.h>
 #include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <utility>
@@ -29,6 +32,7 @@
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/utils.h"
 #include "perfetto/tracing/core/data_source_config.h"
 
 #include "protos/perfetto/config/process_stats/process_stats_config.pbzero.h"
@@ -69,6 +73,55 @@ inline uint32_t ToU32(const char* str) {
   return static_cast<uint32_t>(strtol(str, nullptr, 10));
 }
 
+const char* const kPolledProcFileNames[] = {"status", "oom_score_adj"};
+
+// Larger than /proc/pid/status, even with long cpu and memory node masks.
+constexpr size_t kPolledReadBufSize = 8192;
+
+// Reads the content of the procfs file |fd| from the start, with a single
+// pread(). procfs regenerates the whole content on a read at offset 0.
+bool ReadProcFileFromStart(int fd, std::string* buf) {
+  buf->resize(kPolledReadBufSize);
+  ssize_t rsize = PERFETTO_EINTR(pread(fd, &(*buf)[0], buf->size(), 0));
+  if (rsize <= 0) {
+    buf->clear();
+    return false;
+  }
+  buf->resize(static_cast<size_t>(rsize));
+  return true;
+}
+
+// The files of at most this many processes are kept open, i.e. up to
+// kMaxPolledPids * kNumPolledProcFiles fds, if the fd limit allows it (see
+// GetMaxPolledPids()). The files of the other processes are opened on each
+// poll.
+constexpr size_t kMaxPolledPids = 16384;
+
+// Returns how many processes can have their polled files kept open: up to a
+// quarter of the fd limit, leaving the rest to the other data sources. The
+// soft limit is raised first (up to the hard limit) if it's too low for
+// kMaxPolledPids, as it often is (e.g. 1024).
+size_t GetMaxPolledPids() {
+  constexpr rlim_t kFdsPerPid = ProcessStatsDataSource::kNumPolledProcFiles;
+  constexpr rlim_t kWantedFds = 4 * kMaxPolledPids * kFdsPerPid;
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+    return 0;
+  if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < kWantedFds &&
+      limit.rlim_cur < limit.rlim_max) {
+    struct rlimit raised = limit;
+    raised.rlim_cur = limit.rlim_max == RLIM_INFINITY
+                          ? kWantedFds
+                          : std::min(limit.rlim_max, kWantedFds);
+    if (setrlimit(RLIMIT_NOFILE, &raised) == 0)
+      limit = raised;
+  }
+  rlim_t fds = limit.rlim_cur == RLIM_INFINITY
+                   ? kWantedFds
+                   : std::min(limit.rlim_cur, kWantedFds);
+  return static_cast<size_t>(fds / 4 / kFdsPerPid);
+}
+
 }  // namespace
 
 // static
@@ -113,6 +166,7 @@ ProcessStatsDataSource::ProcessStatsDataSource(
     process_stats_cache_ttl_ticks_ =
         std::max(proc_stats_ttl_ms / poll_period_ms_, 1u);
   }
+  max_polled_pids_ = GetMaxPolledPids();
 }
 
 ProcessStatsDataSource::~ProcessStatsDataSource() = default;
@@ -336,6 +390,38 @@ std::string ProcessStatsDataSource::ReadProcPidFile(int32_t pid,
   return contents;
 }
 
+bool ProcessStatsDataSource::ReadPolledProcPidFile(int32_t pid,
+                                                   PolledProcFile file,
+                                                   std::string* buf) {
+  auto it = polled_files_.find(pid);
+  if (it == polled_files_.end()) {
+    if (polled_files_.size() >= max_polled_pids_) {
+      // Too many processes to keep all their files open: read this one once.
+      base::ScopedFile fd = OpenPolledProcPidFile(pid, file);
+      return fd && ReadProcFileFromStart(*fd, buf);
+    }
+    it = polled_files_.emplace(pid, PolledProcFiles()).first;
+  }
+
+  base::ScopedFile& fd = it->second[file];
+  if (fd) {
+    if (ReadProcFileFromStart(*fd, buf))
+      return true;
+    // The process which had this pid at the previous poll has exited (the
+    // read fails with ESRCH), but the pid might have been reused since.
+  }
+  fd = OpenPolledProcPidFile(pid, file);
+  return fd && ReadProcFileFromStart(*fd, buf);
+}
+
+base::ScopedFile ProcessStatsDataSource::OpenPolledProcPidFile(
+    int32_t pid,
+    PolledProcFile file) {
+  base::StackString<128> path("/proc/%" PRId32 "/%s", pid,
+                              kPolledProcFileNames[file]);
+  return base::OpenFile(path.c_str(), O_RDONLY);
+}
+
 std::string ProcessStatsDataSource::ReadProcStatusEntry(const std::string& buf,
                                                         const char* key) {
   auto begin = buf.find(key);
@@ -445,11 +531,10 @@ void ProcessStatsDataSource::WriteAllProcessStats() {
     if (skip_stats_for_pids_.size() > pid_u && skip_stats_for_pids_[pid_u])
       continue;
 
-    std::string proc_status = ReadProcPidFile(pid, "status");
-    if (proc_status.empty())
+    if (!ReadPolledProcPidFile(pid, kPolledStatus, &polled_read_buf_))
       continue;
 
-    if (!WriteMemCounters(pid, proc_status)) {
+    if (!WriteMemCounters(pid, &polled_read_buf_)) {
       // If WriteMemCounters() fails the pid is very likely a kernel thread
       // that has a valid /proc/[pid]/status but no memory values. In this
       // case avoid keep polling it over and over.
@@ -459,10 +544,9 @@ void ProcessStatsDataSource::WriteAllProcessStats() {
       continue;
     }
 
-    std::string oom_score_adj = ReadProcPidFile(pid, "oom_score_adj");
-    if (!oom_score_adj.empty()) {
+    if (ReadPolledProcPidFile(pid, kPolledOomScoreAdj, &polled_read_buf_)) {
       CachedProcessStats& cached = process_stats_cache_[pid];
-      auto counter = ToInt(oom_score_adj);
+      auto counter = ToInt(polled_read_buf_);
       if (counter != cached.oom_score_adj) {
         GetOrCreateStatsProcess(pid)->set_oom_score_adj(counter);
         cached.oom_score_adj = counter;
@@ -473,6 +557,15 @@ void ProcessStatsDataSource::WriteAllProcessStats() {
   }
   FinalizeCurPacket();
 
+  // Close the files of the processes which have exited (or are skipped).
+  for (auto it = polled_files_.begin(); it != polled_files_.end();) {
+    if (pids.count(it->first)) {
+      ++it;
+    } else {
+      it = polled_files_.erase(it);
+    }
+  }
+
   // Ensure that we write once long-term process info (e.g., name) for new pids
   // that we haven't seen before.
   WriteProcessTree(pids);
@@ -482,7 +575,7 @@ void ProcessStatsDataSource::WriteAllProcessStats() {
 // it failed (e.g., |pid| was a kernel thread and, as such, didn't report any
 // memory counters).
 bool ProcessStatsDataSource::WriteMemCounters(int32_t pid,
-                                              const std::string& proc_status) {
+                                              std::string* proc_status) {
   bool proc_status_has_mem_counters = false;
   CachedProcessStats& cached = process_stats_cache_[pid];
 
@@ -496,94 +589,71 @@ bool ProcessStatsDataSource::WriteMemCounters(int32_t pid,
   // VmSize:     5992 kB
   // VmLck:         0 kB
   // ...
-  std::vector<char> key;
-  std::vector<char> value;
-  enum { kKey, kSeparator, kValue } state = kKey;
-  for (char c : proc_status) {
-    if (c == '\n') {
-      key.push_back('\0');
-      value.push_back('\0');
-
-      // |value| will contain "1234 KB". We rely on strtol() (in ToU32()) to
-      // stop parsing at the first non-numeric character.
-      if (strcmp(key.data(), "VmSize") == 0) {
-        // Assume that if we see VmSize we'll see also the others.
-        proc_status_has_mem_counters = true;
-
-        auto counter = ToU32(value.data());
-        if (counter != cached.vm_size_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_size_kb(counter);
-          cached.vm_size_kb = counter;
-        }
-      } else if (strcmp(key.data(), "VmLck") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.vm_locked_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_locked_kb(counter);
-          cached.vm_locked_kb = counter;
-        }
-      } else if (strcmp(key.data(), "VmHWM") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.vm_hvm_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_hwm_kb(counter);
-          cached.vm_hvm_kb = counter;
-        }
-      } else if (strcmp(key.data(), "VmRSS") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.vm_rss_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_rss_kb(counter);
-          cached.vm_rss_kb = counter;
-        }
-      } else if (strcmp(key.data(), "RssAnon") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.rss_anon_kb) {
-          GetOrCreateStatsProcess(pid)->set_rss_anon_kb(counter);
-          cached.rss_anon_kb = counter;
-        }
-      } else if (strcmp(key.data(), "RssFile") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.rss_file_kb) {
-          GetOrCreateStatsProcess(pid)->set_rss_file_kb(counter);
-          cached.rss_file_kb = counter;
-        }
-      } else if (strcmp(key.data(), "RssShmem") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.rss_shmem_kb) {
-          GetOrCreateStatsProcess(pid)->set_rss_shmem_kb(counter);
-          cached.rss_shmem_kb = counter;
-        }
-      } else if (strcmp(key.data(), "VmSwap") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.vm_swap_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_swap_kb(counter);
-          cached.vm_swap_kb = counter;
-        }
-      }
-
-      key.clear();
-      state = kKey;
+  // The lines are split in place, without copying the keys and values.
+  for (base::StringSplitter lines(&(*proc_status)[0], proc_status->size() + 1,
+                                  '\n');
+       lines.Next();) {
+    char* key = lines.cur_token();
+    char* separator = strchr(key, ':');
+    if (!separator)
       continue;
-    }
-
-    if (state == kKey) {
-      if (c == ':') {
-        state = kSeparator;
-        continue;
+    *separator = '\0';
+
+    // The value will contain "1234 KB". We rely on strtol() (in ToU32()) to
+    // skip the leading whitespace and to stop parsing at the first
+    // non-numeric character.
+    const char* value = separator + 1;
+    if (strcmp(key, "VmSize") == 0) {
+      // Assume that if we see VmSize we'll see also the others.
+      proc_status_has_mem_counters = true;
+
+      auto counter = ToU32(value);
+      if (counter != cached.vm_size_kb) {
+        GetOrCreateStatsProcess(pid)->set_vm_size_kb(counter);
+        cached.vm_size_kb = counter;
+      }
+    } else if (strcmp(key, "VmLck") == 0) {
+      auto counter = ToU32(value);
+      if (counter != cached.vm_locked_kb) {
+        GetOrCreateStatsProcess(pid)->set_vm_locked_kb(counter);
+        cached.vm_locked_kb = counter;
+      }
+    } else if (strcmp(key, "VmHWM") == 0) {
+      auto counter = ToU32(value);
+      if (counter != cached.vm_hvm_kb) {
+        GetOrCreateStatsProcess(pid)->set_vm_hwm_kb(counter);
+        cached.vm_hvm_kb = counter;
+      }
+    } else if (strcmp(key, "VmRSS") == 0) {
+      auto counter = ToU32(value);
+      if (counter != cached.vm_rss_kb) {
+        GetOrCreateStatsProcess(pid)->set_vm_rss_kb(counter);
+        cached.vm_rss_kb = counter;
+      }
+    } else if (strcmp(key, "RssAnon") == 0) {
+      auto counter = ToU32(value);
+      if (counter != cached.rss_anon_kb) {
+        GetOrCreateStatsProcess(pid)->set_rss_anon_kb(counter);
+        cached.rss_anon_kb = counter;
+      }
+    } else if (strcmp(key, "RssFile") == 0) {
+      auto counter = ToU32(value);
+      if (counter != cached.rss_file_kb) {
+        GetOrCreateStatsProcess(pid)->set_rss_file_kb(counter);
+        cached.rss_file_kb = counter;
+      }
+    } else if (strcmp(key, "RssShmem") == 0) {
+      auto counter = ToU32(value);
+      if (counter != cached.rss_shmem_kb) {
+        GetOrCreateStatsProcess(pid)->set_rss_shmem_kb(counter);
+        cached.rss_shmem_kb = counter;
+      }
+    } else if (strcmp(key, "VmSwap") == 0) {
+      auto counter = ToU32(value);
+      if (counter != cached.vm_swap_kb) {
+        GetOrCreateStatsProcess(pid)->set_vm_swap_kb(counter);
+        cached.vm_swap_kb = counter;
       }
-      key.push_back(c);
-      continue;
-    }
-
-    if (state == kSeparator) {
-      if (isspace(c))
-        continue;
-      value.clear();
-      value.push_back(c);
-      state = kValue;
-      continue;
-    }
-
-    if (state == kValue) {
-      value.push_back(c);
     }
   }
   return proc_status_has_mem_counters;
@@ -21,6 +21,7 @@
 #include <limits>
 #include <memory>
 #include <set>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
@@ -51,6 +52,13 @@ class ProcessStatsDataSource : public ProbesDataSource {
  public:
   static const ProbesDataSource::Descriptor descriptor;
 
+  // The /proc/<pid>/ files read for each process on every poll.
+  enum PolledProcFile : size_t {
+    kPolledStatus = 0,
+    kPolledOomScoreAdj,
+    kNumPolledProcFiles
+  };
+
   ProcessStatsDataSource(base::TaskRunner*,
                          TracingSessionID,
                          std::unique_ptr<TraceWriter> writer,
@@ -73,6 +81,14 @@ class ProcessStatsDataSource : public ProbesDataSource {
   // Virtual for testing.
   virtual base::ScopedDir OpenProcDir();
   virtual std::string ReadProcPidFile(int32_t pid, const std::string& file);
+  // Reads |file| of |pid| into |buf| for the periodic stats, reusing the
+  // capacity of |buf|. The file is kept open across polls. Returns false if
+  // the file can't be read (e.g. the process has exited).
+  virtual bool ReadPolledProcPidFile(int32_t pid,
+                                     PolledProcFile file,
+                                     std::string* buf);
+  virtual base::ScopedFile OpenPolledProcPidFile(int32_t pid,
+                                                 PolledProcFile file);
 
  private:
   struct CachedProcessStats {
@@ -120,7 +136,7 @@ class ProcessStatsDataSource : public ProbesDataSource {
   // Functions for periodically sampling process stats/counters.
   static void Tick(base::WeakPtr<ProcessStatsDataSource>);
   void WriteAllProcessStats();
-  bool WriteMemCounters(int32_t pid, const std::string& proc_status);
+  bool WriteMemCounters(int32_t pid, std::string* proc_status);
   bool ShouldWriteThreadStats(int32_t pid);
   void WriteThreadStats(int32_t pid, int32_t tid);
 
@@ -170,6 +186,17 @@ class ProcessStatsDataSource : public ProbesDataSource {
   uint32_t process_stats_cache_ttl_ticks_ = 0;
   std::unordered_map<int32_t, CachedProcessStats> process_stats_cache_;
 
+  // The polled files of the processes seen in the last poll, kept open to
+  // avoid an open() and close() per file and per poll. procfs regenerates the
+  // content of the file on each read from the start. Capped to
+  // |max_polled_pids_| processes, derived from the fd limit, to stay well
+  // below it.
+  using PolledProcFiles = std::array<base::ScopedFile, kNumPolledProcFiles>;
+  std::unordered_map<int32_t, PolledProcFiles> polled_files_;
+  size_t max_polled_pids_ = 0;
+  // Reused for reading the polled files.
+  std::string polled_read_buf_;
+
   using TimeInStateCacheEntry = std::tuple</* tid */ int32_t,
                                            /* cpu_freq_index */ uint32_t,
                                            /* ticks */ uint64_t>;
@@ -17,6 +17,10 @@
 #include "src/traced/probes/ps/process_stats_data_source.h"
 
 #include <dirent.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/temp_file.h"
@@ -58,6 +62,15 @@ class TestProcessStatsDataSource : public ProcessStatsDataSource {
 
   MOCK_METHOD0(OpenProcDir, base::ScopedDir());
   MOCK_METHOD2(ReadProcPidFile, std::string(int32_t pid, const std::string&));
+
+  // The polled files are read through ReadProcPidFile() too.
+  bool ReadPolledProcPidFile(int32_t pid,
+                             PolledProcFile file,
+                             std::string* buf) override {
+    *buf = ReadProcPidFile(
+        pid, file == kPolledStatus ? "status" : "oom_score_adj");
+    return !buf->empty();
+  }
 };
 
 class ProcessStatsDataSourceTest : public ::testing::Test {
@@ -464,6 +477,136 @@ TEST_F(ProcessStatsDataSourceTest, CacheProcessStats) {
   base::Rmdir(path);
 }
 
+TEST_F(ProcessStatsDataSourceTest, ReadPolledProcPidFile) {
+  ProcessStatsDataSource data_source(&task_runner_, 0,
+                                     std::unique_ptr<TraceWriter>(
+                                         new TraceWriterForTesting()),
+                                     DataSourceConfig(), nullptr);
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    pause();
+    _exit(0);
+  }
+
+  std::string buf;
+  for (int i = 0; i < 2; i++) {
+    ASSERT_TRUE(data_source.ReadPolledProcPidFile(
+        pid, ProcessStatsDataSource::kPolledStatus, &buf));
+    EXPECT_NE(buf.find("Pid:\t" + std::to_string(pid) + "\n"),
+              std::string::npos);
+    ASSERT_TRUE(data_source.ReadPolledProcPidFile(
+        pid, ProcessStatsDataSource::kPolledOomScoreAdj, &buf));
+    EXPECT_EQ(buf.back(), '\n');
+  }
+
+  // The files kept open from the previous reads can't be read anymore.
+  kill(pid, SIGKILL);
+  ASSERT_EQ(waitpid(pid, nullptr, 0), pid);
+  EXPECT_FALSE(data_source.ReadPolledProcPidFile(
+      pid, ProcessStatsDataSource::kPolledStatus, &buf));
+  EXPECT_TRUE(buf.empty());
+}
+
+// Opens the files of |current_pid| whatever the pid asked, standing for the
+// process which has that pid at the time.
+class PidReuseProcessStatsDataSource : public ProcessStatsDataSource {
+ public:
+  using ProcessStatsDataSource::ProcessStatsDataSource;
+
+  base::ScopedFile OpenPolledProcPidFile(int32_t,
+                                         PolledProcFile file) override {
+    opens++;
+    return ProcessStatsDataSource::OpenPolledProcPidFile(current_pid, file);
+  }
+
+  int32_t current_pid = 0;
+  int opens = 0;
+};
+
+TEST_F(ProcessStatsDataSourceTest, ReadPolledProcPidFileReusedPid) {
+  PidReuseProcessStatsDataSource data_source(
+      &task_runner_, 0,
+      std::unique_ptr<TraceWriter>(new TraceWriterForTesting()),
+      DataSourceConfig(), nullptr);
+  pid_t pids[2];
+  for (pid_t& pid : pids) {
+    pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+      pause();
+      _exit(0);
+    }
+  }
+
+  // The file is opened once and then kept open.
+  data_source.current_pid = pids[0];
+  std::string buf;
+  for (int i = 0; i < 2; i++) {
+    ASSERT_TRUE(data_source.ReadPolledProcPidFile(
+        42, ProcessStatsDataSource::kPolledStatus, &buf));
+    EXPECT_NE(buf.find("Pid:\t" + std::to_string(pids[0]) + "\n"),
+              std::string::npos);
+  }
+  EXPECT_EQ(data_source.opens, 1);
+
+  // Once the process has exited and its pid has been reused, the stale file
+  // is dropped and the file of the new process is opened instead.
+  kill(pids[0], SIGKILL);
+  ASSERT_EQ(waitpid(pids[0], nullptr, 0), pids[0]);
+  data_source.current_pid = pids[1];
+  for (int i = 0; i < 2; i++) {
+    ASSERT_TRUE(data_source.ReadPolledProcPidFile(
+        42, ProcessStatsDataSource::kPolledStatus, &buf));
+    EXPECT_NE(buf.find("Pid:\t" + std::to_string(pids[1]) + "\n"),
+              std::string::npos);
+  }
+  EXPECT_EQ(data_source.opens, 2);
+
+  kill(pids[1], SIGKILL);
+  ASSERT_EQ(waitpid(pids[1], nullptr, 0), pids[1]);
+}
+
+TEST_F(ProcessStatsDataSourceTest, PolledPidsCappedByFdLimit) {
+  // Run in a sub-process, as the fd limit is changed.
+  ASSERT_EXIT(
+      {
+        // A low soft limit is raised towards the hard limit.
+        struct rlimit limit;
+        ASSERT_EQ(0, getrlimit(RLIMIT_NOFILE, &limit));
+        limit.rlim_cur = 64;
+        ASSERT_EQ(0, setrlimit(RLIMIT_NOFILE, &limit));
+        {
+          ProcessStatsDataSource data_source(
+              &task_runner_, 0,
+              std::unique_ptr<TraceWriter>(new TraceWriterForTesting()),
+              DataSourceConfig(), nullptr);
+        }
+        ASSERT_EQ(0, getrlimit(RLIMIT_NOFILE, &limit));
+        ASSERT_GT(limit.rlim_cur, 64u);
+
+        // A quarter of 64 fds, with two files per process, is enough for the
+        // files of 8 processes: the ones of the 9th are opened on each read.
+        limit.rlim_cur = limit.rlim_max = 64;
+        ASSERT_EQ(0, setrlimit(RLIMIT_NOFILE, &limit));
+        PidReuseProcessStatsDataSource data_source(
+            &task_runner_, 0,
+            std::unique_ptr<TraceWriter>(new TraceWriterForTesting()),
+            DataSourceConfig(), nullptr);
+        data_source.current_pid = getpid();
+        std::string buf;
+        for (int i = 0; i < 2; i++) {
+          for (int32_t pid = 1; pid <= 9; pid++) {
+            ASSERT_TRUE(data_source.ReadPolledProcPidFile(
+                pid, ProcessStatsDataSource::kPolledStatus, &buf));
+          }
+        }
+        ASSERT_EQ(data_source.opens, 10);
+        _exit(0);
+      },
+      ::testing::ExitedWithCode(0), "");
+}
+
 TEST_F(ProcessStatsDataSourceTest, NamespacedProcess) {
   auto data_source = GetProcessStatsDataSource(DataSourceConfig());
   EXPECT_CALL(*data_source, ReadProcPidFile(42, "status"))
@@ -17,6 +17,7 @@
 #include "src/traced/probes/sys_stats/sys_stats_data_source.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <algorithm>
@@ -64,12 +65,46 @@ uint32_t ClampTo10Ms(uint32_t period_ms, const char* counter_name) {
   return period_ms;
 }
 
+// Returns the position of the first |c| in [|pos|, |end|), or |end|.
+// memchr() is vectorized by the libc, which makes this much cheaper than a
+// byte-by-byte scan on large files like /proc/stat.
+const char* FindChar(const char* pos, const char* end, char c) {
+  const void* res = memchr(pos, c, static_cast<size_t>(end - pos));
+  return res ? static_cast<const char*>(res) : end;
+}
+
+// Parses the next decimal number in [|*pos|, |end|), skipping leading spaces,
+// and moves |*pos| past it. Negative numbers wrap around, like strtoll()
+// followed by a cast to uint64_t. Returns false if there is no number left.
+bool ParseNextNumber(const char** pos, const char* end, uint64_t* value) {
+  const char* p = *pos;
+  while (p < end && *p == ' ')
+    p++;
+  bool negative = p < end && *p == '-';
+  if (negative)
+    p++;
+  const char* digits = p;
+  uint64_t v = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; p++)
+    v = v * 10 + static_cast<uint64_t>(*p - '0');
+  if (p == digits)
+    return false;
+  *pos = p;
+  *value = negative ? 0 - v : v;
+  return true;
+}
+
+template <size_t N>
+bool KeyEquals(const char* key, size_t key_size, const char (&expected)[N]) {
+  return key_size == N - 1 && memcmp(key, expected, N - 1) == 0;
+}
+
 }  // namespace
 
 // static
 const ProbesDataSource::Descriptor SysStatsDataSource::descriptor = {
     /*name*/ "linux.sys_stats",
-    /*flags*/ Descriptor::kFlagsNone,
+    /*flags*/ Descriptor::kHandlesIncrementalState,
     /*fill_descriptor_func*/ nullptr,
 };
 
@@ -145,6 +180,8 @@ SysStatsDataSource::SysStatsDataSource(
     stat_enabled_fields_ |= 1ul << static_cast<uint32_t>(*counter);
   }
 
+  emit_changed_counters_only_ = cfg.emit_changed_counters_only();
+
   std::array<uint32_t, 7> periods_ms{};
   std::array<uint32_t, 7> ticks{};
   static_assert(periods_ms.size() == ticks.size(), "must have same size");
@@ -374,66 +411,145 @@ void SysStatsDataSource::ReadMeminfo(protos::pbzero::SysStats* sys_stats) {
   size_t rsize = ReadFile(&meminfo_fd_, "/proc/meminfo");
   if (!rsize)
     return;
-  char* buf = static_cast<char*>(read_buf_.Get());
-  for (base::StringSplitter lines(buf, rsize, '\n'); lines.Next();) {
-    base::StringSplitter words(&lines, ' ');
-    if (!words.Next())
-      continue;
-    // Extract the meminfo key, dropping trailing ':' (e.g., "MemTotal: NN KB").
-    words.cur_token()[words.cur_token_size() - 1] = '\0';
-    auto it = meminfo_counters_.find(words.cur_token());
-    if (it == meminfo_counters_.end())
-      continue;
-    int counter_id = it->second;
-    if (!words.Next())
-      continue;
-    auto value = static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
-    auto* meminfo = sys_stats->add_meminfo();
-    meminfo->set_key(static_cast<protos::pbzero::MeminfoCounters>(counter_id));
-    meminfo->set_value(value);
-  }
+  ParseKeyValueFile(
+      rsize, /*strip_key_colon=*/true, meminfo_counters_, &meminfo_layout_,
+      [this, sys_stats](int counter_id, uint64_t value) {
+        if (!ShouldEmitCounter(&last_meminfo_values_,
+                               static_cast<size_t>(counter_id), value)) {
+          return;
+        }
+        auto* meminfo = sys_stats->add_meminfo();
+        meminfo->set_key(
+            static_cast<protos::pbzero::MeminfoCounters>(counter_id));
+        meminfo->set_value(value);
+      });
 }
 
 void SysStatsDataSource::ReadVmstat(protos::pbzero::SysStats* sys_stats) {
   size_t rsize = ReadFile(&vmstat_fd_, "/proc/vmstat");
   if (!rsize)
     return;
+  ParseKeyValueFile(
+      rsize, /*strip_key_colon=*/false, vmstat_counters_, &vmstat_layout_,
+      [this, sys_stats](int counter_id, uint64_t value) {
+        if (!ShouldEmitCounter(&last_vmstat_values_,
+                               static_cast<size_t>(counter_id), value)) {
+          return;
+        }
+        auto* vmstat = sys_stats->add_vmstat();
+        vmstat->set_key(
+            static_cast<protos::pbzero::VmstatCounters>(counter_id));
+        vmstat->set_value(value);
+      });
+}
+
+template <typename AddCounterFn>
+void SysStatsDataSource::ParseKeyValueFile(
+    size_t rsize,
+    bool strip_key_colon,
+    const std::map<const char*, int, CStrCmp>& counters,
+    KeyValueLayout* layout,
+    AddCounterFn add_counter) {
   char* buf = static_cast<char*>(read_buf_.Get());
-  for (base::StringSplitter lines(buf, rsize, '\n'); lines.Next();) {
-    base::StringSplitter words(&lines, ' ');
-    if (!words.Next())
-      continue;
-    auto it = vmstat_counters_.find(words.cur_token());
-    if (it == vmstat_counters_.end())
-      continue;
-    int counter_id = it->second;
-    if (!words.Next())
-      continue;
-    auto value = static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
-    auto* vmstat = sys_stats->add_vmstat();
-    vmstat->set_key(static_cast<protos::pbzero::VmstatCounters>(counter_id));
-    vmstat->set_value(value);
+  const char* const end = buf + rsize - 1;  // Exclude the null terminator.
+  std::vector<KeyValueLayout::Line>& lines = layout->lines;
+
+  // Once a line doesn't match the learned layout (or on the first read), the
+  // rest of the file is parsed with key lookups and the layout is learned
+  // again from there.
+  bool relearning = false;
+  size_t line_idx = 0;
+  for (char* line = buf; line < end; line_idx++) {
+    const char* line_end = FindChar(line, end, '\n');
+    size_t line_size = static_cast<size_t>(line_end - line);
+
+    const KeyValueLayout::Line* cur = nullptr;
+    if (!relearning && line_idx < lines.size()) {
+      cur = &lines[line_idx];
+      size_t word_size = cur->word_size;
+      if (line_size < word_size ||
+          memcmp(line, &layout->words[cur->word_offset], word_size) != 0 ||
+          (line_size > word_size && line[word_size] != ' ')) {
+        cur = nullptr;
+      }
+    }
+    if (!cur) {
+      if (!relearning && line_idx < lines.size())
+        layout->words.resize(lines[line_idx].word_offset);
+      relearning = true;
+      lines.resize(line_idx);
+
+      KeyValueLayout::Line parsed;
+      size_t word_size =
+          static_cast<size_t>(FindChar(line, line_end, ' ') - line);
+      parsed.word_offset = static_cast<uint32_t>(layout->words.size());
+      parsed.word_size = static_cast<uint32_t>(word_size);
+      layout->words.append(line, word_size);
+
+      // Look up the key, dropping the trailing ':' if needed (e.g.,
+      // "MemTotal: NN kB").
+      size_t key_size = word_size;
+      if (strip_key_colon)
+        key_size = key_size > 0 && line[key_size - 1] == ':' ? key_size - 1 : 0;
+      if (key_size > 0) {
+        char saved = line[key_size];
+        line[key_size] = '\0';
+        auto it = counters.find(line);
+        line[key_size] = saved;
+        if (it != counters.end())
+          parsed.counter_id = it->second;
+      }
+      lines.push_back(parsed);
+      cur = &lines.back();
+    }
+
+    uint64_t value = 0;
+    const char* pos = line + cur->word_size;
+    if (cur->counter_id && ParseNextNumber(&pos, line_end, &value))
+      add_counter(cur->counter_id, value);
+    line += line_size + 1;
   }
+
+  // Drops the lines past the end of the file, if it shrank.
+  if (line_idx < lines.size()) {
+    layout->words.resize(lines[line_idx].word_offset);
+    lines.resize(line_idx);
+  }
+}
+
+bool SysStatsDataSource::ShouldEmitCounter(LastValues* last_values,
+                                           size_t id,
+                                           uint64_t value) {
+  if (!emit_changed_counters_only_)
+    return true;
+  if (id >= last_values->size())
+    last_values->resize(id + 1);
+  base::Optional<uint64_t>& last_value = (*last_values)[id];
+  if (last_value && *last_value == value)
+    return false;
+  last_value = value;
+  return true;
 }
 
 void SysStatsDataSource::ReadStat(protos::pbzero::SysStats* sys_stats) {
   size_t rsize = ReadFile(&stat_fd_, "/proc/stat");
   if (!rsize)
     return;
-  char* buf = static_cast<char*>(read_buf_.Get());
-  for (base::StringSplitter lines(buf, rsize, '\n'); lines.Next();) {
-    base::StringSplitter words(&lines, ' ');
-    if (!words.Next())
-      continue;
+  const char* buf = static_cast<char*>(read_buf_.Get());
+  const char* const end = buf + rsize - 1;  // Exclude the null terminator.
+  for (const char* line = buf; line < end;) {
+    const char* line_end = FindChar(line, end, '\n');
+    const char* pos = FindChar(line, line_end, ' ');
+    size_t key_size = static_cast<size_t>(pos - line);
 
     // Per-CPU stats.
     if ((stat_enabled_fields_ & (1 << SysStatsConfig::STAT_CPU_TIMES)) &&
-        words.cur_token_size() > 3 && !strncmp(words.cur_token(), "cpu", 3)) {
-      long cpu_id = strtol(words.cur_token() + 3, nullptr, 10);
+        key_size > 3 && !strncmp(line, "cpu", 3)) {
+      long cpu_id = strtol(line + 3, nullptr, 10);
       std::array<uint64_t, 7> cpu_times{};
-      for (size_t i = 0; i < cpu_times.size() && words.Next(); i++) {
-        cpu_times[i] =
-            static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
+      for (size_t i = 0; i < cpu_times.size(); i++) {
+        if (!ParseNextNumber(&pos, line_end, &cpu_times[i]))
+          break;
       }
       auto* cpu_stat = sys_stats->add_cpu_stat();
       cpu_stat->set_cpu_id(static_cast<uint32_t>(cpu_id));
@@ -447,12 +563,12 @@ void SysStatsDataSource::ReadStat(protos::pbzero::SysStats* sys_stats) {
     }
     // IRQ counters
     else if ((stat_enabled_fields_ & (1 << SysStatsConfig::STAT_IRQ_COUNTS)) &&
-             !strcmp(words.cur_token(), "intr")) {
-      for (size_t i = 0; words.Next(); i++) {
-        auto v = static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
+             KeyEquals(line, key_size, "intr")) {
+      uint64_t v = 0;
+      for (size_t i = 0; ParseNextNumber(&pos, line_end, &v); i++) {
         if (i == 0) {
           sys_stats->set_num_irq_total(v);
-        } else if (v > 0) {
+        } else if (v > 0 && ShouldEmitCounter(&last_irq_values_, i - 1, v)) {
           auto* irq_stat = sys_stats->add_num_irq();
           irq_stat->set_irq(static_cast<int32_t>(i - 1));
           irq_stat->set_count(v);
@@ -462,12 +578,12 @@ void SysStatsDataSource::ReadStat(protos::pbzero::SysStats* sys_stats) {
     // Softirq counters.
     else if ((stat_enabled_fields_ &
               (1 << SysStatsConfig::STAT_SOFTIRQ_COUNTS)) &&
-             !strcmp(words.cur_token(), "softirq")) {
-      for (size_t i = 0; words.Next(); i++) {
-        auto v = static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
+             KeyEquals(line, key_size, "softirq")) {
+      uint64_t v = 0;
+      for (size_t i = 0; ParseNextNumber(&pos, line_end, &v); i++) {
         if (i == 0) {
           sys_stats->set_num_softirq_total(v);
-        } else {
+        } else if (ShouldEmitCounter(&last_softirq_values_, i - 1, v)) {
           auto* softirq_stat = sys_stats->add_num_softirq();
           softirq_stat->set_irq(static_cast<int32_t>(i - 1));
           softirq_stat->set_count(v);
@@ -476,13 +592,13 @@ void SysStatsDataSource::ReadStat(protos::pbzero::SysStats* sys_stats) {
     }
     // Number of forked processes since boot.
     else if ((stat_enabled_fields_ & (1 << SysStatsConfig::STAT_FORK_COUNT)) &&
-             !strcmp(words.cur_token(), "processes")) {
-      if (words.Next()) {
-        sys_stats->set_num_forks(
-            static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10)));
-      }
+             KeyEquals(line, key_size, "processes")) {
+      uint64_t v = 0;
+      if (ParseNextNumber(&pos, line_end, &v))
+        sys_stats->set_num_forks(v);
     }
 
+    line = line_end + 1;
   }  // for (line)
 }
 
@@ -494,6 +610,16 @@ void SysStatsDataSource::Flush(FlushRequestID, std::function<void()> callback) {
   writer_->Flush(callback);
 }
 
+void SysStatsDataSource::ClearIncrementalState() {
+  // Forgets the last emitted values, so that the next samples are complete
+  // again (e.g. after the older ones got overwritten in a ring buffer).
+  for (LastValues* last_values :
+       {&last_meminfo_values_, &last_vmstat_values_, &last_irq_values_,
+        &last_softirq_values_}) {
+    std::fill(last_values->begin(), last_values->end(), base::nullopt);
+  }
+}
+
 size_t SysStatsDataSource::ReadFile(base::ScopedFile* fd, const char* path) {
   if (!*fd)
     return 0;
@@ -22,7 +22,9 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
+#include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/paged_memory.h"
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/weak_ptr.h"
@@ -60,11 +62,13 @@ class SysStatsDataSource : public ProbesDataSource {
   // ProbesDataSource implementation.
   void Start() override;
   void Flush(FlushRequestID, std::function<void()> callback) override;
+  void ClearIncrementalState() override;
 
   base::WeakPtr<SysStatsDataSource> GetWeakPtr() const;
 
   void set_ns_per_user_hz_for_testing(uint64_t ns) { ns_per_user_hz_ = ns; }
   uint32_t tick_for_testing() const { return tick_; }
+  void ReadSysStatsForTesting() { ReadSysStats(); }
 
   // Virtual for testing
   virtual base::ScopedDir OpenDevfreqDir();
@@ -77,6 +81,24 @@ class SysStatsDataSource : public ProbesDataSource {
     }
   };
 
+  // The lines of a "key value" proc file (/proc/meminfo, /proc/vmstat). The
+  // kernel prints these with a fixed set of keys in a fixed order, so the
+  // layout is learned on the first read and later reads only check that each
+  // line still starts with the expected word rather than looking it up.
+  struct KeyValueLayout {
+    struct Line {
+      uint32_t word_offset = 0;  // Of the first word, in |words|.
+      uint32_t word_size = 0;
+      int counter_id = 0;  // 0 if the counter is not enabled.
+    };
+    std::vector<Line> lines;
+    std::string words;
+  };
+
+  // The last value emitted for each counter, indexed by counter id. Only
+  // used when emitting changed counters only.
+  using LastValues = std::vector<base::Optional<uint64_t>>;
+
   static void Tick(base::WeakPtr<SysStatsDataSource>);
 
   SysStatsDataSource(const SysStatsDataSource&) = delete;
@@ -89,6 +111,13 @@ class SysStatsDataSource : public ProbesDataSource {
   void ReadCpufreq(protos::pbzero::SysStats* sys_stats);
   void ReadBuddyInfo(protos::pbzero::SysStats* sys_stats);
   void ReadDiskStat(protos::pbzero::SysStats* sys_stats);
+  template <typename AddCounterFn>
+  void ParseKeyValueFile(size_t rsize,
+                         bool strip_key_colon,
+                         const std::map<const char*, int, CStrCmp>& counters,
+                         KeyValueLayout* layout,
+                         AddCounterFn add_counter);
+  bool ShouldEmitCounter(LastValues* last_values, size_t id, uint64_t value);
   size_t ReadFile(base::ScopedFile*, const char* path);
 
   base::TaskRunner* const task_runner_;
@@ -102,6 +131,13 @@ class SysStatsDataSource : public ProbesDataSource {
   TraceWriter::TracePacketHandle cur_packet_;
   std::map<const char*, int, CStrCmp> meminfo_counters_;
   std::map<const char*, int, CStrCmp> vmstat_counters_;
+  KeyValueLayout meminfo_layout_;
+  KeyValueLayout vmstat_layout_;
+  bool emit_changed_counters_only_ = false;
+  LastValues last_meminfo_values_;
+  LastValues last_vmstat_values_;
+  LastValues last_irq_values_;
+  LastValues last_softirq_values_;
   uint64_t ns_per_user_hz_ = 0;
   uint32_t tick_ = 0;
   uint32_t tick_period_ms_ = 0;
@@ -0,0 +1,134 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <unistd.h>
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "perfetto/ext/base/utils.h"
+#include "perfetto/tracing/core/data_source_config.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/traced/probes/common/cpu_freq_info_for_testing.h"
+#include "src/traced/probes/sys_stats/sys_stats_data_source.h"
+#include "src/tracing/core/trace_writer_for_testing.h"
+
+#include "protos/perfetto/config/sys_stats/sys_stats_config.gen.h"
+
+namespace perfetto {
+namespace {
+
+const char* const kProcFiles[] = {"/proc/meminfo", "/proc/vmstat",
+                                  "/proc/stat"};
+constexpr size_t kNumProcFiles = base::ArraySize(kProcFiles);
+
+// Two snapshots of each of |kProcFiles|, captured 100 ms apart, and the temp
+// files the data source reads them from. The benchmark alternates between the
+// two snapshots, so that consecutive polls see realistic changes.
+struct ProcSnapshots {
+  std::array<std::array<std::string, 2>, kNumProcFiles> contents;
+  std::vector<base::TempFile> files;
+};
+
+ProcSnapshots* g_snapshots = nullptr;
+
+bool CaptureSnapshots() {
+  if (g_snapshots)
+    return true;
+  std::unique_ptr<ProcSnapshots> snapshots(new ProcSnapshots());
+  for (size_t snapshot = 0; snapshot < 2; snapshot++) {
+    if (snapshot > 0)
+      usleep(100 * 1000);
+    for (size_t i = 0; i < kNumProcFiles; i++) {
+      if (!base::ReadFile(kProcFiles[i], &snapshots->contents[i][snapshot]))
+        return false;
+    }
+  }
+  for (size_t i = 0; i < kNumProcFiles; i++)
+    snapshots->files.emplace_back(base::TempFile::CreateUnlinked());
+  g_snapshots = snapshots.release();
+  return true;
+}
+
+void WriteSnapshot(size_t snapshot) {
+  for (size_t i = 0; i < kNumProcFiles; i++) {
+    const std::string& content = g_snapshots->contents[i][snapshot];
+    int fd = g_snapshots->files[i].fd();
+    PERFETTO_CHECK(ftruncate(fd, 0) == 0);
+    PERFETTO_CHECK(pwrite(fd, content.data(), content.size(), 0) ==
+                   static_cast<ssize_t>(content.size()));
+  }
+}
+
+base::ScopedFile OpenSnapshot(const char* path) {
+  for (size_t i = 0; i < kNumProcFiles; i++) {
+    if (!strcmp(path, kProcFiles[i]))
+      return base::ScopedFile(dup(g_snapshots->files[i].fd()));
+  }
+  return base::ScopedFile();
+}
+
+// Arg 0: 1 to emit only the counters that changed since the last poll.
+void BM_SysStatsPoll(benchmark::State& state) {
+  if (!CaptureSnapshots()) {
+    state.SkipWithError("Cannot read /proc/{meminfo,vmstat,stat}");
+    return;
+  }
+
+  protos::gen::SysStatsConfig sys_cfg;
+  sys_cfg.set_meminfo_period_ms(10);
+  sys_cfg.set_vmstat_period_ms(10);
+  sys_cfg.set_stat_period_ms(10);
+  sys_cfg.set_emit_changed_counters_only(state.range(0) != 0);
+  DataSourceConfig config;
+  config.set_sys_stats_config_raw(sys_cfg.SerializeAsString());
+
+  base::TestTaskRunner task_runner;
+  CpuFreqInfoForTesting cpu_freq_info_for_testing;
+  auto* writer = new TraceWriterForTesting();
+  SysStatsDataSource data_source(
+      &task_runner, 0, std::unique_ptr<TraceWriter>(writer), config,
+      cpu_freq_info_for_testing.GetInstance(), OpenSnapshot);
+
+  // The first poll learns the layout of the files and emits all counters.
+  WriteSnapshot(0);
+  data_source.ReadSysStatsForTesting();
+  uint64_t written_before = writer->written();
+
+  size_t snapshot = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    snapshot ^= 1;
+    WriteSnapshot(snapshot);
+    state.ResumeTiming();
+
+    data_source.ReadSysStatsForTesting();
+  }
+
+  state.counters["bytes_per_poll"] = benchmark::Counter(
+      static_cast<double>(writer->written() - written_before),
+      benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_SysStatsPoll)->Arg(0)->Arg(1);
+
+}  // namespace
+}  // namespace perfetto
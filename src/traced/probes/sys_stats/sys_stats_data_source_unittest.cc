@@ -30,6 +30,7 @@
 #include "protos/perfetto/trace/sys_stats/sys_stats.gen.h"
 
 using ::testing::_;
+using ::testing::ElementsAre;
 using ::testing::Invoke;
 using ::testing::Return;
 using ::testing::UnorderedElementsAre;
@@ -239,17 +240,41 @@ base::ScopedFile MockOpenReadOnly(const char* path) {
   return tmp_.ReleaseFD();
 }
 
+// The /proc/meminfo and /proc/vmstat returned by MockOpenMutable() if set,
+// which tests can rewrite between polls.
+int g_mutable_meminfo_fd = -1;
+int g_mutable_vmstat_fd = -1;
+
+base::ScopedFile MockOpenMutable(const char* path) {
+  if (!strcmp(path, "/proc/meminfo") && g_mutable_meminfo_fd >= 0)
+    return base::ScopedFile(dup(g_mutable_meminfo_fd));
+  if (!strcmp(path, "/proc/vmstat") && g_mutable_vmstat_fd >= 0)
+    return base::ScopedFile(dup(g_mutable_vmstat_fd));
+  return MockOpenReadOnly(path);
+}
+
+void RewriteFile(int fd, const char* content) {
+  ASSERT_EQ(ftruncate(fd, 0), 0);
+  ASSERT_GT(pwrite(fd, content, strlen(content), 0), 0);
+}
+
 class SysStatsDataSourceTest : public ::testing::Test {
  protected:
+  SysStatsDataSourceTest() {
+    g_mutable_meminfo_fd = -1;
+    g_mutable_vmstat_fd = -1;
+  }
+
   std::unique_ptr<TestSysStatsDataSource> GetSysStatsDataSource(
-      const DataSourceConfig& cfg) {
+      const DataSourceConfig& cfg,
+      SysStatsDataSource::OpenFunction open_fn = MockOpenReadOnly) {
     auto writer =
         std::unique_ptr<TraceWriterForTesting>(new TraceWriterForTesting());
     writer_raw_ = writer.get();
     auto instance =
         std::unique_ptr<TestSysStatsDataSource>(new TestSysStatsDataSource(
             &task_runner_, 0, std::move(writer), cfg,
-            cpu_freq_info_for_testing_.GetInstance(), MockOpenReadOnly));
+            cpu_freq_info_for_testing_.GetInstance(), open_fn));
     instance->set_ns_per_user_hz_for_testing(1000000000ull / 100);  // 100 Hz.
     instance->Start();
     return instance;
@@ -329,6 +354,199 @@ TEST_F(SysStatsDataSourceTest, MeminfoAll) {
   EXPECT_GE(sys_stats.meminfo_size(), 10);
 }
 
+TEST_F(SysStatsDataSourceTest, MeminfoLayoutChange) {
+  using C = protos::gen::MeminfoCounters;
+  base::TempFile meminfo = base::TempFile::CreateUnlinked();
+  g_mutable_meminfo_fd = meminfo.fd();
+  RewriteFile(meminfo.fd(),
+              "MemTotal: 100 kB\n"
+              "MemFree: 50 kB\n"
+              "Unknown: 1 kB\n"
+              "Cached: 10 kB\n");
+
+  DataSourceConfig config;
+  protos::gen::SysStatsConfig sys_cfg;
+  sys_cfg.set_meminfo_period_ms(10);
+  sys_cfg.add_meminfo_counters(C::MEMINFO_MEM_FREE);
+  sys_cfg.add_meminfo_counters(C::MEMINFO_CACHED);
+  config.set_sys_stats_config_raw(sys_cfg.SerializeAsString());
+  auto data_source = GetSysStatsDataSource(config, MockOpenMutable);
+
+  data_source->ReadSysStatsForTesting();
+
+  // A line is inserted and another one is removed: the layout learned on the
+  // first poll doesn't apply anymore.
+  RewriteFile(meminfo.fd(),
+              "MemTotal: 100 kB\n"
+              "Inserted: 2 kB\n"
+              "MemFree: 40 kB\n"
+              "Cached: 20 kB\n");
+  data_source->ReadSysStatsForTesting();
+
+  // Back to the original layout, without a trailing newline.
+  RewriteFile(meminfo.fd(),
+              "MemTotal: 100 kB\n"
+              "MemFree: 30 kB\n"
+              "Unknown: 1 kB\n"
+              "Cached: 30 kB");
+  data_source->ReadSysStatsForTesting();
+
+  using KV = std::pair<int, uint64_t>;
+  std::vector<std::vector<KV>> polls;
+  for (const auto& packet : writer_raw_->GetAllTracePackets()) {
+    polls.emplace_back();
+    for (const auto& kv : packet.sys_stats().meminfo())
+      polls.back().push_back({kv.key(), kv.value()});
+  }
+  ASSERT_EQ(polls.size(), 3u);
+  EXPECT_THAT(polls[0], ElementsAre(KV{C::MEMINFO_MEM_FREE, 50},  //
+                                    KV{C::MEMINFO_CACHED, 10}));
+  EXPECT_THAT(polls[1], ElementsAre(KV{C::MEMINFO_MEM_FREE, 40},  //
+                                    KV{C::MEMINFO_CACHED, 20}));
+  EXPECT_THAT(polls[2], ElementsAre(KV{C::MEMINFO_MEM_FREE, 30},  //
+                                    KV{C::MEMINFO_CACHED, 30}));
+}
+
+TEST_F(SysStatsDataSourceTest, ReorderedKeys) {
+  using M = protos::gen::MeminfoCounters;
+  using V = protos::gen::VmstatCounters;
+  base::TempFile meminfo = base::TempFile::CreateUnlinked();
+  g_mutable_meminfo_fd = meminfo.fd();
+  base::TempFile vmstat = base::TempFile::CreateUnlinked();
+  g_mutable_vmstat_fd = vmstat.fd();
+  RewriteFile(meminfo.fd(),
+              "MemTotal: 100 kB\n"
+              "MemFree: 50 kB\n"
+              "Cached: 10 kB\n");
+  RewriteFile(vmstat.fd(),
+              "nr_free_pages 100\n"
+              "pgactivate 10\n"
+              "pgmigrate_fail 1\n");
+
+  DataSourceConfig config;
+  protos::gen::SysStatsConfig sys_cfg;
+  sys_cfg.set_meminfo_period_ms(10);
+  sys_cfg.add_meminfo_counters(M::MEMINFO_MEM_FREE);
+  sys_cfg.add_meminfo_counters(M::MEMINFO_CACHED);
+  sys_cfg.set_vmstat_period_ms(10);
+  sys_cfg.add_vmstat_counters(V::VMSTAT_NR_FREE_PAGES);
+  sys_cfg.add_vmstat_counters(V::VMSTAT_PGACTIVATE);
+  sys_cfg.add_vmstat_counters(V::VMSTAT_PGMIGRATE_FAIL);
+  config.set_sys_stats_config_raw(sys_cfg.SerializeAsString());
+  auto data_source = GetSysStatsDataSource(config, MockOpenMutable);
+
+  data_source->ReadSysStatsForTesting();
+
+  // The lines of the layout learned on the first poll are swapped.
+  RewriteFile(meminfo.fd(),
+              "MemTotal: 100 kB\n"
+              "Cached: 20 kB\n"
+              "MemFree: 40 kB\n");
+  RewriteFile(vmstat.fd(),
+              "pgactivate 20\n"
+              "nr_free_pages 200\n"
+              "pgmigrate_fail 2\n");
+  data_source->ReadSysStatsForTesting();
+
+  // Back to the original order, with lines inserted before and between the
+  // counters, one of them being a counter which isn't enabled.
+  RewriteFile(meminfo.fd(),
+              "Inserted: 1 kB\n"
+              "MemTotal: 100 kB\n"
+              "MemFree: 30 kB\n"
+              "Active: 5 kB\n"
+              "Cached: 30 kB\n");
+  RewriteFile(vmstat.fd(),
+              "nr_inserted 5\n"
+              "nr_free_pages 300\n"
+              "nr_inactive_anon 7\n"
+              "pgactivate 30\n"
+              "pgmigrate_fail 3\n");
+  data_source->ReadSysStatsForTesting();
+
+  using KV = std::pair<int, uint64_t>;
+  std::vector<std::vector<KV>> meminfo_polls;
+  std::vector<std::vector<KV>> vmstat_polls;
+  for (const auto& packet : writer_raw_->GetAllTracePackets()) {
+    meminfo_polls.emplace_back();
+    for (const auto& kv : packet.sys_stats().meminfo())
+      meminfo_polls.back().push_back({kv.key(), kv.value()});
+    vmstat_polls.emplace_back();
+    for (const auto& kv : packet.sys_stats().vmstat())
+      vmstat_polls.back().push_back({kv.key(), kv.value()});
+  }
+  ASSERT_EQ(meminfo_polls.size(), 3u);
+  EXPECT_THAT(meminfo_polls[0], ElementsAre(KV{M::MEMINFO_MEM_FREE, 50},  //
+                                            KV{M::MEMINFO_CACHED, 10}));
+  EXPECT_THAT(meminfo_polls[1], ElementsAre(KV{M::MEMINFO_CACHED, 20},  //
+                                            KV{M::MEMINFO_MEM_FREE, 40}));
+  EXPECT_THAT(meminfo_polls[2], ElementsAre(KV{M::MEMINFO_MEM_FREE, 30},  //
+                                            KV{M::MEMINFO_CACHED, 30}));
+  EXPECT_THAT(vmstat_polls[0],
+              ElementsAre(KV{V::VMSTAT_NR_FREE_PAGES, 100},  //
+                          KV{V::VMSTAT_PGACTIVATE, 10},      //
+                          KV{V::VMSTAT_PGMIGRATE_FAIL, 1}));
+  EXPECT_THAT(vmstat_polls[1],
+              ElementsAre(KV{V::VMSTAT_PGACTIVATE, 20},      //
+                          KV{V::VMSTAT_NR_FREE_PAGES, 200},  //
+                          KV{V::VMSTAT_PGMIGRATE_FAIL, 2}));
+  EXPECT_THAT(vmstat_polls[2],
+              ElementsAre(KV{V::VMSTAT_NR_FREE_PAGES, 300},  //
+                          KV{V::VMSTAT_PGACTIVATE, 30},      //
+                          KV{V::VMSTAT_PGMIGRATE_FAIL, 3}));
+}
+
+TEST_F(SysStatsDataSourceTest, ReorderedKeysChangedCountersOnly) {
+  using M = protos::gen::MeminfoCounters;
+  base::TempFile meminfo = base::TempFile::CreateUnlinked();
+  g_mutable_meminfo_fd = meminfo.fd();
+  RewriteFile(meminfo.fd(),
+              "MemTotal: 100 kB\n"
+              "MemFree: 50 kB\n"
+              "Cached: 10 kB\n");
+
+  DataSourceConfig config;
+  protos::gen::SysStatsConfig sys_cfg;
+  sys_cfg.set_meminfo_period_ms(10);
+  sys_cfg.add_meminfo_counters(M::MEMINFO_MEM_TOTAL);
+  sys_cfg.add_meminfo_counters(M::MEMINFO_MEM_FREE);
+  sys_cfg.add_meminfo_counters(M::MEMINFO_CACHED);
+  sys_cfg.set_emit_changed_counters_only(true);
+  config.set_sys_stats_config_raw(sys_cfg.SerializeAsString());
+  auto data_source = GetSysStatsDataSource(config, MockOpenMutable);
+
+  data_source->ReadSysStatsForTesting();
+
+  // Same values in another order: nothing changed.
+  RewriteFile(meminfo.fd(),
+              "Cached: 10 kB\n"
+              "MemFree: 50 kB\n"
+              "MemTotal: 100 kB\n");
+  data_source->ReadSysStatsForTesting();
+
+  // A line is inserted and a single counter changes.
+  RewriteFile(meminfo.fd(),
+              "Cached: 10 kB\n"
+              "Inserted: 1 kB\n"
+              "MemFree: 40 kB\n"
+              "MemTotal: 100 kB\n");
+  data_source->ReadSysStatsForTesting();
+
+  using KV = std::pair<int, uint64_t>;
+  std::vector<std::vector<KV>> polls;
+  for (const auto& packet : writer_raw_->GetAllTracePackets()) {
+    polls.emplace_back();
+    for (const auto& kv : packet.sys_stats().meminfo())
+      polls.back().push_back({kv.key(), kv.value()});
+  }
+  ASSERT_EQ(polls.size(), 3u);
+  EXPECT_THAT(polls[0], ElementsAre(KV{M::MEMINFO_MEM_TOTAL, 100},  //
+                                    KV{M::MEMINFO_MEM_FREE, 50},    //
+                                    KV{M::MEMINFO_CACHED, 10}));
+  EXPECT_THAT(polls[1], ElementsAre());
+  EXPECT_THAT(polls[2], ElementsAre(KV{M::MEMINFO_MEM_FREE, 40}));
+}
+
 TEST_F(SysStatsDataSourceTest, Vmstat) {
   using C = protos::gen::VmstatCounters;
   DataSourceConfig config;
@@ -550,6 +768,64 @@ TEST_F(SysStatsDataSourceTest, StatForksOnly) {
   ASSERT_EQ(sys_stats.num_softirq_size(), 0);
 }
 
+TEST_F(SysStatsDataSourceTest, ChangedCountersOnly) {
+  using C = protos::gen::MeminfoCounters;
+  base::TempFile meminfo = base::TempFile::CreateUnlinked();
+  g_mutable_meminfo_fd = meminfo.fd();
+  RewriteFile(meminfo.fd(), kMockMeminfo);
+
+  DataSourceConfig config;
+  protos::gen::SysStatsConfig sys_cfg;
+  sys_cfg.set_meminfo_period_ms(10);
+  sys_cfg.set_vmstat_period_ms(10);
+  sys_cfg.set_stat_period_ms(10);
+  sys_cfg.set_emit_changed_counters_only(true);
+  config.set_sys_stats_config_raw(sys_cfg.SerializeAsString());
+  auto data_source = GetSysStatsDataSource(config, MockOpenMutable);
+
+  data_source->ReadSysStatsForTesting();
+
+  std::string changed_meminfo = kMockMeminfo;
+  const char kMemFree[] = "MemFree:           73328 kB";
+  size_t pos = changed_meminfo.find(kMemFree);
+  ASSERT_NE(pos, std::string::npos);
+  changed_meminfo.replace(pos, strlen(kMemFree), "MemFree:           73329 kB");
+  RewriteFile(meminfo.fd(), changed_meminfo.c_str());
+  data_source->ReadSysStatsForTesting();
+
+  data_source->ClearIncrementalState();
+  data_source->ReadSysStatsForTesting();
+
+  auto packets = writer_raw_->GetAllTracePackets();
+  ASSERT_EQ(packets.size(), 3u);
+  const auto& first = packets[0].sys_stats();
+  EXPECT_GE(first.meminfo_size(), 10);
+  EXPECT_GE(first.vmstat_size(), 10);
+  EXPECT_EQ(first.num_irq_size(), 102);
+  EXPECT_EQ(first.num_softirq_size(), 10);
+
+  // Only the counter that changed is emitted. Per-CPU times and totals are
+  // always emitted.
+  const auto& second = packets[1].sys_stats();
+  ASSERT_EQ(second.meminfo_size(), 1);
+  EXPECT_EQ(second.meminfo()[0].key(), C::MEMINFO_MEM_FREE);
+  EXPECT_EQ(second.meminfo()[0].value(), 73329u);
+  EXPECT_EQ(second.vmstat_size(), 0);
+  EXPECT_EQ(second.num_irq_size(), 0);
+  EXPECT_EQ(second.num_softirq_size(), 0);
+  EXPECT_EQ(second.cpu_stat_size(), 8);
+  EXPECT_EQ(second.num_irq_total(), 238128517u);
+  EXPECT_EQ(second.num_softirq_total(), 84611084u);
+  EXPECT_EQ(second.num_forks(), 243320u);
+
+  // Clearing the incremental state emits all the counters again.
+  const auto& third = packets[2].sys_stats();
+  EXPECT_EQ(third.meminfo_size(), first.meminfo_size());
+  EXPECT_EQ(third.vmstat_size(), first.vmstat_size());
+  EXPECT_EQ(third.num_irq_size(), 102);
+  EXPECT_EQ(third.num_softirq_size(), 10);
+}
+
 TEST_F(SysStatsDataSourceTest, Cpufreq) {
   protos::gen::SysStatsConfig cfg;
   cfg.set_cpufreq_period_ms(10);
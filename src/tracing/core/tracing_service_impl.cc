@@ -2327,43 +2327,88 @@ bool TracingServiceImpl::WriteIntoFile(TracingSession* tracing_session,
                                 ? tracing_session->max_file_size_bytes
                                 : std::numeric_limits<size_t>::max();
 
-  size_t total_slices = 0;
-  for (const TracePacket& packet : packets) {
-    total_slices += packet.slices().size();
-  }
   // When writing into a file, the file should look like a root trace.proto
   // message. Each packet should be prepended with a proto preamble stating
-  // its field id (within trace.proto) and size. Hence the addition below.
-  const size_t max_iovecs = total_slices + packets.size();
+  // its field id (within trace.proto) and size.
+  //
+  // Most packets are small (tens to hundreds of bytes). Giving each of them
+  // (and each preamble) its own iovec means that a 1 MB read turns into tens
+  // of thousands of iovecs and, given the IOV_MAX limit, dozens of writev()
+  // calls. Instead preambles and small packets are copied into a contiguous
+  // staging buffer and only packets larger than kMaxCoalescedPacketSize are
+  // referenced in place from the TraceBuffer.
+  size_t staging_capacity = 0;
+  size_t num_large_slices = 0;
+  for (const TracePacket& packet : packets) {
+    staging_capacity += TracePacket::kMaxPreambleBytes;
+    if (packet.size() <= kMaxCoalescedPacketSize) {
+      staging_capacity += packet.size();
+    } else {
+      num_large_slices += packet.slices().size();
+    }
+  }
+  // Every packet contributes at most one staging run (its preamble, possibly
+  // merged with the previous small packets) plus, if large, its slices.
+  const size_t max_iovecs = packets.size() + num_large_slices;
 
   size_t num_iovecs = 0;
   bool stop_writing_into_file = false;
   std::unique_ptr<struct iovec[]> iovecs(new struct iovec[max_iovecs]);
+  std::unique_ptr<char[]> staging(new char[staging_capacity]);
+  size_t staging_size = 0;
+  size_t staging_run_start = 0;  // Start of the not yet emitted staging run.
+
+  // Closes the current staging run, if non-empty, and emits it as one iovec.
+  auto flush_staging_run = [&] {
+    if (staging_size == staging_run_start)
+      return;
+    iovecs[num_iovecs++] = {staging.get() + staging_run_start,
+                            staging_size - staging_run_start};
+    staging_run_start = staging_size;
+  };
+
   size_t num_iovecs_at_last_packet = 0;
+  size_t staging_size_at_last_packet = 0;
+  size_t staging_run_start_at_last_packet = 0;
   uint64_t bytes_about_to_be_written = 0;
   for (TracePacket& packet : packets) {
-    std::tie(iovecs[num_iovecs].iov_base, iovecs[num_iovecs].iov_len) =
-        packet.GetProtoPreamble();
-    bytes_about_to_be_written += iovecs[num_iovecs].iov_len;
-    num_iovecs++;
-    for (const Slice& slice : packet.slices()) {
-      // writev() doesn't change the passed pointer. However, struct iovec
-      // take a non-const ptr because it's the same struct used by readv().
-      // Hence the const_cast here.
-      char* start = static_cast<char*>(const_cast<void*>(slice.start));
-      bytes_about_to_be_written += slice.size;
-      iovecs[num_iovecs++] = {start, slice.size};
+    char* preamble;
+    size_t preamble_size;
+    std::tie(preamble, preamble_size) = packet.GetProtoPreamble();
+    memcpy(staging.get() + staging_size, preamble, preamble_size);
+    staging_size += preamble_size;
+    bytes_about_to_be_written += preamble_size + packet.size();
+
+    if (packet.size() <= kMaxCoalescedPacketSize) {
+      for (const Slice& slice : packet.slices()) {
+        memcpy(staging.get() + staging_size, slice.start, slice.size);
+        staging_size += slice.size;
+      }
+    } else {
+      flush_staging_run();
+      for (const Slice& slice : packet.slices()) {
+        // writev() doesn't change the passed pointer. However, struct iovec
+        // take a non-const ptr because it's the same struct used by readv().
+        // Hence the const_cast here.
+        char* start = static_cast<char*>(const_cast<void*>(slice.start));
+        iovecs[num_iovecs++] = {start, slice.size};
+      }
     }
 
     if (tracing_session->bytes_written_into_file + bytes_about_to_be_written >=
         max_size) {
       stop_writing_into_file = true;
       num_iovecs = num_iovecs_at_last_packet;
+      staging_size = staging_size_at_last_packet;
+      staging_run_start = staging_run_start_at_last_packet;
       break;
     }
 
     num_iovecs_at_last_packet = num_iovecs;
+    staging_size_at_last_packet = staging_size;
+    staging_run_start_at_last_packet = staging_run_start;
   }
+  flush_staging_run();
   PERFETTO_DCHECK(num_iovecs <= max_iovecs);
   int fd = *tracing_session->write_into_file;
 
@@ -2760,13 +2805,30 @@ void TracingServiceImpl::CopyProducerPageIntoLogBuffer(
     return;
   }
 
+  TraceBuffer* buf = GetTargetBufferForWriter(producer, writer_id, buffer_id);
+  if (!buf) {
+    chunks_discarded_++;
+    return;
+  }
+
+  buf->CopyChunkUntrusted(producer_id_trusted, producer_uid_trusted,
+                          producer_pid_trusted, writer_id, chunk_id,
+                          num_fragments, chunk_flags, chunk_complete, src,
+                          size);
+}
+
+TraceBuffer* TracingServiceImpl::GetTargetBufferForWriter(
+    ProducerEndpointImpl* producer,
+    WriterID writer_id,
+    BufferID buffer_id) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+
   TraceBuffer* buf = GetBufferByID(buffer_id);
   if (!buf) {
     PERFETTO_DLOG("Could not find target buffer %" PRIu16
                   " for producer %" PRIu16,
-                  buffer_id, producer_id_trusted);
-    chunks_discarded_++;
-    return;
+                  buffer_id, producer->id_);
+    return nullptr;
   }
 
   // Verify that the producer is actually allowed to write into the target
@@ -2776,10 +2838,9 @@ void TracingServiceImpl::CopyProducerPageIntoLogBuffer(
   if (!producer->is_allowed_target_buffer(buffer_id)) {
     PERFETTO_ELOG("Producer %" PRIu16
                   " tried to write into forbidden target buffer %" PRIu16,
-                  producer_id_trusted, buffer_id);
+                  producer->id_, buffer_id);
     PERFETTO_DFATAL("Forbidden target buffer");
-    chunks_discarded_++;
-    return;
+    return nullptr;
   }
 
   // If the writer was registered by the producer, it should only write into the
@@ -2790,17 +2851,11 @@ void TracingServiceImpl::CopyProducerPageIntoLogBuffer(
     PERFETTO_ELOG("Writer %" PRIu16 " of producer %" PRIu16
                   " was registered to write into target buffer %" PRIu16
                   ", but tried to write into buffer %" PRIu16,
-                  writer_id, producer_id_trusted, *associated_buffer,
-                  buffer_id);
+                  writer_id, producer->id_, *associated_buffer, buffer_id);
     PERFETTO_DFATAL("Wrong target buffer");
-    chunks_discarded_++;
-    return;
+    return nullptr;
   }
-
-  buf->CopyChunkUntrusted(producer_id_trusted, producer_uid_trusted,
-                          producer_pid_trusted, writer_id, chunk_id,
-                          num_fragments, chunk_flags, chunk_complete, src,
-                          size);
+  return buf;
 }
 
 void TracingServiceImpl::ApplyChunkPatches(
@@ -3871,6 +3926,16 @@ void TracingServiceImpl::ProducerEndpointImpl::CommitData(
     return;
   }
   PERFETTO_DCHECK(shmem_abi_.is_valid());
+
+  // A commit typically carries a run of chunks from the same writer, all
+  // targeting the same buffer. Resolve and validate the target buffer once per
+  // run rather than once per chunk. The set of buffers can't change while we
+  // are in here, so the cached pointer stays valid for the whole request.
+  TraceBuffer* cached_buf = nullptr;
+  BufferID cached_buffer_id = 0;
+  WriterID cached_writer_id = 0;
+  bool has_cached_target = false;
+
   for (const auto& entry : req_untrusted.chunks_to_move()) {
     const uint32_t page_idx = entry.page();
     if (page_idx >= shmem_abi_.num_pages())
@@ -3897,10 +3962,22 @@ void TracingServiceImpl::ProducerEndpointImpl::CommitData(
     uint16_t num_fragments = packets.count;
     uint8_t chunk_flags = packets.flags;
 
-    service_->CopyProducerPageIntoLogBuffer(
-        id_, uid_, pid_, writer_id, chunk_id, buffer_id, num_fragments,
-        chunk_flags,
-        /*chunk_complete=*/true, chunk.payload_begin(), chunk.payload_size());
+    if (!has_cached_target || buffer_id != cached_buffer_id ||
+        writer_id != cached_writer_id) {
+      cached_buf =
+          service_->GetTargetBufferForWriter(this, writer_id, buffer_id);
+      cached_buffer_id = buffer_id;
+      cached_writer_id = writer_id;
+      has_cached_target = true;
+    }
+
+    if (cached_buf) {
+      cached_buf->CopyChunkUntrusted(
+          id_, uid_, pid_, writer_id, chunk_id, num_fragments, chunk_flags,
+          /*chunk_complete=*/true, chunk.payload_begin(), chunk.payload_size());
+    } else {
+      service_->chunks_discarded_++;
+    }
 
     // This one has release-store semantics.
     shmem_abi_.ReleaseChunkAsFree(std::move(chunk));
@@ -89,6 +89,9 @@ class TracingServiceImpl : public TracingService {
   // buffers on each iteration when writing into a file. Since filtering
   // allocates memory, this limits the amount of memory allocated.
   static constexpr size_t kWriteIntoFileChunkSize = 1024 * 1024ul;
+  // Packets up to this size are copied into a contiguous staging buffer when
+  // writing into a file, rather than being passed to writev() in place.
+  static constexpr size_t kMaxCoalescedPacketSize = 1024;
 
   // The implementation behind the service endpoint exposed to each producer.
   class ProducerEndpointImpl : public TracingService::ProducerEndpoint {
@@ -277,6 +280,12 @@ class TracingServiceImpl : public TracingService {
                                      bool chunk_complete,
                                      const uint8_t* src,
                                      size_t size);
+  // Returns the buffer that |writer_id| of |producer| is allowed to copy chunks
+  // into, or nullptr if |buffer_id| doesn't exist or is not a valid target for
+  // that writer. Does not update |chunks_discarded_|, the caller must do so.
+  TraceBuffer* GetTargetBufferForWriter(ProducerEndpointImpl* producer,
+                                        WriterID writer_id,
+                                        BufferID buffer_id);
   void ApplyChunkPatches(ProducerID,
                          const std::vector<CommitDataRequest::ChunkToPatch>&);
   void NotifyFlushDoneForProducer(ProducerID, FlushRequestID);
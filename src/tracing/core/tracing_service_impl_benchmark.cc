@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/time.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "perfetto/ext/tracing/core/consumer.h"
+#include "perfetto/ext/tracing/core/producer.h"
+#include "perfetto/ext/tracing/core/trace_packet.h"
+#include "perfetto/ext/tracing/core/trace_writer.h"
+#include "perfetto/ext/tracing/core/tracing_service.h"
+#include "perfetto/tracing/core/data_source_config.h"
+#include "perfetto/tracing/core/data_source_descriptor.h"
+#include "perfetto/tracing/core/trace_config.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/tracing/test/test_shared_memory.h"
+
+#include "protos/perfetto/trace/test_event.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+
+namespace perfetto {
+namespace {
+
+constexpr char kDataSourceName[] = "perfetto.benchmark.data_source";
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+// A producer that does nothing but remember the target buffer of the data
+// source instance the service started on it. All writes go through the
+// in-process SharedMemoryArbiter, so commits reach the service through the
+// same CommitData() path used by out-of-process producers.
+class SyntheticProducer : public Producer {
+ public:
+  void Connect(TracingService* svc, uint32_t idx) {
+    endpoint_ = svc->ConnectProducer(
+        this, /*uid=*/1000 + idx, /*pid=*/static_cast<pid_t>(1000 + idx),
+        "synthetic_producer_" + std::to_string(idx),
+        /*shared_memory_size_hint_bytes=*/0, /*in_process=*/true);
+    DataSourceDescriptor desc;
+    desc.set_name(kDataSourceName);
+    endpoint_->RegisterDataSource(desc);
+  }
+
+  void CreateWriter() {
+    PERFETTO_CHECK(started_);
+    writer_ = endpoint_->CreateTraceWriter(target_buffer_);
+  }
+
+  void DestroyWriter() { writer_.reset(); }
+
+  void WriteBatch(const std::string& payload, size_t num_packets) {
+    for (size_t i = 0; i < num_packets; i++) {
+      auto packet = writer_->NewTracePacket();
+      packet->set_for_testing()->set_str(payload.data(), payload.size());
+    }
+    writer_->Flush();
+  }
+
+  // Producer implementation.
+  void OnConnect() override {}
+  void OnDisconnect() override {}
+  void OnTracingSetup() override {}
+  void SetupDataSource(DataSourceInstanceID,
+                       const DataSourceConfig&) override {}
+  void StartDataSource(DataSourceInstanceID,
+                       const DataSourceConfig& cfg) override {
+    target_buffer_ = static_cast<BufferID>(cfg.target_buffer());
+    started_ = true;
+  }
+  void StopDataSource(DataSourceInstanceID) override {}
+  void Flush(FlushRequestID, const DataSourceInstanceID*, size_t) override {}
+  void ClearIncrementalState(const DataSourceInstanceID*, size_t) override {}
+
+ private:
+  std::unique_ptr<TracingService::ProducerEndpoint> endpoint_;
+  std::unique_ptr<TraceWriter> writer_;
+  BufferID target_buffer_ = 0;
+  bool started_ = false;
+};
+
+class DiscardingConsumer : public Consumer {
+ public:
+  // Consumer implementation.
+  void OnConnect() override {}
+  void OnDisconnect() override {}
+  void OnTracingDisabled(const std::string&) override {}
+  void OnTraceData(std::vector<TracePacket> packets, bool) override {
+    for (const auto& packet : packets)
+      bytes_read_ += packet.size();
+  }
+  void OnDetach(bool) override {}
+  void OnAttach(bool, const TraceConfig&) override {}
+  void OnTraceStats(bool, const TraceStats&) override {}
+  void OnObservableEvents(const ObservableEvents&) override {}
+
+  uint64_t bytes_read() const { return bytes_read_; }
+
+ private:
+  uint64_t bytes_read_ = 0;
+};
+
+// Measures the service-side cost of moving data from N producers' SMBs into a
+// single central buffer and reading it back, without the IPC layer.
+// Args: {number of producers, packet size in bytes}.
+void BM_TracingService_CommitAndRead(benchmark::State& state) {
+  const uint32_t num_producers = static_cast<uint32_t>(state.range(0));
+  const size_t packet_size = static_cast<size_t>(state.range(1));
+  static constexpr size_t kPacketsPerBatch = 64;
+
+  base::TestTaskRunner task_runner;
+  std::unique_ptr<TracingService> svc = TracingService::CreateInstance(
+      std::unique_ptr<SharedMemory::Factory>(new TestSharedMemory::Factory()),
+      &task_runner);
+
+  std::vector<std::unique_ptr<SyntheticProducer>> producers;
+  for (uint32_t i = 0; i < num_producers; i++) {
+    producers.emplace_back(new SyntheticProducer());
+    producers.back()->Connect(svc.get(), i);
+  }
+
+  DiscardingConsumer consumer;
+  auto consumer_endpoint = svc->ConnectConsumer(&consumer, /*uid=*/0);
+  task_runner.RunUntilIdle();
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(
+      IsBenchmarkFunctionalOnly() ? 1024 : 64 * 1024);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name(kDataSourceName);
+  ds_config->set_target_buffer(0);
+  consumer_endpoint->EnableTracing(trace_config);
+  task_runner.RunUntilIdle();
+
+  for (auto& producer : producers)
+    producer->CreateWriter();
+  task_runner.RunUntilIdle();
+
+  const std::string payload(packet_size, 'x');
+  for (auto _ : state) {
+    for (auto& producer : producers)
+      producer->WriteBatch(payload, kPacketsPerBatch);
+    task_runner.RunUntilIdle();
+    consumer_endpoint->ReadBuffers();
+    task_runner.RunUntilIdle();
+  }
+
+  state.SetBytesProcessed(static_cast<int64_t>(consumer.bytes_read()));
+  state.counters["producers"] = benchmark::Counter(num_producers);
+
+  consumer_endpoint->DisableTracing();
+  task_runner.RunUntilIdle();
+  producers.clear();
+  task_runner.RunUntilIdle();
+}
+
+void CommitAndReadArgs(benchmark::internal::Benchmark* b) {
+  const int max_producers = IsBenchmarkFunctionalOnly() ? 2 : 256;
+  for (int producers = 1; producers <= max_producers; producers *= 4) {
+    b->Args({producers, 64});
+    b->Args({producers, 1024});
+  }
+}
+
+// Measures the CPU time the service spends draining a write_into_file
+// session into its file, per MB written. Each iteration fills the buffer with
+// ~8 MB of packets of the given size, then disables tracing: only the final
+// ReadBuffersIntoFile(), i.e. ReadBuffers() and WriteIntoFile(), is timed.
+// Args: {packet size in bytes}.
+void BM_TracingService_WriteIntoFile(benchmark::State& state) {
+  const size_t packet_size = static_cast<size_t>(state.range(0));
+  const size_t bytes_per_session =
+      (IsBenchmarkFunctionalOnly() ? 1 : 8) * 1024 * 1024;
+  // Keeps each batch well within the SMB, as commits are only processed
+  // between batches.
+  const size_t packets_per_batch =
+      std::max<size_t>(1, 64 * 1024 / packet_size);
+
+  base::TestTaskRunner task_runner;
+  std::unique_ptr<TracingService> svc = TracingService::CreateInstance(
+      std::unique_ptr<SharedMemory::Factory>(new TestSharedMemory::Factory()),
+      &task_runner);
+  SyntheticProducer producer;
+  producer.Connect(svc.get(), 0);
+  DiscardingConsumer consumer;
+  auto consumer_endpoint = svc->ConnectConsumer(&consumer, /*uid=*/0);
+  task_runner.RunUntilIdle();
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(
+      static_cast<uint32_t>(bytes_per_session * 2 / 1024));
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name(kDataSourceName);
+  ds_config->set_target_buffer(0);
+  trace_config.set_write_into_file(true);
+  trace_config.set_file_write_period_ms(24 * 3600 * 1000);
+
+  base::TempFile file = base::TempFile::Create();
+  const std::string payload(packet_size, 'x');
+  uint64_t bytes_written = 0;
+  int64_t cpu_ns = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    PERFETTO_CHECK(ftruncate(file.fd(), 0) == 0);
+    PERFETTO_CHECK(lseek(file.fd(), 0, SEEK_SET) == 0);
+    consumer_endpoint->EnableTracing(trace_config,
+                                     base::ScopedFile(dup(file.fd())));
+    task_runner.RunUntilIdle();
+    producer.CreateWriter();
+    for (size_t written = 0; written < bytes_per_session;
+         written += packets_per_batch * packet_size) {
+      producer.WriteBatch(payload, packets_per_batch);
+      task_runner.RunUntilIdle();
+    }
+    producer.DestroyWriter();
+    task_runner.RunUntilIdle();
+    state.ResumeTiming();
+
+    base::TimeNanos cpu_start = base::GetThreadCPUTimeNs();
+    consumer_endpoint->DisableTracing();
+    task_runner.RunUntilIdle();
+    cpu_ns += (base::GetThreadCPUTimeNs() - cpu_start).count();
+
+    state.PauseTiming();
+    struct stat st;
+    PERFETTO_CHECK(fstat(file.fd(), &st) == 0);
+    bytes_written += static_cast<uint64_t>(st.st_size);
+    consumer_endpoint->FreeBuffers();
+    task_runner.RunUntilIdle();
+    state.ResumeTiming();
+  }
+
+  state.SetBytesProcessed(static_cast<int64_t>(bytes_written));
+  state.counters["cpu_us_per_mb"] = benchmark::Counter(
+      static_cast<double>(cpu_ns) / 1000 /
+      (static_cast<double>(bytes_written) / (1024 * 1024)));
+}
+
+}  // namespace
+
+BENCHMARK(BM_TracingService_WriteIntoFile)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(64)
+    ->Arg(512)
+    ->Arg(4096)
+    ->Arg(64 * 1024);
+
+BENCHMARK(BM_TracingService_CommitAndRead)
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime()
+    ->Apply(CommitAndReadArgs);
+
+}  // namespace perfetto
@@ -33,6 +33,7 @@
 #include "src/base/test/test_task_runner.h"
 #include "src/protozero/filtering/filter_bytecode_generator.h"
 #include "src/tracing/core/shared_memory_arbiter_impl.h"
+#include "src/tracing/core/trace_buffer.h"
 #include "src/tracing/core/trace_writer_impl.h"
 #include "src/tracing/test/mock_consumer.h"
 #include "src/tracing/test/mock_producer.h"
@@ -66,6 +67,7 @@ using ::testing::Property;
 using ::testing::StrictMock;
 using ::testing::StringMatchResultListener;
 using ::testing::StrNe;
+using ::testing::UnorderedElementsAre;
 
 namespace perfetto {
 
@@ -151,6 +153,33 @@ class TracingServiceImplTest : public testing::Test {
     return svc->GetProducer(producer_id)->writers_;
   }
 
+  // Reads the TestEvent strings of the packets of |buffer_id| directly from
+  // its TraceBuffer, so that it's possible to tell which buffer they were
+  // committed into.
+  std::vector<std::string> ReadTestStringsFromBuffer(BufferID buffer_id) {
+    std::vector<std::string> strs;
+    TraceBuffer* buf = svc->GetBufferByID(buffer_id);
+    EXPECT_NE(nullptr, buf);
+    if (!buf)
+      return strs;
+    buf->BeginRead();
+    for (;;) {
+      TracePacket packet;
+      TraceBuffer::PacketSequenceProperties sequence_properties{};
+      bool previous_packet_dropped;
+      if (!buf->ReadNextTracePacket(&packet, &sequence_properties,
+                                    &previous_packet_dropped)) {
+        return strs;
+      }
+      protos::gen::TracePacket decoded;
+      EXPECT_TRUE(decoded.ParseFromString(packet.GetRawBytesForTesting()));
+      if (decoded.has_for_testing())
+        strs.push_back(decoded.for_testing().str());
+    }
+  }
+
+  uint64_t chunks_discarded() const { return svc->chunks_discarded_; }
+
   std::unique_ptr<SharedMemoryArbiterImpl> TakeShmemArbiterForProducer(
       ProducerID producer_id) {
     return std::move(svc->GetProducer(producer_id)->inproc_shmem_arbiter_);
@@ -1733,6 +1762,62 @@ TEST_F(TracingServiceImplTest, WriteIntoFileWithPath) {
                   Property(&protos::gen::TestEvent::str, Eq("payload")))));
 }
 
+// Interleaves packets below and above kMaxCoalescedPacketSize, to check that
+// the staged (copied) and in-place parts of the writev() are stitched back in
+// the right order.
+TEST_F(TracingServiceImplTest, WriteIntoFileMixedPacketSizes) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  trace_config.set_write_into_file(true);
+  trace_config.set_file_write_period_ms(100000);  // 100s
+  base::TempFile tmp_file = base::TempFile::Create();
+  consumer->EnableTracing(trace_config, base::ScopedFile(dup(tmp_file.fd())));
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  std::vector<std::string> payloads;
+  for (size_t i = 0; i < 32; i++) {
+    size_t size = (i % 3 == 0)
+                      ? TracingServiceImpl::kMaxCoalescedPacketSize * 4 + i
+                      : 10 + i;
+    payloads.emplace_back(size, static_cast<char>('a' + i % 26));
+    auto tp = writer->NewTracePacket();
+    tp->set_for_testing()->set_str(payloads.back());
+  }
+  writer->Flush();
+  writer.reset();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  std::string trace_raw;
+  ASSERT_TRUE(base::ReadFile(tmp_file.path().c_str(), &trace_raw));
+  protos::gen::Trace trace;
+  ASSERT_TRUE(trace.ParseFromString(trace_raw));
+
+  std::vector<std::string> actual_payloads;
+  for (const auto& packet : trace.packet()) {
+    if (packet.has_for_testing())
+      actual_payloads.push_back(packet.for_testing().str());
+  }
+  EXPECT_THAT(actual_payloads, ElementsAreArray(payloads));
+}
+
 TEST_F(TracingServiceImplTest, WriteIntoFileFilterMultipleChunks) {
   static const size_t kNumTestPackets = 5;
   static const size_t kPayloadSize = 500 * 1024UL;
@@ -2808,6 +2893,95 @@ TEST_F(TracingServiceImplTest, RegisterAndUnregisterTraceWriter) {
                                                   Eq("payload")))));
 }
 
+// CommitData() caches the target buffer of the last writer it looked up.
+// Checks that chunks of writers that target different buffers, interleaved in
+// the same commit, land in the right buffer, and that the cache doesn't
+// outlive the writers and buffers it was filled from.
+TEST_F(TracingServiceImplTest, CommitDataToInterleavedTargetBuffers) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  ProducerID producer_id = *last_producer_id();
+  producer->RegisterDataSource("data_source1");
+  producer->RegisterDataSource("data_source2");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  trace_config.add_buffers()->set_size_kb(128);
+  auto* ds_config1 = trace_config.add_data_sources()->mutable_config();
+  ds_config1->set_name("data_source1");
+  ds_config1->set_target_buffer(0);
+  auto* ds_config2 = trace_config.add_data_sources()->mutable_config();
+  ds_config2->set_name("data_source2");
+  ds_config2->set_target_buffer(1);
+  consumer->EnableTracing(trace_config);
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source1");
+  producer->WaitForDataSourceSetup("data_source2");
+  producer->WaitForDataSourceStart("data_source1");
+  producer->WaitForDataSourceStart("data_source2");
+
+  const BufferID buf0 = tracing_session()->buffers_index[0];
+  const BufferID buf1 = tracing_session()->buffers_index[1];
+  std::unique_ptr<TraceWriter> writer0 =
+      producer->endpoint()->CreateTraceWriter(buf0);
+  std::unique_ptr<TraceWriter> writer1 =
+      producer->endpoint()->CreateTraceWriter(buf1);
+  WaitForTraceWritersChanged(producer_id);
+
+  // The packets are bigger than a chunk, so that the chunks of the two writers
+  // alternate in the commit sent by the flush below.
+  std::vector<std::string> expected0;
+  std::vector<std::string> expected1;
+  for (int i = 0; i < 3; i++) {
+    expected0.push_back("buf0_" + std::to_string(i) + std::string(6000, 'a'));
+    writer0->NewTracePacket()->set_for_testing()->set_str(expected0.back());
+    expected1.push_back("buf1_" + std::to_string(i) + std::string(6000, 'b'));
+    writer1->NewTracePacket()->set_for_testing()->set_str(expected1.back());
+  }
+
+  auto flush_request = consumer->Flush();
+  producer->WaitForFlush({writer0.get(), writer1.get()});
+  ASSERT_TRUE(flush_request.WaitForReply());
+  EXPECT_EQ(0u, chunks_discarded());
+
+  EXPECT_THAT(ReadTestStringsFromBuffer(buf0), ElementsAreArray(expected0));
+  EXPECT_THAT(ReadTestStringsFromBuffer(buf1), ElementsAreArray(expected1));
+
+  // Replace the writer of buffer 1 with one for buffer 0: its chunks must go
+  // to buffer 0, regardless of what was looked up for the previous writer.
+  writer1.reset();
+  WaitForTraceWritersChanged(producer_id);
+  writer1 = producer->endpoint()->CreateTraceWriter(buf0);
+  WaitForTraceWritersChanged(producer_id);
+  writer1->NewTracePacket()->set_for_testing()->set_str("new_writer");
+  writer0->NewTracePacket()->set_for_testing()->set_str("old_writer");
+
+  flush_request = consumer->Flush();
+  producer->WaitForFlush({writer0.get(), writer1.get()});
+  ASSERT_TRUE(flush_request.WaitForReply());
+  EXPECT_EQ(0u, chunks_discarded());
+  EXPECT_THAT(ReadTestStringsFromBuffer(buf0),
+              UnorderedElementsAre("new_writer", "old_writer"));
+  EXPECT_THAT(ReadTestStringsFromBuffer(buf1), IsEmpty());
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source1");
+  producer->WaitForDataSourceStop("data_source2");
+  consumer->WaitForTracingDisabled();
+  consumer->FreeBuffers();
+
+  // The buffers are gone: the chunks committed from now on are discarded.
+  writer0->NewTracePacket()->set_for_testing()->set_str("after_free");
+  auto writer_flushed = task_runner.CreateCheckpoint("writer_flushed");
+  writer0->Flush(writer_flushed);
+  task_runner.RunUntilCheckpoint("writer_flushed");
+  EXPECT_EQ(1u, chunks_discarded());
+}
+
 TEST_F(TracingServiceImplTest, ScrapeBuffersOnFlush) {
   svc->SetSMBScrapingEnabled(true);
 